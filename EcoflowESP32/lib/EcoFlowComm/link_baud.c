@@ -0,0 +1,376 @@
+#include "link_baud.h"
+#include <string.h>
+
+#define LINK_BAUD_COMMIT_TRIES 3
+
+static const uint32_t ladder[LINK_BAUD_STEPS] = LINK_BAUD_LADDER;
+
+static int ladder_index(uint32_t baud) {
+    for (int i = 0; i < LINK_BAUD_STEPS; i++) {
+        if (ladder[i] == baud) return i;
+    }
+    return -1;
+}
+
+static void set_state(LinkBaudCtx *ctx, LinkBaudState state, uint32_t now_us) {
+    ctx->state = state;
+    ctx->state_since_us = now_us;
+}
+
+static void send_baud_msg(LinkBaudCtx *ctx, uint8_t cmd, uint32_t baud, uint8_t flag) {
+    uint8_t buf[16];
+    int len = pack_link_baud_message(buf, cmd, baud, flag);
+    ctx->ops.send(ctx->ops.user, buf, len);
+}
+
+static void send_ping(LinkBaudCtx *ctx, uint8_t cmd, uint16_t seq, uint32_t ts, uint8_t pad) {
+    uint8_t buf[MAX_PAYLOAD_LEN + 4];
+    int len = pack_link_ping_message(buf, cmd, seq, ts, pad);
+    ctx->ops.send(ctx->ops.user, buf, len);
+}
+
+static uint8_t framing_flag(uint8_t framing) {
+    return framing == LINK_FRAMING_COBS ? LINK_BAUD_FLAG_COBS : 0;
+}
+
+static void switch_baud(LinkBaudCtx *ctx, uint32_t baud, uint8_t framing, uint32_t now_us) {
+    if (baud == ctx->cur_baud && framing == ctx->cur_framing) return;
+    ctx->ops.set_baud(ctx->ops.user, baud, framing);
+    ctx->cur_baud = baud;
+    ctx->cur_framing = framing;
+    ctx->err_count = 0;
+    // Give the peer a full silence window at the new rate
+    ctx->last_rx_us = now_us;
+    ctx->last_keepalive_us = now_us;
+}
+
+// --- Ping runs ---
+
+static void start_probe(LinkBaudCtx *ctx, uint16_t count, uint8_t pad, uint8_t window,
+                        LinkBaudState state, uint32_t now_us) {
+    memset(&ctx->probe, 0, sizeof(ctx->probe));
+    ctx->probe.baud = ctx->cur_baud;
+    ctx->probe.rtt_min_us = UINT32_MAX;
+    ctx->probe.start_us = now_us;
+    ctx->probe_first_seq = ctx->next_seq;
+    ctx->probe_count = count;
+    ctx->probe_pad = pad;
+    ctx->probe_window = window ? window : 1;
+    ctx->in_flight = 0;
+    ctx->last_progress_us = now_us;
+    set_state(ctx, state, now_us);
+}
+
+static void probe_pump(LinkBaudCtx *ctx, uint32_t now_us) {
+    while (ctx->in_flight < ctx->probe_window && ctx->probe.sent < ctx->probe_count) {
+        send_ping(ctx, CMD_LINK_PING, ctx->next_seq++, now_us, ctx->probe_pad);
+        ctx->probe.sent++;
+        ctx->in_flight++;
+    }
+}
+
+static void finish_probe(LinkBaudCtx *ctx, uint32_t now_us) {
+    ctx->probe.end_us = now_us;
+    if (ctx->probe.received == 0) ctx->probe.rtt_min_us = 0;
+    ctx->last_result = ctx->probe;
+}
+
+// --- Master steps ---
+
+static void request_baud(LinkBaudCtx *ctx, uint32_t baud, uint32_t now_us) {
+    ctx->target_baud = baud;
+    // The base rate stays legacy so a freshly booted peer can always be reached
+    ctx->target_framing = (baud == LINK_BAUD_BASE) ? LINK_FRAMING_LEGACY : ctx->framing_pref;
+    send_baud_msg(ctx, CMD_LINK_BAUD_REQ, baud, framing_flag(ctx->target_framing));
+    set_state(ctx, LB_WAIT_ACK, now_us);
+}
+
+static void start_commit(LinkBaudCtx *ctx, uint32_t now_us) {
+    send_baud_msg(ctx, CMD_LINK_BAUD_COMMIT, ctx->cur_baud, framing_flag(ctx->cur_framing));
+    ctx->commit_tries = 1;
+    ctx->last_commit_tx_us = now_us;
+    set_state(ctx, LB_COMMIT, now_us);
+}
+
+/**
+ * @brief The candidate rate did not qualify: cap the ladder below it and go
+ * back to the committed rate. The slave reverts on its own when probation ends.
+ */
+static void fail_step(LinkBaudCtx *ctx, uint32_t now_us) {
+    int idx = ladder_index(ctx->target_baud);
+    if (idx > 0 && idx - 1 < ctx->ceiling) ctx->ceiling = idx - 1;
+    ctx->auto_step = false;
+    switch_baud(ctx, ctx->committed_baud, ctx->committed_framing, now_us);
+    set_state(ctx, LB_HOLDOFF, now_us);
+}
+
+// --- Public API ---
+
+void link_baud_init(LinkBaudCtx *ctx, LinkRole role, const LinkBaudOps *ops, uint32_t now_us) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->role = role;
+    ctx->ops = *ops;
+    ctx->ceiling = LINK_BAUD_STEPS - 1;
+    ctx->framing_pref = LINK_FRAMING_COBS;
+    link_baud_reset(ctx, now_us);
+}
+
+void link_baud_reset(LinkBaudCtx *ctx, uint32_t now_us) {
+    ctx->cur_baud = LINK_BAUD_BASE;
+    ctx->committed_baud = LINK_BAUD_BASE;
+    ctx->target_baud = LINK_BAUD_BASE;
+    ctx->cur_framing = LINK_FRAMING_LEGACY;
+    ctx->committed_framing = LINK_FRAMING_LEGACY;
+    ctx->target_framing = LINK_FRAMING_LEGACY;
+    ctx->auto_step = false;
+    ctx->err_count = 0;
+    ctx->in_flight = 0;
+    ctx->last_rx_us = now_us;
+    ctx->last_keepalive_us = now_us;
+    set_state(ctx, LB_IDLE, now_us);
+}
+
+bool link_baud_negotiate(LinkBaudCtx *ctx, uint32_t now_us) {
+    if (ctx->role != LINK_ROLE_MASTER || ctx->state != LB_IDLE) return false;
+    int idx = ladder_index(ctx->cur_baud);
+    if (idx < 0 || idx + 1 > ctx->ceiling) {
+        ctx->auto_step = false;
+        return false;
+    }
+    ctx->auto_step = true;
+    request_baud(ctx, ladder[idx + 1], now_us);
+    return true;
+}
+
+bool link_baud_selftest(LinkBaudCtx *ctx, uint16_t count, uint8_t pad, uint32_t now_us) {
+    if (ctx->role != LINK_ROLE_MASTER || ctx->state != LB_IDLE || count == 0) return false;
+    start_probe(ctx, count, pad, LINK_BAUD_PROBE_WINDOW, LB_SELFTEST, now_us);
+    probe_pump(ctx, now_us);
+    return true;
+}
+
+bool link_baud_on_frame(LinkBaudCtx *ctx, const uint8_t *frame, uint32_t now_us) {
+    ctx->last_rx_us = now_us;
+    uint8_t cmd = frame[1];
+
+    if (cmd == CMD_LINK_PING) {
+        uint16_t seq;
+        uint32_t ts;
+        int pad = unpack_link_ping_message(frame, &seq, &ts);
+        if (pad >= 0) send_ping(ctx, CMD_LINK_PONG, seq, ts, (uint8_t)pad);
+        return true;
+    }
+
+    if (cmd == CMD_LINK_PONG) {
+        uint16_t seq;
+        uint32_t ts;
+        if (ctx->role != LINK_ROLE_MASTER) return true;
+        if (ctx->state != LB_PROBE && ctx->state != LB_SELFTEST) return true; // Keepalive echo
+        if (unpack_link_ping_message(frame, &seq, &ts) < 0) return true;
+        // Ignore echoes of pings already written off as lost
+        if ((uint16_t)(seq - ctx->probe_first_seq) >= (uint16_t)(ctx->next_seq - ctx->probe_first_seq)) return true;
+
+        uint32_t rtt = now_us - ts;
+        ctx->probe.received++;
+        ctx->probe.bytes += 4 + frame[2];
+        ctx->probe.rtt_sum_us += rtt;
+        if (rtt < ctx->probe.rtt_min_us) ctx->probe.rtt_min_us = rtt;
+        if (rtt > ctx->probe.rtt_max_us) ctx->probe.rtt_max_us = rtt;
+        if (ctx->in_flight > 0) ctx->in_flight--;
+        ctx->last_progress_us = now_us;
+        probe_pump(ctx, now_us);
+        return true;
+    }
+
+    if (cmd == CMD_LINK_BAUD_REQ) {
+        uint32_t baud;
+        uint8_t flag;
+        if (ctx->role != LINK_ROLE_SLAVE || unpack_link_baud_message(frame, &baud, &flag) != 0) return true;
+        int idx = ladder_index(baud);
+        if (idx < 0 || idx > ctx->ceiling) {
+            send_baud_msg(ctx, CMD_LINK_BAUD_ACK, baud, LINK_BAUD_REJECTED);
+            return true;
+        }
+        uint8_t framing = ((flag & LINK_BAUD_FLAG_COBS) && ctx->framing_pref == LINK_FRAMING_COBS &&
+                           baud != LINK_BAUD_BASE) ? LINK_FRAMING_COBS : LINK_FRAMING_LEGACY;
+        // The ACK goes out at the old rate; set_baud waits for it to drain.
+        send_baud_msg(ctx, CMD_LINK_BAUD_ACK, baud, LINK_BAUD_ACCEPTED | framing_flag(framing));
+        switch_baud(ctx, baud, framing, now_us);
+        set_state(ctx, LB_PROBATION, now_us);
+        return true;
+    }
+
+    if (cmd == CMD_LINK_BAUD_COMMIT) {
+        uint32_t baud;
+        uint8_t flag;
+        if (ctx->role != LINK_ROLE_SLAVE || unpack_link_baud_message(frame, &baud, &flag) != 0) return true;
+        if (baud != ctx->cur_baud) return true;
+        ctx->committed_baud = baud;
+        ctx->committed_framing = ctx->cur_framing;
+        send_baud_msg(ctx, CMD_LINK_BAUD_ACK, baud, LINK_BAUD_COMMITTED | framing_flag(ctx->cur_framing));
+        set_state(ctx, LB_IDLE, now_us);
+        return true;
+    }
+
+    if (cmd == CMD_LINK_BAUD_ACK) {
+        uint32_t baud;
+        uint8_t flag;
+        if (ctx->role != LINK_ROLE_MASTER || unpack_link_baud_message(frame, &baud, &flag) != 0) return true;
+        uint8_t status = flag & ~LINK_BAUD_FLAG_COBS;
+
+        if (ctx->state == LB_WAIT_ACK && baud == ctx->target_baud) {
+            if (status == LINK_BAUD_ACCEPTED) {
+                // A peer without COBS support answers without the flag
+                uint8_t framing = ((flag & LINK_BAUD_FLAG_COBS) && ctx->target_framing == LINK_FRAMING_COBS)
+                                  ? LINK_FRAMING_COBS : LINK_FRAMING_LEGACY;
+                switch_baud(ctx, baud, framing, now_us);
+                // The base rate is always supported, no need to qualify it
+                if (baud == LINK_BAUD_BASE) start_commit(ctx, now_us);
+                else set_state(ctx, LB_SETTLE, now_us);
+            } else {
+                int idx = ladder_index(baud);
+                if (idx > 0 && idx - 1 < ctx->ceiling) ctx->ceiling = idx - 1;
+                ctx->auto_step = false;
+                set_state(ctx, LB_IDLE, now_us);
+            }
+        } else if (ctx->state == LB_COMMIT && status == LINK_BAUD_COMMITTED && baud == ctx->cur_baud) {
+            ctx->committed_baud = baud;
+            ctx->committed_framing = ctx->cur_framing;
+            set_state(ctx, LB_IDLE, now_us);
+            if (ctx->auto_step) link_baud_negotiate(ctx, now_us);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void link_baud_on_error(LinkBaudCtx *ctx, uint32_t now_us) {
+    if (ctx->state == LB_PROBE || ctx->state == LB_SELFTEST) {
+        ctx->probe.errors++;
+        return;
+    }
+    if (ctx->role != LINK_ROLE_MASTER || ctx->state != LB_IDLE || ctx->cur_baud == LINK_BAUD_BASE) return;
+
+    if (ctx->err_count == 0 || now_us - ctx->err_window_us > LINK_BAUD_ERR_WINDOW_US) {
+        ctx->err_window_us = now_us;
+        ctx->err_count = 0;
+    }
+    if (++ctx->err_count < LINK_BAUD_ERR_LIMIT) return;
+
+    // Too many errors at this rate: never try it again, drop to the base rate
+    // and climb back up to the new ceiling with fresh probes.
+    int idx = ladder_index(ctx->cur_baud);
+    if (idx > 0 && idx - 1 < ctx->ceiling) ctx->ceiling = idx - 1;
+    ctx->auto_step = true;
+    request_baud(ctx, LINK_BAUD_BASE, now_us);
+}
+
+void link_baud_tick(LinkBaudCtx *ctx, uint32_t now_us) {
+    uint32_t in_state = now_us - ctx->state_since_us;
+
+    switch (ctx->state) {
+        case LB_IDLE:
+            if (ctx->cur_baud == LINK_BAUD_BASE) break;
+            if (now_us - ctx->last_rx_us > LINK_BAUD_SILENCE_US) {
+                // Peer reset or the link is unusable at this rate
+                switch_baud(ctx, LINK_BAUD_BASE, LINK_FRAMING_LEGACY, now_us);
+                ctx->committed_baud = LINK_BAUD_BASE;
+                ctx->committed_framing = LINK_FRAMING_LEGACY;
+                break;
+            }
+            if (ctx->role == LINK_ROLE_MASTER && now_us - ctx->last_keepalive_us >= LINK_BAUD_KEEPALIVE_US) {
+                send_ping(ctx, CMD_LINK_PING, ctx->next_seq++, now_us, 0);
+                ctx->last_keepalive_us = now_us;
+            }
+            break;
+
+        case LB_WAIT_ACK:
+            // The slave may have switched and lost only the ACK: wait it out
+            if (in_state > LINK_BAUD_ACK_TIMEOUT_US) {
+                ctx->auto_step = false;
+                set_state(ctx, LB_HOLDOFF, now_us);
+            }
+            break;
+
+        case LB_SETTLE:
+            if (in_state >= LINK_BAUD_SETTLE_US) {
+                start_probe(ctx, LINK_BAUD_PROBE_PINGS, LINK_BAUD_PROBE_PAD, LINK_BAUD_PROBE_WINDOW, LB_PROBE, now_us);
+                probe_pump(ctx, now_us);
+            }
+            break;
+
+        case LB_PROBE:
+        case LB_SELFTEST:
+            if (ctx->in_flight > 0 && now_us - ctx->last_progress_us > LINK_PING_TIMEOUT_US) {
+                ctx->probe.lost += ctx->in_flight;
+                ctx->in_flight = 0;
+                ctx->probe_first_seq = ctx->next_seq;
+                ctx->last_progress_us = now_us;
+            }
+            if (ctx->state == LB_PROBE && (ctx->probe.lost || ctx->probe.errors)) {
+                finish_probe(ctx, now_us);
+                fail_step(ctx, now_us);
+                break;
+            }
+            probe_pump(ctx, now_us);
+            if (ctx->probe.sent >= ctx->probe_count && ctx->in_flight == 0) {
+                finish_probe(ctx, now_us);
+                if (ctx->state == LB_SELFTEST) set_state(ctx, LB_IDLE, now_us);
+                else start_commit(ctx, now_us);
+            }
+            break;
+
+        case LB_COMMIT:
+            if (now_us - ctx->last_commit_tx_us > LINK_BAUD_COMMIT_RETRY_US) {
+                if (ctx->commit_tries >= LINK_BAUD_COMMIT_TRIES) {
+                    fail_step(ctx, now_us);
+                } else {
+                    send_baud_msg(ctx, CMD_LINK_BAUD_COMMIT, ctx->cur_baud, framing_flag(ctx->cur_framing));
+                    ctx->commit_tries++;
+                    ctx->last_commit_tx_us = now_us;
+                }
+            }
+            break;
+
+        case LB_HOLDOFF:
+            if (in_state > LINK_BAUD_PROBATION_US + LINK_BAUD_ACK_TIMEOUT_US) {
+                set_state(ctx, LB_IDLE, now_us);
+            }
+            break;
+
+        case LB_PROBATION:
+            if (in_state > LINK_BAUD_PROBATION_US) {
+                switch_baud(ctx, ctx->committed_baud, ctx->committed_framing, now_us);
+                set_state(ctx, LB_IDLE, now_us);
+            }
+            break;
+    }
+}
+
+uint32_t link_baud_current(const LinkBaudCtx *ctx) {
+    return ctx->cur_baud;
+}
+
+uint8_t link_baud_framing(const LinkBaudCtx *ctx) {
+    return ctx->cur_framing;
+}
+
+void link_baud_set_framing_pref(LinkBaudCtx *ctx, uint8_t framing) {
+    ctx->framing_pref = framing;
+}
+
+void link_baud_set_max(LinkBaudCtx *ctx, uint32_t baud) {
+    ctx->ceiling = 0;
+    for (int i = 1; i < LINK_BAUD_STEPS; i++) {
+        if (ladder[i] <= baud) ctx->ceiling = (int8_t)i;
+    }
+}
+
+bool link_baud_busy(const LinkBaudCtx *ctx) {
+    return ctx->state != LB_IDLE;
+}
+
+const LinkProbeStats *link_baud_last_result(const LinkBaudCtx *ctx) {
+    return &ctx->last_result;
+}
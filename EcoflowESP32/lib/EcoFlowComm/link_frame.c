@@ -0,0 +1,60 @@
+#include "link_frame.h"
+
+void link_parser_init(LinkFrameParser *p) {
+    link_parser_set_framing(p, LINK_FRAMING_LEGACY);
+}
+
+void link_parser_set_framing(LinkFrameParser *p, uint8_t framing) {
+    p->idx = 0;
+    p->frame_len = 0;
+    p->expected = 0;
+    p->overflow = false;
+    p->framing = framing;
+}
+
+static LinkParseResult feed_cobs(LinkFrameParser *p, uint8_t b) {
+    if (b != 0x00) {
+        if (p->idx >= sizeof(p->raw) - 1) p->overflow = true;
+        else p->raw[p->idx++] = b;
+        return LINK_PARSE_NONE;
+    }
+
+    uint16_t len = p->idx;
+    bool overflow = p->overflow;
+    p->idx = 0;
+    p->overflow = false;
+    if (len == 0) return LINK_PARSE_NONE;   // Back-to-back delimiters
+    if (overflow) return LINK_PARSE_CRC_ERROR;
+
+    int n = unpack_cobs_frame(p->raw, len, p->buf);
+    if (n < 0) return LINK_PARSE_CRC_ERROR;
+    p->frame_len = (uint16_t)n;
+    return LINK_PARSE_FRAME;
+}
+
+LinkParseResult link_parser_feed(LinkFrameParser *p, uint8_t b) {
+    if (p->framing == LINK_FRAMING_COBS) return feed_cobs(p, b);
+
+    if (p->idx == 0) {
+        // Hunting for the start of a frame
+        if (b == START_BYTE) p->buf[p->idx++] = b;
+        return LINK_PARSE_NONE;
+    }
+
+    p->buf[p->idx++] = b;
+    if (p->idx == 3) {
+        p->expected = b;
+        return LINK_PARSE_NONE;
+    }
+    if (p->idx < 4 || p->idx < (uint16_t)(4 + p->expected)) {
+        return LINK_PARSE_NONE;
+    }
+
+    uint16_t len = p->idx;
+    p->idx = 0;
+    if (calculate_crc8(&p->buf[1], 2 + p->expected) != p->buf[len - 1]) {
+        return LINK_PARSE_CRC_ERROR;
+    }
+    p->frame_len = len;
+    return LINK_PARSE_FRAME;
+}
@@ -0,0 +1,237 @@
+#include "link_txq.h"
+#include <string.h>
+
+// Attempts to make room in a drop-oldest ring before giving up on a push.
+// Only reached when other producers keep refilling the ring concurrently.
+#define LINK_TXQ_EVICT_RETRIES 4
+
+static void ring_init(LinkTxRing *r, LinkTxCell *cells, uint32_t depth, LinkOverflowPolicy policy) {
+    for (uint32_t i = 0; i < depth; i++) {
+        cells[i].seq = i;
+        cells[i].len = 0;
+    }
+    r->cells = cells;
+    r->mask = depth - 1;
+    r->head = 0;
+    r->tail = 0;
+    r->policy = policy;
+    memset(&r->stats, 0, sizeof(r->stats));
+}
+
+/**
+ * @brief Claims a free cell and fills it.
+ * @return true on success, false if the ring is full.
+ */
+static bool ring_put(LinkTxRing *r, const uint8_t *frame, uint16_t len, uint32_t now_us) {
+    uint32_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    LinkTxCell *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(cell->data, frame, len);
+    cell->len = len;
+    cell->enqueued_at = now_us;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Length of the oldest filled cell without taking it, 0 if empty.
+ */
+static int ring_peek_len(const LinkTxRing *r) {
+    uint32_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    const LinkTxCell *cell = &r->cells[pos & r->mask];
+    uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    if (seq != pos + 1) return 0;
+    return cell->len;
+}
+
+/**
+ * @brief Takes the oldest filled cell.
+ * @param out Destination buffer, or NULL to discard the frame.
+ * @param enqueued_at Optional, receives the enqueue timestamp.
+ * @return Frame length, or 0 if the ring is empty.
+ */
+static int ring_take(LinkTxRing *r, uint8_t *out, uint32_t *enqueued_at) {
+    uint32_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    LinkTxCell *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        uint32_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    int len = cell->len;
+    if (out) memcpy(out, cell->data, len);
+    if (enqueued_at) *enqueued_at = cell->enqueued_at;
+    __atomic_store_n(&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return len;
+}
+
+void link_txq_init(LinkTxQueue *q) {
+    ring_init(&q->rings[LINK_PRIO_CONTROL], q->control_cells, LINK_TXQ_DEPTH_CONTROL, LINK_OVERFLOW_REJECT);
+    ring_init(&q->rings[LINK_PRIO_TELEMETRY], q->telemetry_cells, LINK_TXQ_DEPTH_TELEMETRY, LINK_OVERFLOW_DROP_OLDEST);
+    ring_init(&q->rings[LINK_PRIO_BULK], q->bulk_cells, LINK_TXQ_DEPTH_BULK, LINK_OVERFLOW_DROP_OLDEST);
+    link_txq_set_bulk_rate(q, 0, 0);
+}
+
+void link_txq_set_bulk_rate(LinkTxQueue *q, uint32_t bytes_per_sec, uint32_t burst) {
+    if (burst < LINK_FRAME_MAX) burst = LINK_FRAME_MAX;
+    q->bulk_rate = bytes_per_sec;
+    q->bulk_burst = burst;
+    q->bulk_tokens = burst;
+    q->bulk_last_us = 0;
+}
+
+LinkPriority link_priority_for_cmd(uint8_t cmd) {
+    switch (cmd) {
+        // Periodic state, superseded by the next update
+        case CMD_DEVICE_STATUS:
+        case CMD_DEVICE_LIST:
+        case CMD_DEBUG_INFO:
+        case CMD_GET_DEVICE_STATUS:
+            return LINK_PRIO_TELEMETRY;
+        // Logs, recorded telemetry and file transfers
+        case CMD_ESP_LOG_DATA:
+        case CMD_ESP_LOG_REC:
+        case CMD_ESP_LOG_BATCH:
+        case CMD_OTA_CHUNK:
+        case CMD_OTA_WCHUNK:
+        case CMD_LOG_LIST_RESP:
+        case CMD_LOG_DATA_CHUNK:
+        case CMD_TELEM_DATA:
+        case CMD_LOG_SEARCH_RESP:
+            return LINK_PRIO_BULK;
+        // Handshakes, ACKs, user commands and requests
+        default:
+            return LINK_PRIO_CONTROL;
+    }
+}
+
+/**
+ * @brief Refills the bulk bucket and checks whether a frame fits.
+ */
+static bool bulk_allowed(LinkTxQueue *q, int len, uint32_t now_us) {
+    if (q->bulk_rate == 0) return true;
+
+    if (q->bulk_last_us == 0) q->bulk_last_us = now_us;
+    uint32_t elapsed = now_us - q->bulk_last_us;
+    uint32_t add = (uint32_t)(((uint64_t)elapsed * q->bulk_rate) / 1000000u);
+    if (add > 0) {
+        // Advance by the time actually converted so fractions are not lost
+        q->bulk_last_us += (uint32_t)(((uint64_t)add * 1000000u) / q->bulk_rate);
+        q->bulk_tokens = (q->bulk_tokens + add > q->bulk_burst) ? q->bulk_burst : q->bulk_tokens + add;
+    }
+    return q->bulk_tokens >= (uint32_t)len;
+}
+
+void link_txq_set_policy(LinkTxQueue *q, LinkPriority prio, LinkOverflowPolicy policy) {
+    if (prio >= LINK_PRIO_COUNT) return;
+    q->rings[prio].policy = policy;
+}
+
+bool link_txq_push(LinkTxQueue *q, LinkPriority prio, const uint8_t *frame, uint16_t len, uint32_t now_us) {
+    if (prio >= LINK_PRIO_COUNT || len == 0 || len > LINK_FRAME_MAX) return false;
+    LinkTxRing *r = &q->rings[prio];
+
+    for (int attempt = 0; attempt <= LINK_TXQ_EVICT_RETRIES; attempt++) {
+        if (ring_put(r, frame, len, now_us)) {
+            __atomic_fetch_add(&r->stats.enqueued, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+        if (r->policy != LINK_OVERFLOW_DROP_OLDEST) break;
+        // Evict the stale frame. If the writer emptied the slot first, just retry.
+        if (ring_take(r, NULL, NULL) > 0) {
+            __atomic_fetch_add(&r->stats.dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_fetch_add(&r->stats.rejected, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+void link_txq_give_up(LinkTxQueue *q, LinkPriority prio) {
+    if (prio >= LINK_PRIO_COUNT) return;
+    __atomic_fetch_add(&q->rings[prio].stats.dropped, 1, __ATOMIC_RELAXED);
+}
+
+int link_txq_pop(LinkTxQueue *q, uint8_t *out, uint32_t now_us) {
+    for (int p = 0; p < LINK_PRIO_COUNT; p++) {
+        LinkTxRing *r = &q->rings[p];
+        if (p == LINK_PRIO_BULK) {
+            int next = ring_peek_len(r);
+            if (next <= 0 || !bulk_allowed(q, next, now_us)) return 0;
+        }
+
+        uint32_t enqueued_at;
+        int len = ring_take(r, out, &enqueued_at);
+        if (len <= 0) continue;
+        if (p == LINK_PRIO_BULK && q->bulk_rate != 0) {
+            q->bulk_tokens = (q->bulk_tokens > (uint32_t)len) ? q->bulk_tokens - len : 0;
+        }
+
+        __atomic_fetch_add(&r->stats.sent, 1, __ATOMIC_RELAXED);
+        uint32_t latency = now_us - enqueued_at;
+        uint32_t prev = __atomic_load_n(&r->stats.max_latency_us, __ATOMIC_RELAXED);
+        while (latency > prev &&
+               !__atomic_compare_exchange_n(&r->stats.max_latency_us, &prev, latency, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        return len;
+    }
+    return 0;
+}
+
+bool link_txq_empty(const LinkTxQueue *q) {
+    for (int p = 0; p < LINK_PRIO_COUNT; p++) {
+        const LinkTxRing *r = &q->rings[p];
+        if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void link_txq_get_stats(const LinkTxQueue *q, LinkPriority prio, LinkTxStats *out) {
+    if (prio >= LINK_PRIO_COUNT) return;
+    const LinkTxStats *s = &q->rings[prio].stats;
+    out->enqueued = __atomic_load_n(&s->enqueued, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&s->dropped, __ATOMIC_RELAXED);
+    out->rejected = __atomic_load_n(&s->rejected, __ATOMIC_RELAXED);
+    out->sent = __atomic_load_n(&s->sent, __ATOMIC_RELAXED);
+    out->max_latency_us = __atomic_load_n(&s->max_latency_us, __ATOMIC_RELAXED);
+}
+
+void link_txq_reset_stats(LinkTxQueue *q) {
+    for (int p = 0; p < LINK_PRIO_COUNT; p++) {
+        LinkTxStats *s = &q->rings[p].stats;
+        __atomic_store_n(&s->enqueued, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->dropped, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->rejected, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->sent, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->max_latency_us, 0, __ATOMIC_RELAXED);
+    }
+}
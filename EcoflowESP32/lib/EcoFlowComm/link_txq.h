@@ -0,0 +1,156 @@
+#ifndef LINK_TXQ_H
+#define LINK_TXQ_H
+
+/**
+ * @file link_txq.h
+ * @author Lollokara
+ * @brief Lock-free multi-producer TX frame queue for the inter-MCU UART link.
+ *
+ * Producers (any task) push complete, already packed frames. A single writer
+ * task pops them and is the only code that touches the UART. Each priority
+ * class is a bounded ring of sequence-numbered cells (Vyukov style), so a
+ * producer never blocks and never takes a mutex. When a class is full its
+ * overflow policy decides whether the new frame is rejected or the oldest
+ * queued frame of that class is dropped to make room.
+ *
+ * Scheduling is strict priority: control, then telemetry, then bulk. The
+ * bulk class is additionally limited by a token bucket so a log dump or file
+ * transfer cannot saturate the link and delay periodic telemetry.
+ *
+ * The module has no RTOS or HAL dependency. Timestamps are supplied by the
+ * caller in microseconds. Pushing is safe from any task; popping must only be
+ * done by one writer.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ecoflow_protocol.h"
+#include "link_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ring depths per class (must be powers of two)
+#define LINK_TXQ_DEPTH_CONTROL   8
+#define LINK_TXQ_DEPTH_TELEMETRY 8
+#define LINK_TXQ_DEPTH_BULK      16
+
+// Share of the raw link bandwidth the bulk class may use (percent)
+#define LINK_BULK_SHARE_PCT 75
+/// Bulk byte rate for a given baud (8N1 = 10 bits per byte)
+#define LINK_BULK_RATE_FOR_BAUD(baud) ((uint32_t)(baud) / 10 * LINK_BULK_SHARE_PCT / 100)
+
+/**
+ * @brief Priority classes, highest first. The writer always drains a
+ * higher class completely before looking at the next one.
+ */
+typedef enum {
+    LINK_PRIO_CONTROL = 0,   ///< Handshakes, ACKs, user commands
+    LINK_PRIO_TELEMETRY,     ///< Periodic status / device list
+    LINK_PRIO_BULK,          ///< Logs, file transfers
+    LINK_PRIO_COUNT
+} LinkPriority;
+
+/**
+ * @brief What to do when a class ring is full.
+ */
+typedef enum {
+    LINK_OVERFLOW_REJECT = 0,    ///< Keep queued frames, refuse the new one
+    LINK_OVERFLOW_DROP_OLDEST    ///< Discard the oldest queued frame, accept the new one
+} LinkOverflowPolicy;
+
+/**
+ * @brief Per-class counters. Read with link_txq_get_stats().
+ */
+typedef struct {
+    uint32_t enqueued;        ///< Frames accepted into the ring
+    uint32_t dropped;         ///< Frames lost: evicted, or given up by their producer
+    uint32_t rejected;        ///< Pushes refused, the producer may retry
+    uint32_t sent;            ///< Frames handed to the writer
+    uint32_t max_latency_us;  ///< Worst enqueue-to-dequeue delay seen
+} LinkTxStats;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t enqueued_at;
+    uint16_t len;
+    uint8_t data[LINK_FRAME_MAX];
+} LinkTxCell;
+
+typedef struct {
+    LinkTxCell *cells;
+    uint32_t mask;
+    uint32_t head;            ///< Next enqueue position
+    uint32_t tail;            ///< Next dequeue position
+    LinkOverflowPolicy policy;
+    LinkTxStats stats;
+} LinkTxRing;
+
+typedef struct {
+    LinkTxRing rings[LINK_PRIO_COUNT];
+    // Bulk token bucket, refilled and spent by the writer in link_txq_pop()
+    uint32_t bulk_rate;       ///< Bytes per second, 0 = unlimited
+    uint32_t bulk_burst;      ///< Bucket size in bytes
+    uint32_t bulk_tokens;
+    uint32_t bulk_last_us;
+    LinkTxCell control_cells[LINK_TXQ_DEPTH_CONTROL];
+    LinkTxCell telemetry_cells[LINK_TXQ_DEPTH_TELEMETRY];
+    LinkTxCell bulk_cells[LINK_TXQ_DEPTH_BULK];
+} LinkTxQueue;
+
+/**
+ * @brief Initializes an empty queue.
+ * Control rejects on overflow (callers retry); telemetry and bulk drop oldest.
+ */
+void link_txq_init(LinkTxQueue *q);
+
+void link_txq_set_policy(LinkTxQueue *q, LinkPriority prio, LinkOverflowPolicy policy);
+
+/**
+ * @brief Limits the bulk class to a byte rate.
+ * @param bytes_per_sec 0 disables the cap.
+ * @param burst Bucket size in bytes, raised to at least one full frame.
+ */
+void link_txq_set_bulk_rate(LinkTxQueue *q, uint32_t bytes_per_sec, uint32_t burst);
+
+/**
+ * @brief Returns the priority class for a command id.
+ */
+LinkPriority link_priority_for_cmd(uint8_t cmd);
+
+/**
+ * @brief Copies a frame into the ring of the given class. Safe from any task.
+ * @param now_us Caller timestamp in microseconds.
+ * @return true if the frame was queued, false if it was rejected (counted in
+ * `rejected`; call link_txq_give_up() if it will not be pushed again).
+ */
+bool link_txq_push(LinkTxQueue *q, LinkPriority prio, const uint8_t *frame, uint16_t len, uint32_t now_us);
+
+/**
+ * @brief Counts a frame link_txq_push() refused as lost, once its producer
+ * stops retrying it.
+ */
+void link_txq_give_up(LinkTxQueue *q, LinkPriority prio);
+
+/**
+ * @brief Pops the highest priority frame that may be sent now.
+ * @param out Buffer of at least LINK_FRAME_MAX bytes.
+ * @param now_us Caller timestamp in microseconds.
+ * @return Frame length, or 0 if nothing is sendable. When 0 is returned and
+ * link_txq_empty() is false, bulk is throttled: retry after a short wait.
+ */
+int link_txq_pop(LinkTxQueue *q, uint8_t *out, uint32_t now_us);
+
+bool link_txq_empty(const LinkTxQueue *q);
+
+void link_txq_get_stats(const LinkTxQueue *q, LinkPriority prio, LinkTxStats *out);
+void link_txq_reset_stats(LinkTxQueue *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LINK_TXQ_H
@@ -0,0 +1,182 @@
+#include "log_arena.h"
+#include "log_record.h"
+#include <string.h>
+
+#define ARENA_MASK  (LOG_ARENA_SIZE - 1)
+#define SLOT_MASK   (LOG_ARENA_SLOTS - 1)
+#define REC_HDR     16
+#define SUM_SEED    0x811C9DC5u  // FNV-1a
+#define SUM_PRIME   0x01000193u
+
+typedef enum { REC_READY, REC_PENDING, REC_GONE } RecState;
+
+static int bounded_len(const char *s, int max) {
+    int n = 0;
+    if (s) while (n < max && s[n]) n++;
+    return n;
+}
+
+static uint32_t sum_word(uint32_t h, uint32_t w) {
+    return (h ^ w) * SUM_PRIME;
+}
+
+static uint32_t sum_bytes(uint32_t h, const void *p, int n) {
+    const uint8_t *b = (const uint8_t *)p;
+    for (int i = 0; i < n; i++) h = (h ^ b[i]) * SUM_PRIME;
+    return h;
+}
+
+static const uint32_t *rec_at(const LogArena *a, uint32_t pos) {
+    return &a->buf[(pos & ARENA_MASK) / 4];
+}
+
+// Bytes at `pos` still hold what was written there before the head moved on
+static bool intact(const LogArena *a, uint32_t pos) {
+    return __atomic_load_n(&a->head, __ATOMIC_ACQUIRE) - pos <= LOG_ARENA_SIZE;
+}
+
+void log_arena_init(LogArena *a) {
+    memset(a, 0, sizeof(*a));
+}
+
+// Appends [Tag][Head][Body]; Head and Body together are the message
+static uint32_t put(LogArena *a, uint32_t ms, uint8_t level, const char *tag,
+                    const void *head, int head_len, const void *body, int body_len) {
+    int tag_len = bounded_len(tag, LOG_ARENA_TAG_MAX);
+    uint32_t size = REC_HDR + tag_len + head_len + body_len;
+    uint32_t need = (size + 3) & ~3u;
+
+    uint32_t seq = __atomic_fetch_add(&a->next_seq, 1, __ATOMIC_RELAXED);
+    uint32_t old = __atomic_load_n(&a->head, __ATOMIC_RELAXED), pos;
+    do {
+        pos = old;
+        if ((old & ARENA_MASK) + need > LOG_ARENA_SIZE) pos += LOG_ARENA_SIZE - (old & ARENA_MASK);
+    } while (!__atomic_compare_exchange_n(&a->head, &old, pos + need, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    // A reader that sees any byte below must see the head that freed it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t *h = &a->buf[(pos & ARENA_MASK) / 4];
+    __atomic_store_n(&h[0], ~seq, __ATOMIC_RELAXED);
+    LogArenaSlot *slot = &a->slot[seq & SLOT_MASK];
+    __atomic_store_n(&slot->pos, pos, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    if (!intact(a, pos)) return seq; // Lapped before it began: lost
+
+    uint32_t info = size | (uint32_t)level << 16 | (uint32_t)tag_len << 24;
+    uint32_t sum = sum_word(sum_word(SUM_SEED, ms), info);
+    sum = sum_bytes(sum_bytes(sum_bytes(sum, tag, tag_len), head, head_len), body, body_len);
+    h[1] = ms;
+    h[2] = info;
+    h[3] = sum;
+    uint8_t *p = (uint8_t *)&h[4];
+    if (tag_len) memcpy(p, tag, tag_len);
+    if (head_len) memcpy(p + tag_len, head, head_len);
+    if (body_len) memcpy(p + tag_len + head_len, body, body_len);
+    // Stalled until the head lapped it: the bytes went over newer records,
+    // whose sums now fail, and this one is not published
+    if (intact(a, pos)) __atomic_store_n(&h[0], seq, __ATOMIC_RELEASE);
+    return seq;
+}
+
+uint32_t log_arena_write(LogArena *a, uint32_t ms, uint8_t level, const char *tag, const char *msg) {
+    int msg_len = bounded_len(msg, LOG_ARENA_MSG_MAX);
+    while (msg_len > 0 && (msg[msg_len - 1] == '\n' || msg[msg_len - 1] == '\r')) msg_len--;
+    return put(a, ms, level & ~LOG_ARENA_DEFERRED, tag, msg, msg_len, NULL, 0);
+}
+
+uint32_t log_arena_write_args(LogArena *a, uint32_t ms, uint8_t level, const char *tag,
+                              const char *fmt, const uint8_t *args, int len) {
+    int room = LOG_ARENA_MSG_MAX - (int)sizeof(fmt);
+    if (len < 0) len = 0;
+    return put(a, ms, level | LOG_ARENA_DEFERRED, tag, &fmt, sizeof(fmt), args, len < room ? len : room);
+}
+
+// Where record `seq` is and whether it can be read
+static RecState find(const LogArena *a, uint32_t seq, uint32_t *pos, uint32_t *info) {
+    const LogArenaSlot *slot = &a->slot[seq & SLOT_MASK];
+    uint32_t s = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (s != seq) return (int32_t)(s - seq) < 0 ? REC_PENDING : REC_GONE;
+    *pos = __atomic_load_n(&slot->pos, __ATOMIC_RELAXED);
+    if (!intact(a, *pos)) return REC_GONE;
+
+    const uint32_t *h = rec_at(a, *pos);
+    uint32_t commit = __atomic_load_n(&h[0], __ATOMIC_ACQUIRE);
+    if (commit == ~seq) return REC_PENDING;
+    if (commit != seq) return REC_GONE;
+    *info = __atomic_load_n(&h[2], __ATOMIC_RELAXED);
+    uint32_t size = *info & 0xFFFF, tag_len = *info >> 24;
+    if (size < REC_HDR || tag_len > LOG_ARENA_TAG_MAX || size - REC_HDR - tag_len > LOG_ARENA_MSG_MAX) {
+        return REC_GONE; // Written over between the checks
+    }
+    return REC_READY;
+}
+
+// First Seq a reader can still find
+static uint32_t oldest(const LogArena *a, uint32_t last) {
+    uint32_t floor = __atomic_load_n(&a->floor, __ATOMIC_RELAXED);
+    return last - floor > LOG_ARENA_SLOTS ? last - LOG_ARENA_SLOTS : floor;
+}
+
+int log_arena_read(const LogArena *a, uint32_t *from, LogArenaRec *out, int max) {
+    uint32_t last = __atomic_load_n(&a->next_seq, __ATOMIC_ACQUIRE);
+    uint32_t first = oldest(a, last);
+    uint32_t seq = *from;
+    if ((int32_t)(seq - first) < 0) seq = first;
+    int n = 0;
+
+    for (; (int32_t)(last - seq) > 0 && n < max; seq++) {
+        uint32_t pos, info;
+        RecState st = find(a, seq, &pos, &info);
+        if (st == REC_PENDING) break;
+        if (st == REC_GONE) continue;
+
+        const uint32_t *h = rec_at(a, pos);
+        const uint8_t *p = (const uint8_t *)&h[4];
+        uint32_t tag_len = info >> 24, msg_len = (info & 0xFFFF) - REC_HDR - tag_len;
+        uint8_t level = (uint8_t)(info >> 16);
+        uint8_t raw[LOG_ARENA_MSG_MAX];
+        LogArenaRec *r = &out[n];
+        uint8_t *msg = (level & LOG_ARENA_DEFERRED) ? raw : (uint8_t *)r->msg;
+        r->seq = seq;
+        r->ms = h[1];
+        uint32_t sum = h[3];
+        r->level = level & ~LOG_ARENA_DEFERRED;
+        memcpy(r->tag, p, tag_len);
+        r->tag[tag_len] = 0;
+        memcpy(msg, p + tag_len, msg_len);
+        r->msg[msg_len] = 0;
+
+        // Keep the copy only if the head had not reached it yet and no
+        // writer lapped while stalled wrote into it
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!intact(a, pos) || __atomic_load_n(&h[0], __ATOMIC_RELAXED) != seq) continue;
+        if (sum_bytes(sum_bytes(sum_word(sum_word(SUM_SEED, r->ms), info), r->tag, tag_len), msg, msg_len) != sum) {
+            continue;
+        }
+        if (level & LOG_ARENA_DEFERRED) {
+            const char *fmt;
+            if (msg_len < sizeof(fmt)) continue;
+            memcpy(&fmt, raw, sizeof(fmt));
+            int m = log_rec_format(r->msg, sizeof(r->msg), fmt, raw + sizeof(fmt), (int)(msg_len - sizeof(fmt)));
+            while (m > 0 && (r->msg[m - 1] == '\n' || r->msg[m - 1] == '\r')) r->msg[--m] = 0;
+        }
+        n++;
+    }
+    if ((int32_t)(seq - *from) > 0) *from = seq;
+    return n;
+}
+
+uint32_t log_arena_count(const LogArena *a) {
+    uint32_t last = __atomic_load_n(&a->next_seq, __ATOMIC_ACQUIRE);
+    uint32_t count = 0;
+    for (uint32_t seq = oldest(a, last); seq != last; seq++) {
+        uint32_t pos, info;
+        if (find(a, seq, &pos, &info) != REC_GONE) count++;
+    }
+    return count;
+}
+
+void log_arena_clear(LogArena *a) {
+    __atomic_store_n(&a->floor, __atomic_load_n(&a->next_seq, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,109 @@
+#include "log_levels.h"
+#include <string.h>
+
+static bool is_default(const char *tag) {
+    return tag == NULL || tag[0] == 0 || strcmp(tag, "*") == 0;
+}
+
+static int find(const LogLevels *t, const char *tag) {
+    for (int i = 0; i < t->count; i++) {
+        if (strcmp(t->tags[i].tag, tag) == 0) return i;
+    }
+    return -1;
+}
+
+void log_levels_init(LogLevels *t, uint8_t def) {
+    memset(t, 0, sizeof(*t));
+    t->def = def > LOG_LEVELS_VERBOSE ? LOG_LEVELS_VERBOSE : def;
+}
+
+bool log_levels_set(LogLevels *t, const char *tag, uint8_t level) {
+    if (level > LOG_LEVELS_VERBOSE && level != LOG_LEVELS_UNSET) return false;
+    if (is_default(tag)) {
+        if (level == LOG_LEVELS_UNSET) return false;
+        t->def = level;
+        return true;
+    }
+    if (strlen(tag) > LOG_LEVELS_TAG_MAX) return false;
+
+    int i = find(t, tag);
+    if (level == LOG_LEVELS_UNSET) {
+        if (i >= 0) {
+            t->tags[i] = t->tags[t->count - 1];
+            t->count--;
+        }
+        return true;
+    }
+    if (i < 0) {
+        if (t->count >= LOG_LEVELS_TAGS) return false;
+        i = t->count++;
+        strcpy(t->tags[i].tag, tag);
+        t->tags[i].id = log_levels_tag_id(tag);
+    }
+    t->tags[i].level = level;
+    return true;
+}
+
+uint8_t log_levels_get(const LogLevels *t, const char *tag) {
+    return log_levels_get_or(t, tag, t->def);
+}
+
+uint8_t log_levels_get_or(const LogLevels *t, const char *tag, uint8_t def) {
+    if (tag == NULL) return t->def;
+    int i = find(t, tag);
+    return i < 0 ? def : t->tags[i].level;
+}
+
+uint8_t log_levels_get_id(const LogLevels *t, uint16_t id) {
+    for (int i = 0; i < t->count; i++) {
+        if (t->tags[i].id == id) return t->tags[i].level;
+    }
+    return t->def;
+}
+
+uint16_t log_levels_tag_id(const char *tag) {
+    uint32_t h = 2166136261u;
+    while (*tag) {
+        h ^= (uint8_t)*tag++;
+        h *= 16777619u;
+    }
+    return (uint16_t)(h ^ (h >> 16));
+}
+
+int log_levels_pack(const LogLevels *t, uint8_t *out) {
+    int pos = 0;
+    out[pos++] = t->def;
+    out[pos++] = t->count;
+    for (int i = 0; i < t->count; i++) {
+        uint8_t len = (uint8_t)strlen(t->tags[i].tag);
+        out[pos++] = t->tags[i].level;
+        out[pos++] = len;
+        memcpy(&out[pos], t->tags[i].tag, len);
+        pos += len;
+    }
+    return pos;
+}
+
+bool log_levels_unpack(LogLevels *t, const uint8_t *in, int len) {
+    LogLevels n;
+    if (len < 2 || in[0] > LOG_LEVELS_VERBOSE || in[1] > LOG_LEVELS_TAGS) return false;
+    log_levels_init(&n, in[0]);
+
+    int pos = 2;
+    for (uint8_t i = 0; i < in[1]; i++) {
+        if (pos + 2 > len) return false;
+        uint8_t level = in[pos], tag_len = in[pos + 1];
+        if (level > LOG_LEVELS_VERBOSE || tag_len < 1 || tag_len > LOG_LEVELS_TAG_MAX ||
+            pos + 2 + tag_len > len) {
+            return false;
+        }
+        char tag[LOG_LEVELS_TAG_MAX + 1];
+        memcpy(tag, &in[pos + 2], tag_len);
+        tag[tag_len] = 0;
+        if (is_default(tag) || strlen(tag) != tag_len || !log_levels_set(&n, tag, level)) return false;
+        pos += 2 + tag_len;
+    }
+    if (pos != len) return false;
+    *t = n;
+    return true;
+}
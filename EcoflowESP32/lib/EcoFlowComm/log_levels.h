@@ -0,0 +1,114 @@
+#ifndef LOG_LEVELS_H
+#define LOG_LEVELS_H
+
+/**
+ * @file log_levels.h
+ * @author Lollokara
+ * @brief Per-tag log level table: which lines go on.
+ *
+ * A line passes when its level is at most the level set for its tag, or the
+ * default level when its tag has none. Levels are those of esp_log (error 1
+ * to verbose 5); level 0 lines, the STM32's session header, always pass.
+ * Tags compare exactly, as esp_log_level_set() takes them. ESP32 records
+ * carry their tag as a 16-bit ID (log_levels_tag_id()), which is looked up
+ * against the IDs of the tags in the table.
+ *
+ * The ESP32 checks its table before a line is forwarded to the STM32
+ * (RemoteLogger); the STM32 checks its own before a line is packed into a
+ * record for the SD card (log_manager.c). Both keep the table packed as
+ *
+ *   [Default:1][Count:1] then Count x [Level:1][TagLen:1][Tag]
+ *
+ * which is also the payload of CMD_LOG_LEVEL_LIST, and at most
+ * LOG_LEVELS_PACKED_MAX bytes.
+ *
+ * Not thread safe: the caller serializes changes against lookups.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_LEVELS_TAGS       10     ///< Tags with a level of their own
+#define LOG_LEVELS_TAG_MAX    23     ///< Longest tag, "NimBLEAdvertisedDevice" fits
+#define LOG_LEVELS_PACKED_MAX (2 + LOG_LEVELS_TAGS * (2 + LOG_LEVELS_TAG_MAX))
+#define LOG_LEVELS_VERBOSE    5
+#define LOG_LEVELS_UNSET      0xFF   ///< Set to this, a tag follows the default again
+
+typedef struct {
+    char tag[LOG_LEVELS_TAG_MAX + 1];
+    uint8_t level;
+    uint16_t id;                        ///< log_levels_tag_id(tag)
+} LogLevelTag;
+
+typedef struct {
+    uint8_t def;                        ///< Level of tags not in the table
+    uint8_t count;
+    LogLevelTag tags[LOG_LEVELS_TAGS];
+} LogLevels;
+
+/**
+ * @brief Empties the table.
+ * @param def Level of every tag until one is set.
+ */
+void log_levels_init(LogLevels *t, uint8_t def);
+
+/**
+ * @brief Sets a tag's level.
+ * @param tag NULL, "" or "*" for the default.
+ * @param level 0 to LOG_LEVELS_VERBOSE, or LOG_LEVELS_UNSET to drop the tag.
+ * @return false for a bad level, a tag too long, or a full table.
+ */
+bool log_levels_set(LogLevels *t, const char *tag, uint8_t level);
+
+/**
+ * @brief The level lines of `tag` pass at (NULL: the default).
+ */
+uint8_t log_levels_get(const LogLevels *t, const char *tag);
+
+/**
+ * @brief The level set for `tag`, or `def` if the table has none for it.
+ */
+uint8_t log_levels_get_or(const LogLevels *t, const char *tag, uint8_t def);
+
+/**
+ * @brief The level lines of the tag with this ID pass at; of two tags with
+ * one ID, the first in the table.
+ */
+uint8_t log_levels_get_id(const LogLevels *t, uint16_t id);
+
+/**
+ * @brief A tag's 16-bit ID: FNV-1a of its characters, folded.
+ */
+uint16_t log_levels_tag_id(const char *tag);
+
+static inline bool log_levels_pass(const LogLevels *t, uint8_t level, const char *tag) {
+    return level == 0 || level <= log_levels_get(t, tag);
+}
+
+static inline bool log_levels_pass_id(const LogLevels *t, uint8_t level, uint16_t id) {
+    return level == 0 || level <= log_levels_get_id(t, id);
+}
+
+/**
+ * @brief Packs the table into `out`, LOG_LEVELS_PACKED_MAX bytes at most.
+ * @return Bytes written.
+ */
+int log_levels_pack(const LogLevels *t, uint8_t *out);
+
+/**
+ * @brief Replaces the table with a packed one.
+ * @return false, leaving the table as it was, if `in` is not a whole table.
+ */
+bool log_levels_unpack(LogLevels *t, const uint8_t *in, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_LEVELS_H
@@ -0,0 +1,227 @@
+#include "log_record.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint8_t type;
+    int64_t i;
+    float f;
+    const uint8_t *s;
+    int n;
+} LogArg;
+
+int log_arg_put_int(uint8_t *buf, int pos, int cap, int64_t v) {
+    uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    uint8_t tmp[11];
+    int n = 0;
+    tmp[n++] = LOG_ARG_INT;
+    do {
+        uint8_t b = z & 0x7F;
+        z >>= 7;
+        tmp[n++] = z ? (b | 0x80) : b;
+    } while (z);
+    if (pos < 0 || pos + n > cap) return -1;
+    memcpy(&buf[pos], tmp, n);
+    return pos + n;
+}
+
+int log_arg_put_float(uint8_t *buf, int pos, int cap, float v) {
+    if (pos < 0 || pos + 5 > cap) return -1;
+    uint32_t u;
+    memcpy(&u, &v, 4);
+    buf[pos] = LOG_ARG_FLOAT;
+    buf[pos + 1] = u & 0xFF;
+    buf[pos + 2] = (u >> 8) & 0xFF;
+    buf[pos + 3] = (u >> 16) & 0xFF;
+    buf[pos + 4] = (u >> 24) & 0xFF;
+    return pos + 5;
+}
+
+int log_arg_put_str(uint8_t *buf, int pos, int cap, const char *s) {
+    if (pos < 0 || pos + 2 > cap) return -1;
+    size_t len = s ? strlen(s) : 0;
+    if (len > 255) len = 255;
+    if ((int)len > cap - pos - 2) len = cap - pos - 2;
+    buf[pos] = LOG_ARG_STR;
+    buf[pos + 1] = (uint8_t)len;
+    if (len) memcpy(&buf[pos + 2], s, len);
+    return pos + 2 + (int)len;
+}
+
+static int rec_header(uint8_t *out, uint32_t tick, uint8_t level, uint32_t fmt_id, int payload_len) {
+    uint16_t len = (uint16_t)(LOG_REC_HDR - 3 + payload_len);
+    out[0] = LOG_REC_SYNC;
+    out[1] = len & 0xFF;
+    out[2] = len >> 8;
+    memcpy(&out[3], &tick, 4);
+    out[7] = level;
+    memcpy(&out[8], &fmt_id, 4);
+    return LOG_REC_HDR;
+}
+
+int log_rec_pack(uint8_t *out, uint32_t tick, uint8_t level, uint32_t fmt_id,
+                 const uint8_t *payload, int payload_len) {
+    if (payload_len < 0) payload_len = 0;
+    if (payload_len > LOG_REC_MAX - LOG_REC_HDR) payload_len = LOG_REC_MAX - LOG_REC_HDR;
+    int pos = rec_header(out, tick, level, fmt_id, payload_len);
+    if (payload_len) memcpy(&out[pos], payload, payload_len);
+    return pos + payload_len;
+}
+
+int log_rec_pack_text(uint8_t *out, uint32_t tick, uint8_t level, const char *tag, const char *msg) {
+    size_t tag_len = strlen(tag);
+    if (tag_len > 31) tag_len = 31;
+    size_t msg_len = strlen(msg);
+    size_t room = LOG_REC_MAX - LOG_REC_HDR - 1 - tag_len;
+    if (msg_len > room) msg_len = room;
+
+    int pos = rec_header(out, tick, level, LOG_REC_TEXT, (int)(1 + tag_len + msg_len));
+    out[pos++] = (uint8_t)tag_len;
+    memcpy(&out[pos], tag, tag_len);
+    pos += tag_len;
+    memcpy(&out[pos], msg, msg_len);
+    return pos + (int)msg_len;
+}
+
+uint32_t log_fmt_id(const char *file, uint32_t line, const char *fmt) {
+    const char *base = file;
+    for (const char *p = file; *p; p++) {
+        if (*p == '/' || *p == '\\') base = p + 1;
+    }
+    uint32_t h = LOG_FNV_BASIS;
+    for (const char *p = base; *p; p++) h = (h ^ (uint8_t)*p) * LOG_FNV_PRIME;
+    for (int i = 0; i < 4; i++) h = (h ^ (uint8_t)(line >> (8 * i))) * LOG_FNV_PRIME;
+    for (const char *p = fmt; *p; p++) h = (h ^ (uint8_t)*p) * LOG_FNV_PRIME;
+    return h;
+}
+
+// Next argument at *pos; false at the end or on a cut one
+static int arg_next(const uint8_t *args, int len, int *pos, LogArg *v) {
+    int p = *pos;
+    if (!args || p >= len) return 0;
+    v->type = args[p++];
+    if (v->type == LOG_ARG_INT) {
+        uint64_t z = 0;
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (p >= len || shift > 63) return 0;
+            b = args[p++];
+            z |= (uint64_t)(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        v->i = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+    } else if (v->type == LOG_ARG_FLOAT) {
+        if (p + 4 > len) return 0;
+        uint32_t u = args[p] | (args[p + 1] << 8) | (args[p + 2] << 16) | ((uint32_t)args[p + 3] << 24);
+        memcpy(&v->f, &u, 4);
+        p += 4;
+    } else if (v->type == LOG_ARG_STR) {
+        if (p >= len || p + 1 + args[p] > len) return 0;
+        v->n = args[p];
+        v->s = &args[p + 1];
+        p += 1 + v->n;
+    } else {
+        return 0;
+    }
+    *pos = p;
+    return 1;
+}
+
+// An unsigned conversion's value at the width the ESP32 passed it
+static unsigned long long arg_unsigned(int64_t v, const char *length) {
+    if (!strcmp(length, "hh")) return (uint8_t)v;
+    if (!strcmp(length, "h")) return (uint16_t)v;
+    if (!strcmp(length, "ll") || !strcmp(length, "j")) return (uint64_t)v;
+    return (uint32_t)v; // int, long, size_t: 32 bits there
+}
+
+int log_rec_format(char *out, int cap, const char *fmt, const uint8_t *args, int len) {
+    int o = 0, pos = 0;
+    if (cap <= 0) return 0;
+    while (*fmt && o < cap - 1) {
+        if (*fmt != '%') {
+            out[o++] = *fmt++;
+            continue;
+        }
+        const char *start = fmt++;
+        char spec[24], length[3] = "";
+        int k = 0, n;
+        LogArg v;
+        spec[k++] = '%';
+        while (*fmt && strchr("-+ #0", *fmt) && k < 8) spec[k++] = *fmt++;
+        if (*fmt == '*') {
+            fmt++;
+            int w = arg_next(args, len, &pos, &v) && v.type == LOG_ARG_INT ? (int)v.i : 0;
+            if (w < -99 || w > 99) w = 0;
+            k += snprintf(&spec[k], sizeof(spec) - k, "%d", w);
+        }
+        while (*fmt >= '0' && *fmt <= '9' && k < 12) spec[k++] = *fmt++;
+        if (*fmt == '.') {
+            spec[k++] = *fmt++;
+            while (*fmt >= '0' && *fmt <= '9' && k < 16) spec[k++] = *fmt++;
+        }
+        if ((fmt[0] == 'h' && fmt[1] == 'h') || (fmt[0] == 'l' && fmt[1] == 'l')) {
+            memcpy(length, fmt, 2);
+            length[2] = 0;
+            fmt += 2;
+        } else if (*fmt && strchr("hljztL", *fmt)) {
+            length[0] = *fmt++;
+            length[1] = 0;
+        }
+        char conv = *fmt;
+        if (!conv || !strchr("diouxXeEfFgGcsp%", conv)) {
+            // Not a conversion: as written
+            n = (int)(fmt - start) < cap - 1 - o ? (int)(fmt - start) : cap - 1 - o;
+            memcpy(&out[o], start, n);
+            o += n;
+            continue;
+        }
+        fmt++;
+        if (conv == '%') {
+            out[o++] = '%';
+            continue;
+        }
+        if (!arg_next(args, len, &pos, &v)) {
+            out[o++] = '?';
+            continue;
+        }
+
+        char str[256];
+        if (v.type == LOG_ARG_STR) {
+            memcpy(str, v.s, v.n);
+            str[v.n] = 0;
+        }
+        int64_t iv = v.type == LOG_ARG_FLOAT ? (int64_t)v.f : v.i;
+        double fv = v.type == LOG_ARG_FLOAT ? (double)v.f : (double)v.i;
+        if (conv == 's' || (v.type == LOG_ARG_STR && strchr("diouxXcp", conv))) {
+            if (v.type == LOG_ARG_INT) snprintf(str, sizeof(str), "%lld", (long long)v.i);
+            if (v.type == LOG_ARG_FLOAT) snprintf(str, sizeof(str), "%g", fv);
+            memcpy(&spec[k], "s", 2);
+            n = snprintf(&out[o], cap - o, spec, str);
+        } else if (strchr("eEfFgG", conv)) {
+            if (v.type == LOG_ARG_STR) fv = NAN;
+            spec[k++] = conv;
+            spec[k] = 0;
+            n = snprintf(&out[o], cap - o, spec, fv);
+        } else if (conv == 'c') {
+            memcpy(&spec[k], "c", 2);
+            n = snprintf(&out[o], cap - o, spec, (int)(iv & 0xFF));
+        } else if (conv == 'p') {
+            n = snprintf(&out[o], cap - o, "0x%llx", (unsigned long long)(uint64_t)iv);
+        } else if (conv == 'd' || conv == 'i') {
+            memcpy(&spec[k], "lld", 4);
+            n = snprintf(&out[o], cap - o, spec, (long long)iv);
+        } else {
+            spec[k++] = 'l';
+            spec[k++] = 'l';
+            spec[k++] = conv;
+            spec[k] = 0;
+            n = snprintf(&out[o], cap - o, spec, arg_unsigned(iv, length));
+        }
+        if (n > 0) o += n < cap - o ? n : cap - 1 - o;
+    }
+    out[o] = 0;
+    return o;
+}
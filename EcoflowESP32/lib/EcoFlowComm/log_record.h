@@ -0,0 +1,90 @@
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+/**
+ * @file log_record.h
+ * @author Lollokara
+ * @brief Binary log records, as the STM32 stores them on the SD card.
+ *
+ * A log file starts with LOG_FILE_MAGIC; each record after it is
+ *
+ *   [Sync:1 0xEF][Len:2][Tick:4][Level:1][FmtId:4][Payload: Len - 9]
+ *
+ * little endian, Len counting the bytes after itself. FmtId names the
+ * format string of the call site that logged it; the payload holds that
+ * call's arguments, each a type byte and its value. FmtId 0 is a text
+ * record, [TagLen:1][Tag][Message], for messages formatted on the device.
+ *
+ * The format strings stay in the ESP32's sources: a site's FmtId is the
+ * FNV-1a hash of its file name, line (uint32 LE) and format string, computed
+ * at compile time (LogRecord.h) and again by Test Scripts/tools/log_decode.py,
+ * which renders a file back to the text lines the device used to write.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_FILE_MAGIC     "EFL1"    ///< First 4 bytes of a binary log file
+#define LOG_FILE_MAGIC_LEN 4
+
+#define LOG_REC_SYNC   0xEF
+#define LOG_REC_HDR    12            ///< Sync, Len, Tick, Level, FmtId
+#define LOG_REC_MAX    512           ///< Largest record, header included
+#define LOG_REC_TEXT   0             ///< FmtId of a text record
+
+// Argument type bytes
+#define LOG_ARG_INT    0x01          ///< Zigzag varint of the value as int64
+#define LOG_ARG_FLOAT  0x02          ///< float32; printf's doubles lose nothing %.2f shows
+#define LOG_ARG_STR    0x03          ///< [Len:1][Bytes], cut to fit
+
+#define LOG_FNV_BASIS  2166136261u
+#define LOG_FNV_PRIME  16777619u
+
+/**
+ * @brief Appends one argument at `pos` of a `cap` byte buffer.
+ * @return The position after it, or -1 if it does not fit.
+ */
+int log_arg_put_int(uint8_t *buf, int pos, int cap, int64_t v);
+int log_arg_put_float(uint8_t *buf, int pos, int cap, float v);
+int log_arg_put_str(uint8_t *buf, int pos, int cap, const char *s);
+
+/**
+ * @brief Writes a record of `payload_len` payload bytes to `out`
+ * (LOG_REC_HDR + payload_len bytes). Payload longer than a record
+ * takes is cut.
+ * @return Bytes written.
+ */
+int log_rec_pack(uint8_t *out, uint32_t tick, uint8_t level, uint32_t fmt_id,
+                 const uint8_t *payload, int payload_len);
+
+/**
+ * @brief Writes a text record; the message is cut to fit LOG_REC_MAX.
+ * @return Bytes written.
+ */
+int log_rec_pack_text(uint8_t *out, uint32_t tick, uint8_t level, const char *tag, const char *msg);
+
+/**
+ * @brief Renders a call's packed arguments with its format string, the
+ * device's twin of render() in log_decode.py: the conversions the firmware
+ * uses, integers at the ESP32's widths, '?' for an argument missing from
+ * `args` (cut off, or never packed).
+ * @return Length written to `out`, cut to `cap` - 1 and NUL terminated.
+ */
+int log_rec_format(char *out, int cap, const char *fmt, const uint8_t *args, int len);
+
+/**
+ * @brief Format ID of a call site, the runtime twin of log_site_id() in
+ * LogRecord.h. `file` may be a path; only its last component counts.
+ */
+uint32_t log_fmt_id(const char *file, uint32_t line, const char *fmt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_RECORD_H
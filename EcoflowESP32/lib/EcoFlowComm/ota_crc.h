@@ -0,0 +1,67 @@
+#ifndef OTA_CRC_H
+#define OTA_CRC_H
+
+/**
+ * @file ota_crc.h
+ * @author Lollokara
+ * @brief CRC32 of OTA images and chunks.
+ *
+ * MSB first, polynomial 0x04C11DB7, initial value and final XOR 0xFFFFFFFF
+ * (CRC-32/BZIP2). The STM32 CRC unit runs the same algorithm on 32-bit
+ * words without the final XOR, so feeding it big-endian words gives the
+ * same result: the bootloader hashes whole words in hardware and only the
+ * last 0-3 bytes of an image in software.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Software CRC32, chainable: pass 0 to start, the last result to continue.
+ */
+uint32_t ota_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Hardware CRC unit hooks.
+ * feed() takes `words` 4-byte groups in stream order (the hook does the
+ * byte swap) and returns the unit's data register.
+ */
+typedef struct {
+    void (*reset)(void);
+    uint32_t (*feed)(const uint8_t *data, uint32_t words);
+} OtaCrcHw;
+
+/**
+ * @brief Running CRC32 over a stream split at arbitrary byte boundaries.
+ */
+typedef struct {
+    const OtaCrcHw *hw;    ///< NULL: software only
+    uint32_t reg;          ///< CRC register, before the final XOR
+    uint8_t carry[4];      ///< Bytes of an incomplete word
+    uint8_t carry_len;
+    uint32_t length;
+} OtaCrc;
+
+/**
+ * @brief Starts a stream; resets the unit if `hw` is given.
+ */
+void ota_crc_begin(OtaCrc *c, const OtaCrcHw *hw);
+
+void ota_crc_update(OtaCrc *c, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief CRC of everything fed so far, same value ota_crc32() gives.
+ * The stream may continue afterwards.
+ */
+uint32_t ota_crc_value(const OtaCrc *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_CRC_H
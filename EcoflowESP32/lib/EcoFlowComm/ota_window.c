@@ -0,0 +1,105 @@
+#include "ota_window.h"
+#include <string.h>
+
+void ota_wtx_init(OtaWindowTx *w, uint32_t image_size, uint8_t window) {
+    memset(w, 0, sizeof(*w));
+    if (window < 1) window = 1;
+    if (window > OTA_WINDOW_MAX) window = OTA_WINDOW_MAX;
+    w->image_size = image_size;
+    w->total = (uint16_t)((image_size + OTA_WINDOW_CHUNK - 1) / OTA_WINDOW_CHUNK);
+    w->window = window;
+}
+
+void ota_wtx_start_at(OtaWindowTx *w, uint16_t seq) {
+    if (seq > w->total) seq = w->total;
+    w->base = seq;
+    w->next = seq;
+}
+
+static void mark_sent(OtaWindowTx *w, uint16_t seq, uint32_t now_us) {
+    w->sent_order[seq % OTA_WINDOW_MAX] = ++w->order;
+    w->sent_at_us[seq % OTA_WINDOW_MAX] = now_us;
+}
+
+int ota_wtx_next(OtaWindowTx *w, uint32_t now_us) {
+    if (ota_wtx_done(w)) return OTA_WTX_IDLE;
+
+    uint16_t in_flight = w->next - w->base;
+    if (in_flight > 0 && !(w->resend & 1) &&
+        now_us - w->sent_at_us[w->base % OTA_WINDOW_MAX] > OTA_WINDOW_RTO_US) {
+        if (++w->timeouts >= OTA_WINDOW_MAX_TIMEOUTS) return OTA_WTX_FAILED;
+        w->resend = ((in_flight >= 32) ? 0xFFFFFFFFu : ((1u << in_flight) - 1)) & ~w->acked;
+    }
+
+    if (w->resend) {
+        uint8_t i = 0;
+        while (!(w->resend & (1u << i))) i++;
+        w->resend &= ~(1u << i);
+        uint16_t seq = w->base + i;
+        mark_sent(w, seq, now_us);
+        w->retransmits++;
+        return seq;
+    }
+
+    if (w->next < w->total && in_flight < w->window) {
+        uint16_t seq = w->next++;
+        mark_sent(w, seq, now_us);
+        return seq;
+    }
+    return OTA_WTX_IDLE;
+}
+
+void ota_wtx_on_ack(OtaWindowTx *w, uint16_t next_seq, uint16_t sack) {
+    // Stale or corrupt: behind the window or acking chunks never sent
+    if (next_seq < w->base || next_seq > w->next) return;
+
+    // Everything below next_seq arrived
+    for (uint16_t seq = w->base; seq < next_seq; seq++) {
+        uint32_t order = w->sent_order[seq % OTA_WINDOW_MAX];
+        if (order > w->acked_order) w->acked_order = order;
+    }
+    uint16_t shift = next_seq - w->base;
+    if (shift > 0) {
+        w->acked = (shift >= 32) ? 0 : (w->acked >> shift);
+        w->resend = (shift >= 32) ? 0 : (w->resend >> shift);
+        w->base = next_seq;
+        w->timeouts = 0;
+    }
+
+    // Selective acks relative to the new base (bit 0 = base + 1)
+    for (uint8_t i = 0; i < 16; i++) {
+        uint16_t seq = next_seq + 1 + i;
+        if (!(sack & (1u << i)) || seq >= w->next) continue;
+        w->acked |= 1u << (i + 1);
+        w->resend &= ~(1u << (i + 1));
+        uint32_t order = w->sent_order[seq % OTA_WINDOW_MAX];
+        if (order > w->acked_order) w->acked_order = order;
+    }
+
+    // Anything still missing that went out before an acknowledged chunk was lost
+    for (uint16_t seq = w->base; seq < w->next; seq++) {
+        uint8_t i = seq - w->base;
+        if (w->acked & (1u << i)) continue;
+        if (w->sent_order[seq % OTA_WINDOW_MAX] < w->acked_order) w->resend |= 1u << i;
+    }
+}
+
+uint32_t ota_wtx_offset(uint16_t seq) {
+    return (uint32_t)seq * OTA_WINDOW_CHUNK;
+}
+
+uint16_t ota_wtx_chunk_len(const OtaWindowTx *w, uint16_t seq) {
+    uint32_t offset = ota_wtx_offset(seq);
+    if (offset >= w->image_size) return 0;
+    uint32_t left = w->image_size - offset;
+    return (uint16_t)(left < OTA_WINDOW_CHUNK ? left : OTA_WINDOW_CHUNK);
+}
+
+uint32_t ota_wtx_acked_bytes(const OtaWindowTx *w) {
+    uint32_t bytes = ota_wtx_offset(w->base);
+    return bytes > w->image_size ? w->image_size : bytes;
+}
+
+bool ota_wtx_done(const OtaWindowTx *w) {
+    return w->base >= w->total;
+}
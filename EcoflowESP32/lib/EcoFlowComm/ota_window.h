@@ -0,0 +1,97 @@
+#ifndef OTA_WINDOW_H
+#define OTA_WINDOW_H
+
+/**
+ * @file ota_window.h
+ * @author Lollokara
+ * @brief Sender side of the windowed STM32 OTA transfer.
+ *
+ * Keeps up to `window` CMD_OTA_WCHUNK frames in flight. The bootloader
+ * answers every chunk with a CMD_OTA_WACK carrying the first missing chunk
+ * (cumulative) and a bitmap of the chunks it already holds beyond it.
+ *
+ * A chunk is retransmitted when:
+ * - a chunk sent after it has been acknowledged while it is still missing
+ *   (it was lost, the link does not reorder), or
+ * - the oldest unacknowledged chunk has been outstanding for
+ *   OTA_WINDOW_RTO_US, in which case everything in flight is resent.
+ *
+ * Pure state machine: the caller reads and sends the chunks ota_wtx_next()
+ * returns and feeds WACKs. No RTOS or HAL dependency, so it runs on a host.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ecoflow_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_WINDOW_RTO_US        300000   ///< Oldest chunk unacked this long -> resend window
+#define OTA_WINDOW_MAX_TIMEOUTS  20       ///< Consecutive RTOs without progress -> give up (~6 s)
+
+// ota_wtx_next() results besides a chunk sequence number
+#define OTA_WTX_IDLE   -1   ///< Nothing may be sent now, wait for a WACK
+#define OTA_WTX_FAILED -2   ///< Bootloader stopped acknowledging
+
+typedef struct {
+    uint32_t image_size;
+    uint16_t total;                          ///< Chunks in the image
+    uint8_t window;
+    uint16_t base;                           ///< Oldest unacknowledged chunk
+    uint16_t next;                           ///< Next chunk never sent
+    uint32_t acked;                          ///< Bit i: chunk base + i acknowledged
+    uint32_t resend;                         ///< Bit i: chunk base + i must be resent
+    uint32_t sent_order[OTA_WINDOW_MAX];     ///< Transmission number, by seq % OTA_WINDOW_MAX
+    uint32_t sent_at_us[OTA_WINDOW_MAX];
+    uint32_t order;                          ///< Transmissions so far
+    uint32_t acked_order;                    ///< Highest transmission number acknowledged
+    uint8_t timeouts;                        ///< Consecutive RTOs without progress
+    uint32_t retransmits;
+} OtaWindowTx;
+
+/**
+ * @brief Starts a transfer.
+ * @param window Granted window, clamped to 1..OTA_WINDOW_MAX.
+ */
+void ota_wtx_init(OtaWindowTx *w, uint32_t image_size, uint8_t window);
+
+/**
+ * @brief Skips the chunks before `seq`, which the bootloader already holds
+ * (resumed transfer). Call right after ota_wtx_init().
+ */
+void ota_wtx_start_at(OtaWindowTx *w, uint16_t seq);
+
+/**
+ * @brief Picks the next chunk to transmit and records it as sent.
+ * Resends come first, then new chunks while the window has room.
+ * @return Chunk sequence number, OTA_WTX_IDLE or OTA_WTX_FAILED.
+ */
+int ota_wtx_next(OtaWindowTx *w, uint32_t now_us);
+
+/**
+ * @brief Applies a CMD_OTA_WACK.
+ */
+void ota_wtx_on_ack(OtaWindowTx *w, uint16_t next_seq, uint16_t sack);
+
+/**
+ * @brief Byte range of a chunk.
+ */
+uint32_t ota_wtx_offset(uint16_t seq);
+uint16_t ota_wtx_chunk_len(const OtaWindowTx *w, uint16_t seq);
+
+/**
+ * @brief Bytes acknowledged in order (progress).
+ */
+uint32_t ota_wtx_acked_bytes(const OtaWindowTx *w);
+
+bool ota_wtx_done(const OtaWindowTx *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_WINDOW_H
@@ -0,0 +1,313 @@
+#include "telem_block.h"
+#include "ota_crc.h"
+#include <stddef.h>
+#include <string.h>
+
+#define F(name, unit, dev, field, type, scale) \
+    { name, unit, offsetof(DeviceSpecificData, dev.field), TELEM_NO_OFF, type, scale }
+#define F2(name, unit, dev, a, b, type, scale) \
+    { name, unit, offsetof(DeviceSpecificData, dev.a), offsetof(DeviceSpecificData, dev.b), type, scale }
+
+// Append only: a column's position is its ID in queries and on the card
+static const TelemField FieldsD3[] = {
+    F("soc", "%", d3, batteryLevel, TELEM_F32, 10),
+    F("in", "W", d3, inputPower, TELEM_F32, 1),
+    F("out", "W", d3, outputPower, TELEM_F32, 1),
+    F("acIn", "W", d3, acInputPower, TELEM_F32, 1),
+    F("acOut", "W", d3, acOutputPower, TELEM_F32, 1),
+    F("solar", "W", d3, solarInputPower, TELEM_F32, 1),
+    F("battIn", "W", d3, batteryInputPower, TELEM_F32, 1),
+    F("battOut", "W", d3, batteryOutputPower, TELEM_F32, 1),
+    F("temp", "C", d3, cellTemperature, TELEM_I32, 1),
+};
+
+static const TelemField FieldsD3P[] = {
+    F("soc", "%", d3p, batteryLevel, TELEM_F32, 10),
+    F("in", "W", d3p, inputPower, TELEM_F32, 1),
+    F("out", "W", d3p, outputPower, TELEM_F32, 1),
+    F("acIn", "W", d3p, acInputPower, TELEM_F32, 1),
+    F("acLvOut", "W", d3p, acLvOutputPower, TELEM_F32, 1),
+    F("acHvOut", "W", d3p, acHvOutputPower, TELEM_F32, 1),
+    F2("solar", "W", d3p, solarLvPower, solarHvPower, TELEM_F32, 1),
+    F("temp", "C", d3p, cellTemperature, TELEM_I32, 1),
+    F("soh", "%", d3p, soh, TELEM_F32, 10),
+};
+
+static const TelemField FieldsW2[] = {
+    F("envTemp", "C", w2, envTemp, TELEM_F32, 10),
+    F("outTemp", "C", w2, outLetTemp, TELEM_F32, 10),
+    F("setTemp", "C", w2, setTemp, TELEM_I32, 1),
+    F("soc", "%", w2, batSoc, TELEM_I32, 1),
+    F("battPwr", "W", w2, batPwrWatt, TELEM_I32, 1),
+    F("solar", "W", w2, mpptPwrWatt, TELEM_I32, 1),
+    F("psdrPwr", "W", w2, psdrPwrWatt, TELEM_I32, 1),
+    F("fan", "", w2, fanValue, TELEM_I32, 1),
+    F("mode", "", w2, mode, TELEM_I32, 1),
+};
+
+static const TelemField FieldsAC[] = {
+    F("soc", "%", ac, batteryLevel, TELEM_F32, 10),
+    F("battTemp", "C", ac, batteryTemperature, TELEM_F32, 10),
+    F("dcPower", "W", ac, dcPower, TELEM_F32, 1),
+    F("carVolt", "V", ac, carBatteryVoltage, TELEM_F32, 100),
+    F("mode", "", ac, chargerMode, TELEM_I32, 1),
+};
+
+#undef F
+#undef F2
+
+const TelemField* telem_fields(uint8_t dev, int* cols) {
+    switch (dev) {
+        case DEV_TYPE_DELTA_3:      *cols = sizeof(FieldsD3) / sizeof(FieldsD3[0]); return FieldsD3;
+        case DEV_TYPE_DELTA_PRO_3:  *cols = sizeof(FieldsD3P) / sizeof(FieldsD3P[0]); return FieldsD3P;
+        case DEV_TYPE_WAVE_2:       *cols = sizeof(FieldsW2) / sizeof(FieldsW2[0]); return FieldsW2;
+        case DEV_TYPE_ALT_CHARGER:  *cols = sizeof(FieldsAC) / sizeof(FieldsAC[0]); return FieldsAC;
+    }
+    *cols = 0;
+    return NULL;
+}
+
+static float field_value(const uint8_t* base, uint16_t off, uint8_t type) {
+    switch (type) {
+        case TELEM_F32: { float f; memcpy(&f, base + off, 4); return f; }
+        case TELEM_I32: { int32_t i; memcpy(&i, base + off, 4); return (float)i; }
+        case TELEM_U32: { uint32_t u; memcpy(&u, base + off, 4); return (float)u; }
+        case TELEM_BOOL: return base[off] ? 1.0f : 0.0f;
+    }
+    return 0.0f;
+}
+
+int telem_sample(const DeviceStatus* s, int32_t* vals) {
+    int cols;
+    const TelemField* f = telem_fields(s->id, &cols);
+    const uint8_t* base = (const uint8_t*)&s->data;
+    for (int c = 0; c < cols; c++) {
+        float v = field_value(base, f[c].off, f[c].type);
+        if (f[c].off2 != TELEM_NO_OFF) v += field_value(base, f[c].off2, f[c].type);
+        v *= f[c].scale;
+        if (!(v == v)) v = 0.0f; // NaN
+        if (v > 2147483520.0f) vals[c] = INT32_MAX;
+        else if (v < -2147483520.0f) vals[c] = INT32_MIN;
+        else vals[c] = (int32_t)(v + (v >= 0 ? 0.5f : -0.5f));
+    }
+    return cols;
+}
+
+// --- Encoder ---
+
+static uint32_t zigzag(int64_t v) { return (uint32_t)(((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); }
+
+static int varint_len(uint32_t v) {
+    int n = 1;
+    while (v >= 0x80) { v >>= 7; n++; }
+    return n;
+}
+
+static int varint_put(uint8_t* out, int pos, uint32_t v) {
+    while (v >= 0x80) {
+        out[pos++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[pos++] = (uint8_t)v;
+    return pos;
+}
+
+// Differences of int32 values fit 33 bits; a jump that wide is stored as its
+// 32-bit wraparound, which adds back to the same value
+static uint32_t delta(int32_t v, int32_t prev) { return zigzag((int32_t)((uint32_t)v - (uint32_t)prev)); }
+
+void telem_enc_init(TelemEnc* e, uint8_t dev, uint8_t cols) {
+    memset(e, 0, sizeof(*e));
+    e->dev = dev;
+    e->cols = cols > TELEM_MAX_COLS ? TELEM_MAX_COLS : cols;
+}
+
+int telem_enc_add(TelemEnc* e, uint32_t t, const int32_t* vals) {
+    int stride = e->cols + 1;
+    int bytes = 0;
+    if (e->count) {
+        const int32_t* last = &e->raw[(e->count - 1) * stride];
+        if (t < e->t1) return -1;
+        bytes += varint_len(t - e->t1);
+        for (int c = 0; c < e->cols; c++) bytes += varint_len(delta(vals[c], last[1 + c]));
+    } else {
+        for (int c = 0; c < e->cols; c++) bytes += varint_len(zigzag(vals[c]));
+    }
+    int room = TELEM_BLOCK_SIZE - 4 - telem_hdr_len(e->cols);
+    if (e->used + bytes > room || (e->count + 1) * stride > TELEM_RAW_MAX || e->count == 0xFFFF) return 0;
+
+    int32_t* s = &e->raw[e->count * stride];
+    s[0] = (int32_t)t;
+    for (int c = 0; c < e->cols; c++) {
+        s[1 + c] = vals[c];
+        if (!e->count || vals[c] < e->min[c]) e->min[c] = vals[c];
+        if (!e->count || vals[c] > e->max[c]) e->max[c] = vals[c];
+    }
+    if (!e->count) e->t0 = t;
+    e->t1 = t;
+    e->used += bytes;
+    e->count++;
+    return 1;
+}
+
+int telem_enc_finish(TelemEnc* e, uint8_t* blk) {
+    int n = e->count;
+    if (!n) return 0;
+    int stride = e->cols + 1;
+
+    memset(blk, 0, TELEM_BLOCK_SIZE);
+    TelemBlockHdr h = { TELEM_BLOCK_MAGIC, e->dev, e->cols, e->count, 0, e->t0, e->t1 };
+    memcpy(blk, &h, sizeof(h));
+
+    int pos = telem_hdr_len(e->cols);
+    for (int i = 1; i < n; i++) pos = varint_put(blk, pos, (uint32_t)(e->raw[i * stride] - e->raw[(i - 1) * stride]));
+    for (int c = 0; c < e->cols; c++) {
+        TelemColHdr ch = { e->min[c], e->max[c], (uint16_t)pos };
+        memcpy(&blk[TELEM_HDR_SIZE + c * TELEM_COL_SIZE], &ch, sizeof(ch));
+        pos = varint_put(blk, pos, zigzag(e->raw[1 + c]));
+        for (int i = 1; i < n; i++) pos = varint_put(blk, pos, delta(e->raw[i * stride + 1 + c], e->raw[(i - 1) * stride + 1 + c]));
+    }
+    uint32_t crc = ota_crc32(0, blk, TELEM_BLOCK_SIZE - 4);
+    memcpy(&blk[TELEM_BLOCK_SIZE - 4], &crc, 4);
+
+    telem_enc_init(e, e->dev, e->cols);
+    return n;
+}
+
+// --- Decoder ---
+
+static int varint_get(const uint8_t* b, int pos, int end, uint32_t* v) {
+    uint32_t x = 0;
+    for (int shift = 0; shift < 35 && pos < end; shift += 7) {
+        uint8_t c = b[pos++];
+        x |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *v = x;
+            return pos;
+        }
+    }
+    return -1;
+}
+
+static int32_t unzigzag(uint32_t z) { return (int32_t)((z >> 1) ^ (0u - (z & 1))); }
+
+int telem_block_check(const uint8_t* blk) {
+    TelemBlockHdr h;
+    memcpy(&h, blk, sizeof(h));
+    if (h.magic != TELEM_BLOCK_MAGIC || h.cols == 0 || h.cols > TELEM_MAX_COLS || h.count == 0 || h.t1 < h.t0) return -1;
+    uint32_t crc;
+    memcpy(&crc, &blk[TELEM_BLOCK_SIZE - 4], 4);
+    if (crc != ota_crc32(0, blk, TELEM_BLOCK_SIZE - 4)) return -1;
+    for (int c = 0; c < h.cols; c++) {
+        TelemColHdr ch;
+        memcpy(&ch, &blk[TELEM_HDR_SIZE + c * TELEM_COL_SIZE], sizeof(ch));
+        if (ch.off < telem_hdr_len(h.cols) || ch.off >= TELEM_BLOCK_SIZE - 4) return -1;
+    }
+    return h.cols;
+}
+
+// Walks the time column and one value column side by side
+typedef struct {
+    const uint8_t* blk;
+    int tp;
+    int vp;
+    int i;
+    int n;
+    uint32_t t;
+    int32_t v;
+} ColumnIter;
+
+static int column_begin(ColumnIter* it, const uint8_t* blk, int col) {
+    TelemBlockHdr h;
+    TelemColHdr ch;
+    memcpy(&h, blk, sizeof(h));
+    if (col < 0 || col >= h.cols) return 0;
+    memcpy(&ch, &blk[TELEM_HDR_SIZE + col * TELEM_COL_SIZE], sizeof(ch));
+    it->blk = blk;
+    it->tp = telem_hdr_len(h.cols);
+    it->vp = ch.off;
+    it->i = 0;
+    it->n = h.count;
+    it->t = h.t0;
+    it->v = 0;
+    return 1;
+}
+
+static int column_next(ColumnIter* it) {
+    const int end = TELEM_BLOCK_SIZE - 4;
+    uint32_t d, z;
+    if (it->i >= it->n) return 0;
+    if (it->i) {
+        if ((it->tp = varint_get(it->blk, it->tp, end, &d)) < 0) return 0;
+        it->t += d;
+    }
+    if ((it->vp = varint_get(it->blk, it->vp, end, &z)) < 0) return 0;
+    it->v = it->i ? (int32_t)((uint32_t)it->v + (uint32_t)unzigzag(z)) : unzigzag(z);
+    it->i++;
+    return 1;
+}
+
+int telem_block_column(const uint8_t* blk, int col, uint32_t* t, int32_t* v, int max) {
+    ColumnIter it;
+    int n = 0;
+    if (!column_begin(&it, blk, col)) return 0;
+    while (n < max && column_next(&it)) {
+        t[n] = it.t;
+        v[n] = it.v;
+        n++;
+    }
+    return n;
+}
+
+// --- Query ---
+
+void telem_query_init(TelemQuery* q, uint32_t from, uint32_t to, uint16_t points) {
+    if (points < 1) points = 1;
+    if (points > TELEM_POINTS_MAX) points = TELEM_POINTS_MAX;
+    q->from = from;
+    q->to = to > from ? to : from + 1;
+    q->points = points;
+    for (int i = 0; i < points; i++) {
+        q->min[i] = TELEM_EMPTY_MIN;
+        q->max[i] = TELEM_EMPTY_MAX;
+    }
+}
+
+int telem_query_bucket(const TelemQuery* q, uint32_t t) {
+    if (t < q->from || t >= q->to) return -1;
+    return (int)((uint64_t)(t - q->from) * q->points / (q->to - q->from));
+}
+
+static void query_merge(TelemQuery* q, int b, int32_t min, int32_t max) {
+    if (min < q->min[b]) q->min[b] = min;
+    if (max > q->max[b]) q->max[b] = max;
+}
+
+void telem_query_add(TelemQuery* q, uint32_t t, int32_t v) {
+    int b = telem_query_bucket(q, t);
+    if (b >= 0) query_merge(q, b, v, v);
+}
+
+int telem_query_index(TelemQuery* q, const uint8_t* entry, int col) {
+    TelemBlockHdr h;
+    memcpy(&h, entry, sizeof(h));
+    if (h.magic != TELEM_BLOCK_MAGIC || col < 0 || col >= h.cols || h.t1 < q->from || h.t0 >= q->to) return TELEM_IDX_SKIP;
+    int b0 = telem_query_bucket(q, h.t0);
+    if (b0 < 0 || b0 != telem_query_bucket(q, h.t1)) return TELEM_IDX_DECODE;
+    TelemColHdr ch;
+    memcpy(&ch, &entry[TELEM_HDR_SIZE + col * TELEM_COL_SIZE], sizeof(ch));
+    query_merge(q, b0, ch.min, ch.max);
+    return TELEM_IDX_MERGED;
+}
+
+void telem_query_block(TelemQuery* q, const uint8_t* blk, int col) {
+    ColumnIter it;
+    if (!column_begin(&it, blk, col)) return;
+    while (column_next(&it)) telem_query_add(q, it.t, it.v);
+}
+
+void telem_query_enc(TelemQuery* q, const TelemEnc* e, int col) {
+    if (col < 0 || col >= e->cols) return;
+    int stride = e->cols + 1;
+    for (int i = 0; i < e->count; i++) telem_query_add(q, (uint32_t)e->raw[i * stride], e->raw[i * stride + 1 + col]);
+}
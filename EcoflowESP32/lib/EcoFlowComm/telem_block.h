@@ -0,0 +1,175 @@
+#ifndef TELEM_BLOCK_H
+#define TELEM_BLOCK_H
+
+/**
+ * @file telem_block.h
+ * @author Lollokara
+ * @brief Columnar telemetry blocks, as the STM32 records them on the SD card.
+ *
+ * Each device has a fixed list of columns (telem_fields()), numbers taken
+ * from its DeviceStatus and scaled to integers. Samples are stored in blocks
+ * of exactly TELEM_BLOCK_SIZE bytes, one device and one day per block:
+ *
+ *   [Magic:2][Dev:1][Cols:1][Count:2][Reserved:2][T0:4][T1:4]     header
+ *   Cols x [Min:4][Max:4][Offset:2]                               column index
+ *   [Time column][Column 0]...[Column Cols-1]                      data
+ *   [Zero padding][CRC32:4]
+ *
+ * little endian. T0/T1 are the epoch seconds of the first and last sample.
+ * The time column holds Count - 1 varints, each sample's distance from the
+ * one before; a value column is the zigzag varint of its first value, then
+ * of each difference to the previous one. Offset locates a column in the
+ * block, so one field decodes without touching the others. The CRC
+ * (ota_crc32) covers everything before it.
+ *
+ * The header and column index (telem_hdr_len() bytes) double as the block's
+ * entry in the sidecar index file: a query reads the index, takes min/max of
+ * blocks that fall inside one bucket from there, and decodes only blocks that
+ * straddle a bucket boundary.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include "ecoflow_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEM_BLOCK_SIZE  512
+#define TELEM_BLOCK_MAGIC 0x4254     ///< "TB"
+#define TELEM_MAX_COLS    12
+#define TELEM_HDR_SIZE    16
+#define TELEM_COL_SIZE    10         ///< Min, Max, Offset
+#define TELEM_RAW_MAX     484        ///< Buffered values (time included), bounded by the 1 byte a value takes at least
+#define TELEM_POINTS_MAX  240        ///< Buckets of one query
+#define TELEM_EMPTY_MIN   INT32_MAX  ///< A bucket without samples: min > max
+#define TELEM_EMPTY_MAX   INT32_MIN
+
+// Field types
+#define TELEM_F32  0
+#define TELEM_I32  1
+#define TELEM_U32  2
+#define TELEM_BOOL 3
+
+#define TELEM_NO_OFF 0xFFFF
+
+typedef struct {
+    const char* name;
+    const char* unit;
+    uint16_t off;       ///< Into DeviceSpecificData
+    uint16_t off2;      ///< Added to the first, TELEM_NO_OFF if none
+    uint8_t type;
+    uint16_t scale;     ///< Stored value = round(value * scale)
+} TelemField;
+
+#pragma pack(push, 1)
+typedef struct {
+    uint16_t magic;
+    uint8_t dev;
+    uint8_t cols;
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t t0;
+    uint32_t t1;
+} TelemBlockHdr;
+
+typedef struct {
+    int32_t min;
+    int32_t max;
+    uint16_t off;
+} TelemColHdr;
+#pragma pack(pop)
+
+/**
+ * @brief Columns recorded for a device type.
+ * @return The column list, NULL for a device not recorded.
+ */
+const TelemField* telem_fields(uint8_t dev, int* cols);
+
+/**
+ * @brief One sample of every column of `s`.
+ * @return Number of columns written to `vals`, 0 if the device is not recorded.
+ */
+int telem_sample(const DeviceStatus* s, int32_t* vals);
+
+/** Bytes of header and column index, the size of an index entry */
+static inline int telem_hdr_len(int cols) { return TELEM_HDR_SIZE + TELEM_COL_SIZE * cols; }
+
+/**
+ * @brief Block being filled. Samples are kept as added; their encoded size
+ * is tracked so the block is closed exactly when the next one no longer fits.
+ */
+typedef struct {
+    uint8_t dev;
+    uint8_t cols;
+    uint16_t count;
+    uint16_t used;                  ///< Encoded data bytes, all columns
+    uint32_t t0;
+    uint32_t t1;
+    int32_t min[TELEM_MAX_COLS];
+    int32_t max[TELEM_MAX_COLS];
+    int32_t raw[TELEM_RAW_MAX];     ///< count x [Time, Col 0, ...]
+} TelemEnc;
+
+void telem_enc_init(TelemEnc* e, uint8_t dev, uint8_t cols);
+
+/**
+ * @brief Adds a sample taken at `t`.
+ * @return 1 if added, 0 if the block is full (finish it and add again),
+ * -1 if `t` is before the last sample.
+ */
+int telem_enc_add(TelemEnc* e, uint32_t t, const int32_t* vals);
+
+/**
+ * @brief Writes the block (TELEM_BLOCK_SIZE bytes) and empties the encoder.
+ * @return Samples in the block; nothing is written if 0.
+ */
+int telem_enc_finish(TelemEnc* e, uint8_t* blk);
+
+/**
+ * @brief Checks magic, layout and CRC of a block.
+ * @return Its number of columns, or -1.
+ */
+int telem_block_check(const uint8_t* blk);
+
+/**
+ * @brief Decodes the time column and column `col` of a checked block.
+ * @return Samples decoded, at most `max`.
+ */
+int telem_block_column(const uint8_t* blk, int col, uint32_t* t, int32_t* v, int max);
+
+/**
+ * @brief Min/max of one column over [from, to), in `points` equal buckets.
+ */
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+    uint16_t points;
+    int32_t min[TELEM_POINTS_MAX];
+    int32_t max[TELEM_POINTS_MAX];
+} TelemQuery;
+
+#define TELEM_IDX_SKIP   0   ///< Block outside the range
+#define TELEM_IDX_MERGED 1   ///< Block inside one bucket, taken from its index entry
+#define TELEM_IDX_DECODE 2   ///< Block spans buckets: decode it with telem_query_block()
+
+/** `points` is clamped to 1..TELEM_POINTS_MAX; `to` must be after `from`. */
+void telem_query_init(TelemQuery* q, uint32_t from, uint32_t to, uint16_t points);
+int telem_query_bucket(const TelemQuery* q, uint32_t t); ///< -1 outside the range
+void telem_query_add(TelemQuery* q, uint32_t t, int32_t v);
+
+/**
+ * @brief Takes a block's index entry (its first telem_hdr_len() bytes).
+ * @return TELEM_IDX_*.
+ */
+int telem_query_index(TelemQuery* q, const uint8_t* entry, int col);
+void telem_query_block(TelemQuery* q, const uint8_t* blk, int col);
+void telem_query_enc(TelemQuery* q, const TelemEnc* e, int col); ///< Samples not yet in a block
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEM_BLOCK_H
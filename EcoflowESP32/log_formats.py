@@ -0,0 +1,19 @@
+import os
+import sys
+
+Import("env")
+
+# Writes the format table of this build's LOG_STM_x and ESP_LOGx calls next
+# to the firmware, $BUILD_DIR/log_formats.json. Keep it with the firmware
+# image: Test Scripts/tools/log_decode.py needs it to read the STM32's SD logs.
+project_dir = env.subst("$PROJECT_DIR")
+tools_dir = os.path.join(project_dir, "..", "Test Scripts", "tools")
+sys.path.insert(0, tools_dir)
+import log_decode
+
+build_dir = env.subst("$BUILD_DIR")
+os.makedirs(build_dir, exist_ok=True)
+table = log_decode.scan_formats([os.path.join(project_dir, "src")])
+table_path = os.path.join(build_dir, "log_formats.json")
+log_decode.write_table(table, table_path)
+print(f"Log format table: {table_path} ({len(table)} formats)")
@@ -4,6 +4,8 @@
 #include <WiFi.h>
 #include "LogBuffer.h"
 #include "WebServer.h"
+#include "Stm32Serial.h"
+#include "RemoteLogger.h"
 
 #if CONFIG_IDF_TARGET_ESP32S3
 // Check IDF version for correct header
@@ -131,7 +133,7 @@ void CmdUtils::processInput(String input) {
 
     // System diagnostics
     if (cmd.startsWith("sys_")) {
-        handleSysCommand(cmd);
+        handleSysCommand(cmd, args);
         return;
     }
 
@@ -194,6 +196,10 @@ void CmdUtils::printHelp() {
     cmd_println("\n[System & Connection]");
     cmd_println("  sys_temp                        (Read internal ESP32 temp)");
     cmd_println("  sys_reset                       (Factory reset & reboot)");
+    cmd_println("  sys_link                        (STM32 link baud, TX queue and last test stats)");
+    cmd_println("  sys_linktest [count] [pad]      (Ping the STM32: RTT, loss, throughput)");
+    cmd_println("  sys_linknego                    (Step the STM32 link baud up)");
+    cmd_println("  sys_loglevel [esp/stm <tag/*> <0-5/clear>] (Levels forwarded / written to SD)");
     cmd_println("  con_status                      (List connections)");
     cmd_println("  con_connect <d3/w2/d3p/ac>      (Connect)");
     cmd_println("  con_disconnect <d3/w2/d3p/ac>   (Disconnect)");
@@ -253,7 +259,7 @@ float CmdUtils::parseFloat(String s) {
 
 // --- System Handler ---
 
-void CmdUtils::handleSysCommand(String cmd) {
+void CmdUtils::handleSysCommand(String cmd, String args) {
     if (cmd.equalsIgnoreCase("sys_temp")) {
         float t = readInternalTemp();
         if (t > -900) cmd_printf("Internal Temp: %.2f C\n", t);
@@ -265,6 +271,83 @@ void CmdUtils::handleSysCommand(String cmd) {
         prefs.clear();
         prefs.end();
         ESP.restart();
+    } else if (cmd.equalsIgnoreCase("sys_linktest")) {
+        int count = 200, pad = 240;
+        if (args.length() > 0) {
+            int sp = args.indexOf(' ');
+            count = args.substring(0, sp == -1 ? args.length() : sp).toInt();
+            if (sp != -1) pad = args.substring(sp + 1).toInt();
+        }
+        if (count <= 0 || count > 10000 || pad < 0 || pad > 249) {
+            cmd_println("Usage: sys_linktest [count 1-10000] [pad 0-249]");
+        } else if (Stm32Serial::getInstance().startLinkTest(count, pad)) {
+            cmd_printf("Link test started (%d pings, %d pad bytes). Check sys_link.\n", count, pad);
+        } else {
+            cmd_println("Link busy (negotiation/test/OTA running).");
+        }
+    } else if (cmd.equalsIgnoreCase("sys_linknego")) {
+        if (Stm32Serial::getInstance().negotiateBaud()) cmd_println("Baud negotiation started.");
+        else cmd_println("Link busy or already at the highest usable baud.");
+    } else if (cmd.equalsIgnoreCase("sys_link")) {
+        Stm32Serial& link = Stm32Serial::getInstance();
+        cmd_printf("baud=%u framing=%s%s\n", (unsigned)link.getLinkBaud(),
+                   link.getLinkFraming() == LINK_FRAMING_COBS ? "cobs" : "legacy", link.isLinkBusy() ? " (busy)" : "");
+        const LinkProbeStats& r = link.getLinkTestResult();
+        if (r.sent > 0) {
+            uint32_t elapsed = r.end_us - r.start_us;
+            cmd_printf("last test @%u: sent=%u recv=%u lost=%u err=%u rtt min/avg/max=%u/%u/%u us thr=%u B/s\n",
+                       (unsigned)r.baud, (unsigned)r.sent, (unsigned)r.received, (unsigned)r.lost, (unsigned)r.errors,
+                       (unsigned)r.rtt_min_us, (unsigned)(r.received ? r.rtt_sum_us / r.received : 0), (unsigned)r.rtt_max_us,
+                       (unsigned)(elapsed ? (uint64_t)2 * r.bytes * 1000000 / elapsed : 0));
+        }
+        static const char* names[LINK_PRIO_COUNT] = {"control", "telemetry", "bulk"};
+        for (int p = 0; p < LINK_PRIO_COUNT; p++) {
+            LinkTxStats st;
+            Stm32Serial::getInstance().getTxStats((LinkPriority)p, &st);
+            cmd_printf("%-9s enq=%u sent=%u drop=%u rej=%u max_lat=%u us\n",
+                       names[p], (unsigned)st.enqueued, (unsigned)st.sent, (unsigned)st.dropped,
+                       (unsigned)st.rejected, (unsigned)st.max_latency_us);
+        }
+        LogBatchStats lb;
+        Stm32Serial::getInstance().getLogBatchStats(&lb);
+        cmd_printf("logs      lines=%u drop=%u frames=%u bytes=%u\n",
+                   (unsigned)lb.lines, (unsigned)lb.dropped, (unsigned)lb.frames, (unsigned)lb.bytes);
+    } else if (cmd.equalsIgnoreCase("sys_loglevel")) {
+        Stm32Serial& link = Stm32Serial::getInstance();
+        args.trim();
+        if (args.length() > 0) {
+            int sp1 = args.indexOf(' ');
+            int sp2 = sp1 == -1 ? -1 : args.indexOf(' ', sp1 + 1);
+            String target = args.substring(0, sp1 == -1 ? args.length() : sp1);
+            String tag = sp2 == -1 ? "" : args.substring(sp1 + 1, sp2);
+            String level = sp2 == -1 ? "" : args.substring(sp2 + 1);
+            int lvl = level.equalsIgnoreCase("clear") ? LOG_LEVELS_UNSET : level.toInt();
+            if (tag.length() == 0 || lvl < 0 || (lvl > LOG_LEVELS_VERBOSE && lvl != LOG_LEVELS_UNSET) ||
+                (lvl == 0 && level != "0")) {
+                cmd_println("Usage: sys_loglevel <esp/stm> <tag/*> <0-5/clear>");
+            } else if (target.equalsIgnoreCase("esp")) {
+                if (!RemoteLogger_SetLevel(tag.c_str(), (uint8_t)lvl)) cmd_println("Refused (table full or tag too long).");
+            } else if (target.equalsIgnoreCase("stm")) {
+                link.setStmLogLevel(tag.c_str(), (uint8_t)lvl);
+                cmd_println("Sent; run sys_loglevel again for the STM32's table.");
+                return;
+            } else {
+                cmd_println("Usage: sys_loglevel <esp/stm> <tag/*> <0-5/clear>");
+            }
+        }
+        LogLevels t;
+        RemoteLogger_GetLevels(&t);
+        cmd_printf("esp (forwarded) *=%u", (unsigned)t.def);
+        for (int i = 0; i < t.count; i++) cmd_printf(" %s=%u", t.tags[i].tag, (unsigned)t.tags[i].level);
+        cmd_println("");
+        if (link.getStmLogLevels(&t)) {
+            cmd_printf("stm (SD card)   *=%u", (unsigned)t.def);
+            for (int i = 0; i < t.count; i++) cmd_printf(" %s=%u", t.tags[i].tag, (unsigned)t.tags[i].level);
+            cmd_println("");
+        } else {
+            cmd_println("stm (SD card)   not received yet");
+        }
+        link.requestStmLogLevels();
     } else {
         cmd_println("Unknown sys command.");
     }
@@ -25,7 +25,7 @@ private:
     static void handleAltChargerRead(String cmd);
 
     // System Commands
-    static void handleSysCommand(String cmd);
+    static void handleSysCommand(String cmd, String args);
     static void handleConCommand(String cmd, String args);
 
     static float parseFloat(String s);
@@ -11,6 +11,7 @@
 #include "DeviceManager.h"
 #include "Credentials.h"
 #include <NimBLEDevice.h>
+#include "Logging.h"
 
 /**
  * @brief Extracts the device serial number from the BLE manufacturer data.
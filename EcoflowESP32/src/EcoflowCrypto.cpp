@@ -11,6 +11,7 @@
 #include "esp_log.h"
 #include "esp_system.h"
 #include "mbedtls/md.h"
+#include "Logging.h"
 
 static const char* TAG = "EcoflowCrypto";
 
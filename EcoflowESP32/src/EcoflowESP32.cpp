@@ -21,6 +21,7 @@
 #include <pb_encode.h>
 #include <algorithm>
 #include <time.h>
+#include "Logging.h"
 static const char* TAG = "EcoflowESP32";
 
 // Static vector to hold instances for the static notify callback
@@ -3,6 +3,7 @@
 #include <cstring>
 #include <vector>
 #include "esp_log.h"
+#include "Logging.h"
 
 static const char* TAG = "EcoflowProtocol";
 
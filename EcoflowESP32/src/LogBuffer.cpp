@@ -1,5 +1,6 @@
 #include "LogBuffer.h"
 #include "RemoteLogger.h"
+#include "log_record.h"
 
 // We need a separate static function for the hook
 static vprintf_like_t old_vprintf = nullptr;
@@ -19,14 +20,13 @@ static int buffer_vprintf(const char *fmt, va_list args) {
     int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
 
     if (len > 0) {
-        String logLine = String(buffer);
-
-        // Basic parsing logic
+        // Basic parsing logic, in place: a String per line would churn the
+        // heap at the rate the framework logs
         esp_log_level_t level = ESP_LOG_INFO;
-        String tag = "SYS";
-        String msg = logLine;
+        const char* tag = "SYS";
+        const char* msg = buffer;
 
-        char levelChar = logLine.charAt(0);
+        char levelChar = buffer[0];
         if (levelChar == 'E') level = ESP_LOG_ERROR;
         else if (levelChar == 'W') level = ESP_LOG_WARN;
         else if (levelChar == 'I') level = ESP_LOG_INFO;
@@ -34,16 +34,17 @@ static int buffer_vprintf(const char *fmt, va_list args) {
         else if (levelChar == 'V') level = ESP_LOG_VERBOSE;
 
         // Extract Tag: "L (time) Tag: Message"
-        int closeParen = logLine.indexOf(')');
-        int colon = logLine.indexOf(':', closeParen);
-        if (closeParen > 0 && colon > closeParen) {
-            tag = logLine.substring(closeParen + 2, colon);
-            msg = logLine.substring(colon + 2);
+        char* closeParen = strchr(buffer, ')');
+        char* colon = closeParen ? strchr(closeParen, ':') : nullptr;
+        if (closeParen > buffer && colon >= closeParen + 2) {
+            *colon = '\0';
+            tag = closeParen + 2;
+            msg = colon[1] ? colon + 2 : colon + 1;
         }
 
-        LogBuffer::getInstance().addLog(level, tag.c_str(), msg.c_str(), args);
+        LogBuffer::getInstance().addLog(level, tag, msg, args);
         // Mirror important lines to the STM32 over the inter-chip UART.
-        RemoteLogger_Forward((int)level, tag.c_str(), msg.c_str());
+        RemoteLogger_Forward((int)level, tag, msg);
     }
 
     // Forward to original handler (USB CDC debug serial)
@@ -61,7 +62,7 @@ LogBuffer& LogBuffer::getInstance() {
 }
 
 LogBuffer::LogBuffer() {
-    _mutex = xSemaphoreCreateMutex();
+    log_arena_init(&_arena);
 }
 
 void LogBuffer::begin() {
@@ -79,8 +80,8 @@ void LogBuffer::setLoggingEnabled(bool enabled) {
         esp_log_level_set("*", ESP_LOG_INFO);
 
         // Keep NimBLE at WARN: its INFO "GATT procedure initiated" lines are
-        // extremely high-frequency and churn String allocations through the log
-        // buffer, which exhausts the heap and causes bad_alloc -> abort crashes.
+        // extremely high-frequency and would push everything else out of the
+        // log arena within seconds.
         esp_log_level_set("NimBLE", ESP_LOG_WARN);
         esp_log_level_set("NimBLEScan", ESP_LOG_WARN);
         esp_log_level_set("NimBLEClient", ESP_LOG_WARN);
@@ -158,57 +159,53 @@ void LogBuffer::push(esp_log_level_t level, const char* tag, const char* fmt, ..
     Serial.printf("[%s] %s\n", tag, msg);
 }
 
-void LogBuffer::_append(esp_log_level_t level, const char* tag, const char* message) {
-    if (xSemaphoreTake(_mutex, pdMS_TO_TICKS(50)) != pdTRUE) {
-        _droppedLogs++;
-        return;
-    }
+bool LogBuffer::wantsRecords(esp_log_level_t level, const char* tag) const {
+    // Serial is true while a USB host has the CDC port open. The level is the
+    // one setLoggingEnabled() and setTagLevel() left for the tag.
+    return (_enabled || Serial) && esp_log_level_get(tag) >= level;
+}
 
-    if (_logs.size() >= _maxLogs) {
-        _logs.erase(_logs.begin()); // Remove oldest
+void LogBuffer::pushArgs(esp_log_level_t level, const char* tag, uint32_t fmtId, const char* fmt,
+                         const uint8_t* args, int len) {
+    if (_enabled) {
+        log_arena_write_args(&_arena, millis(), (uint8_t)level, tag, fmt, args, len);
+        // The STM32 stores the record as is; log_decode.py formats it
+        RemoteLogger_ForwardRecord((int)level, tag, fmtId, args, len);
     }
+    if (Serial) {
+        char msg[LOG_ARENA_MSG_MAX + 1];
+        log_rec_format(msg, sizeof(msg), fmt, args, len);
+        Serial.printf("[%s] %s\n", tag, msg);
+    }
+}
 
-    LogMessage lm;
-    lm.seq = _seqCounter++;
-    lm.timestamp = millis();
-    lm.level = level;
-    lm.tag = String(tag);
-    lm.message = String(message);
-    // Bound per-entry heap: long lines (protobuf dumps, etc.) are truncated so a
-    // burst of large messages can't exhaust the heap.
-    if (lm.message.length() > 160) lm.message.remove(160);
-    if (lm.message.endsWith("\n")) lm.message.remove(lm.message.length()-1);
-
-    _logs.push_back(lm);
-
-    xSemaphoreGive(_mutex);
+void LogBuffer::_append(esp_log_level_t level, const char* tag, const char* message) {
+    // Long lines (protobuf dumps, etc.) are cut to LOG_ARENA_MSG_MAX and the
+    // oldest records are overwritten, so a burst can't grow anything.
+    log_arena_write(&_arena, millis(), (uint8_t)level, tag, message);
 }
 
 std::vector<LogMessage> LogBuffer::getLogs(uint32_t fromSeq) {
-    xSemaphoreTake(_mutex, portMAX_DELAY);
-    std::vector<LogMessage> result;
-
     // The buffer is a sliding window; entries carry a monotonic sequence id so
     // the client can simply ask for "everything newer than the last id I saw".
     // This is robust to ring rotation (unlike index-by-position pagination).
+    // Copied out a few at a time so only what there is gets allocated.
     const size_t MAX_BATCH = 60;
-    for (const auto& lm : _logs) {
-        if (lm.seq >= fromSeq) {
-            result.push_back(lm);
-            if (result.size() >= MAX_BATCH) break;
-        }
+    std::vector<LogMessage> result;
+    LogMessage batch[8];
+    while (result.size() < MAX_BATCH) {
+        int max = (int)std::min(sizeof(batch) / sizeof(batch[0]), MAX_BATCH - result.size());
+        int n = log_arena_read(&_arena, &fromSeq, batch, max);
+        if (n <= 0) break;
+        result.insert(result.end(), batch, batch + n);
     }
-
-    xSemaphoreGive(_mutex);
     return result;
 }
 
 size_t LogBuffer::getLogCount() const {
-    return _logs.size();
+    return log_arena_count(&_arena);
 }
 
 void LogBuffer::clearLogs() {
-    xSemaphoreTake(_mutex, portMAX_DELAY);
-    _logs.clear();
-    xSemaphoreGive(_mutex);
+    log_arena_clear(&_arena);
 }
@@ -4,16 +4,11 @@
 #include <Arduino.h>
 #include <vector>
 #include <string>
-#include <mutex>
 #include "esp_log.h"
+#include "log_arena.h"
 
-struct LogMessage {
-    uint32_t seq;
-    uint32_t timestamp;
-    esp_log_level_t level;
-    String tag;
-    String message;
-};
+// One buffered line as copied out of the arena: seq, ms, level, tag, msg
+typedef LogArenaRec LogMessage;
 
 class LogBuffer {
 public:
@@ -46,6 +41,14 @@ public:
     // Always captured, independent of the enable toggle.
     void push(esp_log_level_t level, const char* tag, const char* fmt, ...);
 
+    // Deferred ESP_LOGx (Logging.h): `fmt` is the call's string literal and
+    // `args` its arguments packed as in log_record.h. Stored unformatted;
+    // mirrored like push() when someone is there to take it and the tag's
+    // esp_log level lets the line through, as for the framework's ESP_LOGx.
+    bool wantsRecords(esp_log_level_t level, const char* tag) const;
+    void pushArgs(esp_log_level_t level, const char* tag, uint32_t fmtId, const char* fmt,
+                  const uint8_t* args, int len);
+
     // Internal use for the vprintf hook
     void addLog(esp_log_level_t level, const char* tag, const char* format, va_list args);
 
@@ -54,15 +57,14 @@ private:
     LogBuffer(const LogBuffer&) = delete;
     LogBuffer& operator=(const LogBuffer&) = delete;
 
-    // Core ring append (assumes formatted message). Thread-safe.
+    // Core ring append (assumes formatted message). Lock-free: any task or
+    // core may append at once, nothing is allocated.
     void _append(esp_log_level_t level, const char* tag, const char* message);
 
     bool _enabled = false;
-    std::vector<LogMessage> _logs;
-    const size_t _maxLogs = 120; // Ring buffer depth (bounded RAM usage)
-    uint32_t _seqCounter = 0;    // Monotonic id for stable web pagination
-    mutable SemaphoreHandle_t _mutex;
-    uint32_t _droppedLogs = 0;
+    // Fixed arena of variable-length records (bounded RAM usage, no heap).
+    // Its seq is monotonic for stable web pagination.
+    LogArena _arena;
 };
 
 #endif // LOG_BUFFER_H
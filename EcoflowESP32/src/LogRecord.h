@@ -0,0 +1,81 @@
+#ifndef LOG_RECORD_CPP_H
+#define LOG_RECORD_CPP_H
+
+/**
+ * @file LogRecord.h
+ * @author Lollokara
+ * @brief Compile-time side of the binary log records (lib/EcoFlowComm/log_record.h).
+ *
+ * A LOG_STM_x call no longer formats its message on the ESP32. The call site's
+ * format ID is hashed from __FILE__, __LINE__ and the format string while
+ * compiling (the line tells apart the many sites sharing a format), and
+ * only its arguments are packed, in the order the format consumes them. The
+ * STM32 stores the record as is; Test Scripts/tools/log_decode.py finds the
+ * format again in the sources and renders the line.
+ */
+
+#include <stdint.h>
+#include <type_traits>
+#include "ecoflow_protocol.h"
+#include "log_record.h"
+
+// FNV-1a over a string, continuing from `h`
+constexpr uint32_t log_fnv1a(const char* s, uint32_t h) {
+    return *s ? log_fnv1a(s + 1, (h ^ (uint8_t)*s) * LOG_FNV_PRIME) : h;
+}
+
+// FNV-1a over the 4 bytes of `v`, little endian
+constexpr uint32_t log_fnv1a_u32(uint32_t v, uint32_t h, int i) {
+    return i == 4 ? h : log_fnv1a_u32(v, (h ^ ((v >> (8 * i)) & 0xFF)) * LOG_FNV_PRIME, i + 1);
+}
+
+// Last component of a path; `base` is the start of the current one
+constexpr const char* log_basename(const char* p, const char* base) {
+    return !*p ? base : log_basename(p + 1, (*p == '/' || *p == '\\') ? p + 1 : base);
+}
+
+// Format ID of a call site, the same as log_fmt_id(file, line, fmt) at run time
+constexpr uint32_t log_site_id(const char* file, uint32_t line, const char* fmt) {
+    return log_fnv1a(fmt, log_fnv1a_u32(line, log_fnv1a(log_basename(file, file), LOG_FNV_BASIS), 0));
+}
+
+struct LogArgs {
+    uint8_t buf[MAX_PAYLOAD_LEN - 5];
+    int len = 0;
+    bool full = false;
+};
+
+// Arguments are taken by value: several callers log fields of packed structs.
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+log_put(LogArgs& a, T v) {
+    int pos = log_arg_put_int(a.buf, a.len, sizeof(a.buf), (int64_t)v);
+    if (pos < 0) a.full = true; else a.len = pos;
+}
+
+inline void log_put(LogArgs& a, double v) {
+    int pos = log_arg_put_float(a.buf, a.len, sizeof(a.buf), (float)v);
+    if (pos < 0) a.full = true; else a.len = pos;
+}
+
+inline void log_put(LogArgs& a, const char* s) {
+    int pos = log_arg_put_str(a.buf, a.len, sizeof(a.buf), s);
+    if (pos < 0) a.full = true; else a.len = pos;
+}
+
+inline void log_put(LogArgs& a, char* s) { log_put(a, (const char*)s); }
+
+template <typename T>
+void log_put(LogArgs& a, const T* p) { log_put(a, (uintptr_t)p); }
+
+inline void log_put_all(LogArgs&) {}
+
+// Stops at the first argument that does not fit; the decoder shows the rest as '?'
+template <typename T, typename... Rest>
+void log_put_all(LogArgs& a, T v, Rest... rest) {
+    if (a.full) return;
+    log_put(a, v);
+    log_put_all(a, rest...);
+}
+
+#endif // LOG_RECORD_CPP_H
@@ -3,53 +3,63 @@
 
 #include "esp_log.h"
 #include "Stm32Serial.h"
-#include <stdio.h>
-#include <stdarg.h>
-
-// Helper to format and send
-static void LogToStm(esp_log_level_t level, const char* file, const char* func, const char* format, ...) {
-    // 1. Local Log
-    va_list args;
-    va_start(args, format);
-    // We can't easily forward va_list to ESP_LOG macros because they expect string literals or VA_ARGS.
-    // So we format first.
-    char loc_buf[256];
-    vsnprintf(loc_buf, sizeof(loc_buf), format, args);
-    va_end(args);
-
-    // Get just the filename from the path
-    const char* filename = strrchr(file, '/');
-    if (filename) filename++; else filename = file;
-    // Windows path separator check just in case
-    const char* filename2 = strrchr(filename, '\\');
-    if (filename2) filename = filename2 + 1;
-
-    // Local Output
-    // Disable local logging to prevent GPIO 1 (TX0) interference with Light Sensor (ADC1 CH0)
-    // ESP_LOG_LEVEL(level, "ESP32", "[%s] %s: %s", filename, func, loc_buf);
-
-    // 2. STM32 Log
-    // Format: [Filename] Function() Message
-    // Target Format on STM32: [Timestamp] [Filename] Function() Message
-    // Stm32Serial sends (tag, msg). STM32 writes [Timestamp] [tag] msg.
-    // So we pass 'filename' as tag, and 'Function() Message' as msg.
-    char stm_msg[512];
-    snprintf(stm_msg, sizeof(stm_msg), "%s() %s", func, loc_buf);
-
-    // Send
-    Stm32Serial::getInstance().sendEspLog((uint8_t)level, filename, stm_msg);
+#include "RemoteLogger.h"
+#include "LogRecord.h"
+
+// Packs a call's arguments and sends them to the STM32 as a log record.
+// Formatting happens on the host (Test Scripts/tools/log_decode.py), not here:
+// the format string never leaves the sources, only its ID (LogRecord.h).
+// Local output stays off to keep GPIO 1 (TX0) from disturbing the light
+// sensor on ADC1 CH0. A line the forwarding levels hold back is not packed.
+template <uint32_t FmtId, typename... A>
+static void LogToStmRecord(esp_log_level_t level, const char* tag, A... args) {
+    if (!RemoteLogger_WantsStm(level, tag)) return;
+    LogArgs a;
+    log_put_all(a, args...);
+    Stm32Serial::getInstance().sendEspLogRecord((uint8_t)level, tag, FmtId, a.buf, (uint8_t)a.len);
+}
+
+// Drop-in replacements for ESP_LOGx. The tag picks the forwarding level and
+// goes as an ID for the STM32's; a record names its call site, file and
+// function, which is what the SD log has always shown.
+#define LOG_STM_E(tag, fmt, ...) LogToStmRecord<log_site_id(__FILE__, __LINE__, fmt)>(ESP_LOG_ERROR, (tag), ##__VA_ARGS__)
+#define LOG_STM_W(tag, fmt, ...) LogToStmRecord<log_site_id(__FILE__, __LINE__, fmt)>(ESP_LOG_WARN, (tag), ##__VA_ARGS__)
+#define LOG_STM_I(tag, fmt, ...) LogToStmRecord<log_site_id(__FILE__, __LINE__, fmt)>(ESP_LOG_INFO, (tag), ##__VA_ARGS__)
+#define LOG_STM_D(tag, fmt, ...) LogToStmRecord<log_site_id(__FILE__, __LINE__, fmt)>(ESP_LOG_DEBUG, (tag), ##__VA_ARGS__)
+#define LOG_STM_V(tag, fmt, ...) LogToStmRecord<log_site_id(__FILE__, __LINE__, fmt)>(ESP_LOG_VERBOSE, (tag), ##__VA_ARGS__)
+
+// Deferred ESP_LOGx (build flag LOG_DEFERRED=1). The framework's ESP_LOGx
+// formats on the calling task, BLE host and parser included, whether or not
+// anyone reads the line. These pack the arguments instead and leave the
+// format string where it is: LogBuffer formats a line when the web log reads
+// it or USB prints it, and the STM32 gets it as a record like LOG_STM_x's.
+// Include this after the framework headers so these definitions win. A call
+// its tag's runtime level holds back packs nothing and takes no arena space.
+#if LOG_DEFERRED
+#include "LogBuffer.h"
+
+template <uint32_t FmtId, typename... A>
+static void LogDeferred(esp_log_level_t level, const char* tag, const char* fmt, A... args) {
+    LogBuffer& log = LogBuffer::getInstance();
+    if (!log.wantsRecords(level, tag)) return;
+    LogArgs a;
+    log_put_all(a, args...);
+    log.pushArgs(level, tag, FmtId, fmt, a.buf, a.len);
 }
 
-// Macros to replace ESP_LOGx
-// We use a specific TAG "ESP32" for local logs generated via this macro to keep it consistent,
-// or we could pass the original TAG.
-// User requirement: "replace all esp_log calls"
-// We'll define LOG_INFO_STM(tag, format, ...) to match typical usage patterns or just replace calls.
-
-#define LOG_STM_E(tag, fmt, ...) LogToStm(ESP_LOG_ERROR, __FILE__, __FUNCTION__, fmt, ##__VA_ARGS__)
-#define LOG_STM_W(tag, fmt, ...) LogToStm(ESP_LOG_WARN, __FILE__, __FUNCTION__, fmt, ##__VA_ARGS__)
-#define LOG_STM_I(tag, fmt, ...) LogToStm(ESP_LOG_INFO, __FILE__, __FUNCTION__, fmt, ##__VA_ARGS__)
-#define LOG_STM_D(tag, fmt, ...) LogToStm(ESP_LOG_DEBUG, __FILE__, __FUNCTION__, fmt, ##__VA_ARGS__)
-#define LOG_STM_V(tag, fmt, ...) LogToStm(ESP_LOG_VERBOSE, __FILE__, __FUNCTION__, fmt, ##__VA_ARGS__)
+#define LOG_DEFER(level, tag, fmt, ...) \
+    ((LOG_LOCAL_LEVEL >= (level)) ? LogDeferred<log_site_id(__FILE__, __LINE__, fmt)>((level), (tag), fmt, ##__VA_ARGS__) : (void)0)
+
+#undef ESP_LOGE
+#undef ESP_LOGW
+#undef ESP_LOGI
+#undef ESP_LOGD
+#undef ESP_LOGV
+#define ESP_LOGE(tag, fmt, ...) LOG_DEFER(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) LOG_DEFER(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) LOG_DEFER(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) LOG_DEFER(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) LOG_DEFER(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+#endif
 
 #endif // LOGGING_H
@@ -1,27 +1,96 @@
 #include "RemoteLogger.h"
 #include "Stm32Serial.h"
 #include "esp_log.h"
+#include <Preferences.h>
 #include <string.h>
 
-// Forwards a single (already parsed) log line to the STM32 over the inter-chip
-// UART. The full, unfiltered log stream is captured by LogBuffer and served on
-// the web UI; here we only forward high-value lines (errors, warnings and the
-// data-dump output) so we don't saturate the bandwidth-limited UART that is
-// shared with telemetry and log downloads.
-void RemoteLogger_Forward(int level, const char* tag, const char* msg) {
-    if (tag == nullptr || msg == nullptr) return;
+// Which log lines go to the STM32 over the inter-chip UART. The full,
+// unfiltered log stream is captured by LogBuffer and served on the web UI;
+// here we only forward what the level table lets through, by default the
+// high-value lines (errors, warnings and the data-dump output), so we don't
+// saturate the bandwidth-limited UART that is shared with telemetry and log
+// downloads. LOG_STM_x lines are written for the SD card and pass unless
+// their tag has a level of its own. The table is saved under "log_fwd" in
+// the "ecoflow" namespace.
+static LogLevels levels;
+static bool levelsReady = false;
+static portMUX_TYPE levelsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void RemoteLogger_Defaults() {
+    log_levels_init(&levels, ESP_LOG_WARN);
+    log_levels_set(&levels, "EcoflowDataParser", ESP_LOG_VERBOSE);
+    levelsReady = true;
+}
+
+void RemoteLogger_Begin() {
+    uint8_t table[LOG_LEVELS_PACKED_MAX];
+    Preferences prefs;
+    prefs.begin("ecoflow", true);
+    size_t len = prefs.getBytes("log_fwd", table, sizeof(table));
+    prefs.end();
+
+    portENTER_CRITICAL(&levelsMux);
+    if (!levelsReady) RemoteLogger_Defaults();
+    if (len > 0) log_levels_unpack(&levels, table, (int)len);
+    portEXIT_CRITICAL(&levelsMux);
+}
+
+// For LOG_STM_x lines, `stm`, a tag not in the table passes at every level
+static bool RemoteLogger_Pass(int level, const char* tag, bool stm) {
+    if (tag == nullptr) return false;
 
     // Prevent recursion: never feed logs originating from the serial/log
     // plumbing back into the UART forwarder.
     if (strcmp(tag, "Stm32Serial") == 0 || strcmp(tag, "LogBuffer") == 0) {
-        return;
+        return false;
     }
 
-    bool forward = (level == ESP_LOG_ERROR || level == ESP_LOG_WARN);
-    if (!forward && strcmp(tag, "EcoflowDataParser") == 0) {
-        forward = true;
-    }
-    if (!forward) return;
+    // A spinlock, not a mutex: this runs for every line, on any task
+    portENTER_CRITICAL(&levelsMux);
+    if (!levelsReady) RemoteLogger_Defaults();
+    uint8_t max = stm ? log_levels_get_or(&levels, tag, LOG_LEVELS_VERBOSE) : log_levels_get(&levels, tag);
+    bool forward = level == 0 || level <= max;
+    portEXIT_CRITICAL(&levelsMux);
+    return forward;
+}
+
+bool RemoteLogger_Wants(int level, const char* tag) {
+    return RemoteLogger_Pass(level, tag, false);
+}
 
+bool RemoteLogger_WantsStm(int level, const char* tag) {
+    return RemoteLogger_Pass(level, tag, true);
+}
+
+bool RemoteLogger_SetLevel(const char* tag, uint8_t level) {
+    uint8_t table[LOG_LEVELS_PACKED_MAX];
+    portENTER_CRITICAL(&levelsMux);
+    if (!levelsReady) RemoteLogger_Defaults();
+    bool ok = log_levels_set(&levels, tag, level);
+    int len = log_levels_pack(&levels, table);
+    portEXIT_CRITICAL(&levelsMux);
+    if (!ok) return false;
+
+    Preferences prefs;
+    prefs.begin("ecoflow", false);
+    prefs.putBytes("log_fwd", table, len);
+    prefs.end();
+    return true;
+}
+
+void RemoteLogger_GetLevels(LogLevels* out) {
+    portENTER_CRITICAL(&levelsMux);
+    if (!levelsReady) RemoteLogger_Defaults();
+    *out = levels;
+    portEXIT_CRITICAL(&levelsMux);
+}
+
+void RemoteLogger_Forward(int level, const char* tag, const char* msg) {
+    if (msg == nullptr || !RemoteLogger_Wants(level, tag)) return;
     Stm32Serial::getInstance().sendEspLog((uint8_t)level, tag, msg);
 }
+
+void RemoteLogger_ForwardRecord(int level, const char* tag, uint32_t fmtId, const uint8_t* args, int len) {
+    if (!RemoteLogger_Wants(level, tag)) return;
+    Stm32Serial::getInstance().sendEspLogRecord((uint8_t)level, tag, fmtId, args, (uint8_t)len);
+}
@@ -1,9 +1,32 @@
 #ifndef REMOTE_LOGGER_H
 #define REMOTE_LOGGER_H
 
+#include <stdint.h>
+#include "log_levels.h"
+
+// Loads the forwarding levels saved by RemoteLogger_SetLevel(). Until it has
+// run, or when nothing was saved, the defaults apply.
+void RemoteLogger_Begin();
+
+// Whether a line of this level and tag goes to the STM32: the per-tag level
+// table (log_levels.h), checked before anything is packed or queued.
+bool RemoteLogger_Wants(int level, const char* tag);
+
+// Same for LOG_STM_x lines (Logging.h): as in the days before the table,
+// they all go unless their tag has a level of its own.
+bool RemoteLogger_WantsStm(int level, const char* tag);
+
+// Sets one tag's forwarding level (NULL or "*" for the default,
+// LOG_LEVELS_UNSET to drop the tag) and saves the table. False if refused.
+bool RemoteLogger_SetLevel(const char* tag, uint8_t level);
+void RemoteLogger_GetLevels(LogLevels* out);
+
 // Forward an already-parsed log line (level + tag + message) to the STM32 over
-// the inter-chip UART. Only important lines are actually transmitted; see the
-// implementation for the filtering rules.
+// the inter-chip UART, if RemoteLogger_Wants() it.
 void RemoteLogger_Forward(int level, const char* tag, const char* msg);
 
+// Same for a deferred line: sends its packed arguments as a record under the
+// call site's format ID instead of the text.
+void RemoteLogger_ForwardRecord(int level, const char* tag, uint32_t fmtId, const uint8_t* args, int len);
+
 #endif
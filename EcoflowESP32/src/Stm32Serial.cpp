@@ -10,10 +10,19 @@
 #include "EcoflowESP32.h"
 #include "EcoflowDataParser.h"
 #include "WebServer.h"
+#include "ota_window.h"
+#include "ota_crc.h"
+#include "log_stream.h"
+#include "telem_block.h"
+#include "log_levels.h"
+#include "log_index.h"
+#include "log_record.h"
 #include <WiFi.h>
 #include <LittleFS.h>
 #include <esp_rom_crc.h>
+#include <time.h>
 #include <vector>
+#include "Logging.h"
 
 // Hardware Serial pin definition
 #define RX_PIN 18
@@ -21,6 +30,11 @@
 
 #define POWER_LATCH_PIN 39
 
+// UART writer task
+#define TX_TASK_STACK 4096
+#define TX_TASK_PRIO  2
+#define TX_CONTROL_WAIT_MS 100  // A rejected control frame waits this long for room
+
 static const char* TAG = "Stm32Serial";
 
 // Variables for OTA (from WebServer.cpp)
@@ -31,83 +45,95 @@ extern String ota_msg;
 // Variables for OTA
 static volatile bool otaAckReceived = false;
 static volatile bool otaNackReceived = false;
+static volatile uint8_t otaAckWindow = 0;       // Window granted in the START ACK
+static volatile uint8_t otaAckFlags = 0;        // OTA_FLAG_* the bootloader accepted
+static volatile uint32_t otaAckOffset = 0;      // Resumed START: where the bootloader continues
+static volatile bool otaWackReceived = false;
+static volatile uint32_t otaWack = 0;           // Latest WACK: NextSeq << 16 | Sack
+static volatile bool otaProgressReceived = false;
+static volatile uint32_t otaProgressSize = 0;   // Latest PROGRESS: file the bootloader can resume
+static volatile uint32_t otaProgressCrc = 0;
+static volatile uint32_t otaProgressOffset = 0;
 
 // Log Globals
+// Log list, fetched one CMD_LOG_LIST_RESP page at a time from update()
 static std::vector<Stm32Serial::LogEntry> _cachedLogList;
 static bool _logListReady = false;
+static bool _logListBusy = false;       // Pages still to fetch
+static uint16_t _logListTotal = 0;
+static uint32_t _logListLastMs = 0;     // Last request sent or page taken
+static uint8_t _logListRetries = 0;
 static SemaphoreHandle_t _logListMutex = NULL;
 
-static std::vector<uint8_t> _downloadBuffer;
-static bool _downloadComplete = false;
+#define LOG_LIST_RETRY_MS 500   // No page for this long: ask for it again
+#define LOG_LIST_RETRIES  5     // Then give up and report what arrived
+
+// Recorded telemetry: one query at a time, its CMD_TELEM_DATA pages land here
+static int32_t _telemMin[TELEM_POINTS_MAX];
+static int32_t _telemMax[TELEM_POINTS_MAX];
+static uint8_t _telemId = 0;
+static uint16_t _telemTotal = 0;
+static uint16_t _telemReceived = 0;
+static bool _telemReady = false;
+static SemaphoreHandle_t _telemMutex = NULL;
+
+// Log search: one at a time, the records of its CMD_LOG_SEARCH_RESP pages land here
+#define LOG_SEARCH_HITS_MAX 200   // Matches kept; the STM32 stops at the Max asked for
+static std::vector<Stm32Serial::LogSearchHit> _searchHits;
+static LogSearchEndMsg _searchEnd;
+static uint8_t _searchId = 0;
+static bool _searchDone = false;
+static SemaphoreHandle_t _searchMutex = NULL;
+
+// The STM32's level table, as its last CMD_LOG_LEVEL_LIST had it
+static LogLevels _stmLevels;
+static bool _stmLevelsKnown = false;
+static SemaphoreHandle_t _stmLevelsMutex = NULL;
+
+// Wall clock for the STM32's telemetry recorder, once NTP has set ours
+#define TIME_SYNC_PERIOD_MS 60000
+#define TIME_SYNC_EPOCH_MIN 1700000000
+static uint32_t _timeSyncLastMs = 0;
+static bool _timeSyncDue = true;
+
+// Log download: UART -> fixed ring -> HTTP response. Credit only covers
+// room in the ring, so a slow client throttles the STM32 (log_stream.h).
+static LogStream _logStream;
 static SemaphoreHandle_t _downloadMutex = NULL;
 
-// CRC32 Table
-static const uint32_t crc32_table[] = {
-    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
-    0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
-    0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
-    0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a, 0x745e66cd,
-    0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039, 0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5,
-    0xbe2b5b58, 0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
-    0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
-    0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d,
-    0x34867077, 0x30476dc0, 0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
-    0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca,
-    0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02,
-    0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
-    0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc, 0xb6238b25, 0xb2e29692,
-    0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a,
-    0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e, 0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
-    0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34, 0xdc3abded, 0xd8fba05a,
-    0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
-    0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
-    0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c, 0x3b5a6b9b,
-    0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff, 0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623,
-    0xf12f560e, 0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
-    0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
-    0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b,
-    0x9b3660c6, 0x9ff77d71, 0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
-    0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c,
-    0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24,
-    0x119b4be9, 0x155a565e, 0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
-    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a, 0x2d15ebe3, 0x29d4f654,
-    0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c,
-    0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
-    0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662, 0x933eb0bb, 0x97ffad0c,
-    0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
-};
-
-static uint32_t calculate_crc32(uint32_t crc, const uint8_t *buf, size_t len) {
-    crc = ~crc;
-    while (len--) {
-        crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buf++) & 0xFF];
-    }
-    return ~crc;
-}
-
 void Stm32Serial::begin() {
     Serial1.setRxBufferSize(16384); // Increase buffer for Log List bursts
-    Serial1.begin(460800, SERIAL_8N1, RX_PIN, TX_PIN);
+    Serial1.begin(LINK_BAUD_BASE, SERIAL_8N1, RX_PIN, TX_PIN);
+    _baud = LINK_BAUD_BASE;
+    applyBulkCap();
+    LinkBaudOps ops = { linkSend, linkSetBaud, this };
+    link_baud_init(&_linkBaud, LINK_ROLE_MASTER, &ops, micros());
     if (_txMutex == NULL) {
         _txMutex = xSemaphoreCreateMutex();
     }
-    // Clean up any stale recovery/OTA files on boot
+    if (_logBatchMutex == NULL) {
+        log_batch_init(&_logBatch, LOG_BATCH_RATE, LOG_BATCH_BURST, millis());
+        _logBatchMutex = xSemaphoreCreateMutex();
+    }
+    if (_txTaskHandle == NULL) {
+        xTaskCreate(txTask, "UartTx", TX_TASK_STACK, this, TX_TASK_PRIO, &_txTaskHandle);
+    }
+    // An update cut short by a reboot continues from the bootloader's
+    // progress record; without one the file is stale and goes
     if (LittleFS.begin()) {
         if (LittleFS.exists("/stm32_update.bin")) {
-            LittleFS.remove("/stm32_update.bin");
-            Serial.println("[Stm32Serial] Cleaned stale /stm32_update.bin from LittleFS.");
+            Serial.println("[Stm32Serial] Found /stm32_update.bin, asking the STM32 bootloader to resume it.");
+            startOta("/stm32_update.bin", true);
         }
     }
 }
 
-void Stm32Serial::resetRxBuffer() {
-    _rx_idx = 0;
-    _expected_len = 0;
-    _collecting = false;
-}
-
-void Stm32Serial::changeBaudRate(uint32_t baud) {
+void Stm32Serial::changeBaudRate(uint32_t baud, uint8_t framing) {
     _switchingBaud = true;
+    // Frames already queued were packed for the old baud; let them go out first.
+    if (!waitTxIdle(500)) {
+        ESP_LOGW(TAG, "TX queue not drained before baud change");
+    }
     vTaskDelay(pdMS_TO_TICKS(50));
 
     if (_txMutex != NULL) {
@@ -119,8 +145,11 @@ void Stm32Serial::changeBaudRate(uint32_t baud) {
     // aborts in uart_driver_install when heap is low (OTA runs right after a
     // ~400 KB upload, leaving little free heap). updateBaudRate() allocates
     // nothing and keeps the existing driver/buffer.
-    resetRxBuffer();
+    link_parser_set_framing(&_rxParser, framing);
     Serial1.updateBaudRate(baud);
+    _baud = baud;
+    _framing = framing;
+    applyBulkCap();
 
     if (_txMutex != NULL) {
         xSemaphoreGive(_txMutex);
@@ -129,18 +158,97 @@ void Stm32Serial::changeBaudRate(uint32_t baud) {
     _switchingBaud = false;
 }
 
+void Stm32Serial::txTask(void* parameter) {
+    Stm32Serial* self = (Stm32Serial*)parameter;
+    static uint8_t frame[LINK_FRAME_MAX];
+    static uint8_t encoded[COBS_FRAME_MAX];
+
+    for (;;) {
+        // Frames left in the queue after a drain are bulk waiting for tokens:
+        // poll every tick until they are released, otherwise sleep until notified.
+        ulTaskNotifyTake(pdTRUE, link_txq_empty(&self->_txq) ? portMAX_DELAY : 1);
+
+        self->_txBusy = true;
+        int len;
+        while ((len = link_txq_pop(&self->_txq, frame, micros())) > 0) {
+            xSemaphoreTake(self->_txMutex, portMAX_DELAY);
+            if (self->_framing == LINK_FRAMING_COBS) {
+                Serial1.write(encoded, pack_cobs_frame(encoded, frame, len));
+            } else {
+                Serial1.write(frame, len);
+            }
+            xSemaphoreGive(self->_txMutex);
+        }
+        self->_txBusy = false;
+    }
+}
+
+void Stm32Serial::applyBulkCap() {
+    // During OTA the only traffic is the firmware stream itself; don't throttle it.
+    uint32_t rate = _otaRunning ? 0 : LINK_BULK_RATE_FOR_BAUD(_baud);
+    link_txq_set_bulk_rate(&_txq, rate, 2 * LINK_FRAME_MAX);
+}
+
+bool Stm32Serial::waitTxIdle(uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (!link_txq_empty(&_txq) || _txBusy) {
+        if (millis() - start >= timeoutMs) return false;
+        vTaskDelay(1);
+    }
+    Serial1.flush();
+    return true;
+}
+
+void Stm32Serial::linkSend(void* user, const uint8_t* frame, int len) {
+    ((Stm32Serial*)user)->sendData(frame, len);
+}
+
+void Stm32Serial::linkSetBaud(void* user, uint32_t baud, uint8_t framing) {
+    ESP_LOGI(TAG, "Link baud -> %u (%s)", (unsigned)baud, framing == LINK_FRAMING_COBS ? "COBS" : "legacy");
+    ((Stm32Serial*)user)->changeBaudRate(baud, framing);
+}
+
+// Requests may come from the CLI or web task; the negotiator itself only runs
+// in update(), so they are handed over through _linkRequest.
+bool Stm32Serial::negotiateBaud() {
+    if (_otaRunning || link_baud_busy(&_linkBaud) || _linkRequest != LINK_REQ_NONE) return false;
+    _linkRequest = LINK_REQ_NEGOTIATE;
+    return true;
+}
+
+bool Stm32Serial::startLinkTest(uint16_t count, uint8_t pad) {
+    if (_otaRunning || link_baud_busy(&_linkBaud) || _linkRequest != LINK_REQ_NONE) return false;
+    _linkTestCount = count;
+    _linkTestPad = pad;
+    _linkRequest = LINK_REQ_TEST;
+    return true;
+}
+
 void Stm32Serial::sendData(const uint8_t* data, size_t len) {
     if (_switchingBaud) return;
-    if (_txMutex != NULL) {
-        if (xSemaphoreTake(_txMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            Serial1.write(data, len);
-            xSemaphoreGive(_txMutex);
-        } else {
-            ESP_LOGE(TAG, "Failed to take TX mutex");
-        }
-    } else {
+    if (len < 2) return;
+
+    if (_txTaskHandle == NULL) {
+        // begin() not called yet: nothing owns the UART, write directly.
         Serial1.write(data, len);
+        return;
+    }
+
+    LinkPriority prio = link_priority_for_cmd(data[1]);
+    TickType_t start = xTaskGetTickCount();
+    while (!link_txq_push(&_txq, prio, data, len, micros())) {
+        // Control rejects instead of dropping what is queued: wake the TX task
+        // and retry until it frees a slot, as UART_SendRaw does on the STM32.
+        // Telemetry and bulk are stale by then and go at once.
+        if (prio != LINK_PRIO_CONTROL || (xTaskGetTickCount() - start) > pdMS_TO_TICKS(TX_CONTROL_WAIT_MS)) {
+            link_txq_give_up(&_txq, prio);
+            ESP_LOGW(TAG, "TX queue full, dropped cmd 0x%02X", data[1]);
+            return;
+        }
+        xTaskNotifyGive(_txTaskHandle);
+        vTaskDelay(1);
     }
+    xTaskNotifyGive(_txTaskHandle);
 }
 
 void Stm32Serial::sendEspLog(uint8_t level, const char* tag, const char* msg) {
@@ -150,79 +258,159 @@ void Stm32Serial::sendEspLog(uint8_t level, const char* tag, const char* msg) {
     // traffic (especially at a mismatched baud) can cause UART overruns that
     // wedge the STM32 receiver so it never sees the OTA Start.
     if (_otaRunning) return;
-    if (_txMutex != NULL) {
-        if (xSemaphoreTake(_txMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            uint8_t buf[256];
-            int len = pack_esp_log_message(buf, level, tag, msg);
-            Serial1.write(buf, len);
-            xSemaphoreGive(_txMutex);
-        }
+    uint8_t buf[LINK_FRAME_MAX];
+    int len = pack_esp_log_message(buf, level, tag, msg);
+    if (len > 0) queueLog(buf, len);
+}
+
+void Stm32Serial::sendEspLogRecord(uint8_t level, const char* tag, uint32_t fmt_id, const uint8_t* args, uint8_t args_len) {
+    if (_switchingBaud || _otaRunning) return;  // As sendEspLog
+    uint8_t buf[LINK_FRAME_MAX];
+    int len = pack_esp_log_rec_message(buf, level, fmt_id, log_levels_tag_id(tag), args, args_len);
+    if (len > 0) queueLog(buf, len);
+}
+
+void Stm32Serial::queueLog(const uint8_t* frame, int len) {
+    if (_logBatchMutex == NULL) {
+        // begin() not called yet: no batch, send the line as it is
+        sendData(frame, len);
+        return;
+    }
+    xSemaphoreTake(_logBatchMutex, portMAX_DELAY);
+    log_batch_add(&_logBatch, frame, len, millis());
+    sendLogBatch();
+    xSemaphoreGive(_logBatchMutex);
+}
+
+void Stm32Serial::sendLogBatch() {
+    // Queued under the mutex so batches leave in the order they were made.
+    // sendData's own warnings are not forwarded (RemoteLogger), so this
+    // does not come back here.
+    static uint8_t frame[LINK_FRAME_MAX];
+    int len;
+    while ((len = log_batch_take(&_logBatch, millis(), false, frame)) > 0) {
+        sendData(frame, len);
     }
 }
 
+void Stm32Serial::getLogBatchStats(LogBatchStats* out) {
+    if (_logBatchMutex == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(_logBatchMutex, portMAX_DELAY);
+    *out = _logBatch.stats;
+    xSemaphoreGive(_logBatchMutex);
+}
+
 void Stm32Serial::update() {
     if (_switchingBaud) return;
 
+    // The OTA task drives the baud itself; keep the negotiator out of its way.
+    if (!_otaRunning) {
+        if (_linkRequest == LINK_REQ_NEGOTIATE) link_baud_negotiate(&_linkBaud, micros());
+        else if (_linkRequest == LINK_REQ_TEST) link_baud_selftest(&_linkBaud, _linkTestCount, _linkTestPad, micros());
+        _linkRequest = LINK_REQ_NONE;
+        link_baud_tick(&_linkBaud, micros());
+    }
+
     // bounded — freeze plan F6
     int drained = 0;
     while (Serial1.available()) {
-        uint8_t b = Serial1.read();
+        LinkParseResult r = link_parser_feed(&_rxParser, (uint8_t)Serial1.read());
+        if (r == LINK_PARSE_FRAME) {
+            processPacket(_rxParser.buf, _rxParser.frame_len);
+        } else if (r == LINK_PARSE_CRC_ERROR) {
+            ESP_LOGE(TAG, "CRC Fail: cmd 0x%02X len %u", _rxParser.buf[1], _rxParser.buf[2]);
+            link_baud_on_error(&_linkBaud, micros());
+            // A lost log chunk shows up as a gap in the next one, or as a
+            // stall when it was the last one in flight (below).
+        }
         if (++drained >= 1024) { taskYIELD(); break; }
-        if (!_collecting) {
-            if (b == START_BYTE) {
-                _collecting = true;
-                _rx_idx = 0;
-                _rx_buf[_rx_idx++] = b;
-            }
-        } else {
-            _rx_buf[_rx_idx++] = b;
+    }
 
-            if (_rx_idx == 3) {
-                _expected_len = _rx_buf[2];
-                if (_expected_len > 250) {
-                    _collecting = false;
-                    _rx_idx = 0;
-                }
-            } else if (_rx_idx > 3) {
-                 if (_rx_idx == (4 + _expected_len)) {
-                    uint8_t received_crc = _rx_buf[_rx_idx - 1];
-                    uint8_t calculated_crc = calculate_crc8(&_rx_buf[1], 2 + _expected_len);
-
-                    if (received_crc == calculated_crc) {
-                        processPacket(_rx_buf, _rx_idx);
-                    } else {
-                        ESP_LOGE(TAG, "CRC Fail: Rx %02X != Calc %02X", received_crc, calculated_crc);
-                        // If we are downloading, a CRC fail means we missed a chunk.
-                        // We can't know the exact offset from the corrupted packet safely,
-                        // but we know what we expect.
-                        if (!_downloadComplete && _downloadMutex) {
-                             // Only if we started a download recently
-                             sendLogResendReq(_expectedLogOffset);
-                        }
-                    }
-                    _collecting = false;
-                    _rx_idx = 0;
-                }
+    // Lost list page or request: ask again from what arrived
+    if (_logListBusy && millis() - _logListLastMs > LOG_LIST_RETRY_MS &&
+        xSemaphoreTake(_logListMutex, 0) == pdTRUE) {
+        if (_logListBusy && millis() - _logListLastMs > LOG_LIST_RETRY_MS) {
+            if (++_logListRetries > LOG_LIST_RETRIES) {
+                ESP_LOGW(TAG, "Log list incomplete: %u of %u", (unsigned)_cachedLogList.size(), _logListTotal);
+                _logListBusy = false;
+                _logListReady = true;
+            } else {
+                requestLogListPage(_cachedLogList.size());
             }
+        }
+        xSemaphoreGive(_logListMutex);
+    }
 
-            if (_rx_idx >= sizeof(_rx_buf)) {
-                _collecting = false;
-                _rx_idx = 0;
-            }
+    // The recorder drifts with the STM32's tick; keep it on our clock
+    if ((_timeSyncDue || millis() - _timeSyncLastMs > TIME_SYNC_PERIOD_MS) && !_otaRunning) {
+        time_t now = time(nullptr);
+        if (now >= TIME_SYNC_EPOCH_MIN) {
+            uint8_t buf[8];
+            int l = pack_time_sync_message(buf, (uint32_t)now);
+            sendData(buf, l);
+            _timeSyncDue = false;
         }
+        _timeSyncLastMs = millis();
+    }
+
+    // Log lines that have waited LOG_BATCH_MS for company
+    if (_logBatchMutex && !_otaRunning && xSemaphoreTake(_logBatchMutex, 0) == pdTRUE) {
+        sendLogBatch();
+        xSemaphoreGive(_logBatchMutex);
+    }
+
+    // Credit the reader made room for, keep-alive, stall recovery
+    if (_downloadMutex && xSemaphoreTake(_downloadMutex, 0) == pdTRUE) {
+        bool wasActive = _logStream.active;
+        uint8_t actions = log_stream_poll(&_logStream, millis());
+        if (wasActive && _logStream.failed) {
+            ESP_LOGW(TAG, "Log download: no data after %d resends, ending it", LOG_STREAM_STALLS_MAX);
+        }
+        sendLogActions(actions);
+        xSemaphoreGive(_downloadMutex);
     }
 }
 
-void Stm32Serial::processPacket(uint8_t* rx_buf, uint8_t len) {
+void Stm32Serial::processPacket(uint8_t* rx_buf, uint16_t len) {
     uint8_t cmd = rx_buf[1];
 
+    // Ping/echo and baud negotiation frames
+    if (link_baud_on_frame(&_linkBaud, rx_buf, micros())) return;
+
     if (cmd == CMD_HANDSHAKE) {
         uint8_t ack[4];
         int l = pack_handshake_ack_message(ack);
         sendData(ack, l);
         sendDeviceList();
+        requestStmLogLevels();
+        _timeSyncDue = true;
+        // The STM32 (re)booted at the base rate: raise it again.
+        if (!_otaRunning) link_baud_negotiate(&_linkBaud, micros());
     } else if (cmd == CMD_OTA_ACK) {
+        otaAckWindow = (rx_buf[2] >= 1) ? rx_buf[3] : 0;
+        otaAckFlags = (rx_buf[2] >= 2) ? rx_buf[4] : 0;
+        uint32_t resumeOffset = 0;
+        if (rx_buf[2] >= 6) memcpy(&resumeOffset, &rx_buf[5], 4);
+        otaAckOffset = resumeOffset;
         otaAckReceived = true;
+    } else if (cmd == CMD_OTA_PROGRESS) {
+        uint32_t size, crc, offset;
+        if (unpack_ota_progress_message(rx_buf, &size, &crc, &offset) == 0) {
+            otaProgressSize = size;
+            otaProgressCrc = crc;
+            otaProgressOffset = offset;
+            otaProgressReceived = true;
+        }
+    } else if (cmd == CMD_OTA_WACK) {
+        uint16_t nextSeq, sack;
+        if (unpack_ota_wack_message(rx_buf, &nextSeq, &sack) == 0) {
+            // Acks are cumulative, the latest one supersedes the rest
+            otaWack = ((uint32_t)nextSeq << 16) | sack;
+            otaWackReceived = true;
+        }
     } else if (cmd == CMD_OTA_NACK) {
         otaNackReceived = true;
     } else if (cmd == CMD_GET_DEVICE_STATUS) {
@@ -365,21 +553,73 @@ void Stm32Serial::processPacket(uint8_t* rx_buf, uint8_t len) {
     } else if (cmd == CMD_GET_DEBUG_DUMP) {
         EcoflowDataParser::triggerDebugDump();
     } else if (cmd == CMD_LOG_LIST_RESP) {
-        uint16_t total, idx;
-        uint32_t size;
-        char name[32];
-        if (unpack_log_list_resp_message(rx_buf, &total, &idx, &size, name) == 0) {
-            if (!_logListMutex) _logListMutex = xSemaphoreCreateMutex();
+        uint16_t total, cursor;
+        uint8_t count;
+        if (_logListMutex && unpack_log_list_resp_message(rx_buf, &total, &cursor, &count) == 0) {
             xSemaphoreTake(_logListMutex, portMAX_DELAY);
-            if (idx == 0) _cachedLogList.clear();
-            if (total > 0 && name[0]) {
-                _cachedLogList.push_back({String(name), size});
-            }
-            if (idx == total - 1 || total == 0) {
-                _logListReady = true;
+            // A page resent after a timeout can arrive twice; take the one that continues the list
+            if (_logListBusy && cursor == _cachedLogList.size()) {
+                uint32_t size;
+                char name[LOG_LIST_NAME_MAX + 1];
+                int pos = 0;
+                while ((pos = unpack_log_list_resp_entry(rx_buf, pos, &size, name)) >= 0) {
+                    _cachedLogList.push_back({String(name), size});
+                }
+                _logListTotal = total;
+                _logListRetries = 0;
+                if (_cachedLogList.size() >= total || count == 0) {
+                    _logListBusy = false;
+                    _logListReady = true;
+                } else {
+                    requestLogListPage(_cachedLogList.size());
+                }
             }
             xSemaphoreGive(_logListMutex);
         }
+    } else if (cmd == CMD_TELEM_DATA) {
+        TelemDataHeader hdr;
+        int32_t min[TELEM_DATA_POINTS], max[TELEM_DATA_POINTS];
+        if (_telemMutex && unpack_telem_data_message(rx_buf, &hdr, min, max) == 0) {
+            xSemaphoreTake(_telemMutex, portMAX_DELAY);
+            // Pages of an abandoned query are dropped by their id
+            if (hdr.id == _telemId && !_telemReady && hdr.total <= TELEM_POINTS_MAX &&
+                hdr.first + hdr.count <= hdr.total) {
+                memcpy(&_telemMin[hdr.first], min, hdr.count * sizeof(int32_t));
+                memcpy(&_telemMax[hdr.first], max, hdr.count * sizeof(int32_t));
+                _telemTotal = hdr.total;
+                _telemReceived += hdr.count;
+                _telemReady = _telemReceived >= hdr.total;
+            }
+            xSemaphoreGive(_telemMutex);
+        }
+    } else if (cmd == CMD_LOG_LEVEL_LIST) {
+        const uint8_t* table;
+        int l = unpack_log_level_list_message(rx_buf, &table);
+        if (_stmLevelsMutex && l >= 0) {
+            xSemaphoreTake(_stmLevelsMutex, portMAX_DELAY);
+            _stmLevelsKnown = log_levels_unpack(&_stmLevels, table, l);
+            xSemaphoreGive(_stmLevelsMutex);
+        }
+    } else if (cmd == CMD_LOG_SEARCH_RESP) {
+        uint8_t id, count;
+        if (_searchMutex && unpack_log_search_resp_message(rx_buf, &id, &count) == 0) {
+            xSemaphoreTake(_searchMutex, portMAX_DELAY);
+            // Pages of an abandoned search are dropped by their id
+            if (id == _searchId && !_searchDone) {
+                if (count == 0) {
+                    _searchDone = unpack_log_search_end_message(rx_buf, &_searchEnd) == 0;
+                } else {
+                    uint32_t offset;
+                    const uint8_t* rec;
+                    int rec_len, pos = 0;
+                    while ((pos = unpack_log_search_resp_entry(rx_buf, pos, &offset, &rec, &rec_len)) >= 0 &&
+                           _searchHits.size() < LOG_SEARCH_HITS_MAX) {
+                        if (rec_len >= LOG_REC_HDR) _searchHits.push_back({offset, std::vector<uint8_t>(rec, rec + rec_len)});
+                    }
+                }
+            }
+            xSemaphoreGive(_searchMutex);
+        }
     } else if (cmd == CMD_LOG_DATA_CHUNK) {
         if (len >= 9) {
             uint32_t offset;
@@ -387,26 +627,17 @@ void Stm32Serial::processPacket(uint8_t* rx_buf, uint8_t len) {
             memcpy(&offset, &rx_buf[3], 4);
             memcpy(&dataLen, &rx_buf[7], 2);
 
-            if (offset != _expectedLogOffset) {
-                ESP_LOGW(TAG, "Log Offset Mismatch: Exp %u, Got %u", _expectedLogOffset, offset);
-                // Missed packet(s). Request Resend.
-                sendLogResendReq(_expectedLogOffset);
-                return;
-            }
-
-            if (!_downloadMutex) _downloadMutex = xSemaphoreCreateMutex();
+            if (!_downloadMutex || len < 9 + dataLen) return;
             xSemaphoreTake(_downloadMutex, portMAX_DELAY);
-            if (dataLen > 0) {
-                if (len >= 9 + dataLen) {
-                    size_t current = _downloadBuffer.size();
-                    _downloadBuffer.resize(current + dataLen);
-                    memcpy(&_downloadBuffer[current], &rx_buf[9], dataLen);
-                    _expectedLogOffset += dataLen;
-                }
-            } else {
-                _downloadComplete = true;
+            uint32_t expected = log_stream_offset(&_logStream);
+            uint8_t actions = log_stream_on_chunk(&_logStream, offset, &rx_buf[9], dataLen, millis());
+            if (actions & LOG_STREAM_SEND_RESEND) {
+                ESP_LOGW(TAG, "Log Offset Mismatch: Exp %u, Got %u", expected, offset);
+            }
+            if (dataLen == 0 && (actions & LOG_STREAM_SEND_CREDIT)) {
                 ESP_LOGI(TAG, "Log Download Complete (EOF Received)");
             }
+            sendLogActions(actions);
             xSemaphoreGive(_downloadMutex);
         }
     }
@@ -570,24 +801,123 @@ void Stm32Serial::sendDeviceStatus(uint8_t device_id) {
 
 void Stm32Serial::requestLogList() {
     if(!_logListMutex) _logListMutex = xSemaphoreCreateMutex();
+    xSemaphoreTake(_logListMutex, portMAX_DELAY);
+    _cachedLogList.clear();
     _logListReady = false;
+    _logListBusy = true;
+    _logListTotal = 0;
+    _logListRetries = 0;
+    requestLogListPage(0);
+    xSemaphoreGive(_logListMutex);
+}
+
+void Stm32Serial::requestLogListPage(uint16_t cursor) {
+    _logListLastMs = millis();
     uint8_t buf[8];
-    int l = pack_log_list_req_message(buf);
+    int l = pack_log_list_req_message(buf, cursor);
     sendData(buf, l);
 }
 
+bool Stm32Serial::isLogListReady() {
+    return _logListReady;
+}
+
 std::vector<Stm32Serial::LogEntry> Stm32Serial::getLogList() {
-    uint32_t start = millis();
-    while(!_logListReady && millis() - start < 20000) {
-        if (_logListReady) break;
-        vTaskDelay(10);
-    }
+    if (!_logListMutex) return {};
     xSemaphoreTake(_logListMutex, portMAX_DELAY);
     std::vector<LogEntry> copy = _cachedLogList;
     xSemaphoreGive(_logListMutex);
     return copy;
 }
 
+void Stm32Serial::requestTelemetry(uint8_t dev, uint8_t field, uint32_t from, uint32_t to, uint16_t points) {
+    if (!_telemMutex) _telemMutex = xSemaphoreCreateMutex();
+    xSemaphoreTake(_telemMutex, portMAX_DELAY);
+    TelemQueryMsg q = {++_telemId, dev, field, from, to, points};
+    _telemTotal = 0;
+    _telemReceived = 0;
+    _telemReady = false;
+    xSemaphoreGive(_telemMutex);
+
+    uint8_t buf[sizeof(TelemQueryMsg) + 4];
+    int l = pack_telem_query_message(buf, &q);
+    sendData(buf, l);
+}
+
+bool Stm32Serial::isTelemetryReady() {
+    return _telemReady;
+}
+
+void Stm32Serial::getTelemetry(std::vector<int32_t>& min, std::vector<int32_t>& max) {
+    if (!_telemMutex) return;
+    xSemaphoreTake(_telemMutex, portMAX_DELAY);
+    min.assign(_telemMin, _telemMin + _telemTotal);
+    max.assign(_telemMax, _telemMax + _telemTotal);
+    xSemaphoreGive(_telemMutex);
+}
+
+void Stm32Serial::startLogSearch(const String& name, const String& text, uint8_t levels,
+                                 uint32_t tickFrom, uint32_t tickTo, uint16_t max,
+                                 const std::vector<uint32_t>& fmts) {
+    if (!_searchMutex) _searchMutex = xSemaphoreCreateMutex();
+    LogSearchMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.levels = levels;
+    msg.tick_from = tickFrom;
+    msg.tick_to = tickTo;
+    msg.max = max < LOG_SEARCH_HITS_MAX ? max : LOG_SEARCH_HITS_MAX;
+    for (size_t i = 0; i < fmts.size() && i < LOG_IDX_FMTS_MAX; i++) msg.fmt[msg.nfmts++] = fmts[i];
+    strncpy(msg.name, name.c_str(), sizeof(msg.name) - 1);
+    strncpy(msg.text, text.c_str(), sizeof(msg.text) - 1);
+
+    xSemaphoreTake(_searchMutex, portMAX_DELAY);
+    msg.id = ++_searchId;
+    _searchHits.clear();
+    _searchDone = false;
+    xSemaphoreGive(_searchMutex);
+
+    uint8_t buf[sizeof(LogSearchMsg) + 4];
+    int l = pack_log_search_message(buf, &msg);
+    sendData(buf, l);
+}
+
+bool Stm32Serial::isLogSearchDone() {
+    return _searchDone;
+}
+
+void Stm32Serial::getLogSearch(std::vector<LogSearchHit>& hits, LogSearchEndMsg& end) {
+    if (!_searchMutex) return;
+    xSemaphoreTake(_searchMutex, portMAX_DELAY);
+    hits.swap(_searchHits);
+    _searchHits.clear();
+    end = _searchEnd;
+    xSemaphoreGive(_searchMutex);
+}
+
+void Stm32Serial::setStmLogLevel(const char* tag, uint8_t level) {
+    if (!_stmLevelsMutex) _stmLevelsMutex = xSemaphoreCreateMutex();
+    uint8_t buf[LOG_LEVELS_TAG_MAX + 5];
+    if (tag && strlen(tag) > LOG_LEVELS_TAG_MAX) return;
+    int l = pack_log_level_set_message(buf, level, tag);
+    sendData(buf, l);
+}
+
+void Stm32Serial::requestStmLogLevels() {
+    if (!_stmLevelsMutex) _stmLevelsMutex = xSemaphoreCreateMutex();
+    uint8_t buf[4];
+    int l = pack_simple_cmd_message(buf, CMD_LOG_LEVEL_GET);
+    sendData(buf, l);
+}
+
+bool Stm32Serial::getStmLogLevels(LogLevels* out) {
+    if (!_stmLevelsMutex) return false;
+    xSemaphoreTake(_stmLevelsMutex, portMAX_DELAY);
+    bool known = _stmLevelsKnown;
+    if (known) *out = _stmLevels;
+    xSemaphoreGive(_stmLevelsMutex);
+    return known;
+}
+
 void Stm32Serial::deleteLog(const String& name) {
     uint8_t buf[64];
     int len = pack_log_delete_req_message(buf, name.c_str());
@@ -601,15 +931,14 @@ void Stm32Serial::startLogDownload(const String& name) {
         ESP_LOGW(TAG, "startLogDownload: mutex timeout");
         return;
     }
-    _downloadBuffer.clear();
-    _downloadBuffer.reserve(4096);
-    _downloadComplete = false;
-    _expectedLogOffset = 0;
-    xSemaphoreGive(_downloadMutex);
+    uint8_t actions = log_stream_start(&_logStream, millis());
 
     uint8_t buf[64];
     int len = pack_log_download_req_message(buf, name.c_str());
     sendData(buf, len);
+    // The STM32 sends nothing until granted room
+    sendLogActions(actions);
+    xSemaphoreGive(_downloadMutex);
 }
 
 void Stm32Serial::sendLogResendReq(uint32_t offset) {
@@ -618,16 +947,24 @@ void Stm32Serial::sendLogResendReq(uint32_t offset) {
     sendData(buf, len);
 }
 
+void Stm32Serial::sendLogActions(uint8_t actions) {
+    uint8_t buf[16];
+    if (actions & LOG_STREAM_SEND_RESEND) {
+        sendLogResendReq(log_stream_offset(&_logStream));
+    }
+    if (actions & LOG_STREAM_SEND_CREDIT) {
+        uint32_t offset = log_stream_offset(&_logStream);
+        int len = pack_log_credit_message(buf, offset, log_stream_credits(&_logStream));
+        sendData(buf, len);
+    }
+}
+
 size_t Stm32Serial::readLogChunk(uint8_t* buffer, size_t maxLen) {
     size_t read = 0;
     if(!_downloadMutex) return 0;
     // bounded — freeze plan F2
     if (xSemaphoreTake(_downloadMutex, pdMS_TO_TICKS(50)) != pdTRUE) return 0;
-    if (!_downloadBuffer.empty()) {
-        read = std::min(maxLen, _downloadBuffer.size());
-        memcpy(buffer, _downloadBuffer.data(), read);
-        _downloadBuffer.erase(_downloadBuffer.begin(), _downloadBuffer.begin() + read);
-    }
+    read = log_stream_read(&_logStream, buffer, maxLen);
     xSemaphoreGive(_downloadMutex);
     return read;
 }
@@ -636,7 +973,7 @@ bool Stm32Serial::isLogDownloadComplete() {
     if(!_downloadMutex) return true;
     // bounded — freeze plan F2
     if (xSemaphoreTake(_downloadMutex, pdMS_TO_TICKS(20)) != pdTRUE) return false;
-    bool c = _downloadComplete && _downloadBuffer.empty();
+    bool c = log_stream_done(&_logStream);
     xSemaphoreGive(_downloadMutex);
     return c;
 }
@@ -644,71 +981,115 @@ bool Stm32Serial::isLogDownloadComplete() {
 size_t Stm32Serial::getDownloadBufferSize() {
     if(!_downloadMutex) return 0;
     xSemaphoreTake(_downloadMutex, portMAX_DELAY);
-    size_t s = _downloadBuffer.size();
+    size_t s = log_stream_buffered(&_logStream);
     xSemaphoreGive(_downloadMutex);
     return s;
 }
 
 void Stm32Serial::abortLogDownload() {
-    // Placeholder
+    if(!_downloadMutex) return;
+    // Without new credit the STM32 stops after the window and drops the file
+    xSemaphoreTake(_downloadMutex, portMAX_DELAY);
+    log_stream_abort(&_logStream);
+    xSemaphoreGive(_downloadMutex);
 }
 
-static String otaFilename;
-void Stm32Serial::startOta(const String& filename) {
-    if (_otaRunning) return;
-    otaFilename = filename;
-    _otaRunning = true;
-    xTaskCreate(otaTask, "OtaTask", 8192, this, 1, NULL);
+
+// How a stream attempt ended. A lost link leaves the bootloader's progress
+// record behind, so the next session resumes instead of starting over.
+enum OtaStreamResult { OTA_STREAM_DONE, OTA_STREAM_LINK_LOST, OTA_STREAM_FAILED };
+
+#define OTA_SESSIONS 3   // Handshake + stream attempts per update
+
+/**
+ * @brief ota_crc32 of the whole file. START names the file with it, so the
+ * bootloader only resumes the same image, and END checks it.
+ */
+static uint32_t otaFileCrc(File& f) {
+    uint8_t buf[512];
+    uint32_t crc = 0;
+    int n;
+    f.seek(0);
+    while ((n = f.read(buf, sizeof(buf))) > 0) crc = ota_crc32(crc, buf, n);
+    f.seek(0);
+    return crc;
 }
 
-void Stm32Serial::otaTask(void* parameter) {
-    Stm32Serial* self = (Stm32Serial*)parameter;
-    Serial.printf("[Stm32Serial] otaTask: Starting. Opening file: %s\n", otaFilename.c_str());
-    LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Flash task started (heap=%u)", (unsigned)ESP.getFreeHeap());
-    File f = LittleFS.open(otaFilename, "r");
-    if (!f) {
-        Serial.printf("[Stm32Serial] otaTask: Failed to open firmware file in LittleFS: %s\n", otaFilename.c_str());
-        LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Failed to open firmware file in LittleFS");
-        ota_state = 4; ota_msg = "FS Error";
-        LittleFS.remove(otaFilename);
-        self->_otaRunning = false;
-        vTaskDelete(NULL);
-        return;
+/**
+ * @brief Asks a bootloader for its progress record.
+ * @return Offset at which it can continue this file, 0 if it cannot.
+ */
+static uint32_t otaQueryResume(Stm32Serial* self, uint32_t totalSize, uint32_t fileCrc, bool* answered) {
+    uint8_t buf[8];
+    otaProgressReceived = false;
+    int len = pack_ota_query_message(buf);
+    self->sendData(buf, len);
+    uint32_t startWait = millis();
+    while (!otaProgressReceived && millis() - startWait < 300) {
+        vTaskDelay(10);
     }
+    *answered = otaProgressReceived;
+    if (!otaProgressReceived || otaProgressSize != totalSize || otaProgressCrc != fileCrc) return 0;
+    return otaProgressOffset;
+}
 
-    uint32_t totalSize = f.size();
-    Serial.printf("[Stm32Serial] otaTask: Binary size: %u bytes\n", totalSize);
-    LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Firmware size: %u bytes. Negotiating @921600...", (unsigned)totalSize);
-
-    // Start immediately at 921600 baud to catch the bootloader on boot
-    Serial.println("[Stm32Serial] otaTask: Switching UART to 921600 baud for bootloader...");
-    self->changeBaudRate(921600);
+/**
+ * @brief Gets the STM32 to accept START: the bootloader if it is running,
+ * else the main app, which programs the inactive bank in the background.
+ * @param resumeOnly Only a bootloader or app already holding progress for this file counts.
+ * @param offset Out: where the STM32 continues the file.
+ */
+bool Stm32Serial::otaHandshake(Stm32Serial* self, uint32_t totalSize, uint32_t fileCrc, uint32_t appBaud,
+                               uint8_t appFraming, bool resumeOnly, uint32_t* offset) {
+    uint8_t buf[32];
 
-    bool startSuccess = false;
-    uint8_t buf[256];
-    int len = pack_ota_start_message(buf, totalSize);
+    // A COBS link means the app is up and cannot parse a legacy OTA Start:
+    // skip the bootloader probe and go to the app directly.
+    int firstAttempt = (appFraming == LINK_FRAMING_COBS && !resumeOnly) ? 1 : 0;
+    int attempts = resumeOnly ? 2 : 5;
 
-    Serial.println("[Stm32Serial] otaTask: Commencing handshake loop (max 5 attempts)...");
-    for(int attempt=0; attempt<5; attempt++) {
+    Serial.printf("[Stm32Serial] otaTask: Commencing handshake loop (max %d attempts)...\n", attempts);
+    for(int attempt=firstAttempt; attempt<attempts; attempt++) {
         if (attempt == 1) {
-            Serial.println("[Stm32Serial] otaTask: Attempt 1 (921600) failed/timed out. Switching UART to 460800 baud for main app...");
-            self->changeBaudRate(460800);
+            Serial.printf("[Stm32Serial] otaTask: Attempt 1 (921600) failed/timed out. Switching UART to %u baud for main app...\n", (unsigned)appBaud);
+            self->changeBaudRate(appBaud, appFraming);
         } else if (attempt == 2) {
-            Serial.println("[Stm32Serial] otaTask: Attempt 2 (460800) failed/timed out. Switching UART to 921600 baud for bootloader...");
+            Serial.println("[Stm32Serial] otaTask: Attempt 2 (app baud) failed/timed out. Switching UART to 921600 baud for bootloader...");
             self->changeBaudRate(921600);
         }
 
+        // Bootloader and app both keep the progress record and answer the
+        // query; an app that predates the background update stays silent
+        uint8_t flags = OTA_FLAG_CHUNK_CRC;
+        bool answered = false;
+        uint32_t resumeAt = otaQueryResume(self, totalSize, fileCrc, &answered);
+        if (resumeAt > 0) {
+            Serial.printf("[Stm32Serial] otaTask: STM32 holds %u/%u bytes of this image, resuming\n",
+                          (unsigned)resumeAt, (unsigned)totalSize);
+            LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "STM32 holds %u/%u bytes, resuming",
+                                          (unsigned)resumeAt, (unsigned)totalSize);
+            flags |= OTA_FLAG_RESUME;
+        } else if (resumeOnly) {
+            Serial.printf("[Stm32Serial] otaTask: Nothing to resume (%s %s)\n", attempt == 1 ? "app" : "bootloader",
+                          answered ? "has no record of this image" : "silent");
+            continue;
+        }
+
         otaAckReceived = false;
         otaNackReceived = false;
-
-        Serial.printf("[Stm32Serial] otaTask: Sending OTA Start packet (Attempt %d/5)...\n", attempt+1);
-        ota_msg = String("Negotiating (attempt ") + String(attempt+1) + "/5)...";
-        LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Sending OTA Start (attempt %d/5)", attempt+1);
+        otaAckWindow = 0;
+        otaAckFlags = 0;
+        otaAckOffset = 0;
+
+        Serial.printf("[Stm32Serial] otaTask: Sending OTA Start packet (Attempt %d/%d)...\n", attempt+1, attempts);
+        ota_msg = String("Negotiating (attempt ") + String(attempt+1) + "/" + String(attempts) + ")...";
+        LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Sending OTA Start (attempt %d/%d)", attempt+1, attempts);
+        int len = pack_ota_start_message(buf, totalSize, OTA_WINDOW_MAX, flags, fileCrc);
         self->sendData(buf, len);
 
         uint32_t startWait = millis();
-        uint32_t timeout = (attempt == 1) ? 3000 : 25000; // 3s for main app (attempt 1), 25s for bootloader erase
-        
+        uint32_t timeout = (attempt == 1) ? 5000 : 25000; // 5s for main app (attempt 1), 25s for bootloader erase
+
         Serial.printf("[Stm32Serial] otaTask: Waiting for response (timeout: %u ms)...\n", timeout);
         while(!otaAckReceived && !otaNackReceived && (millis() - startWait < timeout)) {
             vTaskDelay(10);
@@ -716,17 +1097,20 @@ void Stm32Serial::otaTask(void* parameter) {
 
         uint32_t elapsed = millis() - startWait;
         if (otaAckReceived) {
-            Serial.printf("[Stm32Serial] otaTask: Received OTA Start ACK on Attempt %d (negotiation took %u ms)\n", attempt+1, elapsed);
-            LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Bootloader ACK (attempt %d). Streaming firmware...", attempt+1);
-            startSuccess = true;
-            break;
+            *offset = (otaAckFlags & OTA_FLAG_RESUME) ? otaAckOffset : 0;
+            Serial.printf("[Stm32Serial] otaTask: Received OTA Start ACK on Attempt %d (negotiation took %u ms), from offset %u\n",
+                          attempt+1, elapsed, (unsigned)*offset);
+            LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "%s ACK (attempt %d). Streaming firmware from %u...",
+                                          attempt == 1 ? "App" : "Bootloader", attempt+1, (unsigned)*offset);
+            return true;
         }
 
         if (otaNackReceived) {
             Serial.printf("[Stm32Serial] otaTask: Received OTA Start NACK on Attempt %d (elapsed %u ms)\n", attempt+1, elapsed);
             if (attempt == 1) {
-                Serial.println("[Stm32Serial] otaTask: NACK was expected from Main App. Waiting 2.5s for STM32 reboot and bootloader boot...");
-                LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Main app NACK (expected). Waiting for STM32 reboot to bootloader...");
+                // Apps without the background update NACK and reboot into the bootloader
+                Serial.println("[Stm32Serial] otaTask: NACK from Main App. Waiting 2.5s for STM32 reboot and bootloader boot...");
+                LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Main app NACK. Waiting for STM32 reboot to bootloader...");
                 vTaskDelay(2500); // Wait 2.5s for STM32 to reboot and enter the bootloader loop
             } else {
                 Serial.println("[Stm32Serial] otaTask: Unexpected NACK from Bootloader. Retrying...");
@@ -736,36 +1120,91 @@ void Stm32Serial::otaTask(void* parameter) {
             Serial.printf("[Stm32Serial] otaTask: OTA Start response timeout on Attempt %d (elapsed %u ms)\n", attempt+1, elapsed);
         }
     }
+    return false;
+}
 
-    if (!startSuccess) {
-        Serial.println("[Stm32Serial] otaTask: OTA Start negotiation failed completely (Timeout/NACK)");
-        LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Start negotiation FAILED (timeout/NACK). STM32 did not enter bootloader.");
-        ota_state = 4; ota_msg = "Start Timeout";
-        f.close();
-        LittleFS.remove(otaFilename);
-        
-        Serial.println("[Stm32Serial] otaTask: Restoring UART to 460800 baud...");
-        self->changeBaudRate(460800);
+static void otaLogProgress(uint32_t sent, uint32_t totalSize, uint32_t fromOffset, uint32_t startTime,
+                           uint32_t resent, int* lastLogProgress) {
+    ota_progress = (sent * 100) / totalSize;
+    if (ota_progress != *lastLogProgress && ota_progress % 10 == 0) {
+        uint32_t elapsed = millis() - startTime;
+        float kbps = elapsed > 0 ? (float)(sent - fromOffset) / (float)elapsed : 0;
+        ESP_LOGI(TAG, "otaTask: OTA Progress: %d%% (%u/%u bytes) | Speed: %.2f KB/s | Resent: %u",
+                 ota_progress, (unsigned)sent, (unsigned)totalSize, kbps, (unsigned)resent);
+        LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Progress %d%% (%u/%u) %.1f KB/s",
+                 ota_progress, (unsigned)sent, (unsigned)totalSize, kbps);
+        *lastLogProgress = ota_progress;
+    }
+}
 
-        self->_otaRunning = false;
-        vTaskDelete(NULL);
-        return;
+/**
+ * @brief Streams the image from `offset` with up to `window` chunks in flight
+ * and selective retransmit (see ota_window.h). Chunks are re-read from
+ * LittleFS on resend.
+ */
+static OtaStreamResult otaStreamWindowed(Stm32Serial* self, File& f, uint32_t totalSize, uint32_t offset, uint8_t window) {
+    OtaWindowTx win;
+    ota_wtx_init(&win, totalSize, window);
+    ota_wtx_start_at(&win, (uint16_t)(offset / OTA_WINDOW_CHUNK));
+    uint8_t chunk[OTA_WINDOW_CHUNK];
+    uint8_t buf[OTA_WINDOW_CHUNK + 12];
+    uint32_t startTime = millis();
+    int lastLogProgress = -1;
+
+    otaWackReceived = false;
+    otaNackReceived = false;
+    while (!ota_wtx_done(&win)) {
+        if (otaNackReceived) {
+            ESP_LOGE(TAG, "otaTask: Bootloader reported a flash write error at %u", (unsigned)ota_wtx_acked_bytes(&win));
+            LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Flash write error on STM32 near offset %u", (unsigned)ota_wtx_acked_bytes(&win));
+            ota_state = 4; ota_msg = "Flash Error";
+            return OTA_STREAM_FAILED;
+        }
+        if (otaWackReceived) {
+            otaWackReceived = false;
+            uint32_t wack = otaWack;
+            ota_wtx_on_ack(&win, (uint16_t)(wack >> 16), (uint16_t)wack);
+        }
+
+        int seq;
+        while ((seq = ota_wtx_next(&win, micros())) >= 0) {
+            uint16_t chunkLen = ota_wtx_chunk_len(&win, seq);
+            f.seek(ota_wtx_offset(seq));
+            if (f.read(chunk, chunkLen) != chunkLen) {
+                ESP_LOGE(TAG, "otaTask: Short read at offset %u", (unsigned)ota_wtx_offset(seq));
+                ota_state = 4; ota_msg = "FS Error";
+                return OTA_STREAM_FAILED;
+            }
+            int len = pack_ota_wchunk_message(buf, (uint16_t)seq, chunk, chunkLen, otaAckFlags & OTA_FLAG_CHUNK_CRC);
+            self->sendData(buf, len);
+        }
+        if (seq == OTA_WTX_FAILED) {
+            ESP_LOGE(TAG, "otaTask: No progress at offset %u, giving up", (unsigned)ota_wtx_acked_bytes(&win));
+            LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Chunk transfer failed at offset %u", (unsigned)ota_wtx_acked_bytes(&win));
+            ota_state = 4; ota_msg = "Chunk Fail";
+            return OTA_STREAM_LINK_LOST;
+        }
+
+        otaLogProgress(ota_wtx_acked_bytes(&win), totalSize, offset, startTime, win.retransmits, &lastLogProgress);
+        vTaskDelay(1);
     }
+    return OTA_STREAM_DONE;
+}
 
-    Serial.println("[Stm32Serial] otaTask: Flash Negotiation successful. Starting chunk stream...");
-    LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Negotiation OK. Streaming firmware chunks...");
-    uint32_t offset = 0;
+/**
+ * @brief Stop-and-wait for bootloaders that do not grant a window.
+ */
+static OtaStreamResult otaStreamLegacy(Stm32Serial* self, File& f, uint32_t totalSize, uint32_t offset) {
     uint8_t chunk[200];
-    int last_log_progress = -1;
-    bool transferFailed = false;
+    uint8_t buf[256];
     uint32_t startTime = millis();
-    uint32_t crc = 0; // Calculated on the fly
+    int lastLogProgress = -1;
+    uint32_t from = offset;
 
+    f.seek(offset);
     while (f.available()) {
         int bytesRead = f.read(chunk, sizeof(chunk));
-        crc = calculate_crc32(crc, chunk, bytesRead); // On the fly CRC
-
-        len = pack_ota_chunk_message(buf, offset, chunk, bytesRead);
+        int len = pack_ota_chunk_message(buf, offset, chunk, bytesRead, otaAckFlags & OTA_FLAG_CHUNK_CRC);
 
         bool chunkSuccess = false;
         for(int retries=0; retries<3; retries++) {
@@ -797,34 +1236,120 @@ void Stm32Serial::otaTask(void* parameter) {
             ESP_LOGE(TAG, "otaTask: Chunk transfer failed at offset %u", offset);
             LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Chunk transfer failed at offset %u", (unsigned)offset);
             ota_state = 4; ota_msg = "Chunk Fail";
-            transferFailed = true;
-            break;
+            return OTA_STREAM_LINK_LOST;
         }
 
         offset += bytesRead;
-        ota_progress = (offset * 100) / totalSize;
-        if (ota_progress != last_log_progress && ota_progress % 10 == 0) {
-            uint32_t currentElapsed = millis() - startTime;
-            float kbps = 0;
-            if (currentElapsed > 0) {
-                kbps = (float)offset / (float)currentElapsed;
-            }
-            ESP_LOGI(TAG, "otaTask: OTA Progress: %d%% (%u/%u bytes) | Speed: %.2f KB/s | Time: %u s",
-                     ota_progress, offset, totalSize, kbps, currentElapsed / 1000);
-            LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Progress %d%% (%u/%u) %.1f KB/s",
-                     ota_progress, (unsigned)offset, (unsigned)totalSize, kbps);
-            last_log_progress = ota_progress;
+        otaLogProgress(offset, totalSize, from, startTime, 0, &lastLogProgress);
+    }
+    return (offset == totalSize) ? OTA_STREAM_DONE : OTA_STREAM_FAILED;
+}
+
+static String otaFilename;
+static bool otaResumeOnly = false;
+void Stm32Serial::startOta(const String& filename, bool resumeOnly) {
+    if (_otaRunning) return;
+    otaFilename = filename;
+    otaResumeOnly = resumeOnly;
+    _otaRunning = true;
+    applyBulkCap();
+    xTaskCreate(otaTask, "OtaTask", 8192, this, 1, NULL);
+}
+
+void Stm32Serial::otaTask(void* parameter) {
+    Stm32Serial* self = (Stm32Serial*)parameter;
+    bool resumeOnly = otaResumeOnly;
+    Serial.printf("[Stm32Serial] otaTask: Starting. Opening file: %s\n", otaFilename.c_str());
+    LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Flash task started (heap=%u)", (unsigned)ESP.getFreeHeap());
+    File f = LittleFS.open(otaFilename, "r");
+    if (!f) {
+        Serial.printf("[Stm32Serial] otaTask: Failed to open firmware file in LittleFS: %s\n", otaFilename.c_str());
+        LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Failed to open firmware file in LittleFS");
+        ota_state = 4; ota_msg = "FS Error";
+        LittleFS.remove(otaFilename);
+        self->_otaRunning = false;
+        self->applyBulkCap();
+        vTaskDelete(NULL);
+        return;
+    }
+
+    uint32_t totalSize = f.size();
+    uint32_t fileCrc = otaFileCrc(f);
+    Serial.printf("[Stm32Serial] otaTask: Binary size: %u bytes, CRC32 0x%08X\n", totalSize, fileCrc);
+    LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Firmware size: %u bytes. Negotiating @921600...", (unsigned)totalSize);
+
+    // The main app listens at whatever rate and framing was negotiated; the
+    // bootloader at 921600 with legacy framing.
+    uint32_t appBaud = self->getLinkBaud();
+    uint8_t appFraming = link_baud_framing(&self->_linkBaud);
+
+    // Start immediately at 921600 baud to catch the bootloader on boot
+    Serial.println("[Stm32Serial] otaTask: Switching UART to 921600 baud for bootloader...");
+    self->changeBaudRate(921600);
+
+    // A session the link cut short leaves a progress record in the
+    // bootloader or app; the next one continues from it
+    OtaStreamResult result = OTA_STREAM_FAILED;
+    bool startSuccess = false;
+    uint32_t startTime = millis();
+    for (int session = 0; session < OTA_SESSIONS; session++) {
+        uint32_t offset = 0;
+        startSuccess = otaHandshake(self, totalSize, fileCrc, appBaud, appFraming, resumeOnly, &offset);
+        if (!startSuccess) break;
+        if (resumeOnly) {
+            ota_state = 2; ota_msg = "Resuming STM32 flash...";
         }
+        resumeOnly = false;
+
+        Serial.println("[Stm32Serial] otaTask: Flash Negotiation successful. Starting chunk stream...");
+        LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Negotiation OK. Streaming firmware chunks (window %u, chunk CRC %s)...",
+                                      (unsigned)otaAckWindow, (otaAckFlags & OTA_FLAG_CHUNK_CRC) ? "on" : "off");
+        if (otaAckWindow > 0) result = otaStreamWindowed(self, f, totalSize, offset, otaAckWindow);
+        else result = otaStreamLegacy(self, f, totalSize, offset);
+        if (result != OTA_STREAM_LINK_LOST) break;
+        Serial.printf("[Stm32Serial] otaTask: Link lost, resuming (session %d/%d)...\n", session + 2, OTA_SESSIONS);
+        LogBuffer::getInstance().push(ESP_LOG_WARN, "OTA", "Link lost, resuming from the STM32's progress record");
+    }
+
+    if (!startSuccess && resumeOnly) {
+        // Nothing the STM32 can continue: the file was stale
+        f.close();
+        LittleFS.remove(otaFilename);
+        Serial.println("[Stm32Serial] otaTask: Removed stale /stm32_update.bin.");
+        self->changeBaudRate(LINK_BAUD_BASE);
+        link_baud_reset(&self->_linkBaud, micros());
+        self->_otaRunning = false;
+        self->applyBulkCap();
+        vTaskDelete(NULL);
+        return;
+    }
+
+    if (!startSuccess && result != OTA_STREAM_LINK_LOST) {
+        Serial.println("[Stm32Serial] otaTask: OTA Start negotiation failed completely (Timeout/NACK)");
+        LogBuffer::getInstance().push(ESP_LOG_ERROR, "OTA", "Start negotiation FAILED (timeout/NACK). STM32 did not enter bootloader.");
+        ota_state = 4; ota_msg = "Start Timeout";
+        f.close();
+        LittleFS.remove(otaFilename);
+
+        Serial.println("[Stm32Serial] otaTask: Restoring UART to 460800 baud...");
+        self->changeBaudRate(LINK_BAUD_BASE);
+        link_baud_reset(&self->_linkBaud, micros());
+
+        self->_otaRunning = false;
+        self->applyBulkCap();
+        vTaskDelete(NULL);
+        return;
     }
 
     f.close();
 
-    if (!transferFailed && offset == totalSize) {
+    if (result == OTA_STREAM_DONE) {
         uint32_t totalElapsed = millis() - startTime;
-        ESP_LOGI(TAG, "otaTask: Firmware stream complete in %u ms (average speed: %.2f KB/s). Final CRC32: 0x%08X", totalElapsed, (float)totalSize / (float)totalElapsed, crc);
-        ESP_LOGI(TAG, "otaTask: Sending OTA End packet (verification CRC: 0x%08X)...", crc);
-        LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Firmware sent. Verifying CRC 0x%08X...", (unsigned)crc);
-        len = pack_ota_end_message(buf, crc);
+        ESP_LOGI(TAG, "otaTask: Firmware stream complete in %u ms (average speed: %.2f KB/s). Final CRC32: 0x%08X", totalElapsed, (float)totalSize / (float)totalElapsed, fileCrc);
+        ESP_LOGI(TAG, "otaTask: Sending OTA End packet (verification CRC: 0x%08X)...", fileCrc);
+        LogBuffer::getInstance().push(ESP_LOG_INFO, "OTA", "Firmware sent. Verifying CRC 0x%08X...", (unsigned)fileCrc);
+        uint8_t buf[16];
+        int len = pack_ota_end_message(buf, fileCrc);
 
         bool endSuccess = false;
         for(int retries=0; retries<3; retries++) {
@@ -877,16 +1402,24 @@ void Stm32Serial::otaTask(void* parameter) {
              ota_state = 4; ota_msg = "Checksum Fail";
              LittleFS.remove(otaFilename);
         }
+    } else if (result == OTA_STREAM_LINK_LOST) {
+        // Kept: the bootloader's progress record lets a retry (or the next
+        // boot) continue instead of starting over
+        ESP_LOGE(TAG, "otaTask: Link lost %d times, giving up for now; %s kept for a resume", OTA_SESSIONS, otaFilename.c_str());
+        if (ota_state != 4) { ota_state = 4; ota_msg = "Incomplete"; }
     } else {
-        ESP_LOGE(TAG, "otaTask: Transfer was incomplete or failed. Written size: %u/%u bytes", offset, totalSize);
+        ESP_LOGE(TAG, "otaTask: Transfer failed.");
         if (ota_state != 4) { ota_state = 4; ota_msg = "Incomplete"; }
         LittleFS.remove(otaFilename);
     }
 
+    // The STM32 restarts at the base rate and handshakes, which renegotiates.
     ESP_LOGI(TAG, "otaTask: Restoring UART to 460800 baud...");
-    self->changeBaudRate(460800);
+    self->changeBaudRate(LINK_BAUD_BASE);
+    link_baud_reset(&self->_linkBaud, micros());
 
     self->_otaRunning = false;
+    self->applyBulkCap();
     ESP_LOGI(TAG, "otaTask: Task exit.");
     vTaskDelete(NULL);
 }
@@ -12,6 +12,11 @@
 
 #include <Arduino.h>
 #include "ecoflow_protocol.h"
+#include "link_txq.h"
+#include "link_baud.h"
+#include "link_frame.h"
+#include "log_batch.h"
+#include "log_levels.h"
 #include <freertos/semphr.h>
 #include <vector>
 
@@ -23,6 +28,9 @@
  * - Initialization of the hardware serial port.
  * - Processing incoming packets (parsing, CRC validation).
  * - Sending outgoing packets (Handshakes, Status Updates).
+ *
+ * Outgoing frames are queued by priority class and written by a dedicated
+ * writer task, so callers never block on the UART.
  */
 class Stm32Serial {
 public:
@@ -60,25 +68,101 @@ public:
     /**
      * @brief Starts the background OTA task.
      * @param filename Path to the firmware file in LittleFS.
+     * @param resumeOnly Only continue a transfer the bootloader holds progress
+     *                   for (after an ESP32 reboot); otherwise drop the file.
      */
-    void startOta(const String& filename);
+    void startOta(const String& filename, bool resumeOnly = false);
 
     bool isOtaInProgress() const { return _otaRunning; }
 
-    // Helper to send raw data safely
+    /**
+     * @brief Queues a packed frame for the writer task.
+     * The priority class is derived from the command byte.
+     */
     void sendData(const uint8_t* data, size_t len);
 
+    /**
+     * @brief Copies the TX queue counters of one priority class.
+     */
+    void getTxStats(LinkPriority prio, LinkTxStats* out) const { link_txq_get_stats(&_txq, prio, out); }
+
+    /**
+     * @brief Steps the link baud up as far as it stays error free.
+     * @return false if a negotiation or self-test is already running.
+     */
+    bool negotiateBaud();
+
+    /**
+     * @brief Starts a ping run at the current baud (RTT, loss, throughput).
+     * Read the result with getLinkTestResult() once isLinkBusy() is false.
+     */
+    bool startLinkTest(uint16_t count, uint8_t pad);
+    bool isLinkBusy() const { return link_baud_busy(&_linkBaud); }
+    const LinkProbeStats& getLinkTestResult() const { return *link_baud_last_result(&_linkBaud); }
+    uint32_t getLinkBaud() const { return link_baud_current(&_linkBaud); }
+    uint8_t getLinkFraming() const { return link_baud_framing(&_linkBaud); }
+
     void sendLogResendReq(uint32_t offset);
 
-    // Send Log to STM32
+    // Send Log to STM32. Lines are batched and rate limited (log_batch.h):
+    // they go out within LOG_BATCH_MS, several to a frame.
     void sendEspLog(uint8_t level, const char* tag, const char* msg);
+    // Send a binary log record: the call site's format ID and its packed args
+    // (LogRecord.h), with the tag's ID for the STM32's level table (log_levels.h)
+    void sendEspLogRecord(uint8_t level, const char* tag, uint32_t fmt_id, const uint8_t* args, uint8_t args_len);
+    /**
+     * @brief Copies the log batch counters.
+     */
+    void getLogBatchStats(LogBatchStats* out);
+
+    // Log Levels
+    /**
+     * @brief Sets one tag's level in the STM32's table (log_levels.h), checked
+     * there before a line is packed for the SD card, and saved on the card.
+     * NULL or "*" sets the default, LOG_LEVELS_UNSET drops the tag. The STM32
+     * answers with its table, as it does requestStmLogLevels().
+     */
+    void setStmLogLevel(const char* tag, uint8_t level);
+    void requestStmLogLevels(void);
+    bool getStmLogLevels(LogLevels* out); // false until the STM32 has sent its table
 
     // Log Download Support
+    /**
+     * @brief Starts fetching the SD card's log list, page by page, from update().
+     * Poll isLogListReady(), then take the list with getLogList().
+     */
     void requestLogList(void);
+    bool isLogListReady(void);
     struct LogEntry { String name; uint32_t size; };
-    std::vector<LogEntry> getLogList(void); // Blocking wait
+    std::vector<LogEntry> getLogList(void); // Copy of what has arrived, does not wait
     void deleteLog(const String& name);
 
+    // Recorded Telemetry
+    /**
+     * @brief Asks the STM32 for min/max of one recorded field over [from, to)
+     * in `points` buckets (telem_block.h). Replaces a query still running.
+     * Poll isTelemetryReady(), then take the buckets with getTelemetry();
+     * an empty bucket has min > max, none at all means a bad device or field.
+     */
+    void requestTelemetry(uint8_t dev, uint8_t field, uint32_t from, uint32_t to, uint16_t points);
+    bool isTelemetryReady(void);
+    void getTelemetry(std::vector<int32_t>& min, std::vector<int32_t>& max);
+
+    // Log Search
+    /**
+     * @brief Asks the STM32 to search one SD log (log_index.h): records at a
+     * level in `levels` (bit per level, 0 all), with Tick in [tickFrom,
+     * tickTo], holding every word of `text` and, if `fmts` is not empty, one
+     * of its FmtIds. Stops at `max` matches. Replaces a search still running.
+     * Poll isLogSearchDone(), then take the records with getLogSearch().
+     */
+    struct LogSearchHit { uint32_t offset; std::vector<uint8_t> rec; };
+    void startLogSearch(const String& name, const String& text, uint8_t levels,
+                        uint32_t tickFrom, uint32_t tickTo, uint16_t max,
+                        const std::vector<uint32_t>& fmts);
+    bool isLogSearchDone(void);
+    void getLogSearch(std::vector<LogSearchHit>& hits, LogSearchEndMsg& end);
+
     // Stream Support
     void startLogDownload(const String& name);
     size_t readLogChunk(uint8_t* buffer, size_t maxLen);
@@ -90,30 +174,81 @@ private:
     /**
      * @brief Private constructor for Singleton pattern.
      */
-    Stm32Serial() : _otaRunning(false), _expectedLogOffset(0), _txMutex(NULL),
-                    _switchingBaud(false), _rx_idx(0), _expected_len(0), _collecting(false) {}
+    Stm32Serial() : _otaRunning(false), _txMutex(NULL), _txTaskHandle(NULL),
+                    _txBusy(false), _baud(460800), _framing(LINK_FRAMING_LEGACY), _switchingBaud(false) {
+        link_txq_init(&_txq);
+        link_parser_init(&_rxParser);
+    }
 
     /**
      * @brief Processes a fully received and validated packet.
      * @param buf Pointer to the packet buffer.
      * @param len Length of the packet.
      */
-    void processPacket(uint8_t* buf, uint8_t len);
+    void processPacket(uint8_t* buf, uint16_t len);
 
     static void otaTask(void* parameter);
+    static bool otaHandshake(Stm32Serial* self, uint32_t totalSize, uint32_t fileCrc, uint32_t appBaud,
+                             uint8_t appFraming, bool resumeOnly, uint32_t* offset);
+    static void txTask(void* parameter);
+    static void linkSend(void* user, const uint8_t* frame, int len);
+    static void linkSetBaud(void* user, uint32_t baud, uint8_t framing);
+
+    /**
+     * @brief Waits until the TX queue is drained and the UART FIFO is empty.
+     * @return false on timeout.
+     */
+    bool waitTxIdle(uint32_t timeoutMs);
+
+    /**
+     * @brief Sets the bulk class byte rate from the current baud (unlimited during OTA).
+     */
+    void applyBulkCap();
+
+    /**
+     * @brief Drains TX, then reprograms the UART and switches RX/TX framing.
+     */
+    void changeBaudRate(uint32_t baud, uint8_t framing = LINK_FRAMING_LEGACY);
 
-    void resetRxBuffer();
-    void changeBaudRate(uint32_t baud);
+    /**
+     * @brief Adds a packed log line frame to the batch and sends what is due.
+     */
+    void queueLog(const uint8_t* frame, int len);
+
+    /**
+     * @brief Sends the batch frames that are due. Caller holds the log batch mutex.
+     */
+    void sendLogBatch();
+
+    /**
+     * @brief Asks the STM32 for the log list page starting at `cursor`.
+     * Caller holds the log list mutex.
+     */
+    void requestLogListPage(uint16_t cursor);
+
+    /**
+     * @brief Sends the resend request and credit log_stream asks for.
+     * Caller holds the download mutex.
+     */
+    void sendLogActions(uint8_t actions);
 
     bool _otaRunning = false;
-    uint32_t _expectedLogOffset = 0;
-    SemaphoreHandle_t _txMutex = NULL;
+    SemaphoreHandle_t _txMutex = NULL;  ///< Serializes UART writes against baud changes
+    TaskHandle_t _txTaskHandle = NULL;
+    LinkTxQueue _txq;
+    volatile bool _txBusy;
+    uint32_t _baud;
+    volatile uint8_t _framing;           ///< LINK_FRAMING_*, applied by the writer task
+    LinkBaudCtx _linkBaud;
+    enum { LINK_REQ_NONE, LINK_REQ_NEGOTIATE, LINK_REQ_TEST };
+    volatile uint8_t _linkRequest = LINK_REQ_NONE;
+    uint16_t _linkTestCount = 0;
+    uint8_t _linkTestPad = 0;
 
     volatile bool _switchingBaud;
-    uint8_t _rx_buf[1024];
-    uint16_t _rx_idx;
-    uint8_t _expected_len;
-    bool _collecting;
+    LinkFrameParser _rxParser;
+    LogBatch _logBatch;
+    SemaphoreHandle_t _logBatchMutex = NULL;
 };
 
 #endif
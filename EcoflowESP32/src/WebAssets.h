@@ -356,6 +356,17 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
                 <div id="sd-log-list" style="margin-top:15px; max-height:300px; overflow-y:auto;">
                     <div style="text-align:center; color:#555; padding:20px;">Click Refresh to load...</div>
                 </div>
+                <div class="ctrl-row" style="margin-top:15px;">
+                    <input type="text" id="sd-search-q" placeholder="Search words..." style="flex:1;" onkeydown="if(event.key==='Enter')searchSdLog()">
+                    <select id="sd-search-file"><option>current.log</option></select>
+                    <select id="sd-search-lvl">
+                        <option value="0">All</option>
+                        <option value="2">Error</option>
+                        <option value="6">Warn+</option>
+                    </select>
+                    <button class="btn btn-primary" onclick="searchSdLog()">Search</button>
+                </div>
+                <div id="sd-search-res" class="hidden" style="margin-top:10px; max-height:300px; overflow-y:auto; font-family:monospace; font-size:0.8em;"></div>
             </div>
         </div>
     </div>
@@ -418,7 +429,8 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
                 <input type="range" id="rg-min-${d.type}" min="0" max="30" step="1" value="${d.cfg_min}" onchange="cmd('${d.type}', 'set_min_soc', parseInt(this.value), this)" oninput="el('val-min-${d.type}').innerText=this.value">
 
                 <div style="margin-top:20px">
-                    <span style="font-size:0.8em; color:var(--text-sub); text-transform: uppercase; letter-spacing:1px;">Solar Input (1h)</span>
+                    <span style="font-size:0.8em; color:var(--text-sub); text-transform: uppercase; letter-spacing:1px;">Solar Input</span>
+                    ${spanCtrl(d.type)}
                     <canvas id="graph-d3" class="graph" width="300" height="100"></canvas>
                 </div>
             </div>
@@ -497,7 +509,8 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
                     </div>
 
                     <div style="margin-top:20px">
-                        <span style="font-size:0.8em; color:var(--text-sub); text-transform: uppercase;">Temp History (1h)</span>
+                        <span style="font-size:0.8em; color:var(--text-sub); text-transform: uppercase;">Temp History</span>
+                        ${spanCtrl(d.type)}
                         <canvas id="graph-w2" class="graph" width="300" height="100"></canvas>
                     </div>
                 </div>
@@ -552,7 +565,8 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
                 <input type="range" id="rg-bkp-${d.type}" min="0" max="100" value="${d.backup_lvl}" onchange="cmd('${d.type}', 'set_backup_level', parseInt(this.value))" oninput="el('val-bkp-${d.type}').innerText=this.value">
 
                 <div style="margin-top:20px">
-                    <span style="font-size:0.8em; color:var(--text-sub); text-transform: uppercase;">Solar Input (1h)</span>
+                    <span style="font-size:0.8em; color:var(--text-sub); text-transform: uppercase;">Solar Input</span>
+                    ${spanCtrl(d.type)}
                     <canvas id="graph-d3p" class="graph" width="300" height="100"></canvas>
                 </div>
             </div>
@@ -899,41 +913,94 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
         if((id === 'w2' || id === 'd3' || id === 'd3p') && e.classList.contains('open')) loadGraph(id);
     }
 
+    // Graph range per card. The last hour is the ESP32's own history; longer
+    // ranges come from the STM32's SD card as min/max per bucket.
+    const GRAPH_SPANS = [[3600, '1h'], [86400, '24h'], [604800, '7d']];
+    const TELEM_FIELD = { d3: 5, d3p: 6, w2: 0 }; // Column in /api/telemetry?type=...
+    const graphSpan = {};
+
+    function spanCtrl(type) {
+        const cur = graphSpan[type] || 3600;
+        return '<div class="seg-ctrl" style="margin:6px 0">' + GRAPH_SPANS.map(([s, l]) =>
+            `<div class="seg-opt${s === cur ? ' active' : ''}" id="span-${s}-${type}" onclick="setGraphSpan('${type}', ${s})"><small>${l}</small></div>`
+        ).join('') + '</div>';
+    }
+
+    function setGraphSpan(type, span) {
+        graphSpan[type] = span;
+        GRAPH_SPANS.forEach(([s]) => { const o = el('span-' + s + '-' + type); if(o) o.classList.toggle('active', s === span); });
+        loadGraph(type);
+    }
+
     function loadGraph(type) {
         const canvas = el('graph-' + type);
         if(!canvas) return;
-        fetch(API + '/history?type=' + type).then(r => r.json()).then(data => {
-            const ctx = canvas.getContext('2d');
-            const w = canvas.width;
-            const h = canvas.height;
-            ctx.clearRect(0,0,w,h);
-
-            if(!data || data.length === 0) {
-                ctx.fillStyle = '#555'; ctx.fillText('No Data', w/2-20, h/2); return;
-            }
+        const span = graphSpan[type] || 3600;
+        if(span <= 3600) {
+            fetch(API + '/history?type=' + type).then(r => r.json())
+                .then(data => drawGraph(canvas, data, null)).catch(() => drawGraph(canvas, [], null));
+            return;
+        }
+        fetch(API + '/telemetry?type=' + type + '&field=' + TELEM_FIELD[type] + '&span=' + span + '&points=120')
+            .then(r => r.ok ? r.json() : null).then(t => {
+                if(!t) { drawGraph(canvas, [], null); return; }
+                const v = x => x === null ? null : x / t.scale;
+                const lo = t.min.map(v), hi = t.max.map(v);
+                drawGraph(canvas, lo.map((x, i) => x === null ? null : (x + hi[i]) / 2), { lo, hi });
+            }).catch(() => drawGraph(canvas, [], null));
+    }
 
-            // Gradient Line
-            const gradient = ctx.createLinearGradient(0, 0, w, 0);
-            gradient.addColorStop(0, '#00f3ff');
-            gradient.addColorStop(1, '#00ff9d');
-            ctx.strokeStyle = gradient;
-            ctx.lineWidth = 2;
-            ctx.beginPath();
+    // `data` may hold nulls (no samples); `band` adds the min/max around it
+    function drawGraph(canvas, data, band) {
+        const ctx = canvas.getContext('2d');
+        const w = canvas.width;
+        const h = canvas.height;
+        ctx.clearRect(0,0,w,h);
 
-            const min = Math.min(...data) - 2;
-            const max = Math.max(...data) + 2;
-            const range = max - min || 1;
+        const vals = (band ? band.lo.concat(band.hi) : data).filter(x => x !== null);
+        if(!data || vals.length === 0) {
+            ctx.fillStyle = '#555'; ctx.fillText('No Data', w/2-20, h/2); return;
+        }
 
-            data.forEach((val, i) => {
-                const x = (i / (data.length - 1)) * w;
-                const y = h - ((val - min) / range) * h;
-                if(i===0) ctx.moveTo(x,y); else ctx.lineTo(x,y);
-            });
-            ctx.stroke();
+        const min = Math.min(...vals) - 2;
+        const max = Math.max(...vals) + 2;
+        const range = max - min || 1;
+        const xAt = i => (i / Math.max(data.length - 1, 1)) * w;
+        const yAt = val => h - ((val - min) / range) * h;
+
+        if(band) {
+            // One filled run per stretch of buckets with samples
+            ctx.fillStyle = 'rgba(0, 243, 255, 0.15)';
+            let i = 0;
+            while(i < data.length) {
+                if(band.lo[i] === null) { i++; continue; }
+                let j = i;
+                while(j < data.length && band.lo[j] !== null) j++;
+                ctx.beginPath();
+                for(let k = i; k < j; k++) ctx.lineTo(xAt(k), yAt(band.hi[k]));
+                for(let k = j - 1; k >= i; k--) ctx.lineTo(xAt(k), yAt(band.lo[k]));
+                ctx.closePath(); ctx.fill();
+                i = j;
+            }
+        }
 
-            // Fill
-            ctx.lineTo(w, h); ctx.lineTo(0, h); ctx.fillStyle = 'rgba(0, 243, 255, 0.1)'; ctx.fill();
+        // Gradient Line
+        const gradient = ctx.createLinearGradient(0, 0, w, 0);
+        gradient.addColorStop(0, '#00f3ff');
+        gradient.addColorStop(1, '#00ff9d');
+        ctx.strokeStyle = gradient;
+        ctx.lineWidth = 2;
+        ctx.beginPath();
+        let pen = false;
+        data.forEach((val, i) => {
+            if(val === null) { pen = false; return; }
+            if(!pen) ctx.moveTo(xAt(i), yAt(val)); else ctx.lineTo(xAt(i), yAt(val));
+            pen = true;
         });
+        ctx.stroke();
+
+        // Fill
+        if(!band) { ctx.lineTo(w, h); ctx.lineTo(0, h); ctx.fillStyle = 'rgba(0, 243, 255, 0.1)'; ctx.fill(); }
     }
 
     function connectDevice(type) {
@@ -1064,6 +1131,10 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
             `;
             list.appendChild(table);
             const tbody = table.querySelector('tbody');
+            const sel = el('sd-search-file');
+            const picked = sel.value;
+            sel.innerHTML = '';
+            data.filter(f => f.name.endsWith('.log')).forEach(f => sel.add(new Option(f.name, f.name, false, f.name === picked)));
 
             data.forEach(file => {
                 let name = file.name;
@@ -1088,6 +1159,30 @@ const char WEB_APP_HTML[] PROGMEM = R"rawliteral(
         });
     }
 
+    // Matching records only, found by the STM32 through the log's index
+    function searchSdLog() {
+        const res = el('sd-search-res');
+        const q = new URLSearchParams({ name: el('sd-search-file').value || 'current.log',
+                                        q: el('sd-search-q').value, levels: el('sd-search-lvl').value });
+        res.classList.remove('hidden');
+        res.textContent = 'Searching...';
+        fetch(API + '/log_search?' + q).then(r => r.ok ? r.json() : r.text().then(t => { throw t; })).then(d => {
+            res.innerHTML = '';
+            d.lines.forEach(l => {
+                const line = document.createElement('div');
+                line.className = 'log-line log-' + (['?','E','W','I','D','V'][l.l] || 'I');
+                const body = l.fmt !== undefined ? `[fmt ${l.fmt}] ${l.args.join(', ')}` : `[${l.tag}] ${l.msg}`;
+                line.textContent = `[${l.t}] ${body}`;
+                res.appendChild(line);
+            });
+            const info = document.createElement('div');
+            info.style.color = 'var(--text-sub)';
+            info.textContent = `${d.matches} match(es)${d.status === 2 ? ' (limit)' : ''}, ` +
+                               `${(d.read / 1024).toFixed(0)} of ${(d.size / 1024).toFixed(0)} KB read`;
+            res.appendChild(info);
+        }).catch(e => { res.textContent = 'Search failed: ' + e; });
+    }
+
     function deleteLog(name) {
         if(!confirm('Delete ' + name + '?')) return;
         const fd = new FormData();
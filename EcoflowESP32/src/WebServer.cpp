@@ -6,12 +6,27 @@
 #include <esp_heap_caps.h>
 #include <LittleFS.h>
 #include "Stm32Serial.h"
+#include "telem_block.h"
+#include "log_record.h"
+#include <time.h>
+#include "Logging.h"
+#include "RemoteLogger.h"
 
 static const char* TAG = "WebServer";
 AsyncWebServer WebServer::server(80);
 
 AsyncWebServerRequest* WebServer::_pendingLogRequest = nullptr;
 uint32_t WebServer::_pendingLogRequestTime = 0;
+AsyncWebServerRequest* WebServer::_pendingListRequest = nullptr;
+uint32_t WebServer::_pendingListRequestTime = 0;
+AsyncWebServerRequest* WebServer::_pendingTelemRequest = nullptr;
+uint32_t WebServer::_pendingTelemRequestTime = 0;
+uint8_t WebServer::_telemDev = 0;
+uint8_t WebServer::_telemField = 0;
+uint32_t WebServer::_telemFrom = 0;
+uint32_t WebServer::_telemTo = 0;
+AsyncWebServerRequest* WebServer::_pendingSearchRequest = nullptr;
+uint32_t WebServer::_pendingSearchRequestTime = 0;
 SemaphoreHandle_t WebServer::_requestMutex = NULL;
 DynamicJsonDocument* WebServer::_statusDoc = nullptr; // pre-alloc — freeze plan F7
 bool WebServer::_serverStarted = false;
@@ -35,10 +50,181 @@ public:
     }
     bool _sourceValid() const { return true; }
     // non-blocking — freeze plan F3
+    // Only called while the TCP send buffer has space; not reading leaves the
+    // ring full, and the STM32 gets only keep-alive credit until it drains.
+    // A download that failed (log_stream.h) ends the body short.
     virtual size_t _fillBuffer(uint8_t *data, size_t len){
-        if (Stm32Serial::getInstance().isLogDownloadComplete()) return 0;
+        if (Stm32Serial::getInstance().isLogDownloadComplete()) return 0; // ends the chunked body
         size_t read = Stm32Serial::getInstance().readLogChunk(data, len);
-        return read; // 0 → AsyncTCP polls next tick; no busy-wait
+        return read ? read : RESPONSE_TRY_AGAIN; // asked again on the next poll/ack
+    }
+};
+
+// SD log list as a chunked JSON array, one entry at a time, so the list
+// size is not bounded by a JSON document
+class LogListResponse : public AsyncAbstractResponse {
+    std::vector<Stm32Serial::LogEntry> _logs;
+    size_t _next = 0;          // Entry to write next; _logs.size() is the closing bracket
+    char _piece[LOG_LIST_NAME_MAX + 48];
+    size_t _pieceLen = 0;
+    size_t _piecePos = 0;
+
+    bool nextPiece() {
+        if (_next > _logs.size()) return false;
+        const char* sep = (_next == 0) ? "[" : ",";
+        int n;
+        if (_next == _logs.size()) {
+            n = snprintf(_piece, sizeof(_piece), "%s]", _logs.empty() ? "[" : "");
+        } else {
+            // FAT names cannot hold quotes, backslashes or control characters
+            const Stm32Serial::LogEntry& e = _logs[_next];
+            n = snprintf(_piece, sizeof(_piece), "%s{\"name\":\"%s\",\"size\":%lu}",
+                         sep, e.name.c_str(), (unsigned long)e.size);
+        }
+        _next++;
+        _pieceLen = (n < (int)sizeof(_piece)) ? n : sizeof(_piece) - 1;
+        _piecePos = 0;
+        return true;
+    }
+public:
+    LogListResponse(std::vector<Stm32Serial::LogEntry> logs) : _logs(std::move(logs)) {
+        _code = 200;
+        _contentType = "application/json";
+        _sendContentLength = false;
+        _chunked = true;
+    }
+    bool _sourceValid() const { return true; }
+    virtual size_t _fillBuffer(uint8_t *data, size_t len){
+        size_t out = 0;
+        while (out < len) {
+            if (_piecePos == _pieceLen && !nextPiece()) break;
+            size_t n = std::min(len - out, _pieceLen - _piecePos);
+            memcpy(data + out, _piece + _piecePos, n);
+            _piecePos += n;
+            out += n;
+        }
+        return out; // 0 once the closing bracket went out ends the body
+    }
+};
+
+// Log search results as a chunked JSON object, one record at a time:
+// {"status":..,"matches":..,"read":..,"size":..,"lines":[..]}. A text record
+// is {"o","t","l","tag","msg"}; an ESP32 record {"o","t","l","fmt","args"},
+// its format string being in the sources only (Test Scripts/tools/log_decode.py)
+class LogSearchResponse : public AsyncAbstractResponse {
+    std::vector<Stm32Serial::LogSearchHit> _hits;
+    LogSearchEndMsg _end;
+    size_t _next = 0;          // Hit to write next; _hits.size() + 1 is the closing bracket
+    size_t _written = 0;       // Records in the body so far
+    // Worst case of one record: every payload byte a control character,
+    // escaped as \u00XX, plus the separator, the keys and the numbers
+    static constexpr size_t PAYLOAD_MAX = MAX_PAYLOAD_LEN - LOG_REC_HDR;
+    static constexpr size_t PIECE_MAX = 1 + 128 + 6 * PAYLOAD_MAX;
+    // One array slot per argument, at least 2 payload bytes each, and a
+    // copy of every string
+    static constexpr size_t DOC_MAX = JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(PAYLOAD_MAX / 2) + 2 * PAYLOAD_MAX;
+    char _piece[PIECE_MAX];
+    size_t _pieceLen = 0;
+    size_t _piecePos = 0;
+
+    static void addArgs(JsonArray args, const uint8_t* p, const uint8_t* end) {
+        while (p < end) {
+            uint8_t type = *p++;
+            if (type == LOG_ARG_INT) {
+                uint64_t z = 0;
+                for (int shift = 0; p < end && shift < 64; shift += 7) {
+                    uint8_t c = *p++;
+                    z |= (uint64_t)(c & 0x7F) << shift;
+                    if (!(c & 0x80)) break;
+                }
+                args.add((long long)(z >> 1) ^ -(long long)(z & 1));
+            } else if (type == LOG_ARG_FLOAT && end - p >= 4) {
+                float f;
+                memcpy(&f, p, 4);
+                p += 4;
+                args.add(f);
+            } else if (type == LOG_ARG_STR && p < end) {
+                size_t n = *p++;
+                if (n > (size_t)(end - p)) n = end - p;
+                args.add(std::string((const char*)p, n));
+                p += n;
+            } else {
+                return;
+            }
+        }
+    }
+
+    void record(const Stm32Serial::LogSearchHit& h) {
+        DynamicJsonDocument doc(DOC_MAX);
+        const uint8_t* r = h.rec.data();
+        const uint8_t* end = r + h.rec.size();
+        uint32_t tick, fmt;
+        memcpy(&tick, &r[3], 4);
+        memcpy(&fmt, &r[8], 4);
+        doc["o"] = h.offset;
+        doc["t"] = tick;
+        doc["l"] = r[7];
+        const uint8_t* p = r + LOG_REC_HDR;
+        if (fmt == LOG_REC_TEXT) {
+            size_t n = 0;
+            if (p < end) {
+                n = *p++;
+                if (n > (size_t)(end - p)) n = end - p;
+            }
+            doc["tag"] = std::string((const char*)p, n);
+            doc["msg"] = std::string((const char*)p + n, end - p - n);
+        } else {
+            char id[9];
+            snprintf(id, sizeof(id), "%08lx", (unsigned long)fmt);
+            doc["fmt"] = id;
+            addArgs(doc.createNestedArray("args"), p, end);
+        }
+        size_t n = _written ? 1 : 0;
+        // A record that would not fit whole is left out rather than cut
+        if (doc.overflowed() || measureJson(doc) >= sizeof(_piece) - n) {
+            _pieceLen = 0;
+            return;
+        }
+        _piece[0] = ',';
+        _pieceLen = n + serializeJson(doc, _piece + n, sizeof(_piece) - n);
+        _written++;
+    }
+
+    bool nextPiece() {
+        if (_next > _hits.size() + 1) return false;
+        if (_next == 0) {
+            _pieceLen = snprintf(_piece, sizeof(_piece),
+                                 "{\"status\":%u,\"matches\":%lu,\"read\":%lu,\"size\":%lu,\"lines\":[",
+                                 _end.status, (unsigned long)_end.matches, (unsigned long)_end.read,
+                                 (unsigned long)_end.size);
+        } else if (_next == _hits.size() + 1) {
+            _pieceLen = snprintf(_piece, sizeof(_piece), "]}");
+        } else {
+            record(_hits[_next - 1]);
+        }
+        _next++;
+        _piecePos = 0;
+        return true;
+    }
+public:
+    LogSearchResponse(std::vector<Stm32Serial::LogSearchHit> hits, const LogSearchEndMsg& end)
+        : _hits(std::move(hits)), _end(end) {
+        _code = 200;
+        _contentType = "application/json";
+        _sendContentLength = false;
+        _chunked = true;
+    }
+    bool _sourceValid() const { return true; }
+    virtual size_t _fillBuffer(uint8_t *data, size_t len){
+        size_t out = 0;
+        while (out < len) {
+            if (_piecePos == _pieceLen && !nextPiece()) break;
+            size_t n = std::min(len - out, _pieceLen - _piecePos);
+            memcpy(data + out, _piece + _piecePos, n);
+            _piecePos += n;
+            out += n;
+        }
+        return out; // 0 once the closing brace went out ends the body
     }
 };
 
@@ -119,6 +305,8 @@ void WebServer::update() {
         if (WiFi.status() == WL_CONNECTED) {
             _staFallbackPending = false;
             ESP_LOGI(TAG, "WiFi connected: %s", WiFi.localIP().toString().c_str());
+            // UTC; the STM32's telemetry recorder takes its clock from ours
+            configTime(0, 0, "pool.ntp.org", "time.google.com");
         } else if (millis() - _staConnectStart > 15000) {
             _staFallbackPending = false;
             ESP_LOGW(TAG, "WiFi connect failed; starting persistent hotspot.");
@@ -128,12 +316,12 @@ void WebServer::update() {
 
     if (xSemaphoreTake(_requestMutex, 0) == pdTRUE) {
         if (_pendingLogRequest) {
-            // Check if download is ready (buffer > 8KB or Complete)
-            // 8KB gives ~100ms head start at 90KB/s UART
+            // Respond once the file opened and data flows; the body streams
+            // from the download ring from then on
             size_t buffered = Stm32Serial::getInstance().getDownloadBufferSize();
             bool complete = Stm32Serial::getInstance().isLogDownloadComplete();
 
-            if (complete || buffered > 8192) {
+            if (complete || buffered > 0) {
                 ESP_LOGI(TAG, "Starting Delayed Response. Buffered: %d, Complete: %d", buffered, complete);
                 String name = _pendingLogRequest->getParam("name")->value(); // Should be safe
                 AsyncWebServerResponse *response = new LogResponse(name);
@@ -147,6 +335,45 @@ void WebServer::update() {
                  Stm32Serial::getInstance().abortLogDownload();
             }
         }
+        if (_pendingListRequest) {
+            // Stm32Serial fetches the pages in the background
+            if (Stm32Serial::getInstance().isLogListReady()) {
+                _pendingListRequest->send(new LogListResponse(Stm32Serial::getInstance().getLogList()));
+                _pendingListRequest = nullptr;
+            } else if (millis() - _pendingListRequestTime > 10000) {
+                ESP_LOGW(TAG, "Log List Timeout");
+                _pendingListRequest->send(504, "text/plain", "Timeout waiting for log list");
+                _pendingListRequest = nullptr;
+            }
+        }
+        if (_pendingTelemRequest) {
+            if (Stm32Serial::getInstance().isTelemetryReady()) {
+                sendTelemetry(_pendingTelemRequest);
+                _pendingTelemRequest = nullptr;
+            } else if (millis() - _pendingTelemRequestTime > 10000) {
+                ESP_LOGW(TAG, "Telemetry Query Timeout");
+                _pendingTelemRequest->send(504, "text/plain", "Timeout waiting for telemetry");
+                _pendingTelemRequest = nullptr;
+            }
+        }
+        if (_pendingSearchRequest) {
+            // A search reads the whole file in the worst case: a longer wait
+            if (Stm32Serial::getInstance().isLogSearchDone()) {
+                std::vector<Stm32Serial::LogSearchHit> hits;
+                LogSearchEndMsg end;
+                Stm32Serial::getInstance().getLogSearch(hits, end);
+                if (end.status == LOG_SEARCH_NO_FILE) {
+                    _pendingSearchRequest->send(404, "text/plain", "No such binary log");
+                } else {
+                    _pendingSearchRequest->send(new LogSearchResponse(std::move(hits), end));
+                }
+                _pendingSearchRequest = nullptr;
+            } else if (millis() - _pendingSearchRequestTime > 30000) {
+                ESP_LOGW(TAG, "Log Search Timeout");
+                _pendingSearchRequest->send(504, "text/plain", "Timeout waiting for search");
+                _pendingSearchRequest = nullptr;
+            }
+        }
         xSemaphoreGive(_requestMutex);
     }
 }
@@ -163,6 +390,7 @@ void WebServer::setupRoutes() {
     server.on("/api/forget", HTTP_POST, [](AsyncWebServerRequest *r){}, NULL, handleForget);
 
     server.on("/api/history", HTTP_GET, handleHistory);
+    server.on("/api/telemetry", HTTP_GET, handleTelemetry);
 
     server.on("/api/logs", HTTP_GET, handleLogs);
     server.on("/api/log_config", HTTP_GET, [](AsyncWebServerRequest *r){
@@ -172,23 +400,31 @@ void WebServer::setupRoutes() {
         r->send(200, "application/json", j);
     });
     server.on("/api/log_config", HTTP_POST, [](AsyncWebServerRequest *r){}, NULL, handleLogConfig);
+    server.on("/api/log_levels", HTTP_GET, handleLogLevels);
+    server.on("/api/log_levels", HTTP_POST, [](AsyncWebServerRequest *r){}, NULL, handleLogLevelsSave);
     server.on("/api/raw_command", HTTP_POST, [](AsyncWebServerRequest *r){}, NULL, handleRawCommand);
 
     // SD Logs
     server.on("/api/sd_logs", HTTP_GET, [](AsyncWebServerRequest *request){
         log_d("free heap: %u, largest block: %u", ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT)); // heap-log — freeze plan F7
-        Stm32Serial::getInstance().requestLogList();
-        std::vector<Stm32Serial::LogEntry> logs = Stm32Serial::getInstance().getLogList();
-        // Increase buffer size to 32KB to accommodate large file lists and prevent "Error loading list"
-        AsyncJsonResponse *response = new AsyncJsonResponse(true, 32768);
-        JsonArray root = response->getRoot();
-        for(const auto& log : logs) {
-            JsonObject obj = root.createNestedObject();
-            obj["name"] = log.name;
-            obj["size"] = log.size;
+        xSemaphoreTake(_requestMutex, portMAX_DELAY);
+        if (_pendingListRequest) {
+            xSemaphoreGive(_requestMutex);
+            request->send(503, "text/plain", "List in progress");
+            return;
         }
-        response->setLength();
-        request->send(response);
+        // Answered from update() once the list is in
+        Stm32Serial::getInstance().requestLogList();
+        _pendingListRequest = request;
+        _pendingListRequestTime = millis();
+        xSemaphoreGive(_requestMutex);
+
+        request->onDisconnect([request](){
+            if (xSemaphoreTake(_requestMutex, 100) == pdTRUE) {
+                if (_pendingListRequest == request) _pendingListRequest = nullptr;
+                xSemaphoreGive(_requestMutex);
+            }
+        });
     });
 
     server.on("/api/download_log", HTTP_GET, [](AsyncWebServerRequest *request){
@@ -224,6 +460,8 @@ void WebServer::setupRoutes() {
         });
     });
 
+    server.on("/api/log_search", HTTP_GET, handleLogSearch);
+
     server.on("/api/sd_logs/delete", HTTP_POST, [](AsyncWebServerRequest *request){
         if (!request->hasParam("name", true)) { // POST param
             request->send(400, "text/plain", "Missing name");
@@ -379,6 +617,137 @@ void WebServer::handleHistory(AsyncWebServerRequest *request) {
     } else { request->send(400, "text/plain", "Missing Type"); }
 }
 
+// ?type=d3 lists the recorded fields; with &field=<n>, min/max of that field
+// over the last `span` seconds (or [from, to)) in `points` buckets, from the
+// STM32's SD card. Answered from update() once the buckets are in.
+void WebServer::handleTelemetry(AsyncWebServerRequest *request) {
+    if (!request->hasParam("type")) { request->send(400, "text/plain", "Missing Type"); return; }
+    String type = request->getParam("type")->value();
+    uint8_t dev;
+    if (type == "d3") dev = DEV_TYPE_DELTA_3;
+    else if (type == "d3p") dev = DEV_TYPE_DELTA_PRO_3;
+    else if (type == "w2") dev = DEV_TYPE_WAVE_2;
+    else if (type == "ac") dev = DEV_TYPE_ALT_CHARGER;
+    else { request->send(400, "text/plain", "Invalid Type"); return; }
+    int cols = 0;
+    const TelemField* fields = telem_fields(dev, &cols);
+
+    if (!request->hasParam("field")) {
+        DynamicJsonDocument doc(1024);
+        JsonArray arr = doc.to<JsonArray>();
+        for (int i = 0; i < cols; i++) {
+            JsonObject f = arr.createNestedObject();
+            f["name"] = fields[i].name;
+            f["unit"] = fields[i].unit;
+            f["scale"] = fields[i].scale;
+        }
+        String json; serializeJson(doc, json);
+        request->send(200, "application/json", json);
+        return;
+    }
+    int field = request->getParam("field")->value().toInt();
+    if (field < 0 || field >= cols) { request->send(400, "text/plain", "Invalid Field"); return; }
+
+    time_t now = time(nullptr);
+    if (now < 1700000000) { request->send(503, "text/plain", "Clock not set"); return; }
+    uint32_t to = request->hasParam("to") ? request->getParam("to")->value().toInt() : (uint32_t)now + 1;
+    uint32_t span = request->hasParam("span") ? request->getParam("span")->value().toInt() : 86400;
+    uint32_t from = request->hasParam("from") ? request->getParam("from")->value().toInt() : to - span;
+    int points = request->hasParam("points") ? request->getParam("points")->value().toInt() : 120;
+    if (to <= from || points < 1 || points > TELEM_POINTS_MAX) { request->send(400, "text/plain", "Invalid Range"); return; }
+
+    xSemaphoreTake(_requestMutex, portMAX_DELAY);
+    if (_pendingTelemRequest) {
+        xSemaphoreGive(_requestMutex);
+        request->send(503, "text/plain", "Query in progress");
+        return;
+    }
+    _telemDev = dev;
+    _telemField = field;
+    _telemFrom = from;
+    _telemTo = to;
+    Stm32Serial::getInstance().requestTelemetry(dev, field, from, to, points);
+    _pendingTelemRequest = request;
+    _pendingTelemRequestTime = millis();
+    xSemaphoreGive(_requestMutex);
+
+    request->onDisconnect([request](){
+        if (xSemaphoreTake(_requestMutex, 100) == pdTRUE) {
+            if (_pendingTelemRequest == request) _pendingTelemRequest = nullptr;
+            xSemaphoreGive(_requestMutex);
+        }
+    });
+}
+
+// ?name=<log>&q=<words>, optional levels (bit per level), from/to (record
+// ticks, ms since the STM32 booted), fmt (hex FmtId, up to 4 comma
+// separated) and max. Answered from update() once the STM32 ends the search.
+void WebServer::handleLogSearch(AsyncWebServerRequest *request) {
+    if (!request->hasParam("name")) { request->send(400, "text/plain", "Missing name"); return; }
+    String name = request->getParam("name")->value();
+    String text = request->hasParam("q") ? request->getParam("q")->value() : "";
+    uint8_t levels = request->hasParam("levels") ? request->getParam("levels")->value().toInt() : 0;
+    uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), nullptr, 10) : 0;
+    uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), nullptr, 10) : UINT32_MAX;
+    uint16_t max = request->hasParam("max") ? request->getParam("max")->value().toInt() : 100;
+    std::vector<uint32_t> fmts;
+    if (request->hasParam("fmt")) {
+        const char* p = request->getParam("fmt")->value().c_str();
+        while (*p) {
+            char* end;
+            fmts.push_back(strtoul(p, &end, 16));
+            if (end == p) break;
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
+    if (name.length() >= 32 || text.length() > LOG_SEARCH_TEXT_MAX || to < from || max == 0) {
+        request->send(400, "text/plain", "Invalid Search");
+        return;
+    }
+
+    xSemaphoreTake(_requestMutex, portMAX_DELAY);
+    if (_pendingSearchRequest) {
+        xSemaphoreGive(_requestMutex);
+        request->send(503, "text/plain", "Search in progress");
+        return;
+    }
+    Stm32Serial::getInstance().startLogSearch(name, text, levels, from, to, max, fmts);
+    _pendingSearchRequest = request;
+    _pendingSearchRequestTime = millis();
+    xSemaphoreGive(_requestMutex);
+
+    request->onDisconnect([request](){
+        if (xSemaphoreTake(_requestMutex, 100) == pdTRUE) {
+            if (_pendingSearchRequest == request) _pendingSearchRequest = nullptr;
+            xSemaphoreGive(_requestMutex);
+        }
+    });
+}
+
+// Stored integers as they are; the page divides by `scale`. Empty buckets are null.
+void WebServer::sendTelemetry(AsyncWebServerRequest *request) {
+    std::vector<int32_t> min, max;
+    Stm32Serial::getInstance().getTelemetry(min, max);
+    int cols = 0;
+    const TelemField* fields = telem_fields(_telemDev, &cols);
+    if (min.empty() || !fields) { request->send(404, "text/plain", "No such field"); return; }
+
+    DynamicJsonDocument doc(256 + min.size() * 32);
+    doc["from"] = _telemFrom;
+    doc["to"] = _telemTo;
+    doc["name"] = fields[_telemField].name;
+    doc["unit"] = fields[_telemField].unit;
+    doc["scale"] = fields[_telemField].scale;
+    JsonArray lo = doc.createNestedArray("min");
+    JsonArray hi = doc.createNestedArray("max");
+    for (size_t i = 0; i < min.size(); i++) {
+        if (min[i] > max[i]) { lo.add(); hi.add(); }
+        else { lo.add(min[i]); hi.add(max[i]); }
+    }
+    String json; serializeJson(doc, json);
+    request->send(200, "application/json", json);
+}
+
 void WebServer::handleControl(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
     StaticJsonDocument<512> doc; deserializeJson(doc, data, len);
     String typeStr = doc["type"]; String cmd = doc["cmd"];
@@ -469,10 +838,10 @@ void WebServer::handleLogs(AsyncWebServerRequest *request) {
     for (const auto& log : logs) {
         JsonObject obj = arr.createNestedObject();
         obj["seq"] = log.seq;
-        obj["ts"] = log.timestamp;
+        obj["ts"] = log.ms;
         obj["lvl"] = (int)log.level;
-        obj["tag"] = log.tag.isEmpty() ? "?" : log.tag;
-        obj["msg"] = log.message;
+        obj["tag"] = log.tag[0] ? log.tag : "?";
+        obj["msg"] = log.msg;
     }
     String json; serializeJson(doc, json);
     request->send(200, "application/json", json);
@@ -490,6 +859,49 @@ void WebServer::handleLogConfig(AsyncWebServerRequest *request, uint8_t *data, s
     request->send(200, "text/plain", "OK");
 }
 
+static void levelsToJson(JsonObject obj, const LogLevels& t) {
+    obj["default"] = t.def;
+    JsonObject tags = obj.createNestedObject("tags");
+    for (int i = 0; i < t.count; i++) tags[t.tags[i].tag] = t.tags[i].level;
+}
+
+// Levels of the lines the ESP32 forwards and of those the STM32 writes to
+// the card. The STM32's table is the one it last sent (null before the
+// first); each GET asks for it again.
+void WebServer::handleLogLevels(AsyncWebServerRequest *request) {
+    LogLevels esp, stm;
+    RemoteLogger_GetLevels(&esp);
+    DynamicJsonDocument doc(2048);
+    levelsToJson(doc.createNestedObject("esp"), esp);
+    if (Stm32Serial::getInstance().getStmLogLevels(&stm)) levelsToJson(doc.createNestedObject("stm"), stm);
+    else doc["stm"] = nullptr;
+    Stm32Serial::getInstance().requestStmLogLevels();
+    String json; serializeJson(doc, json);
+    request->send(200, "application/json", json);
+}
+
+// {"target": "esp" | "stm", "tag": "NimBLE", "level": 0-5}. No tag sets the
+// default, level -1 drops the tag. Both sides save the table.
+void WebServer::handleLogLevelsSave(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    StaticJsonDocument<200> doc; deserializeJson(doc, data, len);
+    String target = doc["target"] | "esp";
+    String tag = doc["tag"] | "";
+    int level = doc["level"] | -1;
+    if (level > LOG_LEVELS_VERBOSE || tag.length() > LOG_LEVELS_TAG_MAX) {
+        request->send(400, "text/plain", "Invalid Level"); return;
+    }
+    uint8_t lvl = level < 0 ? LOG_LEVELS_UNSET : (uint8_t)level;
+    if (target == "stm") {
+        Stm32Serial::getInstance().setStmLogLevel(tag.c_str(), lvl);
+        request->send(200, "text/plain", "Sent");
+    } else if (target == "esp") {
+        if (RemoteLogger_SetLevel(tag.c_str(), lvl)) request->send(200, "text/plain", "Saved");
+        else request->send(400, "text/plain", "Refused");
+    } else {
+        request->send(400, "text/plain", "Invalid Target");
+    }
+}
+
 void WebServer::handleRawCommand(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
     StaticJsonDocument<200> doc; deserializeJson(doc, data, len);
     if (doc.containsKey("cmd")) {
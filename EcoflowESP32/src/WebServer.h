@@ -20,6 +20,16 @@ private:
     static AsyncWebServer server;
     static AsyncWebServerRequest* _pendingLogRequest;
     static uint32_t _pendingLogRequestTime;
+    static AsyncWebServerRequest* _pendingListRequest;
+    static uint32_t _pendingListRequestTime;
+    static AsyncWebServerRequest* _pendingTelemRequest;
+    static uint32_t _pendingTelemRequestTime;
+    static uint8_t _telemDev;
+    static uint8_t _telemField;
+    static uint32_t _telemFrom;
+    static uint32_t _telemTo;
+    static AsyncWebServerRequest* _pendingSearchRequest;
+    static uint32_t _pendingSearchRequestTime;
     static SemaphoreHandle_t _requestMutex;
     static DynamicJsonDocument* _statusDoc; // pre-alloc — freeze plan F7
     static bool _serverStarted;
@@ -33,8 +43,13 @@ private:
     static void handleDisconnect(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
     static void handleForget(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
     static void handleHistory(AsyncWebServerRequest *request);
+    static void handleTelemetry(AsyncWebServerRequest *request);
+    static void sendTelemetry(AsyncWebServerRequest *request);
+    static void handleLogSearch(AsyncWebServerRequest *request);
     static void handleLogs(AsyncWebServerRequest *request);
     static void handleLogConfig(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+    static void handleLogLevels(AsyncWebServerRequest *request);
+    static void handleLogLevelsSave(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
     static void handleRawCommand(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
     static void handleSettings(AsyncWebServerRequest *request);
     static void handleSettingsSave(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
@@ -22,6 +22,7 @@
 #include "ecoflow_protocol.h"
 #include "Stm32Serial.h"
 #include "LogBuffer.h"
+#include "RemoteLogger.h"
 
 // Hardware Pin Definitions
 #define POWER_LATCH_PIN 16 ///< GPIO pin to control the power latch (keeps device on).
@@ -63,6 +64,9 @@ void setup() {
     // Initialize the UART communication with the STM32F4 FIRST
     Stm32Serial::getInstance().begin();
 
+    // Which lines are mirrored to the STM32, as last set on the web UI
+    RemoteLogger_Begin();
+
     // Route all ESP_LOGx output into the in-memory ring buffer (served on the
     // web UI) and mirror important lines to the STM32. Enabled at boot so the
     // BLE scan/connect/auth/data flow is captured from the very first packet.
@@ -1,4 +1,6 @@
 #include "ecoflow_protocol.h"
+#include "ota_crc.h"
+#include <stddef.h>
 #include <string.h>
 
 /**
@@ -32,50 +34,106 @@ int pack_handshake_message(uint8_t *buffer) {
 
 // Log API
 
-int pack_log_list_req_message(uint8_t *buffer) {
+int pack_log_list_req_message(uint8_t *buffer, uint16_t cursor) {
+    LogListReqMsg msg;
+    msg.cursor = cursor;
+    uint8_t len = sizeof(LogListReqMsg);
     buffer[0] = START_BYTE;
     buffer[1] = CMD_LOG_LIST_REQ;
-    buffer[2] = 0;
-    buffer[3] = calculate_crc8(&buffer[1], 2);
-    return 4;
+    buffer[2] = len;
+    memcpy(&buffer[3], &msg, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
 }
 
-int pack_log_list_resp_message(uint8_t *buffer, uint16_t total, uint16_t index, uint32_t size, const char* name) {
-    // Structure: [Total:2][Index:2][Size:4][Name:32] = 40 bytes
-    LogListEntryMsg msg;
-    msg.total_files = total;
-    msg.index = index;
-    msg.size = size;
-    strncpy(msg.name, name, 31);
-    msg.name[31] = 0;
+int unpack_log_list_req_message(const uint8_t *buffer, uint16_t *cursor) {
+    uint8_t len = buffer[2];
+    if (len != 0 && len != sizeof(LogListReqMsg)) return -2;
 
-    uint8_t len = sizeof(LogListEntryMsg);
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    // Empty request: the whole list from the start
+    LogListReqMsg msg = {0};
+    memcpy(&msg, &buffer[3], len);
+    *cursor = msg.cursor;
+    return 0;
+}
+
+void pack_log_list_resp_begin(uint8_t *buffer, uint16_t total, uint16_t cursor) {
+    LogListPageHeader hdr;
+    hdr.total_files = total;
+    hdr.cursor = cursor;
+    hdr.count = 0;
     buffer[0] = START_BYTE;
     buffer[1] = CMD_LOG_LIST_RESP;
-    buffer[2] = len;
-    memcpy(&buffer[3], &msg, len);
+    buffer[2] = sizeof(LogListPageHeader);
+    memcpy(&buffer[3], &hdr, sizeof(hdr));
+}
+
+bool pack_log_list_resp_add(uint8_t *buffer, uint32_t size, const char* name) {
+    size_t name_len = strlen(name);
+    if (name_len > LOG_LIST_NAME_MAX) name_len = LOG_LIST_NAME_MAX;
+    uint8_t len = buffer[2];
+    if (len + 5 + name_len > MAX_PAYLOAD_LEN) return false;
+
+    uint8_t *p = &buffer[3 + len];
+    memcpy(p, &size, 4);
+    p[4] = (uint8_t)name_len;
+    memcpy(&p[5], name, name_len);
+    buffer[2] = (uint8_t)(len + 5 + name_len);
+    buffer[3 + offsetof(LogListPageHeader, count)]++;
+    return true;
+}
+
+int pack_log_list_resp_end(uint8_t *buffer) {
+    uint8_t len = buffer[2];
     buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
     return 4 + len;
 }
 
-int unpack_log_list_resp_message(const uint8_t *buffer, uint16_t *total, uint16_t *index, uint32_t *size, char* name) {
+int unpack_log_list_resp_message(const uint8_t *buffer, uint16_t *total, uint16_t *cursor, uint8_t *count) {
     uint8_t len = buffer[2];
-    if (len != sizeof(LogListEntryMsg)) return -2;
+    if (len < sizeof(LogListPageHeader)) return -2;
 
     uint8_t received_crc = buffer[3 + len];
     uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
     if (received_crc != calculated_crc) return -1;
 
-    LogListEntryMsg msg;
-    memcpy(&msg, &buffer[3], len);
+    LogListPageHeader hdr;
+    memcpy(&hdr, &buffer[3], sizeof(hdr));
 
-    *total = msg.total_files;
-    *index = msg.index;
-    *size = msg.size;
-    strncpy(name, msg.name, 32);
+    // Entries must fill the payload exactly
+    int pos = 0;
+    for (uint8_t i = 0; i < hdr.count; i++) {
+        pos = unpack_log_list_resp_entry(buffer, pos, NULL, NULL);
+        if (pos < 0) return -2;
+    }
+    if (sizeof(LogListPageHeader) + pos != len) return -2;
+
+    *total = hdr.total_files;
+    *cursor = hdr.cursor;
+    *count = hdr.count;
     return 0;
 }
 
+int unpack_log_list_resp_entry(const uint8_t *buffer, int pos, uint32_t *size, char* name) {
+    uint8_t len = buffer[2];
+    const uint8_t *p = &buffer[3 + sizeof(LogListPageHeader) + pos];
+    int end = (int)sizeof(LogListPageHeader) + pos;
+    if (end + 5 > len) return -1;
+    uint8_t name_len = p[4];
+    if (name_len > LOG_LIST_NAME_MAX || end + 5 + name_len > len) return -1;
+
+    if (size) memcpy(size, p, 4);
+    if (name) {
+        memcpy(name, &p[5], name_len);
+        name[name_len] = 0;
+    }
+    return pos + 5 + name_len;
+}
+
 int pack_log_download_req_message(uint8_t *buffer, const char* name) {
     LogDownloadReqMsg msg;
     strncpy(msg.name, name, 31);
@@ -154,22 +212,22 @@ int unpack_log_delete_req_message(const uint8_t *buffer, char* name) {
 int pack_esp_log_message(uint8_t *buffer, uint8_t level, const char* tag, const char* msg) {
     // [Level:1][TagLen:1][Tag:...][Msg...]
     // Max payload 255.
-    uint8_t tagLen = strlen(tag);
-    uint8_t msgLen = strlen(msg);
+    size_t tagLen = strlen(tag);
+    size_t msgLen = strlen(msg);
     if (1 + 1 + tagLen + msgLen > 255) {
         // Truncate message
-        int avail = 255 - (1 + 1 + tagLen);
+        int avail = 255 - (int)(1 + 1 + tagLen);
         if (avail < 0) return -3;
         msgLen = avail;
     }
 
-    uint8_t payload_len = 1 + 1 + tagLen + msgLen;
+    uint8_t payload_len = (uint8_t)(1 + 1 + tagLen + msgLen);
     buffer[0] = START_BYTE;
     buffer[1] = CMD_ESP_LOG_DATA;
     buffer[2] = payload_len;
 
     buffer[3] = level;
-    buffer[4] = tagLen;
+    buffer[4] = (uint8_t)tagLen;
     memcpy(&buffer[5], tag, tagLen);
     memcpy(&buffer[5+tagLen], msg, msgLen);
 
@@ -177,6 +235,194 @@ int pack_esp_log_message(uint8_t *buffer, uint8_t level, const char* tag, const
     return 4 + payload_len;
 }
 
+int pack_esp_log_rec_message(uint8_t *buffer, uint8_t level, uint32_t fmt_id, uint16_t tag_id, const uint8_t* args, uint8_t args_len) {
+    // [Level:1][FmtId:4][TagId:2][Args...]
+    if (args_len > MAX_PAYLOAD_LEN - 7) args_len = MAX_PAYLOAD_LEN - 7;
+    uint8_t payload_len = 7 + args_len;
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_ESP_LOG_REC;
+    buffer[2] = payload_len;
+    buffer[3] = level;
+    memcpy(&buffer[4], &fmt_id, 4);
+    memcpy(&buffer[8], &tag_id, 2);
+    if (args_len) memcpy(&buffer[10], args, args_len);
+    buffer[3 + payload_len] = calculate_crc8(&buffer[1], 2 + payload_len);
+    return 4 + payload_len;
+}
+
+int unpack_esp_log_rec_message(const uint8_t *buffer, uint8_t *level, uint32_t *fmt_id, uint16_t *tag_id, const uint8_t **args) {
+    uint8_t len = buffer[2];
+    if (len < 7) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    *level = buffer[3];
+    memcpy(fmt_id, &buffer[4], 4);
+    memcpy(tag_id, &buffer[8], 2);
+    *args = &buffer[10];
+    return len - 7;
+}
+
+#define LOG_BATCH_REC 0x80   // Hdr bits, ecoflow_protocol.h
+#define LOG_BATCH_SRC 0x0F
+
+// Bytes of a payload's source after its level, [TagLen][Tag] or
+// [FmtId:4][TagId:2]; 0 if it is too short to hold one
+static int batch_source_len(uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    if (cmd == CMD_ESP_LOG_REC) return len >= 7 ? 6 : 0;
+    if (cmd == CMD_ESP_LOG_DATA && len >= 2 && 2 + payload[1] <= len) return 1 + payload[1];
+    return 0;
+}
+
+void pack_esp_log_batch_begin(uint8_t *buffer, LogBatchCursor *c) {
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_ESP_LOG_BATCH;
+    buffer[2] = 1;
+    buffer[3] = 0;
+    memset(c, 0, sizeof(*c));
+}
+
+bool pack_esp_log_batch_add(uint8_t *buffer, LogBatchCursor *c, uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    if (len > LOG_BATCH_LINE_MAX) len = LOG_BATCH_LINE_MAX;
+    int src_len = batch_source_len(cmd, payload, len);
+    if (src_len == 0) return true;
+
+    const uint8_t *lines = &buffer[4];
+    uint8_t hdr = (uint8_t)((cmd == CMD_ESP_LOG_REC ? LOG_BATCH_REC : 0) | (payload[0] & 7) << 4);
+    for (uint8_t i = 0; i < c->sources; i++) {
+        const uint8_t *named = &lines[c->source[i]];
+        if ((named[0] & LOG_BATCH_REC) == (hdr & LOG_BATCH_REC) && memcmp(&named[2], &payload[1], src_len) == 0) {
+            hdr |= (uint8_t)(i + 1);
+            break;
+        }
+    }
+
+    int skip = (hdr & LOG_BATCH_SRC) ? src_len : 0;
+    int body = len - 1 - skip;
+    uint8_t used = buffer[2];
+    if (used + 2 + body > MAX_PAYLOAD_LEN) return false;
+
+    uint8_t *p = &buffer[3 + used];
+    p[0] = hdr;
+    p[1] = (uint8_t)body;
+    memcpy(&p[2], &payload[1 + skip], body);
+    if (!skip && c->sources < LOG_BATCH_SOURCES) c->source[c->sources++] = (uint8_t)(used - 1);
+    buffer[2] = (uint8_t)(used + 2 + body);
+    buffer[3]++;
+    return true;
+}
+
+int pack_esp_log_batch_end(uint8_t *buffer) {
+    uint8_t len = buffer[2];
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_esp_log_batch_message(const uint8_t *buffer, uint8_t *count) {
+    uint8_t len = buffer[2];
+    if (len < 1) return -2;
+
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    // Lines must fill the payload exactly, each source named before use
+    LogBatchCursor c;
+    memset(&c, 0, sizeof(c));
+    for (uint8_t i = 0; i < buffer[3]; i++) {
+        if (unpack_esp_log_batch_line(buffer, &c, NULL, NULL, NULL) < 0) return -2;
+    }
+    if (1 + c.pos != len) return -2;
+
+    *count = buffer[3];
+    return 0;
+}
+
+int unpack_esp_log_batch_line(const uint8_t *buffer, LogBatchCursor *c, uint8_t *cmd, uint8_t *payload, uint8_t *len) {
+    uint8_t total = buffer[2];
+    const uint8_t *lines = &buffer[4];
+    const uint8_t *p = &lines[c->pos];
+    if (1 + c->pos + 2 > total) return -1;
+    uint8_t body = p[1];
+    if (1 + c->pos + 2 + body > total) return -1;
+
+    // A line naming its source must hold it; one naming none points back
+    // to a line of the same kind that did
+    bool rec = (p[0] & LOG_BATCH_REC) != 0;
+    uint8_t src = p[0] & LOG_BATCH_SRC;
+    const uint8_t *named = p;
+    if (src) {
+        if (src > c->sources) return -1;
+        named = &lines[c->source[src - 1]];
+        if ((named[0] & LOG_BATCH_REC) != (p[0] & LOG_BATCH_REC)) return -1;
+    } else if (rec ? body < 6 : (body < 1 || body < 1 + p[2])) {
+        return -1;
+    }
+    int skip = src ? (rec ? 6 : 1 + named[2]) : 0;
+    if (1 + skip + body > MAX_PAYLOAD_LEN) return -1;
+
+    if (payload) {
+        payload[0] = (p[0] >> 4) & 7;
+        memcpy(&payload[1], &named[2], skip);
+        memcpy(&payload[1 + skip], &p[2], body);
+    }
+    if (cmd) *cmd = rec ? CMD_ESP_LOG_REC : CMD_ESP_LOG_DATA;
+    if (len) *len = (uint8_t)(1 + skip + body);
+    if (!src && c->sources < LOG_BATCH_SOURCES) c->source[c->sources++] = (uint8_t)c->pos;
+    c->pos += 2 + body;
+    return c->pos;
+}
+
+int pack_log_level_set_message(uint8_t *buffer, uint8_t level, const char *tag) {
+    // [Level:1][Tag...]
+    size_t tag_len = tag ? strlen(tag) : 0;
+    if (tag_len > MAX_PAYLOAD_LEN - 1) tag_len = MAX_PAYLOAD_LEN - 1;
+    uint8_t payload_len = (uint8_t)(1 + tag_len);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_LOG_LEVEL_SET;
+    buffer[2] = payload_len;
+    buffer[3] = level;
+    if (tag_len) memcpy(&buffer[4], tag, tag_len);
+    buffer[3 + payload_len] = calculate_crc8(&buffer[1], 2 + payload_len);
+    return 4 + payload_len;
+}
+
+int unpack_log_level_set_message(const uint8_t *buffer, uint8_t *level, char *tag, int tag_size) {
+    uint8_t len = buffer[2];
+    if (len < 1) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    int tag_len = len - 1;
+    if (tag_len >= tag_size) return -2;
+    *level = buffer[3];
+    memcpy(tag, &buffer[4], tag_len);
+    tag[tag_len] = 0;
+    return 0;
+}
+
+int pack_log_level_list_message(uint8_t *buffer, const uint8_t *table, uint8_t len) {
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_LOG_LEVEL_LIST;
+    buffer[2] = len;
+    memcpy(&buffer[3], table, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_log_level_list_message(const uint8_t *buffer, const uint8_t **table) {
+    uint8_t len = buffer[2];
+    if (len < 2) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    *table = &buffer[3];
+    return len;
+}
+
 int pack_simple_cmd_message(uint8_t *buffer, uint8_t cmd) {
     buffer[0] = START_BYTE;
     buffer[1] = cmd;
@@ -229,6 +475,149 @@ int unpack_log_resend_req_message(const uint8_t *buffer, uint32_t *offset) {
     return 0;
 }
 
+int pack_log_credit_message(uint8_t *buffer, uint32_t offset, uint8_t credits) {
+    uint8_t len = sizeof(LogCreditMsg);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_LOG_CREDIT;
+    buffer[2] = len;
+    LogCreditMsg msg;
+    msg.offset = offset;
+    msg.credits = credits;
+    memcpy(&buffer[3], &msg, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_log_credit_message(const uint8_t *buffer, uint32_t *offset, uint8_t *credits) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(LogCreditMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+    LogCreditMsg msg;
+    memcpy(&msg, &buffer[3], len);
+    *offset = msg.offset;
+    *credits = msg.credits;
+    return 0;
+}
+
+int pack_log_search_message(uint8_t *buffer, const LogSearchMsg *msg) {
+    uint8_t len = sizeof(LogSearchMsg);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_LOG_SEARCH;
+    buffer[2] = len;
+    memcpy(&buffer[3], msg, len);
+    buffer[3 + offsetof(LogSearchMsg, name) + sizeof(msg->name) - 1] = 0;
+    buffer[3 + offsetof(LogSearchMsg, text) + sizeof(msg->text) - 1] = 0;
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_log_search_message(const uint8_t *buffer, LogSearchMsg *msg) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(LogSearchMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+    memcpy(msg, &buffer[3], len);
+    msg->name[sizeof(msg->name) - 1] = 0;
+    msg->text[sizeof(msg->text) - 1] = 0;
+    if (msg->nfmts > 4) msg->nfmts = 4;
+    return 0;
+}
+
+void pack_log_search_resp_begin(uint8_t *buffer, uint8_t id) {
+    LogSearchPageHeader hdr = {id, 0};
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_LOG_SEARCH_RESP;
+    buffer[2] = sizeof(LogSearchPageHeader);
+    memcpy(&buffer[3], &hdr, sizeof(hdr));
+}
+
+bool pack_log_search_resp_add(uint8_t *buffer, uint32_t offset, const uint8_t *rec, int len) {
+    uint8_t used = buffer[2];
+    int room = MAX_PAYLOAD_LEN - used - 4;
+    if (len > room) {
+        // Alone in a page and still too long: cut the payload and fix Len
+        if (used != sizeof(LogSearchPageHeader)) return false;
+        len = room;
+    }
+    uint8_t *p = &buffer[3 + used];
+    memcpy(p, &offset, 4);
+    memcpy(&p[4], rec, len);
+    p[5] = (uint8_t)((len - 3) & 0xFF);
+    p[6] = (uint8_t)((len - 3) >> 8);
+    buffer[2] = (uint8_t)(used + 4 + len);
+    buffer[3 + offsetof(LogSearchPageHeader, count)]++;
+    return true;
+}
+
+int pack_log_search_resp_end(uint8_t *buffer) {
+    uint8_t len = buffer[2];
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int pack_log_search_end_message(uint8_t *buffer, const LogSearchEndMsg *msg) {
+    uint8_t len = sizeof(LogSearchEndMsg);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_LOG_SEARCH_RESP;
+    buffer[2] = len;
+    memcpy(&buffer[3], msg, len);
+    buffer[3 + offsetof(LogSearchEndMsg, count)] = 0;
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_log_search_resp_message(const uint8_t *buffer, uint8_t *id, uint8_t *count) {
+    uint8_t len = buffer[2];
+    if (len < sizeof(LogSearchPageHeader)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    LogSearchPageHeader hdr;
+    memcpy(&hdr, &buffer[3], sizeof(hdr));
+    if (hdr.count == 0) {
+        if (len != sizeof(LogSearchEndMsg)) return -2;
+    } else {
+        // Entries must fill the payload exactly
+        int pos = 0;
+        for (uint8_t i = 0; i < hdr.count; i++) {
+            pos = unpack_log_search_resp_entry(buffer, pos, NULL, NULL, NULL);
+            if (pos < 0) return -2;
+        }
+        if (sizeof(LogSearchPageHeader) + pos != len) return -2;
+    }
+    *id = hdr.id;
+    *count = hdr.count;
+    return 0;
+}
+
+int unpack_log_search_resp_entry(const uint8_t *buffer, int pos, uint32_t *offset, const uint8_t **rec, int *len) {
+    uint8_t plen = buffer[2];
+    const uint8_t *p = &buffer[3 + sizeof(LogSearchPageHeader) + pos];
+    int end = (int)sizeof(LogSearchPageHeader) + pos;
+    if (end + 4 + 3 > plen) return -1;
+    int rec_len = 3 + (p[5] | (p[6] << 8));
+    if (end + 4 + rec_len > plen) return -1;
+
+    if (offset) memcpy(offset, p, 4);
+    if (rec) *rec = &p[4];
+    if (len) *len = rec_len;
+    return pos + 4 + rec_len;
+}
+
+int unpack_log_search_end_message(const uint8_t *buffer, LogSearchEndMsg *msg) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(LogSearchEndMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+    memcpy(msg, &buffer[3], len);
+    return msg->count == 0 ? 0 : -2;
+}
+
 int pack_handshake_ack_message(uint8_t *buffer) {
     buffer[0] = START_BYTE;
     buffer[1] = CMD_HANDSHAKE_ACK;
@@ -489,31 +878,99 @@ int unpack_forget_device_message(const uint8_t *buffer, uint8_t *device_type) {
     return 0;
 }
 
-int pack_ota_start_message(uint8_t *buffer, uint32_t total_size) {
+int pack_ota_start_message(uint8_t *buffer, uint32_t total_size, uint8_t window, uint8_t flags, uint32_t file_crc) {
     uint8_t len = sizeof(OtaStartMsg);
     buffer[0] = START_BYTE;
     buffer[1] = CMD_OTA_START;
     buffer[2] = len;
-    OtaStartMsg msg = { total_size };
+    OtaStartMsg msg = { total_size, window, flags, {0, 0}, file_crc };
     memcpy(&buffer[3], &msg, len);
     buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
     return 4 + len;
 }
 
-int pack_ota_chunk_message(uint8_t *buffer, uint32_t offset, const uint8_t *data, uint8_t len) {
-    // [OFFSET(4)][DATA(len)]
-    // Payload length = 4 + len. Max 255.
-    // So len must be <= 251.
+int pack_ota_query_message(uint8_t *buffer) {
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_OTA_QUERY;
+    buffer[2] = 0;
+    buffer[3] = calculate_crc8(&buffer[1], 2);
+    return 4;
+}
+
+int unpack_ota_progress_message(const uint8_t *buffer, uint32_t *total_size, uint32_t *file_crc, uint32_t *offset) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(OtaProgressMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+    OtaProgressMsg msg;
+    memcpy(&msg, &buffer[3], len);
+    *total_size = msg.total_size;
+    *file_crc = msg.file_crc;
+    *offset = msg.offset;
+    return 0;
+}
+
+// Appends the CRC32 of the payload so far; the frame CRC8 lets too many
+// corrupted chunks through to trust it with flash contents
+static uint8_t append_chunk_crc(uint8_t *payload, uint8_t payload_len) {
+    uint32_t crc = ota_crc32(0, payload, payload_len);
+    memcpy(&payload[payload_len], &crc, 4);
+    return payload_len + 4;
+}
+
+int pack_ota_chunk_message(uint8_t *buffer, uint32_t offset, const uint8_t *data, uint8_t len, bool chunk_crc) {
+    // [OFFSET(4)][DATA(len)][CRC32(4) if chunk_crc]
+    // Payload length = 4 + len (+ 4). Max 255.
+    // So len must be <= 247.
     uint8_t payload_len = 4 + len;
     buffer[0] = START_BYTE;
     buffer[1] = CMD_OTA_CHUNK;
-    buffer[2] = payload_len;
     memcpy(&buffer[3], &offset, 4);
     memcpy(&buffer[7], data, len);
+    if (chunk_crc) payload_len = append_chunk_crc(&buffer[3], payload_len);
+    buffer[2] = payload_len;
+    buffer[3 + payload_len] = calculate_crc8(&buffer[1], 2 + payload_len);
+    return 4 + payload_len;
+}
+
+int pack_ota_wchunk_message(uint8_t *buffer, uint16_t seq, const uint8_t *data, uint8_t len, bool chunk_crc) {
+    // [SEQ(2)][DATA(len)][CRC32(4) if chunk_crc], len <= OTA_WINDOW_CHUNK
+    uint8_t payload_len = 2 + len;
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_OTA_WCHUNK;
+    memcpy(&buffer[3], &seq, 2);
+    memcpy(&buffer[5], data, len);
+    if (chunk_crc) payload_len = append_chunk_crc(&buffer[3], payload_len);
+    buffer[2] = payload_len;
     buffer[3 + payload_len] = calculate_crc8(&buffer[1], 2 + payload_len);
     return 4 + payload_len;
 }
 
+int pack_ota_wack_message(uint8_t *buffer, uint16_t next_seq, uint16_t sack) {
+    uint8_t len = sizeof(OtaWackMsg);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_OTA_WACK;
+    buffer[2] = len;
+    OtaWackMsg msg = { next_seq, sack };
+    memcpy(&buffer[3], &msg, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_ota_wack_message(const uint8_t *buffer, uint16_t *next_seq, uint16_t *sack) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(OtaWackMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+    OtaWackMsg msg;
+    memcpy(&msg, &buffer[3], len);
+    *next_seq = msg.next_seq;
+    *sack = msg.sack;
+    return 0;
+}
+
 int pack_ota_end_message(uint8_t *buffer, uint32_t crc32) {
     uint8_t len = 4; // 4 bytes CRC
     buffer[0] = START_BYTE;
@@ -531,3 +988,241 @@ int pack_ota_apply_message(uint8_t *buffer) {
     buffer[3] = calculate_crc8(&buffer[1], 2);
     return 4;
 }
+
+// Telemetry recorder
+
+int pack_time_sync_message(uint8_t *buffer, uint32_t epoch) {
+    TimeSyncMsg msg;
+    msg.epoch = epoch;
+    uint8_t len = sizeof(TimeSyncMsg);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_TIME_SYNC;
+    buffer[2] = len;
+    memcpy(&buffer[3], &msg, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_time_sync_message(const uint8_t *buffer, uint32_t *epoch) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(TimeSyncMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    TimeSyncMsg msg;
+    memcpy(&msg, &buffer[3], len);
+    *epoch = msg.epoch;
+    return 0;
+}
+
+int pack_telem_query_message(uint8_t *buffer, const TelemQueryMsg *q) {
+    uint8_t len = sizeof(TelemQueryMsg);
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_TELEM_QUERY;
+    buffer[2] = len;
+    memcpy(&buffer[3], q, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_telem_query_message(const uint8_t *buffer, TelemQueryMsg *q) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(TelemQueryMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    memcpy(q, &buffer[3], len);
+    return 0;
+}
+
+int pack_telem_data_message(uint8_t *buffer, uint8_t id, uint16_t total, uint16_t first,
+                            const int32_t *min, const int32_t *max, uint8_t count) {
+    if (count > TELEM_DATA_POINTS) count = TELEM_DATA_POINTS;
+    TelemDataHeader hdr;
+    hdr.id = id;
+    hdr.total = total;
+    hdr.first = first;
+    hdr.count = count;
+    uint8_t len = sizeof(TelemDataHeader) + count * 8;
+    buffer[0] = START_BYTE;
+    buffer[1] = CMD_TELEM_DATA;
+    buffer[2] = len;
+    memcpy(&buffer[3], &hdr, sizeof(hdr));
+    uint8_t *p = &buffer[3 + sizeof(hdr)];
+    for (uint8_t i = 0; i < count; i++) {
+        memcpy(p, &min[i], 4);
+        memcpy(p + 4, &max[i], 4);
+        p += 8;
+    }
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_telem_data_message(const uint8_t *buffer, TelemDataHeader *hdr, int32_t *min, int32_t *max) {
+    uint8_t len = buffer[2];
+    if (len < sizeof(TelemDataHeader)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    memcpy(hdr, &buffer[3], sizeof(TelemDataHeader));
+    if (hdr->count > TELEM_DATA_POINTS || sizeof(TelemDataHeader) + hdr->count * 8 != len) return -2;
+    const uint8_t *p = &buffer[3 + sizeof(TelemDataHeader)];
+    for (uint8_t i = 0; i < hdr->count; i++) {
+        memcpy(&min[i], p, 4);
+        memcpy(&max[i], p + 4, 4);
+        p += 8;
+    }
+    return 0;
+}
+
+// Link API
+
+int pack_link_ping_message(uint8_t *buffer, uint8_t cmd, uint16_t seq, uint32_t timestamp_us, uint8_t pad_len) {
+    // [Seq:2][Time:4][Pad:pad_len]
+    if (sizeof(LinkPingHeader) + pad_len > MAX_PAYLOAD_LEN) pad_len = MAX_PAYLOAD_LEN - sizeof(LinkPingHeader);
+    uint8_t len = sizeof(LinkPingHeader) + pad_len;
+    LinkPingHeader hdr = { seq, timestamp_us };
+
+    buffer[0] = START_BYTE;
+    buffer[1] = cmd;
+    buffer[2] = len;
+    memcpy(&buffer[3], &hdr, sizeof(hdr));
+    for (uint8_t i = 0; i < pad_len; i++) {
+        buffer[3 + sizeof(hdr) + i] = (uint8_t)(seq + i); // Varying pattern, not just zeros
+    }
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_link_ping_message(const uint8_t *buffer, uint16_t *seq, uint32_t *timestamp_us) {
+    uint8_t len = buffer[2];
+    if (len < sizeof(LinkPingHeader)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    LinkPingHeader hdr;
+    memcpy(&hdr, &buffer[3], sizeof(hdr));
+    *seq = hdr.seq;
+    *timestamp_us = hdr.timestamp_us;
+    return len - sizeof(LinkPingHeader);
+}
+
+int pack_link_baud_message(uint8_t *buffer, uint8_t cmd, uint32_t baud, uint8_t flag) {
+    uint8_t len = sizeof(LinkBaudMsg);
+    LinkBaudMsg msg = { baud, flag };
+    buffer[0] = START_BYTE;
+    buffer[1] = cmd;
+    buffer[2] = len;
+    memcpy(&buffer[3], &msg, len);
+    buffer[3 + len] = calculate_crc8(&buffer[1], 2 + len);
+    return 4 + len;
+}
+
+int unpack_link_baud_message(const uint8_t *buffer, uint32_t *baud, uint8_t *flag) {
+    uint8_t len = buffer[2];
+    if (len != sizeof(LinkBaudMsg)) return -2;
+    uint8_t received_crc = buffer[3 + len];
+    uint8_t calculated_crc = calculate_crc8(&buffer[1], 2 + len);
+    if (received_crc != calculated_crc) return -1;
+
+    LinkBaudMsg msg;
+    memcpy(&msg, &buffer[3], len);
+    *baud = msg.baud;
+    *flag = msg.flag;
+    return 0;
+}
+
+// COBS framing
+
+/**
+ * @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF).
+ */
+uint16_t calculate_crc16(const uint8_t *data, uint16_t len) {
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Consistent Overhead Byte Stuffing: removes every 0x00 from the data
+ * so 0x00 can delimit frames. Output is at most len + len / 254 + 1 bytes.
+ */
+int cobs_encode(const uint8_t *in, int len, uint8_t *out) {
+    int code_pos = 0;
+    int o = 1;
+    uint8_t code = 1;
+    for (int i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = o++;
+            code = 1;
+        } else {
+            out[o++] = in[i];
+            if (++code == 0xFF) {
+                out[code_pos] = code;
+                code_pos = o++;
+                code = 1;
+            }
+        }
+    }
+    out[code_pos] = code;
+    return o;
+}
+
+int cobs_decode(const uint8_t *in, int len, uint8_t *out) {
+    int i = 0;
+    int o = 0;
+    while (i < len) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > len) return -1;
+        for (uint8_t k = 1; k < code; k++) {
+            if (in[i] == 0) return -1;
+            out[o++] = in[i++];
+        }
+        if (code != 0xFF && i < len) out[o++] = 0;
+    }
+    return o;
+}
+
+int pack_cobs_frame(uint8_t *out, const uint8_t *frame, int len) {
+    // [CMD][LEN][PAYLOAD][CRC16]: drop the start byte and CRC8, add CRC16.
+    // Delimiters on both sides: whatever noise preceded the frame is flushed
+    // as a separate (rejected) frame instead of corrupting this one.
+    uint8_t raw[MAX_PAYLOAD_LEN + 4];
+    int body = len - 2;
+    if (body < 2 || body > MAX_PAYLOAD_LEN + 2) return 0;
+    memcpy(raw, &frame[1], body);
+    uint16_t crc = calculate_crc16(raw, body);
+    raw[body] = crc & 0xFF;
+    raw[body + 1] = crc >> 8;
+    out[0] = 0x00;
+    int n = 1 + cobs_encode(raw, body + 2, &out[1]);
+    out[n++] = 0x00;
+    return n;
+}
+
+int unpack_cobs_frame(const uint8_t *encoded, int len, uint8_t *frame) {
+    uint8_t raw[COBS_FRAME_MAX];
+    if (len > COBS_FRAME_MAX - 1) return -2;
+    int n = cobs_decode(encoded, len, raw);
+    if (n < 4) return -2;
+    int body = n - 2;
+    if (raw[1] != body - 2) return -2;
+    uint16_t crc = raw[body] | (raw[body + 1] << 8);
+    if (calculate_crc16(raw, body) != crc) return -1;
+
+    // Rebuild the legacy frame so upper layers see one format
+    frame[0] = START_BYTE;
+    memcpy(&frame[1], raw, body);
+    frame[1 + body] = calculate_crc8(raw, body);
+    return body + 2;
+}
@@ -41,23 +41,122 @@ extern "C" {
 #define CMD_OTA_CHUNK 0xA1           ///< OTA Data Chunk
 #define CMD_OTA_END   0xA2           ///< End OTA Update
 #define CMD_OTA_APPLY 0xA3           ///< Apply OTA Update
+#define CMD_OTA_WCHUNK 0xA4          ///< Windowed OTA chunk [Seq:2][Data...]
+#define CMD_OTA_WACK   0xA5          ///< Bootloader -> ESP32: windowed ack [NextSeq:2][Sack:2]
+#define CMD_OTA_QUERY  0xA6          ///< ESP32 -> bootloader: which transfer can be resumed
+#define CMD_OTA_PROGRESS 0xA7        ///< Bootloader -> ESP32: [Size:4][FileCRC32:4][Offset:4], zeros: none
+
+// Windowed OTA. OTA_START carries the window the ESP32 asks for; the
+// bootloader grants one in the payload of its START ACK (no payload = old
+// bootloader, stop-and-wait CMD_OTA_CHUNK). Chunk seq covers bytes
+// [seq * OTA_WINDOW_CHUNK, +OTA_WINDOW_CHUNK). NextSeq in a WACK is the first
+// chunk not yet received; Sack bit i is set if chunk NextSeq + 1 + i was.
+#define OTA_WINDOW_CHUNK 240
+#define OTA_WINDOW_MAX   16
+
+// OTA_START flags. The bootloader echoes those it supports after the window
+// in its START ACK ([Window:1][Flags:1]); older bootloaders echo none.
+#define OTA_FLAG_CHUNK_CRC 0x01      ///< CHUNK/WCHUNK end in a CRC32 (ota_crc32) of the payload before it
+#define OTA_FLAG_RESUME    0x02      ///< Continue this file from the bootloader's progress record;
+                                     ///< the ACK then ends in [Offset:4], where to continue
 
 // --- Log Management Commands ---
 // ESP32 -> F4
-#define CMD_LOG_LIST_REQ      0x70   ///< Request List of Log Files
+#define CMD_LOG_LIST_REQ      0x70   ///< Request a page of the log list [Cursor:2]
 #define CMD_LOG_DOWNLOAD_REQ  0x71   ///< Request to start downloading a specific log
 #define CMD_LOG_DELETE_REQ    0x72   ///< Request to delete a specific log
 #define CMD_ESP_LOG_DATA      0x73   ///< Send ESP32 Log (Error/Warning) to F4
+#define CMD_ESP_LOG_REC       0x7D   ///< ESP32 log record [Level:1][FmtId:4][TagId:2][Args...] (log_record.h, log_levels.h)
+#define CMD_ESP_LOG_BATCH     0x85   ///< Several ESP32 log lines in one frame (log_batch.h)
 #define CMD_LOG_MANAGER_OP    0x74   ///< Perform Log Manager Op (Format, Delete All)
 #define CMD_LOG_RESEND_REQ    0x7B   ///< Request resend of log chunk
+#define CMD_LOG_CREDIT        0x7C   ///< Grant log chunks [Offset:4][Credits:1]: all before Offset received
+#define CMD_LOG_SEARCH        0x7E   ///< Search a log for records (LogSearchMsg, log_index.h)
+#define CMD_LOG_LEVEL_SET     0x86   ///< Set one tag's level in the F4's table [Level:1][Tag...] (log_levels.h)
+#define CMD_LOG_LEVEL_GET     0x87   ///< Ask for the F4's level table
+
+// Log batch. [Count:1] then Count x [Hdr:1][Len:1][Body], each line a
+// CMD_ESP_LOG_DATA or CMD_ESP_LOG_REC payload, cut to LOG_BATCH_LINE_MAX.
+// Hdr is [Rec:1][Level:3][Src:4]: Rec set for a record; the level moves out
+// of the payload. The source, a text line's [TagLen][Tag] or a record's
+// [FmtId:4][TagId:2], heads the body when Src is 0 and is then the frame's
+// next source, up to LOG_BATCH_SOURCES; Src n leaves it out, being the n-th.
+// A burst from a few call sites sends each tag or FmtId once a frame.
+#define LOG_BATCH_LINE_MAX (MAX_PAYLOAD_LEN - 2)
+#define LOG_BATCH_SOURCES  15
+
+// Where packing or unpacking a batch is, and the sources named so far
+typedef struct {
+    int pos;                              // From the first line
+    uint8_t sources;
+    uint8_t source[LOG_BATCH_SOURCES];    // The line naming each, from the first line
+} LogBatchCursor;
+
+// Log levels. CMD_LOG_LEVEL_SET carries a level and the rest of the payload
+// is the tag, none for the default; LOG_LEVELS_UNSET drops the tag from the
+// table. The F4 answers SET and GET with CMD_LOG_LEVEL_LIST, its table as
+// log_levels_pack() writes it, after saving it to the card.
+
+// Log download. The F4 streams a file once CMD_LOG_CREDIT grants it room and
+// sends at most Credits * LOG_CHUNK_MAX bytes past the latest Offset.
+#define LOG_CHUNK_MAX 240            ///< Data bytes per CMD_LOG_DATA_CHUNK
+
+// Log list. CMD_LOG_LIST_REQ asks for the files from Cursor on (0 rescans the
+// card); the F4 answers with one page of as many entries as fit a frame:
+// [Total:2][Cursor:2][Count:1] then Count x [Size:4][NameLen:1][Name].
+// The page with Cursor + Count == Total is the last.
+#define LOG_LIST_NAME_MAX  31        ///< Longer names are cut, as download/delete take 32 bytes
+#define LOG_LIST_ENTRY_MAX (5 + LOG_LIST_NAME_MAX)
 
 // F4 -> ESP32
-#define CMD_LOG_LIST_RESP     0x75   ///< Response with Log File List
+#define CMD_LOG_LIST_RESP     0x75   ///< One page of the log list
 #define CMD_LOG_DATA_CHUNK    0x76   ///< Stream Log Data Chunk
 #define CMD_LOG_DELETE_RESP   0x77   ///< Response for Delete Request
 #define CMD_GET_FULL_CONFIG   0x78   ///< Request Full Config Dump (Section 2)
 #define CMD_GET_DEBUG_DUMP    0x79   ///< Request Debug Values Dump (Section 3)
 #define CMD_LOG_MANAGER_RESP  0x7A   ///< Response for Log Manager Op
+#define CMD_LOG_SEARCH_RESP   0x7F   ///< Matching records of a search, then its end
+#define CMD_LOG_LEVEL_LIST    0x88   ///< The F4's level table (log_levels.h)
+
+// Log search. The F4 answers CMD_LOG_SEARCH with pages [Id:1][Count:1] then
+// Count x [Offset:4][Record], each record as stored (log_record.h), its
+// payload cut if it does not fit a frame on its own. A page with Count 0
+// ends the search: [Id:1][0][Status:1][Matches:4][Read:4][Size:4], Read
+// being the bytes of log and index it took from the card.
+#define LOG_SEARCH_OK       0
+#define LOG_SEARCH_NO_FILE  1        ///< Missing, or not a binary log
+#define LOG_SEARCH_LIMIT    2        ///< Stopped at Max matches
+#define LOG_SEARCH_TEXT_MAX 63
+
+// --- Telemetry Recorder Commands (telem_block.h) ---
+// ESP32 -> F4
+#define CMD_TIME_SYNC         0x26   ///< Wall clock [Epoch:4], UTC seconds; nothing is recorded before it
+#define CMD_TELEM_QUERY       0x27   ///< [Id:1][Dev:1][Field:1][From:4][To:4][Points:2]
+// F4 -> ESP32
+#define CMD_TELEM_DATA        0x28   ///< [Id:1][Total:2][First:2][Count:1] then Count x [Min:4][Max:4]
+
+// A query asks for min/max of one field in Points equal buckets of [From, To);
+// the F4 answers in pages of TELEM_DATA_POINTS buckets, First counting from 0.
+// An empty bucket has min > max. Total 0: no such device or field.
+#define TELEM_DATA_POINTS 30
+
+// --- Link Management Commands (both directions) ---
+#define CMD_LINK_PING         0x80   ///< Echo request [Seq:2][Time:4][Pad...]
+#define CMD_LINK_PONG         0x81   ///< Echo reply, payload copied from the ping
+#define CMD_LINK_BAUD_REQ     0x82   ///< ESP32 -> F4: switch to baud [Baud:4][Flag:1]
+#define CMD_LINK_BAUD_ACK     0x83   ///< F4 -> ESP32: reply to REQ / COMMIT [Baud:4][Flag:1]
+#define CMD_LINK_BAUD_COMMIT  0x84   ///< ESP32 -> F4: keep the new baud [Baud:4][Flag:1]
+
+// CMD_LINK_BAUD_ACK flags
+#define LINK_BAUD_REJECTED  0
+#define LINK_BAUD_ACCEPTED  1
+#define LINK_BAUD_COMMITTED 2
+#define LINK_BAUD_FLAG_COBS 0x80   ///< OR'ed into any flag: use COBS framing at the new baud
+
+// Wire framing, chosen per baud step by the negotiator. The base rate is always legacy.
+#define LINK_FRAMING_LEGACY 0      ///< [0xAA][CMD][LEN][PAYLOAD][CRC8]
+#define LINK_FRAMING_COBS   1      ///< 0x00 COBS([CMD][LEN][PAYLOAD][CRC16]) 0x00
+#define COBS_FRAME_MAX (MAX_PAYLOAD_LEN + 8)   ///< Encoded size of the largest frame incl. delimiters
 
 // --- F4 -> ESP32 Command IDs ---
 #define CMD_REQUEST_STATUS_UPDATE 0x10 ///< Request immediate update (Generic)
@@ -319,8 +418,23 @@ typedef struct {
 // OTA Payload Structures
 typedef struct {
     uint32_t total_size;
+    uint8_t window;          ///< Chunks in flight requested, 0 = stop-and-wait
+    uint8_t flags;           ///< OTA_FLAG_*
+    uint8_t reserved[2];
+    uint32_t file_crc;       ///< ota_crc32 of the whole file, names it for a resume
 } OtaStartMsg;
 
+typedef struct {
+    uint32_t total_size;
+    uint32_t file_crc;
+    uint32_t offset;
+} OtaProgressMsg;
+
+typedef struct {
+    uint16_t next_seq;
+    uint16_t sack;
+} OtaWackMsg;
+
 typedef struct {
     uint32_t offset;
     // Data follows
@@ -329,15 +443,15 @@ typedef struct {
 // --- Log Payloads ---
 
 typedef struct {
-    uint8_t count;
-} LogListRespEntry;
+    uint16_t cursor;
+} LogListReqMsg;
 
 typedef struct {
     uint16_t total_files;
-    uint16_t index;
-    uint32_t size;
-    char name[32];
-} LogListEntryMsg;
+    uint16_t cursor;         ///< List index of the first entry
+    uint8_t count;
+    // count x [Size:4][NameLen:1][Name] follow
+} LogListPageHeader;
 
 typedef struct {
     char name[32];
@@ -372,6 +486,70 @@ typedef struct {
     uint32_t offset;
 } LogResendReqMsg;
 
+typedef struct {
+    uint32_t offset;  // Everything before it received
+    uint8_t credits;  // Chunks the receiver has room for past offset
+} LogCreditMsg;
+
+typedef struct {
+    uint8_t id;             // Echoed in the answer
+    uint8_t levels;         // Bit per level, 0 all
+    uint32_t tick_from;     // Record ticks, both ends included
+    uint32_t tick_to;
+    uint16_t max;           // Matches to send at most
+    uint8_t nfmts;          // FmtIds, any may match; none: all
+    uint32_t fmt[4];
+    char name[32];
+    char text[LOG_SEARCH_TEXT_MAX + 1]; // Words that must all be in the record
+} LogSearchMsg;
+
+typedef struct {
+    uint8_t id;
+    uint8_t count;
+    // count x [Offset:4][Record] follow
+} LogSearchPageHeader;
+
+typedef struct {
+    uint8_t id;
+    uint8_t count;          // 0
+    uint8_t status;         // LOG_SEARCH_*
+    uint32_t matches;
+    uint32_t read;
+    uint32_t size;
+} LogSearchEndMsg;
+
+typedef struct {
+    uint32_t epoch;
+} TimeSyncMsg;
+
+typedef struct {
+    uint8_t id;       // Echoed in the answer
+    uint8_t dev;      // DEV_TYPE_*
+    uint8_t field;    // Column in telem_fields()
+    uint32_t from;
+    uint32_t to;
+    uint16_t points;
+} TelemQueryMsg;
+
+typedef struct {
+    uint8_t id;
+    uint16_t total;
+    uint16_t first;
+    uint8_t count;
+    // count x [Min:4][Max:4] follow
+} TelemDataHeader;
+
+typedef struct {
+    uint16_t seq;
+    uint32_t timestamp_us; // Sender clock, echoed back unchanged
+    // Padding follows
+} LinkPingHeader;
+
+typedef struct {
+    uint32_t baud;
+    uint8_t flag;
+} LinkBaudMsg;
+
 #pragma pack(pop)
 
 // --- API Functions (Serialization/Deserialization) ---
@@ -415,15 +593,27 @@ int unpack_connect_device_message(const uint8_t *buffer, uint8_t *device_type);
 int pack_forget_device_message(uint8_t *buffer, uint8_t device_type);
 int unpack_forget_device_message(const uint8_t *buffer, uint8_t *device_type);
 
-int pack_ota_start_message(uint8_t *buffer, uint32_t total_size);
-int pack_ota_chunk_message(uint8_t *buffer, uint32_t offset, const uint8_t *data, uint8_t len);
+int pack_ota_start_message(uint8_t *buffer, uint32_t total_size, uint8_t window, uint8_t flags, uint32_t file_crc);
+int pack_ota_query_message(uint8_t *buffer);
+int unpack_ota_progress_message(const uint8_t *buffer, uint32_t *total_size, uint32_t *file_crc, uint32_t *offset);
+int pack_ota_chunk_message(uint8_t *buffer, uint32_t offset, const uint8_t *data, uint8_t len, bool chunk_crc);
+int pack_ota_wchunk_message(uint8_t *buffer, uint16_t seq, const uint8_t *data, uint8_t len, bool chunk_crc);
+int pack_ota_wack_message(uint8_t *buffer, uint16_t next_seq, uint16_t sack);
+int unpack_ota_wack_message(const uint8_t *buffer, uint16_t *next_seq, uint16_t *sack);
 int pack_ota_end_message(uint8_t *buffer, uint32_t crc32);
 int pack_ota_apply_message(uint8_t *buffer);
 
 // Log API
-int pack_log_list_req_message(uint8_t *buffer);
-int pack_log_list_resp_message(uint8_t *buffer, uint16_t total, uint16_t index, uint32_t size, const char* name);
-int unpack_log_list_resp_message(const uint8_t *buffer, uint16_t *total, uint16_t *index, uint32_t *size, char* name);
+int pack_log_list_req_message(uint8_t *buffer, uint16_t cursor);
+int unpack_log_list_req_message(const uint8_t *buffer, uint16_t *cursor);
+// Page built in place: begin, add entries until one does not fit, end (returns the frame length)
+void pack_log_list_resp_begin(uint8_t *buffer, uint16_t total, uint16_t cursor);
+bool pack_log_list_resp_add(uint8_t *buffer, uint32_t size, const char* name);
+int pack_log_list_resp_end(uint8_t *buffer);
+// Checks the page; entries are then read with unpack_log_list_resp_entry from
+// position 0 until it returns -1. name holds LOG_LIST_NAME_MAX + 1 bytes.
+int unpack_log_list_resp_message(const uint8_t *buffer, uint16_t *total, uint16_t *cursor, uint8_t *count);
+int unpack_log_list_resp_entry(const uint8_t *buffer, int pos, uint32_t *size, char* name);
 
 int pack_log_download_req_message(uint8_t *buffer, const char* name);
 int unpack_log_download_req_message(const uint8_t *buffer, char* name);
@@ -435,7 +625,26 @@ int pack_log_delete_req_message(uint8_t *buffer, const char* name);
 int unpack_log_delete_req_message(const uint8_t *buffer, char* name);
 
 int pack_esp_log_message(uint8_t *buffer, uint8_t level, const char* tag, const char* msg);
+int pack_esp_log_rec_message(uint8_t *buffer, uint8_t level, uint32_t fmt_id, uint16_t tag_id, const uint8_t* args, uint8_t args_len);
+// Returns the length of the args at *args, or < 0
+int unpack_esp_log_rec_message(const uint8_t *buffer, uint8_t *level, uint32_t *fmt_id, uint16_t *tag_id, const uint8_t **args);
+void pack_esp_log_batch_begin(uint8_t *buffer, LogBatchCursor *c);
+// false if the line does not fit what is left of the frame; a payload
+// too short for its level and source is left out
+bool pack_esp_log_batch_add(uint8_t *buffer, LogBatchCursor *c, uint8_t cmd, const uint8_t *payload, uint8_t len);
+int pack_esp_log_batch_end(uint8_t *buffer);
+// Checks the batch; lines are then read with unpack_esp_log_batch_line from
+// a zeroed cursor until it returns -1, each into payload (MAX_PAYLOAD_LEN)
+// as its own frame would have carried it
+int unpack_esp_log_batch_message(const uint8_t *buffer, uint8_t *count);
+int unpack_esp_log_batch_line(const uint8_t *buffer, LogBatchCursor *c, uint8_t *cmd, uint8_t *payload, uint8_t *len);
 // unpack manual
+int pack_log_level_set_message(uint8_t *buffer, uint8_t level, const char *tag);
+// `tag` takes tag_size bytes with the terminator; -2 if the tag is longer
+int unpack_log_level_set_message(const uint8_t *buffer, uint8_t *level, char *tag, int tag_size);
+int pack_log_level_list_message(uint8_t *buffer, const uint8_t *table, uint8_t len);
+// Returns the length of the packed table at *table, or < 0
+int unpack_log_level_list_message(const uint8_t *buffer, const uint8_t **table);
 
 int pack_simple_cmd_message(uint8_t *buffer, uint8_t cmd); // For GET_FULL_CONFIG, GET_DEBUG_DUMP, LOG_OP_RESP
 int pack_log_manager_op_message(uint8_t *buffer, uint8_t op);
@@ -443,9 +652,46 @@ int unpack_log_manager_op_message(const uint8_t *buffer, uint8_t *op);
 
 int pack_log_resend_req_message(uint8_t *buffer, uint32_t offset);
 int unpack_log_resend_req_message(const uint8_t *buffer, uint32_t *offset);
+int pack_log_credit_message(uint8_t *buffer, uint32_t offset, uint8_t credits);
+int unpack_log_credit_message(const uint8_t *buffer, uint32_t *offset, uint8_t *credits);
+
+int pack_log_search_message(uint8_t *buffer, const LogSearchMsg *msg);
+int unpack_log_search_message(const uint8_t *buffer, LogSearchMsg *msg);
+// Page built in place like the log list page; add returns false when the record does not fit
+void pack_log_search_resp_begin(uint8_t *buffer, uint8_t id);
+bool pack_log_search_resp_add(uint8_t *buffer, uint32_t offset, const uint8_t *rec, int len);
+int pack_log_search_resp_end(uint8_t *buffer);
+int pack_log_search_end_message(uint8_t *buffer, const LogSearchEndMsg *msg);
+// Checks the frame; a page (count > 0) is then read with unpack_log_search_resp_entry
+// from position 0 until it returns -1, an end (count 0) with unpack_log_search_end_message
+int unpack_log_search_resp_message(const uint8_t *buffer, uint8_t *id, uint8_t *count);
+int unpack_log_search_resp_entry(const uint8_t *buffer, int pos, uint32_t *offset, const uint8_t **rec, int *len);
+int unpack_log_search_end_message(const uint8_t *buffer, LogSearchEndMsg *msg);
+
+// Telemetry recorder
+int pack_time_sync_message(uint8_t *buffer, uint32_t epoch);
+int unpack_time_sync_message(const uint8_t *buffer, uint32_t *epoch);
+int pack_telem_query_message(uint8_t *buffer, const TelemQueryMsg *q);
+int unpack_telem_query_message(const uint8_t *buffer, TelemQueryMsg *q);
+int pack_telem_data_message(uint8_t *buffer, uint8_t id, uint16_t total, uint16_t first,
+                            const int32_t *min, const int32_t *max, uint8_t count);
+int unpack_telem_data_message(const uint8_t *buffer, TelemDataHeader *hdr, int32_t *min, int32_t *max);
+
+// Link API
+int pack_link_ping_message(uint8_t *buffer, uint8_t cmd, uint16_t seq, uint32_t timestamp_us, uint8_t pad_len);
+int unpack_link_ping_message(const uint8_t *buffer, uint16_t *seq, uint32_t *timestamp_us); // Returns pad length
+int pack_link_baud_message(uint8_t *buffer, uint8_t cmd, uint32_t baud, uint8_t flag);
+int unpack_link_baud_message(const uint8_t *buffer, uint32_t *baud, uint8_t *flag);
+
+// COBS framing
+uint16_t calculate_crc16(const uint8_t *data, uint16_t len);
+int cobs_encode(const uint8_t *in, int len, uint8_t *out);
+int cobs_decode(const uint8_t *in, int len, uint8_t *out); // Returns -1 on malformed input
+int pack_cobs_frame(uint8_t *out, const uint8_t *frame, int len); // Legacy frame -> encoded incl. delimiters
+int unpack_cobs_frame(const uint8_t *encoded, int len, uint8_t *frame); // Without delimiters; returns legacy frame length
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // ECOFLOW_PROTOCOL_H
\ No newline at end of file
+#endif // ECOFLOW_PROTOCOL_H
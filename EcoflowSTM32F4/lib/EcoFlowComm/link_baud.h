@@ -0,0 +1,201 @@
+#ifndef LINK_BAUD_H
+#define LINK_BAUD_H
+
+/**
+ * @file link_baud.h
+ * @author Lollokara
+ * @brief Link self-test (ping/echo) and baud-rate negotiation.
+ *
+ * The ESP32 is the master: it asks the STM32 to move one step up the baud
+ * ladder, both sides switch, and the master probes the new rate with a burst
+ * of padded pings. The rate is only kept (COMMIT) if every ping came back
+ * and no CRC/line error was seen; otherwise both sides fall back to the last
+ * committed rate and the failed step becomes the ceiling.
+ *
+ * Safety nets, so the two ends can never stay on different rates:
+ * - The slave reverts if no COMMIT arrives within the probation window.
+ * - Either side drops to LINK_BAUD_BASE after LINK_BAUD_SILENCE_US without a
+ *   valid frame (covers a reboot of the peer). The master sends keepalive
+ *   pings while above the base rate.
+ * - The master steps down when line errors keep occurring at a raised rate.
+ * - A side whose receiver cannot keep up above some rate caps the ladder
+ *   there (link_baud_set_max); a slave rejects REQs above its cap, which
+ *   becomes the master's ceiling too.
+ *
+ * Each step above the base rate also selects the wire framing: the REQ
+ * carries LINK_BAUD_FLAG_COBS when the master wants COBS, and the slave
+ * echoes it in the ACK if it agrees. The base rate always uses legacy
+ * framing, so every fallback path also falls back to legacy.
+ *
+ * Pure state machine: the caller feeds validated frames, errors and time,
+ * and provides callbacks to send a frame and to reprogram the UART. No RTOS
+ * or HAL dependency, so it can run against a simulated link on a host.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ecoflow_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LINK_BAUD_BASE 460800                                   ///< Power-on rate of both sides
+#define LINK_BAUD_LADDER { 460800, 921600, 1500000, 2000000 }
+#define LINK_BAUD_STEPS 4
+
+// Timing (microseconds)
+#define LINK_BAUD_ACK_TIMEOUT_US    500000
+#define LINK_BAUD_SETTLE_US         20000    ///< Pause after switching before probing
+#define LINK_BAUD_PROBATION_US      1500000  ///< Slave reverts without COMMIT
+#define LINK_BAUD_COMMIT_RETRY_US   100000
+#define LINK_BAUD_SILENCE_US        3000000  ///< No valid frame -> back to base
+#define LINK_BAUD_KEEPALIVE_US      1000000
+#define LINK_PING_TIMEOUT_US        200000
+
+// Probe used to qualify a new rate
+#define LINK_BAUD_PROBE_PINGS  32
+#define LINK_BAUD_PROBE_PAD    200
+#define LINK_BAUD_PROBE_WINDOW 4              ///< Pings in flight
+
+// Runtime fallback: this many errors inside the window triggers a step down
+#define LINK_BAUD_ERR_LIMIT     3
+#define LINK_BAUD_ERR_WINDOW_US 10000000
+
+typedef enum {
+    LINK_ROLE_MASTER = 0,
+    LINK_ROLE_SLAVE
+} LinkRole;
+
+typedef enum {
+    LB_IDLE = 0,
+    LB_WAIT_ACK,     ///< Master: REQ sent
+    LB_SETTLE,       ///< Master: switched, waiting before the probe
+    LB_PROBE,        ///< Master: qualifying the candidate rate
+    LB_COMMIT,       ///< Master: COMMIT sent, waiting for confirmation
+    LB_HOLDOFF,      ///< Master: reverted, waiting out the slave probation
+    LB_PROBATION,    ///< Slave: switched, waiting for COMMIT
+    LB_SELFTEST      ///< Master: ping test at the current rate
+} LinkBaudState;
+
+/**
+ * @brief Platform hooks. set_baud must let frames already handed to send()
+ * finish at the old rate and framing before reprogramming the UART and
+ * switching the RX parser and TX encoder to the new framing.
+ */
+typedef struct {
+    void (*send)(void *user, const uint8_t *frame, int len);
+    void (*set_baud)(void *user, uint32_t baud, uint8_t framing);
+    void *user;
+} LinkBaudOps;
+
+/**
+ * @brief Result of a ping run. Throughput = 2 * bytes / (end_us - start_us).
+ */
+typedef struct {
+    uint32_t baud;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t lost;
+    uint32_t errors;        ///< CRC / line errors seen during the run
+    uint32_t rtt_min_us;
+    uint32_t rtt_max_us;
+    uint32_t rtt_sum_us;
+    uint32_t bytes;         ///< Frame bytes echoed back (one direction)
+    uint32_t start_us;
+    uint32_t end_us;
+} LinkProbeStats;
+
+typedef struct {
+    LinkRole role;
+    LinkBaudState state;
+    LinkBaudOps ops;
+
+    uint32_t cur_baud;
+    uint32_t committed_baud;
+    uint32_t target_baud;
+    uint8_t cur_framing;       ///< LINK_FRAMING_*
+    uint8_t committed_framing;
+    uint8_t target_framing;
+    uint8_t framing_pref;      ///< Framing to use above the base rate (COBS by default)
+    int8_t ceiling;            ///< Highest ladder index that may be tried
+    bool auto_step;            ///< Master: keep stepping up after a commit
+
+    uint32_t state_since_us;
+    uint32_t last_rx_us;
+    uint32_t last_keepalive_us;
+    uint32_t last_commit_tx_us;
+    uint8_t commit_tries;
+
+    uint32_t err_window_us;
+    uint8_t err_count;
+
+    // Ping run
+    uint16_t next_seq;
+    uint16_t probe_first_seq;
+    uint16_t probe_count;
+    uint8_t probe_pad;
+    uint8_t probe_window;
+    uint16_t in_flight;
+    uint32_t last_progress_us;
+    LinkProbeStats probe;
+    LinkProbeStats last_result;
+} LinkBaudCtx;
+
+void link_baud_init(LinkBaudCtx *ctx, LinkRole role, const LinkBaudOps *ops, uint32_t now_us);
+
+/**
+ * @brief Returns to LINK_BAUD_BASE without talking to the peer (e.g. after
+ * the peer was reset). Does not call set_baud: the UART must already be at
+ * the base rate. The ceiling learned so far is kept.
+ */
+void link_baud_reset(LinkBaudCtx *ctx, uint32_t now_us);
+
+/**
+ * @brief Master: tries the next ladder step, and the following ones if it
+ * succeeds. @return false if busy or already at the ceiling.
+ */
+bool link_baud_negotiate(LinkBaudCtx *ctx, uint32_t now_us);
+
+/**
+ * @brief Master: measures RTT, loss and throughput at the current rate.
+ * Results are available from link_baud_last_result() once idle again.
+ */
+bool link_baud_selftest(LinkBaudCtx *ctx, uint16_t count, uint8_t pad, uint32_t now_us);
+
+/**
+ * @brief Feeds a CRC-valid frame. Every frame counts as link activity.
+ * @return true if the frame was a link command and has been consumed.
+ */
+bool link_baud_on_frame(LinkBaudCtx *ctx, const uint8_t *frame, uint32_t now_us);
+
+/**
+ * @brief Reports a CRC mismatch or UART line error.
+ */
+void link_baud_on_error(LinkBaudCtx *ctx, uint32_t now_us);
+
+void link_baud_tick(LinkBaudCtx *ctx, uint32_t now_us);
+
+uint32_t link_baud_current(const LinkBaudCtx *ctx);
+uint8_t link_baud_framing(const LinkBaudCtx *ctx);
+
+/**
+ * @brief Framing requested (master) or accepted (slave) on the next step.
+ * LINK_FRAMING_LEGACY keeps the original framing at every rate.
+ */
+void link_baud_set_framing_pref(LinkBaudCtx *ctx, uint8_t framing);
+
+/**
+ * @brief Caps the ladder at the highest step not above baud. Call after init.
+ */
+void link_baud_set_max(LinkBaudCtx *ctx, uint32_t baud);
+bool link_baud_busy(const LinkBaudCtx *ctx);
+const LinkProbeStats *link_baud_last_result(const LinkBaudCtx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LINK_BAUD_H
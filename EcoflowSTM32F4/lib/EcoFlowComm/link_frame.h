@@ -0,0 +1,68 @@
+#ifndef LINK_FRAME_H
+#define LINK_FRAME_H
+
+/**
+ * @file link_frame.h
+ * @author Lollokara
+ * @brief Incremental receive parser for inter-MCU UART frames.
+ *
+ * Feed received bytes one at a time; the parser reports each complete frame
+ * or CRC mismatch. Shared by Stm32Serial, the STM32 UART task and the host
+ * link simulator so all of them frame bytes identically.
+ *
+ * Legacy framing resynchronises on START_BYTE and collects
+ * [START][CMD][LEN][PAYLOAD][CRC8]. COBS framing collects bytes up to the
+ * 0x00 delimiter, so a corrupted length can never swallow the following
+ * frames. Either way the frame handed out is in legacy layout.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ecoflow_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LINK_FRAME_MAX (MAX_PAYLOAD_LEN + 4)  ///< [START][CMD][LEN][PAYLOAD][CRC8]
+
+typedef enum {
+    LINK_PARSE_NONE = 0,    ///< Need more bytes
+    LINK_PARSE_FRAME,       ///< A CRC-valid frame is ready
+    LINK_PARSE_CRC_ERROR    ///< A frame was discarded
+} LinkParseResult;
+
+typedef struct {
+    uint8_t buf[LINK_FRAME_MAX];
+    uint16_t idx;
+    uint16_t frame_len;     ///< Length of the last complete frame
+    uint8_t expected;       ///< Payload length from the header
+    uint8_t framing;        ///< LINK_FRAMING_*
+    bool overflow;          ///< COBS: frame too long, skip to the delimiter
+    uint8_t raw[COBS_FRAME_MAX];
+} LinkFrameParser;
+
+/**
+ * @brief Resets the parser to legacy framing.
+ */
+void link_parser_init(LinkFrameParser *p);
+
+/**
+ * @brief Switches framing and drops any partial frame.
+ */
+void link_parser_set_framing(LinkFrameParser *p, uint8_t framing);
+
+/**
+ * @brief Consumes one byte.
+ * On LINK_PARSE_FRAME the frame is in p->buf (p->frame_len bytes) until the
+ * next call.
+ */
+LinkParseResult link_parser_feed(LinkFrameParser *p, uint8_t b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LINK_FRAME_H
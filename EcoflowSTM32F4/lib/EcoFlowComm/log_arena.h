@@ -0,0 +1,117 @@
+#ifndef LOG_ARENA_H
+#define LOG_ARENA_H
+
+/**
+ * @file log_arena.h
+ * @author Lollokara
+ * @brief The ESP32's in-RAM log: a fixed byte arena of variable length
+ * records that any task can write without a lock, read by the web log.
+ *
+ * A record is
+ *
+ *   [Commit:4][Ms:4][Info:4][Sum:4][Tag][Message]
+ *
+ * padded to 4 bytes, where Info is Size:16 | Level:8 | TagLen:8, Sum an
+ * FNV-1a hash of Ms, Info, Tag and Message, and Commit the record's Seq,
+ * ~Seq while it is being written. A deferred record (Level has
+ * LOG_ARENA_DEFERRED set) holds a format string pointer and the call's
+ * arguments packed as in log_record.h instead of the message; it is
+ * formatted when it is read, so a call nobody reads never formats.
+ *
+ * A writer takes the next Seq, then reserves its bytes by advancing the
+ * arena's head (a running byte count) with a compare-and-swap; a record
+ * that would cross the end of the arena starts over at its beginning. It
+ * publishes Seq and the record's position in slot Seq % LOG_ARENA_SLOTS,
+ * writes the record and stores Commit last. Writers only contend on the
+ * two counters, so a task preempted mid-record holds up no other.
+ *
+ * New records overwrite the oldest. A reader follows Seq through the slots
+ * and copies a record out only once it is committed; it stops at the first
+ * record still being written so it never skips one that is about to
+ * appear. Bytes at head position p are overwritten once the head passes
+ * p + LOG_ARENA_SIZE, so a copy made before the head got there is whole and
+ * a later one is dropped: a reader never sees a torn record, but one that
+ * falls a whole arena behind misses the records written over.
+ *
+ * A writer preempted for so long that the head laps its record writes
+ * over newer ones when it resumes. It checks the head before it writes and
+ * again before it commits, so such a record is never published, and the
+ * records it wrote over fail their Sum when read and are dropped.
+ *
+ * No RTOS or HAL dependency (GCC __atomic builtins), so it runs on a host.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_ARENA_SIZE     16384  ///< Arena bytes, a power of two
+#define LOG_ARENA_SLOTS    256    ///< Records a reader can find, a power of two
+#define LOG_ARENA_TAG_MAX  23     ///< Longer tags are cut
+#define LOG_ARENA_MSG_MAX  160    ///< Longer messages are cut, and deferred records' arguments
+#define LOG_ARENA_DEFERRED 0x80   ///< Level flag of a deferred record
+
+typedef struct {
+    uint32_t seq;   ///< Stored last
+    uint32_t pos;   ///< Head position of the record
+} LogArenaSlot;
+
+typedef struct {
+    uint32_t buf[LOG_ARENA_SIZE / 4];
+    LogArenaSlot slot[LOG_ARENA_SLOTS];  ///< Record Seq is in slot Seq % LOG_ARENA_SLOTS
+    uint32_t head;                       ///< Bytes reserved
+    uint32_t next_seq;
+    uint32_t floor;                      ///< Records before this Seq were cleared
+} LogArena;
+
+/** One record as copied out. */
+typedef struct {
+    uint32_t seq;
+    uint32_t ms;
+    uint8_t level;
+    char tag[LOG_ARENA_TAG_MAX + 1];
+    char msg[LOG_ARENA_MSG_MAX + 1];
+} LogArenaRec;
+
+void log_arena_init(LogArena *a);
+
+/**
+ * @brief Appends one record; safe from any number of tasks at once. A
+ * trailing newline of `msg` is dropped.
+ * @return Its Seq.
+ */
+uint32_t log_arena_write(LogArena *a, uint32_t ms, uint8_t level, const char *tag, const char *msg);
+
+/**
+ * @brief Appends a deferred record: `fmt` must outlive the arena (a string
+ * literal) and `args` are packed with log_arg_put_*(). Arguments past
+ * LOG_ARENA_MSG_MAX bytes are cut and read as missing.
+ * @return Its Seq.
+ */
+uint32_t log_arena_write_args(LogArena *a, uint32_t ms, uint8_t level, const char *tag,
+                              const char *fmt, const uint8_t *args, int len);
+
+/**
+ * @brief Copies out up to `max` records with Seq >= *from, oldest first,
+ * and moves *from past them, formatting deferred ones. Records overwritten
+ * before they could be read are skipped.
+ * @return Records copied.
+ */
+int log_arena_read(const LogArena *a, uint32_t *from, LogArenaRec *out, int max);
+
+/** Records a reader starting now could still get. */
+uint32_t log_arena_count(const LogArena *a);
+
+/** Hides everything written so far from readers. */
+void log_arena_clear(LogArena *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_ARENA_H
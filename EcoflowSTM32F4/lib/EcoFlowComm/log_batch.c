@@ -0,0 +1,120 @@
+#include "log_batch.h"
+#include "ecoflow_protocol.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_BATCH_TOKEN   1000   // One line, in bucket units
+#define LOG_BATCH_NOTE_MS 1000   // "lines dropped" at most this often
+#define LOG_BATCH_WARN    2      // ESP_LOG_WARN
+
+static uint32_t waiting(const LogBatch *b) {
+    return b->head - b->tail;
+}
+
+static void ring_put(LogBatch *b, const uint8_t *data, uint32_t len) {
+    for (uint32_t done = 0; done < len; ) {
+        uint32_t at = b->head & (LOG_BATCH_RING - 1);
+        uint32_t span = LOG_BATCH_RING - at;
+        if (span > len - done) span = len - done;
+        memcpy(&b->ring[at], data + done, span);
+        b->head += span;
+        done += span;
+    }
+}
+
+static void ring_peek(const LogBatch *b, uint32_t pos, uint8_t *out, uint32_t len) {
+    for (uint32_t done = 0; done < len; ) {
+        uint32_t at = (pos + done) & (LOG_BATCH_RING - 1);
+        uint32_t span = LOG_BATCH_RING - at;
+        if (span > len - done) span = len - done;
+        memcpy(out + done, &b->ring[at], span);
+        done += span;
+    }
+}
+
+static void refill(LogBatch *b, uint32_t now_ms) {
+    uint32_t elapsed = now_ms - b->refill_ms;
+    b->refill_ms = now_ms;
+    if (b->rate == 0) return;
+
+    // ms * lines/s is thousandths of a line; no more than fills the bucket
+    uint32_t cap = b->burst * LOG_BATCH_TOKEN;
+    uint32_t fill_ms = cap / b->rate + 1;
+    if (elapsed > fill_ms) elapsed = fill_ms;
+    uint32_t add = elapsed * b->rate;
+    b->tokens = (cap - b->tokens < add) ? cap : b->tokens + add;
+}
+
+static bool put_line(LogBatch *b, uint8_t cmd, const uint8_t *payload, uint8_t len, uint32_t now_ms) {
+    if (len > LOG_BATCH_LINE_MAX) len = LOG_BATCH_LINE_MAX;
+    if (LOG_BATCH_RING - waiting(b) < 2u + len) return false;
+
+    if (waiting(b) == 0) b->first_ms = now_ms;
+    uint8_t hdr[2] = { cmd, len };
+    ring_put(b, hdr, 2);
+    ring_put(b, payload, len);
+    return true;
+}
+
+// Reports the lines dropped so far, once a second while they are. Takes no
+// token: it says what the limit cost, not more of what it held back.
+static void note_dropped(LogBatch *b, uint32_t now_ms) {
+    if (b->dropped == 0 || now_ms - b->note_ms < LOG_BATCH_NOTE_MS) return;
+
+    uint8_t frame[MAX_PAYLOAD_LEN + 4];
+    char msg[32];
+    snprintf(msg, sizeof(msg), "%lu lines dropped", (unsigned long)b->dropped);
+    int len = pack_esp_log_message(frame, LOG_BATCH_WARN, "LOG", msg);
+    if (len > 0 && put_line(b, frame[1], &frame[3], frame[2], now_ms)) {
+        b->dropped = 0;
+    }
+}
+
+void log_batch_init(LogBatch *b, uint32_t rate, uint32_t burst, uint32_t now_ms) {
+    memset(b, 0, sizeof(*b));
+    if (burst < 1) burst = 1;
+    b->rate = rate;
+    b->burst = burst;
+    b->tokens = burst * LOG_BATCH_TOKEN;
+    b->refill_ms = now_ms;
+}
+
+bool log_batch_add(LogBatch *b, const uint8_t *frame, int len, uint32_t now_ms) {
+    if (len < 4 || frame[2] + 4 > len) return false;
+
+    refill(b, now_ms);
+    note_dropped(b, now_ms);
+    bool limited = b->rate != 0 && b->tokens < LOG_BATCH_TOKEN;
+    if (limited || !put_line(b, frame[1], &frame[3], frame[2], now_ms)) {
+        // The first of a run is reported a second on, with the rest
+        if (b->dropped++ == 0) b->note_ms = now_ms;
+        b->stats.dropped++;
+        return false;
+    }
+    if (b->rate != 0) b->tokens -= LOG_BATCH_TOKEN;
+    b->stats.lines++;
+    return true;
+}
+
+int log_batch_take(LogBatch *b, uint32_t now_ms, bool flush, uint8_t *out) {
+    note_dropped(b, now_ms);
+    uint32_t n = waiting(b);
+    if (n == 0) return 0;
+    if (!flush && n < LOG_BATCH_FULL && now_ms - b->first_ms < LOG_BATCH_MS) return 0;
+
+    // Lines left over keep the oldest's time: they are no older, so they
+    // only go sooner
+    LogBatchCursor c;
+    pack_esp_log_batch_begin(out, &c);
+    while (waiting(b) > 0) {
+        uint8_t hdr[2], payload[LOG_BATCH_LINE_MAX];
+        ring_peek(b, b->tail, hdr, 2);
+        ring_peek(b, b->tail + 2, payload, hdr[1]);
+        if (!pack_esp_log_batch_add(out, &c, hdr[0], payload, hdr[1])) break;
+        b->tail += 2u + hdr[1];
+    }
+    int len = pack_esp_log_batch_end(out);
+    b->stats.frames++;
+    b->stats.bytes += (uint32_t)len;
+    return len;
+}
@@ -0,0 +1,90 @@
+#ifndef LOG_BATCH_H
+#define LOG_BATCH_H
+
+/**
+ * @file log_batch.h
+ * @author Lollokara
+ * @brief The ESP32's log lines for the STM32, batched and rate limited.
+ *
+ * Lines come in as the frames they used to be sent as (CMD_ESP_LOG_DATA or
+ * CMD_ESP_LOG_REC) and wait in a byte ring as [Cmd:1][Len:1][Payload]. They
+ * leave as CMD_ESP_LOG_BATCH frames holding as many lines as fit: as soon
+ * as LOG_BATCH_FULL bytes wait, or once the oldest has waited
+ * LOG_BATCH_MS. A burst becomes a few full frames instead of a frame per
+ * line, each line's level in its 1-byte header and each tag or FmtId sent
+ * once a frame (ecoflow_protocol.h).
+ *
+ * A token bucket of `burst` lines, refilled at `rate` lines a second, limits
+ * what is accepted; a line over the limit, or with the ring full, is
+ * dropped and counted. A second after the first of them, and every second
+ * while lines are being dropped, a CMD_ESP_LOG_DATA line "N lines dropped"
+ * (tag LOG, warning) joins the queue, much as the STM32's own log notes an
+ * overflow of its ring.
+ *
+ * Not thread safe: the caller serializes calls. No RTOS or HAL dependency;
+ * the caller supplies the time in ms.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_BATCH_RING  1024   ///< Bytes of lines waiting, a power of two
+#define LOG_BATCH_FULL  192    ///< Waiting bytes that send a frame at once
+#define LOG_BATCH_MS    100    ///< Longest a line waits for others
+#define LOG_BATCH_RATE  200    ///< Default lines per second
+#define LOG_BATCH_BURST 400    ///< Default bucket, in lines
+
+typedef struct {
+    uint32_t lines;     ///< Lines accepted
+    uint32_t dropped;   ///< Lines refused, over the rate or with the ring full
+    uint32_t frames;    ///< Batch frames made
+    uint32_t bytes;     ///< Their bytes on the wire, before framing (COBS)
+} LogBatchStats;
+
+typedef struct {
+    uint8_t ring[LOG_BATCH_RING];
+    uint32_t head;        ///< Bytes put
+    uint32_t tail;        ///< Bytes taken
+    uint32_t first_ms;    ///< When the oldest waiting line came
+    uint32_t rate;        ///< Lines per second, 0 unlimited
+    uint32_t burst;       ///< Bucket size in lines
+    uint32_t tokens;      ///< In thousandths of a line
+    uint32_t refill_ms;
+    uint32_t dropped;     ///< Since the last "lines dropped" line
+    uint32_t note_ms;     ///< When the first of those was dropped
+    LogBatchStats stats;
+} LogBatch;
+
+/**
+ * @brief Empties the batch and fills its bucket.
+ * @param rate Lines per second, 0 for no limit.
+ * @param burst Lines let through at once, at least 1.
+ */
+void log_batch_init(LogBatch *b, uint32_t rate, uint32_t burst, uint32_t now_ms);
+
+/**
+ * @brief Queues a line.
+ * @param frame A packed CMD_ESP_LOG_DATA or CMD_ESP_LOG_REC frame.
+ * @return false if the line was dropped.
+ */
+bool log_batch_add(LogBatch *b, const uint8_t *frame, int len, uint32_t now_ms);
+
+/**
+ * @brief Makes the next batch frame, if one is due.
+ * @param flush Send what waits now, however little.
+ * @param out Buffer of at least MAX_PAYLOAD_LEN + 4 bytes.
+ * @return Frame length, 0 if nothing is due. Call until it returns 0.
+ */
+int log_batch_take(LogBatch *b, uint32_t now_ms, bool flush, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_BATCH_H
@@ -0,0 +1,225 @@
+#include "log_index.h"
+#include "log_record.h"
+#include "ota_crc.h"
+#include <string.h>
+#include <stddef.h>
+
+#define WORD_FMT_MARK 0xFF   // Starts the hash of a FmtId, a byte no word has
+
+typedef void (*WordFn)(void *ctx, const char *w, int len);
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static bool word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static bool word_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static uint32_t word_hash(const char *w, int len) {
+    uint32_t h = LOG_FNV_BASIS;
+    for (int i = 0; i < len; i++) h = (h ^ (uint8_t)lower(w[i])) * LOG_FNV_PRIME;
+    return h;
+}
+
+static uint32_t fmt_hash(uint32_t fmt) {
+    uint32_t h = (LOG_FNV_BASIS ^ WORD_FMT_MARK) * LOG_FNV_PRIME;
+    for (int i = 0; i < 4; i++) h = (h ^ (uint8_t)(fmt >> (8 * i))) * LOG_FNV_PRIME;
+    return h;
+}
+
+// LOG_IDX_BLOOM_K bits per word, by double hashing of its 32 bit hash
+static uint32_t bloom_bit(uint32_t h, int k) {
+    return (h + (uint32_t)k * ((h >> 16) | 1)) & (LOG_IDX_BLOOM * 8 - 1);
+}
+
+static void bloom_set(uint8_t *bloom, uint32_t h) {
+    for (int k = 0; k < LOG_IDX_BLOOM_K; k++) {
+        uint32_t bit = bloom_bit(h, k);
+        bloom[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    }
+}
+
+static bool bloom_has(const uint8_t *bloom, uint32_t h) {
+    for (int k = 0; k < LOG_IDX_BLOOM_K; k++) {
+        uint32_t bit = bloom_bit(h, k);
+        if (!(bloom[bit >> 3] & (1u << (bit & 7)))) return false;
+    }
+    return true;
+}
+
+// Words of `len` chars of text, each cut to LOG_IDX_WORD_MAX
+static void text_words(const char *s, int len, WordFn fn, void *ctx) {
+    int i = 0;
+    while (i < len) {
+        if (!word_char(s[i])) { i++; continue; }
+        int start = i;
+        while (i < len && word_char(s[i])) i++;
+        if (!word_start(s[start])) continue;
+        fn(ctx, &s[start], i - start > LOG_IDX_WORD_MAX ? LOG_IDX_WORD_MAX : i - start);
+    }
+}
+
+// Words a search can find in a record: tag and message of a text record, the
+// string arguments of an ESP32 one
+static void rec_words(const uint8_t *rec, int len, WordFn fn, void *ctx) {
+    uint32_t fmt;
+    memcpy(&fmt, &rec[8], 4);
+    const uint8_t *p = rec + LOG_REC_HDR;
+    const uint8_t *end = rec + len;
+    if (fmt == LOG_REC_TEXT) {
+        if (p >= end) return;
+        int tag_len = *p++;
+        if (tag_len > end - p) tag_len = (int)(end - p);
+        text_words((const char *)p, tag_len, fn, ctx);
+        p += tag_len;
+        text_words((const char *)p, (int)(end - p), fn, ctx);
+        return;
+    }
+    while (p < end) {
+        uint8_t type = *p++;
+        if (type == LOG_ARG_INT) {
+            while (p < end && (*p & 0x80)) p++;
+            p++;
+        } else if (type == LOG_ARG_FLOAT) {
+            p += 4;
+        } else if (type == LOG_ARG_STR && p < end) {
+            int n = *p++;
+            if (n > end - p) n = (int)(end - p);
+            text_words((const char *)p, n, fn, ctx);
+            p += n;
+        } else {
+            return;
+        }
+    }
+}
+
+void log_idx_init(LogIdxEntry *e, uint32_t first, uint8_t flags) {
+    memset(e, 0, sizeof(*e));
+    e->first = first;
+    e->tick_min = UINT32_MAX;
+    e->flags = flags;
+}
+
+static void add_word(void *ctx, const char *w, int len) {
+    bloom_set(((LogIdxEntry *)ctx)->words, word_hash(w, len));
+}
+
+void log_idx_add(LogIdxEntry *e, const uint8_t *rec, int len) {
+    uint32_t tick, fmt;
+    memcpy(&tick, &rec[3], 4);
+    memcpy(&fmt, &rec[8], 4);
+    uint8_t level = rec[7] < LOG_IDX_LEVELS ? rec[7] : LOG_IDX_LEVELS - 1;
+
+    if (tick < e->tick_min) e->tick_min = tick;
+    if (tick > e->tick_max) e->tick_max = tick;
+    if (e->levels[level] != UINT16_MAX) e->levels[level]++;
+    if (e->records != UINT16_MAX) e->records++;
+    if (fmt != LOG_REC_TEXT) bloom_set(e->words, fmt_hash(fmt));
+    rec_words(rec, len, add_word, e);
+}
+
+void log_idx_seal(LogIdxEntry *e) {
+    e->crc = ota_crc32(0, (const uint8_t *)e, offsetof(LogIdxEntry, crc));
+}
+
+bool log_idx_valid(const LogIdxEntry *e) {
+    return e->crc == ota_crc32(0, (const uint8_t *)e, offsetof(LogIdxEntry, crc));
+}
+
+void log_query_init(LogQuery *q, uint8_t levels, uint32_t tick_from, uint32_t tick_to,
+                    const char *text, const uint32_t *fmts, uint8_t nfmts) {
+    memset(q, 0, sizeof(*q));
+    q->levels = levels;
+    q->tick_from = tick_from;
+    q->tick_to = tick_to;
+    if (nfmts > LOG_IDX_FMTS_MAX) nfmts = LOG_IDX_FMTS_MAX;
+    for (uint8_t i = 0; i < nfmts; i++) q->fmt[i] = fmts[i];
+    q->fmts = nfmts;
+
+    int i = 0, len = text ? (int)strlen(text) : 0;
+    while (i < len && q->words < LOG_IDX_WORDS_MAX) {
+        if (!word_char(text[i])) { i++; continue; }
+        int start = i;
+        while (i < len && word_char(text[i])) i++;
+        if (!word_start(text[start])) continue;
+        int n = i - start > LOG_IDX_WORD_MAX ? LOG_IDX_WORD_MAX : i - start;
+        for (int k = 0; k < n; k++) q->word[q->words][k] = lower(text[start + k]);
+        q->word[q->words][n] = 0;
+        q->word_hash[q->words] = word_hash(&text[start], n);
+        q->words++;
+    }
+}
+
+bool log_idx_may_match(const LogIdxEntry *e, const LogQuery *q) {
+    if (e->flags & LOG_IDX_PARTIAL) return true;
+    if (e->records == 0) return false;
+    if (e->tick_max < q->tick_from || e->tick_min > q->tick_to) return false;
+    if (q->levels) {
+        bool any = false;
+        for (int l = 0; l < LOG_IDX_LEVELS; l++) {
+            if ((q->levels & (1u << l)) && e->levels[l]) any = true;
+        }
+        if (!any) return false;
+    }
+    for (uint8_t i = 0; i < q->words; i++) {
+        if (!bloom_has(e->words, q->word_hash[i])) return false;
+    }
+    if (q->fmts) {
+        bool any = false;
+        for (uint8_t i = 0; i < q->fmts; i++) {
+            if (bloom_has(e->words, fmt_hash(q->fmt[i]))) any = true;
+        }
+        if (!any) return false;
+    }
+    return true;
+}
+
+typedef struct {
+    const LogQuery *q;
+    uint8_t found;   // Bit per query word seen
+} MatchCtx;
+
+static void match_word(void *ctx, const char *w, int len) {
+    MatchCtx *m = (MatchCtx *)ctx;
+    for (uint8_t i = 0; i < m->q->words; i++) {
+        const char *qw = m->q->word[i];
+        int k = 0;
+        while (k < len && qw[k] && lower(w[k]) == qw[k]) k++;
+        if (k == len && !qw[k]) m->found |= (uint8_t)(1u << i);
+    }
+}
+
+bool log_rec_match(const uint8_t *rec, int len, const LogQuery *q) {
+    uint32_t tick, fmt;
+    memcpy(&tick, &rec[3], 4);
+    memcpy(&fmt, &rec[8], 4);
+    uint8_t level = rec[7] < LOG_IDX_LEVELS ? rec[7] : LOG_IDX_LEVELS - 1;
+
+    if (tick < q->tick_from || tick > q->tick_to) return false;
+    if (q->levels && !(q->levels & (1u << level))) return false;
+    if (q->fmts) {
+        bool any = false;
+        for (uint8_t i = 0; i < q->fmts; i++) {
+            if (q->fmt[i] == fmt) any = true;
+        }
+        if (!any) return false;
+    }
+    if (!q->words) return true;
+    MatchCtx m = {q, 0};
+    rec_words(rec, len, match_word, &m);
+    return m.found == (1u << q->words) - 1;
+}
+
+int log_rec_check(const uint8_t *rec, int avail) {
+    if (avail < 1) return 0;
+    if (rec[0] != LOG_REC_SYNC) return -1;
+    if (avail < LOG_REC_HDR) return 0;
+    uint16_t len = (uint16_t)(rec[1] | (rec[2] << 8));
+    if (len < LOG_REC_HDR - 3 || len + 3 > LOG_REC_MAX || rec[7] > 7) return -1;
+    return len + 3;
+}
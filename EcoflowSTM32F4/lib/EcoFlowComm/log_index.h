@@ -0,0 +1,110 @@
+#ifndef LOG_INDEX_H
+#define LOG_INDEX_H
+
+/**
+ * @file log_index.h
+ * @author Lollokara
+ * @brief Sidecar index of a binary log file (log_record.h), and the search
+ * that uses it.
+ *
+ * The STM32 cuts each log into segments of LOG_IDX_SEGMENT bytes; a record
+ * belongs to the segment its first byte falls in. For every segment, entry n
+ * of the sidecar (current.lix next to current.log, log_N.lix next to
+ * log_N.log) holds
+ *
+ *   [First:4][TickMin:4][TickMax:4][Levels:2 x 6][Flags:1][Reserved:1]
+ *   [Records:2][Words:256][CRC32:4]
+ *
+ * little endian. First is the file offset of the segment's first record,
+ * Levels counts its records per level (saturating), and Words is a Bloom
+ * filter of what a search can look for: the words of a text record's tag
+ * and message, the words of an ESP32 record's string arguments, and its
+ * FmtId. A word is a run of letters, digits and '_' starting with a letter,
+ * compared without case. The filter is sized for the few hundred distinct
+ * words a segment of device logs holds: about 4 % of the segments without a
+ * word let it through. The CRC (ota_crc32) covers the entry before it.
+ *
+ * A search takes the entries first and reads only the segments they do not
+ * rule out. An entry flagged LOG_IDX_PARTIAL (the writer lost track of the
+ * records, e.g. after a reset) rules out nothing; neither does a missing one.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_IDX_SEGMENT    16384     ///< Log bytes per entry, a multiple of the sector size
+#define LOG_IDX_LEVELS     6         ///< ESP_LOG_NONE .. ESP_LOG_VERBOSE
+#define LOG_IDX_BLOOM      256       ///< Bytes of the word filter, a power of two
+#define LOG_IDX_BLOOM_K    4         ///< Filter bits per word
+#define LOG_IDX_PARTIAL    0x01      ///< Entry does not cover all records of its segment
+#define LOG_IDX_WORDS_MAX  4         ///< Words of one search, all must be present
+#define LOG_IDX_WORD_MAX   24        ///< Longer search words are cut
+#define LOG_IDX_FMTS_MAX   4         ///< FmtIds of one search, any may match
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t first;
+    uint32_t tick_min;
+    uint32_t tick_max;
+    uint16_t levels[LOG_IDX_LEVELS];
+    uint8_t flags;
+    uint8_t reserved;
+    uint16_t records;
+    uint8_t words[LOG_IDX_BLOOM];
+    uint32_t crc;
+} LogIdxEntry;
+#pragma pack(pop)
+
+/** What a search looks for. Empty criteria match everything. */
+typedef struct {
+    uint8_t levels;                                 ///< Bit per level; 0 all
+    uint32_t tick_from;                             ///< Records with tick_from <= Tick <= tick_to
+    uint32_t tick_to;
+    uint8_t words;
+    char word[LOG_IDX_WORDS_MAX][LOG_IDX_WORD_MAX + 1]; ///< Lower case
+    uint32_t word_hash[LOG_IDX_WORDS_MAX];
+    uint8_t fmts;
+    uint32_t fmt[LOG_IDX_FMTS_MAX];
+} LogQuery;
+
+/** Starts the entry of a segment whose first record is at `first`. */
+void log_idx_init(LogIdxEntry *e, uint32_t first, uint8_t flags);
+
+/** Adds one whole record (header included) to its segment's entry. */
+void log_idx_add(LogIdxEntry *e, const uint8_t *rec, int len);
+
+/** Sets the CRC; call before the entry is written. */
+void log_idx_seal(LogIdxEntry *e);
+bool log_idx_valid(const LogIdxEntry *e);
+
+/**
+ * @brief Builds a query. `text` holds up to LOG_IDX_WORDS_MAX words, split
+ * as records are; anything else in it is ignored.
+ */
+void log_query_init(LogQuery *q, uint8_t levels, uint32_t tick_from, uint32_t tick_to,
+                    const char *text, const uint32_t *fmts, uint8_t nfmts);
+
+/** False only if no record of the entry's segment can match. */
+bool log_idx_may_match(const LogIdxEntry *e, const LogQuery *q);
+
+/** Whether one whole record matches. */
+bool log_rec_match(const uint8_t *rec, int len, const LogQuery *q);
+
+/**
+ * @brief Checks the record header at `rec` (`avail` bytes there).
+ * @return Its length with header, 0 if more bytes are needed to tell,
+ * -1 if it is not a record.
+ */
+int log_rec_check(const uint8_t *rec, int avail);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_INDEX_H
@@ -0,0 +1,135 @@
+#include "log_stream.h"
+#include <string.h>
+
+#define RING_MASK (LOG_STREAM_RING - 1)
+
+static uint32_t room(const LogStream *s) {
+    return LOG_STREAM_RING - (s->head - s->tail);
+}
+
+// Chunks the ring has room for past what it holds
+static uint32_t grantable(const LogStream *s) {
+    uint32_t n = room(s) / LOG_CHUNK_MAX;
+    return (n > LOG_STREAM_CREDITS) ? LOG_STREAM_CREDITS : n;
+}
+
+// A credit is worth a frame once it extends the grant by half a window
+static uint8_t credit_due(const LogStream *s) {
+    uint32_t limit = s->head + grantable(s) * LOG_CHUNK_MAX;
+    return (limit >= s->granted + (LOG_STREAM_CREDITS / 2) * LOG_CHUNK_MAX) ? LOG_STREAM_SEND_CREDIT : 0;
+}
+
+static uint8_t request_resend(LogStream *s, uint32_t now_ms, bool force) {
+    // One request per gap: the rest of the window arrives past it as well
+    if (!force && s->resend_at == s->head && now_ms - s->resend_ms < LOG_STREAM_STALL_MS) return 0;
+    s->resend_at = s->head;
+    s->resend_ms = now_ms;
+    s->resends++;
+    return LOG_STREAM_SEND_RESEND;
+}
+
+uint8_t log_stream_start(LogStream *s, uint32_t now_ms) {
+    s->head = 0;
+    s->tail = 0;
+    s->active = true;
+    s->complete = false;
+    s->failed = false;
+    s->granted = 0;
+    s->resend_at = 0xFFFFFFFFu;
+    s->resend_ms = now_ms;
+    s->last_rx_ms = now_ms;
+    s->keepalive_ms = now_ms;
+    s->stall_run = 0;
+    s->resends = 0;
+    s->credits_sent = 0;
+    s->stalls = 0;
+    return LOG_STREAM_SEND_CREDIT;
+}
+
+void log_stream_abort(LogStream *s) {
+    s->active = false;
+}
+
+uint8_t log_stream_on_chunk(LogStream *s, uint32_t offset, const uint8_t *data, uint16_t len, uint32_t now_ms) {
+    if (!s->active) return 0;
+    if (offset < s->head) return 0;  // Overlap after a resend
+    if (offset > s->head) return request_resend(s, now_ms, false);
+
+    if (len == 0) {
+        // In order, so nothing is missing; the credit confirms the end
+        s->complete = true;
+        s->active = false;
+        return LOG_STREAM_SEND_CREDIT;
+    }
+    // Never granted: the stall timer brings it back once there is room
+    if (len > room(s)) return 0;
+
+    uint32_t at = s->head & RING_MASK;
+    uint32_t first = LOG_STREAM_RING - at;
+    if (first > len) first = len;
+    memcpy(&s->buf[at], data, first);
+    memcpy(s->buf, data + first, len - first);
+    s->head += len;
+    s->last_rx_ms = now_ms;
+    s->keepalive_ms = now_ms;
+    s->stall_run = 0;
+    return credit_due(s);
+}
+
+uint8_t log_stream_poll(LogStream *s, uint32_t now_ms) {
+    if (!s->active) return 0;
+
+    // Owed data missing: lost tail of the window, lost credit or lost end marker
+    if (s->granted > s->head && now_ms - s->last_rx_ms > LOG_STREAM_STALL_MS) {
+        s->last_rx_ms = now_ms;
+        s->stalls++;
+        if (++s->stall_run >= LOG_STREAM_STALLS_MAX) {
+            s->failed = true;
+            s->active = false;
+            return 0;
+        }
+        return request_resend(s, now_ms, true) | LOG_STREAM_SEND_CREDIT;
+    }
+    if (s->granted > s->head) return credit_due(s);
+
+    // Waiting on the reader, not the link: keep the STM32 from dropping us
+    s->last_rx_ms = now_ms;
+    uint8_t due = credit_due(s);
+    if (due || now_ms - s->keepalive_ms >= LOG_STREAM_KEEPALIVE_MS) {
+        s->keepalive_ms = now_ms;
+        return LOG_STREAM_SEND_CREDIT;
+    }
+    return 0;
+}
+
+uint32_t log_stream_read(LogStream *s, uint8_t *out, uint32_t max) {
+    uint32_t n = s->head - s->tail;
+    if (n > max) n = max;
+    uint32_t at = s->tail & RING_MASK;
+    uint32_t first = LOG_STREAM_RING - at;
+    if (first > n) first = n;
+    memcpy(out, &s->buf[at], first);
+    memcpy(out + first, s->buf, n - first);
+    s->tail += n;
+    return n;
+}
+
+uint32_t log_stream_buffered(const LogStream *s) {
+    return s->head - s->tail;
+}
+
+uint32_t log_stream_offset(const LogStream *s) {
+    return s->head;
+}
+
+uint8_t log_stream_credits(LogStream *s) {
+    uint32_t n = grantable(s);
+    uint32_t limit = s->head + n * LOG_CHUNK_MAX;
+    if (limit > s->granted) s->granted = limit;
+    s->credits_sent++;
+    return (uint8_t)n;
+}
+
+bool log_stream_done(const LogStream *s) {
+    return (s->complete || s->failed) && s->head == s->tail;
+}
@@ -0,0 +1,123 @@
+#ifndef LOG_STREAM_H
+#define LOG_STREAM_H
+
+/**
+ * @file log_stream.h
+ * @author Lollokara
+ * @brief Receiving end of a log download: a fixed ring between the UART and
+ * the HTTP response, and the credit that keeps the STM32 from overrunning it.
+ *
+ * CMD_LOG_DATA_CHUNK frames are appended in file order; the ring's write
+ * count is the next offset expected. Credit is only granted for room the
+ * ring has, so a reader that stops (TCP send buffer full, slow browser)
+ * stops the STM32 within one window instead of growing a buffer. Once the
+ * reader frees half a window the credit is renewed.
+ *
+ * Gaps are answered with one CMD_LOG_RESEND_REQ each; a download that
+ * expects data and gets none for LOG_STREAM_STALL_MS gets a resend request
+ * and a fresh credit; LOG_STREAM_STALLS_MAX of those in a row and the
+ * download has failed (the STM32 dropped it or the link is gone), so the
+ * reader sees the end instead of waiting forever.
+ *
+ * While the reader holds the ring full no credit is due, but the STM32 drops
+ * a download left without credit for DL_IDLE_TIMEOUT. A keep-alive credit at
+ * the write position, granting whatever room there is (often none), goes
+ * out every LOG_STREAM_KEEPALIVE_MS to hold it open.
+ *
+ * Pure state machine: the caller sends the frames the returned LOG_STREAM_*
+ * flags ask for and serializes access. No RTOS or HAL dependency, so it
+ * runs on a host.
+ *
+ * @note This file MUST be identical in both projects.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ecoflow_protocol.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_STREAM_RING         16384  ///< Ring bytes, a power of two
+#define LOG_STREAM_CREDITS      32     ///< Most chunks granted past the write position
+#define LOG_STREAM_STALL_MS     500    ///< Owed data missing this long -> resend and credit
+#define LOG_STREAM_STALLS_MAX   20     ///< Stalls in a row before the download has failed
+#define LOG_STREAM_KEEPALIVE_MS 2000   ///< Credit interval while the reader holds the ring full
+
+// Frames the caller must send, OR'ed together
+#define LOG_STREAM_SEND_CREDIT 0x01  ///< CMD_LOG_CREDIT [log_stream_offset()][log_stream_credits()]
+#define LOG_STREAM_SEND_RESEND 0x02  ///< CMD_LOG_RESEND_REQ [log_stream_offset()]
+
+typedef struct {
+    uint8_t buf[LOG_STREAM_RING];
+    uint32_t head;            ///< Bytes written = next file offset expected
+    uint32_t tail;            ///< Bytes read
+    bool active;              ///< Started and neither complete nor aborted
+    bool complete;            ///< End marker received in order
+    bool failed;              ///< Gave up after LOG_STREAM_STALLS_MAX stalls
+    uint32_t granted;         ///< Highest offset the STM32 may send up to
+    uint32_t resend_at;       ///< head when the last resend was requested
+    uint32_t resend_ms;
+    uint32_t last_rx_ms;      ///< Last chunk in order, or the last stall action
+    uint32_t keepalive_ms;    ///< Last chunk in order, or the last credit from a poll
+    uint32_t stall_run;       ///< Stalls since the last chunk in order
+    uint32_t resends;
+    uint32_t credits_sent;
+    uint32_t stalls;
+} LogStream;
+
+/**
+ * @brief Empties the ring for a new download.
+ * @return LOG_STREAM_SEND_CREDIT: the STM32 sends nothing before the first credit.
+ */
+uint8_t log_stream_start(LogStream *s, uint32_t now_ms);
+
+/**
+ * @brief Stops granting credit; the STM32 stops after what it was granted.
+ */
+void log_stream_abort(LogStream *s);
+
+/**
+ * @brief Takes one CMD_LOG_DATA_CHUNK. `len` 0 is the end marker.
+ * @return LOG_STREAM_SEND_* flags.
+ */
+uint8_t log_stream_on_chunk(LogStream *s, uint32_t offset, const uint8_t *data, uint16_t len, uint32_t now_ms);
+
+/**
+ * @brief Renews credit the reader made room for and handles stalls. Call
+ * from the loop that receives the chunks.
+ * @return LOG_STREAM_SEND_* flags.
+ */
+uint8_t log_stream_poll(LogStream *s, uint32_t now_ms);
+
+/**
+ * @brief Copies up to `max` buffered bytes out and frees their room.
+ * @return Bytes copied.
+ */
+uint32_t log_stream_read(LogStream *s, uint8_t *out, uint32_t max);
+
+uint32_t log_stream_buffered(const LogStream *s);
+
+/**
+ * @brief Offset for CMD_LOG_CREDIT / CMD_LOG_RESEND_REQ: first byte missing.
+ */
+uint32_t log_stream_offset(const LogStream *s);
+
+/**
+ * @brief Chunks to grant in CMD_LOG_CREDIT. Also records the grant, so
+ * call it once per credit frame sent.
+ */
+uint8_t log_stream_credits(LogStream *s);
+
+/**
+ * @brief Everything received and read out, or the download failed and what
+ * did arrive is read out.
+ */
+bool log_stream_done(const LogStream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOG_STREAM_H
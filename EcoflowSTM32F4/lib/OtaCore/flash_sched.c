@@ -0,0 +1,69 @@
+#include "flash_sched.h"
+
+static const uint32_t sector_kb[FLASH_SCHED_SECTORS] = { 16, 16, 16, 16, 64, 128, 128, 128, 128, 128, 128, 128 };
+
+uint32_t flash_sched_sector_start(uint8_t sector) {
+    uint32_t offset = 0;
+    for (uint8_t i = 0; i < sector && i < FLASH_SCHED_SECTORS; i++) offset += sector_kb[i] * 1024;
+    return offset;
+}
+
+bool flash_sched_init(FlashSched *s, uint32_t image_size) {
+    s->image_size = image_size;
+    s->erased = 0;
+    s->erasing = false;
+    s->programmed = 0;
+    s->sectors = 0;
+    if (image_size > FLASH_SCHED_BANK_SIZE) return false;
+    while (flash_sched_sector_start(s->sectors) < image_size) s->sectors++;
+    return true;
+}
+
+bool flash_sched_resume(FlashSched *s, uint32_t image_size, uint32_t programmed) {
+    if (!flash_sched_init(s, image_size) || programmed > image_size) return false;
+    // A sector that holds programmed bytes was erased before them; any
+    // later one may have been erased, or cut short, after the resume point
+    while (s->erased < s->sectors && flash_sched_sector_start(s->erased) < programmed) s->erased++;
+    s->programmed = programmed;
+    return true;
+}
+
+FlashOp flash_sched_next(FlashSched *s, uint32_t staged, uint32_t max_len, uint8_t *sector, uint32_t *len) {
+    if (s->erasing) return FLASH_OP_NONE;
+    if (s->programmed >= s->image_size) return FLASH_OP_DONE;
+
+    if (staged > s->image_size) staged = s->image_size;
+    // Whole words only, a flash word is programmed once; the image may end
+    // in a partial one
+    if (staged < s->image_size) staged &= ~3u;
+    if (staged > s->programmed) {
+        // Program whatever is staged inside erased sectors first, so an
+        // erase never holds back data that is already here
+        uint32_t end = flash_sched_sector_start(s->erased);
+        if (end > staged) end = staged;
+        if (end > s->programmed) {
+            uint32_t n = end - s->programmed;
+            *len = (n > max_len) ? max_len : n;
+            return (*len > 0) ? FLASH_OP_PROGRAM : FLASH_OP_NONE;
+        }
+    }
+
+    // Either the write pointer reached an unerased sector, or the flash is
+    // idle waiting for data: erase the next sector the image covers
+    if (s->erased < s->sectors) {
+        *sector = s->erased;
+        s->erasing = true;
+        return FLASH_OP_ERASE;
+    }
+    return FLASH_OP_NONE;
+}
+
+void flash_sched_erase_done(FlashSched *s) {
+    if (!s->erasing) return;
+    s->erasing = false;
+    s->erased++;
+}
+
+void flash_sched_program_done(FlashSched *s, uint32_t len) {
+    s->programmed += len;
+}
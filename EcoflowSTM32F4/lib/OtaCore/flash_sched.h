@@ -0,0 +1,84 @@
+#ifndef FLASH_SCHED_H
+#define FLASH_SCHED_H
+
+/**
+ * @file flash_sched.h
+ * @author Lollokara
+ * @brief Erase/program ordering for writing an image into the inactive bank.
+ *
+ * Only the sectors the image covers are erased, and only when the write
+ * pointer needs them or when the flash would otherwise sit idle waiting for
+ * the UART. Erase and program share the flash controller, so the caller asks
+ * for one operation at a time, runs it and reports completion:
+ *
+ *   FLASH_OP_PROGRAM  program `len` staged bytes at `programmed`
+ *   FLASH_OP_ERASE    start erasing bank sector `sector` (0 = bank start)
+ *   FLASH_OP_NONE     nothing to do until more data is staged or the erase ends
+ *   FLASH_OP_DONE     every byte of the image is programmed
+ *
+ * Pure logic, no HAL: the bootloader drives it against the real flash,
+ * Test Scripts/verify_ota_core.py against a fake flash that records the
+ * order of operations.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_SCHED_SECTORS 12               ///< Sectors per bank
+#define FLASH_SCHED_BANK_SIZE 0x100000       ///< 4 x 16K, 64K, 7 x 128K
+
+typedef enum {
+    FLASH_OP_NONE = 0,
+    FLASH_OP_ERASE,
+    FLASH_OP_PROGRAM,
+    FLASH_OP_DONE
+} FlashOp;
+
+typedef struct {
+    uint32_t image_size;
+    uint8_t sectors;       ///< Sectors the image covers
+    uint8_t erased;        ///< Sectors [0, erased) are erased
+    bool erasing;          ///< Sector `erased` is being erased
+    uint32_t programmed;   ///< Bytes [0, programmed) are written
+} FlashSched;
+
+/**
+ * @brief Starts a new image.
+ * @return false if the image does not fit in a bank.
+ */
+bool flash_sched_init(FlashSched *s, uint32_t image_size);
+
+/**
+ * @brief Continues an image whose bytes [0, programmed) are already written.
+ * Sectors past them are erased again.
+ * @return false if the image does not fit in a bank.
+ */
+bool flash_sched_resume(FlashSched *s, uint32_t image_size, uint32_t programmed);
+
+/**
+ * @brief Picks the next flash operation.
+ * @param staged Bytes [0, staged) have been received and can be programmed;
+ *               programs stop at a word boundary until the image's last byte.
+ * @param max_len Upper bound for a program step (staging contiguity, latency).
+ * @param sector Out: sector to erase for FLASH_OP_ERASE.
+ * @param len Out: bytes to program at s->programmed for FLASH_OP_PROGRAM.
+ */
+FlashOp flash_sched_next(FlashSched *s, uint32_t staged, uint32_t max_len, uint8_t *sector, uint32_t *len);
+
+void flash_sched_erase_done(FlashSched *s);
+void flash_sched_program_done(FlashSched *s, uint32_t len);
+
+/**
+ * @brief Bank offset of a sector; FLASH_SCHED_SECTORS gives the bank size.
+ */
+uint32_t flash_sched_sector_start(uint8_t sector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_SCHED_H
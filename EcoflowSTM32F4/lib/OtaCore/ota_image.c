@@ -0,0 +1,224 @@
+#include "ota_image.h"
+#include <string.h>
+
+// LZ4 sequence: [Token][LitLen+][Literals][Offset:2][MatchLen+]; the last
+// sequence stops after its literals. Patches: [Offset:2] = 0 is followed by
+// [BaseOffset:4]
+enum {
+    LZ_TOKEN = 0,
+    LZ_LITLEN,
+    LZ_LIT,
+    LZ_OFF0,
+    LZ_OFF1,
+    LZ_BASE0,   // ..LZ_BASE0 + 3
+    LZ_MATLEN = LZ_BASE0 + 4,
+    LZ_MATCH,
+    LZ_DONE
+};
+
+#define LZ_MIN_MATCH 4
+
+static uint32_t rd32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t room(const OtaImage *im, uint32_t out_limit) {
+    return (out_limit > im->out_pos) ? out_limit - im->out_pos : 0;
+}
+
+static void put(OtaImage *im, const uint8_t *data, uint32_t len) {
+    if (len == 0) return;
+    uint32_t pos = im->out_pos % im->out_size;
+    uint32_t first = (len > im->out_size - pos) ? im->out_size - pos : len;
+    memcpy(&im->out[pos], data, first);
+    memcpy(im->out, data + first, len - first);
+    im->out_pos += len;
+}
+
+static void copy_base(OtaImage *im, uint32_t len) {
+    put(im, &im->base[im->base_off], len);
+    im->base_off += len;
+}
+
+// Byte by byte: a match may overlap the bytes it produces
+static void copy_match(OtaImage *im, uint32_t len) {
+    uint32_t dst = im->out_pos % im->out_size;
+    uint32_t src = (im->out_pos - im->offset) % im->out_size;
+    for (uint32_t i = 0; i < len; i++) {
+        im->out[dst] = im->out[src];
+        if (++dst == im->out_size) dst = 0;
+        if (++src == im->out_size) src = 0;
+    }
+    im->out_pos += len;
+}
+
+static void parse_header(OtaImage *im, uint8_t format) {
+    uint8_t window_log = im->hdr[12];
+    im->image_size = rd32(&im->hdr[4]);
+    im->image_crc = rd32(&im->hdr[8]);
+    im->format = format;
+    im->state = LZ_TOKEN;
+    if (im->image_size == 0 || window_log > 16 || (1u << window_log) > im->out_size) im->error = true;
+    if (format == OTA_IMAGE_DELTA) {
+        im->base_size = rd32(&im->hdr[16]);
+        im->base_crc = rd32(&im->hdr[20]);
+        if (im->base == NULL || im->base_size > im->base_avail) im->error = true;
+    }
+}
+
+static uint8_t header_size(const OtaImage *im) {
+    return memcmp(im->hdr, OTA_IMAGE_MAGIC_DELTA, 4) == 0 ? OTA_IMAGE_DELTA_HEADER_SIZE : OTA_IMAGE_HEADER_SIZE;
+}
+
+static uint32_t lz_feed(OtaImage *im, const uint8_t *in, uint32_t len, uint32_t out_limit) {
+    uint32_t i = 0;
+    while (!im->error) {
+        uint32_t n;
+        switch (im->state) {
+            case LZ_TOKEN:
+                if (i == len) return i;
+                im->token = in[i++];
+                im->run = im->token >> 4;
+                im->state = (im->run == 15) ? LZ_LITLEN : LZ_LIT;
+                break;
+            case LZ_LITLEN:
+            case LZ_MATLEN:
+                if (i == len) return i;
+                im->run += in[i];
+                if (im->run > im->image_size) im->error = true;
+                if (in[i++] != 255) im->state = (im->state == LZ_LITLEN) ? LZ_LIT : LZ_MATCH;
+                break;
+            case LZ_LIT:
+                if (im->run > im->image_size - im->out_pos) {
+                    im->error = true;
+                    break;
+                }
+                n = room(im, out_limit);
+                if (n > len - i) n = len - i;
+                if (n > im->run) n = im->run;
+                put(im, &in[i], n);
+                i += n;
+                im->run -= n;
+                if (im->run > 0) return i;
+                im->state = (im->out_pos == im->image_size) ? LZ_DONE : LZ_OFF0;
+                break;
+            case LZ_OFF0:
+                if (i == len) return i;
+                im->offset = in[i++];
+                im->state = LZ_OFF1;
+                break;
+            case LZ_OFF1:
+                if (i == len) return i;
+                im->offset |= (uint16_t)in[i++] << 8;
+                im->run = (im->token & 15) + LZ_MIN_MATCH;
+                im->state = ((im->token & 15) == 15) ? LZ_MATLEN : LZ_MATCH;
+                if (im->offset == 0 && im->format == OTA_IMAGE_DELTA) {
+                    im->base_off = 0;
+                    im->state = LZ_BASE0;
+                } else if (im->offset == 0 || im->offset > im->out_pos || im->offset > (1u << im->hdr[12])) {
+                    im->error = true;
+                }
+                break;
+            case LZ_BASE0:
+            case LZ_BASE0 + 1:
+            case LZ_BASE0 + 2:
+            case LZ_BASE0 + 3:
+                if (i == len) return i;
+                im->base_off |= (uint32_t)in[i++] << (8 * (im->state - LZ_BASE0));
+                if (im->state++ == LZ_BASE0 + 3) {
+                    im->state = ((im->token & 15) == 15) ? LZ_MATLEN : LZ_MATCH;
+                    if (im->base_off > im->base_size) im->error = true;
+                }
+                break;
+            case LZ_MATCH:
+                if (im->run > im->image_size - im->out_pos ||
+                    (im->offset == 0 && im->run > im->base_size - im->base_off)) {
+                    im->error = true;
+                    break;
+                }
+                n = room(im, out_limit);
+                if (n > im->run) n = im->run;
+                if (im->offset == 0) copy_base(im, n); else copy_match(im, n);
+                im->run -= n;
+                if (im->run > 0) return i;
+                im->state = (im->out_pos == im->image_size) ? LZ_DONE : LZ_TOKEN;
+                break;
+            default:
+                // Anything after the last sequence is not part of the image
+                if (i < len) im->error = true;
+                return i;
+        }
+    }
+    return i;
+}
+
+void ota_image_set_base(OtaImage *im, const uint8_t *base, uint32_t size) {
+    im->base = base;
+    im->base_avail = size;
+}
+
+void ota_image_begin(OtaImage *im, uint32_t wire_size, uint8_t *out, uint32_t out_size) {
+    memset(im, 0, sizeof(*im));
+    im->out = out;
+    im->out_size = out_size;
+    im->wire_size = wire_size;
+    if (wire_size < 4) {
+        // Too short for a magic
+        im->format = OTA_IMAGE_RAW;
+        im->image_size = wire_size;
+    }
+}
+
+uint32_t ota_image_feed(OtaImage *im, const uint8_t *in, uint32_t len, uint32_t out_limit) {
+    uint32_t used = 0;
+    if (im->error) return 0;
+    if (len > im->wire_size - im->wire_pos) {
+        im->error = true;
+        return 0;
+    }
+
+    while (im->format == OTA_IMAGE_PENDING && used < len) {
+        im->hdr[im->hdr_len++] = in[used++];
+        if (im->hdr_len == 4 && memcmp(im->hdr, OTA_IMAGE_MAGIC_LZ, 4) != 0 &&
+            memcmp(im->hdr, OTA_IMAGE_MAGIC_DELTA, 4) != 0) {
+            im->format = OTA_IMAGE_RAW;
+            im->image_size = im->wire_size;
+        } else if (im->hdr_len == header_size(im)) {
+            parse_header(im, (im->hdr_len == OTA_IMAGE_DELTA_HEADER_SIZE) ? OTA_IMAGE_DELTA : OTA_IMAGE_LZ);
+        }
+    }
+    im->wire_pos += used;
+    if (im->error) return used;
+
+    if (im->format == OTA_IMAGE_RAW) {
+        // The bytes held back to look for a magic are image bytes
+        uint32_t n = im->hdr_len - im->hdr_out;
+        if (n > room(im, out_limit)) n = room(im, out_limit);
+        put(im, &im->hdr[im->hdr_out], n);
+        im->hdr_out += n;
+        if (im->hdr_out < im->hdr_len) return used;
+
+        n = len - used;
+        if (n > room(im, out_limit)) n = room(im, out_limit);
+        put(im, &in[used], n);
+        im->wire_pos += n;
+        return used + n;
+    }
+
+    if (im->format == OTA_IMAGE_LZ || im->format == OTA_IMAGE_DELTA) {
+        uint32_t n = lz_feed(im, &in[used], len - used, out_limit);
+        im->wire_pos += n;
+        used += n;
+        // A sequence cut short by the end of the file can never complete
+        if (im->wire_pos == im->wire_size && im->state != LZ_MATCH && im->state != LZ_DONE) im->error = true;
+    }
+    return used;
+}
+
+bool ota_image_sized(const OtaImage *im) {
+    return im->format != OTA_IMAGE_PENDING && !im->error;
+}
+
+bool ota_image_done(const OtaImage *im) {
+    return ota_image_sized(im) && im->wire_pos == im->wire_size && im->out_pos == im->image_size;
+}
@@ -0,0 +1,112 @@
+#ifndef OTA_IMAGE_H
+#define OTA_IMAGE_H
+
+/**
+ * @file ota_image.h
+ * @author Lollokara
+ * @brief Turns the transferred OTA file into the image that goes to flash.
+ *
+ * The file is the raw bank image, a compressed container or a patch
+ * against the image in the active bank:
+ *
+ *   [Magic:4 "EFZ1"][ImageSize:4][ImageCRC32:4][WindowLog:1][Reserved:3]
+ *   followed by one LZ4 block (sequences of literals and back-references)
+ *
+ *   [Magic:4 "EFD1"][ImageSize:4][ImageCRC32:4][WindowLog:1][Reserved:3]
+ *   [BaseSize:4][BaseCRC32:4]
+ *   followed by the same block, where a match offset of 0 is followed by
+ *   [BaseOffset:4] and copies the match from the base image instead
+ *
+ * A raw image starts with its initial stack pointer, never with a magic.
+ * The base is read in place (the active bank is memory mapped), so a patch
+ * needs no more RAM than a compressed image. The caller checks BaseCRC32
+ * before anything is programmed; the image CRC catches the rest.
+ *
+ * The decoder writes the image into the caller's staging ring, indexed by
+ * image offset modulo its size, and takes match history from that same
+ * ring: RAM use is the ring plus this struct, whatever the window. The
+ * window is at most 64 KB (LZ4 offsets are 16 bits) and must fit the ring.
+ *
+ * Input can be cut at any byte and output is bounded by `out_limit`, so a
+ * chunk may be consumed partially while the flash catches up; feeding
+ * zero bytes continues a back-reference that was waiting for room.
+ *
+ * Pure logic, no HAL: the bootloader feeds it from the UART,
+ * Test Scripts/verify_ota_core.py round-trips it against
+ * Test Scripts/tools/ota_pack.py.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_IMAGE_HEADER_SIZE 16
+#define OTA_IMAGE_DELTA_HEADER_SIZE 24
+#define OTA_IMAGE_MAGIC_LZ "EFZ1"
+#define OTA_IMAGE_MAGIC_DELTA "EFD1"
+
+typedef enum {
+    OTA_IMAGE_PENDING = 0,   ///< Header not complete yet
+    OTA_IMAGE_RAW,
+    OTA_IMAGE_LZ,
+    OTA_IMAGE_DELTA
+} OtaImageFormat;
+
+typedef struct {
+    uint8_t *out;            ///< Staging ring, also the match history
+    uint32_t out_size;
+    uint32_t wire_size;      ///< Bytes in the transferred file
+    uint32_t wire_pos;       ///< File bytes consumed
+    uint32_t image_size;     ///< Valid once format != OTA_IMAGE_PENDING
+    uint32_t image_crc;      ///< CRC32 of the image, containers only
+    uint32_t out_pos;        ///< Image bytes produced
+    const uint8_t *base;     ///< Image a patch applies to, NULL: none
+    uint32_t base_avail;
+    uint32_t base_size;      ///< Patch header: bytes of the base it was made against
+    uint32_t base_crc;       ///< Patch header: their CRC32
+    uint32_t base_off;       ///< Source of the current base match
+    uint8_t format;          ///< OtaImageFormat
+    bool error;              ///< Corrupt or unsupported stream, sticky
+    uint8_t hdr[OTA_IMAGE_DELTA_HEADER_SIZE];
+    uint8_t hdr_len;
+    uint8_t hdr_out;         ///< Raw: header bytes already passed through
+    uint8_t state;           ///< LZ sequence parser state
+    uint8_t token;
+    uint16_t offset;         ///< 0: current match comes from the base
+    uint32_t run;            ///< Literal or match bytes left in the sequence
+} OtaImage;
+
+void ota_image_begin(OtaImage *im, uint32_t wire_size, uint8_t *out, uint32_t out_size);
+
+/**
+ * @brief Makes `base` available to patches; call after ota_image_begin().
+ * Without it a patch is rejected at its header.
+ */
+void ota_image_set_base(OtaImage *im, const uint8_t *base, uint32_t size);
+
+/**
+ * @brief Consumes file bytes in order and produces image bytes.
+ * @param out_limit Produce no image byte at or past this offset
+ *                  (programmed + ring size keeps unprogrammed bytes intact).
+ * @return File bytes consumed; less than `len` when output is blocked.
+ */
+uint32_t ota_image_feed(OtaImage *im, const uint8_t *in, uint32_t len, uint32_t out_limit);
+
+/**
+ * @brief True once the image size is known.
+ */
+bool ota_image_sized(const OtaImage *im);
+
+/**
+ * @brief True when the whole file is consumed and the whole image produced.
+ */
+bool ota_image_done(const OtaImage *im);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_IMAGE_H
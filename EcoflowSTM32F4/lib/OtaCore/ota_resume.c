@@ -0,0 +1,99 @@
+#include "ota_resume.h"
+#include "ota_crc.h"
+#include <string.h>
+
+#define RESUME_MAGIC 0x4F545231u   // "OTR1"
+
+bool ota_resume_point(const OtaImage *im) {
+    // Raw images: the bytes held back to look for a magic are out
+    return ota_image_sized(im) && (im->format != OTA_IMAGE_RAW || im->hdr_out == im->hdr_len) &&
+           im->out_pos % 4 == 0 && im->out_pos < im->image_size;
+}
+
+void ota_resume_capture(OtaResume *r, const OtaImage *im) {
+    r->wire_pos = im->wire_pos;
+    r->out_pos = im->out_pos;
+    r->image_size = im->image_size;
+    r->image_crc = im->image_crc;
+    r->base_size = im->base_size;
+    r->base_crc = im->base_crc;
+    r->base_off = im->base_off;
+    r->run = im->run;
+    r->offset = im->offset;
+    r->state = im->state;
+    r->token = im->token;
+    r->format = im->format;
+    r->window_log = im->hdr[12];
+}
+
+void ota_resume_apply(const OtaResume *r, OtaImage *im, const uint8_t *bank) {
+    im->wire_pos = r->wire_pos;
+    im->out_pos = r->out_pos;
+    im->image_size = r->image_size;
+    im->image_crc = r->image_crc;
+    im->base_size = r->base_size;
+    im->base_crc = r->base_crc;
+    im->base_off = r->base_off;
+    im->run = r->run;
+    im->offset = r->offset;
+    im->state = r->state;
+    im->token = r->token;
+    im->format = r->format;
+    im->hdr[12] = r->window_log;
+    im->hdr_len = im->hdr_out = 0;
+    im->error = false;
+
+    // The last out_size image bytes, each at its ring position
+    uint32_t from = (r->out_pos > im->out_size) ? r->out_pos - im->out_size : 0;
+    for (uint32_t pos = from; pos < r->out_pos;) {
+        uint32_t ring = pos % im->out_size;
+        uint32_t n = im->out_size - ring;
+        if (n > r->out_pos - pos) n = r->out_pos - pos;
+        memcpy(&im->out[ring], &bank[pos], n);
+        pos += n;
+    }
+}
+
+void ota_resume_pack(const OtaResume *r, uint32_t words[OTA_RESUME_WORDS]) {
+    words[0] = RESUME_MAGIC;
+    words[1] = r->file_size;
+    words[2] = r->file_crc;
+    words[3] = r->wire_pos;
+    words[4] = r->wire_crc;
+    words[5] = r->out_pos;
+    words[6] = r->flash_crc;
+    words[7] = r->image_size;
+    words[8] = r->image_crc;
+    words[9] = r->base_size;
+    words[10] = r->base_crc;
+    words[11] = r->base_off;
+    words[12] = r->run;
+    words[13] = r->offset | ((uint32_t)r->state << 16) | ((uint32_t)r->token << 24);
+    words[14] = r->format | ((uint32_t)r->window_log << 8);
+    words[15] = ota_crc32(0, (const uint8_t*)words, 15 * 4);
+}
+
+bool ota_resume_unpack(OtaResume *r, const uint32_t words[OTA_RESUME_WORDS]) {
+    uint32_t copy[OTA_RESUME_WORDS];
+    // Backup registers are read one word at a time
+    for (int i = 0; i < OTA_RESUME_WORDS; i++) copy[i] = words[i];
+    if (copy[0] != RESUME_MAGIC || copy[15] != ota_crc32(0, (const uint8_t*)copy, 15 * 4)) return false;
+    r->file_size = copy[1];
+    r->file_crc = copy[2];
+    r->wire_pos = copy[3];
+    r->wire_crc = copy[4];
+    r->out_pos = copy[5];
+    r->flash_crc = copy[6];
+    r->image_size = copy[7];
+    r->image_crc = copy[8];
+    r->base_size = copy[9];
+    r->base_crc = copy[10];
+    r->base_off = copy[11];
+    r->run = copy[12];
+    r->offset = (uint16_t)copy[13];
+    r->state = (uint8_t)(copy[13] >> 16);
+    r->token = (uint8_t)(copy[13] >> 24);
+    r->format = (uint8_t)copy[14];
+    r->window_log = (uint8_t)(copy[14] >> 8);
+    return r->wire_pos <= r->file_size && r->out_pos <= r->image_size;
+}
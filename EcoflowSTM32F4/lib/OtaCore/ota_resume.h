@@ -0,0 +1,86 @@
+#ifndef OTA_RESUME_H
+#define OTA_RESUME_H
+
+/**
+ * @file ota_resume.h
+ * @author Lollokara
+ * @brief Progress record that lets an interrupted OTA transfer continue.
+ *
+ * The bootloader takes a checkpoint of the decoder at a chunk boundary,
+ * lets the flash catch up to it, and only then stores it: every image byte
+ * before `out_pos` is in the inactive bank and hashes to `flash_crc`. After
+ * a link loss, an ESP32 reboot or a reset, the ESP32 asks for the record
+ * (CMD_OTA_QUERY) and restarts the same file at `wire_pos`.
+ *
+ * The record is OTA_RESUME_WORDS 32-bit words, sized for the RTC backup
+ * registers, and ends in a CRC32 of the others: a record cut short by a
+ * reset reads back as none.
+ *
+ * The decoder's match history is the staging ring, which a reset loses;
+ * it is the image bytes before `out_pos`, so ota_resume_apply() refills it
+ * from the bank.
+ *
+ * Pure logic, no HAL: Test Scripts/verify_ota_core.py interrupts simulated
+ * transfers at random points and resumes them.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ota_image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_RESUME_WORDS 16
+
+typedef struct {
+    uint32_t file_size;      ///< The transfer: size and CRC32 of the file sent
+    uint32_t file_crc;
+    uint32_t wire_pos;       ///< Resume the file here
+    uint32_t wire_crc;       ///< CRC32 of the file bytes before wire_pos
+    uint32_t out_pos;        ///< Image bytes in flash
+    uint32_t flash_crc;      ///< Their CRC32
+    // Decoder state at wire_pos
+    uint32_t image_size;
+    uint32_t image_crc;
+    uint32_t base_size;
+    uint32_t base_crc;
+    uint32_t base_off;
+    uint32_t run;
+    uint16_t offset;
+    uint8_t state;
+    uint8_t token;
+    uint8_t format;
+    uint8_t window_log;
+} OtaResume;
+
+/**
+ * @brief True if the decoder state can be captured now: image sized, raw
+ * header passed through, and the image ending on a flash word.
+ */
+bool ota_resume_point(const OtaImage *im);
+
+/**
+ * @brief Copies the decoder state; the caller fills in the file and CRCs.
+ */
+void ota_resume_capture(OtaResume *r, const OtaImage *im);
+
+/**
+ * @brief Puts a decoder begun with the file size and staging ring back in
+ * the captured state, taking the match history from `bank`.
+ */
+void ota_resume_apply(const OtaResume *r, OtaImage *im, const uint8_t *bank);
+
+void ota_resume_pack(const OtaResume *r, uint32_t words[OTA_RESUME_WORDS]);
+
+/**
+ * @return false if the words hold no complete record.
+ */
+bool ota_resume_unpack(OtaResume *r, const uint32_t words[OTA_RESUME_WORDS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_RESUME_H
@@ -0,0 +1,460 @@
+#include "ota_rx.h"
+#include "ecoflow_protocol.h"
+#include <string.h>
+
+#if OTA_RX_CHUNK != OTA_WINDOW_CHUNK || OTA_RX_WINDOW_MAX != OTA_WINDOW_MAX
+#error "ota_rx.h and ecoflow_protocol.h disagree on the OTA window"
+#endif
+
+#define RX_LOG(rx, ...) do { if ((rx)->port->log) (rx)->port->log(__VA_ARGS__); } while (0)
+
+static void idle(OtaRx *rx) {
+    if (rx->port->idle) rx->port->idle(rx->user);
+}
+
+static void reply(OtaRx *rx, uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    rx->port->reply(rx->user, cmd, payload, len);
+}
+
+static void send_ack(OtaRx *rx) { reply(rx, CMD_OTA_ACK, NULL, 0); }
+static void send_nack(OtaRx *rx) { reply(rx, CMD_OTA_NACK, NULL, 0); }
+
+// [NextSeq:2][Sack:2]: first missing chunk, bit i = chunk NextSeq + 1 + i held
+static void send_wack(OtaRx *rx) {
+    uint8_t p[4];
+    uint16_t sack = (uint16_t)rx->win_sack;
+    memcpy(&p[0], &rx->win_base, 2);
+    memcpy(&p[2], &sack, 2);
+    reply(rx, CMD_OTA_WACK, p, 4);
+}
+
+// START ACK [Window:1][Flags:1]: granted window (0 = stop-and-wait) and the
+// accepted OTA_START flags, then [Offset:4] when resuming
+static void send_ack_start(OtaRx *rx, uint32_t offset) {
+    uint8_t p[6] = { rx->window, rx->flags };
+    memcpy(&p[2], &offset, 4);
+    reply(rx, CMD_OTA_ACK, p, (rx->flags & OTA_FLAG_RESUME) ? 6 : 2);
+}
+
+// [Size:4][FileCRC32:4][Offset:4]: the file a restarted sender may resume
+// and where, all zero when there is nothing to resume
+static void send_progress(OtaRx *rx, uint32_t size, uint32_t file_crc, uint32_t offset) {
+    uint8_t p[12];
+    memcpy(&p[0], &size, 4);
+    memcpy(&p[4], &file_crc, 4);
+    memcpy(&p[8], &offset, 4);
+    reply(rx, CMD_OTA_PROGRESS, p, 12);
+}
+
+// Strips the trailing CRC32 off a chunk payload and checks it
+static bool chunk_crc_ok(const uint8_t *payload, uint8_t *len) {
+    if (*len < 4) return false;
+    uint32_t crc;
+    memcpy(&crc, &payload[*len - 4], 4);
+    *len -= 4;
+    return ota_crc32(0, payload, *len) == crc;
+}
+
+static void hash_bank(OtaRx *rx, OtaCrc *crc, const uint8_t *from, uint32_t len) {
+    for (uint32_t off = 0; off < len; off += 0x10000) {
+        uint32_t n = len - off;
+        if (n > 0x10000) n = 0x10000;
+        ota_crc_update(crc, from + off, n);
+        idle(rx);
+    }
+}
+
+// --- Progress record ---
+// A checkpoint is taken at a chunk boundary every OTA_RX_RESUME_INTERVAL
+// image bytes and stored once the flash has caught up with it.
+
+static void resume_clear(OtaRx *rx) {
+    if (rx->port->record) rx->port->record[0] = 0;
+    rx->resume_pending = false;
+}
+
+static bool resume_read(const OtaRx *rx, OtaResume *r) {
+    uint32_t words[OTA_RESUME_WORDS];
+    if (!rx->port->record) return false;
+    for (int i = 0; i < OTA_RESUME_WORDS; i++) words[i] = rx->port->record[i];
+    return ota_resume_unpack(r, words);
+}
+
+static void resume_capture(OtaRx *rx) {
+    OtaImage *im = &rx->image;
+    if (!rx->resume_on || rx->resume_pending || im->out_pos < rx->resume_next ||
+        im->wire_pos % OTA_RX_CHUNK != 0 || !ota_resume_point(im)) return;
+    ota_resume_capture(&rx->resume, im);
+    rx->resume.wire_crc = rx->wire_crc;
+    rx->resume_pending = true;
+}
+
+// The flash holds every image byte before the checkpoint
+static void resume_commit(OtaRx *rx) {
+    uint32_t words[OTA_RESUME_WORDS];
+    rx->resume.flash_crc = ota_crc_value(&rx->flash_crc);
+    ota_resume_pack(&rx->resume, words);
+    for (int i = 0; i < OTA_RESUME_WORDS; i++) rx->port->record[i] = words[i];
+    rx->resume_pending = false;
+    rx->resume_next = rx->resume.out_pos + OTA_RX_RESUME_INTERVAL;
+}
+
+// Continues the same file from its record, if the bank still holds what the
+// record describes. Call right after the flash and decoder are started.
+static bool resume_restore(OtaRx *rx, uint32_t file_size, uint32_t file_crc) {
+    OtaResume r;
+    if (!resume_read(rx, &r) || r.file_size != file_size || r.file_crc != file_crc) return false;
+    hash_bank(rx, &rx->flash_crc, rx->port->bank, r.out_pos);
+    if (ota_crc_value(&rx->flash_crc) != r.flash_crc || !flash_sched_resume(&rx->sched, r.image_size, r.out_pos)) {
+        RX_LOG(rx, "Progress record does not match the bank, starting over");
+        ota_crc_begin(&rx->flash_crc, rx->port->crc_hw);
+        memset(&rx->sched, 0, sizeof(rx->sched));
+        return false;
+    }
+    ota_resume_apply(&r, &rx->image, rx->port->bank);
+    rx->wire_crc = r.wire_crc;
+    rx->resume = r;
+    rx->resume_next = r.out_pos + OTA_RX_RESUME_INTERVAL;
+    RX_LOG(rx, "Resuming at %d of %d (image %d of %d)", r.wire_pos, r.file_size, r.out_pos, r.image_size);
+    return true;
+}
+
+// --- Decode ---
+
+// A patch applies to the image in the active bank: it must be the very
+// image the patch was made against
+static bool base_ok(OtaRx *rx) {
+    OtaCrc base_crc;
+    ota_crc_begin(&base_crc, rx->port->crc_hw);
+    hash_bank(rx, &base_crc, rx->image.base, rx->image.base_size);
+    bool ok = (ota_crc_value(&base_crc) == rx->image.base_crc);
+    // Nothing is programmed yet: hand the unit back to the flash CRC
+    ota_crc_begin(&rx->flash_crc, rx->port->crc_hw);
+    return ok;
+}
+
+// Decodes file bytes, in order, into the staging ring without overwriting
+// bytes that are not programmed yet. Returns the bytes taken.
+static uint32_t image_feed(OtaRx *rx, const uint8_t *data, uint32_t len) {
+    OtaImage *im = &rx->image;
+    bool sized = ota_image_sized(im);
+    uint32_t used = ota_image_feed(im, data, len, rx->sched.programmed + rx->port->stage_size);
+    rx->wire_crc = ota_crc32(rx->wire_crc, data, used);
+
+    if (!sized && ota_image_sized(im)) {
+        RX_LOG(rx, "Image: %s, %d bytes", im->format == OTA_IMAGE_LZ ? "EFZ1" :
+               im->format == OTA_IMAGE_DELTA ? "EFD1" : "raw", im->image_size);
+        // Sectors are erased lazily, just ahead of the data, and only
+        // those the image covers
+        if (!flash_sched_init(&rx->sched, im->image_size)) {
+            RX_LOG(rx, "Bad image size %d", im->image_size);
+            rx->failed = true;
+        } else if (im->format == OTA_IMAGE_DELTA && !base_ok(rx)) {
+            RX_LOG(rx, "Patch is not for the running image (%d bytes, CRC 0x%08X)", im->base_size, im->base_crc);
+            rx->failed = true;
+        }
+    }
+    if (im->error && !rx->failed) {
+        RX_LOG(rx, "Image stream rejected at %d", im->wire_pos);
+        rx->failed = true;
+        resume_clear(rx); // Resuming would only reach the same error
+    }
+    resume_capture(rx);
+    return used;
+}
+
+static void wire_decode(OtaRx *rx) {
+    while (rx->dec_seq != rx->win_base && !rx->failed) {
+        uint8_t slot = rx->dec_seq % OTA_RX_SLOTS;
+        rx->dec_off += image_feed(rx, &rx->wire[slot][rx->dec_off], rx->wire_len[slot] - rx->dec_off);
+        if (rx->dec_off < rx->wire_len[slot]) return;
+        rx->dec_seq++;
+        rx->dec_off = 0;
+    }
+}
+
+// --- Flash ---
+// One erase or program step per call, so the caller keeps draining the UART
+// while a sector erase runs in the background
+
+static void flash_step(OtaRx *rx) {
+    const OtaRxPort *port = rx->port;
+    if (rx->sched.erasing) {
+        int st = port->erase_poll(rx->user);
+        if (st > 0) return;
+        if (st < 0) {
+            RX_LOG(rx, "Erase Error at bank sector %d", rx->sched.erased);
+            rx->failed = true;
+        }
+        flash_sched_erase_done(&rx->sched);
+        return;
+    }
+    if (rx->failed) return;
+
+    // Programs stop at a pending checkpoint until it is stored
+    uint32_t staged = rx->image.out_pos;
+    if (rx->resume_pending && rx->sched.programmed == rx->resume.out_pos) resume_commit(rx);
+    if (rx->resume_pending && staged > rx->resume.out_pos) staged = rx->resume.out_pos;
+
+    // A program step never crosses the end of the staging ring
+    uint32_t pos = rx->sched.programmed % port->stage_size;
+    uint32_t max_len = port->stage_size - pos;
+    if (max_len > OTA_RX_PROGRAM_STEP) max_len = OTA_RX_PROGRAM_STEP;
+
+    uint8_t sector;
+    uint32_t len;
+    switch (flash_sched_next(&rx->sched, staged, max_len, &sector, &len)) {
+        case FLASH_OP_ERASE:
+            port->erase_start(rx->user, sector);
+            break;
+        case FLASH_OP_PROGRAM:
+            if (port->program(rx->user, rx->sched.programmed, &port->stage[pos], len)) {
+                // Hash what the flash now holds, so END needs no second pass
+                ota_crc_update(&rx->flash_crc, port->bank + rx->sched.programmed, len);
+                flash_sched_program_done(&rx->sched, len);
+            } else {
+                RX_LOG(rx, "Flash Write Error at bank offset %08X", rx->sched.programmed);
+                rx->failed = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static bool flash_done(const OtaRx *rx) {
+    return rx->failed || (!rx->sched.erasing && rx->sched.programmed >= rx->sched.image_size);
+}
+
+// --- Frames ---
+
+static void on_start(OtaRx *rx, const uint8_t *payload, uint8_t len) {
+    const OtaRxPort *port = rx->port;
+    // A restarted transfer may find an erase still running
+    while (rx->sched.erasing && port->erase_poll(rx->user) > 0) idle(rx);
+
+    // [Size:4][Window:1][Flags:1][Reserved:2][FileCRC32:4]; older senders
+    // stop after the size or the flags, and without the file CRC the
+    // transfer cannot be resumed.
+    // Size is that of the file sent: raw image, EFZ1 container or EFD1 patch
+    uint32_t file_size = 0;
+    uint32_t file_crc = 0;
+    if (len >= 4) memcpy(&file_size, payload, 4);
+    if (len >= 12) memcpy(&file_crc, &payload[8], 4);
+    uint8_t window_max = (port->window_max && port->window_max < OTA_RX_WINDOW_MAX) ? port->window_max
+                                                                                   : OTA_RX_WINDOW_MAX;
+    rx->window = (len >= 5) ? payload[4] : 0;
+    if (rx->window > window_max) rx->window = window_max;
+    rx->flags = (len >= 6) ? (payload[5] & (OTA_FLAG_CHUNK_CRC | OTA_FLAG_RESUME)) : 0;
+    if (len < 12 || !port->record) rx->flags &= ~OTA_FLAG_RESUME;
+    RX_LOG(rx, "OTA Start. Size: %d Window: %d Flags: %02X", file_size, rx->window, rx->flags);
+
+    rx->verified = false;
+    rx->failed = false;
+    rx->end_pending = false;
+    rx->win_sack = 0;
+    rx->received = 0;
+    rx->chunks = 0;
+    rx->dec_off = 0;
+    // Nothing to program until the image header tells the size
+    memset(&rx->sched, 0, sizeof(rx->sched));
+    ota_crc_begin(&rx->flash_crc, port->crc_hw);
+    ota_image_begin(&rx->image, file_size, port->stage, port->stage_size);
+    if (port->base) ota_image_set_base(&rx->image, port->base, port->base_size);
+    rx->wire_crc = 0;
+    rx->resume_on = (len >= 12 && port->record);
+    rx->resume_pending = false;
+    rx->resume_next = OTA_RX_RESUME_INTERVAL;
+
+    uint32_t resume_from = 0;
+    if (file_size > 0 && (rx->flags & OTA_FLAG_RESUME) && resume_restore(rx, file_size, file_crc)) {
+        resume_from = rx->image.wire_pos;
+    } else {
+        // Nothing is erased before the record is gone
+        rx->flags &= ~OTA_FLAG_RESUME;
+        resume_clear(rx);
+    }
+    rx->resume.file_size = file_size;
+    rx->resume.file_crc = file_crc;
+    rx->win_base = (uint16_t)(resume_from / OTA_RX_CHUNK);
+    rx->dec_seq = rx->win_base;
+    rx->legacy_end = resume_from;
+    rx->received = resume_from;
+    if (file_size == 0) {
+        RX_LOG(rx, "Bad image size %d", file_size);
+        rx->started = false;
+        send_nack(rx);
+        return;
+    }
+    rx->started = true;
+    if (rx->window > 0 || rx->flags) send_ack_start(rx, resume_from); else send_ack(rx);
+}
+
+static void count_chunk(OtaRx *rx, uint32_t len) {
+    rx->received += len;
+    if (++rx->chunks % 64 == 0) { // Log every ~16KB
+        RX_LOG(rx, "Received %dKB...", rx->received / 1024);
+    }
+}
+
+static void on_chunk(OtaRx *rx, const uint8_t *payload, uint8_t len) {
+    uint32_t offset;
+    memcpy(&offset, payload, 4);
+    const uint8_t *data = &payload[4];
+    uint32_t data_len = len - 4;
+
+    if (offset < rx->legacy_end) {
+        send_ack(rx); // Retry of a chunk whose ACK was lost
+        return;
+    }
+    if (offset != rx->legacy_end || rx->failed || offset + data_len > rx->image.wire_size) {
+        RX_LOG(rx, "Chunk rejected at %08X (expected %08X)", offset, rx->legacy_end);
+        send_nack(rx);
+        return;
+    }
+    // The sender waits for the ACK, so hold it until the decoder has
+    // taken the whole chunk, programming to free staging room meanwhile
+    uint32_t used = image_feed(rx, data, data_len);
+    while (used < data_len && !rx->failed) {
+        idle(rx);
+        flash_step(rx);
+        used += image_feed(rx, data + used, data_len - used);
+    }
+    if (rx->failed) {
+        send_nack(rx);
+        return;
+    }
+    rx->legacy_end += data_len;
+    count_chunk(rx, data_len);
+    send_ack(rx);
+}
+
+static void on_wchunk(OtaRx *rx, const uint8_t *payload, uint8_t len) {
+    uint16_t seq;
+    memcpy(&seq, payload, 2);
+    const uint8_t *data = &payload[2];
+    uint32_t data_len = len - 2;
+    int32_t rel = (int32_t)seq - rx->win_base;
+
+    // Chunks behind the base or already held are duplicates of a
+    // retransmit: flash cannot be programmed twice, just re-ack.
+    bool fresh = rel >= 0 && rel < OTA_RX_WINDOW_MAX &&
+                 (rel == 0 || !(rx->win_sack & (1u << (rel - 1))));
+    if (rx->failed) {
+        send_nack(rx); // Fatal for the sender
+        return;
+    }
+    // A chunk with no free slot is left unacknowledged; the sender's
+    // retransmit timer brings it back once decoding caught up
+    uint32_t offset = (uint32_t)seq * OTA_RX_CHUNK;
+    if (fresh && (uint16_t)(seq - rx->dec_seq) < OTA_RX_SLOTS &&
+        data_len <= OTA_RX_CHUNK && offset + data_len <= rx->image.wire_size) {
+        memcpy(rx->wire[seq % OTA_RX_SLOTS], data, data_len);
+        rx->wire_len[seq % OTA_RX_SLOTS] = (uint8_t)data_len;
+        count_chunk(rx, data_len);
+
+        if (rel == 0) {
+            // Slide past every chunk that had arrived ahead of this one
+            rx->win_base++;
+            while (rx->win_sack & 1) { rx->win_sack >>= 1; rx->win_base++; }
+            rx->win_sack >>= 1;
+        } else {
+            rx->win_sack |= 1u << (rel - 1);
+        }
+        wire_decode(rx);
+    }
+    send_wack(rx);
+}
+
+static void on_end(OtaRx *rx, const uint8_t *payload, uint8_t len) {
+    // Checked once the whole file is decoded and in flash
+    uint32_t received = rx->legacy_end;
+    if (rx->window > 0) received = (uint32_t)rx->win_base * OTA_RX_CHUNK;
+    if (len >= 4 && rx->started && received >= rx->image.wire_size) {
+        memcpy(&rx->end_crc, payload, 4);
+        rx->end_pending = true;
+        rx->verified = false;
+    } else {
+        RX_LOG(rx, "OTA End without CRC or before the whole file. Rejecting.");
+        send_nack(rx);
+    }
+}
+
+static void finish_end(OtaRx *rx) {
+    rx->end_pending = false;
+    if (rx->failed) {
+        resume_clear(rx);
+        send_nack(rx);
+        return;
+    }
+    // Accumulated as each step was programmed; a container or patch names
+    // its image CRC, END covers the file as sent
+    uint32_t calculated = ota_crc_value(&rx->flash_crc);
+    uint32_t expected = (rx->image.format != OTA_IMAGE_RAW) ? rx->image.image_crc : rx->end_crc;
+    RX_LOG(rx, "OTA End. Calc: 0x%08X, Expected: 0x%08X, File: 0x%08X/0x%08X",
+           calculated, expected, rx->wire_crc, rx->end_crc);
+    if (calculated == expected && rx->wire_crc == rx->end_crc) {
+        rx->verified = true;
+        resume_clear(rx);
+        send_ack(rx);
+    } else {
+        RX_LOG(rx, "Checksum Mismatch!");
+        send_nack(rx);
+    }
+}
+
+void ota_rx_init(OtaRx *rx, const OtaRxPort *port, void *user) {
+    memset(rx, 0, sizeof(*rx));
+    rx->port = port;
+    rx->user = user;
+}
+
+bool ota_rx_frame(OtaRx *rx, uint8_t cmd, uint8_t *payload, uint8_t len) {
+    // Negotiated chunks carry a CRC32 the frame CRC8 cannot match;
+    // a mismatch is handled like a corrupt frame
+    if (rx->started && (rx->flags & OTA_FLAG_CHUNK_CRC) &&
+        (cmd == CMD_OTA_CHUNK || cmd == CMD_OTA_WCHUNK) && !chunk_crc_ok(payload, &len)) {
+        RX_LOG(rx, "Chunk CRC32 Err: Cmd=%02X Len=%d", cmd, len);
+        ota_rx_frame_error(rx);
+        return true;
+    }
+
+    switch (cmd) {
+        case CMD_OTA_START:
+            on_start(rx, payload, len);
+            return true;
+        case CMD_OTA_CHUNK:
+            if (rx->started && len >= 4) on_chunk(rx, payload, len);
+            return true;
+        case CMD_OTA_WCHUNK:
+            if (rx->started && len >= 2) on_wchunk(rx, payload, len);
+            return true;
+        case CMD_OTA_END:
+            on_end(rx, payload, len);
+            return true;
+        case CMD_OTA_QUERY: {
+            OtaResume r;
+            if (resume_read(rx, &r)) send_progress(rx, r.file_size, r.file_crc, r.wire_pos);
+            else send_progress(rx, 0, 0, 0);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void ota_rx_frame_error(OtaRx *rx) {
+    // While windowed, the sender learns about the loss from the acks
+    if (rx->started && rx->window > 0) send_wack(rx);
+    else send_nack(rx);
+}
+
+bool ota_rx_poll(OtaRx *rx) {
+    if (!rx->started) return false;
+    image_feed(rx, NULL, 0); // A back-reference may be waiting for staging room
+    wire_decode(rx);
+    flash_step(rx);
+    if (rx->end_pending && (rx->failed || (ota_image_done(&rx->image) && flash_done(rx)))) finish_end(rx);
+    // More to do right away: an erase to poll or staged bytes to program
+    return rx->sched.erasing || (!rx->failed && rx->sched.programmed < rx->image.out_pos);
+}
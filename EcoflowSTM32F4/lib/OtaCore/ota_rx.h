@@ -0,0 +1,131 @@
+#ifndef OTA_RX_H
+#define OTA_RX_H
+
+/**
+ * @file ota_rx.h
+ * @author Lollokara
+ * @brief Receiving end of an OTA transfer, shared by the bootloader and the
+ * application's background update.
+ *
+ * Takes the OTA frames the ESP32 sends (START, CHUNK, WCHUNK, END, QUERY),
+ * decodes the file into the staging ring (ota_image.h), erases and programs
+ * the inactive bank one step at a time (flash_sched.h), keeps the progress
+ * record (ota_resume.h) and answers with ACK, NACK, WACK or PROGRESS. The
+ * caller owns the UART and the flash controller: it passes in frames whose
+ * CRC8 checked, calls ota_rx_poll() between them, and provides the flash
+ * and reply operations in an OtaRxPort. CMD_OTA_APPLY stays with the caller,
+ * which checks `verified` first.
+ *
+ * Pure logic, no HAL: Test Scripts/verify_ota_core.py runs transfers through
+ * it against a model of the bank, resets included.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash_sched.h"
+#include "ota_crc.h"
+#include "ota_image.h"
+#include "ota_resume.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_RX_CHUNK 240                      ///< Windowed chunk, OTA_WINDOW_CHUNK
+#define OTA_RX_WINDOW_MAX 16                  ///< Largest window granted
+#define OTA_RX_SLOTS (OTA_RX_WINDOW_MAX * 2)  ///< Windowed chunks held ahead of the decoder
+#define OTA_RX_PROGRAM_STEP 256               ///< Bytes per program step
+#define OTA_RX_RESUME_INTERVAL (16 * 1024)    ///< Image bytes between checkpoints
+
+typedef struct {
+    /** Starts erasing bank sector `sector` (0 = bank start) and returns. */
+    void (*erase_start)(void *user, uint8_t sector);
+    /** The erase started last: 1 running, 0 done, -1 failed. */
+    int (*erase_poll)(void *user);
+    /**
+     * Programs `len` bytes at bank offset `offset`, a word boundary. Words
+     * that already hold their value must be skipped: a resumed transfer
+     * repeats what it had programmed past its last checkpoint.
+     */
+    bool (*program)(void *user, uint32_t offset, const uint8_t *data, uint32_t len);
+    /** Sends one frame in the caller's framing. */
+    void (*reply)(void *user, uint8_t cmd, const uint8_t *payload, uint8_t len);
+    /** Called from loops that wait or hash: watchdog, yield. May be NULL. */
+    void (*idle)(void *user);
+    /** printf-style diagnostics. May be NULL. */
+    void (*log)(const char *fmt, ...);
+
+    uint8_t *stage;                 ///< Staging ring, at least 64 KB for EFZ1 windows
+    uint32_t stage_size;
+    const uint8_t *bank;            ///< Inactive bank as mapped for reading
+    const uint8_t *base;            ///< Active bank; EFD1 patches apply to it
+    uint32_t base_size;
+    const OtaCrcHw *crc_hw;         ///< NULL: software CRC
+    volatile uint32_t *record;      ///< OTA_RESUME_WORDS words that survive a reset; NULL: no resume
+    uint8_t window_max;             ///< Largest window granted; 0: OTA_RX_WINDOW_MAX
+} OtaRxPort;
+
+typedef struct {
+    const OtaRxPort *port;
+    void *user;
+
+    // Transfer
+    bool started;
+    bool verified;           ///< END matched; the bank can be swapped in
+    bool failed;             ///< Flash error or unusable image, fatal for the transfer
+    bool end_pending;        ///< END received, waiting for the flash to catch up
+    uint32_t end_crc;
+    uint8_t window;          ///< Granted at START, 0 = stop-and-wait
+    uint8_t flags;           ///< OTA_FLAG_* accepted at START
+    uint16_t win_base;       ///< First chunk not yet received
+    uint32_t win_sack;       ///< Bit i: chunk win_base + 1 + i received
+    uint32_t legacy_end;     ///< Stop-and-wait: bytes [0, legacy_end) decoded
+    uint32_t received;       ///< File bytes received, for progress logs
+    uint32_t chunks;
+
+    // Windowed chunks are decoded in sequence as the staging ring makes room
+    uint8_t wire[OTA_RX_SLOTS][OTA_RX_CHUNK];
+    uint8_t wire_len[OTA_RX_SLOTS];
+    uint16_t dec_seq;        ///< First chunk not fully decoded
+    uint8_t dec_off;         ///< Bytes of it already decoded
+
+    // File as sent -> image in the staging ring -> bank
+    OtaImage image;
+    uint32_t wire_crc;       ///< Over the file as sent, for END
+    FlashSched sched;
+    OtaCrc flash_crc;        ///< Over the flash contents, as programmed
+
+    // Progress record
+    OtaResume resume;        ///< File of this transfer, then the pending checkpoint
+    bool resume_on;          ///< START named the file
+    bool resume_pending;     ///< Checkpoint waiting for the flash to reach it
+    uint32_t resume_next;    ///< Image offset of the next checkpoint
+} OtaRx;
+
+void ota_rx_init(OtaRx *rx, const OtaRxPort *port, void *user);
+
+/**
+ * @brief Handles one OTA frame whose CRC8 checked.
+ * @param payload Frame payload; a chunk CRC32 is checked and stripped in place.
+ * @return false for commands it does not handle (CMD_OTA_APPLY, non-OTA).
+ */
+bool ota_rx_frame(OtaRx *rx, uint8_t cmd, uint8_t *payload, uint8_t len);
+
+/**
+ * @brief A frame failed its CRC8: WACK while windowed, NACK otherwise.
+ */
+void ota_rx_frame_error(OtaRx *rx);
+
+/**
+ * @brief One decode and flash step; answers a pending END once the image
+ * is in flash.
+ * @return true while an erase runs or staged bytes wait to be programmed;
+ * otherwise nothing happens until the next frame.
+ */
+bool ota_rx_poll(OtaRx *rx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_RX_H
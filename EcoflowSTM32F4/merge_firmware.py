@@ -1,4 +1,5 @@
 import os
+import sys
 
 Import("env")
 
@@ -59,6 +60,29 @@ def merge_firmware(source, target, env):
 
         print(f"Factory firmware created at: {output_path}")
 
+        # Compressed copy for the OTA upload (bootloader decodes it on the fly)
+        tools_dir = os.path.join(env.subst("$PROJECT_DIR"), "..", "Test Scripts", "tools")
+        sys.path.insert(0, tools_dir)
+        import ota_pack
+        with open(output_path, "rb") as f:
+            image = f.read()
+        efz_path = os.path.splitext(output_path)[0] + ".efz"
+        efz = ota_pack.pack(image)
+        with open(efz_path, "wb") as f:
+            f.write(efz)
+        print(f"OTA image created at: {efz_path} ({len(efz)} of {len(image)} bytes)")
+
+        # Patch against the image the device runs, when told which one
+        base_path = os.environ.get("OTA_PATCH_BASE")
+        if base_path:
+            with open(base_path, "rb") as f:
+                base = f.read()
+            efd_path = os.path.splitext(output_path)[0] + ".efd"
+            efd = ota_pack.pack(image, base=base)
+            with open(efd_path, "wb") as f:
+                f.write(efd)
+            print(f"OTA patch created at: {efd_path} ({len(efd)} of {len(image)} bytes, base {base_path})")
+
     except Exception as e:
         print(f"Error merging firmware: {e}")
         env.Exit(1)
@@ -162,24 +162,71 @@ bool Flash_CopyBootloader(void) {
     return true;
 }
 
+// Option bytes are written by hand, as the bootloader does: HAL's USER
+// option path rewrites the low byte of OPTCR without BFB2.
 void Flash_SwapBank(void) {
-    FLASH_OBProgramInitTypeDef OBInit;
-
     HAL_FLASH_Unlock();
     HAL_FLASH_OB_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                           FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
 
-    HAL_FLASHEx_OBGetConfig(&OBInit);
-
-    // Toggle BFB2
-    if ((OBInit.USERConfig & FLASH_OPTCR_BFB2) == FLASH_OPTCR_BFB2) {
-        OBInit.USERConfig &= ~FLASH_OPTCR_BFB2;
-    } else {
-        OBInit.USERConfig |= FLASH_OPTCR_BFB2;
-    }
+    uint32_t optcr = FLASH->OPTCR ^ FLASH_OPTCR_BFB2; // Toggle BFB2
+    optcr &= ~FLASH_OPTCR_OPTSTRT;
 
-    OBInit.OptionType = OPTIONBYTE_USER;
+    __disable_irq();
+    FLASH->OPTCR = optcr;
+    FLASH->OPTCR |= FLASH_OPTCR_OPTSTRT;
+    while (FLASH->SR & FLASH_SR_BSY);
 
-    HAL_FLASHEx_OBProgram(&OBInit);
     HAL_FLASH_OB_Launch();
     HAL_NVIC_SystemReset();
 }
+
+// Physical sector at offset 0 of the inactive bank
+uint32_t Flash_InactiveFirstSector(void) {
+    return (Flash_GetActiveBank() == 0) ? FLASH_SECTOR_12 : FLASH_SECTOR_0;
+}
+
+// Starts a sector erase and returns; Flash_ErasePoll() reports the outcome
+void Flash_EraseStart(uint32_t sector) {
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                           FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    FLASH_Erase_Sector(sector, FLASH_VOLTAGE_RANGE_3);
+}
+
+// 1 while erasing, 0 done, -1 failed
+int Flash_ErasePoll(void) {
+    if (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) return 1;
+    CLEAR_BIT(FLASH->CR, (FLASH_CR_SER | FLASH_CR_SNB));
+    int result = 0;
+    if (FLASH->SR & (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
+                     FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)) {
+        __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
+                               FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+        result = -1;
+    }
+    // HAL flushes the caches after an erase; the erase above bypassed it
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+    __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+    return result;
+}
+
+// Word program that skips words already holding their value, so a resumed
+// transfer can repeat a stretch it had programmed
+bool Flash_ProgramWords(uint32_t addr, const uint8_t *data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i += 4) {
+        uint32_t data_word = 0xFFFFFFFF;
+        uint8_t bytes_to_copy = (length - i < 4) ? (length - i) : 4;
+        memcpy(&data_word, &data[i], bytes_to_copy);
+        if (*(__IO uint32_t*)(addr + i) == data_word) continue;
+
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + i, data_word) != HAL_OK) {
+            return false;
+        }
+    }
+    return true;
+}
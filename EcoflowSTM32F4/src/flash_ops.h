@@ -13,4 +13,10 @@ bool Flash_CopyBootloader(void);
 bool Flash_PrepareOTA(void);
 void Flash_SwapBank(void);
 
+// Background OTA into the inactive bank, mapped at 0x08100000
+uint32_t Flash_InactiveFirstSector(void);
+void Flash_EraseStart(uint32_t sector);
+int Flash_ErasePoll(void);
+bool Flash_ProgramWords(uint32_t addr, const uint8_t *data, uint32_t length);
+
 #endif
@@ -1,6 +1,11 @@
 #include "log_manager.h"
+#include "log_record.h"
+#include "log_index.h"
+#include "log_levels.h"
+#include "ota_crc.h"
 #include "ff.h"
 #include "uart_task.h"
+#include "telemetry.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
@@ -8,10 +13,56 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stddef.h>
 
 #define MAX_LOG_SIZE (5 * 1024 * 1024)
 #define LOG_FILENAME "current.log"
 
+// Rotation: log_N numbers come from an index file instead of probing names,
+// and each new log is allocated in one contiguous run up front
+#define LOG_INDEX_NAME  "log.idx"
+#define LOG_INDEX_MAGIC 0x5844494C                  // "LIDX"
+#define LOG_PREALLOC    (MAX_LOG_SIZE + LOG_RING_SIZE) // A file rotates within one flush past MAX_LOG_SIZE
+#define LOG_MIN_FREE    (4 * MAX_LOG_SIZE)          // Below this the oldest logs are deleted
+
+// Download streaming: sequential block reads, chunks sent as credit allows
+#define DL_BLOCK_SIZE   4096   // One f_read, a multiple of the sector size
+#define DL_BURST        8      // Chunks per LogManager_Process call
+#define DL_IDLE_TIMEOUT 10000  // ms without credit before the download is dropped
+#define DL_CLMT_SIZE    256    // Fast seek map: room for 127 cluster runs
+
+// Sidecar index (log_index.h): an entry per LOG_IDX_SEGMENT of log, written
+// as the records go to the card; current.lix becomes log_N.lix at rotation
+#define LOG_IDX_CURRENT "current.lix"
+
+// Search: stepped from LogManager_Process, reading only segments the index
+// does not rule out
+#define SEARCH_STEP_BYTES 8192   // Log and index read per LogManager_Process call
+#define SEARCH_BUF_SIZE   1024   // Read window; a record fits from any offset in its first sector
+#define SEARCH_PLAIN_SEGS 8      // Segments none of which the index ruled out: scan the rest without it
+
+// Buffered writer: records (log_record.h) go to a RAM ring, the log task
+// writes them out in whole sectors so FatFs hands full sectors straight to
+// the card
+#define LOG_RING_SIZE     32768  // Power of two, a multiple of the sector size
+#define LOG_RING_MAGIC    0x4C4F4753  // Bumped when the ring switched from text to records
+#define LOG_SECTOR        512
+#define LOG_FLUSH_SECTORS 16     // Write once this many whole sectors are buffered
+#define LOG_FLUSH_MS      1000   // Write everything once the oldest line is this old
+#define LOG_POLL_MS       250    // Log task wakeup without a kick
+#define LOG_COALESCE_MS   100    // Log task rest after an urgent write; a burst of errors shares one
+#define LOG_STARVED_MS    5000   // Log task has not run: the UART task writes instead
+
+// Level gate (log_levels.h), kept on the card as [Magic:4][Table][CRC32:4]
+#define LOG_LEVELS_NAME   "loglevel.cfg"
+#define LOG_LEVELS_MAGIC  0x4C564C4C  // "LLVL"
+
+// CCM RAM, not cleared at startup (stm32f469ni_flash.ld) and unused by the
+// bootloader, so a watchdog or software reset leaves the ring intact
+#ifndef LOG_RING_SECTION
+#define LOG_RING_SECTION __attribute__((section(".ccm_noinit")))
+#endif
+
 extern char SDPath[4];
 extern FATFS SDFatFs;
 
@@ -20,26 +71,132 @@ void LogManager_Write(uint8_t level, const char* tag, const char* message);
 static void LogManager_Write_Internal(uint8_t level, const char* tag, const char* message);
 void LogManager_WriteSessionHeader(void);
 void LogManager_ForceRotate(void);
+static FRESULT LogManager_OpenCurrent(void);
+static void LogManager_IndexLoad(void);
+static bool LogManager_LevelsLoad(void);
+static void LogManager_LevelsSave(void);
+static void LogManager_IdxStart(uint32_t seg, uint8_t flags);
+static void LogManager_SearchStep(void);
+static void LogManager_EndSearch(uint8_t status);
+static void LogManager_CloseDownload(const char* why);
 
 static FIL LogFile;
 static bool LogOpen = false;
 static bool TriggerSessionHeader = false;
 static SemaphoreHandle_t LogMutex = NULL;
 
+// Rotation index, kept in LOG_INDEX_NAME. Rebuilt from the directory when
+// the file is missing or damaged, e.g. on a card from older firmware.
+typedef struct {
+    uint32_t magic;
+    uint32_t next;    // Number the next rotated log gets
+    uint32_t oldest;  // Lowest number that may still be on the card
+    uint32_t crc;     // ota_crc32 of the fields above
+} LogIndexFile;
+static LogIndexFile LogIndex;
+
+// Write ring. Bytes [tail, head) are not on the card yet; tail moves once
+// f_sync has them, so after a reset the ring still holds what was lost.
+typedef struct {
+    uint32_t magic;
+    uint32_t head;
+    uint32_t tail;
+    uint8_t buf[LOG_RING_SIZE];
+} LogRingState;
+static LogRingState LogRing LOG_RING_SECTION;
+static SemaphoreHandle_t RingMutex = NULL;  // Guards head/tail; held for copies only
+static SemaphoreHandle_t LogKick = NULL;    // Wakes the log task early
+static bool RingReady = false;
+static bool RingUrgent = false;             // Error line: write everything now
+static uint32_t RingOldest = 0;             // Tick the ring last became non-empty
+static uint32_t RingDropped = 0;            // Lines lost to a full ring
+static uint32_t RingRecovered = 0;          // Bytes found in the ring at boot
+
+// Which lines reach the ring, checked before they are packed. Every level
+// until LOG_LEVELS_NAME says otherwise.
+static LogLevels Levels;
+static SemaphoreHandle_t LevelMutex = NULL;
+
+// Sidecar index of current.log: entries of closed segments are on the card,
+// the open one is kept here
+static LogIdxEntry IdxOpen;             // Entry of segment IdxSeg
+static uint32_t IdxSeg = 0;
+static uint32_t IdxNext = 0;            // File offset of the next record to index
+static bool IdxReady = false;           // The state above belongs to current.log
+static bool IdxLost = false;            // Lost track of the records: no entries until the next log
+static uint8_t IdxRec[LOG_REC_MAX];
+
 // Download State
 static bool Downloading = false;
 static FIL DownloadFile;
 static char DownloadName[32];
 static uint32_t DownloadOffset = 0;
 static uint32_t DownloadSize = 0;
-
-// Sync State
-static uint32_t LastSyncTime = 0;
+static uint32_t DownloadLimit = 0;      // Credit: bytes below this may be sent
+static bool DownloadEofSent = false;    // Kept open until the ESP32 confirms the end
+static uint32_t DownloadLastCredit = 0;
+static uint8_t DownloadBlock[DL_BLOCK_SIZE];
+static uint32_t DownloadBlockStart = 0; // File offset of DownloadBlock[0]
+static uint32_t DownloadBlockLen = 0;
+static DWORD DownloadClmt[DL_CLMT_SIZE];
+
+// Search State
+static bool Searching = false;
+static FIL SearchFile;
+static FIL SearchIdxFile;
+static bool SearchIdxOpen = false;
+static char SearchName[32];
+static LogQuery SearchQuery;
+static uint8_t SearchId = 0;
+static uint16_t SearchMax = 0;
+static uint32_t SearchSize = 0;         // File size when the search started
+static uint32_t SearchSeg = 0;          // Next segment to decide on
+static uint32_t SearchSkipped = 0;      // Segments the index ruled out
+static uint32_t SearchSegs = 0;         // Entries in the sidecar
+static bool SearchHaveOpen = false;     // current.log: the open segment's entry, copied at the start
+static LogIdxEntry SearchOpen;
+static uint32_t SearchOpenSeg = 0;
+static uint32_t SearchPos = 0;          // Next record, while scanning
+static uint32_t SearchStop = 0;         // Scan records that start before this
+static bool SearchExact = false;        // SearchPos is known to be a record start
+static uint32_t SearchMatches = 0;
+static uint32_t SearchRead = 0;         // Bytes of log and index read
+static uint8_t SearchBuf[SEARCH_BUF_SIZE];
+static uint32_t SearchBufStart = 0;
+static uint32_t SearchBufLen = 0;
+static uint8_t SearchPage[MAX_PAYLOAD_LEN + 4];
+static DWORD SearchClmt[DL_CLMT_SIZE];
+
+// List State: the directory stays open between pages read in order
+static DIR ListDir;
+static bool ListOpen = false;
+static uint16_t ListNext = 0;   // List index of the next log entry ListDir returns
+static uint16_t ListTotal = 0;
 
 void LogManager_Init(void) {
     if (LogMutex == NULL) {
         LogMutex = xSemaphoreCreateMutex();
     }
+    if (RingMutex == NULL) {
+        RingMutex = xSemaphoreCreateMutex();
+        LogKick = xSemaphoreCreateBinary();
+    }
+    if (LevelMutex == NULL) {
+        log_levels_init(&Levels, LOG_LEVELS_VERBOSE);
+        LevelMutex = xSemaphoreCreateMutex();
+    }
+    if (!RingReady) {
+        // Anything but a power cycle keeps CCM RAM; pick up what never reached the card
+        if (LogRing.magic == LOG_RING_MAGIC && LogRing.head - LogRing.tail <= LOG_RING_SIZE) {
+            RingRecovered = LogRing.head - LogRing.tail;
+        } else {
+            LogRing.magic = LOG_RING_MAGIC;
+            LogRing.head = 0;
+            LogRing.tail = 0;
+        }
+        RingOldest = xTaskGetTickCount();
+        RingReady = true;
+    }
 
     if (xSemaphoreTake(LogMutex, portMAX_DELAY) != pdTRUE) return;
 
@@ -77,13 +234,22 @@ void LogManager_Init(void) {
         return;
     }
 
+    LogManager_IndexLoad();
+    // A card without the file (new, or just formatted) gets the levels in use
+    if (!LogManager_LevelsLoad()) LogManager_LevelsSave();
+
     // Open current log
-    res = f_open(&LogFile, LOG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE | FA_READ);
+    res = LogManager_OpenCurrent();
     printf("LogManager: f_open res=%d\n", res);
 
     if (res == FR_OK) {
-        f_lseek(&LogFile, f_size(&LogFile)); // Append
-        LogOpen = true;
+
+        if (RingRecovered) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "%lu bytes above recovered after reset", RingRecovered);
+            LogManager_Write_Internal(1, "SYS", msg);
+            RingRecovered = 0;
+        }
 
         // Check size
         if (f_size(&LogFile) > MAX_LOG_SIZE) {
@@ -117,92 +283,671 @@ void LogManager_WriteSessionHeader(void) {
     UART_SendRaw(buf, len);
 }
 
-void LogManager_ForceRotate(void) {
-    if (xSemaphoreTake(LogMutex, portMAX_DELAY) != pdTRUE) return;
+// Number of a rotated log, log_N.log or log_N.txt
+static bool LogManager_LogNumber(const char* name, uint32_t* n) {
+    if (strncmp(name, "log_", 4) != 0 || name[4] < '0' || name[4] > '9') return false;
+    uint32_t v = 0;
+    const char* p = name + 4;
+    while (*p >= '0' && *p <= '9') v = v * 10 + (uint32_t)(*p++ - '0');
+    if (strcmp(p, ".log") != 0 && strcmp(p, ".txt") != 0) return false;
+    *n = v;
+    return true;
+}
 
-    if (LogOpen) {
-        f_close(&LogFile);
-        LogOpen = false;
+static void LogManager_IndexSave(void) {
+    LogIndex.magic = LOG_INDEX_MAGIC;
+    LogIndex.crc = ota_crc32(0, (const uint8_t*)&LogIndex, offsetof(LogIndexFile, crc));
+    FIL f;
+    if (f_open(&f, LOG_INDEX_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return;
+    UINT bw;
+    f_write(&f, &LogIndex, sizeof(LogIndex), &bw);
+    f_close(&f);
+}
+
+// One pass over the directory for the lowest and highest log number
+static void LogManager_IndexRebuild(void) {
+    DIR dir;
+    FILINFO fno;
+    uint32_t lo = UINT32_MAX, hi = 0, n;
+    bool any = false;
+    if (f_opendir(&dir, SDPath[0] ? SDPath : "0:/") == FR_OK) {
+        while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+            if (!LogManager_LogNumber(fno.fname, &n)) continue;
+            if (n < lo) lo = n;
+            if (n > hi) hi = n;
+            any = true;
+        }
+        f_closedir(&dir);
     }
+    LogIndex.next = any ? hi + 1 : 0;
+    LogIndex.oldest = any ? lo : 0;
+    printf("LogManager: index rebuilt, next=%lu oldest=%lu\n", LogIndex.next, LogIndex.oldest);
+    LogManager_IndexSave();
+}
 
-    // Rename current.log to log_N.txt
+static void LogManager_IndexLoad(void) {
+    FIL f;
+    UINT br = 0;
+    bool ok = false;
+    if (f_open(&f, LOG_INDEX_NAME, FA_READ) == FR_OK) {
+        ok = f_read(&f, &LogIndex, sizeof(LogIndex), &br) == FR_OK && br == sizeof(LogIndex) &&
+             LogIndex.magic == LOG_INDEX_MAGIC &&
+             LogIndex.crc == ota_crc32(0, (const uint8_t*)&LogIndex, offsetof(LogIndexFile, crc));
+        f_close(&f);
+    }
+    if (!ok) LogManager_IndexRebuild();
+}
+
+static bool LogManager_LevelsLoad(void) {
+    uint8_t buf[8 + LOG_LEVELS_PACKED_MAX];
+    FIL f;
+    UINT br = 0;
+    if (f_open(&f, LOG_LEVELS_NAME, FA_READ) != FR_OK) return false;
+    FRESULT res = f_read(&f, buf, sizeof(buf), &br);
+    f_close(&f);
+
+    uint32_t magic, crc;
+    if (res != FR_OK || br < 10) return false;
+    memcpy(&magic, buf, 4);
+    memcpy(&crc, &buf[br - 4], 4);
+    if (magic != LOG_LEVELS_MAGIC || crc != ota_crc32(0, buf, br - 4)) return false;
+
+    xSemaphoreTake(LevelMutex, portMAX_DELAY);
+    bool ok = log_levels_unpack(&Levels, &buf[4], (int)br - 8);
+    xSemaphoreGive(LevelMutex);
+    return ok;
+}
+
+// Assumes LogMutex is held
+static void LogManager_LevelsSave(void) {
+    uint8_t buf[8 + LOG_LEVELS_PACKED_MAX];
+    uint32_t magic = LOG_LEVELS_MAGIC;
+    memcpy(buf, &magic, 4);
+    int len = 4 + LogManager_GetLevels(&buf[4]);
+    uint32_t crc = ota_crc32(0, buf, len);
+    memcpy(&buf[len], &crc, 4);
+
+    FIL f;
+    if (f_open(&f, LOG_LEVELS_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return;
+    UINT bw;
+    f_write(&f, buf, len + 4, &bw);
+    f_close(&f);
+}
+
+// Renames current.log to log_N.<ext>, N from the index
+static void LogManager_Retire(const char* ext) {
     char new_name[32];
-    int i = 0;
-    while(1) {
-        sprintf(new_name, "log_%d.txt", i);
-        FILINFO fno;
-        if (f_stat(new_name, &fno) != FR_OK) break; // Found free slot
-        i++;
-        if(i > 999) break; // Safety
+    for (int attempt = 0; attempt < 2; attempt++) {
+        sprintf(new_name, "log_%lu.%s", LogIndex.next, ext);
+        FRESULT res = f_rename(LOG_FILENAME, new_name);
+        if (res == FR_OK) {
+            if (strcmp(ext, "log") == 0) {
+                sprintf(new_name, "log_%lu.lix", LogIndex.next);
+                f_unlink(new_name);
+                f_rename(LOG_IDX_CURRENT, new_name);
+            } else {
+                f_unlink(LOG_IDX_CURRENT);
+            }
+            LogIndex.next++;
+            LogManager_IndexSave();
+            return;
+        }
+        if (res != FR_EXIST) break;
+        LogManager_IndexRebuild(); // Stale index: files were added behind its back
     }
+    printf("LogManager: rotate to %s failed\n", new_name);
+}
 
-    f_rename(LOG_FILENAME, new_name);
+// Ends a search or download still reading a log that is about to be deleted:
+// FF_FS_LOCK is 0, so f_unlink frees the clusters under the open file and the
+// next f_expand can hand them to a new log. The active log is not reopened,
+// as this runs in the middle of a rotation.
+static void LogManager_ReleaseFile(const char* name) {
+    if (Searching && strcmp(name, SearchName) == 0) LogManager_EndSearch(LOG_SEARCH_NO_FILE);
+    if (Downloading && strcmp(name, DownloadName) == 0) LogManager_CloseDownload("File pruned");
+}
 
-    // Open new
-    if (f_open(&LogFile, LOG_FILENAME, FA_CREATE_ALWAYS | FA_WRITE | FA_READ) == FR_OK) {
+// Deletes the oldest logs, keeping the newest rotated one, while the card is short of space
+static void LogManager_Prune(void) {
+    FATFS* fs;
+    DWORD free_clst;
+    bool changed = false;
+    while (LogIndex.oldest + 1 < LogIndex.next &&
+           f_getfree(SDPath, &free_clst, &fs) == FR_OK &&
+           (uint64_t)free_clst * fs->csize * FF_MAX_SS < LOG_MIN_FREE) {
+        char name[32];
+        sprintf(name, "log_%lu.log", LogIndex.oldest);
+        LogManager_ReleaseFile(name);
+        if (f_unlink(name) != FR_OK) {
+            sprintf(name, "log_%lu.txt", LogIndex.oldest);
+            LogManager_ReleaseFile(name);
+            f_unlink(name);
+        }
+        sprintf(name, "log_%lu.lix", LogIndex.oldest);
+        f_unlink(name);
+        LogIndex.oldest++;
+        changed = true;
+    }
+    if (changed) LogManager_IndexSave();
+}
+
+// Copies `len` ring bytes from position `pos`, across the wrap
+static void LogManager_RingCopy(uint32_t pos, uint8_t* out, uint32_t len) {
+    for (uint32_t done = 0; done < len; ) {
+        uint32_t at = (pos + done) & (LOG_RING_SIZE - 1);
+        uint32_t span = LOG_RING_SIZE - at;
+        if (span > len - done) span = len - done;
+        memcpy(out + done, &LogRing.buf[at], span);
+        done += span;
+    }
+}
+
+// Where the first whole record starts in the bytes the ring has not written
+// yet: after a reset or a partial flush the ring may begin mid-record. The
+// records from there must run exactly up to head. -1 if none do.
+static int LogManager_RingBoundary(void) {
+    xSemaphoreTake(RingMutex, portMAX_DELAY);
+    uint32_t tail = LogRing.tail;
+    uint32_t n = LogRing.head - tail;
+    xSemaphoreGive(RingMutex);
+
+    for (uint32_t p = 0; p < n && p < LOG_REC_MAX; p++) {
+        uint32_t at = p;
+        while (at < n) {
+            uint8_t hdr[LOG_REC_HDR];
+            uint32_t have = n - at < LOG_REC_HDR ? n - at : LOG_REC_HDR;
+            LogManager_RingCopy(tail + at, hdr, have);
+            int len = log_rec_check(hdr, (int)have);
+            if (len <= 0) break;
+            at += len;
+        }
+        if (at == n) return (int)p;
+    }
+    return n ? -1 : 0;
+}
+
+// Starts indexing current.log at its end, with segment `seg` open; the
+// entries before it are on the card
+static void LogManager_IdxStart(uint32_t seg, uint8_t flags) {
+    int p = LogManager_RingBoundary();
+    IdxLost = p < 0;
+    IdxNext = f_size(&LogFile) + (p > 0 ? (uint32_t)p : 0);
+    IdxSeg = seg;
+    log_idx_init(&IdxOpen, seg ? seg * LOG_IDX_SEGMENT : LOG_FILE_MAGIC_LEN,
+                 flags | (p > 0 ? LOG_IDX_PARTIAL : 0));
+    IdxReady = true;
+}
+
+static void LogManager_IdxWrite(uint32_t seg, const LogIdxEntry* e) {
+    LogIdxEntry entry = *e;
+    log_idx_seal(&entry);
+    FIL f;
+    UINT bw;
+    if (f_open(&f, LOG_IDX_CURRENT, FA_OPEN_ALWAYS | FA_WRITE) != FR_OK) return;
+    if (f_lseek(&f, seg * sizeof(entry)) == FR_OK) f_write(&f, &entry, sizeof(entry), &bw);
+    f_close(&f);
+}
+
+// The open segment's entry onto the card, as current.log is closed for good
+static void LogManager_IdxClose(void) {
+    if (IdxReady && !IdxLost) LogManager_IdxWrite(IdxSeg, &IdxOpen);
+    IdxReady = false;
+}
+
+// Indexes the records that start in [base, base + done) of current.log, just
+// written from the ring at `tail`; they are whole within its `avail` bytes.
+// Assumes LogMutex is held.
+static void LogManager_IdxRecords(uint32_t base, uint32_t tail, uint32_t avail, uint32_t done) {
+    while (IdxReady && !IdxLost && IdxNext < base + done) {
+        uint32_t off = IdxNext - base;
+        int len = -1;
+        if (IdxNext >= base && avail - off >= LOG_REC_HDR) {
+            LogManager_RingCopy(tail + off, IdxRec, LOG_REC_HDR);
+            len = log_rec_check(IdxRec, LOG_REC_HDR);
+        }
+        if (len <= 0 || (uint32_t)len > avail - off) {
+            IdxLost = true;
+            printf("LogManager: index lost track at %lu\n", IdxNext);
+            break;
+        }
+        LogManager_RingCopy(tail + off + LOG_REC_HDR, IdxRec + LOG_REC_HDR, len - LOG_REC_HDR);
+
+        uint32_t seg = IdxNext / LOG_IDX_SEGMENT;
+        if (seg != IdxSeg) {
+            // Records are shorter than a segment: this is the next one
+            LogManager_IdxWrite(IdxSeg, &IdxOpen);
+            IdxSeg = seg;
+            log_idx_init(&IdxOpen, IdxNext, 0);
+        }
+        log_idx_add(&IdxOpen, IdxRec, len);
+        IdxNext += len;
+    }
+}
+
+// Creates an empty current.log: just the magic, records follow. The whole
+// file is allocated first, as one contiguous cluster run, so appending
+// never touches the FAT. f_expand sets the file size to what it allocated;
+// it is put back to 0 and writes then follow the chain already there.
+//
+// Invariant from here on: the size in the directory entry is the logical
+// end of the log, every byte below it was written by us, and the chain may
+// run on past it. f_sync only ever stores that size, so after a reset the
+// file reopens at the last synced end and appending continues into the
+// same run (FatFs follows a link that is already there instead of
+// allocating). The clusters past the end are freed by
+// LogManager_TrimLocked when the log is rotated.
+static FRESULT LogManager_CreateCurrent(void) {
+    FRESULT res = f_open(&LogFile, LOG_FILENAME, FA_CREATE_ALWAYS | FA_WRITE | FA_READ);
+    if (res != FR_OK) return res;
+    if (f_expand(&LogFile, LOG_PREALLOC, 1) == FR_OK) {
+        // f_expand only allocates. Zeroing the size is only sound while the
+        // pointer still sits at the start of the chain; should that ever
+        // change, give the run back and grow as needed.
+        if (LogFile.fptr == 0 && LogFile.clust == 0) {
+            LogFile.obj.objsize = 0;
+        } else {
+            printf("LogManager: f_expand moved the file pointer, no preallocation\n");
+            f_lseek(&LogFile, 0);
+            f_truncate(&LogFile);
+        }
+    } // else no contiguous run that long is free; grow as needed
+    UINT bw = 0;
+    res = f_write(&LogFile, LOG_FILE_MAGIC, LOG_FILE_MAGIC_LEN, &bw);
+    if (res == FR_OK && bw == LOG_FILE_MAGIC_LEN) {
+        f_sync(&LogFile); // Directory entry owns the chain before anything else happens
         LogOpen = true;
+        FIL idx;
+        if (f_open(&idx, LOG_IDX_CURRENT, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK) f_close(&idx);
+        LogManager_IdxStart(0, 0);
+        return FR_OK;
+    }
+    f_close(&LogFile);
+    return res != FR_OK ? res : FR_DISK_ERR;
+}
+
+// Frees the preallocated clusters past the end of the file: grows it over
+// them, then truncates back
+static void LogManager_TrimLocked(void) {
+    FSIZE_t end = f_size(&LogFile);
+    if (end < LOG_PREALLOC && f_lseek(&LogFile, LOG_PREALLOC) == FR_OK) {
+        f_lseek(&LogFile, end);
+        f_truncate(&LogFile);
+    }
+}
+
+// Opens current.log for appending. A text log from older firmware is kept
+// as log_N.txt and a binary one started in its place.
+static FRESULT LogManager_OpenCurrent(void) {
+    FRESULT res = f_open(&LogFile, LOG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE | FA_READ);
+    if (res != FR_OK) return res;
+    if (f_size(&LogFile) == 0) {
+        f_close(&LogFile);
+        return LogManager_CreateCurrent();
+    }
+
+    char magic[LOG_FILE_MAGIC_LEN];
+    UINT br = 0;
+    if (f_read(&LogFile, magic, sizeof(magic), &br) != FR_OK || br != sizeof(magic) ||
+        memcmp(magic, LOG_FILE_MAGIC, sizeof(magic)) != 0) {
+        f_close(&LogFile);
+        LogManager_Retire("txt");
+        return LogManager_CreateCurrent();
+    }
+
+    f_lseek(&LogFile, f_size(&LogFile)); // Append
+    LogOpen = true;
+    if (!IdxReady) {
+        // Boot: carry on after the entries on the card. The segment that was
+        // open has records no entry covers.
+        FIL idx;
+        LogIdxEntry last;
+        UINT br = 0;
+        uint32_t k = 0;
+        if (f_open(&idx, LOG_IDX_CURRENT, FA_READ) == FR_OK) {
+            k = f_size(&idx) / sizeof(LogIdxEntry);
+            if (k && (f_lseek(&idx, (k - 1) * sizeof(LogIdxEntry)) != FR_OK ||
+                      f_read(&idx, &last, sizeof(last), &br) != FR_OK || br != sizeof(last) ||
+                      !log_idx_valid(&last))) {
+                k--;
+            }
+            f_close(&idx);
+        }
+        uint32_t seg = f_size(&LogFile) / LOG_IDX_SEGMENT;
+        for (; k < seg; k++) {
+            LogIdxEntry gap; // Entry lost with the reset
+            log_idx_init(&gap, k ? k * LOG_IDX_SEGMENT : LOG_FILE_MAGIC_LEN, LOG_IDX_PARTIAL);
+            LogManager_IdxWrite(k, &gap);
+        }
+        LogManager_IdxStart(seg, LOG_IDX_PARTIAL);
+    }
+    return FR_OK;
+}
+
+// Renames current.log to the next log_N.log and starts a new one.
+// Assumes LogMutex is held and the ring was written out.
+static void LogManager_RotateLocked(void) {
+    if (LogOpen) {
+        LogManager_IdxClose();
+        LogManager_TrimLocked();
+        f_close(&LogFile);
+        LogOpen = false;
     }
 
+    LogManager_Retire("log");
+    LogManager_Prune();
+    LogManager_CreateCurrent();
+
     if (LogOpen) {
         LogManager_WriteSessionHeader(); // Calls Write_Internal
     }
+}
 
+// Writes buffered lines to the log file and syncs it. Unless `all`, only up
+// to the last sector boundary of the file, so every sector is written once.
+// Assumes LogMutex is held.
+static void LogManager_FlushLocked(bool all) {
+    if (!LogOpen || !RingReady) return;
+
+    xSemaphoreTake(RingMutex, portMAX_DELAY);
+    uint32_t tail = LogRing.tail;
+    uint32_t n = LogRing.head - tail;
+    xSemaphoreGive(RingMutex);
+    uint32_t avail = n;     // Whole records
+    uint32_t base = f_size(&LogFile);
+
+    if (!all) {
+        // Top up the file's last sector, then whole sectors
+        uint32_t fill = (LOG_SECTOR - f_size(&LogFile) % LOG_SECTOR) % LOG_SECTOR;
+        if (n < fill) return;
+        n = fill + (n - fill) / LOG_SECTOR * LOG_SECTOR;
+    }
+    if (n == 0) return;
+
+    // Writers only append past head, so [tail, tail + n) holds still
+    uint32_t done = 0;
+    while (done < n) {
+        uint32_t at = (tail + done) & (LOG_RING_SIZE - 1);
+        uint32_t span = LOG_RING_SIZE - at;
+        if (span > n - done) span = n - done;
+        UINT bw = 0;
+        FRESULT res = f_write(&LogFile, &LogRing.buf[at], span, &bw);
+        done += bw;
+        if (res != FR_OK || bw != span) {
+            printf("Log: write failed res=%d\n", res);
+            break;
+        }
+    }
+    // What f_write took stays out of the ring even if the sync fails, or the
+    // next pass would write it twice
+    f_sync(&LogFile);
+    LogManager_IdxRecords(base, tail, avail, done);
+
+    xSemaphoreTake(RingMutex, portMAX_DELAY);
+    LogRing.tail = tail + done;
+    if (LogRing.head != LogRing.tail) RingOldest = xTaskGetTickCount();
+    xSemaphoreGive(RingMutex);
+}
+
+void LogManager_ForceRotate(void) {
+    if (xSemaphoreTake(LogMutex, portMAX_DELAY) != pdTRUE) return;
+    LogManager_FlushLocked(true);
+    LogManager_RotateLocked();
     xSemaphoreGive(LogMutex);
 }
 
-// Internal Write function - Assumes LogMutex is held by caller
-static void LogManager_Write_Internal(uint8_t level, const char* tag, const char* message) {
-    if (!LogOpen) return;
+void LogManager_Flush(void) {
+    if (!LogMutex) return;
+    if (xSemaphoreTake(LogMutex, portMAX_DELAY) != pdTRUE) return;
+    LogManager_FlushLocked(true);
+    xSemaphoreGive(LogMutex);
+}
 
-    // Check size and rotate if needed
-    if (f_size(&LogFile) > MAX_LOG_SIZE) {
-        // We must release lock to call ForceRotate because it takes lock
-        xSemaphoreGive(LogMutex);
-        LogManager_ForceRotate();
-        xSemaphoreTake(LogMutex, portMAX_DELAY);
-        if (!LogOpen) return;
+// One pass of the log task: write what is due, rotate a full file.
+// Returns true after an error or warning was written out, which the task
+// then rests on so a burst of them is not synced line by line.
+static bool LogManager_Service(void) {
+    if (!RingReady) return false;
+
+    xSemaphoreTake(RingMutex, portMAX_DELAY);
+    uint32_t n = LogRing.head - LogRing.tail;
+    bool urgent = n && RingUrgent;
+    bool all = urgent || (n && xTaskGetTickCount() - RingOldest >= pdMS_TO_TICKS(LOG_FLUSH_MS));
+    RingUrgent = false;
+    xSemaphoreGive(RingMutex);
+
+    if (!all && n < LOG_FLUSH_SECTORS * LOG_SECTOR) return false;
+
+    xSemaphoreTake(LogMutex, portMAX_DELAY);
+    LogManager_FlushLocked(all);
+    if (LogOpen && f_size(&LogFile) > MAX_LOG_SIZE) {
+        LogManager_FlushLocked(true); // Ends on a whole record
+        LogManager_RotateLocked();
     }
+    xSemaphoreGive(LogMutex);
+    return urgent;
+}
 
-    char line[512];
-    uint32_t time;
-    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
-        time = xTaskGetTickCount();
-    } else {
-        time = HAL_GetTick();
+void StartLogTask(void *argument) {
+    (void)argument;
+    // LogManager_Init runs in the UART task
+    while (!RingReady) {
+        vTaskDelay(pdMS_TO_TICKS(LOG_POLL_MS));
+    }
+    for (;;) {
+        xSemaphoreTake(LogKick, pdMS_TO_TICKS(LOG_POLL_MS));
+        bool rest = LogManager_Service();
+        Telemetry_Service(); // Blocks the UART task closed
+        if (rest) {
+            vTaskDelay(pdMS_TO_TICKS(LOG_COALESCE_MS));
+        }
     }
+}
 
-    int line_len = snprintf(line, sizeof(line), "[%lu] [%s] %s\n", time, tag, message);
+// Copies into the ring. Assumes RingMutex is held and there is room.
+static void LogManager_RingPut(const char* data, uint32_t len) {
+    if (LogRing.head == LogRing.tail) RingOldest = xTaskGetTickCount();
+    for (uint32_t done = 0; done < len; ) {
+        uint32_t at = LogRing.head & (LOG_RING_SIZE - 1);
+        uint32_t span = LOG_RING_SIZE - at;
+        if (span > len - done) span = len - done;
+        memcpy(&LogRing.buf[at], data + done, span);
+        LogRing.head += span;
+        done += span;
+    }
+}
 
-    FRESULT res;
-    if (line_len > 0) {
-        UINT bw;
-        res = f_write(&LogFile, line, (UINT)line_len, &bw);
-        if (res != FR_OK || bw != (UINT)line_len) {
-            // Error handling
+static uint32_t LogManager_Now(void) {
+    if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+        return xTaskGetTickCount();
+    }
+    return HAL_GetTick();
+}
+
+// Appends one record to the ring; the log task takes it to the card. No
+// FatFs access, so callers may or may not hold LogMutex.
+static void LogManager_RingRecord(uint8_t level, uint32_t time, const uint8_t* rec, int rec_len) {
+    // Held for copies only, so the wait is short; a timeout would lose the
+    // line without counting it in RingDropped
+    xSemaphoreTake(RingMutex, portMAX_DELAY);
+    uint32_t room = LOG_RING_SIZE - (LogRing.head - LogRing.tail);
+    if (RingDropped) {
+        uint8_t note[LOG_REC_HDR + 32];
+        char msg[24];
+        snprintf(msg, sizeof(msg), "%lu lines dropped", RingDropped);
+        int note_len = log_rec_pack_text(note, time, 1, "LOG", msg);
+        if (room >= (uint32_t)(note_len + rec_len)) {
+            LogManager_RingPut((const char*)note, note_len);
+            room -= note_len;
+            RingDropped = 0;
         }
     }
+    if (!RingDropped && room >= (uint32_t)rec_len) {
+        LogManager_RingPut((const char*)rec, rec_len);
+    } else {
+        RingDropped++;
+    }
+    // Errors and warnings go out at once, as they were synced before
+    if (level <= 1) RingUrgent = true;
+    bool kick = RingUrgent || LogRing.head - LogRing.tail >= LOG_FLUSH_SECTORS * LOG_SECTOR;
+    xSemaphoreGive(RingMutex);
+
+    if (kick) xSemaphoreGive(LogKick);
+}
+
+bool LogManager_Wants(uint8_t level, const char* tag) {
+    if (LevelMutex == NULL || xSemaphoreTake(LevelMutex, pdMS_TO_TICKS(10)) != pdTRUE) return true;
+    bool pass = log_levels_pass(&Levels, level, tag);
+    xSemaphoreGive(LevelMutex);
+    return pass;
+}
 
-    // Conditional Sync
-    if (level <= 1) { // Error or Warn
-        f_sync(&LogFile);
+// As LogManager_Wants, for an ESP32 record's tag ID
+static bool LogManager_WantsId(uint8_t level, uint16_t tag_id) {
+    if (LevelMutex == NULL || xSemaphoreTake(LevelMutex, pdMS_TO_TICKS(10)) != pdTRUE) return true;
+    bool pass = log_levels_pass_id(&Levels, level, tag_id);
+    xSemaphoreGive(LevelMutex);
+    return pass;
+}
+
+bool LogManager_SetLevel(const char* tag, uint8_t level) {
+    if (LevelMutex == NULL) return false;
+    xSemaphoreTake(LevelMutex, portMAX_DELAY);
+    bool ok = log_levels_set(&Levels, tag, level);
+    xSemaphoreGive(LevelMutex);
+    if (ok && LogMutex && xSemaphoreTake(LogMutex, portMAX_DELAY) == pdTRUE) {
+        LogManager_LevelsSave();
+        xSemaphoreGive(LogMutex);
     }
+    return ok;
+}
+
+int LogManager_GetLevels(uint8_t* table) {
+    if (LevelMutex == NULL) return 0;
+    xSemaphoreTake(LevelMutex, portMAX_DELAY);
+    int len = log_levels_pack(&Levels, table);
+    xSemaphoreGive(LevelMutex);
+    return len;
+}
+
+// Text record: messages formatted on the STM32 and plain ESP32 log lines
+static void LogManager_Write_Internal(uint8_t level, const char* tag, const char* message) {
+    if (!RingReady || !LogManager_Wants(level, tag)) return;
+
+    uint8_t rec[LOG_REC_MAX];
+    uint32_t time = LogManager_Now();
+    int rec_len = log_rec_pack_text(rec, time, level, tag, message);
+    LogManager_RingRecord(level, time, rec, rec_len);
 }
 
 void LogManager_Write(uint8_t level, const char* tag, const char* message) {
-    if (!LogMutex) return;
-    if (xSemaphoreTake(LogMutex, 100) == pdTRUE) {
-        LogManager_Write_Internal(level, tag, message);
-        xSemaphoreGive(LogMutex);
+    LogManager_Write_Internal(level, tag, message);
+}
+
+void LogManager_WriteRecord(uint8_t level, uint32_t fmt_id, uint16_t tag_id, const uint8_t* args, uint8_t args_len) {
+    if (!RingReady || !LogManager_WantsId(level, tag_id)) return;
+
+    uint8_t rec[LOG_REC_HDR + 255];
+    uint32_t time = LogManager_Now();
+    int rec_len = log_rec_pack(rec, time, level, fmt_id, args, args_len);
+    LogManager_RingRecord(level, time, rec, rec_len);
+}
+
+// Maps the file's cluster runs so f_lseek finds any offset without walking
+// the FAT chain from the start. A file in more runs than `len` allows keeps
+// seeking the slow way. For files opened read-only: a mapped file cannot grow.
+static void LogManager_MapClusters(FIL* f, DWORD* tbl, DWORD len) {
+#if FF_USE_FASTSEEK
+    tbl[0] = len;
+    f->cltbl = tbl;
+    FRESULT res = f_lseek(f, CREATE_LINKMAP);
+    if (res != FR_OK) {
+        f->cltbl = NULL;
+        printf("LogManager: no fast seek (%d), %lu map entries needed\n", res, tbl[0]);
+    }
+#else
+    (void)f; (void)tbl; (void)len;
+#endif
+}
+
+// Closes the download; the ESP32 gives up once its resends go unanswered
+static void LogManager_CloseDownload(const char* why) {
+    printf("DL: %s. Off=%lu Size=%lu\n", why, DownloadOffset, DownloadSize);
+    Downloading = false;
+    f_close(&DownloadFile);
+}
+
+// Closes the download and reopens the active log if the download took it
+static void LogManager_EndDownload(const char* why) {
+    LogManager_CloseDownload(why);
+
+    if (!LogOpen) {
+        if (LogManager_OpenCurrent() == FR_OK) {
+            printf("DL: ActiveLog Restored\n");
+        } else {
+            printf("DL: ActiveLog Restore Failed\n");
+        }
+    }
+}
+
+// Sends what the ESP32's credit allows, at most DL_BURST chunks. The file is
+// read in DL_BLOCK_SIZE blocks front to back; only a resend that falls outside
+// the current block seeks. Assumes LogMutex is held.
+static void LogManager_StreamDownload(void) {
+    if (xTaskGetTickCount() - DownloadLastCredit > pdMS_TO_TICKS(DL_IDLE_TIMEOUT)) {
+        LogManager_EndDownload("No credit, dropped");
+        return;
+    }
+
+    for (int n = 0; n < DL_BURST && DownloadOffset < DownloadLimit; n++) {
+        if (DownloadOffset >= DownloadSize) {
+            // Empty chunk marks the end; the ESP32 confirms it with a credit
+            if (!DownloadEofSent) {
+                uint8_t packet[32];
+                int len = pack_log_data_chunk_message(packet, DownloadSize, NULL, 0);
+                UART_SendRaw(packet, len);
+                DownloadEofSent = true;
+            }
+            return;
+        }
+
+        if (DownloadOffset < DownloadBlockStart || DownloadOffset >= DownloadBlockStart + DownloadBlockLen) {
+            uint32_t start = DownloadOffset - (DownloadOffset % DL_BLOCK_SIZE);
+            UINT br = 0;
+            FRESULT res = FR_OK;
+            if (f_tell(&DownloadFile) != start) res = f_lseek(&DownloadFile, start);
+            if (res == FR_OK) res = f_read(&DownloadFile, DownloadBlock, DL_BLOCK_SIZE, &br);
+            if (res != FR_OK || br == 0) {
+                printf("DL: Read Error res=%d\n", res);
+                LogManager_EndDownload("Read failed");
+                // Empty chunk short of the size: the ESP32 sees the file cut short
+                uint8_t packet[32];
+                int len = pack_log_data_chunk_message(packet, DownloadOffset, NULL, 0);
+                UART_SendRaw(packet, len);
+                return;
+            }
+            DownloadBlockStart = start;
+            DownloadBlockLen = br;
+        }
+
+        uint32_t len = DownloadBlockStart + DownloadBlockLen - DownloadOffset;
+        if (len > LOG_CHUNK_MAX) len = LOG_CHUNK_MAX;
+        if (len > DownloadLimit - DownloadOffset) len = DownloadLimit - DownloadOffset;
+
+        uint8_t packet[LOG_CHUNK_MAX + 16];
+        int plen = pack_log_data_chunk_message(packet, DownloadOffset,
+                                               &DownloadBlock[DownloadOffset - DownloadBlockStart], (uint16_t)len);
+        UART_SendRaw(packet, plen);
+        DownloadOffset += len;
     }
 }
 
 void LogManager_Process(void) {
-    // Periodic Sync
-    if (LogOpen && (xTaskGetTickCount() - LastSyncTime > 5000)) {
+    // Log task starved by busier tasks: write from here rather than lose lines
+    if (LogOpen && RingReady && LogRing.head != LogRing.tail &&
+        xTaskGetTickCount() - RingOldest > pdMS_TO_TICKS(LOG_STARVED_MS)) {
         if (xSemaphoreTake(LogMutex, 10) == pdTRUE) {
-             f_sync(&LogFile);
-             xSemaphoreGive(LogMutex);
-             LastSyncTime = xTaskGetTickCount();
+            LogManager_FlushLocked(true);
+            xSemaphoreGive(LogMutex);
         }
     }
 
@@ -216,138 +961,305 @@ void LogManager_Process(void) {
 
     if (Downloading) {
         if (xSemaphoreTake(LogMutex, 100) == pdTRUE) {
-            // Send chunks
-            uint8_t buffer[200];
-            UINT br;
-
-            f_lseek(&DownloadFile, DownloadOffset);
-            FRESULT res = f_read(&DownloadFile, buffer, sizeof(buffer), &br);
-            if (res == FR_OK) {
-                if (br > 0) {
-                    uint8_t packet[256];
-                    int len = pack_log_data_chunk_message(packet, DownloadOffset, buffer, br);
-                    UART_SendRaw(packet, len);
-                }
+            LogManager_StreamDownload();
+            xSemaphoreGive(LogMutex);
+        }
+    }
 
-                DownloadOffset += br;
-                if (br < sizeof(buffer) || DownloadOffset >= DownloadSize) {
-                    // End of file
-                    printf("DL: EOF. Off=%lu Size=%lu\n", DownloadOffset, DownloadSize);
-                    Downloading = false;
-                    f_close(&DownloadFile);
-
-                    // Restore LogFile if needed
-                    if (!LogOpen) {
-                         if (f_open(&LogFile, LOG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE | FA_READ) == FR_OK) {
-                             f_lseek(&LogFile, f_size(&LogFile));
-                             LogOpen = true;
-                             printf("DL: ActiveLog Restored (EOF)\n");
-                         } else {
-                             printf("DL: ActiveLog Restore Failed (EOF)\n");
-                         }
-                    }
-
-                    // Send empty chunk
-                    uint8_t packet[32];
-                    int len = pack_log_data_chunk_message(packet, DownloadOffset, NULL, 0);
-                    UART_SendRaw(packet, len);
-                }
-            } else {
-                 // Error
-                 printf("DL: Read Error res=%d\n", res);
-                 Downloading = false;
-                 f_close(&DownloadFile);
-
-                 // Restore LogFile if needed (Error case)
-                 if (!LogOpen) {
-                      if (f_open(&LogFile, LOG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE | FA_READ) == FR_OK) {
-                          f_lseek(&LogFile, f_size(&LogFile));
-                          LogOpen = true;
-                          printf("DL: ActiveLog Restored (Error)\n");
-                      }
-                 }
-            }
+    if (Searching) {
+        if (xSemaphoreTake(LogMutex, 100) == pdTRUE) {
+            LogManager_SearchStep();
             xSemaphoreGive(LogMutex);
         }
     }
 }
 
-void LogManager_HandleListReq(void) {
+// Entry of segment `seg` of the file searched; false if there is none
+static bool LogManager_SearchEntry(uint32_t seg, LogIdxEntry* e) {
+    if (SearchHaveOpen && seg == SearchOpenSeg) {
+        *e = SearchOpen;
+        return true;
+    }
+    if (!SearchIdxOpen || seg >= SearchSegs) return false;
+    UINT br = 0;
+    if (f_lseek(&SearchIdxFile, seg * sizeof(*e)) != FR_OK ||
+        f_read(&SearchIdxFile, e, sizeof(*e), &br) != FR_OK || br != sizeof(*e)) {
+        return false;
+    }
+    SearchRead += br;
+    return log_idx_valid(e);
+}
+
+// Moves the window to start at the sector SearchPos is in and fills it.
+// What the window already holds from there is kept, not read again.
+// Returns the bytes read.
+static uint32_t LogManager_SearchFill(void) {
+    uint32_t start = SearchPos - SearchPos % LOG_SECTOR;
+    uint32_t keep = 0;
+    if (start >= SearchBufStart && start < SearchBufStart + SearchBufLen) {
+        keep = SearchBufStart + SearchBufLen - start;
+        memmove(SearchBuf, &SearchBuf[start - SearchBufStart], keep);
+    }
+    SearchBufStart = start;
+    SearchBufLen = keep;
+    UINT br = 0;
+    if (f_lseek(&SearchFile, start + keep) != FR_OK ||
+        f_read(&SearchFile, &SearchBuf[keep], SEARCH_BUF_SIZE - keep, &br) != FR_OK) {
+        return 0;
+    }
+    if (start + keep + br > SearchSize) br = SearchSize > start + keep ? SearchSize - start - keep : 0;
+    SearchBufLen = keep + br;
+    SearchRead += br;
+    return br;
+}
+
+// Sends the page of matches if it holds any
+static void LogManager_SearchSendPage(void) {
+    if (SearchPage[3 + offsetof(LogSearchPageHeader, count)] == 0) return;
+    UART_SendRaw(SearchPage, pack_log_search_resp_end(SearchPage));
+    pack_log_search_resp_begin(SearchPage, SearchId);
+}
+
+// Takes the record at SearchPos. Returns the bytes read from the card for it.
+static uint32_t LogManager_SearchRecord(void) {
+    uint32_t read = 0;
+    if (SearchPos < SearchBufStart || SearchPos + LOG_REC_MAX > SearchBufStart + SearchBufLen) {
+        if (SearchPos < SearchBufStart || SearchBufStart + SearchBufLen < SearchSize) {
+            read = LogManager_SearchFill();
+            if (!read) {
+                SearchPos = SearchSize; // Unreadable: end of the file for this search
+                return 0;
+            }
+        }
+    }
+    const uint8_t* rec = &SearchBuf[SearchPos - SearchBufStart];
+    uint32_t avail = SearchBufStart + SearchBufLen - SearchPos;
+    int len = log_rec_check(rec, (int)avail);
+    if (len == 0 || (len > 0 && (uint32_t)len > avail)) {
+        SearchPos = SearchSize; // Torn record at the end of the file
+        return read;
+    }
+    // Off a known record start, a header must be followed by another one
+    if (len < 0 || (!SearchExact && (uint32_t)len < avail && rec[len] != LOG_REC_SYNC)) {
+        SearchPos++;
+        SearchExact = false;
+        return read;
+    }
+    SearchExact = true;
+    if (log_rec_match(rec, len, &SearchQuery)) {
+        if (!pack_log_search_resp_add(SearchPage, SearchPos, rec, len)) {
+            LogManager_SearchSendPage();
+            pack_log_search_resp_add(SearchPage, SearchPos, rec, len);
+        }
+        SearchMatches++;
+    }
+    SearchPos += len;
+    return read;
+}
+
+// One step of the search, about SEARCH_STEP_BYTES read. Assumes LogMutex is held.
+static void LogManager_SearchStep(void) {
+    uint32_t budget = SEARCH_STEP_BYTES;
+    while (Searching && budget) {
+        if (SearchMax && SearchMatches >= SearchMax) {
+            LogManager_EndSearch(LOG_SEARCH_LIMIT);
+            return;
+        }
+        if (SearchPos < SearchStop && SearchPos < SearchSize) {
+            uint32_t read = LogManager_SearchRecord();
+            budget -= read < budget ? read : budget;
+            continue;
+        }
+        if (SearchSeg * LOG_IDX_SEGMENT >= SearchSize) {
+            LogManager_EndSearch(LOG_SEARCH_OK);
+            return;
+        }
+
+        LogIdxEntry e;
+        bool have = LogManager_SearchEntry(SearchSeg, &e);
+        budget -= budget > sizeof(e) ? sizeof(e) : budget;
+        if (have && !log_idx_may_match(&e, &SearchQuery)) {
+            SearchSeg++;
+            SearchSkipped++;
+            continue;
+        }
+        // Scan the segment: carry on from the one before, else from its
+        // first record, else find one from its start
+        uint32_t start = SearchSeg * LOG_IDX_SEGMENT;
+        if (!(SearchExact && SearchPos >= start)) {
+            SearchExact = SearchSeg == 0 || (have && !(e.flags & LOG_IDX_PARTIAL));
+            SearchPos = SearchSeg == 0 ? LOG_FILE_MAGIC_LEN : (SearchExact ? e.first : start);
+        }
+        SearchStop = start + LOG_IDX_SEGMENT;
+        SearchSeg++;
+        // A common word or no filter at all: the entries would only add
+        // their own reads to a full scan
+        if (SearchSeg == SEARCH_PLAIN_SEGS && SearchSkipped == 0) {
+            SearchStop = SearchSize;
+            SearchSeg = (SearchSize + LOG_IDX_SEGMENT - 1) / LOG_IDX_SEGMENT;
+        }
+    }
+}
+
+// Sends what is left and the end of the search, and closes it
+static void LogManager_EndSearch(uint8_t status) {
+    if (!Searching) return;
+    Searching = false;
+    LogManager_SearchSendPage();
+    LogSearchEndMsg end = {SearchId, 0, status, SearchMatches, SearchRead, SearchSize};
+    uint8_t packet[sizeof(end) + 4];
+    UART_SendRaw(packet, pack_log_search_end_message(packet, &end));
+    f_close(&SearchFile);
+    if (SearchIdxOpen) f_close(&SearchIdxFile);
+    SearchIdxOpen = false;
+    printf("Search: %lu matches, %lu of %lu bytes read\n", SearchMatches, SearchRead, SearchSize);
+}
+
+static void LogManager_SearchFail(uint8_t id) {
+    LogSearchEndMsg end = {id, 0, LOG_SEARCH_NO_FILE, 0, 0, 0};
+    uint8_t packet[sizeof(end) + 4];
+    UART_SendRaw(packet, pack_log_search_end_message(packet, &end));
+}
+
+void LogManager_HandleSearch(const LogSearchMsg* msg) {
     if (!LogMutex) return;
+    char name[sizeof(msg->name) + 1];
+    char idx_name[32];
+    uint32_t n = 0;
+    memcpy(name, msg->name, sizeof(msg->name));
+    name[sizeof(msg->name)] = 0;
+
     xSemaphoreTake(LogMutex, portMAX_DELAY);
-    DIR dir;
-    FILINFO fno;
-    uint8_t buffer[256];
-    uint16_t count = 0;
+    LogManager_EndSearch(LOG_SEARCH_OK); // One at a time: a new one replaces it
 
-    const char* path = SDPath[0] ? SDPath : "0:/";
+    bool current = strcmp(name, LOG_FILENAME) == 0;
+    if (current) {
+        strcpy(idx_name, LOG_IDX_CURRENT);
+    } else if (LogManager_LogNumber(name, &n)) {
+        sprintf(idx_name, "log_%lu.lix", n);
+    } else {
+        xSemaphoreGive(LogMutex);
+        return LogManager_SearchFail(msg->id);
+    }
+    if (current) {
+        // Lines still in the ring go to the card first; the open segment's
+        // entry is taken as it is now
+        LogManager_FlushLocked(true);
+        SearchHaveOpen = IdxReady && !IdxLost;
+        SearchOpen = IdxOpen;
+        SearchOpenSeg = IdxSeg;
+    } else {
+        SearchHaveOpen = false;
+    }
 
-    // Count files
-    if (f_opendir(&dir, path) == FR_OK) {
-        while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
-             if (strstr(fno.fname, ".log") || strstr(fno.fname, ".txt")) {
-                 count++;
-             }
-        }
-        f_closedir(&dir);
+    char magic[LOG_FILE_MAGIC_LEN];
+    UINT br = 0;
+    if (f_open(&SearchFile, name, FA_READ) != FR_OK) {
+        xSemaphoreGive(LogMutex);
+        return LogManager_SearchFail(msg->id);
+    }
+    if (f_read(&SearchFile, magic, sizeof(magic), &br) != FR_OK || br != sizeof(magic) ||
+        memcmp(magic, LOG_FILE_MAGIC, sizeof(magic)) != 0) {
+        f_close(&SearchFile);
+        xSemaphoreGive(LogMutex);
+        return LogManager_SearchFail(msg->id); // Text logs from before records have no index
     }
 
-    // Must release mutex for UART send (avoid deadlock if UART calls LogManager_Write)
+    LogManager_MapClusters(&SearchFile, SearchClmt, DL_CLMT_SIZE);
+    Searching = true;
+    strcpy(SearchName, name);
+    SearchId = msg->id;
+    SearchMax = msg->max;
+    SearchMatches = 0;
+    SearchRead = br;
+    SearchSize = f_size(&SearchFile);
+    SearchSeg = 0;
+    SearchSkipped = 0;
+    SearchPos = 0;
+    SearchStop = 0;
+    SearchExact = false;
+    SearchBufStart = 0;
+    SearchBufLen = 0;
+    pack_log_search_resp_begin(SearchPage, SearchId);
+    char text[sizeof(msg->text) + 1];
+    memcpy(text, msg->text, sizeof(msg->text));
+    text[sizeof(msg->text)] = 0;
+    log_query_init(&SearchQuery, msg->levels, msg->tick_from, msg->tick_to, text, msg->fmt, msg->nfmts);
+
+    SearchIdxOpen = f_open(&SearchIdxFile, idx_name, FA_READ) == FR_OK;
+    SearchSegs = SearchIdxOpen ? f_size(&SearchIdxFile) / sizeof(LogIdxEntry) : 0;
+    printf("Search: '%s' in %s, %lu entries\n", text, name, SearchSegs);
     xSemaphoreGive(LogMutex);
+}
+
+static bool LogManager_IsLogName(const char* name) {
+    return strstr(name, ".log") || strstr(name, ".txt");
+}
 
-    if (count == 0) {
-         int len = pack_log_list_resp_message(buffer, 0, 0, 0, "");
-         UART_SendRaw(buffer, len);
-         return;
+// Next log entry from ListDir; false at the end of the directory
+static bool LogManager_ListRead(FILINFO* fno) {
+    while (f_readdir(&ListDir, fno) == FR_OK && fno->fname[0]) {
+        if (LogManager_IsLogName(fno->fname)) {
+            ListNext++;
+            return true;
+        }
     }
+    return false;
+}
 
-    // Stream files
-    if (xSemaphoreTake(LogMutex, portMAX_DELAY) == pdTRUE) {
-        FRESULT res = f_opendir(&dir, path);
-        xSemaphoreGive(LogMutex);
+// Opens the directory, counts the logs and positions it at `cursor`
+static bool LogManager_ListOpen(uint16_t cursor) {
+    FILINFO fno;
+    const char* path = SDPath[0] ? SDPath : "0:/";
 
-        if (res == FR_OK) {
-            uint16_t idx = 0;
-            // Loop until we reach count. If dir ends early, fill with dummy.
-            while(idx < count) {
-                bool found = false;
-                if (xSemaphoreTake(LogMutex, portMAX_DELAY) == pdTRUE) {
-                    res = f_readdir(&dir, &fno);
-                    xSemaphoreGive(LogMutex);
-                    if (res == FR_OK && fno.fname[0]) {
-                        if (strstr(fno.fname, ".log") || strstr(fno.fname, ".txt")) {
-                            found = true;
-                        } else {
-                            // Non-log file, skip
-                        }
-                    } else {
-                        // End of dir or error
-                    }
-                }
+    if (ListOpen) f_closedir(&ListDir);
+    ListOpen = (f_opendir(&ListDir, path) == FR_OK);
+    if (!ListOpen) return false;
 
-                if (found) {
-                    int len = pack_log_list_resp_message(buffer, count, idx, fno.fsize, fno.fname);
-                    UART_SendRaw(buffer, len);
-                    idx++;
-                    vTaskDelay(2); // Throttle every packet for reliability
-                } else if (res != FR_OK || fno.fname[0] == 0) {
-                    // End of dir reached, but idx < count (Under-run)
-                    // Fill with dummy packets
-                    while (idx < count) {
-                        int len = pack_log_list_resp_message(buffer, count, idx, 0, "");
-                        UART_SendRaw(buffer, len);
-                        idx++;
-                        vTaskDelay(2);
-                    }
-                    break;
-                }
-            }
+    ListNext = 0;
+    while (LogManager_ListRead(&fno)) {}
+    ListTotal = ListNext;
 
-            xSemaphoreTake(LogMutex, portMAX_DELAY);
-            f_closedir(&dir);
-            xSemaphoreGive(LogMutex);
+    f_rewinddir(&ListDir);
+    ListNext = 0;
+    while (ListNext < cursor && LogManager_ListRead(&fno)) {}
+    return true;
+}
+
+void LogManager_HandleListReq(uint16_t cursor) {
+    if (!LogMutex) return;
+    FILINFO fno;
+    uint8_t buffer[MAX_PAYLOAD_LEN + 4];
+
+    xSemaphoreTake(LogMutex, portMAX_DELAY);
+    // Next page: carry on from where the last one stopped. Anything else
+    // (first page, a page resent after a loss) rescans from the start.
+    if (!ListOpen || cursor == 0 || cursor != ListNext) {
+        if (!LogManager_ListOpen(cursor)) ListTotal = 0;
+    }
+    if (ListOpen && ListNext < cursor) {
+        // Directory shrank since it was counted
+        ListTotal = ListNext;
+    }
+
+    pack_log_list_resp_begin(buffer, ListTotal, cursor);
+    while (ListOpen && ListNext < ListTotal && buffer[2] + LOG_LIST_ENTRY_MAX <= MAX_PAYLOAD_LEN) {
+        if (!LogManager_ListRead(&fno)) {
+            // Shrank mid-list: the next request gets an empty page with the real total
+            ListTotal = ListNext;
+            break;
         }
+        pack_log_list_resp_add(buffer, fno.fsize, fno.fname);
     }
+    if (ListOpen && ListNext >= ListTotal) {
+        f_closedir(&ListDir);
+        ListOpen = false;
+    }
+    int len = pack_log_list_resp_end(buffer);
+
+    // Must release mutex for UART send (avoid deadlock if UART calls LogManager_Write)
+    xSemaphoreGive(LogMutex);
+    UART_SendRaw(buffer, len);
 }
 
 void LogManager_HandleDownloadReq(const char* filename) {
@@ -358,6 +1270,7 @@ void LogManager_HandleDownloadReq(const char* filename) {
 
     // Close LogFile if we are trying to download the active log (avoids sharing violation)
     if (LogOpen && strcmp(filename, LOG_FILENAME) == 0) {
+        LogManager_FlushLocked(true); // Download what has been logged so far
         f_close(&LogFile);
         LogOpen = false;
         printf("DL: ActiveLog Closed for '%s'\n", filename);
@@ -366,9 +1279,16 @@ void LogManager_HandleDownloadReq(const char* filename) {
     strncpy(DownloadName, filename, 31);
     FRESULT res = f_open(&DownloadFile, filename, FA_READ);
     if (res == FR_OK) {
+        LogManager_MapClusters(&DownloadFile, DownloadClmt, DL_CLMT_SIZE);
         Downloading = true;
         DownloadOffset = 0;
         DownloadSize = f_size(&DownloadFile);
+        // Nothing goes out until the first CMD_LOG_CREDIT
+        DownloadLimit = 0;
+        DownloadEofSent = false;
+        DownloadLastCredit = xTaskGetTickCount();
+        DownloadBlockStart = 0;
+        DownloadBlockLen = 0;
         printf("DL: Opened '%s' size=%lu\n", filename, DownloadSize);
     } else {
         Downloading = false;
@@ -376,9 +1296,7 @@ void LogManager_HandleDownloadReq(const char* filename) {
 
         // Restore LogFile if we closed it and failed to open for download
         if (!LogOpen && strcmp(filename, LOG_FILENAME) == 0) {
-             if (f_open(&LogFile, LOG_FILENAME, FA_OPEN_ALWAYS | FA_WRITE | FA_READ) == FR_OK) {
-                 f_lseek(&LogFile, f_size(&LogFile));
-                 LogOpen = true;
+             if (LogManager_OpenCurrent() == FR_OK) {
                  printf("DL: ActiveLog Restored\n");
              } else {
                  printf("DL: ActiveLog Restore Failed\n");
@@ -396,18 +1314,42 @@ void LogManager_HandleDownloadReq(const char* filename) {
 void LogManager_SeekDownload(uint32_t offset) {
     if (!LogMutex) return;
     if (xSemaphoreTake(LogMutex, portMAX_DELAY) == pdTRUE) {
-        if (Downloading) {
+        if (Downloading && offset <= DownloadSize) {
             DownloadOffset = offset;
+            DownloadEofSent = false;
             printf("DL: Seek to %lu\n", offset);
         }
         xSemaphoreGive(LogMutex);
     }
 }
 
+void LogManager_HandleCredit(uint32_t offset, uint8_t credits) {
+    if (!LogMutex) return;
+    if (xSemaphoreTake(LogMutex, portMAX_DELAY) == pdTRUE) {
+        if (Downloading) {
+            uint32_t limit = offset + (uint32_t)credits * LOG_CHUNK_MAX;
+            if (limit > DownloadLimit) DownloadLimit = limit;
+            // A 0-credit keep-alive from a paused reader counts too
+            DownloadLastCredit = xTaskGetTickCount();
+            if (DownloadEofSent && offset >= DownloadSize) LogManager_EndDownload("Complete");
+        }
+        xSemaphoreGive(LogMutex);
+    }
+}
+
 void LogManager_HandleDeleteReq(const char* filename) {
     if (!LogMutex) return;
     xSemaphoreTake(LogMutex, portMAX_DELAY);
+    if (Searching && strcmp(filename, SearchName) == 0) LogManager_EndSearch(LOG_SEARCH_NO_FILE);
+    // Not left reading freed clusters (LogManager_ReleaseFile)
+    if (Downloading && strcmp(filename, DownloadName) == 0) LogManager_EndDownload("File deleted");
     f_unlink(filename);
+    uint32_t n;
+    if (LogManager_LogNumber(filename, &n)) {
+        char idx_name[32];
+        sprintf(idx_name, "log_%lu.lix", n);
+        f_unlink(idx_name);
+    }
     xSemaphoreGive(LogMutex);
 }
 
@@ -415,6 +1357,7 @@ void LogManager_HandleManagerOp(uint8_t op_code) {
     if (!LogMutex) return;
     xSemaphoreTake(LogMutex, portMAX_DELAY);
 
+    LogManager_EndSearch(LOG_SEARCH_NO_FILE);
     if (op_code == LOG_OP_DELETE_ALL) {
         if (LogOpen) {
             f_close(&LogFile);
@@ -426,7 +1369,7 @@ void LogManager_HandleManagerOp(uint8_t op_code) {
         const char* path = SDPath[0] ? SDPath : "0:/";
         if (f_opendir(&dir, path) == FR_OK) {
             while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
-                if (strstr(fno.fname, ".log") || strstr(fno.fname, ".txt")) {
+                if (strstr(fno.fname, ".log") || strstr(fno.fname, ".txt") || strstr(fno.fname, ".lix")) {
                     f_unlink(fno.fname);
                 }
             }
@@ -477,7 +1420,7 @@ uint32_t LogManager_GetTotalSpace(void) {
 }
 
 void LogManager_GetStats(uint32_t* size, uint32_t* file_count) {
-    if (size) *size = LogOpen ? f_size(&LogFile) : 0;
+    if (size) *size = (LogOpen ? f_size(&LogFile) : 0) + (RingReady ? LogRing.head - LogRing.tail : 0);
 
     if (file_count) {
         *file_count = 0;
@@ -11,17 +11,30 @@ void LogManager_Init(void);
 // Main Process Loop (call frequently)
 void LogManager_Process(void);
 
+// Log writer task: takes buffered records to the card in whole sectors
+void StartLogTask(void *argument);
+
 // Logging API
 void LogManager_Write(uint8_t level, const char* tag, const char* message);
+void LogManager_WriteRecord(uint8_t level, uint32_t fmt_id, uint16_t tag_id, const uint8_t* args, uint8_t args_len); // ESP32 record (log_record.h)
 void LogManager_ForceRotate(void);
+void LogManager_Flush(void); // Everything buffered onto the card now, e.g. before a reset
+
+// Level gate (log_levels.h): lines that fail it are neither packed nor written.
+// ESP32 records carry their tag as an ID and are checked by it (log_levels_tag_id()).
+bool LogManager_Wants(uint8_t level, const char* tag); // For callers that format first
+bool LogManager_SetLevel(const char* tag, uint8_t level); // Saved to the card; false if refused
+int LogManager_GetLevels(uint8_t* table); // Packed, LOG_LEVELS_PACKED_MAX bytes at most
 
 // UART Command Handlers
-void LogManager_HandleListReq(void);
+void LogManager_HandleListReq(uint16_t cursor);
 void LogManager_HandleDownloadReq(const char* filename);
 void LogManager_SeekDownload(uint32_t offset);
+void LogManager_HandleCredit(uint32_t offset, uint8_t credits);
 void LogManager_HandleDeleteReq(const char* filename);
 void LogManager_HandleManagerOp(uint8_t op_code);
 void LogManager_HandleEspLog(uint8_t level, const char* tag, const char* message);
+void LogManager_HandleSearch(const LogSearchMsg* msg); // Answered from LogManager_Process
 
 // Callbacks (from UART Task)
 void LogManager_SendChunkAck(void); // If needed
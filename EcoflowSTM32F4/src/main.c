@@ -24,6 +24,7 @@
 #include "display_task.h"
 #include "uart_task.h"
 #include "fan_task.h"
+#include "ota_task.h"
 #include "log_manager.h"
 #include "ff.h"
 #include "sd_diskio.h"
@@ -405,6 +406,8 @@ int main(void) {
     xTaskCreate(StartDisplayTask, "Display", 16384, NULL, 2, NULL);
     xTaskCreate(StartUARTTask, "UART", 8192, NULL, 3, NULL);
     xTaskCreate(StartFanTask, "Fan", 4096, NULL, 2, NULL);
+    xTaskCreate(StartOtaTask, "OTA", 2048, NULL, 1, NULL); // Background update, just above idle
+    xTaskCreate(StartLogTask, "Log", 2048, NULL, 1, NULL); // SD log writer
 
     // Start Scheduler
     vTaskStartScheduler();
@@ -0,0 +1,197 @@
+#include "ota_task.h"
+#include "ota_rx.h"
+#include "flash_ops.h"
+#include "uart_task.h"
+#include "log_manager.h"
+#include "telemetry.h"
+#include "ecoflow_protocol.h"
+#include "link_frame.h"
+#include "stm32f4xx_hal.h"
+#include "stm32469i_discovery_lcd.h"
+#include "queue.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+/*
+ * Background OTA. The update is received and programmed into the inactive
+ * bank (mapped at 0x08100000) while the UI keeps running; CMD_OTA_APPLY
+ * then swaps the banks. The transfer itself is ota_rx, the same receiver
+ * the bootloader runs, so windowing, compressed and delta images and
+ * resume behave the same on both paths.
+ *
+ * The task runs just above idle: the flash work (one sector erase or one
+ * 256 byte program step per poll) only gets the CPU the display and UART
+ * tasks leave over, and sector erases run on the other bank without
+ * stalling code fetches from this one.
+ */
+
+// A window arrives back to back and waits in the UART task's RX ring while
+// that task is busy; grant no more than half the ring holds
+#define OTA_RING_CHUNKS ((UART_RX_RING_SIZE / 2) / COBS_FRAME_MAX)
+#define OTA_APP_WINDOW (OTA_RING_CHUNKS < OTA_RX_WINDOW_MAX ? OTA_RING_CHUNKS : OTA_RX_WINDOW_MAX)
+#define OTA_QUEUE_DEPTH (OTA_APP_WINDOW + 4)
+#define OTA_STAGE_ADDR (LCD_FB_START_ADDRESS + 0x800000) // SDRAM above the LVGL buffers
+#define OTA_STAGE_SIZE (OTA_RX_CHUNK * 512)
+#define OTA_IDLE_TIMEOUT_MS 60000 // Sender gone: stop polling, keep the progress record
+
+typedef struct {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t payload[MAX_PAYLOAD_LEN];
+} OtaFrame;
+
+static QueueHandle_t otaQueue;
+static OtaFrame uartFrame; // Filled in the UART task, copied into the queue
+static uint32_t firstSector; // Physical sector of inactive bank offset 0
+
+// --- OTA receiver port ---
+static void Ota_Log(const char *fmt, ...) {
+    if (!LogManager_Wants(3, "OTA")) return;
+    char msg[128];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    LogManager_Write(3, "OTA", msg);
+}
+
+static void Ota_EraseStart(void *user, uint8_t sector) {
+    (void)user;
+    Flash_EraseStart(firstSector + sector);
+}
+
+static int Ota_ErasePoll(void *user) {
+    (void)user;
+    int result = Flash_ErasePoll();
+    if (result < 0) Ota_Log("Erase error. SR: 0x%08lX", (unsigned long)FLASH->SR);
+    return result;
+}
+
+static bool Ota_Program(void *user, uint32_t offset, const uint8_t *data, uint32_t len) {
+    (void)user;
+    if (Flash_ProgramWords(0x08100000 + offset, data, len)) return true;
+    Ota_Log("Flash write error at %08lX", (unsigned long)(0x08100000 + offset));
+    return false;
+}
+
+static void Ota_Reply(void *user, uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    (void)user;
+    uint8_t frame[4 + 16];
+    if (len > 16) return;
+    frame[0] = START_BYTE;
+    frame[1] = cmd;
+    frame[2] = len;
+    if (len) memcpy(&frame[3], payload, len);
+    frame[3 + len] = calculate_crc8(&frame[1], 2 + len);
+    UART_SendRaw(frame, 4 + len);
+}
+
+static void Ota_Idle(void *user) {
+    (void)user;
+    vTaskDelay(1); // The UART task refreshes the watchdog
+}
+
+// Progress record in RTC->BKP2R.., shared with the bootloader: a transfer
+// cut short here can be resumed by either
+static OtaRxPort otaPort = {
+    Ota_EraseStart, Ota_ErasePoll, Ota_Program, Ota_Reply, Ota_Idle, Ota_Log,
+    (uint8_t*)OTA_STAGE_ADDR, OTA_STAGE_SIZE,
+    (const uint8_t*)0x08100000,                         // Inactive bank
+    (const uint8_t*)0x08000000, FLASH_SCHED_BANK_SIZE,  // Running image, the base of a patch
+    NULL, NULL, OTA_APP_WINDOW
+};
+static OtaRx ota;
+
+bool OtaTask_SubmitFrame(const uint8_t *packet, uint16_t total_len) {
+    uint8_t cmd = packet[1];
+    if (cmd != CMD_OTA_START && cmd != CMD_OTA_CHUNK && cmd != CMD_OTA_WCHUNK &&
+        cmd != CMD_OTA_END && cmd != CMD_OTA_APPLY && cmd != CMD_OTA_QUERY) {
+        return false;
+    }
+    if (otaQueue == NULL || total_len < 4) return true;
+
+    uartFrame.cmd = cmd;
+    uartFrame.len = packet[2];
+    memcpy(uartFrame.payload, &packet[3], uartFrame.len);
+    xQueueSend(otaQueue, &uartFrame, 0);
+    return true;
+}
+
+void OtaTask_FrameError(void) {
+    if (otaQueue == NULL) return;
+    uartFrame.cmd = 0; // Not a command: a frame that failed its CRC8
+    uartFrame.len = 0;
+    xQueueSend(otaQueue, &uartFrame, 0);
+}
+
+static void Ota_Apply(void) {
+    if (!ota.verified) {
+        Ota_Log("Apply without a verified image");
+        Ota_Reply(NULL, CMD_OTA_NACK, NULL, 0);
+        return;
+    }
+    Ota_Log("Swapping banks");
+    Ota_Reply(NULL, CMD_OTA_ACK, NULL, 0);
+    vTaskDelay(pdMS_TO_TICKS(100)); // Let the UART task send the ACK
+
+    RTC->BKP1R = 0; // Fresh boot counter for the new image
+    Telemetry_Flush();
+    LogManager_Flush();
+    Flash_SwapBank();
+}
+
+void StartOtaTask(void *argument) {
+    (void)argument;
+    static OtaFrame frame;
+
+    otaQueue = xQueueCreate(OTA_QUEUE_DEPTH, sizeof(OtaFrame));
+    if (otaQueue == NULL) vTaskDelete(NULL);
+
+    otaPort.record = &RTC->BKP2R;
+    ota_rx_init(&ota, &otaPort, NULL);
+
+    bool busy = false;
+    bool unlocked = false;
+    TickType_t lastFrame = xTaskGetTickCount();
+
+    for (;;) {
+        // Program steps back to back, erases polled every tick; otherwise
+        // sleep until the next frame (or the idle timeout during a transfer)
+        TickType_t wait = ota.started ? pdMS_TO_TICKS(1000) : portMAX_DELAY;
+        if (busy) wait = ota.sched.erasing ? 1 : 0;
+        if (xQueueReceive(otaQueue, &frame, wait) == pdTRUE) {
+            lastFrame = xTaskGetTickCount();
+            if (frame.cmd == CMD_OTA_START) {
+                HAL_FLASH_Unlock();
+                unlocked = true;
+                firstSector = Flash_InactiveFirstSector();
+            }
+            if (frame.cmd == 0) {
+                if (ota.started) ota_rx_frame_error(&ota);
+            } else if (!ota_rx_frame(&ota, frame.cmd, frame.payload, frame.len) &&
+                       frame.cmd == CMD_OTA_APPLY) {
+                Ota_Apply();
+            }
+        }
+
+        busy = ota_rx_poll(&ota);
+
+        // A transfer whose sender went away stops here; its progress record
+        // stays for the next START to resume from
+        if (ota.started && !ota.verified && !ota.sched.erasing &&
+            (xTaskGetTickCount() - lastFrame) > pdMS_TO_TICKS(OTA_IDLE_TIMEOUT_MS)) {
+            Ota_Log("Transfer abandoned at %lu bytes", (unsigned long)ota.received);
+            ota_rx_init(&ota, &otaPort, NULL);
+            busy = false;
+        }
+
+        // Relock once the flash has nothing left to do: verified, failed,
+        // refused at START or abandoned. The next START unlocks again.
+        if (unlocked && !busy && !ota.sched.erasing && !ota.end_pending &&
+            (!ota.started || ota.verified || ota.failed)) {
+            HAL_FLASH_Lock();
+            unlocked = false;
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef OTA_TASK_H
+#define OTA_TASK_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Initialize Task
+void StartOtaTask(void *argument);
+
+// Hands an OTA frame ([AA][Cmd][Len][Payload][CRC8], CRC checked) from the
+// UART task to the OTA task. Returns false if cmd is not an OTA command.
+// Frames that find the queue full are dropped; the ESP32 resends them.
+bool OtaTask_SubmitFrame(const uint8_t *packet, uint16_t total_len);
+
+// A frame failed its CRC8. During a transfer the sender is told at once
+// (NACK, or WACK while windowed) instead of waiting for its timeout.
+void OtaTask_FrameError(void);
+
+#endif // OTA_TASK_H
@@ -7,6 +7,7 @@
 /* External variables */
 extern UART_HandleTypeDef huart3;
 extern UART_HandleTypeDef huart6;
+extern DMA_HandleTypeDef hdma_usart6_rx;
 
 /******************************************************************************/
 /*           Cortex-M4 Processor Interruption and Exception Handlers          */
@@ -98,6 +99,11 @@ void USART6_IRQHandler(void)
   HAL_UART_IRQHandler(&huart6);
 }
 
+void DMA2_Stream1_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_usart6_rx);
+}
+
 void UART4_IRQHandler(void)
 {
   extern UART_HandleTypeDef huart4;
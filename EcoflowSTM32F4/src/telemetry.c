@@ -0,0 +1,365 @@
+#include "telemetry.h"
+#include "telem_block.h"
+#include "ff.h"
+#include "uart_task.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "stm32f4xx_hal.h"
+#include <stdio.h>
+#include <string.h>
+
+// Blocks go to telem/<Dev>_<Day>.blk, one file per device and day (Day:
+// epoch / 86400), their index entries to the .idx next to it. Entry n is
+// block n's header and column index, so a query reads a day's index and
+// only the blocks it cannot answer from there.
+//
+// Nothing here makes the UART task wait on the card: a closed block is
+// handed to the log task (Telemetry_Service), and a query is stepped from
+// the UART task's loop like a log search.
+#define TELEM_DIR         "telem"
+#define TELEM_PERIOD_S    10                  // One sample per device this often
+#define TELEM_DAY_S       86400
+#define TELEM_EPOCH_MIN   1700000000u         // Earlier: the ESP32's clock is not set
+#define TELEM_QUERY_DAYS  92                  // Longer ranges read only their last days
+#define TELEM_MIN_FREE    (64 * 1024 * 1024)  // Below this the oldest days are deleted, before logs are
+#define TELEM_STEP_BYTES  8192                // Index and blocks read per Telemetry_Process call
+
+extern char SDPath[4];
+
+typedef struct {
+    TelemEnc enc;
+    uint32_t last;                       // Epoch of the last sample taken, 0 none
+    uint8_t closed[TELEM_BLOCK_SIZE];    // Block closed, for the log task to write
+    volatile bool pending;               // closed holds a block not on the card yet
+} TelemDevice;
+
+static TelemDevice Devices[MAX_DEVICES];
+static uint8_t Block[TELEM_BLOCK_SIZE];  // Query: block read from the card
+static TelemQuery Query;
+static SemaphoreHandle_t TelemMutex = NULL;  // Devices
+static SemaphoreHandle_t WriteMutex = NULL;  // Block writes; taken after TelemMutex, never before
+static bool DirReady = false;
+static bool TimeSet = false;
+static uint32_t EpochBase = 0;
+static TickType_t TickBase = 0;
+
+// Query in progress, a day at a time
+static bool Querying = false;
+static uint8_t QueryId;
+static uint8_t QueryDev;
+static uint8_t QueryField;
+static int QueryCols;
+static uint32_t QueryDay;       // Next day to open
+static uint32_t QueryLast;      // Last day of the range
+static bool QueryDayOpen;
+static FIL QueryData, QueryIdx;
+static uint32_t QueryBlock;     // Next block of the open day
+static uint32_t QueryBlocks;    // Blocks in the open day
+
+static uint32_t Telemetry_Now(void) {
+    return EpochBase + (xTaskGetTickCount() - TickBase) / pdMS_TO_TICKS(1000);
+}
+
+static void Telemetry_Name(char* name, uint8_t dev, uint32_t day, const char* ext) {
+    sprintf(name, TELEM_DIR "/%u_%lu.%s", dev, day, ext);
+}
+
+// Day of a telem/ file name, <Dev>_<Day>.<ext>
+static bool Telemetry_NameDay(const char* name, uint32_t* day) {
+    if (name[0] < '1' || name[0] > '9' || name[1] != '_') return false;
+    uint32_t v = 0;
+    const char* p = name + 2;
+    if (*p < '0' || *p > '9') return false;
+    while (*p >= '0' && *p <= '9') v = v * 10 + (uint32_t)(*p++ - '0');
+    if (*p != '.') return false;
+    *day = v;
+    return true;
+}
+
+static bool Telemetry_Dir(void) {
+    if (!DirReady) {
+        FRESULT res = f_mkdir(TELEM_DIR);
+        DirReady = res == FR_OK || res == FR_EXIST;
+    }
+    return DirReady;
+}
+
+// Deletes whole days, oldest first, while the card is short of space. The
+// day being written stays.
+static void Telemetry_Prune(uint32_t today) {
+    FATFS* fs;
+    DWORD free_clst;
+    while (f_getfree(SDPath, &free_clst, &fs) == FR_OK &&
+           (uint64_t)free_clst * fs->csize * FF_MAX_SS < TELEM_MIN_FREE) {
+        DIR dir;
+        FILINFO fno;
+        uint32_t oldest = UINT32_MAX, day;
+        if (f_opendir(&dir, TELEM_DIR) != FR_OK) return;
+        while (f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+            if (Telemetry_NameDay(fno.fname, &day) && day < oldest) oldest = day;
+        }
+        f_closedir(&dir);
+        if (oldest >= today) return;
+
+        char name[32];
+        for (uint8_t dev = 1; dev <= MAX_DEVICES; dev++) {
+            Telemetry_Name(name, dev, oldest, "blk");
+            f_unlink(name);
+            Telemetry_Name(name, dev, oldest, "idx");
+            f_unlink(name);
+        }
+        printf("Telemetry: day %lu deleted for space\n", oldest);
+    }
+}
+
+// Appends a closed block to its day. Caller holds WriteMutex.
+static void Telemetry_WriteBlock(const uint8_t* blk) {
+    TelemBlockHdr h;
+    memcpy(&h, blk, sizeof(h));
+    int entry = telem_hdr_len(h.cols);
+    uint32_t day = h.t0 / TELEM_DAY_S;
+    if (!Telemetry_Dir()) return;
+
+    char name[32];
+    FIL data, idx;
+    Telemetry_Name(name, h.dev, day, "blk");
+    FRESULT res = f_open(&data, name, FA_OPEN_ALWAYS | FA_WRITE);
+    if (res == FR_NO_PATH) {
+        DirReady = false; // The card was formatted under us
+        if (Telemetry_Dir()) res = f_open(&data, name, FA_OPEN_ALWAYS | FA_WRITE);
+    }
+    if (res != FR_OK) return;
+    Telemetry_Name(name, h.dev, day, "idx");
+    if (f_open(&idx, name, FA_OPEN_ALWAYS | FA_WRITE) != FR_OK) {
+        f_close(&data);
+        return;
+    }
+    bool fresh = f_size(&data) == 0;
+
+    // Block n and entry n are written together; a reset between the two
+    // leaves one of them ahead, and the next block goes over it
+    uint32_t n = f_size(&data) / TELEM_BLOCK_SIZE;
+    if (f_size(&idx) / entry < n) n = f_size(&idx) / entry;
+    UINT bw = 0;
+    if (f_lseek(&data, n * TELEM_BLOCK_SIZE) == FR_OK &&
+        f_write(&data, blk, TELEM_BLOCK_SIZE, &bw) == FR_OK && bw == TELEM_BLOCK_SIZE &&
+        f_lseek(&idx, n * entry) == FR_OK) {
+        f_write(&idx, blk, entry, &bw);
+    }
+    f_close(&idx);
+    f_close(&data);
+
+    if (fresh) Telemetry_Prune(day);
+}
+
+// Closes the device's block and hands it to the log task. A block it has
+// not taken yet, after minutes without running, is written here first.
+// Caller holds TelemMutex.
+static void Telemetry_Close(TelemDevice* d) {
+    if (d->pending) {
+        xSemaphoreTake(WriteMutex, portMAX_DELAY);
+        if (d->pending) Telemetry_WriteBlock(d->closed);
+        d->pending = false;
+        xSemaphoreGive(WriteMutex);
+    }
+    if (telem_enc_finish(&d->enc, d->closed)) d->pending = true;
+}
+
+static SemaphoreHandle_t Telemetry_Mutex(void) {
+    if (TelemMutex == NULL) {
+        WriteMutex = xSemaphoreCreateMutex(); // Before TelemMutex, which the log task checks
+        TelemMutex = xSemaphoreCreateMutex();
+    }
+    return TelemMutex;
+}
+
+void Telemetry_SetTime(uint32_t epoch) {
+    if (epoch < TELEM_EPOCH_MIN) return;
+    EpochBase = epoch;
+    TickBase = xTaskGetTickCount();
+    TimeSet = true;
+}
+
+void Telemetry_Record(const DeviceStatus* status) {
+    if (!TimeSet || !status->connected || status->id < 1 || status->id > MAX_DEVICES) return;
+    TelemDevice* d = &Devices[status->id - 1];
+    uint32_t now = Telemetry_Now();
+    // Blocks of a day must follow each other in time: after the clock was
+    // set back, nothing is taken until it passes the last sample again
+    if (d->last && (now < d->last || now - d->last < TELEM_PERIOD_S)) return;
+
+    int32_t vals[TELEM_MAX_COLS];
+    int cols = telem_sample(status, vals);
+    if (!cols) return;
+
+    if (xSemaphoreTake(Telemetry_Mutex(), portMAX_DELAY) != pdTRUE) return;
+    if (d->enc.dev != status->id || d->enc.cols != cols) telem_enc_init(&d->enc, status->id, cols);
+    if (d->enc.count && now / TELEM_DAY_S != d->enc.t0 / TELEM_DAY_S) {
+        Telemetry_Close(d); // A block holds one day
+    }
+    int res = telem_enc_add(&d->enc, now, vals);
+    if (res == 0) {
+        Telemetry_Close(d);
+        res = telem_enc_add(&d->enc, now, vals);
+    }
+    if (res > 0) d->last = now;
+    xSemaphoreGive(TelemMutex);
+}
+
+void Telemetry_Service(void) {
+    if (TelemMutex == NULL) return;
+    xSemaphoreTake(WriteMutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (Devices[i].pending) {
+            Telemetry_WriteBlock(Devices[i].closed);
+            Devices[i].pending = false;
+        }
+    }
+    xSemaphoreGive(WriteMutex);
+}
+
+static bool Telemetry_ReadEntry(FIL* idx, uint32_t i, uint8_t* entry, int len) {
+    UINT br = 0;
+    return f_lseek(idx, i * len) == FR_OK && f_read(idx, entry, len, &br) == FR_OK && br == (UINT)len;
+}
+
+// Opens the next day of the query and finds its first block ending at or
+// after the range start
+static void Telemetry_QueryOpen(void) {
+    char name[32];
+    uint8_t entry[TELEM_HDR_SIZE + TELEM_COL_SIZE * TELEM_MAX_COLS];
+    int len = telem_hdr_len(QueryCols);
+    uint32_t day = QueryDay++;
+
+    Telemetry_Name(name, QueryDev, day, "idx");
+    if (f_open(&QueryIdx, name, FA_READ) != FR_OK) return;
+    Telemetry_Name(name, QueryDev, day, "blk");
+    if (f_open(&QueryData, name, FA_READ) != FR_OK) {
+        f_close(&QueryIdx);
+        return;
+    }
+    QueryDayOpen = true;
+    QueryBlocks = f_size(&QueryData) / TELEM_BLOCK_SIZE;
+    if (f_size(&QueryIdx) / len < QueryBlocks) QueryBlocks = f_size(&QueryIdx) / len;
+
+    // T1 grows with the block number
+    uint32_t lo = 0, hi = QueryBlocks;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        TelemBlockHdr h;
+        if (!Telemetry_ReadEntry(&QueryIdx, mid, entry, len)) break;
+        memcpy(&h, entry, sizeof(h));
+        if (h.t1 < Query.from) lo = mid + 1; else hi = mid;
+    }
+    QueryBlock = lo;
+}
+
+static void Telemetry_QueryClose(void) {
+    if (!QueryDayOpen) return;
+    f_close(&QueryData);
+    f_close(&QueryIdx);
+    QueryDayOpen = false;
+}
+
+// Takes the next block of the open day, from its index entry or decoded.
+// Returns the bytes read.
+static uint32_t Telemetry_QueryBlock(void) {
+    uint8_t entry[TELEM_HDR_SIZE + TELEM_COL_SIZE * TELEM_MAX_COLS];
+    int len = telem_hdr_len(QueryCols);
+    TelemBlockHdr h;
+    uint32_t i = QueryBlock++;
+    if (!Telemetry_ReadEntry(&QueryIdx, i, entry, len)) {
+        Telemetry_QueryClose();
+        return 0;
+    }
+    memcpy(&h, entry, sizeof(h));
+    if (h.magic == TELEM_BLOCK_MAGIC && h.t0 >= Query.to) {
+        Telemetry_QueryClose(); // Past the range
+        return len;
+    }
+    if (telem_query_index(&Query, entry, QueryField) != TELEM_IDX_DECODE) return len;
+    UINT br = 0;
+    if (f_lseek(&QueryData, i * TELEM_BLOCK_SIZE) == FR_OK &&
+        f_read(&QueryData, Block, TELEM_BLOCK_SIZE, &br) == FR_OK && br == TELEM_BLOCK_SIZE &&
+        telem_block_check(Block) == QueryCols) {
+        telem_query_block(&Query, Block, QueryField);
+    }
+    return len + br;
+}
+
+// Sends the answer, or an empty one, and ends the query
+static void Telemetry_EndQuery(bool answer) {
+    static uint8_t frame[MAX_PAYLOAD_LEN + 4];
+    if (!Querying) return;
+    Querying = false;
+    Telemetry_QueryClose();
+    if (!answer) {
+        UART_SendRaw(frame, pack_telem_data_message(frame, QueryId, 0, 0, NULL, NULL, 0));
+        return;
+    }
+    for (uint16_t first = 0; first < Query.points; first += TELEM_DATA_POINTS) {
+        uint8_t count = Query.points - first < TELEM_DATA_POINTS ? Query.points - first : TELEM_DATA_POINTS;
+        int len = pack_telem_data_message(frame, QueryId, Query.points, first,
+                                          &Query.min[first], &Query.max[first], count);
+        UART_SendRaw(frame, len);
+    }
+}
+
+void Telemetry_HandleQuery(const TelemQueryMsg* q) {
+    int cols = 0;
+    Telemetry_EndQuery(false); // One at a time: a new one replaces it
+    QueryId = q->id;
+    Querying = true;
+    if (q->dev < 1 || q->dev > MAX_DEVICES || !telem_fields(q->dev, &cols) ||
+        q->field >= cols || q->to <= q->from) {
+        Telemetry_EndQuery(false);
+        return;
+    }
+    QueryDev = q->dev;
+    QueryField = q->field;
+    QueryCols = cols;
+    QueryLast = (q->to - 1) / TELEM_DAY_S;
+    QueryDay = q->from / TELEM_DAY_S;
+    if (QueryLast - QueryDay >= TELEM_QUERY_DAYS) QueryDay = QueryLast - TELEM_QUERY_DAYS + 1;
+    telem_query_init(&Query, q->from, q->to, q->points);
+
+    // The samples not on the card yet are taken now, the card's as the
+    // steps get to them: a block closed in between is in both, which the
+    // min/max do not mind, and none is missed
+    if (xSemaphoreTake(Telemetry_Mutex(), portMAX_DELAY) != pdTRUE) return;
+    TelemDevice* d = &Devices[q->dev - 1];
+    if (d->enc.dev == q->dev && d->enc.cols == cols) telem_query_enc(&Query, &d->enc, q->field);
+    if (d->pending && telem_block_check(d->closed) == cols) telem_query_block(&Query, d->closed, q->field);
+    xSemaphoreGive(TelemMutex);
+}
+
+void Telemetry_Process(void) {
+    uint32_t budget = TELEM_STEP_BYTES;
+    while (Querying && budget) {
+        if (QueryDayOpen && QueryBlock < QueryBlocks) {
+            uint32_t read = Telemetry_QueryBlock();
+            budget -= read < budget ? read : budget;
+        } else {
+            Telemetry_QueryClose();
+            if (QueryDay > QueryLast) {
+                Telemetry_EndQuery(true);
+                return;
+            }
+            // Opening a day walks the directory and the index's chain: a
+            // step of its own
+            if (budget == TELEM_STEP_BYTES) Telemetry_QueryOpen();
+            return;
+        }
+    }
+}
+
+void Telemetry_Flush(void) {
+    if (TelemMutex == NULL) return;
+    if (xSemaphoreTake(TelemMutex, portMAX_DELAY) != pdTRUE) return;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (Devices[i].enc.count) Telemetry_Close(&Devices[i]);
+    }
+    xSemaphoreGive(TelemMutex);
+    Telemetry_Service();
+}
@@ -0,0 +1,31 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ecoflow_protocol.h"
+
+// Telemetry recorder: DeviceStatus samples to columnar blocks on the SD card
+// (telem_block.h). Calls come from the UART task, after LogManager_Init
+// mounted the card, except Telemetry_Service (log task) and Telemetry_Flush.
+// None of the UART task's calls waits on the card.
+
+// Wall clock from the ESP32 (CMD_TIME_SYNC); samples are dropped until it arrives
+void Telemetry_SetTime(uint32_t epoch);
+
+// Takes a sample of a device at most every TELEM_PERIOD_S seconds
+void Telemetry_Record(const DeviceStatus* status);
+
+// Starts answering CMD_TELEM_QUERY; a query still running gets an empty answer
+void Telemetry_HandleQuery(const TelemQueryMsg* q);
+
+// One step of the query, about 8 KB read; sends the CMD_TELEM_DATA pages at the end
+void Telemetry_Process(void);
+
+// Writes the blocks Telemetry_Record closed, from the log task
+void Telemetry_Service(void);
+
+// Partly filled blocks onto the card, e.g. before a reset
+void Telemetry_Flush(void);
+
+#endif // TELEMETRY_H
@@ -10,3 +10,15 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
         Fan_UART_RxCpltCallback(huart);
     }
 }
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance == USART6) {
+        UART_RxHalfCpltCallback(huart);
+    }
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance == USART6) {
+        UART_ErrorCallback(huart);
+    }
+}
@@ -1,9 +1,15 @@
 #include "uart_task.h"
 #include "ecoflow_protocol.h"
+#include "link_txq.h"
+#include "link_baud.h"
+#include "link_frame.h"
+#include "log_levels.h"
 #include "display_task.h"
 #include "stm32f4xx_hal.h"
 #include "ui/ui_lvgl.h" // For UI_UpdateConnectionStatus
 #include "log_manager.h"
+#include "telemetry.h"
+#include "ota_task.h"
 #include <string.h>
 #include <stdio.h>
 #include "queue.h"
@@ -14,73 +20,94 @@ extern IWDG_HandleTypeDef hiwdg; // Refresh Watchdog during long ops
 UART_HandleTypeDef huart6;
 SemaphoreHandle_t uartTxMutex;
 
-// Ring Buffer Implementation
-#define RING_BUFFER_SIZE 2048 // Increased to support OTA Chunks (1KB payload + overhead)
-typedef struct {
-    uint8_t buffer[RING_BUFFER_SIZE];
-    volatile uint16_t head;
-    volatile uint16_t tail;
-} RingBuffer;
-
-static RingBuffer rx_ring_buffer;
+// RX: USART6 -> DMA2 Stream1 (channel 5) in circular mode. The DMA writes the
+// ring without a per-byte interrupt; the UART task reads behind it. 16 KB lasts
+// ~180 ms at 921600, longer than the SD work this task does between reads
+// (the old 2 KB per-byte-IRQ ring filled in ~10 ms at 2M).
+#define UART_RX_MAX_BAUD 921600 // Highest rate the slave accepts (see link_baud_set_max)
+static uint8_t rxRing[UART_RX_RING_SIZE];
+DMA_HandleTypeDef hdma_usart6_rx;
+static volatile uint32_t rxHalves = 0;  // Half-buffer completions (HT/TC IRQs) since the DMA started
+static uint32_t rxRead = 0;             // Bytes consumed since the DMA started, UART task only
+static volatile bool rxRestart = false; // An error aborted the DMA, restart from the task
+
+// TX Queue: any task enqueues packed frames by priority class, the UART task
+// is the only writer (see UART_PumpTx).
+static LinkTxQueue uartTxq;
+static volatile bool uartTxqReady = false;
+static TaskHandle_t uartTaskHandle = NULL;
+
+static uint32_t UART_NowUs(void) {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS * 1000u;
+}
 
-// TX Queue for sending commands from UI Task to UART Task
-typedef enum {
-    MSG_WAVE2_SET,
-    MSG_AC_SET,
-    MSG_DC_SET,
-    MSG_SET_VALUE,
-    MSG_POWER_OFF,
-    MSG_GET_DEBUG_INFO,
-    MSG_CONNECT_DEVICE,
-    MSG_FORGET_DEVICE,
-    MSG_ENABLE_HOTSPOT
-} TxMsgType;
-
-typedef struct {
-    TxMsgType type;
-    union {
-        Wave2SetMsg w2;
-        uint8_t enable;
-        struct {
-            uint8_t type;
-            int value;
-        } set_val;
-        uint8_t device_type;
-    } data;
-} TxMessage;
-
-static QueueHandle_t uartTxQueue;
-
-static void rb_init(RingBuffer *rb) {
-    rb->head = 0;
-    rb->tail = 0;
+static void UART_PumpTx(void);
+static void UART_TransmitFrame(const uint8_t *frame, int len);
+static volatile uint8_t uartFraming = LINK_FRAMING_LEGACY; // Set by the negotiator
+
+// Baud negotiation / ping echo (slave side, the ESP32 drives it)
+static LinkBaudCtx linkBaud;
+static volatile uint32_t uartLineErrors = 0; // Bumped from the error IRQ
+
+/**
+ * @brief Bytes the DMA has written since it started. The half count can lag the
+ * DMA counter by one half when the HT/TC IRQ is still pending, which the
+ * masked offset absorbs.
+ */
+static uint32_t rx_written(void) {
+    uint32_t halves, remaining;
+    do {
+        halves = rxHalves;
+        remaining = __HAL_DMA_GET_COUNTER(&hdma_usart6_rx);
+    } while (halves != rxHalves);
+    uint32_t pos = UART_RX_RING_SIZE - remaining;
+    uint32_t half_start = (halves & 1u) * (UART_RX_RING_SIZE / 2);
+    return halves * (UART_RX_RING_SIZE / 2) + ((pos - half_start) & (UART_RX_RING_SIZE - 1));
 }
 
-static void rb_push(RingBuffer *rb, uint8_t byte) {
-    uint16_t next_head = (rb->head + 1) % RING_BUFFER_SIZE;
-    if (next_head != rb->tail) {
-        rb->buffer[rb->head] = byte;
-        rb->head = next_head;
+/**
+ * @brief Pops one received byte. @return 1 with a byte, 0 when empty, -1 when
+ * the DMA lapped the reader: the unread bytes are gone and have been skipped.
+ */
+static int rx_pop(uint8_t *byte) {
+    uint32_t unread = rx_written() - rxRead;
+    if (unread == 0) return 0;
+    if (unread <= UART_RX_RING_SIZE) {
+        *byte = rxRing[rxRead & (UART_RX_RING_SIZE - 1)];
+        // Close to a lap the DMA may have overwritten the byte while it was read
+        if (unread < UART_RX_RING_SIZE / 2 || rx_written() - rxRead <= UART_RX_RING_SIZE) {
+            rxRead++;
+            return 1;
+        }
     }
+    rxRead = rx_written();
+    return -1;
 }
 
-static int rb_pop(RingBuffer *rb, uint8_t *byte) {
-    if (rb->head == rb->tail) {
-        return 0; // Empty
-    }
-    *byte = rb->buffer[rb->tail];
-    rb->tail = (rb->tail + 1) % RING_BUFFER_SIZE;
-    return 1;
+/**
+ * @brief (Re)starts the circular RX DMA at the start of the ring. Anything not
+ * yet read is dropped. UART task only.
+ */
+static void UART_RxStart(void) {
+    HAL_UART_AbortReceive(&huart6);
+    rxHalves = 0;
+    rxRead = 0;
+    HAL_UART_Receive_DMA(&huart6, rxRing, UART_RX_RING_SIZE);
 }
 
-// ISR Variables
-uint8_t rx_byte_isr;
+void UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance == USART6) rxHalves++;
+}
 
 void UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance == USART6) rxHalves++;
+}
+
+void UART_ErrorCallback(UART_HandleTypeDef *huart) {
     if (huart->Instance == USART6) {
-        rb_push(&rx_ring_buffer, rx_byte_isr);
-        HAL_UART_Receive_IT(&huart6, &rx_byte_isr, 1);
+        uartLineErrors++;
+        // HAL aborts a DMA reception on any error; restart it from the task
+        if (huart->RxState == HAL_UART_STATE_READY) rxRestart = true;
     }
 }
 
@@ -98,18 +125,7 @@ static uint8_t currentDeviceIndex = 0;
 static uint32_t last_device_rx_time[MAX_DEVICES] = {0};
 
 // Packet Parsing State
-typedef enum {
-    PARSE_START,
-    PARSE_CMD,
-    PARSE_LEN_L,
-    PARSE_PAYLOAD,
-    PARSE_CRC
-} ParseState;
-
-static ParseState parseState = PARSE_START;
-static uint8_t parseBuffer[1024]; // Increased for safety
-static uint16_t parseIndex = 0;
-static uint8_t expectedPayloadLen = 0;
+static LinkFrameParser rxParser;
 
 static void UART_Init(void) {
     __HAL_RCC_USART6_CLK_ENABLE();
@@ -124,7 +140,7 @@ static void UART_Init(void) {
     HAL_GPIO_Init(GPIOG, &GPIO_InitStruct);
 
     huart6.Instance = USART6;
-    huart6.Init.BaudRate = 460800;
+    huart6.Init.BaudRate = LINK_BAUD_BASE;
     huart6.Init.WordLength = UART_WORDLENGTH_8B;
     huart6.Init.StopBits = UART_STOPBITS_1;
     huart6.Init.Parity = UART_PARITY_NONE;
@@ -133,40 +149,73 @@ static void UART_Init(void) {
     huart6.Init.OverSampling = UART_OVERSAMPLING_16;
     HAL_UART_Init(&huart6);
 
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    hdma_usart6_rx.Instance = DMA2_Stream1;
+    hdma_usart6_rx.Init.Channel = DMA_CHANNEL_5;
+    hdma_usart6_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_usart6_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart6_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart6_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart6_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart6_rx.Init.Mode = DMA_CIRCULAR;
+    hdma_usart6_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_usart6_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    HAL_DMA_Init(&hdma_usart6_rx);
+    __HAL_LINKDMA(&huart6, hdmarx, hdma_usart6_rx);
+
+    HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
     HAL_NVIC_SetPriority(USART6_IRQn, 5, 0);
     HAL_NVIC_EnableIRQ(USART6_IRQn);
 
-    rb_init(&rx_ring_buffer);
-    HAL_UART_Receive_IT(&huart6, &rx_byte_isr, 1);
+    UART_RxStart();
+}
+
+// One ESP32 log line, sent on its own or in a CMD_ESP_LOG_BATCH: the
+// payload of CMD_ESP_LOG_DATA or CMD_ESP_LOG_REC
+static void UART_HandleEspLogLine(uint8_t cmd, const uint8_t *p, uint8_t len) {
+    if (cmd == CMD_ESP_LOG_DATA) {
+        // [Level:1][TagLen:1][Tag][Msg]
+        if (len < 2 || len < 2 + p[1]) return;
+        char tag[32];
+        uint8_t tagLen = p[1] > 31 ? 31 : p[1];
+        memcpy(tag, &p[2], tagLen);
+        tag[tagLen] = 0;
+        if (!LogManager_Wants(p[0], tag)) return;
+
+        int msgLen = len - (2 + p[1]);
+        if (msgLen > 0) {
+            char msg[256];
+            memcpy(msg, &p[2 + p[1]], msgLen);
+            msg[msgLen] = 0;
+            LogManager_HandleEspLog(p[0], tag, msg);
+        }
+    } else if (cmd == CMD_ESP_LOG_REC) {
+        // [Level:1][FmtId:4][TagId:2][Args...]
+        if (len < 7) return;
+        uint32_t fmt_id;
+        uint16_t tag_id;
+        memcpy(&fmt_id, &p[1], 4);
+        memcpy(&tag_id, &p[5], 2);
+        LogManager_WriteRecord(p[0], fmt_id, tag_id, &p[7], (uint8_t)(len - 7));
+    }
 }
 
 static void process_packet(uint8_t *packet, uint16_t total_len) {
     uint8_t cmd = packet[1];
 
-    // Check OTA Commands first
-    if (cmd == CMD_OTA_START) {
-        // Send NACK to force ESP32 to retry (waiting for Bootloader)
-        // This solves the "Double OTA" issue where ESP32 times out waiting for ACK from App
-        uint8_t nack[4];
-        nack[0] = 0xAA;
-        nack[1] = 0x15; // CMD_OTA_NACK
-        nack[2] = 0x00; // Length
-        nack[3] = calculate_crc8(&nack[1], 2);
-
-        HAL_UART_Transmit(&huart6, nack, 4, 100);
-        HAL_Delay(50); // Ensure transmission
-
-        // Enable Backup Access
-        HAL_PWR_EnableBkUpAccess();
-        __HAL_RCC_BKPSRAM_CLK_ENABLE();
+    // Ping/echo and baud negotiation frames
+    if (link_baud_on_frame(&linkBaud, packet, UART_NowUs())) return;
 
-        RTC->BKP0R = 0xDEADBEEF;
+    // OTA frames go to the background receiver (ota_task.c)
+    if (OtaTask_SubmitFrame(packet, total_len)) return;
 
-        HAL_NVIC_SystemReset();
-    }
     // ... Log Commands ...
-    else if (cmd == CMD_LOG_LIST_REQ) {
-        LogManager_HandleListReq();
+    if (cmd == CMD_LOG_LIST_REQ) {
+        uint16_t cursor;
+        if (unpack_log_list_req_message(packet, &cursor) == 0) {
+            LogManager_HandleListReq(cursor);
+        }
     }
     else if (cmd == CMD_LOG_DOWNLOAD_REQ) {
         char name[32];
@@ -192,30 +241,45 @@ static void process_packet(uint8_t *packet, uint16_t total_len) {
             LogManager_SeekDownload(offset);
         }
     }
-    else if (cmd == CMD_ESP_LOG_DATA) {
-        // [Level:1][TagLen:1][Tag][Msg]
-        // Manual unpack since implementation was custom
-        uint8_t payload_len = packet[2];
-        if (payload_len >= 2) {
-            uint8_t level = packet[3];
-            uint8_t tagLen = packet[4];
-            if (payload_len >= 2 + tagLen) {
-                char tag[32];
-                if (tagLen > 31) tagLen = 31;
-                memcpy(tag, &packet[5], tagLen);
-                tag[tagLen] = 0;
-
-                int msgLen = payload_len - (2 + tagLen);
-                if (msgLen > 0) {
-                    char msg[256];
-                    if (msgLen > 255) msgLen = 255;
-                    memcpy(msg, &packet[5+packet[4]], msgLen); // packet[4] is actual tagLen in packet
-                    msg[msgLen] = 0;
-                    LogManager_HandleEspLog(level, tag, msg);
-                }
+    else if (cmd == CMD_LOG_CREDIT) {
+        uint32_t offset;
+        uint8_t credits;
+        if (unpack_log_credit_message(packet, &offset, &credits) == 0) {
+            LogManager_HandleCredit(offset, credits);
+        }
+    }
+    else if (cmd == CMD_LOG_SEARCH) {
+        LogSearchMsg msg;
+        if (unpack_log_search_message(packet, &msg) == 0) {
+            LogManager_HandleSearch(&msg);
+        }
+    }
+    else if (cmd == CMD_ESP_LOG_DATA || cmd == CMD_ESP_LOG_REC) {
+        UART_HandleEspLogLine(cmd, &packet[3], packet[2]);
+    }
+    else if (cmd == CMD_ESP_LOG_BATCH) {
+        uint8_t count;
+        if (unpack_esp_log_batch_message(packet, &count) == 0) {
+            uint8_t line_cmd, line_len;
+            uint8_t line[MAX_PAYLOAD_LEN];
+            LogBatchCursor c = {0};
+            while (unpack_esp_log_batch_line(packet, &c, &line_cmd, line, &line_len) >= 0) {
+                UART_HandleEspLogLine(line_cmd, line, line_len);
             }
         }
     }
+    else if (cmd == CMD_LOG_LEVEL_SET || cmd == CMD_LOG_LEVEL_GET) {
+        uint8_t level;
+        char tag[LOG_LEVELS_TAG_MAX + 1];
+        if (cmd == CMD_LOG_LEVEL_GET || unpack_log_level_set_message(packet, &level, tag, sizeof(tag)) == 0) {
+            if (cmd == CMD_LOG_LEVEL_SET) LogManager_SetLevel(tag, level);
+            // The table as it now is, whether the change was taken or not
+            uint8_t table[LOG_LEVELS_PACKED_MAX];
+            uint8_t buf[LOG_LEVELS_PACKED_MAX + 4];
+            int len = LogManager_GetLevels(table);
+            UART_SendRaw(buf, pack_log_level_list_message(buf, table, (uint8_t)len));
+        }
+    }
     // ... Normal Commands ...
     else if (cmd == CMD_HANDSHAKE_ACK) {
         if (protocolState == STATE_WAIT_HANDSHAKE_ACK) {
@@ -257,6 +321,19 @@ static void process_packet(uint8_t *packet, uint16_t total_len) {
              event.type = DISPLAY_EVENT_UPDATE_BATTERY;
              memcpy(&event.data.deviceStatus, &status, sizeof(DeviceStatus));
              xQueueSend(displayQueue, &event, 0);
+             Telemetry_Record(&status);
+        }
+    }
+    else if (cmd == CMD_TIME_SYNC) {
+        uint32_t epoch;
+        if (unpack_time_sync_message(packet, &epoch) == 0) {
+            Telemetry_SetTime(epoch);
+        }
+    }
+    else if (cmd == CMD_TELEM_QUERY) {
+        TelemQueryMsg q;
+        if (unpack_telem_query_message(packet, &q) == 0) {
+            Telemetry_HandleQuery(&q);
         }
     }
     else if (cmd == CMD_DEBUG_INFO) {
@@ -272,59 +349,137 @@ static void process_packet(uint8_t *packet, uint16_t total_len) {
 
 // ... Public Send Functions ...
 void UART_SendWave2Set(Wave2SetMsg *msg) {
-    if (uartTxQueue) {
-        TxMessage tx; tx.type = MSG_WAVE2_SET; tx.data.w2 = *msg;
-        xQueueSend(uartTxQueue, &tx, 0);
-    }
+    uint8_t buf[16]; UART_SendRaw(buf, pack_set_wave2_message(buf, msg->type, msg->value));
 }
 void UART_SendPowerOff(void) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_POWER_OFF; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_power_off_message(buf));
 }
 void UART_SendACSet(uint8_t enable) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_AC_SET; tx.data.enable = enable; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_set_ac_message(buf, enable));
 }
 void UART_SendDCSet(uint8_t enable) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_DC_SET; tx.data.enable = enable; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_set_dc_message(buf, enable));
 }
 void UART_SendSetValue(uint8_t type, int value) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_SET_VALUE; tx.data.set_val.type = type; tx.data.set_val.value = value; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[16]; UART_SendRaw(buf, pack_set_value_message(buf, type, value));
 }
 void UART_SendGetDebugInfo(void) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_GET_DEBUG_INFO; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_get_debug_info_message(buf));
 }
 void UART_SendConnectDevice(uint8_t type) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_CONNECT_DEVICE; tx.data.device_type = type; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_connect_device_message(buf, type));
 }
 void UART_SendForgetDevice(uint8_t type) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_FORGET_DEVICE; tx.data.device_type = type; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_forget_device_message(buf, type));
 }
 void UART_SendEnableHotspot(void) {
-    if (uartTxQueue) { TxMessage tx; tx.type = MSG_ENABLE_HOTSPOT; xQueueSend(uartTxQueue, &tx, 0); }
+    uint8_t buf[8]; UART_SendRaw(buf, pack_simple_cmd_message(buf, CMD_ENABLE_HOTSPOT));
 }
 void UART_GetKnownDevices(DeviceList *list) { memcpy(list, &knownDevices, sizeof(DeviceList)); }
 
-
-void UART_SendRaw(uint8_t* data, uint16_t len) {
-    if (uartTxMutex) {
+/**
+ * @brief Writes every frame the scheduler releases. UART task only.
+ * Bulk frames held back by the bandwidth cap stay queued for the next call.
+ */
+static void UART_PumpTx(void) {
+    static uint8_t frame[LINK_FRAME_MAX];
+    int len;
+    while ((len = link_txq_pop(&uartTxq, frame, UART_NowUs())) > 0) {
         if (xSemaphoreTake(uartTxMutex, 100) == pdTRUE) {
-            HAL_UART_Transmit(&huart6, data, len, 100);
+            UART_TransmitFrame(frame, len);
             xSemaphoreGive(uartTxMutex);
         }
     }
 }
 
+/**
+ * @brief Blocking write of one legacy-layout frame in the current framing.
+ */
+static void UART_TransmitFrame(const uint8_t *frame, int len) {
+    if (uartFraming == LINK_FRAMING_COBS) {
+        static uint8_t encoded[COBS_FRAME_MAX];
+        HAL_UART_Transmit(&huart6, encoded, pack_cobs_frame(encoded, frame, len), 100);
+    } else {
+        HAL_UART_Transmit(&huart6, (uint8_t*)frame, len, 100);
+    }
+}
+
+void UART_SendRaw(uint8_t* data, uint16_t len) {
+    if (!uartTxqReady || len < 2) return;
+
+    LinkPriority prio = link_priority_for_cmd(data[1]);
+    bool inUartTask = (xTaskGetCurrentTaskHandle() == uartTaskHandle);
+    TickType_t start = xTaskGetTickCount();
+
+    while (!link_txq_push(&uartTxq, prio, data, len, UART_NowUs())) {
+        // Full ring. Producers running in the UART task (log list/download)
+        // drain it themselves and retry rather than lose the frame.
+        if (!inUartTask || (xTaskGetTickCount() - start) > pdMS_TO_TICKS(100)) {
+            link_txq_give_up(&uartTxq, prio);
+            return;
+        }
+        UART_PumpTx();
+        vTaskDelay(1);
+    }
+    if (inUartTask) UART_PumpTx();
+}
+
+/**
+ * @brief Reprograms USART6 for a new baud and framing. Called by the negotiator in the
+ * UART task right after it queued its reply, which must leave at the old rate.
+ */
+static void UART_ApplyBaud(uint32_t baud, uint8_t framing) {
+    UART_PumpTx();
+    uint32_t start = HAL_GetTick();
+    while (__HAL_UART_GET_FLAG(&huart6, UART_FLAG_TC) == RESET && (HAL_GetTick() - start) < 10) {}
+
+    xSemaphoreTake(uartTxMutex, portMAX_DELAY);
+    HAL_UART_AbortReceive(&huart6);
+    huart6.Init.BaudRate = baud;
+    HAL_UART_Init(&huart6);
+    link_parser_set_framing(&rxParser, framing);
+    uartFraming = framing;
+    UART_RxStart();
+    link_txq_set_bulk_rate(&uartTxq, LINK_BULK_RATE_FOR_BAUD(baud), 2 * LINK_FRAME_MAX);
+    xSemaphoreGive(uartTxMutex);
+
+    LogManager_Write(3, "UART", baud == LINK_BAUD_BASE ? "Link baud reset to base" : "Link baud raised");
+}
+
+static void UART_LinkSend(void *user, const uint8_t *frame, int len) {
+    (void)user;
+    UART_SendRaw((uint8_t*)frame, (uint16_t)len);
+}
+
+static void UART_LinkSetBaud(void *user, uint32_t baud, uint8_t framing) {
+    (void)user;
+    UART_ApplyBaud(baud, framing);
+}
+
 void StartUARTTask(void * argument) {
     UART_Init();
 
     uartTxMutex = xSemaphoreCreateMutex();
+    uartTaskHandle = xTaskGetCurrentTaskHandle();
+    link_txq_init(&uartTxq);
+    // Log list/data frames are not resent by the ESP32 if silently evicted
+    link_txq_set_policy(&uartTxq, LINK_PRIO_BULK, LINK_OVERFLOW_REJECT);
+    link_txq_set_bulk_rate(&uartTxq, LINK_BULK_RATE_FOR_BAUD(huart6.Init.BaudRate), 2 * LINK_FRAME_MAX);
+    uartTxqReady = true;
+
+    LinkBaudOps linkOps = { UART_LinkSend, UART_LinkSetBaud, NULL };
+    link_baud_init(&linkBaud, LINK_ROLE_SLAVE, &linkOps, UART_NowUs());
+    link_baud_set_max(&linkBaud, UART_RX_MAX_BAUD);
+    link_parser_init(&rxParser);
+    uint32_t seenLineErrors = 0;
 
     // Initialize Log Manager in Task Context (Safe for Mutex/FS)
     LogManager_Init();
     LogManager_Write(3, "SYS", "UART Task: Boot Complete");
-    uartTxQueue = xQueueCreate(10, sizeof(TxMessage));
     uint8_t tx_buf[32];
     int len;
     uint8_t b;
+    int got;
     TickType_t lastActivityTime = xTaskGetTickCount();
     TickType_t lastHandshakeTime = 0;
 
@@ -332,68 +487,39 @@ void StartUARTTask(void * argument) {
         HAL_IWDG_Refresh(&hiwdg); // Refresh IWDG in high-priority task
         // Process Log Streaming
         LogManager_Process();
+        Telemetry_Process();
         // 1. Process RX
-        while (rb_pop(&rx_ring_buffer, &b)) {
+        if (rxRestart) {
+            rxRestart = false;
+            UART_RxStart();
+            link_parser_set_framing(&rxParser, uartFraming);
+        }
+        while ((got = rx_pop(&b)) != 0) {
             HAL_IWDG_Refresh(&hiwdg); // Prevent Watchdog timeout during burst processing (e.g. Logs)
-            switch (parseState) {
-                case PARSE_START:
-                    if (b == START_BYTE) {
-                        parseBuffer[0] = b;
-                        parseIndex = 1;
-                        parseState = PARSE_CMD;
-                    }
-                    break;
-                case PARSE_CMD:
-                    parseBuffer[parseIndex++] = b;
-                    parseState = PARSE_LEN_L;
-                    break;
-                case PARSE_LEN_L:
-                    parseBuffer[parseIndex++] = b;
-                    expectedPayloadLen = b;
-                    if (expectedPayloadLen > MAX_PAYLOAD_LEN) {
-                        parseState = PARSE_START;
-                        parseIndex = 0;
-                    } else {
-                        if (expectedPayloadLen == 0) parseState = PARSE_CRC;
-                        else parseState = PARSE_PAYLOAD;
-                    }
-                    break;
-                case PARSE_PAYLOAD:
-                    parseBuffer[parseIndex++] = b;
-                    if (parseIndex == (3 + expectedPayloadLen)) parseState = PARSE_CRC;
-                    break;
-                case PARSE_CRC:
-                    {
-                        uint8_t received_crc = b;
-                        uint8_t calcd_crc = calculate_crc8(&parseBuffer[1], parseIndex - 1);
-                        if (received_crc == calcd_crc) {
-                            parseBuffer[parseIndex++] = b;
-                            process_packet(parseBuffer, parseIndex);
-                        }
-                    }
-                    parseState = PARSE_START;
-                    parseIndex = 0;
-                    break;
+            if (got < 0) {
+                // Lapped by the DMA: the partial frame is gone, treat it as a line error
+                link_parser_set_framing(&rxParser, uartFraming);
+                link_baud_on_error(&linkBaud, UART_NowUs());
+                continue;
+            }
+            LinkParseResult r = link_parser_feed(&rxParser, b);
+            if (r == LINK_PARSE_FRAME) {
+                process_packet(rxParser.buf, rxParser.frame_len);
+            } else if (r == LINK_PARSE_CRC_ERROR) {
+                link_baud_on_error(&linkBaud, UART_NowUs());
+                OtaTask_FrameError();
             }
         }
 
-        // 2. Process TX
-        TxMessage tx;
-        if (xQueueReceive(uartTxQueue, &tx, 0) == pdTRUE) {
-            uint8_t buf[32];
-            int len = 0;
-            if (tx.type == MSG_WAVE2_SET) len = pack_set_wave2_message(buf, tx.data.w2.type, tx.data.w2.value);
-            else if (tx.type == MSG_AC_SET) len = pack_set_ac_message(buf, tx.data.enable);
-            else if (tx.type == MSG_DC_SET) len = pack_set_dc_message(buf, tx.data.enable);
-            else if (tx.type == MSG_SET_VALUE) len = pack_set_value_message(buf, tx.data.set_val.type, tx.data.set_val.value);
-            else if (tx.type == MSG_POWER_OFF) len = pack_power_off_message(buf);
-            else if (tx.type == MSG_GET_DEBUG_INFO) len = pack_get_debug_info_message(buf);
-            else if (tx.type == MSG_CONNECT_DEVICE) len = pack_connect_device_message(buf, tx.data.device_type);
-            else if (tx.type == MSG_FORGET_DEVICE) len = pack_forget_device_message(buf, tx.data.device_type);
-            else if (tx.type == MSG_ENABLE_HOTSPOT) len = pack_simple_cmd_message(buf, CMD_ENABLE_HOTSPOT);
-
-            if (len > 0) UART_SendRaw(buf, len);
+        // Link supervision: line errors, probation and silence fallback
+        while (seenLineErrors != uartLineErrors) {
+            seenLineErrors++;
+            link_baud_on_error(&linkBaud, UART_NowUs());
         }
+        link_baud_tick(&linkBaud, UART_NowUs());
+
+        // 2. Process TX (strict priority, bulk rate limited)
+        UART_PumpTx();
 
         // 3. State Machine
         if ((xTaskGetTickCount() - lastActivityTime) > pdMS_TO_TICKS(200)) {
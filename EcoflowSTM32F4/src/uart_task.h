@@ -20,10 +20,15 @@ void UART_SendForgetDevice(uint8_t type);
 void UART_SendEnableHotspot(void);
 void UART_GetKnownDevices(DeviceList *list);
 
+#define UART_RX_RING_SIZE 16384 ///< USART6 DMA ring, a power of two
+
 // Helper for IRQ dispatch
 void UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void UART_RxHalfCpltCallback(UART_HandleTypeDef *huart);
+void UART_ErrorCallback(UART_HandleTypeDef *huart);
 
-// Direct Send (Thread Safe)
+// Queue a packed frame for transmission (any task). Priority class is
+// derived from the command byte; the UART task writes it out.
 void UART_SendRaw(uint8_t* data, uint16_t len);
 
 #endif // UART_TASK_H
@@ -17,6 +17,8 @@
 #include "lvgl.h"
 #include "uart_task.h" // Added for UART commands
 #include "fan_task.h"  // Added for Fan/Amb Temp
+#include "log_manager.h" // Flush before reboot
+#include "telemetry.h"
 #include "ui_utils.h"  // For safe aligned access
 #include <stdio.h>
 #include <math.h>
@@ -327,6 +329,8 @@ static void event_power_off_confirm(lv_event_t * e) {
     HAL_Delay(3000);
 
     // Reboot
+    Telemetry_Flush();
+    LogManager_Flush();
     NVIC_SystemReset();
 }
 
@@ -8,6 +8,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include "ota_rx.h"
 
 // Define Application Address (Sector 2)
 #define APP_ADDRESS 0x08008000
@@ -15,14 +16,14 @@
 // UART Protocol
 #define START_BYTE 0xAA
 #define CMD_OTA_START 0xA0
-#define CMD_OTA_CHUNK 0xA1
-#define CMD_OTA_END   0xA2
 #define CMD_OTA_APPLY 0xA3
+#define CMD_OTA_WCHUNK 0xA4
 #define CMD_OTA_ACK   0x06
 #define CMD_OTA_NACK  0x15
+// The other OTA commands are handled by the shared receiver, ota_rx.c
 
-// Ring Buffer Definition
-#define RING_BUFFER_SIZE 2048
+// Ring Buffer Definition (holds a full window of chunks while programming)
+#define RING_BUFFER_SIZE 4096
 typedef struct {
     uint8_t buffer[RING_BUFFER_SIZE];
     volatile uint16_t head;
@@ -32,6 +33,13 @@ typedef struct {
 RingBuffer rx_ring_buffer;
 uint8_t rx_byte_isr;
 
+// Staging between the image decoder and the flash, indexed by image offset
+// modulo its size, and the decoder's match history. Programmed as the erase
+// schedule allows; 120 KB covers the ~1 s a 128 KB sector erase blocks the
+// controller at 921600 baud.
+#define STAGE_SIZE (OTA_RX_CHUNK * 512)
+static uint8_t stage[STAGE_SIZE];
+
 // Register Definitions
 #ifndef FLASH_OPTCR_BFB2
 #define FLASH_OPTCR_BFB2 (1 << 4)
@@ -50,7 +58,7 @@ void UART_Init(void);
 void USART3_Init(void);
 void MX_IWDG_Init(void);
 void GPIO_Init(void);
-void Bootloader_OTA_Loop(void);
+void Bootloader_OTA_Loop(const uint8_t* first);
 void Serial_Log(const char* fmt, ...);
 void ClearFlashFlags(void);
 
@@ -125,50 +133,25 @@ HAL_StatusTypeDef UART_ReadBuffer(uint8_t* out, uint16_t len, uint32_t timeout)
 }
 
 
-// CRC32 Table (Standard Ethernet 0x04C11DB7)
-static const uint32_t crc32_table[] = {
-    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
-    0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
-    0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac, 0x5bd4b01b, 0x569796c2, 0x52568b75,
-    0x6a1936c8, 0x6ed82b7f, 0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a, 0x745e66cd,
-    0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039, 0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5,
-    0xbe2b5b58, 0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033, 0xa4ad16ea, 0xa06c0b5d,
-    0xd4326d90, 0xd0f37027, 0xddb056fe, 0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
-    0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4, 0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d,
-    0x34867077, 0x30476dc0, 0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5, 0x2ac12072,
-    0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16, 0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca,
-    0x7897ab07, 0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c, 0x6211e6b5, 0x66d0fb02,
-    0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1, 0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
-    0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b, 0xbb60adfc, 0xb6238b25, 0xb2e29692,
-    0x8aad2b2f, 0x8e6c3698, 0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d, 0x94ea7b2a,
-    0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e, 0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2,
-    0xc6bcf05f, 0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34, 0xdc3abded, 0xd8fba05a,
-    0x690ce0ee, 0x6dcdfd59, 0x608edb80, 0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
-    0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a, 0x58c1663d, 0x558240e4, 0x51435d53,
-    0x251d3b9e, 0x21dc2629, 0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c, 0x3b5a6b9b,
-    0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff, 0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623,
-    0xf12f560e, 0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65, 0xeba91bbc, 0xef68060b,
-    0xd727bbb6, 0xd3e6a601, 0xdea580d8, 0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
-    0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2, 0xaafbe615, 0xa7b8c0cc, 0xa379dd7b,
-    0x9b3660c6, 0x9ff77d71, 0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74, 0x857130c3,
-    0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640, 0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c,
-    0x7b827d21, 0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a, 0x61043093, 0x65c52d24,
-    0x119b4be9, 0x155a565e, 0x18197087, 0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
-    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d, 0x2056cd3a, 0x2d15ebe3, 0x29d4f654,
-    0xc5a92679, 0xc1683bce, 0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb, 0xdbee767c,
-    0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18, 0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4,
-    0x89b8fd09, 0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662, 0x933eb0bb, 0x97ffad0c,
-    0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
-};
+// --- CRC Unit ---
+// Hooks for ota_crc: the unit hashes words MSB first, the image is a byte
+// stream, so each word goes in byte-swapped
+static void Crc_Unit_Reset(void) {
+    __HAL_RCC_CRC_CLK_ENABLE();
+    CRC->CR = CRC_CR_RESET;
+}
 
-static uint32_t calculate_crc32(uint32_t crc, const uint8_t *buf, size_t len) {
-    crc = ~crc;
-    while (len--) {
-        crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buf++) & 0xFF];
+static uint32_t Crc_Unit_Feed(const uint8_t *data, uint32_t words) {
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t word;
+        memcpy(&word, &data[i * 4], 4);
+        CRC->DR = __REV(word);
     }
-    return ~crc;
+    return CRC->DR;
 }
 
+static const OtaCrcHw crc_unit = { Crc_Unit_Reset, Crc_Unit_Feed };
+
 // Helper to de-initialize peripherals and interrupts
 void DeInit(void) {
     HAL_UART_DeInit(&huart6);
@@ -274,32 +257,34 @@ int main(void) {
         // Clear flag and boot counter
         RTC->BKP0R = 0;
         RTC->BKP1R = 0;
-        Bootloader_OTA_Loop();
+        Bootloader_OTA_Loop(NULL);
     } else if (valid_app) {
         if (boot_fails >= 3) {
             Serial_Log("Too many failed boots (%d). Forcing OTA.", boot_fails);
             // Flash RED to indicate failure
             for(int i=0; i<10; i++) { LED_R_Toggle(); HAL_Delay(100); }
             RTC->BKP1R = 0;
-            Bootloader_OTA_Loop();
+            Bootloader_OTA_Loop(NULL);
         }
 
         // Increment Boot Counter (App must clear it on success)
         RTC->BKP1R = boot_fails + 1;
 
-        // Wait 500ms for OTA START - Blink Blue
-        uint8_t buf[3];
+        // Wait 500ms for OTA START or QUERY - Blink Blue
+        uint8_t buf[3 + 256];
         LED_B_On();
 
-        // Check for specific CMD_OTA_START command sequence
-        // AA A0 ...
+        // AA A0 ... or AA A6 ...: the ESP32 asks for the progress record
+        // before START, so a QUERY enters the loop as well. The whole frame
+        // goes to the loop, which answers it.
         if (HAL_UART_Receive(&huart6, buf, 1, 500) == HAL_OK) {
             if (buf[0] == START_BYTE) {
                  if (HAL_UART_Receive(&huart6, &buf[1], 2, 50) == HAL_OK) {
-                     if (buf[1] == CMD_OTA_START) {
-                         Serial_Log("OTA START received on boot.");
+                     if ((buf[1] == CMD_OTA_START || buf[1] == CMD_OTA_QUERY) &&
+                         HAL_UART_Receive(&huart6, &buf[3], buf[2] + 1, 50) == HAL_OK) {
+                         Serial_Log("OTA %s received on boot.", buf[1] == CMD_OTA_START ? "START" : "QUERY");
                          RTC->BKP1R = 0; // Reset counter if we enter OTA manually
-                         Bootloader_OTA_Loop();
+                         Bootloader_OTA_Loop(buf);
                      }
                  }
             }
@@ -323,7 +308,7 @@ int main(void) {
         // No valid app, force OTA
         Serial_Log("No valid app found. Entering OTA Loop.");
         RTC->BKP1R = 0;
-        Bootloader_OTA_Loop();
+        Bootloader_OTA_Loop(NULL);
     }
 
     while (1) {}
@@ -340,10 +325,16 @@ uint8_t calculate_crc8(const uint8_t *data, uint8_t len) {
     return crc;
 }
 
+static void send_frame(uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    uint8_t buf[4 + 16] = {START_BYTE, cmd, len};
+    if (len > 16) return;
+    if (len) memcpy(&buf[3], payload, len);
+    buf[3 + len] = calculate_crc8(&buf[1], 2 + len);
+    HAL_UART_Transmit(&huart6, buf, 4 + len, 100);
+}
+
 void send_ack() {
-    uint8_t buf[4] = {START_BYTE, CMD_OTA_ACK, 0, 0};
-    buf[3] = calculate_crc8(&buf[1], 2);
-    HAL_UART_Transmit(&huart6, buf, 4, 100);
+    send_frame(CMD_OTA_ACK, NULL, 0);
     // REMOVED HAL_Delay(50) for performance
     // Tiny software delay for LED visibility, negligible impact
     LED_G_On();
@@ -352,9 +343,7 @@ void send_ack() {
 }
 
 void send_nack() {
-    uint8_t buf[4] = {START_BYTE, CMD_OTA_NACK, 0, 0};
-    buf[3] = calculate_crc8(&buf[1], 2);
-    HAL_UART_Transmit(&huart6, buf, 4, 100);
+    send_frame(CMD_OTA_NACK, NULL, 0);
     // Red Flash - Reduced delay
     LED_R_On(); HAL_Delay(50); LED_R_Off();
 }
@@ -369,7 +358,106 @@ void ClearFlashFlags() {
 #define FLASH_OPTCR_DB1M (1 << 30)
 #endif
 
-void Bootloader_OTA_Loop(void) {
+// Programs one chunk word by word; the tail word is padded with 0xFF.
+// x32 is the widest parallelism at voltage range 3 (x64 needs external VPP);
+// PG stays set across the chunk instead of HAL_FLASH_Program's per-word setup.
+// Words that already hold their value are skipped: a resumed transfer
+// repeats what it had programmed past its last checkpoint.
+static bool Program_Chunk(uint32_t addr, const uint8_t *data, uint32_t data_len) {
+    bool ok = true;
+    CLEAR_BIT(FLASH->CR, FLASH_CR_PSIZE);
+    FLASH->CR |= FLASH_PSIZE_WORD | FLASH_CR_PG;
+    for (uint32_t i=0; i<data_len; i+=4) {
+        uint32_t word = 0xFFFFFFFF;
+        uint8_t copy_len = (data_len - i < 4) ? (data_len - i) : 4;
+        memcpy(&word, &data[i], copy_len);
+        if (*(__IO uint32_t*)(addr + i) == word) continue;
+
+        *(__IO uint32_t*)(addr + i) = word;
+        while (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) {}
+        if (FLASH->SR & (FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)) {
+            ok = false;
+            break;
+        }
+    }
+    CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+    return ok;
+}
+
+// --- OTA receiver port ---
+// ota_rx runs the transfer; these are its flash and UART. One erase or
+// program step per ota_rx_poll(), so the main loop keeps draining the UART
+// while a sector erase runs in the background.
+// Erase bypasses HAL, which flushes the caches after an erase; do it here
+// so reading the new image back never hits stale lines
+static void Flash_FlushCaches(void) {
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+    __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+}
+
+static uint32_t flash_bank_addr;
+static uint32_t flash_first_sector;  // Physical sector of bank offset 0
+
+static void Ota_Erase_Start(void *user, uint8_t sector) {
+    (void)user;
+    ClearFlashFlags();
+    // Starts the erase and returns; completion is polled on BSY
+    FLASH_Erase_Sector(flash_first_sector + sector, FLASH_VOLTAGE_RANGE_3);
+}
+
+static int Ota_Erase_Poll(void *user) {
+    (void)user;
+    if (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) return 1;
+    CLEAR_BIT(FLASH->CR, (FLASH_CR_SER | FLASH_CR_SNB));
+    int result = 0;
+    if (FLASH->SR & (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
+                     FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)) {
+        Serial_Log("Erase Error. SR: 0x%08X", FLASH->SR);
+        ClearFlashFlags();
+        result = -1;
+    }
+    Flash_FlushCaches();
+    return result;
+}
+
+static bool Ota_Program(void *user, uint32_t offset, const uint8_t *data, uint32_t len) {
+    (void)user;
+    if (Program_Chunk(flash_bank_addr + offset, data, len)) return true;
+    Serial_Log("Flash Write Error at %08X. SR: 0x%08X", flash_bank_addr + offset, FLASH->SR);
+    ClearFlashFlags();
+    return false;
+}
+
+static void Ota_Reply(void *user, uint8_t cmd, const uint8_t *payload, uint8_t len) {
+    (void)user;
+    if (cmd == CMD_OTA_ACK && len == 0) send_ack();
+    else if (cmd == CMD_OTA_NACK) send_nack();
+    else send_frame(cmd, payload, len);
+}
+
+static void Ota_Idle(void *user) {
+    (void)user;
+    HAL_IWDG_Refresh(&hiwdg);
+}
+
+// Progress record in RTC->BKP2R.. (BKP0R: OTA flag, BKP1R: boot counter)
+static OtaRxPort ota_port = {
+    Ota_Erase_Start, Ota_Erase_Poll, Ota_Program, Ota_Reply, Ota_Idle, Serial_Log,
+    stage, STAGE_SIZE,
+    (const uint8_t*)0x08100000,                         // Inactive bank, whichever it is
+    (const uint8_t*)0x08000000, FLASH_SCHED_BANK_SIZE,  // Active bank, the base of a patch
+    &crc_unit, NULL
+};
+static OtaRx ota;
+
+
+// `first`: a frame [AA][Cmd][Len][Payload][CRC8] already read from the UART,
+// handled before anything else, or NULL
+void Bootloader_OTA_Loop(const uint8_t* first) {
     uint8_t header[3];
     uint8_t payload[256];
 
@@ -396,33 +484,38 @@ void Bootloader_OTA_Loop(void) {
     // If BFB2=0 (Bank 1 Active), Inactive is Bank 2 (Phys Sectors 12-23).
 
     uint32_t target_bank_addr = 0x08100000;
-    uint32_t start_sector, end_sector;
+    uint32_t start_sector;
 
     if (bfb2_active) {
         // Active: Bank 2. Inactive: Bank 1 (Sectors 0-11).
         start_sector = FLASH_SECTOR_0;
-        end_sector = FLASH_SECTOR_11;
         Serial_Log("Active: Bank 2. Target: Bank 1 (Sectors 0-11) Addr: 0x%08X", target_bank_addr);
     } else {
         // Active: Bank 1. Inactive: Bank 2 (Sectors 12-23).
         start_sector = FLASH_SECTOR_12;
-        end_sector = FLASH_SECTOR_23;
         Serial_Log("Active: Bank 1. Target: Bank 2 (Sectors 12-23) Addr: 0x%08X", target_bank_addr);
     }
 
-    bool ota_started = false;
-    bool checksum_verified = false;
-    uint32_t bytes_written = 0;
-    uint32_t chunks_received = 0;
+    flash_bank_addr = target_bank_addr;
+    flash_first_sector = start_sector;
+    ota_port.record = &RTC->BKP2R;
+    ota_rx_init(&ota, &ota_port, NULL);
+    bool verified_shown = false;
     uint32_t last_packet_time = HAL_GetTick();
 
+    bool pending = (first != NULL);
+    if (pending) {
+        memcpy(header, first, 3);
+        memcpy(payload, &first[3], first[2] + 1);
+    }
+
     while(1) {
         // Watchdog Refresh (Important for long waits)
         HAL_IWDG_Refresh(&hiwdg);
 
         // Heartbeat: Blue Toggle
         static uint32_t last_tick = 0;
-        if (HAL_GetTick() - last_tick > (ota_started ? 200 : 1000)) {
+        if (HAL_GetTick() - last_tick > (ota.started ? 200 : 1000)) {
             LED_B_Toggle();
             last_tick = HAL_GetTick();
         }
@@ -432,30 +525,42 @@ void Bootloader_OTA_Loop(void) {
         // If OTA has started, we might want to stay longer, but 30s silence is bad.
         // But the ESP32 might be downloading.
         // Let's set timeout to 30s. If OTA started, maybe 60s?
-        uint32_t timeout_val = ota_started ? 60000 : 30000;
+        uint32_t timeout_val = ota.started ? 60000 : 30000;
         if (HAL_GetTick() - last_packet_time > timeout_val) {
              Serial_Log("OTA Timeout (%d ms). Resetting...", timeout_val);
              HAL_NVIC_SystemReset();
         }
 
-        uint8_t b;
-        // Non-blocking check for start byte
-        if (UART_ReadByte(&b, 10) != HAL_OK) continue;
-        if (b != START_BYTE) continue;
+        // Decoding and flash work interleave with the UART, one step per iteration
+        bool flash_busy = ota_rx_poll(&ota);
+        if (ota.verified != verified_shown) {
+            verified_shown = ota.verified;
+            if (verified_shown) {
+                All_LEDs_Off();
+                LED_G_On(); // Green Solid
+            }
+        }
+
+        if (!pending) {
+            uint8_t b;
+            // Non-blocking check for start byte; don't wait while flash has work
+            if (UART_ReadByte(&b, flash_busy ? 0 : 10) != HAL_OK) continue;
+            if (b != START_BYTE) continue;
 
-        // RX Activity: Orange On
-        LED_O_On();
+            // RX Activity: Orange On
+            LED_O_On();
 
-        if (UART_ReadBuffer(&header[1], 2, 100) != HAL_OK) {
-            LED_O_Off(); continue;
+            if (UART_ReadBuffer(&header[1], 2, 100) != HAL_OK) {
+                LED_O_Off(); continue;
+            }
+            if (UART_ReadBuffer(payload, header[2] + 1, 500) != HAL_OK) {
+                LED_O_Off(); continue;
+            }
         }
+        pending = false;
         uint8_t cmd = header[1];
         uint8_t len = header[2];
 
-        if (UART_ReadBuffer(payload, len + 1, 500) != HAL_OK) {
-            LED_O_Off(); continue;
-        }
-
         last_packet_time = HAL_GetTick(); // Update timestamp
         LED_O_Off(); // RX Done
 
@@ -468,119 +573,15 @@ void Bootloader_OTA_Loop(void) {
         uint8_t calculated_crc8_val = calculate_crc8(check_buf, 2 + len);
         if (calculated_crc8_val != recv_crc) {
             Serial_Log("CRC Err: Cmd=%02X Len=%d Calc=%02X Recv=%02X", cmd, len, calculated_crc8_val, recv_crc);
-            send_nack(); continue;
+            ota_rx_frame_error(&ota);
+            continue;
         }
 
-        if (cmd == CMD_OTA_START) {
-            Serial_Log("OTA Start");
-            ota_started = true;
-            bytes_written = 0;
-            chunks_received = 0;
-            checksum_verified = false;
-
-            FLASH_EraseInitTypeDef EraseInitStruct;
-            uint32_t SectorError = 0;
-            EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
-            EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
-            EraseInitStruct.NbSectors = 1;
-
-            ClearFlashFlags(); // Clear flags before Erase
-
-            bool error = false;
-            // Erase the ENTIRE Inactive Bank (Bootloader area included)
-            for (uint32_t sec = start_sector; sec <= end_sector; sec++) {
-                // Refresh Watchdog inside Erase Loop
-                HAL_IWDG_Refresh(&hiwdg);
-
-                EraseInitStruct.Sector = sec;
-
-                if (HAL_FLASHEx_Erase(&EraseInitStruct, &SectorError) != HAL_OK) {
-                    uint32_t err = HAL_FLASH_GetError();
-                    Serial_Log("Erase Error at Sector %d. HAL Err: %d. SecErr: %d", sec, err, SectorError);
-                    error = true; break;
-                }
-            }
+        if (cmd == CMD_OTA_WCHUNK) LED_G_Toggle();
+        if (ota_rx_frame(&ota, cmd, payload, len)) continue;
 
-            if (!error) {
-                ClearFlashFlags(); // Clear flags after Erase, before Write
-                Serial_Log("Erase Complete");
-                send_ack();
-            } else {
-                send_nack();
-            }
-        }
-        else if (cmd == CMD_OTA_CHUNK) {
-            uint32_t offset;
-            memcpy(&offset, payload, 4);
-            uint8_t *data = &payload[4];
-            uint32_t data_len = len - 4;
-
-            // Write to Inactive Bank
-            uint32_t addr = target_bank_addr + offset;
-
-            bool ok = true;
-            for (uint32_t i=0; i<data_len; i+=4) {
-                uint32_t word = 0xFFFFFFFF;
-                uint8_t copy_len = (data_len - i < 4) ? (data_len - i) : 4;
-                memcpy(&word, &data[i], copy_len);
-
-                // ClearFlashFlags(); // Optimization: Removed for speed. Only on error?
-
-                if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + i, word) != HAL_OK) {
-                    ok = false; break;
-                }
-            }
-            if (ok) {
-                bytes_written += data_len;
-                chunks_received++;
-                if (chunks_received % 64 == 0) { // Log every ~16KB
-                    Serial_Log("Written %dKB...", bytes_written / 1024);
-                }
-                send_ack();
-            } else {
-                uint32_t err = HAL_FLASH_GetError();
-                Serial_Log("Flash Write Error at %08X. HAL Err: %d", addr, err);
-                ClearFlashFlags(); // Try to recover
-                send_nack();
-            }
-        }
-        else if (cmd == CMD_OTA_END) {
-            // New Logic: Checksum Verification
-            uint32_t received_crc32;
-            if (len >= 4) {
-                memcpy(&received_crc32, payload, 4);
-                Serial_Log("OTA End. Verifying CRC...");
-
-                // Calculate CRC of written flash using SOFTWARE CRC
-                uint32_t calculated_crc32 = 0;
-                uint8_t* flash_ptr = (uint8_t*)target_bank_addr;
-
-                for(uint32_t i = 0; i < bytes_written; i++) {
-                     // Refresh Watchdog during CRC Check
-                     if (i % 10000 == 0) HAL_IWDG_Refresh(&hiwdg);
-                     calculated_crc32 = calculate_crc32(calculated_crc32, &flash_ptr[i], 1);
-                }
-
-                Serial_Log("Calc: 0x%08X, Recv: 0x%08X", calculated_crc32, received_crc32);
-
-                if (calculated_crc32 == received_crc32) {
-                    checksum_verified = true;
-                    send_ack();
-                    All_LEDs_Off();
-                    LED_G_On(); // Green Solid
-                } else {
-                    checksum_verified = false;
-                    Serial_Log("Checksum Mismatch!");
-                    send_nack();
-                }
-
-            } else {
-                Serial_Log("OTA End without CRC. Rejecting.");
-                send_nack();
-            }
-        }
-        else if (cmd == CMD_OTA_APPLY) {
-            if (!checksum_verified) {
+        if (cmd == CMD_OTA_APPLY) {
+            if (!ota.verified) {
                 Serial_Log("Apply requested but Checksum not verified!");
                 send_nack();
                 continue;
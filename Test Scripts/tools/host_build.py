@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import subprocess
+import tempfile
+
+# Pieces every host check in Test Scripts shares: the failure count behind
+# the PASS / FAILED line, and the gcc build of firmware sources into a
+# library the check drives through ctypes.
+
+
+class Failures:
+    def __init__(self):
+        self.count = 0
+
+    def check(self, cond, what):
+        if not cond:
+            self.count += 1
+            print("  FAIL: " + what)
+        return cond
+
+
+def build_lib(sources, sigs, flags, name, deps=()):
+    """Compiles `sources` into <tmp>/ecoflow_<name>.so, again only when one of
+    them or of `deps` (headers) is newer, and loads it.
+
+    `sigs` maps each function the check calls to (restype, argtypes).
+    `flags` go to gcc as they are: warnings, -I paths, -pthread.
+    """
+    out = os.path.join(tempfile.gettempdir(), "ecoflow_%s.so" % name)
+    paths = list(sources) + list(deps)
+    if not os.path.exists(out) or os.path.getmtime(out) < max(os.path.getmtime(p) for p in paths):
+        subprocess.run(["gcc", "-shared", "-fPIC", "-O2"] + list(flags) + ["-o", out] + list(sources), check=True)
+    lib = ctypes.CDLL(out)
+    for fn_name, (res, args) in sigs.items():
+        fn = getattr(lib, fn_name)
+        fn.restype = res
+        fn.argtypes = args
+    return lib
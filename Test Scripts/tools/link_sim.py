@@ -0,0 +1,1885 @@
+#!/usr/bin/env python3
+import argparse
+import ctypes
+import os
+import random
+import select
+import sys
+import time
+import tty
+
+import host_build
+import ota_pack
+
+# Host simulator for the ESP32 <-> STM32 UART link.
+#
+# Builds the shared EcoFlowComm link layer (framing, RX parser, TX scheduler,
+# baud negotiation) and the OtaCore receiver for the host with gcc and runs an ESP32 and an STM32
+# endpoint against each other over a simulated UART: baud-rate throttling,
+# bit errors, byte drops, and garbage when the two sides disagree on the
+# baud. The application side of each MCU is modelled after Stm32Serial.cpp,
+# uart_task.c, ota_task.c, log_manager.c and the bootloader.
+#
+# Usage:
+#   ./link_sim.py status [--bulk]        status/control latency (optionally under bulk load)
+#   ./link_sim.py ota [--size N]         OTA stream to the bootloader (--window 0: stop-and-wait,
+#                                        --app: to the app's background OTA task instead)
+#   ./link_sim.py otabench               OTA flash time, stop-and-wait vs windowed, with and without loss
+#                                        and per-chunk CRC32 (--no-chunk-crc: ota without it)
+#                                        --image FILE sends a real image (default: random bytes),
+#                                        --efz packs it with ota_pack.py first,
+#                                        --base FILE makes it a patch against that running image
+#   ./link_sim.py logdl [--size N]       credit-based log download from the STM32
+#   ./link_sim.py loglist [--files N]    SD log list, one frame per file vs paged
+#   ./link_sim.py nego [--ber-at B=E]    baud negotiation and ping self-test
+#   ./link_sim.py framing [--ber 1e-4]   frames lost per bit error, legacy vs COBS
+#   ./link_sim.py rxring                 STM32 RX ring overruns under an ESP32 flood while the
+#                                        UART task stalls on SD work, per ring size and baud
+#   ./link_sim.py loglevel               UART bytes and SD writes of a verbose BLE debug session,
+#                                        with and without the per-tag level gates
+#   ./link_sim.py all
+#
+# Link options: --baud, --ber, --drop, --ber-at BAUD=BER (repeatable),
+# --framing legacy|cobs, --seed, --transport mem|pty. STM32 receiver: --rx-ring,
+# --stm-max-baud, --stm-stall-ms. "mem" runs in virtual time and is
+# deterministic; "pty" pushes every byte through a pseudo-terminal pair in
+# real time (slow, but exercises a real tty path).
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+LIB_DIR = os.path.join(REPO, "EcoflowESP32", "lib", "EcoFlowComm")
+OTA_CORE_DIR = os.path.join(REPO, "EcoflowSTM32F4", "lib", "OtaCore")
+SHIM = os.path.join(os.path.dirname(os.path.abspath(__file__)), "link_sim_shim.c")
+
+START_BYTE = 0xAA
+CMD_HANDSHAKE = 0x20
+CMD_HANDSHAKE_ACK = 0x21
+CMD_DEVICE_STATUS = 0x24
+CMD_GET_DEVICE_STATUS = 0x25
+CMD_SET_WAVE2 = 0x30
+CMD_LOG_LIST_REQ = 0x70
+CMD_LOG_LIST_RESP = 0x75
+CMD_LOG_DOWNLOAD_REQ = 0x71
+CMD_LOG_DATA_CHUNK = 0x76
+CMD_ESP_LOG_DATA = 0x73
+CMD_ESP_LOG_REC = 0x7D
+CMD_ESP_LOG_BATCH = 0x85
+CMD_LOG_LEVEL_SET = 0x86
+CMD_LOG_LEVEL_LIST = 0x88
+CMD_LOG_RESEND_REQ = 0x7B
+CMD_LOG_CREDIT = 0x7C
+LOG_CHUNK_MAX = 240
+LOG_LIST_NAME_MAX = 31
+LOG_STREAM_RING = 16384
+LOG_STREAM_SEND_CREDIT = 0x01
+LOG_STREAM_SEND_RESEND = 0x02
+CMD_OTA_START = 0xA0
+CMD_OTA_CHUNK = 0xA1
+CMD_OTA_END = 0xA2
+CMD_OTA_WCHUNK = 0xA4
+CMD_OTA_WACK = 0xA5
+CMD_OTA_ACK = 0x06
+CMD_OTA_NACK = 0x15
+
+LINK_BAUD_BASE = 460800
+LINK_BAUD_LADDER = (460800, 921600, 1500000, 2000000)
+STM_RX_RING = 16384         # uart_task.c RX_RING_SIZE
+STM_RX_MAX_BAUD = 921600    # uart_task.c UART_RX_MAX_BAUD
+LINK_FRAME_MAX = 255 + 4
+PRIO_NAMES = ["control", "telemetry", "bulk"]
+LINK_PRIO_BULK = 2
+LINK_OVERFLOW_REJECT = 0
+LINK_PARSE_FRAME = 1
+LINK_PARSE_CRC_ERROR = 2
+ROLE_MASTER = 0
+ROLE_SLAVE = 1
+FRAMING_LEGACY = 0
+FRAMING_COBS = 1
+FRAMING_NAMES = ["legacy", "cobs"]
+COBS_FRAME_MAX = 255 + 8
+OTA_WINDOW_CHUNK = 240
+OTA_WINDOW_MAX = 16
+OTA_FLAG_CHUNK_CRC = 0x01
+FLASH_OP_NONE, FLASH_OP_ERASE, FLASH_OP_PROGRAM, FLASH_OP_DONE = range(4)
+OTA_WTX_FAILED = -2
+LOG_LEVELS_PACKED_MAX = 2 + 10 * (2 + 23)
+LOG_REC_MAX = 512
+LOG_BATCH_RATE = 200
+LOG_BATCH_BURST = 400
+LOG_BATCH_SOURCES = 15
+MAX_PAYLOAD_LEN = 255
+LOG_SECTOR = 512
+LOG_FLUSH_SECTORS = 16
+LOG_FLUSH_MS = 1000
+LOG_COALESCE_MS = 100
+LEVEL_NAMES = "-EWIDV"
+
+STEP_US = 100
+
+
+# ---------------------------------------------------------------------------
+# Native library
+# ---------------------------------------------------------------------------
+
+class LinkTxStats(ctypes.Structure):
+    _fields_ = [("enqueued", ctypes.c_uint32), ("dropped", ctypes.c_uint32), ("rejected", ctypes.c_uint32),
+                ("sent", ctypes.c_uint32), ("max_latency_us", ctypes.c_uint32)]
+
+
+class LinkProbeStats(ctypes.Structure):
+    _fields_ = [(n, ctypes.c_uint32) for n in (
+        "baud", "sent", "received", "lost", "errors", "rtt_min_us", "rtt_max_us",
+        "rtt_sum_us", "bytes", "start_us", "end_us")]
+
+
+SEND_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint8), ctypes.c_int)
+SET_BAUD_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint8)
+RX_ERASE_START_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint8)
+RX_ERASE_POLL_FN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p)
+RX_PROGRAM_FN = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.c_void_p, ctypes.c_uint32,
+                                 ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint32)
+RX_REPLY_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint8)
+RX_IDLE_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p)
+
+
+class LogBatchStats(ctypes.Structure):
+    _fields_ = [(n, ctypes.c_uint32) for n in ("lines", "dropped", "frames", "bytes")]
+
+
+class LogBatchCursor(ctypes.Structure):
+    _fields_ = [("pos", ctypes.c_int), ("sources", ctypes.c_uint8), ("source", ctypes.c_uint8 * LOG_BATCH_SOURCES)]
+
+
+class LinkBaudOps(ctypes.Structure):
+    _fields_ = [("send", SEND_FN), ("set_baud", SET_BAUD_FN), ("user", ctypes.c_void_p)]
+
+
+def build_lib():
+    files = [os.path.join(d, f) for d in (LIB_DIR, OTA_CORE_DIR) for f in sorted(os.listdir(d))]
+    sources = [SHIM] + [f for f in files if f.endswith(".c")]
+    u8p = ctypes.POINTER(ctypes.c_uint8)
+    sigs = {
+        "calculate_crc8": (ctypes.c_uint8, [u8p, ctypes.c_uint8]),
+        "link_parser_init": (None, [ctypes.c_void_p]),
+        "link_parser_feed": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_uint8]),
+        "link_parser_set_framing": (None, [ctypes.c_void_p, ctypes.c_uint8]),
+        "pack_cobs_frame": (ctypes.c_int, [u8p, u8p, ctypes.c_int]),
+        "link_txq_init": (None, [ctypes.c_void_p]),
+        "link_txq_set_policy": (None, [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]),
+        "link_txq_set_bulk_rate": (None, [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32]),
+        "link_priority_for_cmd": (ctypes.c_int, [ctypes.c_uint8]),
+        "link_txq_push": (ctypes.c_bool, [ctypes.c_void_p, ctypes.c_int, u8p, ctypes.c_uint16, ctypes.c_uint32]),
+        "link_txq_give_up": (None, [ctypes.c_void_p, ctypes.c_int]),
+        "link_txq_pop": (ctypes.c_int, [ctypes.c_void_p, u8p, ctypes.c_uint32]),
+        "link_txq_empty": (ctypes.c_bool, [ctypes.c_void_p]),
+        "link_txq_get_stats": (None, [ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(LinkTxStats)]),
+        "link_baud_init": (None, [ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(LinkBaudOps), ctypes.c_uint32]),
+        "link_baud_reset": (None, [ctypes.c_void_p, ctypes.c_uint32]),
+        "link_baud_negotiate": (ctypes.c_bool, [ctypes.c_void_p, ctypes.c_uint32]),
+        "link_baud_selftest": (ctypes.c_bool, [ctypes.c_void_p, ctypes.c_uint16, ctypes.c_uint8, ctypes.c_uint32]),
+        "link_baud_on_frame": (ctypes.c_bool, [ctypes.c_void_p, u8p, ctypes.c_uint32]),
+        "link_baud_on_error": (None, [ctypes.c_void_p, ctypes.c_uint32]),
+        "link_baud_tick": (None, [ctypes.c_void_p, ctypes.c_uint32]),
+        "link_baud_current": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "link_baud_framing": (ctypes.c_uint8, [ctypes.c_void_p]),
+        "link_baud_set_framing_pref": (None, [ctypes.c_void_p, ctypes.c_uint8]),
+        "link_baud_set_max": (None, [ctypes.c_void_p, ctypes.c_uint32]),
+        "sim_baud_ceiling": (ctypes.c_int, [ctypes.c_void_p]),
+        "sim_baud_state": (ctypes.c_int, [ctypes.c_void_p]),
+        "link_baud_busy": (ctypes.c_bool, [ctypes.c_void_p]),
+        "link_baud_last_result": (ctypes.POINTER(LinkProbeStats), [ctypes.c_void_p]),
+        "pack_esp_log_message": (ctypes.c_int, [u8p, ctypes.c_uint8, ctypes.c_char_p, ctypes.c_char_p]),
+        "pack_esp_log_rec_message": (ctypes.c_int, [u8p, ctypes.c_uint8, ctypes.c_uint32, ctypes.c_uint16, u8p,
+                                                    ctypes.c_uint8]),
+        "unpack_esp_log_batch_message": (ctypes.c_int, [u8p, u8p]),
+        "unpack_esp_log_batch_line": (ctypes.c_int, [u8p, ctypes.c_void_p, u8p, u8p, u8p]),
+        "sim_sizeof_log_batch": (ctypes.c_size_t, []),
+        "sim_log_batch_stats": (ctypes.POINTER(LogBatchStats), [ctypes.c_void_p]),
+        "log_batch_init": (None, [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_uint32]),
+        "log_batch_add": (ctypes.c_bool, [ctypes.c_void_p, u8p, ctypes.c_int, ctypes.c_uint32]),
+        "log_batch_take": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_bool, u8p]),
+        "sim_sizeof_log_levels": (ctypes.c_size_t, []),
+        "log_levels_init": (None, [ctypes.c_void_p, ctypes.c_uint8]),
+        "log_levels_set": (ctypes.c_bool, [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint8]),
+        "log_levels_get": (ctypes.c_uint8, [ctypes.c_void_p, ctypes.c_char_p]),
+        "log_levels_get_or": (ctypes.c_uint8, [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint8]),
+        "log_levels_get_id": (ctypes.c_uint8, [ctypes.c_void_p, ctypes.c_uint16]),
+        "log_levels_tag_id": (ctypes.c_uint16, [ctypes.c_char_p]),
+        "log_levels_pack": (ctypes.c_int, [ctypes.c_void_p, u8p]),
+        "log_levels_unpack": (ctypes.c_bool, [ctypes.c_void_p, u8p, ctypes.c_int]),
+        "pack_log_level_set_message": (ctypes.c_int, [u8p, ctypes.c_uint8, ctypes.c_char_p]),
+        "unpack_log_level_set_message": (ctypes.c_int, [u8p, u8p, ctypes.c_char_p, ctypes.c_int]),
+        "pack_log_level_list_message": (ctypes.c_int, [u8p, u8p, ctypes.c_uint8]),
+        "unpack_log_level_list_message": (ctypes.c_int, [u8p, ctypes.POINTER(u8p)]),
+        "log_rec_pack": (ctypes.c_int, [u8p, ctypes.c_uint32, ctypes.c_uint8, ctypes.c_uint32, u8p, ctypes.c_int]),
+        "log_rec_pack_text": (ctypes.c_int, [u8p, ctypes.c_uint32, ctypes.c_uint8, ctypes.c_char_p, ctypes.c_char_p]),
+        "pack_device_status_message": (ctypes.c_int, [u8p, ctypes.c_void_p]),
+        "pack_get_device_status_message": (ctypes.c_int, [u8p, ctypes.c_uint8]),
+        "pack_set_wave2_message": (ctypes.c_int, [u8p, ctypes.c_uint8, ctypes.c_uint8]),
+        "pack_handshake_message": (ctypes.c_int, [u8p]),
+        "pack_handshake_ack_message": (ctypes.c_int, [u8p]),
+        "pack_log_list_req_message": (ctypes.c_int, [u8p, ctypes.c_uint16]),
+        "unpack_log_list_req_message": (ctypes.c_int, [u8p, ctypes.POINTER(ctypes.c_uint16)]),
+        "pack_log_list_resp_begin": (None, [u8p, ctypes.c_uint16, ctypes.c_uint16]),
+        "pack_log_list_resp_add": (ctypes.c_bool, [u8p, ctypes.c_uint32, ctypes.c_char_p]),
+        "pack_log_list_resp_end": (ctypes.c_int, [u8p]),
+        "unpack_log_list_resp_message": (ctypes.c_int, [u8p, ctypes.POINTER(ctypes.c_uint16),
+                                                        ctypes.POINTER(ctypes.c_uint16), u8p]),
+        "unpack_log_list_resp_entry": (ctypes.c_int, [u8p, ctypes.c_int, ctypes.POINTER(ctypes.c_uint32),
+                                                      ctypes.c_char_p]),
+        "pack_log_download_req_message": (ctypes.c_int, [u8p, ctypes.c_char_p]),
+        "pack_log_data_chunk_message": (ctypes.c_int, [u8p, ctypes.c_uint32, u8p, ctypes.c_uint16]),
+        "pack_log_resend_req_message": (ctypes.c_int, [u8p, ctypes.c_uint32]),
+        "pack_log_credit_message": (ctypes.c_int, [u8p, ctypes.c_uint32, ctypes.c_uint8]),
+        "sim_sizeof_log_stream": (ctypes.c_size_t, []),
+        "sim_log_stream_resends": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "sim_log_stream_credits_sent": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "sim_log_stream_stalls": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "sim_log_stream_granted": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "log_stream_start": (ctypes.c_uint8, [ctypes.c_void_p, ctypes.c_uint32]),
+        "log_stream_abort": (None, [ctypes.c_void_p]),
+        "log_stream_on_chunk": (ctypes.c_uint8, [ctypes.c_void_p, ctypes.c_uint32, u8p, ctypes.c_uint16,
+                                                 ctypes.c_uint32]),
+        "log_stream_poll": (ctypes.c_uint8, [ctypes.c_void_p, ctypes.c_uint32]),
+        "log_stream_read": (ctypes.c_uint32, [ctypes.c_void_p, u8p, ctypes.c_uint32]),
+        "log_stream_buffered": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "log_stream_offset": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "log_stream_credits": (ctypes.c_uint8, [ctypes.c_void_p]),
+        "log_stream_done": (ctypes.c_bool, [ctypes.c_void_p]),
+        "pack_ota_start_message": (ctypes.c_int, [u8p, ctypes.c_uint32, ctypes.c_uint8, ctypes.c_uint8,
+                                                  ctypes.c_uint32]),
+        "pack_ota_chunk_message": (ctypes.c_int, [u8p, ctypes.c_uint32, u8p, ctypes.c_uint8, ctypes.c_bool]),
+        "pack_ota_wchunk_message": (ctypes.c_int, [u8p, ctypes.c_uint16, u8p, ctypes.c_uint8, ctypes.c_bool]),
+        "ota_wtx_init": (None, [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint8]),
+        "ota_wtx_next": (ctypes.c_int, [ctypes.c_void_p, ctypes.c_uint32]),
+        "ota_wtx_on_ack": (None, [ctypes.c_void_p, ctypes.c_uint16, ctypes.c_uint16]),
+        "ota_wtx_acked_bytes": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "ota_wtx_done": (ctypes.c_bool, [ctypes.c_void_p]),
+        "sim_sizeof_ota_wtx": (ctypes.c_size_t, []),
+        "sim_wtx_retransmits": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "sim_sizeof_ota_rx": (ctypes.c_size_t, []),
+        "sim_rx_started": (ctypes.c_bool, [ctypes.c_void_p]),
+        "ota_rx_init": (None, [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]),
+        "ota_rx_frame": (ctypes.c_bool, [ctypes.c_void_p, ctypes.c_uint8, u8p, ctypes.c_uint8]),
+        "ota_rx_frame_error": (None, [ctypes.c_void_p]),
+        "ota_rx_poll": (ctypes.c_bool, [ctypes.c_void_p]),
+        "ota_crc32": (ctypes.c_uint32, [ctypes.c_uint32, u8p, ctypes.c_uint32]),
+        "flash_sched_sector_start": (ctypes.c_uint32, [ctypes.c_uint8]),
+        "pack_ota_end_message": (ctypes.c_int, [u8p, ctypes.c_uint32]),
+        "sim_sizeof_parser": (ctypes.c_size_t, []),
+        "sim_sizeof_txq": (ctypes.c_size_t, []),
+        "sim_sizeof_baud": (ctypes.c_size_t, []),
+        "sim_sizeof_device_status": (ctypes.c_size_t, []),
+        "sim_parser_frame": (u8p, [ctypes.c_void_p]),
+        "sim_parser_frame_len": (ctypes.c_uint16, [ctypes.c_void_p]),
+    }
+    return host_build.build_lib(sources, sigs, ["-Wall", "-I", LIB_DIR, "-I", OTA_CORE_DIR], "link_sim", files)
+
+
+def u8buf(data):
+    return (ctypes.c_uint8 * max(len(data), 1)).from_buffer_copy(bytes(data) or b"\0")
+
+
+def pack(fn, *args):
+    buf = (ctypes.c_uint8 * LINK_FRAME_MAX)()
+    n = fn(buf, *args)
+    return bytes(buf[:n])
+
+
+def encode(lib, frame, framing):
+    if framing != FRAMING_COBS:
+        return frame
+    out = (ctypes.c_uint8 * COBS_FRAME_MAX)()
+    n = lib.pack_cobs_frame(out, u8buf(frame), len(frame))
+    return bytes(out[:n])
+
+
+def make_frame(lib, cmd, payload=b""):
+    body = bytes([cmd, len(payload)]) + payload
+    return bytes([START_BYTE]) + body + bytes([lib.calculate_crc8(u8buf(body), len(body))])
+
+
+def percentile(values, pct):
+    if not values:
+        return 0
+    s = sorted(values)
+    return s[min(len(s) - 1, int(len(s) * pct / 100))]
+
+
+def fmt_lat(values):
+    if not values:
+        return "n/a"
+    return "n=%d p50=%.2fms p99=%.2fms max=%.2fms" % (
+        len(values), percentile(values, 50) / 1000, percentile(values, 99) / 1000, max(values) / 1000)
+
+
+# ---------------------------------------------------------------------------
+# Physical link
+# ---------------------------------------------------------------------------
+
+class Wire:
+    """One direction of the UART: serialises bytes at the sender's baud and
+    applies impairments. Bytes sent at a baud the receiver is not listening
+    on arrive as garbage (or not at all) and count as line errors."""
+
+    def __init__(self, args, rng):
+        self.args = args
+        self.rng = rng
+        self.busy_until = 0.0
+        self.inflight = []      # (deliver_at_us, byte, sender_baud)
+        self.head = 0
+        self.bytes_sent = 0
+        self.corrupted = 0
+        self.dropped = 0
+
+    def ber_for(self, baud):
+        return self.args.ber_at.get(baud, self.args.ber)
+
+    def send(self, now, data, baud):
+        byte_us = 10e6 / baud
+        ber = self.ber_for(baud)
+        t = max(self.busy_until, now)
+        for b in data:
+            t += byte_us
+            if self.args.drop and self.rng.random() < self.args.drop:
+                self.dropped += 1
+                continue
+            if ber and self.rng.random() < 1 - (1 - ber) ** 10:
+                b ^= 1 << self.rng.randrange(8)
+                self.corrupted += 1
+            self.inflight.append((t, b, baud))
+        self.busy_until = t
+        self.bytes_sent += len(data)
+
+    def backlog_us(self, now):
+        return max(0.0, self.busy_until - now)
+
+    def deliver(self, now, rx_baud):
+        """Returns (bytes, line_errors) that have fully arrived by now."""
+        out = bytearray()
+        errors = 0
+        inflight = self.inflight
+        i = self.head
+        while i < len(inflight) and inflight[i][0] <= now:
+            _, b, baud = inflight[i]
+            i += 1
+            if baud != rx_baud:
+                errors += 1
+                if self.rng.random() < 0.5:
+                    continue
+                b = self.rng.randrange(256)
+            out.append(b)
+        if i > 4096:
+            del inflight[:i]
+            i = 0
+        self.head = i
+        return bytes(out), errors
+
+
+class MemTransport:
+    """Virtual time; bytes go straight from the wire to the receiver."""
+
+    def __init__(self):
+        self.now = 1.0
+
+    def clock(self):
+        return self.now
+
+    def advance(self):
+        self.now += STEP_US
+
+    def carry(self, side, data):
+        return data
+
+    def close(self):
+        pass
+
+
+class PtyTransport:
+    """Real time; every delivered byte is written to one end of a
+    pseudo-terminal pair and read back from the other."""
+
+    def __init__(self):
+        self.fds = {}
+        for side in ("esp", "stm"):
+            master, slave = os.openpty()
+            tty.setraw(slave)
+            os.set_blocking(slave, False)
+            self.fds[side] = (master, slave)
+        self.t0 = time.monotonic()
+
+    def clock(self):
+        return (time.monotonic() - self.t0) * 1e6 + 1
+
+    def advance(self):
+        time.sleep(STEP_US / 1e6)
+
+    def carry(self, side, data):
+        master, slave = self.fds[side]
+        if data:
+            os.write(master, data)
+        out = bytearray()
+        while select.select([slave], [], [], 0)[0]:
+            chunk = os.read(slave, 4096)
+            if not chunk:
+                break
+            out += chunk
+        return bytes(out)
+
+    def close(self):
+        for master, slave in self.fds.values():
+            os.close(master)
+            os.close(slave)
+
+
+# ---------------------------------------------------------------------------
+# Endpoints
+# ---------------------------------------------------------------------------
+
+class Endpoint:
+    """Link layer of one MCU: TX queue, RX parser and baud negotiator, all
+    running the shared C code."""
+
+    def __init__(self, lib, name, role, baud, loop_us, count_line_errors):
+        self.lib = lib
+        self.name = name
+        self.baud = baud
+        self.framing = FRAMING_LEGACY
+        self.loop_us = loop_us
+        self.count_line_errors = count_line_errors
+        self.next_loop = 0.0
+        self.now = 1.0
+        self.out = None
+        self.app = None
+        self.pending_rx = bytearray()
+        self.crc_errors = 0
+        self.line_errors = 0
+        self.rx_overruns = 0
+        self.rx_lost = 0
+
+        self.txq = ctypes.create_string_buffer(lib.sim_sizeof_txq())
+        self.parser = ctypes.create_string_buffer(lib.sim_sizeof_parser())
+        self.lb = ctypes.create_string_buffer(lib.sim_sizeof_baud())
+        lib.link_txq_init(self.txq)
+        lib.link_parser_init(self.parser)
+        self.apply_bulk_cap()
+
+        self._send_cb = SEND_FN(lambda user, frame, n: self.send(ctypes.string_at(frame, n)))
+        self._baud_cb = SET_BAUD_FN(lambda user, b, f: self.set_baud(b, f))
+        self.ops = LinkBaudOps(self._send_cb, self._baud_cb, None)
+        lib.link_baud_init(self.lb, role, ctypes.byref(self.ops), self.us())
+
+    def us(self):
+        return int(self.now) & 0xFFFFFFFF
+
+    def apply_bulk_cap(self, unlimited=False):
+        rate = 0 if unlimited else self.baud // 10 * 75 // 100
+        self.lib.link_txq_set_bulk_rate(self.txq, rate, 2 * LINK_FRAME_MAX)
+
+    def send(self, frame, retry=False):
+        """Queues a frame; a refused one counts as lost unless the caller
+        will push it again (retry)."""
+        prio = self.lib.link_priority_for_cmd(frame[1])
+        if self.lib.link_txq_push(self.txq, prio, u8buf(frame), len(frame), self.us()):
+            return True
+        if not retry:
+            self.lib.link_txq_give_up(self.txq, prio)
+        return False
+
+    def pump(self, limit_us=None):
+        """Moves sendable frames onto the wire while it has less than
+        limit_us of backlog (None = until nothing is sendable)."""
+        buf = (ctypes.c_uint8 * LINK_FRAME_MAX)()
+        while limit_us is None or self.out.backlog_us(self.now) < limit_us:
+            n = self.lib.link_txq_pop(self.txq, buf, self.us())
+            if n <= 0:
+                break
+            self.out.send(self.now, encode(self.lib, bytes(buf[:n]), self.framing), self.baud)
+
+    def set_baud(self, baud, framing):
+        # Frames already queued were packed for the old rate: flush them first.
+        self.lib.link_txq_set_bulk_rate(self.txq, 0, 0)
+        self.pump()
+        self.now = max(self.now, self.out.busy_until)
+        self.baud = baud
+        self.framing = framing
+        self.lib.link_parser_set_framing(self.parser, framing)
+        self.apply_bulk_cap()
+
+    def receive(self, data, line_errors):
+        self.pending_rx += data
+        if self.count_line_errors:
+            for _ in range(line_errors):
+                self.lib.link_baud_on_error(self.lb, self.us())
+        self.line_errors += line_errors
+
+    def process_rx(self):
+        lib = self.lib
+        data = bytes(self.pending_rx)
+        self.pending_rx.clear()
+        for b in data:
+            r = lib.link_parser_feed(self.parser, b)
+            if r == LINK_PARSE_FRAME:
+                ptr = lib.sim_parser_frame(self.parser)
+                frame = ctypes.string_at(ptr, lib.sim_parser_frame_len(self.parser))
+                if lib.link_baud_on_frame(self.lb, u8buf(frame), self.us()):
+                    continue
+                if self.app:
+                    self.app.on_frame(self, frame)
+            elif r == LINK_PARSE_CRC_ERROR:
+                self.crc_errors += 1
+                lib.link_baud_on_error(self.lb, self.us())
+                if self.app:
+                    self.app.on_crc_error(self)
+
+    def stats(self):
+        out = []
+        for p in range(3):
+            s = LinkTxStats()
+            self.lib.link_txq_get_stats(self.txq, p, ctypes.byref(s))
+            out.append((PRIO_NAMES[p], s))
+        return out
+
+
+class EspEndpoint(Endpoint):
+    """Stm32Serial: RX parsed from the main loop, a writer task keeps the
+    UART fed as long as the queue has sendable frames."""
+
+    TX_FIFO_BYTES = 128
+
+    def step(self):
+        self.pump(self.TX_FIFO_BYTES * 10e6 / self.baud)
+        if self.now >= self.next_loop:
+            self.next_loop = self.now + self.loop_us
+            self.lib.link_baud_tick(self.lb, self.us())
+            self.process_rx()
+            if self.app:
+                self.app.tick(self)
+            self.pump(self.TX_FIFO_BYTES * 10e6 / self.baud)
+
+
+class StmEndpoint(Endpoint):
+    """uart_task.c: one loop iteration parses RX, ticks the negotiator, runs
+    the application and pumps TX with blocking writes, then sleeps.
+
+    RX lands in a ring of rx_ring bytes between iterations. Once it holds
+    more than that the DMA has lapped the reader: the next read drops all
+    unread bytes and reports a line error. stall_us, once a second, stands
+    in for SD work that keeps the task away from the ring."""
+
+    def __init__(self, *args, rx_ring=STM_RX_RING, max_baud=STM_RX_MAX_BAUD, stall_us=0):
+        super().__init__(*args)
+        self.lib.link_txq_set_policy(self.txq, LINK_PRIO_BULK, LINK_OVERFLOW_REJECT)
+        self.lib.link_baud_set_max(self.lb, max_baud)
+        self.rx_ring = rx_ring
+        self.lapped = False
+        self.stall_us = stall_us
+        self.next_stall = 1e6
+
+    def receive(self, data, line_errors):
+        super().receive(data, line_errors)
+        if len(self.pending_rx) > self.rx_ring:
+            self.lapped = True
+
+    def process_rx(self):
+        if self.lapped:
+            self.lapped = False
+            self.rx_overruns += 1
+            self.rx_lost += len(self.pending_rx)
+            self.pending_rx.clear()
+            self.lib.link_parser_set_framing(self.parser, self.framing)
+            self.lib.link_baud_on_error(self.lb, self.us())
+        super().process_rx()
+
+    def step(self):
+        if self.now >= self.next_loop:
+            self.process_rx()
+            self.lib.link_baud_tick(self.lb, self.us())
+            if self.app:
+                self.app.tick(self)
+            self.pump()
+            # HAL_UART_Transmit blocks the task until the bytes are out
+            self.next_loop = max(self.now, self.out.busy_until) + self.loop_us
+            if self.stall_us and self.now >= self.next_stall:
+                self.next_stall = self.now + 1e6
+                self.next_loop += self.stall_us
+
+
+class App:
+    def on_frame(self, ep, frame):
+        pass
+
+    def on_crc_error(self, ep):
+        pass
+
+    def tick(self, ep):
+        pass
+
+
+class Link:
+    def __init__(self, lib, args, stm_loop_us=5000, esp_loop_us=1000, baud=None, framing=None,
+                 rx_ring=None, stall_us=None):
+        self.lib = lib
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.transport = PtyTransport() if args.transport == "pty" else MemTransport()
+        baud = baud or args.baud
+        self.esp = EspEndpoint(lib, "esp", ROLE_MASTER, baud, esp_loop_us, False)
+        self.stm = StmEndpoint(lib, "stm", ROLE_SLAVE, baud, stm_loop_us, True,
+                               rx_ring=rx_ring or args.rx_ring, max_baud=args.stm_max_baud,
+                               stall_us=args.stm_stall_ms * 1000 if stall_us is None else stall_us)
+        self.esp.out = Wire(args, self.rng)   # ESP32 TX -> STM32 RX
+        self.stm.out = Wire(args, self.rng)   # STM32 TX -> ESP32 RX
+        if framing is None:
+            framing = FRAMING_NAMES.index(args.framing)
+        for ep in (self.esp, self.stm):
+            lib.link_baud_set_framing_pref(ep.lb, framing)
+            if baud != LINK_BAUD_BASE:
+                # Start as if this step had been negotiated already
+                ep.framing = framing
+                lib.link_parser_set_framing(ep.parser, framing)
+
+    def now(self):
+        return self.esp.now
+
+    def run(self, until_us, done=lambda: False):
+        esp, stm = self.esp, self.stm
+        while True:
+            now = self.transport.clock()
+            esp.now = max(esp.now, now)
+            stm.now = max(stm.now, now)
+            data, err = esp.out.deliver(stm.now, stm.baud)
+            stm.receive(self.transport.carry("stm", data), err)
+            data, err = stm.out.deliver(esp.now, esp.baud)
+            esp.receive(self.transport.carry("esp", data), err)
+            esp.step()
+            stm.step()
+            if done() or now >= until_us:
+                return
+            self.transport.advance()
+
+    def close(self):
+        self.transport.close()
+
+    def report(self):
+        for ep in (self.esp, self.stm):
+            print("  %s: baud=%d framing=%s crc_errors=%d line_errors=%d rx_overruns=%d wire_bytes=%d corrupted=%d "
+                  "dropped=%d" % (ep.name.upper(), ep.baud, FRAMING_NAMES[ep.framing], ep.crc_errors, ep.line_errors,
+                                  ep.rx_overruns, ep.out.bytes_sent, ep.out.corrupted, ep.out.dropped))
+            for name, s in ep.stats():
+                print("    tx %-9s enq=%-6d sent=%-6d dropped=%-5d rejected=%-5d max_latency=%.2fms" % (
+                    name, s.enqueued, s.sent, s.dropped, s.rejected, s.max_latency_us / 1000))
+
+
+# ---------------------------------------------------------------------------
+# Application models
+# ---------------------------------------------------------------------------
+
+class EspStatusApp(App):
+    """Answers status polls; optionally floods the link with ESP log lines."""
+
+    def __init__(self, lib, bulk):
+        self.lib = lib
+        self.bulk = bulk
+        self.status = ctypes.create_string_buffer(lib.sim_sizeof_device_status())
+        self.control_rx = []
+        self.bulk_sent = 0
+
+    def on_frame(self, ep, frame):
+        cmd = frame[1]
+        if cmd == CMD_HANDSHAKE:
+            ep.send(pack(self.lib.pack_handshake_ack_message))
+        elif cmd == CMD_GET_DEVICE_STATUS:
+            ep.send(pack(self.lib.pack_device_status_message, self.status))
+        elif cmd == CMD_SET_WAVE2:
+            self.control_rx.append((frame[4], ep.now))
+
+    def tick(self, ep):
+        if not self.bulk:
+            return
+        # Keep the bulk ring full, like a burst of ESP_LOGx calls
+        msg = b"x" * 180
+        for _ in range(4):
+            if ep.send(pack(self.lib.pack_esp_log_message, 3, b"SIM", msg)):
+                self.bulk_sent += 1
+
+
+class StmStatusApp(App):
+    """uart_task.c polling: handshake, then GET_DEVICE_STATUS every poll
+    period, plus a user command every control period."""
+
+    def __init__(self, lib, poll_us, control_us, bulk):
+        self.lib = lib
+        self.poll_us = poll_us
+        self.control_us = control_us
+        self.bulk = bulk
+        self.connected = False
+        self.last_handshake = -1e9
+        self.next_poll = 0
+        self.next_control = 0
+        self.poll_sent = []
+        self.status_latency = []
+        self.control_sent = {}
+        self.control_seq = 0
+        self.chunk_offset = 0
+
+    def on_frame(self, ep, frame):
+        cmd = frame[1]
+        if cmd == CMD_HANDSHAKE_ACK:
+            self.connected = True
+        elif cmd == CMD_DEVICE_STATUS and self.poll_sent:
+            self.status_latency.append(ep.now - self.poll_sent.pop(0))
+
+    def tick(self, ep):
+        now = ep.now
+        if not self.connected:
+            if now - self.last_handshake > 1e6:
+                self.last_handshake = now
+                ep.send(pack(self.lib.pack_handshake_message))
+            return
+        if now >= self.next_poll:
+            self.next_poll = now + self.poll_us
+            # A status the previous poll never got is superseded
+            self.poll_sent = [now]
+            ep.send(pack(self.lib.pack_get_device_status_message, 1))
+        if now >= self.next_control:
+            self.next_control = now + self.control_us
+            self.control_seq = (self.control_seq + 1) & 0xFF
+            self.control_sent[self.control_seq] = now
+            ep.send(pack(self.lib.pack_set_wave2_message, 0, self.control_seq))
+        if self.bulk:
+            # Concurrent log download: one chunk per loop iteration
+            data = bytes(200)
+            ep.send(pack(self.lib.pack_log_data_chunk_message, self.chunk_offset, u8buf(data), len(data)))
+            self.chunk_offset += len(data)
+
+
+def scenario_status(lib, args):
+    link = Link(lib, args)
+    esp_app = EspStatusApp(lib, args.bulk)
+    stm_app = StmStatusApp(lib, args.poll_ms * 1000, args.control_ms * 1000, args.bulk)
+    link.esp.app = esp_app
+    link.stm.app = stm_app
+    link.run(args.duration * 1e6)
+
+    control_latency = [t - stm_app.control_sent[seq] for seq, t in esp_app.control_rx
+                       if seq in stm_app.control_sent]
+    print("status @%d baud%s, %.1fs:" % (args.baud, " under bulk load" if args.bulk else "", args.duration))
+    print("  status round trip : " + fmt_lat(stm_app.status_latency))
+    print("  control STM->ESP  : " + fmt_lat(control_latency))
+    if args.bulk:
+        secs = args.duration
+        print("  bulk ESP->STM     : %.1f KB/s" % (link.esp.out.bytes_sent / secs / 1024))
+        print("  bulk STM->ESP     : %.1f KB/s" % (link.stm.out.bytes_sent / secs / 1024))
+    link.report()
+    link.close()
+
+
+class OtaRxPort(ctypes.Structure):
+    _fields_ = [("erase_start", RX_ERASE_START_FN), ("erase_poll", RX_ERASE_POLL_FN),
+                ("program", RX_PROGRAM_FN), ("reply", RX_REPLY_FN), ("idle", RX_IDLE_FN),
+                ("log", ctypes.c_void_p), ("stage", ctypes.POINTER(ctypes.c_uint8)),
+                ("stage_size", ctypes.c_uint32), ("bank", ctypes.POINTER(ctypes.c_uint8)),
+                ("base", ctypes.POINTER(ctypes.c_uint8)), ("base_size", ctypes.c_uint32),
+                ("crc_hw", ctypes.c_void_p), ("record", ctypes.POINTER(ctypes.c_uint32)),
+                ("window_max", ctypes.c_uint8)]
+
+
+class OtaReceiverApp(App):
+    """STM32 OTA receiver: the real ota_rx core (OtaCore), as
+    Bootloader_OTA_Loop and the app's OTA task run it, on a 1 MB bank model.
+    The file (raw image, EFZ1 container or EFD1 patch against `base`, the
+    active bank) is decoded into the staging ring and programmed as it
+    arrives; END is answered once the image is in flash and both CRCs match.
+
+    The receiver keeps its own clock: a program step blocks it for the
+    words written, an erase runs in the background until polled done, and a
+    pass with nothing to do costs `idle_us`. Its replies leave when its
+    clock gets there. Flash timings are typical STM32F469 figures.
+
+    bootloader: frames wait in a 4 KB RX ring, the loop busy-polls the UART.
+    app: the UART task queues frames for the OTA task (OTA_QUEUE_DEPTH,
+    dropped when full), which waits a tick for the next one while the
+    flash has work. It grants no larger window than half the UART task's
+    RX ring holds (OTA_APP_WINDOW)."""
+
+    RING_BYTES = 4096
+    APP_WINDOW = min(OTA_WINDOW_MAX, STM_RX_RING // 2 // COBS_FRAME_MAX)
+    QUEUE_DEPTH = APP_WINDOW + 4
+    STAGE_SIZE = OTA_WINDOW_CHUNK * 512
+    BANK_SIZE = 0x100000
+
+    def __init__(self, lib, args, base=None, app=False):
+        self.lib = lib
+        self.app = app
+        self.idle_us = 1000 if app else 50
+        self.erase_128k_us = args.erase_128k_ms * 1000
+        self.word_us = args.program_word_us
+        self.bank = (ctypes.c_uint8 * self.BANK_SIZE)()
+        ctypes.memset(self.bank, 0xFF, self.BANK_SIZE)
+        self.active_bank = u8buf(base or b"")
+        self.stage = (ctypes.c_uint8 * self.STAGE_SIZE)()
+        self.record = (ctypes.c_uint32 * 16)()
+        self.t = 0
+        self.asleep = True
+        self.erase_until = 0
+        self.replies = []         # (receiver time, frame)
+        self.rx = []              # frames (or None for a CRC error) not yet handled
+        self.rx_bytes = 0
+        self.overruns = 0
+        self.chunk_crc = False
+        self.chunk_crc_errors = 0
+
+        self._cbs = (RX_ERASE_START_FN(self.erase_start), RX_ERASE_POLL_FN(self.erase_poll),
+                     RX_PROGRAM_FN(self.program), RX_REPLY_FN(self.reply), RX_IDLE_FN(self.idle))
+        self.port = OtaRxPort(*self._cbs, None, self.stage, self.STAGE_SIZE, self.bank,
+                              self.active_bank, len(base or b""), None, self.record,
+                              self.APP_WINDOW if app else 0)
+        self.state = ctypes.create_string_buffer(lib.sim_sizeof_ota_rx())
+        lib.ota_rx_init(self.state, ctypes.byref(self.port), None)
+
+    # --- port ---
+    def erase_start(self, user, sector):
+        start = self.lib.flash_sched_sector_start(sector)
+        end = self.lib.flash_sched_sector_start(sector + 1)
+        ctypes.memset(ctypes.addressof(self.bank) + start, 0xFF, end - start)
+        self.erase_until = self.t + self.erase_128k_us * {16: 0.25, 64: 0.5}.get((end - start) // 1024, 1.0)
+
+    def erase_poll(self, user):
+        return 1 if self.t < self.erase_until else 0
+
+    def program(self, user, offset, data, length):
+        # Program_Chunk: equal words are skipped, programming only clears bits
+        new = ctypes.string_at(data, length).ljust((length + 3) // 4 * 4, b"\xff")
+        written = 0
+        for i in range(0, len(new), 4):
+            old = bytes(self.bank[offset + i:offset + i + 4])
+            if old != new[i:i + 4]:
+                self.bank[offset + i:offset + i + 4] = bytes(x & y for x, y in zip(old, new[i:i + 4]))
+                written += 1
+        self.t += written * self.word_us
+        return True
+
+    def reply(self, user, cmd, payload, length):
+        self.replies.append((self.t, make_frame(self.lib, cmd, ctypes.string_at(payload, length) if length else b"")))
+
+    def idle(self, user):
+        self.t += self.idle_us
+
+    # --- link ---
+    def on_frame(self, ep, frame):
+        if (len(self.rx) >= self.QUEUE_DEPTH if self.app else self.rx_bytes + len(frame) > self.RING_BYTES):
+            self.overruns += 1
+            return
+        self.rx.append(frame)
+        self.rx_bytes += len(frame)
+
+    def on_crc_error(self, ep):
+        if self.app and len(self.rx) >= self.QUEUE_DEPTH:
+            return
+        self.rx.append(None)
+
+    def handle(self, frame):
+        lib = self.lib
+        if frame is None:
+            # The OTA task only answers a bad frame during a transfer
+            if not self.app or lib.sim_rx_started(self.state):
+                lib.ota_rx_frame_error(self.state)
+            return
+        cmd, payload = frame[1], frame[3:3 + frame[2]]
+        if cmd == CMD_OTA_START:
+            self.chunk_crc = len(payload) >= 6 and bool(payload[5] & OTA_FLAG_CHUNK_CRC)
+        elif self.chunk_crc and cmd in (CMD_OTA_CHUNK, CMD_OTA_WCHUNK):
+            body = payload[:-4]
+            if len(payload) < 4 or lib.ota_crc32(0, u8buf(body), len(body)) != int.from_bytes(payload[-4:], "little"):
+                self.chunk_crc_errors += 1
+        lib.ota_rx_frame(self.state, cmd, u8buf(payload), len(payload))
+
+    def tick(self, ep):
+        # Passes of the receive loop up to the endpoint's time: one frame if
+        # any is waiting, then one decode and flash step
+        # Work not finished by the last call carries on from where it was
+        if self.asleep:
+            self.t = max(self.t, ep.now)
+        self.asleep = False
+        while self.t <= ep.now:
+            frame = None
+            if self.rx:
+                frame = self.rx.pop(0)
+                if frame is not None:
+                    self.rx_bytes -= len(frame)
+                self.handle(frame)
+            before = self.t
+            busy = self.lib.ota_rx_poll(self.state)
+            if frame is None and self.t == before:
+                if not busy:
+                    self.asleep = True
+                    break
+                self.t += self.idle_us
+        while self.replies and self.replies[0][0] <= ep.now:
+            ep.send(self.replies.pop(0)[1])
+
+    def image(self, size):
+        return bytes(self.bank[:size])
+
+
+class EspOtaApp(App):
+    """Stm32Serial::otaTask. Stop-and-wait polls for the ACK every
+    ack_poll_ms; the windowed stream runs the shared ota_window sender and
+    loops every millisecond (vTaskDelay(1))."""
+
+    def __init__(self, lib, args, image, window):
+        self.lib = lib
+        self.image = image
+        self.want_window = window
+        self.window = 0
+        self.poll_us = args.ack_poll_ms * 1000
+        self.state = "start"
+        self.offset = 0
+        self.retries = 0
+        self.total_retries = 0
+        self.acked = False
+        self.nacked = False
+        self.ack_window = 0
+        self.wack = None
+        self.sent_at = 0
+        self.next_poll = 0
+        self.t_start = 0
+        self.t_stream = 0
+        self.t_end = 0
+        self.chunk = 200
+        self.want_flags = 0 if args.no_chunk_crc else OTA_FLAG_CHUNK_CRC
+        self.ack_flags = 0
+        self.chunk_crc = False
+        self.end_nacked = False
+        self.wtx = ctypes.create_string_buffer(lib.sim_sizeof_ota_wtx())
+
+    def on_frame(self, ep, frame):
+        if frame[1] == CMD_OTA_ACK:
+            self.acked = True
+            self.ack_window = frame[3] if frame[2] >= 1 else 0
+            self.ack_flags = frame[4] if frame[2] >= 2 else 0
+        elif frame[1] == CMD_OTA_NACK:
+            self.nacked = True
+        elif frame[1] == CMD_OTA_WACK:
+            self.wack = (int.from_bytes(frame[3:5], "little"), int.from_bytes(frame[5:7], "little"))
+
+    def send_current(self, ep):
+        self.acked = self.nacked = False
+        self.sent_at = ep.now
+        if self.state == "start":
+            ep.send(pack(self.lib.pack_ota_start_message, len(self.image), self.want_window, self.want_flags,
+                         self.lib.ota_crc32(0, u8buf(self.image), len(self.image))))
+        elif self.state == "stream":
+            data = self.image[self.offset:self.offset + self.chunk]
+            ep.send(pack(self.lib.pack_ota_chunk_message, self.offset, u8buf(data), len(data), self.chunk_crc))
+        elif self.state == "end":
+            crc = self.lib.ota_crc32(0, u8buf(self.image), len(self.image))
+            ep.send(pack(self.lib.pack_ota_end_message, crc))
+
+    def tick_windowed(self, ep):
+        lib = self.lib
+        if self.nacked:
+            self.state = "failed"
+            return
+        if self.wack is not None:
+            lib.ota_wtx_on_ack(self.wtx, *self.wack)
+            self.wack = None
+        while True:
+            seq = lib.ota_wtx_next(self.wtx, ep.us())
+            if seq < 0:
+                break
+            offset = seq * OTA_WINDOW_CHUNK
+            data = self.image[offset:offset + OTA_WINDOW_CHUNK]
+            ep.send(pack(lib.pack_ota_wchunk_message, seq, u8buf(data), len(data), self.chunk_crc))
+        if seq == OTA_WTX_FAILED:
+            self.state = "failed"
+            return
+        self.offset = lib.ota_wtx_acked_bytes(self.wtx)
+        if lib.ota_wtx_done(self.wtx):
+            self.total_retries = lib.sim_wtx_retransmits(self.wtx)
+            self.state = "end"
+            self.t_end = ep.now
+            self.send_current(ep)
+
+    def tick(self, ep):
+        if self.state == "idle":
+            self.state = "start"
+            self.t_start = ep.now
+            self.send_current(ep)
+            return
+        if self.state in ("done", "failed") or ep.now < self.next_poll:
+            return
+        if self.state == "stream" and self.window:
+            self.next_poll = ep.now + 1000
+            self.tick_windowed(ep)
+            return
+        self.next_poll = ep.now + self.poll_us
+        timeout = {"start": 25e6, "stream": 2e6, "end": 5e6}[self.state]
+        if self.acked:
+            self.retries = 0
+            if self.state == "start":
+                self.state = "stream"
+                self.t_stream = ep.now
+                self.window = self.ack_window
+                self.chunk_crc = bool(self.ack_flags & OTA_FLAG_CHUNK_CRC)
+                if self.window:
+                    self.lib.ota_wtx_init(self.wtx, len(self.image), self.window)
+                    self.tick_windowed(ep)
+                    return
+            elif self.state == "stream":
+                self.offset += len(self.image[self.offset:self.offset + self.chunk])
+                if self.offset >= len(self.image):
+                    self.state = "end"
+                    self.t_end = ep.now
+            else:
+                self.state = "done"
+                self.t_done = ep.now
+                return
+            self.send_current(ep)
+        elif self.nacked and self.state == "end":
+            # Stm32Serial gives up on a CRC mismatch
+            self.end_nacked = True
+            self.state = "failed"
+        elif self.nacked or ep.now - self.sent_at > timeout:
+            self.retries += 1
+            self.total_retries += 1
+            if self.retries >= 3:
+                self.state = "failed"
+                return
+            self.send_current(ep)
+
+
+def run_ota(lib, args, image, window, base=None):
+    if args.app:
+        # The app's UART task runs every 5 ms in the negotiated framing and
+        # hands the frames to the OTA task
+        link = Link(lib, args, stm_loop_us=5000, esp_loop_us=1000, baud=args.ota_baud)
+    else:
+        # The bootloader busy-polls its UART and only speaks the legacy framing
+        link = Link(lib, args, stm_loop_us=0, esp_loop_us=1000, baud=args.ota_baud,
+                    framing=FRAMING_LEGACY)
+    link.esp.apply_bulk_cap(unlimited=True)
+    boot = OtaReceiverApp(lib, args, base, app=args.app)
+    esp = EspOtaApp(lib, args, image, window)
+    esp.state = "idle"
+    link.esp.app = esp
+    link.stm.app = boot
+    link.run(600e6, done=lambda: esp.state in ("done", "failed"))
+    return link, boot, esp
+
+
+def ota_files(args):
+    """(image, file sent, running image): --image or random bytes, packed
+    with --efz, or a patch against --base."""
+    if args.image:
+        with open(args.image, "rb") as f:
+            image = f.read()
+    else:
+        rng = random.Random(args.seed)
+        image = bytes(rng.randrange(256) for _ in range(args.size))
+    base = None
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+        return image, ota_pack.pack(image, base=base), base
+    return image, (ota_pack.pack(image) if args.efz else image), base
+
+
+def sent_as(args, sent):
+    if args.base:
+        return " as %d bytes EFD1" % len(sent)
+    return " as %d bytes EFZ1" % len(sent) if args.efz else ""
+
+
+def scenario_ota(lib, args):
+    image, sent, base = ota_files(args)
+    link, boot, esp = run_ota(lib, args, sent, args.window, base)
+
+    print("ota %d bytes%s to the %s @%d baud, %s:" % (
+        len(image), sent_as(args, sent), "app" if args.app else "bootloader", args.ota_baud,
+        "window %d x %d B" % (esp.window, OTA_WINDOW_CHUNK) if esp.window
+        else "stop-and-wait %d B, ack poll %dms" % (esp.chunk, args.ack_poll_ms)))
+    if esp.end_nacked:
+        print("  END NACK: image CRC mismatch (%d chunk CRC rejects)" % boot.chunk_crc_errors)
+    elif esp.state != "done":
+        print("  FAILED at offset %d (state %s)" % (esp.offset, esp.state))
+    else:
+        stream_s = (esp.t_end - esp.t_stream) / 1e6
+        print("  start       : %.2fs" % ((esp.t_stream - esp.t_start) / 1e6))
+        print("  stream      : %.2fs  %.1f KB/s of image  (%d retries)" % (
+            stream_s, len(image) / stream_s / 1024, esp.total_retries))
+        print("  total       : %.2fs  image %s  (%d chunk CRC rejects)" % (
+            (esp.t_done - esp.t_start) / 1e6, "OK" if boot.image(len(image)) == image else "MISMATCH",
+            boot.chunk_crc_errors))
+    if boot.overruns:
+        print("  %s overruns: %d" % ("OTA queue" if args.app else "bootloader RX ring", boot.overruns))
+    link.report()
+    link.close()
+
+
+def scenario_otabench(lib, args):
+    """Total flash time for one fixed image, stop-and-wait vs windowed (with
+    and without per-chunk CRC32), on a clean link and with injected loss."""
+    image, sent, base = ota_files(args)
+    impairments = [("clean", 0.0, 0.0), ("ber 1e-5", 1e-5, 0.0),
+                   ("ber 1e-4", 1e-4, 0.0), ("drop 1e-4", 0.0, 1e-4)]
+    print("ota bench: %d bytes%s @%d baud, 128K erase %dms" % (
+        len(image), sent_as(args, sent), args.ota_baud, args.erase_128k_ms))
+    print("  %-10s %-24s %9s %9s %9s  %s" % ("link", "mode", "stream", "total", "retries", "image"))
+    for label, ber, drop in impairments:
+        for window, chunk_crc in ((0, True), (args.window, False), (args.window, True)):
+            run_args = argparse.Namespace(**vars(args))
+            run_args.ber, run_args.drop = ber, drop
+            run_args.no_chunk_crc = not chunk_crc
+            link, boot, esp = run_ota(lib, run_args, sent, window, base)
+            mode = ("window %d" % window if window else "stop-and-wait") + (", chunk crc" if chunk_crc else "")
+            if esp.state == "done":
+                print("  %-10s %-24s %8.2fs %8.2fs %9d  %s" % (
+                    label, mode, (esp.t_end - esp.t_stream) / 1e6, (esp.t_done - esp.t_start) / 1e6,
+                    esp.total_retries, "OK" if boot.image(len(image)) == image else "MISMATCH"))
+            elif esp.end_nacked:
+                print("  %-10s %-24s %8.2fs %9s %9d  END NACK" % (
+                    label, mode, (esp.t_end - esp.t_stream) / 1e6, "-", esp.total_retries))
+            else:
+                print("  %-10s %-24s FAILED at offset %d" % (label, mode, esp.offset))
+            link.close()
+
+
+class StmLogApp(App):
+    """LogManager download: DL_BLOCK_SIZE blocks read front to back, up to
+    DL_BURST chunks per UART loop iteration within the ESP32's credit, seek
+    on CMD_LOG_RESEND_REQ, empty chunk at EOF."""
+
+    BLOCK = 4096
+    BURST = 8
+
+    def __init__(self, lib, args, content):
+        self.lib = lib
+        self.content = content
+        self.read_us = args.sd_read_us
+        self.sector_us = args.sd_sector_us
+        self.downloading = False
+        self.offset = 0
+        self.limit = 0
+        self.eof_sent = False
+        self.block_start = self.block_len = 0
+        self.reads = 0
+
+    def on_frame(self, ep, frame):
+        cmd = frame[1]
+        if cmd == CMD_LOG_DOWNLOAD_REQ:
+            self.downloading = True
+            self.offset = self.limit = 0
+            self.eof_sent = False
+            self.block_start = self.block_len = 0
+        elif cmd == CMD_LOG_RESEND_REQ and self.downloading:
+            self.offset = int.from_bytes(frame[3:7], "little")
+            self.eof_sent = False
+        elif cmd == CMD_LOG_CREDIT and self.downloading:
+            offset = int.from_bytes(frame[3:7], "little")
+            self.limit = max(self.limit, offset + frame[7] * LOG_CHUNK_MAX)
+            if self.eof_sent and offset >= len(self.content):
+                self.downloading = False
+
+    def send(self, ep, frame):
+        # UART_SendRaw from the UART task pumps until the ring has room
+        while not ep.send(frame, retry=True):
+            ep.pump()
+            ep.now = max(ep.now + 1000, ep.out.busy_until)
+        ep.pump()
+
+    def tick(self, ep):
+        if not self.downloading:
+            return
+        for _ in range(self.BURST):
+            if self.offset >= self.limit:
+                return
+            if self.offset >= len(self.content):
+                if not self.eof_sent:
+                    self.eof_sent = True
+                    self.send(ep, pack(self.lib.pack_log_data_chunk_message, len(self.content), None, 0))
+                return
+            if not self.block_start <= self.offset < self.block_start + self.block_len:
+                self.block_start = self.offset - self.offset % self.BLOCK
+                self.block_len = len(self.content[self.block_start:self.block_start + self.BLOCK])
+                ep.now += self.read_us + (self.block_len + 511) // 512 * self.sector_us
+                self.reads += 1
+            n = min(LOG_CHUNK_MAX, self.block_start + self.block_len - self.offset, self.limit - self.offset)
+            data = self.content[self.offset:self.offset + n]
+            self.send(ep, pack(self.lib.pack_log_data_chunk_message, self.offset, u8buf(data), n))
+            self.offset += n
+
+
+class EspLogApp(App):
+    """Stm32Serial log download through log_stream: chunks land in the
+    16 KB ring, the HTTP response drains it at --consumer-kbps (0 = as fast
+    as it arrives), and credit only covers the room the ring has."""
+
+    def __init__(self, lib, consumer_kbps):
+        self.lib = lib
+        self.stream = ctypes.create_string_buffer(lib.sim_sizeof_log_stream())
+        self.consumer_bps = consumer_kbps * 1024
+        self.out = bytearray()
+        self.scratch = (ctypes.c_uint8 * 1460)()
+        self.complete = False
+        self.started = False
+        self.peak = 0
+        self.last_read = 0
+        self.t_start = 0
+        self.t_done = 0
+
+    def act(self, ep, actions):
+        lib = self.lib
+        if actions & LOG_STREAM_SEND_RESEND:
+            ep.send(pack(lib.pack_log_resend_req_message, lib.log_stream_offset(self.stream)))
+        if actions & LOG_STREAM_SEND_CREDIT:
+            offset = lib.log_stream_offset(self.stream)
+            ep.send(pack(lib.pack_log_credit_message, offset, lib.log_stream_credits(self.stream)))
+
+    def on_frame(self, ep, frame):
+        if frame[1] != CMD_LOG_DATA_CHUNK:
+            return
+        offset = int.from_bytes(frame[3:7], "little")
+        n = int.from_bytes(frame[7:9], "little")
+        self.act(ep, self.lib.log_stream_on_chunk(self.stream, offset, u8buf(frame[9:9 + n]), n, int(ep.now // 1000)))
+        self.peak = max(self.peak, self.lib.log_stream_buffered(self.stream))
+
+    def tick(self, ep):
+        lib = self.lib
+        if not self.started:
+            self.started = True
+            self.t_start = self.last_read = ep.now
+            actions = lib.log_stream_start(self.stream, int(ep.now // 1000))
+            ep.send(pack(lib.pack_log_download_req_message, b"log.txt"))
+            self.act(ep, actions)
+            return
+        if self.complete:
+            return
+        # _fillBuffer: whatever the TCP send buffer takes since the last call
+        budget = len(self.scratch)
+        if self.consumer_bps:
+            budget = min(budget, int((ep.now - self.last_read) * self.consumer_bps // 1000000))
+        if budget:
+            n = lib.log_stream_read(self.stream, self.scratch, budget)
+            self.out += bytes(self.scratch[:n])
+            self.last_read = ep.now
+        self.act(ep, lib.log_stream_poll(self.stream, int(ep.now // 1000)))
+        if lib.log_stream_done(self.stream):
+            self.complete = True
+            self.t_done = ep.now
+
+
+def scenario_logdl(lib, args):
+    rng = random.Random(args.seed)
+    content = bytes(rng.choice(b"abcdefghijklmnopqrstuvwxyz \n") for _ in range(args.size))
+    link = Link(lib, args)
+    stm = StmLogApp(lib, args, content)
+    esp = EspLogApp(lib, args.consumer_kbps)
+    link.stm.app = stm
+    link.esp.app = esp
+    link.run(600e6, done=lambda: esp.complete)
+
+    secs = (esp.t_done - esp.t_start) / 1e6
+    print("log download %d bytes @%d baud:" % (len(content), args.baud))
+    if not esp.complete:
+        print("  INCOMPLETE: %d bytes received" % len(esp.out))
+    else:
+        s = esp.stream
+        print("  %.2fs  %.1f KB/s  %d resend requests  %d stalls  %d credits  %d SD reads  "
+              "peak buffered %d/%d  content %s" % (
+                  secs, len(content) / secs / 1024, lib.sim_log_stream_resends(s), lib.sim_log_stream_stalls(s),
+                  lib.sim_log_stream_credits_sent(s), stm.reads, esp.peak, LOG_STREAM_RING,
+                  "OK" if bytes(esp.out) == content else "MISMATCH"))
+    link.report()
+    link.close()
+
+
+class StmListApp(App):
+    """LogManager_HandleListReq. Paged: a page of as many entries as fit a
+    frame per request, the directory kept open between pages read in order.
+    Legacy (before paging): one 40-byte entry frame per file with a 2 ms
+    task delay after each, all from one request, blocking the UART task."""
+
+    MAX_PAYLOAD = 255
+    ENTRY_MAX = 5 + LOG_LIST_NAME_MAX
+
+    def __init__(self, lib, args, files, paged):
+        self.lib = lib
+        self.files = files
+        self.paged = paged
+        self.dirent_us = args.sd_dirent_us
+        self.requests = []
+        self.open = False
+        self.next = 0
+        self.total = 0
+        self.pages = 0
+        self.blocked_us = 0   # Longest UART task iteration spent on one request
+
+    def on_frame(self, ep, frame):
+        if frame[1] != CMD_LOG_LIST_REQ:
+            return
+        cursor = ctypes.c_uint16()
+        if self.lib.unpack_log_list_req_message(u8buf(frame), ctypes.byref(cursor)) == 0:
+            self.requests.append(cursor.value)
+
+    def send(self, ep, frame):
+        while not ep.send(frame, retry=True):
+            ep.pump()
+            ep.now = max(ep.now + 1000, ep.out.busy_until)
+        ep.pump()
+
+    def tick(self, ep):
+        while self.requests:
+            cursor = self.requests.pop(0)
+            t0 = ep.now
+            if self.paged:
+                self.page(ep, cursor)
+            else:
+                self.legacy(ep)
+            self.blocked_us = max(self.blocked_us, ep.now - t0)
+
+    def page(self, ep, cursor):
+        if not self.open or cursor == 0 or cursor != self.next:
+            # Count pass, rewind, skip to the cursor
+            ep.now += (len(self.files) + min(cursor, len(self.files))) * self.dirent_us
+            self.open = True
+            self.total = len(self.files)
+            self.next = min(cursor, self.total)
+        buf = (ctypes.c_uint8 * (self.MAX_PAYLOAD + 4))()
+        self.lib.pack_log_list_resp_begin(buf, self.total, cursor)
+        while self.next < self.total and buf[2] + self.ENTRY_MAX <= self.MAX_PAYLOAD:
+            name, size = self.files[self.next]
+            ep.now += self.dirent_us
+            self.lib.pack_log_list_resp_add(buf, size, name.encode())
+            self.next += 1
+        if self.next >= self.total:
+            self.open = False
+        n = self.lib.pack_log_list_resp_end(buf)
+        self.pages += 1
+        self.send(ep, bytes(buf[:n]))
+
+    def legacy(self, ep):
+        ep.now += len(self.files) * self.dirent_us
+        if not self.files:
+            self.send(ep, make_frame(self.lib, CMD_LOG_LIST_RESP, bytes(40)))
+            self.pages += 1
+        for idx, (name, size) in enumerate(self.files):
+            ep.now += self.dirent_us
+            payload = (len(self.files).to_bytes(2, "little") + idx.to_bytes(2, "little") +
+                       size.to_bytes(4, "little") + name.encode()[:31].ljust(32, b"\0"))
+            self.send(ep, make_frame(self.lib, CMD_LOG_LIST_RESP, payload))
+            self.pages += 1
+            ep.now += 2000   # vTaskDelay(2)
+            ep.pump()
+
+
+class EspListApp(App):
+    """Stm32Serial log list. Paged: the next page is asked for as each one
+    arrives, a page missing for LOG_LIST_RETRY_MS is asked for again.
+    Legacy: one request, then wait for the entry with the last index."""
+
+    RETRY_US = 500000
+    RETRIES = 5
+
+    def __init__(self, lib, paged):
+        self.lib = lib
+        self.paged = paged
+        self.entries = []
+        self.started = False
+        self.busy = False
+        self.complete = False
+        self.last_req = 0
+        self.retries = 0
+        self.requests = 0
+        self.t_start = 0
+        self.t_done = 0
+
+    def request(self, ep, cursor):
+        self.last_req = ep.now
+        self.requests += 1
+        if self.paged:
+            ep.send(pack(self.lib.pack_log_list_req_message, cursor))
+        else:
+            ep.send(make_frame(self.lib, CMD_LOG_LIST_REQ))
+
+    def done(self, ep):
+        self.busy = False
+        self.complete = True
+        self.t_done = ep.now
+
+    def on_frame(self, ep, frame):
+        if frame[1] != CMD_LOG_LIST_RESP or not self.busy:
+            return
+        if not self.paged:
+            total = int.from_bytes(frame[3:5], "little")
+            idx = int.from_bytes(frame[5:7], "little")
+            if idx == 0:
+                self.entries = []
+            if total:
+                self.entries.append((frame[11:43].split(b"\0")[0].decode(), int.from_bytes(frame[7:11], "little")))
+            if idx == total - 1 or total == 0:
+                self.done(ep)
+            return
+        buf = u8buf(frame)
+        total, cursor, count = ctypes.c_uint16(), ctypes.c_uint16(), ctypes.c_uint8()
+        if self.lib.unpack_log_list_resp_message(buf, ctypes.byref(total), ctypes.byref(cursor),
+                                                 ctypes.byref(count)) != 0:
+            return
+        if cursor.value != len(self.entries):
+            return
+        size = ctypes.c_uint32()
+        name = ctypes.create_string_buffer(LOG_LIST_NAME_MAX + 1)
+        pos = 0
+        while True:
+            pos = self.lib.unpack_log_list_resp_entry(buf, pos, ctypes.byref(size), name)
+            if pos < 0:
+                break
+            self.entries.append((name.value.decode(), size.value))
+        self.retries = 0
+        if len(self.entries) >= total.value or count.value == 0:
+            self.done(ep)
+        else:
+            self.request(ep, len(self.entries))
+
+    def tick(self, ep):
+        if not self.started:
+            self.started = self.busy = True
+            self.t_start = ep.now
+            self.request(ep, 0)
+        elif self.paged and self.busy and ep.now - self.last_req > self.RETRY_US:
+            self.retries += 1
+            if self.retries > self.RETRIES:
+                self.done(ep)
+            else:
+                self.request(ep, len(self.entries))
+
+
+def scenario_loglist(lib, args):
+    rng = random.Random(args.seed)
+    files = [("log_%04d_%02d%02d_%s.log" % (2024 + i // 400, 1 + i // 31 % 12, 1 + i % 31,
+                                              "".join(rng.choice("abcdef0123456789") for _ in range(rng.randrange(2, 9)))),
+              rng.randrange(100, 5 * 1024 * 1024)) for i in range(args.files)]
+    print("log list, %d files @%d baud:" % (len(files), args.baud))
+    for label, paged in (("per file", False), ("paged", True)):
+        link = Link(lib, args)
+        stm = StmListApp(lib, args, files, paged)
+        esp = EspListApp(lib, paged)
+        link.stm.app = stm
+        link.esp.app = esp
+        link.run(60e6, done=lambda: esp.complete)
+        if not esp.complete:
+            print("  %-9s INCOMPLETE after 60s: %d of %d entries" % (label, len(esp.entries), len(files)))
+        else:
+            print("  %-9s %6.2fs  %4d frames  %3d requests  UART task blocked up to %7.2fms  list %s" % (
+                label, (esp.t_done - esp.t_start) / 1e6, stm.pages, esp.requests, stm.blocked_us / 1000,
+                "OK" if esp.entries == files else "MISMATCH (%d of %d)" % (len(esp.entries), len(files))))
+        link.close()
+
+
+def scenario_nego(lib, args):
+    link = Link(lib, args, baud=LINK_BAUD_BASE)
+    esp_app = EspStatusApp(lib, False)
+    stm_app = StmStatusApp(lib, 200000, 1000000, False)
+    link.esp.app = esp_app
+    link.stm.app = stm_app
+
+    link.run(2e6, done=lambda: stm_app.connected)
+    t0 = link.now()
+    lib.link_baud_negotiate(link.esp.lb, link.esp.us())
+    link.run(t0 + 30e6, done=lambda: not lib.link_baud_busy(link.esp.lb))
+    print("negotiation: %.2fs -> ESP %d %s / STM %d %s" % (
+        (link.now() - t0) / 1e6,
+        lib.link_baud_current(link.esp.lb), FRAMING_NAMES[lib.link_baud_framing(link.esp.lb)],
+        lib.link_baud_current(link.stm.lb), FRAMING_NAMES[lib.link_baud_framing(link.stm.lb)]))
+
+    # Settle past the slave probation, then measure the committed rate
+    link.run(link.now() + 2e6)
+    lib.link_baud_selftest(link.esp.lb, args.pings, args.pad, link.esp.us())
+    link.run(link.now() + 30e6, done=lambda: not lib.link_baud_busy(link.esp.lb))
+    r = lib.link_baud_last_result(link.esp.lb).contents
+    span = max(1, r.end_us - r.start_us)
+    print("self-test @%d: sent=%d received=%d lost=%d errors=%d rtt min/avg/max=%.2f/%.2f/%.2fms %.1f KB/s" % (
+        r.baud, r.sent, r.received, r.lost, r.errors, r.rtt_min_us / 1000,
+        (r.rtt_sum_us / r.received / 1000) if r.received else 0, r.rtt_max_us / 1000,
+        2 * r.bytes / span * 1e6 / 1024))
+    link.report()
+    link.close()
+
+
+def scenario_rxring(lib, args):
+    """The ESP32 keeps its bulk class saturated with log lines while the
+    STM32 UART task is held off the ring by SD work once a second."""
+    stalls = (args.stm_stall_ms,) if args.stm_stall_ms else (50, 100, 200)
+    print("rxring: ESP32 log flood for %.1fs, STM32 task stalled once a second:" % args.duration)
+    print("  %-6s %8s %7s %9s %9s %10s  %s" % ("ring", "baud", "stall", "overruns", "lost B", "crc_errors",
+                                               "status p99"))
+    for ring in (2048, STM_RX_RING):
+        for stall_ms in stalls:
+            for baud in LINK_BAUD_LADDER:
+                link = Link(lib, args, baud=baud, rx_ring=ring, stall_us=stall_ms * 1000)
+                esp_app = EspStatusApp(lib, True)
+                stm_app = StmStatusApp(lib, args.poll_ms * 1000, args.control_ms * 1000, False)
+                link.esp.app = esp_app
+                link.stm.app = stm_app
+                link.run(args.duration * 1e6)
+                stm = link.stm
+                print("  %-6s %8d %5dms %9d %9d %10d  %s" % (
+                    "%dK" % (ring // 1024), baud, stall_ms, stm.rx_overruns, stm.rx_lost, stm.crc_errors,
+                    "%.2fms" % (percentile(stm_app.status_latency, 99) / 1000) if stm_app.status_latency
+                    else "never connected"))
+                link.close()
+    print("  the firmware accepts up to %d (uart_task.c UART_RX_MAX_BAUD) with a %dK DMA ring" % (
+        STM_RX_MAX_BAUD, STM_RX_RING // 1024))
+
+
+def scenario_framing(lib, args):
+    """Streams the same frames through both framings with the same bit-error
+    pattern density and counts what the parser recovers."""
+    ber = args.ber or 1e-4
+    count = args.frames
+    for framing in (FRAMING_LEGACY, FRAMING_COBS):
+        rng = random.Random(args.seed)
+        sent = {}
+        stream = bytearray()
+        for seq in range(count):
+            # Random payloads so START_BYTE and 0x00 occur inside frames
+            payload = seq.to_bytes(4, "little") + bytes(rng.randrange(256) for _ in range(rng.randrange(0, args.frame_max)))
+            frame = make_frame(lib, CMD_ESP_LOG_DATA, payload)
+            sent[seq] = frame
+            stream += encode(lib, frame, framing)
+
+        flips = 0
+        pos = int(rng.expovariate(ber))
+        while pos < len(stream) * 8:
+            stream[pos // 8] ^= 1 << (pos % 8)
+            flips += 1
+            pos += 1 + int(rng.expovariate(ber))
+
+        parser = ctypes.create_string_buffer(lib.sim_sizeof_parser())
+        lib.link_parser_set_framing(parser, framing)
+        good = bad = crc = 0
+        received = set()
+        for b in stream:
+            r = lib.link_parser_feed(parser, b)
+            if r == LINK_PARSE_FRAME:
+                frame = ctypes.string_at(lib.sim_parser_frame(parser), lib.sim_parser_frame_len(parser))
+                seq = int.from_bytes(frame[3:7], "little") if len(frame) >= 8 else -1
+                if sent.get(seq) == frame:
+                    good += 1
+                    received.add(seq)
+                else:
+                    bad += 1
+            elif r == LINK_PARSE_CRC_ERROR:
+                crc += 1
+        lost = count - good
+        longest = run = 0
+        for seq in range(count):
+            run = 0 if seq in received else run + 1
+            longest = max(longest, run)
+        print("%-6s: %d frames, %d wire bytes, %d bit errors -> %d lost (%.2f per error), "
+              "longest loss run %d, %d CRC rejects, %d corrupt frames accepted" % (
+                  FRAMING_NAMES[framing], count, len(stream), flips, lost,
+                  lost / flips if flips else 0, longest, crc, bad))
+
+
+# ---------------------------------------------------------------------------
+# Log levels
+# ---------------------------------------------------------------------------
+
+def ble_debug_session(rng, secs):
+    """ESP32 log lines of a BLE debug session with every tag at verbose:
+    (time_us, level, tag, fmt_id or None for a text line, message or args)."""
+    lines = []
+
+    def every(rate, level, tag, make):
+        t = rng.uniform(0, 1e6 / rate)
+        while t < secs * 1e6:
+            lines.append((t, level, tag) + make())
+            t += rng.expovariate(rate) * 1e6
+
+    hexdump = lambda n: " ".join("%02x" % rng.randrange(256) for _ in range(n))
+    every(120, 5, "NimBLE", lambda: (None, "GATT procedure; notify rx conn=%d handle=%d len=%d" % (
+        rng.randrange(4), rng.randrange(10, 60), rng.randrange(8, 180))))
+    every(40, 4, "NimBLEClient", lambda: (None, "<< onNotify: handle %d data %s" % (
+        rng.randrange(10, 60), hexdump(rng.randrange(8, 24)))))
+    every(30, 4, "NimBLEScan", lambda: (None, "Advertised Device found: Name: %s, Address: %s, rssi: %d" % (
+        rng.choice(["R331ZEB4ZE", "P231ZEB5", "KT210"]), ":".join("%02x" % rng.randrange(256) for _ in range(6)),
+        -rng.randrange(40, 95))))
+    every(25, 4, "EcoflowESP32", lambda: (None, "Packet src=0x%02x cmd=%d len=%d" % (
+        rng.randrange(256), rng.randrange(100), rng.randrange(200))))
+    every(25, 4, "EcoflowProtocol", lambda: (None, "Decrypted %d bytes, seq %d" % (
+        rng.randrange(20, 200), rng.randrange(1 << 16))))
+    every(1, 2, "EcoflowESP32", lambda: (None, "Write without response timed out, retrying"))
+    every(0.25, 1, "NimBLEClient", lambda: (None, "Disconnected; reason=531"))
+    # EcoflowDataParser: a LOG_STM_I dump of every field each update, as records
+    t = rng.uniform(0, 5e6)
+    while t < secs * 1e6:
+        for i in range(60):
+            args = bytes([0x01]) + rng.randrange(1 << 32).to_bytes(4, "little")
+            lines.append((t + i * 50, 3, "EcoflowDataParser", 0x5EED0000 + i, args))
+        t += 5e6
+    lines.sort(key=lambda line: line[0])
+    return lines
+
+
+class EspLogLevelApp(EspStatusApp):
+    """RemoteLogger and Stm32Serial: gates each line on the ESP32's table,
+    batches what passes and keeps a copy of the STM32's table."""
+
+    def __init__(self, lib, lines, esp_levels, stm_levels):
+        super().__init__(lib, False)
+        self.lines = lines
+        self.levels = ctypes.create_string_buffer(lib.sim_sizeof_log_levels())
+        # RemoteLogger's defaults: warnings and errors, all of the data dumps
+        lib.log_levels_init(self.levels, 2)
+        lib.log_levels_set(self.levels, b"EcoflowDataParser", 5)
+        for tag, level in esp_levels.items():
+            lib.log_levels_set(self.levels, tag.encode(), level)
+        self.stm_sets = list(stm_levels.items())
+        self.stm_levels = None
+        self.batch = ctypes.create_string_buffer(lib.sim_sizeof_log_batch())
+        self.start = None
+        self.next_line = 0
+        self.gated = 0
+
+    def on_frame(self, ep, frame):
+        if frame[1] == CMD_LOG_LEVEL_LIST:
+            table = ctypes.POINTER(ctypes.c_uint8)()
+            n = self.lib.unpack_log_level_list_message(u8buf(frame), ctypes.byref(table))
+            if n > 0:
+                self.stm_levels = ctypes.create_string_buffer(self.lib.sim_sizeof_log_levels())
+                self.lib.log_levels_unpack(self.stm_levels, table, n)
+        else:
+            super().on_frame(ep, frame)
+
+    def begin(self, ep):
+        # The table is only sent once the STM32 answered the handshake
+        for tag, level in self.stm_sets:
+            ep.send(pack(self.lib.pack_log_level_set_message, level, tag.encode()))
+        self.lib.log_batch_init(self.batch, LOG_BATCH_RATE, LOG_BATCH_BURST, ep.us() // 1000)
+
+    def tick(self, ep):
+        if self.start is None:
+            return
+        lib = self.lib
+        while self.next_line < len(self.lines) and self.start + self.lines[self.next_line][0] <= ep.now:
+            _, level, tag, fmt_id, body = self.lines[self.next_line]
+            self.next_line += 1
+            # Records are LOG_STM_x lines: RemoteLogger_WantsStm() passes a
+            # tag the table does not name
+            if fmt_id is None:
+                wants = lib.log_levels_get(self.levels, tag.encode())
+            else:
+                wants = lib.log_levels_get_or(self.levels, tag.encode(), 5)
+            if not wants >= level:
+                self.gated += 1
+                continue
+            if fmt_id is None:
+                frame = pack(lib.pack_esp_log_message, level, tag.encode(), body.encode())
+            else:
+                frame = pack(lib.pack_esp_log_rec_message, level, fmt_id, lib.log_levels_tag_id(tag.encode()),
+                             u8buf(body), len(body))
+            lib.log_batch_add(self.batch, u8buf(frame), len(frame), ep.us() // 1000)
+        buf = (ctypes.c_uint8 * LINK_FRAME_MAX)()
+        while True:
+            n = lib.log_batch_take(self.batch, ep.us() // 1000, False, buf)
+            if n <= 0:
+                break
+            ep.send(bytes(buf[:n]))
+
+
+class StmLogLevelApp(StmStatusApp):
+    """uart_task.c and log_manager.c: gates each ESP32 line on the STM32's
+    table (records by their tag's ID), packs what passes into the record ring and
+    writes the ring out as the log task does."""
+
+    def __init__(self, lib, poll_us):
+        super().__init__(lib, poll_us, 1e12, False)
+        self.levels = ctypes.create_string_buffer(lib.sim_sizeof_log_levels())
+        lib.log_levels_init(self.levels, 5)
+        self.lines = self.gated = self.rec_bytes = 0
+        self.pending = 0
+        self.oldest = 0
+        self.urgent = False
+        self.rest_until = 0
+        self.offset = 0
+        self.writes = self.sectors = 0
+
+    def on_frame(self, ep, frame):
+        lib = self.lib
+        cmd = frame[1]
+        if cmd == CMD_LOG_LEVEL_SET:
+            level = ctypes.c_uint8()
+            tag = ctypes.create_string_buffer(32)
+            if lib.unpack_log_level_set_message(u8buf(frame), ctypes.byref(level), tag, 32) == 0:
+                lib.log_levels_set(self.levels, tag.value, level.value)
+            table = (ctypes.c_uint8 * LOG_LEVELS_PACKED_MAX)()
+            n = lib.log_levels_pack(self.levels, table)
+            ep.send(pack(lib.pack_log_level_list_message, table, n))
+        elif cmd == CMD_ESP_LOG_BATCH:
+            buf = u8buf(frame)
+            count = ctypes.c_uint8()
+            if lib.unpack_esp_log_batch_message(buf, ctypes.byref(count)) != 0:
+                return
+            cursor = LogBatchCursor()
+            line_cmd, line_len = ctypes.c_uint8(), ctypes.c_uint8()
+            line = (ctypes.c_uint8 * MAX_PAYLOAD_LEN)()
+            for _ in range(count.value):
+                lib.unpack_esp_log_batch_line(buf, ctypes.byref(cursor), ctypes.byref(line_cmd), line,
+                                              ctypes.byref(line_len))
+                self.line(ep, line_cmd.value, bytes(line[:line_len.value]))
+        else:
+            super().on_frame(ep, frame)
+
+    def line(self, ep, cmd, p):
+        lib = self.lib
+        self.lines += 1
+        level = p[0]
+        rec = (ctypes.c_uint8 * LOG_REC_MAX)()
+        if cmd == CMD_ESP_LOG_DATA:
+            tag = p[2:2 + p[1]]
+            if not lib.log_levels_get(self.levels, tag) >= level:
+                self.gated += 1
+                return
+            n = lib.log_rec_pack_text(rec, ep.us() // 1000, level, tag, p[2 + p[1]:])
+        else:
+            if not lib.log_levels_get_id(self.levels, int.from_bytes(p[5:7], "little")) >= level:
+                self.gated += 1
+                return
+            n = lib.log_rec_pack(rec, ep.us() // 1000, level, int.from_bytes(p[1:5], "little"),
+                                 u8buf(p[7:]), len(p) - 7)
+        if not self.pending:
+            self.oldest = ep.now
+        self.pending += n
+        self.rec_bytes += n
+        self.urgent = self.urgent or level <= 1
+
+    def tick(self, ep):
+        super().tick(ep)
+        # LogManager_Service: everything once an error came or the oldest
+        # line is LOG_FLUSH_MS old, else whole sectors in LOG_FLUSH_SECTORS
+        if not self.pending or ep.now < self.rest_until:
+            return
+        urgent = self.urgent
+        if urgent or ep.now - self.oldest >= LOG_FLUSH_MS * 1000:
+            n = self.pending
+        elif self.pending >= LOG_FLUSH_SECTORS * LOG_SECTOR:
+            n = (self.offset + self.pending) // LOG_SECTOR * LOG_SECTOR - self.offset
+        else:
+            return
+        self.writes += 1
+        self.sectors += -(-(self.offset + n) // LOG_SECTOR) - self.offset // LOG_SECTOR
+        self.offset += n
+        self.pending -= n
+        self.oldest = ep.now
+        self.urgent = False
+        if urgent:
+            self.rest_until = ep.now + LOG_COALESCE_MS * 1000
+
+
+def scenario_loglevel(lib, args):
+    rng = random.Random(args.seed)
+    lines = ble_debug_session(rng, args.duration)
+    # Debugging a notify problem: NimBLEClient at verbose, the rest as it was
+    wanted = {"*": 2, "NimBLEClient": 5, "EcoflowDataParser": 3}
+    stm_wanted = {"*": 2, "NimBLEClient": 5, "EcoflowDataParser": 3}
+    runs = (("defaults", {}, {}),
+            ("verbose", {"*": 5}, {}),
+            ("ESP gate", wanted, {}),
+            ("STM gate", {"*": 5}, stm_wanted),
+            ("both", wanted, stm_wanted))
+    print("loglevel: BLE debug session, %d ESP32 lines in %.1fs @%d baud:" % (len(lines), args.duration, args.baud))
+    print("  %-9s %7s %7s %7s %9s %7s %8s %9s %7s %8s  %s" % (
+        "", "gatedE", "sent", "dropped", "wire B", "frames", "gatedS", "SD bytes", "writes", "sectors", "status p99"))
+    for label, esp_levels, stm_levels in runs:
+        link = Link(lib, args)
+        esp = EspLogLevelApp(lib, lines, esp_levels, stm_levels)
+        stm = StmLogLevelApp(lib, args.poll_ms * 1000)
+        link.esp.app = esp
+        link.stm.app = stm
+        link.run(5e6, done=lambda: stm.connected)
+        esp.begin(link.esp)
+        link.run(link.now() + 1e6, done=lambda: esp.stm_levels is not None and len(stm.status_latency) > 0)
+        if stm_levels and esp.stm_levels is None:
+            print("  %-9s STM32 never answered the level table" % label)
+            link.close()
+            continue
+
+        wire0 = link.esp.out.bytes_sent
+        stm.status_latency = []
+        esp.start = link.now()
+        link.run(esp.start + args.duration * 1e6 + LOG_FLUSH_MS * 2000)
+        s = lib.sim_log_batch_stats(esp.batch).contents
+        print("  %-9s %7d %7d %7d %9d %7d %8d %9d %7d %8d  %.2fms" % (
+            label, esp.gated, s.lines, s.dropped, link.esp.out.bytes_sent - wire0, s.frames,
+            stm.gated, stm.rec_bytes, stm.writes, stm.sectors, percentile(stm.status_latency, 99) / 1000))
+        link.close()
+    print("  gatedE/gatedS: lines the ESP32/STM32 table stopped; dropped: over the batch rate limit;")
+    print("  wire B: ESP32->STM32 bytes, status polls included; writes/sectors: f_write calls and the sectors they touch")
+
+
+def parse_ber_at(items):
+    out = {}
+    for item in items or []:
+        baud, ber = item.split("=")
+        out[int(baud)] = float(ber)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ESP32 <-> STM32 UART link simulator")
+    parser.add_argument("scenario", choices=["status", "ota", "otabench", "logdl", "loglist", "nego", "framing", "loglevel",
+                                             "rxring", "all"])
+    parser.add_argument("--transport", choices=["mem", "pty"], default="mem")
+    parser.add_argument("--baud", type=int, default=LINK_BAUD_BASE)
+    parser.add_argument("--ber", type=float, default=0.0, help="bit error rate")
+    parser.add_argument("--ber-at", action="append", help="BAUD=BER, error rate at a given baud")
+    parser.add_argument("--drop", type=float, default=0.0, help="byte drop probability")
+    parser.add_argument("--framing", choices=FRAMING_NAMES, default="cobs",
+                        help="framing above the base rate (negotiated, or forced when starting above base)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--rx-ring", type=int, default=STM_RX_RING, help="STM32 RX ring bytes")
+    parser.add_argument("--stm-max-baud", type=int, default=STM_RX_MAX_BAUD,
+                        help="highest rate the STM32 accepts (link_baud_set_max)")
+    parser.add_argument("--stm-stall-ms", type=int, default=0,
+                        help="STM32 UART task blocked this long once a second (SD work)")
+    parser.add_argument("--duration", type=float, default=10.0, help="status: seconds")
+    parser.add_argument("--bulk", action="store_true", help="status: saturate both directions with bulk")
+    parser.add_argument("--poll-ms", type=int, default=200)
+    parser.add_argument("--control-ms", type=int, default=500)
+    parser.add_argument("--size", type=int, default=128 * 1024, help="ota/logdl: bytes")
+    parser.add_argument("--ota-baud", type=int, default=921600)
+    parser.add_argument("--ack-poll-ms", type=int, default=5)
+    parser.add_argument("--window", type=int, default=OTA_WINDOW_MAX, help="ota: chunks in flight, 0 = stop-and-wait")
+    parser.add_argument("--no-chunk-crc", action="store_true", help="ota: chunks without their CRC32 (older sender)")
+    parser.add_argument("--app", action="store_true", help="ota/otabench: background update in the app, not the bootloader")
+    parser.add_argument("--image", help="ota/otabench: image file instead of --size random bytes")
+    parser.add_argument("--efz", action="store_true", help="ota/otabench: send the image as an EFZ1 container")
+    parser.add_argument("--base", help="ota/otabench: send an EFD1 patch against this image, the one running")
+    parser.add_argument("--erase-128k-ms", type=int, default=1000, help="128K sector erase (16K: 1/4, 64K: 1/2)")
+    parser.add_argument("--program-word-us", type=int, default=16)
+    parser.add_argument("--sd-read-us", type=int, default=400, help="logdl: f_read call overhead")
+    parser.add_argument("--consumer-kbps", type=int, default=0,
+                        help="logdl: HTTP client read rate, 0 = unlimited")
+    parser.add_argument("--sd-dirent-us", type=int, default=30, help="loglist: f_readdir per entry")
+    parser.add_argument("--files", type=int, default=1000, help="loglist: log files on the card")
+    parser.add_argument("--sd-sector-us", type=int, default=40, help="logdl: per 512-byte sector read")
+    parser.add_argument("--pings", type=int, default=200)
+    parser.add_argument("--pad", type=int, default=240)
+    parser.add_argument("--frames", type=int, default=20000, help="framing: frames per run")
+    parser.add_argument("--frame-max", type=int, default=200, help="framing: max random payload length")
+    args = parser.parse_args()
+    args.ber_at = parse_ber_at(args.ber_at)
+
+    lib = build_lib()
+    scenarios = {"status": scenario_status, "ota": scenario_ota, "otabench": scenario_otabench,
+                 "logdl": scenario_logdl, "loglist": scenario_loglist, "nego": scenario_nego, "framing": scenario_framing,
+                 "loglevel": scenario_loglevel, "rxring": scenario_rxring}
+    for name in (scenarios if args.scenario == "all" else [args.scenario]):
+        scenarios[name](lib, args)
+        print()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,45 @@
+/*
+ * Host shim for link_sim.py.
+ *
+ * Exposes the struct sizes and the few fields the simulator needs from the
+ * shared EcoFlowComm link layer and OtaCore, so the real C code can be
+ * driven through ctypes without mirroring every struct layout in Python.
+ */
+#include <stddef.h>
+#include "ecoflow_protocol.h"
+#include "link_frame.h"
+#include "link_txq.h"
+#include "link_baud.h"
+#include "ota_window.h"
+#include "ota_rx.h"
+#include "log_stream.h"
+#include "log_levels.h"
+#include "log_batch.h"
+#include "log_record.h"
+
+size_t sim_sizeof_parser(void) { return sizeof(LinkFrameParser); }
+size_t sim_sizeof_txq(void) { return sizeof(LinkTxQueue); }
+size_t sim_sizeof_baud(void) { return sizeof(LinkBaudCtx); }
+size_t sim_sizeof_device_status(void) { return sizeof(DeviceStatus); }
+size_t sim_sizeof_ota_wtx(void) { return sizeof(OtaWindowTx); }
+size_t sim_sizeof_ota_rx(void) { return sizeof(OtaRx); }
+size_t sim_sizeof_log_stream(void) { return sizeof(LogStream); }
+size_t sim_sizeof_log_levels(void) { return sizeof(LogLevels); }
+size_t sim_sizeof_log_batch(void) { return sizeof(LogBatch); }
+
+const uint8_t *sim_parser_frame(const LinkFrameParser *p) { return p->buf; }
+uint16_t sim_parser_frame_len(const LinkFrameParser *p) { return p->frame_len; }
+
+int sim_baud_state(const LinkBaudCtx *ctx) { return (int)ctx->state; }
+int sim_baud_ceiling(const LinkBaudCtx *ctx) { return ctx->ceiling; }
+
+uint32_t sim_wtx_retransmits(const OtaWindowTx *w) { return w->retransmits; }
+
+bool sim_rx_started(const OtaRx *rx) { return rx->started; }
+
+uint32_t sim_log_stream_resends(const LogStream *s) { return s->resends; }
+uint32_t sim_log_stream_credits_sent(const LogStream *s) { return s->credits_sent; }
+uint32_t sim_log_stream_stalls(const LogStream *s) { return s->stalls; }
+uint32_t sim_log_stream_granted(const LogStream *s) { return s->granted; }
+
+const LogBatchStats *sim_log_batch_stats(const LogBatch *b) { return &b->stats; }
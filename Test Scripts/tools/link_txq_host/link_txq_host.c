@@ -0,0 +1,181 @@
+/*
+ * Multithreaded driver of the link TX queue (EcoFlowComm/link_txq.c) for
+ * verify_link_txq.py.
+ *
+ * Producer threads push frames whose bytes follow from the producer and its
+ * frame number, so the consumer can tell a torn or mixed up frame from a
+ * whole one. One consumer thread pops, as the UART writer task does. Every
+ * thread gives up the CPU after each frame, so producers and the consumer
+ * take turns and the rings fill and overflow without starving the consumer.
+ *
+ * link_txq.c is included rather than linked so its copies can be cut in
+ * two: with host_yield_every set, every so many a thread gives up the CPU
+ * halfway through one, so producers are caught mid-cell and the consumer
+ * mid-copy even on a single core.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int host_yield_every;
+static __thread unsigned host_copies;
+
+static void *host_memcpy(void *dst, const void *src, size_t n) {
+    if (host_yield_every && n > 1 && ++host_copies % (unsigned)host_yield_every == 0) {
+        memcpy(dst, src, n / 2);
+        sched_yield();
+        memcpy((char *)dst + n / 2, (const char *)src + n / 2, n - n / 2);
+        return dst;
+    }
+    return memcpy(dst, src, n);
+}
+
+#define memcpy host_memcpy
+#include "link_txq.c"
+#undef memcpy
+
+#define HOST_PRODUCERS_MAX 16
+
+typedef struct {
+    uint64_t pushed;
+    uint64_t accepted;   // Pushes that returned true
+    uint64_t rejected;   // Stats, all classes, as the rest below
+    uint64_t received;   // Frames the consumer popped
+    uint64_t torn;       // Frames that are not what their producer pushed
+    uint64_t disorder;   // A producer's frames going backwards in one class
+    uint64_t duplicate;  // A frame popped twice
+    uint64_t enqueued;   // Stats, all classes
+    uint64_t dropped;
+    uint64_t sent;
+} HostTxq;
+
+typedef struct {
+    LinkTxQueue *q;
+    int id;
+    int count;
+    int mixed;           // Spread over the three classes, else bulk only
+    uint64_t accepted;
+} ProducerArg;
+
+typedef struct {
+    LinkTxQueue *q;
+    int producers;
+    HostTxq res;
+} ConsumerArg;
+
+static int host_producing;   // Set while producers run
+
+static uint32_t mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    return x ^ (x >> 16);
+}
+
+// [Id:1][N:4][Prio:1] and filler, 8 bytes to a full frame
+static int make_frame(int id, uint32_t n, int prio, uint8_t *out) {
+    uint32_t r = mix((uint32_t)(id << 24) ^ n);
+    int len = 8 + (int)(r % (LINK_FRAME_MAX - 7));
+    out[0] = (uint8_t)id;
+    memcpy(&out[1], &n, 4);
+    out[5] = (uint8_t)prio;
+    for (int k = 6; k < len; k++) out[k] = (uint8_t)(r + (uint32_t)k * 31);
+    return len;
+}
+
+static int frame_prio(int mixed, int id, uint32_t n) {
+    return mixed ? (int)((uint32_t)id + n) % LINK_PRIO_COUNT : LINK_PRIO_BULK;
+}
+
+static void *producer_main(void *p) {
+    ProducerArg *a = (ProducerArg *)p;
+    uint8_t frame[LINK_FRAME_MAX];
+    for (int n = 0; n < a->count; n++) {
+        int prio = frame_prio(a->mixed, a->id, (uint32_t)n);
+        int len = make_frame(a->id, (uint32_t)n, prio, frame);
+        if (link_txq_push(a->q, (LinkPriority)prio, frame, (uint16_t)len, (uint32_t)n)) a->accepted++;
+        else link_txq_give_up(a->q, (LinkPriority)prio);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *consumer_main(void *p) {
+    ConsumerArg *c = (ConsumerArg *)p;
+    uint8_t frame[LINK_FRAME_MAX], want[LINK_FRAME_MAX];
+    int64_t last[LINK_PRIO_COUNT][HOST_PRODUCERS_MAX];
+    for (int i = 0; i < LINK_PRIO_COUNT; i++)
+        for (int k = 0; k < HOST_PRODUCERS_MAX; k++) last[i][k] = -1;
+
+    for (;;) {
+        int producing = __atomic_load_n(&host_producing, __ATOMIC_ACQUIRE);
+        int len = link_txq_pop(c->q, frame, 0);
+        if (len <= 0) {
+            if (!producing) break;
+            sched_yield();
+            continue;
+        }
+        c->res.received++;
+        uint32_t n;
+        memcpy(&n, &frame[1], 4);
+        int id = frame[0], prio = frame[5];
+        if (len < 8 || id >= c->producers || prio >= LINK_PRIO_COUNT ||
+            make_frame(id, n, prio, want) != len || memcmp(frame, want, (size_t)len) != 0) {
+            c->res.torn++;
+        } else if ((int64_t)n == last[prio][id]) {
+            c->res.duplicate++;
+        } else if ((int64_t)n < last[prio][id]) {
+            c->res.disorder++;
+        } else {
+            last[prio][id] = n;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+size_t host_sizeof_txq(void) { return sizeof(LinkTxQueue); }
+
+int host_stress(int producers, int per_producer, int mixed, int policy, int yield_every, HostTxq *res) {
+    if (producers < 1 || producers > HOST_PRODUCERS_MAX) return -1;
+    LinkTxQueue *q = malloc(sizeof(LinkTxQueue));
+    if (!q) return -1;
+    link_txq_init(q);
+    for (int p = 0; p < LINK_PRIO_COUNT; p++) link_txq_set_policy(q, (LinkPriority)p, (LinkOverflowPolicy)policy);
+
+    pthread_t pt[HOST_PRODUCERS_MAX], ct;
+    ProducerArg pa[HOST_PRODUCERS_MAX];
+    ConsumerArg ca = {q, producers, {0}};
+    memset(res, 0, sizeof(*res));
+    host_yield_every = yield_every;
+    __atomic_store_n(&host_producing, 1, __ATOMIC_RELEASE);
+
+    pthread_create(&ct, NULL, consumer_main, &ca);
+    for (int i = 0; i < producers; i++) {
+        pa[i] = (ProducerArg){q, i, per_producer, mixed, 0};
+        pthread_create(&pt[i], NULL, producer_main, &pa[i]);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(pt[i], NULL);
+        res->accepted += pa[i].accepted;
+    }
+    __atomic_store_n(&host_producing, 0, __ATOMIC_RELEASE);
+    pthread_join(ct, NULL);
+    host_yield_every = 0;
+
+    *res = (HostTxq){(uint64_t)producers * (uint64_t)per_producer, res->accepted, 0, ca.res.received,
+                     ca.res.torn, ca.res.disorder, ca.res.duplicate, 0, 0, 0};
+    for (int p = 0; p < LINK_PRIO_COUNT; p++) {
+        LinkTxStats s;
+        link_txq_get_stats(q, (LinkPriority)p, &s);
+        res->enqueued += s.enqueued;
+        res->dropped += s.dropped;
+        res->rejected += s.rejected;
+        res->sent += s.sent;
+    }
+    free(q);
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * Multithreaded driver of the ESP32's log arena (EcoFlowComm/log_arena.c)
+ * for verify_log_arena.py.
+ *
+ * Writer threads log records whose tag, level and message follow from the
+ * writer and its record number, so a reader can rebuild what it should have
+ * got and tell a torn or mixed up record from a whole one. Reader threads
+ * poll the arena the way the web log does, in batches, while the writers
+ * run. With `locked` set every write goes through one mutex, the way
+ * LogBuffer appended before, for comparison.
+ *
+ * log_arena.c is included rather than linked so its copies can be cut in
+ * two: with host_yield_every set, every so many a thread gives up the CPU
+ * halfway through one, so writers are caught mid-record and readers
+ * mid-copy even on a single core. host_stall() stops one writer halfway
+ * through a copy until the others have lapped the arena.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int host_yield_every;
+static __thread unsigned host_copies;
+static __thread int host_stall_copy;    // Copy of this thread to stop halfway through, 0 none
+static int host_stalled;                // Set by the stopped writer, cleared to let it go
+
+static void *host_memcpy(void *dst, const void *src, size_t n) {
+    if (host_stall_copy && --host_stall_copy == 0) {
+        memcpy(dst, src, n / 2);
+        __atomic_store_n(&host_stalled, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&host_stalled, __ATOMIC_ACQUIRE)) sched_yield();
+        memcpy((char *)dst + n / 2, (const char *)src + n / 2, n - n / 2);
+        return dst;
+    }
+    if (host_yield_every && n > 1 && ++host_copies % (unsigned)host_yield_every == 0) {
+        memcpy(dst, src, n / 2);
+        sched_yield();
+        memcpy((char *)dst + n / 2, (const char *)src + n / 2, n - n / 2);
+        return dst;
+    }
+    return memcpy(dst, src, n);
+}
+
+#define memcpy host_memcpy
+#include "log_arena.c"
+#undef memcpy
+
+#define HOST_WRITERS_MAX 16
+#define HOST_READ_BATCH  60
+
+typedef struct {
+    uint64_t written;
+    uint64_t read;       // Records copied out, all readers
+    uint64_t torn;       // Records that are not what their writer wrote
+    uint64_t disorder;   // Seq or a writer's records going backwards
+    uint64_t missed;     // Seqs a reader stepped over
+    uint64_t write_ns;   // Wall time until the last writer finished
+} HostStress;
+
+typedef struct {
+    LogArena *arena;
+    int id;
+    int count;
+    int locked;
+} WriterArg;
+
+typedef struct {
+    LogArena *arena;
+    int writers;
+    HostStress res;
+} ReaderArg;
+
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+static int host_writing;   // Set while writers run
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t mix(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    return x ^ (x >> 16);
+}
+
+void host_make_tag(int id, int n, char *out) {
+    int len = 3 + (int)(mix((uint32_t)(id * 7919 + n)) % (LOG_ARENA_TAG_MAX - 2));
+    int k = snprintf(out, LOG_ARENA_TAG_MAX + 1, "W%d_", id);
+    for (; k < len; k++) out[k] = (char)('a' + (id + k) % 26);
+    out[len] = 0;
+}
+
+// "<id> <n> " and filler up to a length from 0 to past LOG_ARENA_MSG_MAX
+void host_make_msg(int id, int n, char *out, int size) {
+    uint32_t r = mix((uint32_t)(id << 20) ^ (uint32_t)n);
+    int len = 10 + (int)(r % (LOG_ARENA_MSG_MAX + 20));
+    if (len >= size) len = size - 1;
+    int k = snprintf(out, (size_t)size, "%d %d ", id, n);
+    for (; k < len; k++) out[k] = (char)('!' + (r + (uint32_t)k * 31) % 90);
+    out[len] = 0;
+}
+
+static uint8_t make_level(int id, int n) {
+    return (uint8_t)((id + n) % 6);
+}
+
+static void *writer_main(void *p) {
+    WriterArg *w = (WriterArg *)p;
+    char tag[LOG_ARENA_TAG_MAX + 1], msg[256];
+    for (int n = 0; n < w->count; n++) {
+        host_make_tag(w->id, n, tag);
+        host_make_msg(w->id, n, msg, sizeof(msg));
+        if (w->locked) pthread_mutex_lock(&host_lock);
+        log_arena_write(w->arena, (uint32_t)n, make_level(w->id, n), tag, msg);
+        if (w->locked) pthread_mutex_unlock(&host_lock);
+    }
+    return NULL;
+}
+
+// Whether `r` is exactly what its writer logged
+static int rec_whole(const LogArenaRec *r, int writers, int *id, int *n) {
+    if (sscanf(r->msg, "%d %d ", id, n) != 2 || *id < 0 || *id >= writers || *n < 0) return 0;
+    char tag[LOG_ARENA_TAG_MAX + 1], msg[256];
+    host_make_tag(*id, *n, tag);
+    host_make_msg(*id, *n, msg, sizeof(msg));
+    if (strlen(msg) > LOG_ARENA_MSG_MAX) msg[LOG_ARENA_MSG_MAX] = 0;
+    return strcmp(r->tag, tag) == 0 && strcmp(r->msg, msg) == 0 &&
+           r->level == make_level(*id, *n) && r->ms == (uint32_t)*n;
+}
+
+static void *reader_main(void *p) {
+    ReaderArg *rd = (ReaderArg *)p;
+    LogArenaRec batch[HOST_READ_BATCH];
+    int last_n[HOST_WRITERS_MAX];
+    uint32_t from = 0, expect = 0;
+    for (int i = 0; i < HOST_WRITERS_MAX; i++) last_n[i] = -1;
+
+    for (;;) {
+        int writing = __atomic_load_n(&host_writing, __ATOMIC_ACQUIRE);
+        int got = log_arena_read(rd->arena, &from, batch, HOST_READ_BATCH);
+        for (int i = 0; i < got; i++) {
+            const LogArenaRec *r = &batch[i];
+            int id, n;
+            rd->res.read++;
+            if ((int32_t)(r->seq - expect) < 0) rd->res.disorder++;
+            else rd->res.missed += r->seq - expect;
+            expect = r->seq + 1;
+            if (!rec_whole(r, rd->writers, &id, &n)) {
+                rd->res.torn++;
+                continue;
+            }
+            if (n <= last_n[id]) rd->res.disorder++;
+            last_n[id] = n;
+        }
+        if (!writing && got == 0) break;
+    }
+    return NULL;
+}
+
+int host_stress(int writers, int per_writer, int readers, int locked, int yield_every, HostStress *res) {
+    if (writers < 1 || writers > HOST_WRITERS_MAX || readers < 0 || readers > 4) return -1;
+    LogArena *arena = malloc(sizeof(LogArena));
+    if (!arena) return -1;
+    log_arena_init(arena);
+
+    pthread_t wt[HOST_WRITERS_MAX], rt[4];
+    WriterArg wa[HOST_WRITERS_MAX];
+    ReaderArg ra[4];
+    memset(res, 0, sizeof(*res));
+    host_yield_every = yield_every;
+    __atomic_store_n(&host_writing, 1, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < readers; i++) {
+        ra[i].arena = arena;
+        ra[i].writers = writers;
+        memset(&ra[i].res, 0, sizeof(ra[i].res));
+        pthread_create(&rt[i], NULL, reader_main, &ra[i]);
+    }
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < writers; i++) {
+        wa[i] = (WriterArg){arena, i, per_writer, locked};
+        pthread_create(&wt[i], NULL, writer_main, &wa[i]);
+    }
+    for (int i = 0; i < writers; i++) pthread_join(wt[i], NULL);
+    res->write_ns = now_ns() - t0;
+    __atomic_store_n(&host_writing, 0, __ATOMIC_RELEASE);
+    host_yield_every = 0;
+
+    for (int i = 0; i < readers; i++) {
+        pthread_join(rt[i], NULL);
+        res->read += ra[i].res.read;
+        res->torn += ra[i].res.torn;
+        res->disorder += ra[i].res.disorder;
+        res->missed += ra[i].res.missed;
+    }
+    res->written = arena->next_seq;
+
+    // What is left must read back whole and complete, newest last
+    LogArenaRec batch[HOST_READ_BATCH];
+    uint32_t from = 0;
+    int got;
+    while ((got = log_arena_read(arena, &from, batch, HOST_READ_BATCH)) > 0) {
+        for (int i = 0; i < got; i++) {
+            int id, n;
+            if (!rec_whole(&batch[i], writers, &id, &n)) res->torn++;
+        }
+    }
+    if (from != arena->next_seq) res->disorder++;
+    free(arena);
+    return 0;
+}
+
+typedef struct {
+    LogArena *arena;
+    int copy;
+} StallArg;
+
+static void *stalled_main(void *p) {
+    StallArg *st = (StallArg *)p;
+    char tag[LOG_ARENA_TAG_MAX + 1], msg[256];
+    host_make_tag(1, 0, tag);
+    host_make_msg(1, 0, msg, sizeof(msg));
+    host_stall_copy = st->copy;
+    log_arena_write(st->arena, 0, make_level(1, 0), tag, msg);
+    host_stall_copy = 0;
+    return NULL;
+}
+
+// Writer 1 stops halfway through copy `copy` of its record (1: the tag, 2:
+// the message) while writer 0 logs `records` records, then finishes. What
+// the arena holds afterwards is read back: res counts written, read, torn
+// (writer 1's record among them: it must never be published), and as
+// missed the records that could be read before writer 1 resumed but not
+// after.
+int host_stall(int records, int copy, HostStress *res) {
+    LogArena *arena = malloc(sizeof(LogArena));
+    if (!arena) return -1;
+    log_arena_init(arena);
+    memset(res, 0, sizeof(*res));
+    char tag[LOG_ARENA_TAG_MAX + 1], msg[256];
+    int n = 0;
+    for (; n < 20; n++) {
+        host_make_tag(0, n, tag);
+        host_make_msg(0, n, msg, sizeof(msg));
+        log_arena_write(arena, (uint32_t)n, make_level(0, n), tag, msg);
+    }
+
+    pthread_t t;
+    StallArg st = {arena, copy};
+    __atomic_store_n(&host_stalled, 0, __ATOMIC_RELEASE);
+    pthread_create(&t, NULL, stalled_main, &st);
+    while (!__atomic_load_n(&host_stalled, __ATOMIC_ACQUIRE)) sched_yield();
+    for (; n < 20 + records; n++) {
+        host_make_tag(0, n, tag);
+        host_make_msg(0, n, msg, sizeof(msg));
+        log_arena_write(arena, (uint32_t)n, make_level(0, n), tag, msg);
+    }
+    // Readers before the writer resumes
+    LogArenaRec batch[HOST_READ_BATCH];
+    uint32_t from = 0;
+    int got;
+    while ((got = log_arena_read(arena, &from, batch, HOST_READ_BATCH)) > 0) {}
+    uint32_t before = log_arena_count(arena);
+    __atomic_store_n(&host_stalled, 0, __ATOMIC_RELEASE);
+    pthread_join(t, NULL);
+
+    res->written = arena->next_seq;
+    from = 0;
+    while ((got = log_arena_read(arena, &from, batch, HOST_READ_BATCH)) > 0) {
+        for (int i = 0; i < got; i++) {
+            int id, k;
+            res->read++;
+            if (!rec_whole(&batch[i], 2, &id, &k) || id != 0) res->torn++;
+        }
+    }
+    res->missed = before - res->read;
+    free(arena);
+    return 0;
+}
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+# Renders the STM32's binary SD logs (EcoflowSTM32F4 current.log, log_N.log)
+# back to the text lines the firmware used to write:
+#
+#   [Tick] [Tag] Message                      text record (FmtId 0)
+#   [Tick] [File.cpp] function() Message      ESP32 record
+#
+# File layout (lib/EcoFlowComm/log_record.h): the magic "EFL1", then records
+#
+#   [Sync:1 0xEF][Len:2][Tick:4][Level:1][FmtId:4][Payload: Len - 9]
+#
+# An ESP32 record carries only the arguments of its LOG_STM_x call, or of its
+# ESP_LOGx call in a build with LOG_DEFERRED. Its format string is found by
+# FmtId, the FNV-1a hash of the call's file name, line and format string, in
+# a table built by scanning the ESP32 sources; the ESP32 build writes one to
+# .pio/build/<env>/log_formats.json (log_formats.py).
+# A table must come from the sources the logging firmware was built from:
+# an edit that moves a call to another line changes its FmtId.
+#
+# Files without the magic, log_N.txt from older firmware, pass through as is.
+#
+# Usage:
+#   ./log_decode.py current.log                      (scans ../../EcoflowESP32/src)
+#   ./log_decode.py log_3.log --formats log_formats.json -o log_3.txt
+#   ./log_decode.py --src EcoflowESP32/src --write-table log_formats.json
+
+MAGIC = b"EFL1"
+SYNC = 0xEF
+HEADER = struct.Struct("<BHIBI")  # Sync, Len, Tick, Level, FmtId
+LEN_MIN = HEADER.size - 3
+
+ARG_INT = 0x01
+ARG_FLOAT = 0x02
+ARG_STR = 0x03
+
+FNV_BASIS = 2166136261
+FNV_PRIME = 16777619
+
+DEFAULT_SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "..", "..", "EcoflowESP32", "src")
+
+SITE_RE = re.compile(r'(?:LOG_STM_|ESP_LOG)[EWIDV]\s*\(\s*[^,()]+,\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL_RE = re.compile(r'"((?:[^"\\]|\\.)*)"')
+FUNC_RE = re.compile(r'^[A-Za-z_][^;=]*?([A-Za-z_]\w*)\s*\([^;]*$')
+CONV_RE = re.compile(r'%([-+ #0]*)(\d*|\*)(\.\d+)?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGcsp%])')
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "0": "\0", "\\": "\\", '"': '"', "'": "'"}
+
+
+def fnv1a(data, h=FNV_BASIS):
+    for b in data:
+        h = ((h ^ b) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def fmt_id(file_name, line, fmt):
+    """Same as log_fmt_id() in log_record.c and log_site_id() in LogRecord.h."""
+    base = re.split(r"[/\\]", file_name)[-1]
+    h = fnv1a(struct.pack("<I", line), fnv1a(base.encode()))
+    return fnv1a(fmt.encode(), h)
+
+
+def c_string(literals):
+    """The bytes a sequence of adjacent C string literals compiles to."""
+    out = []
+    for lit in LITERAL_RE.findall(literals):
+        i = 0
+        while i < len(lit):
+            c = lit[i]
+            if c == "\\" and i + 1 < len(lit):
+                e = lit[i + 1]
+                if e == "x":
+                    m = re.match(r"[0-9a-fA-F]+", lit[i + 2:])
+                    out.append(chr(int(m.group(0), 16)))
+                    i += 2 + len(m.group(0))
+                    continue
+                out.append(ESCAPES.get(e, e))
+                i += 2
+                continue
+            out.append(c)
+            i += 1
+    return "".join(out)
+
+
+def scan_formats(src_dirs):
+    """{FmtId: {"file", "func", "line", "fmt"}} for every LOG_STM_x and ESP_LOGx call site."""
+    table = {}
+    for src in src_dirs:
+        for root, _, files in os.walk(src):
+            for name in sorted(files):
+                if not name.endswith((".c", ".cpp", ".h", ".hpp")):
+                    continue
+                with open(os.path.join(root, name), encoding="utf-8", errors="replace") as f:
+                    text = f.read()
+                scan_file(name, text, table)
+    return table
+
+
+def scan_file(name, text, table):
+    # Enclosing function: the last definition opened at column 0 before the call
+    starts = []
+    func = ""
+    offset = 0
+    for line in text.splitlines(True):
+        m = FUNC_RE.match(line)
+        if m and not line.startswith(("#", "//")):
+            func = m.group(1)
+        starts.append((offset, func))
+        offset += len(line)
+
+    for m in SITE_RE.finditer(text):
+        fmt = c_string(m.group(1))
+        first = text.count("\n", 0, m.start()) + 1
+        last = first + text.count("\n", m.start(), call_end(text, m.end()))
+        site = {"file": name, "func": starts[first - 1][1], "line": first, "fmt": fmt}
+        # __LINE__ of a call spread over lines is compiler dependent; take any
+        for line_no in range(first, last + 1):
+            table[fmt_id(name, line_no, fmt)] = site
+    return table
+
+
+def call_end(text, pos):
+    """Position of the parenthesis closing the call that `pos` is in."""
+    depth = 1
+    in_str = False
+    while pos < len(text) and depth:
+        c = text[pos]
+        if in_str:
+            if c == "\\":
+                pos += 1
+            elif c == '"':
+                in_str = False
+        elif c == '"':
+            in_str = True
+        elif c == "(":
+            depth += 1
+        elif c == ")":
+            depth -= 1
+        pos += 1
+    return pos
+
+
+def write_table(table, path):
+    out = {"%08x" % k: v for k, v in sorted(table.items())}
+    with open(path, "w") as f:
+        json.dump({"version": 1, "formats": out}, f, indent=1, sort_keys=True)
+
+
+def load_table(path):
+    with open(path) as f:
+        data = json.load(f)
+    return {int(k, 16): v for k, v in data["formats"].items()}
+
+
+def zigzag(b, pos):
+    shift = 0
+    v = 0
+    while True:
+        c = b[pos]
+        pos += 1
+        v |= (c & 0x7F) << shift
+        shift += 7
+        if not c & 0x80:
+            break
+    return (v >> 1) ^ -(v & 1), pos
+
+
+def unpack_args(payload):
+    args = []
+    pos = 0
+    try:
+        while pos < len(payload):
+            t = payload[pos]
+            pos += 1
+            if t == ARG_INT:
+                v, pos = zigzag(payload, pos)
+            elif t == ARG_FLOAT:
+                v = struct.unpack_from("<f", payload, pos)[0]
+                pos += 4
+            elif t == ARG_STR:
+                n = payload[pos]
+                v = payload[pos + 1:pos + 1 + n].decode("utf-8", "replace")
+                pos += 1 + n
+            else:
+                break
+            args.append(v)
+    except (IndexError, struct.error):
+        pass
+    return args
+
+
+def render(fmt, args):
+    """printf for the conversions the firmware uses; a missing argument is '?'."""
+    it = iter(args)
+
+    def conv(m):
+        flags, width, prec, _, kind = m.groups()
+        if kind == "%":
+            return "%"
+        if width == "*":
+            width = str(next(it, ""))
+        v = next(it, None)
+        if v is None:
+            return "?"
+        spec = "%" + flags + width + (prec or "")
+        if kind in "diouxXc":
+            if isinstance(v, str):
+                return v
+            v = int(v)
+            if kind == "c":
+                return chr(v & 0xFF)
+            if kind == "u" and v < 0:
+                v &= 0xFFFFFFFF
+            return (spec + ("d" if kind in "iu" else kind)) % v
+        if kind in "eEfFgG":
+            return (spec + kind) % (float(v) if not isinstance(v, str) else float("nan"))
+        if kind == "p":
+            return "0x%x" % int(v)
+        return (spec + "s") % (v,)
+
+    return CONV_RE.sub(conv, fmt)
+
+
+def records(data):
+    """(tick, level, fmt_id, payload) for each record of a binary log."""
+    pos = len(MAGIC)
+    end = len(data)
+    while pos + HEADER.size <= end:
+        if data[pos] != SYNC:
+            pos += 1
+            continue
+        _, length, tick, level, fid = HEADER.unpack_from(data, pos)
+        nxt = pos + 3 + length
+        # Take the record if it fits and the next one starts where it ends;
+        # otherwise resync on the next sync byte
+        if length < LEN_MIN or nxt > end or (nxt < end and data[nxt] != SYNC):
+            pos += 1
+            continue
+        yield tick, level, fid, data[pos + HEADER.size:nxt]
+        pos = nxt
+
+
+def decode_record(tick, level, fid, payload, table):
+    if fid == 0:
+        n = payload[0] if payload else 0
+        tag = payload[1:1 + n].decode("utf-8", "replace")
+        msg = payload[1 + n:].decode("utf-8", "replace")
+        return "[%lu] [%s] %s" % (tick, tag, msg)
+    args = unpack_args(payload)
+    site = table.get(fid)
+    if site is None:
+        return "[%lu] [?] fmt %08x: %s" % (tick, fid, ", ".join(str(a) for a in args))
+    return "[%lu] [%s] %s() %s" % (tick, site["file"], site["func"], render(site["fmt"], args))
+
+
+def decode(data, table):
+    """Text of a log file: decoded if binary, as is otherwise."""
+    if not data.startswith(MAGIC):
+        return data.decode("utf-8", "replace")
+    lines = [decode_record(t, lv, f, p, table) for t, lv, f, p in records(data)]
+    return "".join(line + "\n" for line in lines)
+
+
+def main():
+    p = argparse.ArgumentParser(description="Decode binary STM32 SD logs.")
+    p.add_argument("files", nargs="*")
+    p.add_argument("--formats", help="format table (log_formats.json)")
+    p.add_argument("--src", action="append", help="ESP32 source dir to scan instead")
+    p.add_argument("--write-table", help="write the scanned format table here")
+    p.add_argument("-o", "--output", help="output file (default stdout)")
+    a = p.parse_args()
+
+    if a.formats:
+        table = load_table(a.formats)
+    else:
+        table = scan_formats(a.src or [DEFAULT_SRC])
+    if a.write_table:
+        write_table(table, a.write_table)
+        print("%d formats written to %s" % (len(table), a.write_table), file=sys.stderr)
+
+    out = open(a.output, "w") if a.output else sys.stdout
+    for name in a.files:
+        with open(name, "rb") as f:
+            out.write(decode(f.read(), table))
+    if a.output:
+        out.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
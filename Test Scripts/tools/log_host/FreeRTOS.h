@@ -0,0 +1,22 @@
+#ifndef LOG_HOST_FREERTOS_H
+#define LOG_HOST_FREERTOS_H
+
+// Host stand-in for the FreeRTOS headers log_manager.c and ffsystem.c use.
+// Single threaded: the test calls the log task's work directly.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef void *TaskHandle_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(x) ((TickType_t)(x)) // 1 kHz tick, as configured on the board
+
+void *pvPortMalloc(size_t size);
+void vPortFree(void *p);
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * Host build of the STM32's LogManager for verify_log_writer.py. The
+ * telemetry recorder (src/telemetry.c), linked next to it, uses the same
+ * card and clock in verify_telemetry.py.
+ *
+ * Compiles EcoflowSTM32F4/src/log_manager.c as is against the real FatFs,
+ * with a RAM disk in place of the SD card that counts every sector read and
+ * written. The log task's loop is not run; the test calls one pass of it at
+ * a time and drives the tick itself, so timing is exact and repeatable.
+ *
+ * log_manager.c is included rather than linked so a reset can be staged:
+ * host_reset() clears its state the way startup clears .bss and leaves the
+ * ring, which lives in CCM RAM on the board, as it was.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "stm32f4xx_hal.h"
+
+static int host_verbose = 0;
+
+static int host_printf(const char *fmt, ...) {
+    if (!host_verbose) return 0;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+#define printf host_printf
+#include "log_manager.c"
+#undef printf
+
+// --- Board ---
+
+char SDPath[4] = "0:/";
+FATFS SDFatFs;
+IWDG_HandleTypeDef hiwdg;
+
+static uint32_t host_now = 0;
+static uint32_t host_uart_bytes = 0;
+
+TickType_t xTaskGetTickCount(void) { return host_now; }
+BaseType_t xTaskGetSchedulerState(void) { return taskSCHEDULER_RUNNING; }
+void vTaskDelay(TickType_t ticks) { host_now += ticks; }
+uint32_t HAL_GetTick(void) { return host_now; }
+void HAL_IWDG_Refresh(IWDG_HandleTypeDef *h) { (void)h; }
+static uint8_t *host_dl = NULL;     // Download chunks land here at their offset
+static uint32_t host_dl_cap = 0;
+static uint8_t *host_frames = NULL; // Frames of one command, back to back
+static uint32_t host_frames_cap = 0;
+static uint32_t host_frames_len = 0;
+static uint8_t host_frames_cmd = 0;
+
+void UART_SendRaw(uint8_t *data, uint16_t len) {
+    host_uart_bytes += len;
+    // [Start][Cmd][Len][Offset:4][Len:2][Data...][CRC]
+    if (host_dl && len >= 10 && data[1] == CMD_LOG_DATA_CHUNK) {
+        uint32_t off;
+        uint16_t n;
+        memcpy(&off, &data[3], 4);
+        memcpy(&n, &data[7], 2);
+        if (off + n <= host_dl_cap) memcpy(host_dl + off, &data[9], n);
+    }
+    if (host_frames && len >= 2 && data[1] == host_frames_cmd && host_frames_len + len <= host_frames_cap) {
+        memcpy(host_frames + host_frames_len, data, len);
+        host_frames_len += len;
+    }
+}
+// The log task's telemetry pass; telemetry.c replaces it where it is linked
+__attribute__((weak)) void Telemetry_Service(void) {}
+
+DWORD get_fattime(void) { return ((DWORD)(2024 - 1980) << 25) | (1u << 21) | (1u << 16); }
+
+void *pvPortMalloc(size_t size) { return malloc(size); }
+void vPortFree(void *p) { free(p); }
+
+struct HostSem {
+    int count;
+    int max;
+};
+
+static SemaphoreHandle_t host_sem(int count, int max) {
+    SemaphoreHandle_t s = malloc(sizeof(*s));
+    s->count = count;
+    s->max = max;
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return host_sem(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return host_sem(0, 1); }
+void vSemaphoreDelete(SemaphoreHandle_t s) { free(s); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait) {
+    (void)wait;
+    if (!s || s->count == 0) return pdFALSE;
+    s->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    if (!s || s->count >= s->max) return pdFALSE;
+    s->count++;
+    return pdTRUE;
+}
+
+// --- RAM disk ---
+
+static uint8_t *disk = NULL;
+static uint8_t *disk_writes_per_sector = NULL;
+static uint32_t disk_sectors = 0;
+static uint32_t disk_sector_writes = 0;
+static uint32_t disk_write_calls = 0;
+static uint32_t disk_sector_reads = 0;
+static uint32_t disk_rewrites = 0;  // Sector writes to a sector already written since the last reset
+
+DSTATUS disk_initialize(BYTE pdrv) { return (pdrv == 0 && disk) ? 0 : STA_NOINIT; }
+DSTATUS disk_status(BYTE pdrv) { return (pdrv == 0 && disk) ? 0 : STA_NOINIT; }
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+    if (pdrv != 0 || sector + count > disk_sectors) return RES_PARERR;
+    memcpy(buff, disk + (size_t)sector * 512, (size_t)count * 512);
+    disk_sector_reads += count;
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+    if (pdrv != 0 || sector + count > disk_sectors) return RES_PARERR;
+    memcpy(disk + (size_t)sector * 512, buff, (size_t)count * 512);
+    disk_sector_writes += count;
+    disk_write_calls++;
+    for (UINT i = 0; i < count; i++) {
+        if (disk_writes_per_sector[sector + i]) disk_rewrites++;
+        if (disk_writes_per_sector[sector + i] < 255) disk_writes_per_sector[sector + i]++;
+    }
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    if (pdrv != 0) return RES_PARERR;
+    switch (cmd) {
+    case CTRL_SYNC: return RES_OK;
+    case GET_SECTOR_COUNT: *(LBA_t *)buff = disk_sectors; return RES_OK;
+    case GET_SECTOR_SIZE: *(WORD *)buff = 512; return RES_OK;
+    case GET_BLOCK_SIZE: *(DWORD *)buff = 1; return RES_OK;
+    }
+    return RES_PARERR;
+}
+
+// --- Test interface ---
+
+void host_set_verbose(int on) { host_verbose = on; }
+
+// Blank card of `sectors` sectors; LogManager_Init formats it
+void host_disk_init(uint32_t sectors) {
+    free(disk);
+    free(disk_writes_per_sector);
+    disk = calloc(sectors, 512);
+    disk_writes_per_sector = calloc(sectors, 1);
+    disk_sectors = sectors;
+}
+
+void host_counters_reset(void) {
+    disk_sector_writes = 0;
+    disk_write_calls = 0;
+    disk_sector_reads = 0;
+    disk_rewrites = 0;
+    memset(disk_writes_per_sector, 0, disk_sectors);
+}
+
+// [sector writes, write calls, sector reads, rewrites]
+void host_counters(uint32_t out[4]) {
+    out[0] = disk_sector_writes;
+    out[1] = disk_write_calls;
+    out[2] = disk_sector_reads;
+    out[3] = disk_rewrites;
+}
+
+void host_set_time(uint32_t ms) { host_now = ms; }
+uint32_t host_time(void) { return host_now; }
+
+// The log task's wait: true if a writer kicked it since the last pass
+int host_log_task_kicked(void) {
+    return LogKick && xSemaphoreTake(LogKick, 0) == pdTRUE;
+}
+
+// One pass of the log task's loop; true if the task rests now
+int host_log_task_step(void) { return LogManager_Service(); }
+
+uint32_t host_ring_buffered(void) { return RingReady ? LogRing.head - LogRing.tail : 0; }
+uint32_t host_ring_dropped(void) { return RingDropped; }
+int host_downloading(void) { return Downloading; }
+
+// Reset without losing power: state outside the ring is gone, the card
+// holds only what reached it. With `power`, CCM RAM is lost as well.
+void host_reset(int power) {
+    LogOpen = false;
+    TriggerSessionHeader = false;
+    LogMutex = NULL;
+    RingMutex = NULL;
+    LogKick = NULL;
+    RingReady = false;
+    RingUrgent = false;
+    RingOldest = 0;
+    RingDropped = 0;
+    RingRecovered = 0;
+    Downloading = false;
+    ListOpen = false;
+    IdxReady = false;
+    IdxLost = false;
+    Searching = false;
+    SearchIdxOpen = false;
+    memset(&LogFile, 0, sizeof(LogFile));
+    memset(&LogIndex, 0, sizeof(LogIndex));
+    memset(&SDFatFs, 0, sizeof(SDFatFs));
+    if (power) memset(&LogRing, 0, sizeof(LogRing));
+}
+
+// Reads a whole file from the card; -1 if it cannot be opened
+long host_read_file(const char *name, uint8_t *buf, uint32_t max) {
+    FIL f;
+    UINT br = 0;
+    if (f_open(&f, name, FA_READ) != FR_OK) return -1;
+    FRESULT res = f_read(&f, buf, max, &br);
+    f_close(&f);
+    return res == FR_OK ? (long)br : -1;
+}
+
+// Writes a whole file to the card, mounting it if need be; -1 on failure
+long host_write_file(const char *name, const uint8_t *buf, uint32_t len) {
+    FIL f;
+    UINT bw = 0;
+    if (f_mount(&SDFatFs, SDPath, 1) != FR_OK) return -1;
+    if (f_open(&f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return -1;
+    FRESULT res = f_write(&f, buf, len, &bw);
+    f_close(&f);
+    return res == FR_OK ? (long)bw : -1;
+}
+
+// f_stat and f_unlink on the mounted card, for setting up and checking
+int host_stat(const char *name) { FILINFO fno; return f_stat(name, &fno); }
+int host_unlink(const char *name) { return f_unlink(name); }
+
+// Raw sector read, uncounted, for checking the card's layout
+void host_disk_peek(uint32_t sector, uint8_t *buf) {
+    memcpy(buf, disk + (size_t)sector * 512, 512);
+}
+
+// Download chunks are copied to `buf` at their offset
+void host_capture_download(uint8_t *buf, uint32_t cap) {
+    host_dl = buf;
+    host_dl_cap = cap;
+}
+
+// Frames sent with command `cmd` are copied to `buf`, one after the other;
+// host_captured() tells how many bytes so far
+void host_capture_frames(uint8_t cmd, uint8_t *buf, uint32_t cap) {
+    host_frames = buf;
+    host_frames_cap = cap;
+    host_frames_len = 0;
+    host_frames_cmd = cmd;
+}
+
+uint32_t host_captured(void) { return host_frames_len; }
+
+// A file of `size` zero bytes on the mounted card, to take up space
+int host_fill(const char *name, uint32_t size) {
+    static uint8_t buf[4096];
+    FIL f;
+    UINT bw;
+    if (f_open(&f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return -1;
+    for (uint32_t off = 0; off < size; off += bw) {
+        uint32_t n = size - off < sizeof(buf) ? size - off : sizeof(buf);
+        if (f_write(&f, buf, n, &bw) != FR_OK || bw != n) break;
+    }
+    f_close(&f);
+    return 0;
+}
+
+// Free bytes on the mounted card
+uint32_t host_free(void) {
+    FATFS *fs;
+    DWORD clst;
+    if (f_getfree(SDPath, &clst, &fs) != FR_OK) return 0;
+    return clst * fs->csize * FF_MAX_SS;
+}
+
+// Writes `size` bytes of a known pattern to `name` in `piece` byte steps,
+// each followed by as much filler in another file, so the file ends up in
+// size / piece cluster runs. Returns 0 on success.
+int host_write_fragmented(const char *name, uint32_t size, uint32_t piece) {
+    static uint8_t buf[4096];
+    FIL f, g;
+    UINT bw;
+    if (f_mount(&SDFatFs, SDPath, 1) != FR_OK) return -1;
+    if (f_open(&f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return -1;
+    if (f_open(&g, "filler.tmp", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return -1;
+    for (uint32_t off = 0; off < size; ) {
+        for (uint32_t end = off + piece; off < end && off < size; ) {
+            uint32_t n = sizeof(buf);
+            if (n > end - off) n = end - off;
+            for (uint32_t i = 0; i < n; i++) buf[i] = (uint8_t)((off + i) * 7 + ((off + i) >> 11));
+            if (f_write(&f, buf, n, &bw) != FR_OK || bw != n) return -1;
+            off += n;
+        }
+        f_sync(&f);
+        for (uint32_t done = 0; done < piece; done += sizeof(buf)) {
+            if (f_write(&g, buf, sizeof(buf), &bw) != FR_OK) return -1;
+        }
+        f_sync(&g);
+    }
+    f_close(&f);
+    f_close(&g);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef LOG_HOST_SEMPHR_H
+#define LOG_HOST_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+// Counting stand-ins: a take that would block fails instead, so a lock
+// the code forgot to give shows up as a lost line rather than a hang
+typedef struct HostSem *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s);
+void vSemaphoreDelete(SemaphoreHandle_t s);
+
+#endif
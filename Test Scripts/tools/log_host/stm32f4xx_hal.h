@@ -0,0 +1,14 @@
+#ifndef LOG_HOST_HAL_H
+#define LOG_HOST_HAL_H
+
+#include <stdint.h>
+
+#define __weak __attribute__((weak))
+
+typedef struct { int unused; } IWDG_HandleTypeDef;
+typedef struct { int unused; } UART_HandleTypeDef;
+
+uint32_t HAL_GetTick(void);
+void HAL_IWDG_Refresh(IWDG_HandleTypeDef *h);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef LOG_HOST_TASK_H
+#define LOG_HOST_TASK_H
+
+#include "FreeRTOS.h"
+
+#define taskSCHEDULER_RUNNING 2
+
+TickType_t xTaskGetTickCount(void);  // The test's clock
+BaseType_t xTaskGetSchedulerState(void);
+void vTaskDelay(TickType_t ticks);   // Advances the clock
+
+#endif
@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+import argparse
+import struct
+import sys
+
+# Packs an STM32 bank image into the compressed OTA container the bootloader
+# decodes on the fly (EcoflowSTM32F4/lib/OtaCore/ota_image.h):
+#
+#   [Magic:4 "EFZ1"][ImageSize:4][ImageCRC32:4][WindowLog:1][Reserved:3]
+#   followed by one LZ4 block
+#
+# The block is plain LZ4 (greedy hash-chain matcher, offsets limited to the
+# window), so any LZ4 block decoder can check it. Upload the .efz through
+# /api/update/stm32 like a .bin; the ESP32 forwards it as is.
+#
+# With --base, the output is a patch against the image currently running
+# (the factory_firmware.bin it was flashed from):
+#
+#   [Magic:4 "EFD1"][ImageSize:4][ImageCRC32:4][WindowLog:1][Reserved:3]
+#   [BaseSize:4][BaseCRC32:4] followed by the block
+#
+# where a match may also copy from the base: offset 0, then [BaseOffset:4].
+# The bootloader reads the base from the active bank and refuses the patch
+# when the bank does not hold it.
+#
+# Usage:
+#   ./ota_pack.py firmware.bin firmware.efz [--window-log 16]
+#   ./ota_pack.py new.bin update.efd --base old.bin
+#   ./ota_pack.py --unpack firmware.efz firmware.bin [--base old.bin]
+
+MAGIC = b"EFZ1"
+MAGIC_DELTA = b"EFD1"
+HEADER = struct.Struct("<4sIIB3x")
+DELTA_HEADER = struct.Struct("<4sIIB3xII")
+
+MIN_MATCH = 4
+LAST_LITERALS = 5      # LZ4 block rules: the last 5 bytes are literals and
+MF_LIMIT = 12          # no match starts in the last 12
+CHAIN_DEPTH = 16
+BASE_REF_COST = 4      # a base match spends 4 more bytes than a local one
+
+
+def _crc_table():
+    table = []
+    for i in range(256):
+        reg = i << 24
+        for _ in range(8):
+            reg = ((reg << 1) ^ 0x04C11DB7) if reg & 0x80000000 else (reg << 1)
+        table.append(reg & 0xFFFFFFFF)
+    return table
+
+
+CRC_TABLE = _crc_table()
+
+
+def crc32(data):
+    """CRC-32/BZIP2, the same value ota_crc32() gives."""
+    reg = 0xFFFFFFFF
+    for b in data:
+        reg = ((reg << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(reg >> 24) ^ b]
+    return reg ^ 0xFFFFFFFF
+
+
+def _length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _sequence(out, literals, offset, match_len, base_offset=None):
+    ml = match_len - MIN_MATCH if match_len else 0
+    out.append((min(len(literals), 15) << 4) | min(ml, 15))
+    if len(literals) >= 15:
+        _length(out, len(literals) - 15)
+    out += literals
+    if match_len:
+        if base_offset is not None:
+            out += struct.pack("<HI", 0, base_offset)
+        else:
+            out += struct.pack("<H", offset)
+        if ml >= 15:
+            _length(out, ml - 15)
+
+
+def _match_len(data, a, b, limit, src=None):
+    """Common prefix of src[a:] (default data) and data[b:], up to limit bytes."""
+    src = data if src is None else src
+    limit = min(limit, len(src) - a)
+    n = 0
+    step = 64
+    while n < limit:
+        k = min(step, limit - n)
+        if src[a + n:a + n + k] == data[b + n:b + n + k]:
+            n += k
+            step *= 2
+        elif k == 1:
+            break
+        else:
+            step = max(1, k // 2)
+    return n
+
+
+def _index(data):
+    """Hash chains over every position of data: (head, prev)."""
+    head, prev = {}, {}
+    for pos in range(len(data) - MIN_MATCH + 1):
+        key = data[pos:pos + MIN_MATCH]
+        if key in head:
+            prev[pos] = head[key]
+        head[key] = pos
+    return head, prev
+
+
+def _base_match(data, i, limit, base, base_index, guess):
+    """Longest match for data[i:] in base: the spot right after the last
+    base match first (code that moved keeps moving together), then the chain."""
+    best_len, best_pos = 0, 0
+    if 0 <= guess < len(base):
+        best_len, best_pos = _match_len(data, guess, i, limit, base), guess
+    head, prev = base_index
+    cand = head.get(data[i:i + MIN_MATCH])
+    depth = 0
+    while cand is not None and depth < CHAIN_DEPTH:
+        length = _match_len(data, cand, i, limit, base)
+        if length > best_len:
+            best_len, best_pos = length, cand
+        cand = prev.get(cand)
+        depth += 1
+    return best_len, best_pos
+
+
+def compress_block(data, window, base=None):
+    """LZ4 block, offsets <= min(window, 65535). With a base, matches may
+    also come from it (offset 0 + base offset)."""
+    max_offset = min(window, 0xFFFF)
+    n = len(data)
+    out = bytearray()
+    head = {}
+    prev = {}
+    anchor = 0
+    i = 0
+    match_end = n - LAST_LITERALS
+    base_index = _index(base) if base is not None else None
+    base_next = 0          # base position following the last base match
+
+    def insert(pos):
+        key = data[pos:pos + MIN_MATCH]
+        if key in head:
+            prev[pos] = head[key]
+        head[key] = pos
+
+    while i + MF_LIMIT <= n:
+        key = data[i:i + MIN_MATCH]
+        cand = head.get(key)
+        best_len, best_off = 0, 0
+        depth = 0
+        while cand is not None and i - cand <= max_offset and depth < CHAIN_DEPTH:
+            length = _match_len(data, cand, i, match_end - i)
+            if length > best_len:
+                best_len, best_off = length, i - cand
+            cand = prev.get(cand)
+            depth += 1
+        base_len, base_pos = 0, 0
+        if base_index is not None:
+            base_len, base_pos = _base_match(data, i, match_end - i, base, base_index, base_next + (i - anchor))
+        use_base = base_len >= MIN_MATCH + BASE_REF_COST and base_len > best_len + BASE_REF_COST
+        if best_len < MIN_MATCH and not use_base:
+            insert(i)
+            i += 1
+            continue
+        if use_base:
+            best_len = base_len
+            _sequence(out, data[anchor:i], 0, best_len, base_pos)
+            base_next = base_pos + best_len
+        else:
+            _sequence(out, data[anchor:i], best_off, best_len)
+        # Long runs only need their tail in the dictionary
+        for pos in range(max(i, i + best_len - max_offset), i + best_len):
+            if pos + MIN_MATCH <= n:
+                insert(pos)
+        i += best_len
+        anchor = i
+    _sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress_block(block, size, base=None):
+    out = bytearray()
+    i = 0
+    while True:
+        token = block[i]
+        i += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                lit += block[i]
+                i += 1
+                if block[i - 1] != 255:
+                    break
+        out += block[i:i + lit]
+        i += lit
+        if len(out) >= size:
+            return bytes(out)
+        offset = block[i] | (block[i + 1] << 8)
+        i += 2
+        if offset == 0:
+            base_offset = struct.unpack_from("<I", block, i)[0]
+            i += 4
+        ml = token & 15
+        if ml == 15:
+            while True:
+                ml += block[i]
+                i += 1
+                if block[i - 1] != 255:
+                    break
+        ml += MIN_MATCH
+        if offset == 0:
+            out += base[base_offset:base_offset + ml]
+            continue
+        start = len(out) - offset
+        for k in range(ml):
+            out.append(out[start + k])
+
+
+def pack(image, window_log=16, base=None):
+    """EFZ1 container, or EFD1 patch against `base`."""
+    block = compress_block(image, 1 << window_log, base)
+    if base is None:
+        return HEADER.pack(MAGIC, len(image), crc32(image), window_log) + block
+    return DELTA_HEADER.pack(MAGIC_DELTA, len(image), crc32(image), window_log, len(base), crc32(base)) + block
+
+
+def unpack(container, base=None):
+    if container[:4] == MAGIC_DELTA:
+        _magic, size, crc, _window_log, base_size, base_crc = DELTA_HEADER.unpack_from(container)
+        if base is None or len(base) < base_size or crc32(base[:base_size]) != base_crc:
+            raise ValueError("patch needs the base it was made against")
+        block = container[DELTA_HEADER.size:]
+    else:
+        magic, size, crc, _window_log = HEADER.unpack_from(container)
+        if magic != MAGIC:
+            raise ValueError("not an EFZ1 container")
+        block = container[HEADER.size:]
+    image = decompress_block(block, size, base)
+    if len(image) != size or crc32(image) != crc:
+        raise ValueError("container does not decode to its image")
+    return image
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Compress an STM32 image for OTA")
+    ap.add_argument("input")
+    ap.add_argument("output")
+    ap.add_argument("--window-log", type=int, default=16,
+                    help="log2 of the match window, at most 16 (default 16)")
+    ap.add_argument("--base", help="make a patch against this image (the one the device runs)")
+    ap.add_argument("--unpack", action="store_true", help="decode a container back to the image")
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    base = None
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+    if args.unpack:
+        result = unpack(data, base)
+    else:
+        if not 8 <= args.window_log <= 16:
+            ap.error("--window-log must be 8..16")
+        result = pack(data, args.window_log, base)
+        if unpack(result, base) != data:
+            print("internal error: container does not round-trip", file=sys.stderr)
+            return 1
+        print("%s: %d -> %d bytes (%.1f%%)" % (args.output, len(data), len(result),
+                                               100.0 * len(result) / max(len(data), 1)))
+    with open(args.output, "wb") as f:
+        f.write(result)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
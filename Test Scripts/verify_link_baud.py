@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+import argparse
+import ctypes
+import os
+import sys
+
+# Host checks for the link baud negotiation (EcoFlowComm/link_baud.c) and
+# the STM32 receive ring it has to respect.
+#
+# Builds the link layer with tools/link_sim.py and runs a master and a slave
+# negotiator against each other, frames passed straight across in 1 ms
+# steps; a frame sent at one rate and received at another is lost and
+# reported as a line error:
+#
+#   cap         a slave capped at 921600 (uart_task.c) rejects 1.5M, the
+#               master settles on 921600 and never asks for more; uncapped,
+#               both climb to 2M.
+#   probe       pongs lost at 1.5M: the master drops back to 921600 and makes
+#               it its ceiling, the slave reverts when probation runs out.
+#   commit      every COMMIT lost: both sides end up back at the base rate.
+#   silence     the link cut at 921600: both fall back to the base rate
+#               within LINK_BAUD_SILENCE_US.
+#   errors      line errors at a raised rate: the master steps back to the
+#               base rate and climbs again, to below the failing rate.
+#   rx ring     through link_sim: an ESP32 log flood while the STM32 UART
+#               task stalls on SD work, with the old 2 KB ring at 2M and
+#               with the firmware's 16 KB ring and cap.
+#
+# Usage: python3 "Test Scripts/verify_link_baud.py"
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+import link_sim  # noqa: E402
+
+CMD_LINK_PING = 0x80
+CMD_LINK_PONG = 0x81
+CMD_LINK_BAUD_REQ = 0x82
+CMD_LINK_BAUD_ACK = 0x83
+CMD_LINK_BAUD_COMMIT = 0x84
+LINK_BAUD_REJECTED = 0
+LINK_BAUD_BASE = 460800
+LINK_BAUD_SILENCE_US = 3000000
+LB_IDLE = 0
+STEP_US = 1000
+
+
+class Side:
+    def __init__(self, lib, pair, name, role):
+        self.lib = lib
+        self.pair = pair
+        self.name = name
+        self.baud = LINK_BAUD_BASE
+        self.lb = ctypes.create_string_buffer(lib.sim_sizeof_baud())
+        self.sent = []
+        self._send = link_sim.SEND_FN(lambda user, frame, n: pair.post(self, ctypes.string_at(frame, n)))
+        self._set_baud = link_sim.SET_BAUD_FN(lambda user, baud, framing: self.switch(baud))
+        self.ops = link_sim.LinkBaudOps(self._send, self._set_baud, None)
+        lib.link_baud_init(self.lb, role, ctypes.byref(self.ops), pair.us())
+
+    def switch(self, baud):
+        self.baud = baud
+
+    def current(self):
+        return self.lib.link_baud_current(self.lb)
+
+    def idle(self):
+        return self.lib.sim_baud_state(self.lb) == LB_IDLE
+
+
+class Pair:
+    """Master and slave negotiators joined by a lossless wire, except where
+    drop(side, frame) says otherwise."""
+
+    def __init__(self, lib, slave_max=None, drop=None):
+        self.lib = lib
+        self.now = 1000
+        self.wire = []          # (sender, frame, baud it was sent at)
+        self.drop = drop or (lambda side, frame: False)
+        self.cut = False
+        self.master = Side(lib, self, "master", link_sim.ROLE_MASTER)
+        self.slave = Side(lib, self, "slave", link_sim.ROLE_SLAVE)
+        if slave_max:
+            lib.link_baud_set_max(self.slave.lb, slave_max)
+
+    def us(self):
+        return self.now & 0xFFFFFFFF
+
+    def post(self, side, frame):
+        side.sent.append(frame)
+        self.wire.append((side, frame, side.baud))
+
+    def run(self, us, done=lambda: False):
+        end = self.now + us
+        while self.now < end:
+            wire, self.wire = self.wire, []
+            for sender, frame, baud in wire:
+                peer = self.slave if sender is self.master else self.master
+                if self.cut or self.drop(sender, frame):
+                    continue
+                if baud != peer.baud:
+                    self.lib.link_baud_on_error(peer.lb, self.us())
+                    continue
+                self.lib.link_baud_on_frame(peer.lb, link_sim.u8buf(frame), self.us())
+            self.lib.link_baud_tick(self.master.lb, self.us())
+            self.lib.link_baud_tick(self.slave.lb, self.us())
+            self.now += STEP_US
+            if done():
+                return True
+        return False
+
+    def negotiate(self, us=10000000):
+        self.lib.link_baud_negotiate(self.master.lb, self.us())
+        return self.run(us, done=lambda: self.master.idle() and self.slave.idle())
+
+    def rates(self):
+        return self.master.current(), self.slave.current()
+
+
+def baud_of(frame):
+    return int.from_bytes(frame[3:7], "little")
+
+
+def check_cap(lib, fails):
+    print("cap")
+    pair = Pair(lib, slave_max=921600)
+    pair.negotiate()
+    fails.check(pair.rates() == (921600, 921600), "capped slave: ended at %d / %d" % pair.rates())
+    rejected = [f for f in pair.slave.sent if f[1] == CMD_LINK_BAUD_ACK and f[7] == LINK_BAUD_REJECTED]
+    fails.check([baud_of(f) for f in rejected] == [1500000], "capped slave rejected %s" % [baud_of(f) for f in rejected])
+    fails.check(lib.sim_baud_ceiling(pair.master.lb) == 1, "master ceiling %d" % lib.sim_baud_ceiling(pair.master.lb))
+    fails.check(not lib.link_baud_negotiate(pair.master.lb, pair.us()), "master asked again above the cap")
+    reqs = [baud_of(f) for f in pair.master.sent if f[1] == CMD_LINK_BAUD_REQ]
+    print("  slave max 921600: %s -> %d / %d" % (reqs, *pair.rates()))
+
+    pair = Pair(lib)
+    pair.negotiate()
+    fails.check(pair.rates() == (2000000, 2000000), "uncapped: ended at %d / %d" % pair.rates())
+    reqs = [baud_of(f) for f in pair.master.sent if f[1] == CMD_LINK_BAUD_REQ]
+    print("  uncapped:         %s -> %d / %d" % (reqs, *pair.rates()))
+
+
+def check_probe(lib, fails):
+    print("probe")
+    pair = Pair(lib, drop=lambda side, f: f[1] == CMD_LINK_PONG and side.baud == 1500000)
+    pair.negotiate()
+    fails.check(pair.master.current() == 921600, "master at %d" % pair.master.current())
+    fails.check(lib.sim_baud_ceiling(pair.master.lb) == 1, "master ceiling %d" % lib.sim_baud_ceiling(pair.master.lb))
+    pair.run(2000000)
+    fails.check(pair.rates() == (921600, 921600), "after probation: %d / %d" % pair.rates())
+    print("  pongs lost at 1.5M: %d / %d, ceiling %d" % (*pair.rates(), lib.sim_baud_ceiling(pair.master.lb)))
+
+
+def check_commit(lib, fails):
+    print("commit")
+    pair = Pair(lib, drop=lambda side, f: f[1] == CMD_LINK_BAUD_COMMIT)
+    pair.negotiate()
+    pair.run(2000000)
+    fails.check(pair.rates() == (LINK_BAUD_BASE, LINK_BAUD_BASE), "COMMIT lost: %d / %d" % pair.rates())
+    tries = sum(1 for f in pair.master.sent if f[1] == CMD_LINK_BAUD_COMMIT)
+    fails.check(tries == 3, "%d COMMITs sent" % tries)
+    print("  every COMMIT lost: %d tries, %d / %d" % (tries, *pair.rates()))
+
+
+def check_silence(lib, fails):
+    print("silence")
+    pair = Pair(lib, slave_max=921600)
+    pair.negotiate()
+    pair.cut = True
+    t0 = pair.now
+    pair.run(LINK_BAUD_SILENCE_US + 100000,
+             done=lambda: pair.rates() == (LINK_BAUD_BASE, LINK_BAUD_BASE))
+    fails.check(pair.rates() == (LINK_BAUD_BASE, LINK_BAUD_BASE), "link cut: %d / %d" % pair.rates())
+    print("  link cut at 921600: both at base after %.2fs" % ((pair.now - t0) / 1e6))
+    pair.cut = False
+    pair.run(100000)
+    fails.check(lib.link_baud_negotiate(pair.master.lb, pair.us()), "no negotiation after the fallback")
+    pair.run(10000000, done=lambda: pair.master.idle() and pair.slave.idle())
+    fails.check(pair.rates() == (921600, 921600), "link back: %d / %d" % pair.rates())
+
+
+def check_errors(lib, fails):
+    print("errors")
+    pair = Pair(lib, drop=lambda side, f: f[1] == CMD_LINK_PONG and side.baud == 2000000)
+    pair.negotiate()
+    pair.run(2000000)
+    fails.check(pair.rates() == (1500000, 1500000), "setup: %d / %d" % pair.rates())
+    for _ in range(3):
+        lib.link_baud_on_error(pair.master.lb, pair.us())
+        pair.run(10000)
+    pair.run(10000000, done=lambda: pair.master.idle() and pair.slave.idle())
+    pair.run(2000000)
+    fails.check(pair.rates() == (921600, 921600), "after errors at 1.5M: %d / %d" % pair.rates())
+    print("  3 line errors at 1.5M: %d / %d, ceiling %d" % (*pair.rates(), lib.sim_baud_ceiling(pair.master.lb)))
+
+
+def flood(lib, args, baud, rx_ring, max_baud, stall_ms, secs=3.0):
+    args.stm_max_baud = max_baud
+    link = link_sim.Link(lib, args, baud=LINK_BAUD_BASE, rx_ring=rx_ring, stall_us=stall_ms * 1000)
+    esp_app = link_sim.EspStatusApp(lib, False)
+    link.esp.app = esp_app
+    link.stm.app = link_sim.StmStatusApp(lib, 200000, 1000000, False)
+    link.run(2e6, done=lambda: link.stm.app.connected)
+    if baud != LINK_BAUD_BASE:
+        lib.link_baud_negotiate(link.esp.lb, link.esp.us())
+        link.run(link.now() + 10e6, done=lambda: not lib.link_baud_busy(link.esp.lb))
+        link.run(link.now() + 2e6)
+    esp_app.bulk = True
+    link.run(link.now() + secs * 1e6)
+    link.close()
+    return link.esp.baud, link.stm
+
+
+def check_rx_ring(lib, fails):
+    print("rx ring")
+    args = argparse.Namespace(seed=1, transport="mem", baud=LINK_BAUD_BASE, framing="cobs", ber=0.0, ber_at={},
+                              drop=0.0, rx_ring=link_sim.STM_RX_RING, stm_max_baud=link_sim.STM_RX_MAX_BAUD,
+                              stm_stall_ms=0)
+    for label, ring, max_baud, stall_ms, expect_loss in (
+            ("2K, up to 2M", 2048, 2000000, 20, True),
+            ("16K, up to 2M", link_sim.STM_RX_RING, 2000000, 200, True),
+            ("16K, up to 921600", link_sim.STM_RX_RING, link_sim.STM_RX_MAX_BAUD, 200, False)):
+        baud, stm = flood(lib, args, 2000000, ring, max_baud, stall_ms)
+        print("  %-18s %3dms stalls: settled at %7d, %d overruns, %d bytes lost" % (
+            label, stall_ms, baud, stm.rx_overruns, stm.rx_lost))
+        if expect_loss:
+            fails.check(stm.rx_overruns > 0, "%s: the ring never overflowed" % label)
+        else:
+            fails.check(baud == link_sim.STM_RX_MAX_BAUD, "%s: settled at %d" % (label, baud))
+            fails.check(stm.rx_overruns == 0, "%s: %d overruns" % (label, stm.rx_overruns))
+
+
+def main():
+    lib = link_sim.build_lib()
+    fails = host_build.Failures()
+    check_cap(lib, fails)
+    check_probe(lib, fails)
+    check_commit(lib, fails)
+    check_silence(lib, fails)
+    check_errors(lib, fails)
+    check_rx_ring(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import sys
+
+# Host checks for the link TX queue (EcoFlowComm/link_txq.c), the ring of
+# frames any task pushes to and the UART writer pops from without a lock.
+#
+# Builds the file with the pthread driver in tools/link_txq_host and drives
+# it through ctypes. Producers on many threads push numbered frames while
+# one consumer pops, with threads made to give up the CPU halfway through
+# their copies:
+#
+#   drop oldest   bulk and telemetry's policy: no frame torn, popped twice
+#                 or out of its producer's order within a class, every push
+#                 either accepted or counted as rejected, and every frame
+#                 pushed either popped or counted as dropped (evicted, or
+#                 given up by its producer after a rejection).
+#   reject        control's policy, and bulk's on the STM32: every refused
+#                 push counted, every accepted frame popped.
+#   latency       control commands among a saturating bulk transfer, in
+#                 virtual time at the base baud: strict priority against
+#                 one shared FIFO, the way both sides queued before.
+#
+# Usage: python3 "Test Scripts/verify_link_txq.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+COMM_DIR = os.path.join(REPO, "EcoflowESP32", "lib", "EcoFlowComm")
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools", "link_txq_host")
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+
+LINK_OVERFLOW_REJECT = 0
+LINK_OVERFLOW_DROP_OLDEST = 1
+LINK_PRIO_CONTROL = 0
+LINK_PRIO_BULK = 2
+LINK_FRAME_MAX = 255 + 4
+BAUD = 460800
+
+u64 = ctypes.c_uint64
+
+
+class HostTxq(ctypes.Structure):
+    _fields_ = [(name, u64) for name in
+                ("pushed", "accepted", "rejected", "received", "torn", "disorder", "duplicate",
+                 "enqueued", "dropped", "sent")]
+
+
+def build_lib():
+    u8p = ctypes.POINTER(ctypes.c_uint8)
+    u32 = ctypes.c_uint32
+    sigs = {
+        "host_stress": (ctypes.c_int, [ctypes.c_int] * 5 + [ctypes.POINTER(HostTxq)]),
+        "host_sizeof_txq": (ctypes.c_size_t, []),
+        "link_txq_init": (None, [ctypes.c_void_p]),
+        "link_txq_set_policy": (None, [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]),
+        "link_txq_set_bulk_rate": (None, [ctypes.c_void_p, u32, u32]),
+        "link_txq_push": (ctypes.c_bool, [ctypes.c_void_p, ctypes.c_int, u8p, ctypes.c_uint16, u32]),
+        "link_txq_pop": (ctypes.c_int, [ctypes.c_void_p, u8p, u32]),
+    }
+    # link_txq.c is included by the host file
+    return host_build.build_lib([os.path.join(HOST_DIR, "link_txq_host.c")], sigs,
+                                ["-pthread", "-Wall", "-Wextra", "-Werror", "-I", COMM_DIR], "link_txq_host",
+                                [os.path.join(COMM_DIR, f) for f in ("link_txq.c", "link_txq.h", "link_frame.h")])
+
+
+def stress(lib, fails, producers, per_producer, mixed, policy, yield_every):
+    res = HostTxq()
+    fails.check(lib.host_stress(producers, per_producer, mixed, policy, yield_every, res) == 0, "stress not run")
+    what = "%d producers%s" % (producers, " mixed" if mixed else " bulk")
+    fails.check(res.torn == 0, "%s: %d torn frames" % (what, res.torn))
+    fails.check(res.duplicate == 0, "%s: %d frames popped twice" % (what, res.duplicate))
+    fails.check(res.disorder == 0, "%s: %d frames out of order" % (what, res.disorder))
+    fails.check(res.accepted == res.enqueued, "%s: %d accepted, %d counted" % (what, res.accepted, res.enqueued))
+    fails.check(res.pushed == res.accepted + res.rejected, "%s: %d pushed, %d accepted + %d rejected" % (
+        what, res.pushed, res.accepted, res.rejected))
+    fails.check(res.received == res.sent, "%s: %d popped, %d counted" % (what, res.received, res.sent))
+    fails.check(res.pushed == res.received + res.dropped, "%s: %d pushed, %d popped + %d dropped" % (
+        what, res.pushed, res.received, res.dropped))
+    if producers > 1:
+        fails.check(res.dropped and res.received, "%s: ring never overflowed or never drained" % what)
+    print("  %-18s yield every %d copies: %6d pushed  %6d popped  %6d dropped" % (
+        what, yield_every, res.pushed, res.received, res.dropped))
+    return res
+
+
+def check_drop_oldest(lib, fails):
+    print("drop oldest")
+    for producers, mixed, yield_every in ((1, 0, 2), (4, 0, 3), (4, 1, 5), (8, 1, 7)):
+        stress(lib, fails, producers, 20000, mixed, LINK_OVERFLOW_DROP_OLDEST, yield_every)
+
+
+def check_reject(lib, fails):
+    print("reject")
+    for producers, mixed, yield_every in ((1, 0, 2), (4, 1, 3), (8, 1, 7)):
+        res = stress(lib, fails, producers, 20000, mixed, LINK_OVERFLOW_REJECT, yield_every)
+        fails.check(res.received == res.accepted, "reject: accepted frame lost")
+
+
+def control_latency(lib, shared, secs=5.0, control_every_us=50000):
+    """Writes frames to a simulated UART as fast as the baud allows while the
+    bulk ring is kept full. Returns the time from a control command's push
+    to its last byte on the wire, in microseconds, for every command."""
+    q = ctypes.create_string_buffer(lib.host_sizeof_txq())
+    lib.link_txq_init(q)
+    lib.link_txq_set_policy(q, LINK_PRIO_BULK, LINK_OVERFLOW_REJECT)
+    lib.link_txq_set_bulk_rate(q, BAUD // 10 * 75 // 100, 2 * LINK_FRAME_MAX)
+    bulk = (ctypes.c_uint8 * LINK_FRAME_MAX)(*([0xAA, 0x76, 255] + [0] * 256))
+    out = (ctypes.c_uint8 * LINK_FRAME_MAX)()
+    now, next_control, seq = 1.0, 1.0, 0
+    pushed, waiting, latency = {}, [], []
+    while now < secs * 1e6:
+        if now >= next_control:
+            seq += 1
+            pushed[seq] = next_control  # Issued mid-frame, not when the writer looks
+            waiting.append((ctypes.c_uint8 * 8)(0xAA, 0x30, 4, seq & 0xFF, seq >> 8, 0, 0, 0))
+            next_control += control_every_us
+        # The command's task retries until the ring takes it
+        while waiting and lib.link_txq_push(q, LINK_PRIO_BULK if shared else LINK_PRIO_CONTROL,
+                                            waiting[0], 8, int(pushed[waiting[0][3] | waiting[0][4] << 8])):
+            waiting.pop(0)
+        while lib.link_txq_push(q, LINK_PRIO_BULK, bulk, LINK_FRAME_MAX, int(now)):
+            pass
+        n = lib.link_txq_pop(q, out, int(now))
+        if n <= 0:
+            now += 100
+            continue
+        now += n * 10e6 / BAUD
+        if out[1] == 0x30:
+            latency.append(now - pushed.pop(out[3] | out[4] << 8))
+    return latency
+
+
+def check_latency(lib, fails):
+    print("latency")
+    frame_us = LINK_FRAME_MAX * 10e6 / BAUD
+    for label, shared in (("one FIFO", True), ("priority", False)):
+        lat = sorted(control_latency(lib, shared))
+        p50, p99, worst = lat[len(lat) // 2], lat[len(lat) * 99 // 100], lat[-1]
+        print("  %-9s control under bulk @%d: n=%d p50=%.2fms p99=%.2fms max=%.2fms" % (
+            label, BAUD, len(lat), p50 / 1000, p99 / 1000, worst / 1000))
+        if not shared:
+            # At most the bulk frame already on the wire, then its own bytes
+            fails.check(worst <= frame_us + 8 * 10e6 / BAUD + 100, "control waited %.2fms behind bulk" % (worst / 1000))
+
+
+def main():
+    lib = build_lib()
+    fails = host_build.Failures()
+    check_drop_oldest(lib, fails)
+    check_reject(lib, fails)
+    check_latency(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import sys
+
+# Host checks for the ESP32's in-RAM log (EcoFlowComm/log_arena.c), the
+# byte arena LogBuffer writes into from every task without a lock.
+#
+# Builds the file with the pthread driver in tools/log_arena_host and drives
+# both through ctypes.
+#
+#   records     tag, level, time and message come back as written; long tags
+#               and messages are cut, a trailing newline dropped; reads go
+#               in batches from a Seq on.
+#   overwrite   many times the arena's worth of records: what is left reads
+#               back whole, newest last, and the count agrees.
+#   pending     a record still being written holds a reader up until it is
+#               done instead of being skipped.
+#   stalled     a writer stopped mid-record until the arena laps it, then
+#               let go: its record is never published, and the newer
+#               records it wrote over are dropped, not read torn.
+#   clear       hides what was written, not what comes after.
+#   threads     writers on many threads with readers polling the way the
+#               web log does, with threads made to give up the CPU halfway
+#               through their copies: no record torn or out of order, none
+#               read twice.
+#   rate        logs/s from several threads against the same writes behind
+#               one mutex, the way LogBuffer appended before.
+#
+# Usage: python3 "Test Scripts/verify_log_arena.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+COMM_DIR = os.path.join(REPO, "EcoflowESP32", "lib", "EcoFlowComm")
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools", "log_arena_host")
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+
+LOG_ARENA_SIZE = 16384
+LOG_ARENA_SLOTS = 256
+LOG_ARENA_TAG_MAX = 23
+LOG_ARENA_MSG_MAX = 160
+
+u32 = ctypes.c_uint32
+
+
+class LogArenaSlot(ctypes.Structure):
+    _fields_ = [("seq", u32), ("pos", u32)]
+
+
+class LogArena(ctypes.Structure):
+    _fields_ = [("buf", u32 * (LOG_ARENA_SIZE // 4)), ("slot", LogArenaSlot * LOG_ARENA_SLOTS),
+                ("head", u32), ("next_seq", u32), ("floor", u32)]
+
+
+class LogArenaRec(ctypes.Structure):
+    _fields_ = [("seq", u32), ("ms", u32), ("level", ctypes.c_uint8),
+                ("tag", ctypes.c_char * (LOG_ARENA_TAG_MAX + 1)),
+                ("msg", ctypes.c_char * (LOG_ARENA_MSG_MAX + 1))]
+
+
+class HostStress(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in
+                ("written", "read", "torn", "disorder", "missed", "write_ns")]
+
+
+def build_lib():
+    ap = ctypes.POINTER(LogArena)
+    sigs = {
+        "log_arena_init": (None, [ap]),
+        "log_arena_write": (u32, [ap, u32, ctypes.c_uint8, ctypes.c_char_p, ctypes.c_char_p]),
+        "log_arena_read": (ctypes.c_int, [ap, ctypes.POINTER(u32), ctypes.POINTER(LogArenaRec), ctypes.c_int]),
+        "log_arena_count": (u32, [ap]),
+        "log_arena_clear": (None, [ap]),
+        "host_stall": (ctypes.c_int, [ctypes.c_int, ctypes.c_int, ctypes.POINTER(HostStress)]),
+        "host_stress": (ctypes.c_int, [ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+                                       ctypes.c_int, ctypes.POINTER(HostStress)]),
+    }
+    # log_arena.c is included by the host file
+    return host_build.build_lib([os.path.join(HOST_DIR, "log_arena_host.c"), os.path.join(COMM_DIR, "log_record.c")],
+                                sigs, ["-pthread", "-Wall", "-Wextra", "-Werror", "-I", COMM_DIR], "log_arena_host",
+                                [os.path.join(COMM_DIR, f) for f in ("log_arena.c", "log_arena.h", "log_record.h")])
+
+
+class Arena:
+    def __init__(self, lib):
+        self.lib = lib
+        self.a = LogArena()
+        lib.log_arena_init(self.a)
+
+    def write(self, ms, level, tag, msg):
+        return self.lib.log_arena_write(self.a, ms, level, tag.encode(), msg.encode())
+
+    def read(self, since, batch=60):
+        """Records from `since` on, as tuples, and where the next read starts."""
+        out = (LogArenaRec * batch)()
+        frm = u32(since)
+        n = self.lib.log_arena_read(self.a, ctypes.byref(frm), out, batch)
+        return [(r.seq, r.ms, r.level, r.tag.decode(), r.msg.decode()) for r in out[:n]], frm.value
+
+    def read_all(self, since=0):
+        recs = []
+        while True:
+            got, since = self.read(since)
+            if not got:
+                return recs, since
+            recs += got
+
+
+def check_records(lib, fails):
+    print("records")
+    ar = Arena(lib)
+    fails.check(ar.read(0) == ([], 0), "empty arena read something")
+    ar.write(100, 3, "WEB", "hello\n")
+    ar.write(101, 1, "NimBLEAdvertisedDeviceCallbacks", "x" * 300)
+    ar.write(102, 5, "", "")
+    recs, nxt = ar.read(0)
+    fails.check(nxt == 3, "next Seq %d, expected 3" % nxt)
+    fails.check(recs[0] == (0, 100, 3, "WEB", "hello"), "record 0 %r" % (recs[0],))
+    fails.check(recs[1] == (1, 101, 1, "NimBLEAdvertisedDeviceCallbacks"[:LOG_ARENA_TAG_MAX],
+                            "x" * LOG_ARENA_MSG_MAX), "long record not cut: %r" % (recs[1],))
+    fails.check(recs[2] == (2, 102, 5, "", ""), "empty record %r" % (recs[2],))
+    fails.check(ar.read(1)[0] == recs[1:], "read from Seq 1")
+    fails.check(ar.read(3) == ([], 3), "read past the end")
+    fails.check(ar.read(50) == ([], 50), "read from a Seq not written yet")
+
+    for i in range(3, 100):
+        ar.write(i, 2, "T", "m%d" % i)
+    got, nxt = ar.read(0, 60)
+    fails.check(len(got) == 60 and nxt == 60 and [r[0] for r in got] == list(range(60)), "first batch")
+    got, nxt = ar.read(nxt, 60)
+    fails.check(len(got) == 40 and nxt == 100 and got[-1][4] == "m99", "second batch")
+    fails.check(lib.log_arena_count(ar.a) == 100, "count %d, expected 100" % lib.log_arena_count(ar.a))
+
+
+def check_overwrite(lib, fails):
+    print("overwrite")
+    for size in (0, 40, LOG_ARENA_MSG_MAX):
+        ar = Arena(lib)
+        total = 5000
+        for i in range(total):
+            ar.write(i, i % 6, "TAG%d" % (i % 7), ("%d " % i).ljust(size if size else i % 150, "z"))
+        recs, nxt = ar.read_all(0)
+        seqs = [r[0] for r in recs]
+        whole = all(r[1] == r[0] and r[2] == r[0] % 6 and r[3] == "TAG%d" % (r[0] % 7) and
+                    r[4].split(" ")[0] == str(r[0]) for r in recs)
+        fails.check(whole, "records %d B: not whole" % size)
+        fails.check(seqs == list(range(total - len(recs), total)) and nxt == total,
+                    "records %d B: not the newest in order" % size)
+        held = sum(16 + len(r[3]) + len(r[4]) + 3 & ~3 for r in recs)
+        fails.check(held <= LOG_ARENA_SIZE and len(recs) <= LOG_ARENA_SLOTS,
+                    "records %d B: %d records of %d B held" % (size, len(recs), held))
+        fails.check(lib.log_arena_count(ar.a) == len(recs), "records %d B: count %d, read %d" % (
+            size, lib.log_arena_count(ar.a), len(recs)))
+        # A reader that fell behind picks up at what is left
+        got, _ = ar.read(10)
+        fails.check(got and got[0][0] == seqs[0], "stale Seq not moved up")
+        print("  messages of %3s B: %3d records kept, %5d of %d arena bytes" % (
+            size or "0-149", len(recs), held, LOG_ARENA_SIZE))
+
+
+def check_pending(lib, fails):
+    print("pending")
+    ar = Arena(lib)
+    for i in range(5):
+        ar.write(i, 3, "T", "m%d" % i)
+    # Record 2 as a writer that reserved it but has not committed it
+    word = ar.a.slot[2].pos % LOG_ARENA_SIZE // 4
+    commit, ar.a.buf[word] = ar.a.buf[word], ~2 & 0xFFFFFFFF
+    got, nxt = ar.read(0)
+    fails.check([r[0] for r in got] == [0, 1] and nxt == 2, "read past a pending record: %r" % (
+        [r[0] for r in got],))
+    fails.check(lib.log_arena_count(ar.a) == 5, "pending record not counted")
+    ar.a.buf[word] = commit
+    got, nxt = ar.read(nxt)
+    fails.check([r[0] for r in got] == [2, 3, 4] and nxt == 5, "pending record not read once done")
+    # Slot not yet published: the writer has its Seq but no place yet
+    ar.write(5, 3, "T", "m5")
+    ar.write(6, 3, "T", "m6")
+    seq, ar.a.slot[5].seq = ar.a.slot[5].seq, 5 - LOG_ARENA_SLOTS
+    got, nxt = ar.read(5)
+    fails.check(got == [] and nxt == 5, "read past an unpublished record")
+    ar.a.slot[5].seq = seq
+    fails.check([r[0] for r in ar.read(5)[0]] == [5, 6], "unpublished record not read once published")
+
+
+def check_stalled(lib, fails):
+    print("stalled")
+    for copy, what in ((1, "tag"), (2, "message")):
+        for records in (200, 300, 1000):
+            res = HostStress()
+            fails.check(lib.host_stall(records, copy, res) == 0, "stall not run")
+            print("  stopped in its %-7s while %4d records went by: %3d read, %d dropped, %d torn" % (
+                what, records, res.read, res.missed, res.torn))
+            fails.check(res.torn == 0, "stopped in its %s, %d records: %d torn" % (what, records, res.torn))
+            fails.check(res.read > 0 and res.missed < 8, "stopped in its %s, %d records: %d read, %d dropped" % (
+                what, records, res.read, res.missed))
+
+
+def check_clear(lib, fails):
+    print("clear")
+    ar = Arena(lib)
+    for i in range(10):
+        ar.write(i, 3, "T", "m%d" % i)
+    lib.log_arena_clear(ar.a)
+    fails.check(ar.read(0)[0] == [] and lib.log_arena_count(ar.a) == 0, "cleared records still read")
+    ar.write(10, 3, "T", "after")
+    got, nxt = ar.read(4)
+    fails.check([r[4] for r in got] == ["after"] and nxt == 11, "record after clear: %r" % (got,))
+
+
+def stress(lib, fails, writers, per_writer, readers, locked, yield_every):
+    res = HostStress()
+    fails.check(lib.host_stress(writers, per_writer, readers, locked, yield_every, res) == 0, "stress not run")
+    what = "%d writers %d readers%s" % (writers, readers, " mutex" if locked else "")
+    fails.check(res.written == writers * per_writer, "%s: %d written" % (what, res.written))
+    fails.check(res.torn == 0, "%s: %d torn records" % (what, res.torn))
+    fails.check(res.disorder == 0, "%s: %d out of order" % (what, res.disorder))
+    return res
+
+
+def check_threads(lib, fails):
+    print("threads")
+    for writers, readers, yield_every in ((1, 1, 2), (4, 1, 3), (4, 2, 5), (8, 3, 7)):
+        res = stress(lib, fails, writers, 20000, readers, 0, yield_every)
+        print("  %d writers %d readers, yield every %d copies: %6d read  %6d missed  %d torn" % (
+            writers, readers, yield_every, res.read, res.missed, res.torn))
+
+
+def check_rate(lib, fails):
+    print("rate")
+    for writers, readers in ((1, 0), (1, 1), (4, 1), (8, 1)):
+        rates = []
+        for locked in (1, 0):
+            res = stress(lib, fails, writers, 200000, readers, locked, 0)
+            rates.append(res.written / (res.write_ns / 1e9))
+        print("  %d writers %d readers: %5.2f M logs/s, behind one mutex %5.2f M" % (
+            writers, readers, rates[1] / 1e6, rates[0] / 1e6))
+
+
+def main():
+    lib = build_lib()
+    fails = host_build.Failures()
+    check_records(lib, fails)
+    check_overwrite(lib, fails)
+    check_pending(lib, fails)
+    check_stalled(lib, fails)
+    check_clear(lib, fails)
+    check_threads(lib, fails)
+    check_rate(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
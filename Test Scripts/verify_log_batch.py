@@ -0,0 +1,408 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import random
+import sys
+
+# Host checks for the ESP32's log forwarding to the STM32
+# (EcoFlowComm/log_batch.c): lines batched into CMD_ESP_LOG_BATCH frames
+# and rate limited by a token bucket.
+#
+# Builds the file and the protocol packers with gcc and drives them through
+# ctypes; batch frames are read back with the STM32's unpack functions.
+#
+#   lines       text lines and records come back in order, as the frames of
+#               their own would have carried them; a line too long for a
+#               batch is cut. Frames match the format (ecoflow_protocol.h)
+#               byte for byte: the level in the line header, each tag or
+#               FmtId once a frame. A line pointing at a source not named
+#               yet, or named by a line of the other kind, is refused.
+#   timing      a lone line waits LOG_BATCH_MS and no longer, LOG_BATCH_FULL
+#               bytes go at once, a flush sends whatever waits; every frame
+#               is as full as the next line allows.
+#   limit       no more lines through than the bucket and its rate allow;
+#               every line refused is counted in a "lines dropped" line, at
+#               most one a second. A full ring drops and counts the same.
+#   burst       10k lines in half a second, with the ESP32's update() loop
+#               taking every ms: what goes through arrives in order, within
+#               LOG_BATCH_MS, with the drops accounted for; frames and bytes,
+#               before and after COBS, against a frame per line. Once with
+#               lines of random tags and FmtIds, once with a few call sites
+#               in a loop.
+#
+# Usage: python3 "Test Scripts/verify_log_batch.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+COMM_DIR = os.path.join(REPO, "EcoflowESP32", "lib", "EcoFlowComm")
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+
+CMD_ESP_LOG_DATA = 0x73
+CMD_ESP_LOG_REC = 0x7D
+CMD_ESP_LOG_BATCH = 0x85
+MAX_PAYLOAD_LEN = 255
+LINK_FRAME_MAX = MAX_PAYLOAD_LEN + 4
+LOG_BATCH_LINE_MAX = MAX_PAYLOAD_LEN - 2
+LOG_BATCH_SOURCES = 15
+LOG_BATCH_RING = 1024
+LOG_BATCH_FULL = 192
+LOG_BATCH_MS = 100
+LOG_BATCH_RATE = 200
+LOG_BATCH_BURST = 400
+NOTE_MS = 1000
+BURST_LINES = 10000
+
+u8 = ctypes.c_uint8
+u32 = ctypes.c_uint32
+u8p = ctypes.POINTER(u8)
+
+
+class LogBatchStats(ctypes.Structure):
+    _fields_ = [(name, u32) for name in ("lines", "dropped", "frames", "bytes")]
+
+
+class LogBatchCursor(ctypes.Structure):
+    _fields_ = [("pos", ctypes.c_int), ("sources", u8), ("source", u8 * LOG_BATCH_SOURCES)]
+
+
+class LogBatch(ctypes.Structure):
+    _fields_ = [("ring", u8 * LOG_BATCH_RING)] + \
+               [(name, u32) for name in ("head", "tail", "first_ms", "rate", "burst", "tokens",
+                                         "refill_ms", "dropped", "note_ms")] + \
+               [("stats", LogBatchStats)]
+
+
+def build_lib():
+    bp = ctypes.POINTER(LogBatch)
+    sigs = {
+        "log_batch_init": (None, [bp, u32, u32, u32]),
+        "log_batch_add": (ctypes.c_bool, [bp, u8p, ctypes.c_int, u32]),
+        "log_batch_take": (ctypes.c_int, [bp, u32, ctypes.c_bool, u8p]),
+        "pack_esp_log_message": (ctypes.c_int, [u8p, u8, ctypes.c_char_p, ctypes.c_char_p]),
+        "pack_esp_log_rec_message": (ctypes.c_int, [u8p, u8, u32, ctypes.c_uint16, u8p, u8]),
+        "unpack_esp_log_batch_message": (ctypes.c_int, [u8p, u8p]),
+        "unpack_esp_log_batch_line": (ctypes.c_int, [u8p, ctypes.POINTER(LogBatchCursor), u8p, u8p, u8p]),
+        "calculate_crc8": (u8, [u8p, u8]),
+    }
+    return host_build.build_lib([os.path.join(COMM_DIR, f) for f in ("log_batch.c", "ecoflow_protocol.c", "ota_crc.c")],
+                                sigs, ["-Wall", "-Wextra", "-Werror", "-I", COMM_DIR], "log_batch",
+                                [os.path.join(COMM_DIR, f) for f in ("log_batch.h", "ecoflow_protocol.h")])
+
+
+def text_line(lib, level, tag, msg):
+    buf = (u8 * LINK_FRAME_MAX)()
+    n = lib.pack_esp_log_message(buf, level, tag.encode(), msg.encode())
+    return bytes(buf[:n])
+
+
+def rec_line(lib, level, fmt_id, args, tag_id=0x7A61):
+    buf = (u8 * LINK_FRAME_MAX)()
+    n = lib.pack_esp_log_rec_message(buf, level, fmt_id, tag_id,
+                                     (u8 * max(len(args), 1)).from_buffer_copy(args or b"\0"), len(args))
+    return bytes(buf[:n])
+
+
+def line_of(frame):
+    """What a batch carries of a line's own frame: its command and payload."""
+    return (frame[1], frame[3:3 + frame[2]])
+
+
+def encode(lines):
+    """The lines of a batch frame as ecoflow_protocol.h describes them, from
+    (cmd, payload) pairs."""
+    out, named = b"", []
+    for cmd, p in lines:
+        p = p[:LOG_BATCH_LINE_MAX]
+        rec = cmd == CMD_ESP_LOG_REC
+        src = p[1:7] if rec else p[1:2 + p[1]]
+        hdr = (0x80 if rec else 0) | (p[0] & 7) << 4
+        if (rec, src) in named:
+            hdr |= named.index((rec, src)) + 1
+            body = p[1 + len(src):]
+        else:
+            if len(named) < LOG_BATCH_SOURCES:
+                named.append((rec, src))
+            body = p[1:]
+        out += bytes((hdr, len(body))) + body
+    return out
+
+
+def cobs_len(n):
+    """A frame's bytes on the wire once COBS framed, with its delimiter."""
+    return n + n // 254 + 2
+
+
+class Batch:
+    def __init__(self, lib, rate=LOG_BATCH_RATE, burst=LOG_BATCH_BURST, now=0):
+        self.lib = lib
+        self.b = LogBatch()
+        lib.log_batch_init(self.b, rate, burst, now)
+
+    def add(self, frame, now):
+        return self.lib.log_batch_add(self.b, (u8 * len(frame)).from_buffer_copy(frame), len(frame), now)
+
+    def take(self, now, flush=False):
+        """Frames due at `now`, each as (bytes, lines)."""
+        out = []
+        buf = (u8 * LINK_FRAME_MAX)()
+        while True:
+            n = self.lib.log_batch_take(self.b, now, flush, buf)
+            if n <= 0:
+                return out
+            frame = bytes(buf[:n])
+            out.append((frame, self.lines(frame)))
+
+    def lines(self, frame):
+        buf = (u8 * LINK_FRAME_MAX).from_buffer_copy(frame.ljust(LINK_FRAME_MAX, b"\0"))
+        count = u8()
+        if self.lib.unpack_esp_log_batch_message(buf, ctypes.byref(count)) != 0:
+            return None
+        lines, cursor = [], LogBatchCursor()
+        cmd, ln, p = u8(), u8(), (u8 * MAX_PAYLOAD_LEN)()
+        while self.lib.unpack_esp_log_batch_line(buf, ctypes.byref(cursor), ctypes.byref(cmd), p, ctypes.byref(ln)) >= 0:
+            lines.append((cmd.value, bytes(p[:ln.value])))
+        return lines if len(lines) == count.value else None
+
+
+def batch_frame(lib, lines_bytes, count):
+    """A batch frame around already encoded lines."""
+    payload = bytes((count,)) + lines_bytes
+    head = bytes((0xAA, CMD_ESP_LOG_BATCH, len(payload))) + payload
+    crc = lib.calculate_crc8((u8 * len(head)).from_buffer_copy(head[1:].ljust(len(head), b"\0")), len(head) - 1)
+    return head + bytes((crc,))
+
+
+def dropped_note(line):
+    """N of a "N lines dropped" line, None for any other line."""
+    cmd, payload = line
+    if cmd != CMD_ESP_LOG_DATA or payload[1:2] != b"\x03" or payload[2:5] != b"LOG":
+        return None
+    words = payload[5:].decode().split()
+    if len(words) == 3 and words[1:] == ["lines", "dropped"] and payload[0] == 2:
+        return int(words[0])
+    return None
+
+
+def check_lines(lib, fails):
+    print("lines")
+    b = Batch(lib, rate=0)
+    sent = [text_line(lib, 3, "WEB", "hello"), rec_line(lib, 1, 0xDEADBEEF, b"\x02\x04abc"),
+            rec_line(lib, 4, 7, b""), text_line(lib, 2, "NimBLEAdvertisedDeviceCallbacks", "")]
+    for f in sent:
+        fails.check(b.add(f, 0), "line refused")
+    frames = b.take(0, flush=True)
+    fails.check(len(frames) == 1 and frames[0][1] is not None, "one valid batch frame expected")
+    fails.check(frames[0][0][1] == CMD_ESP_LOG_BATCH, "batch frame command 0x%02X" % frames[0][0][1])
+    fails.check(frames[0][1] == [line_of(f) for f in sent], "lines not carried as their own frames had them")
+    fails.check(frames[0][0][4:-1] == encode([line_of(f) for f in sent]), "frame not as the format describes")
+
+    # Repeated tags and FmtIds are named once, and come back whole
+    sent = [text_line(lib, 3, "WEB", "get /status"), rec_line(lib, 4, 0x1234, b"\x01"),
+            text_line(lib, 2, "BLE", "notify"), text_line(lib, 3, "WEB", "get /"),
+            rec_line(lib, 4, 0x1234, b"\x02"), rec_line(lib, 4, 0x1234, b""), text_line(lib, 3, "BLE", "")]
+    for f in sent:
+        b.add(f, 0)
+    got = b.take(0, flush=True)
+    fails.check(len(got) == 1 and got[0][1] == [line_of(f) for f in sent], "repeated sources not carried back")
+    fails.check(got[0][0][4:-1] == encode([line_of(f) for f in sent]), "repeated sources not named once")
+    own = sum(len(f) for f in sent)
+    print("  7 lines of 3 sources: %d B batched, %d B a frame each" % (len(got[0][0]), own))
+
+    # More sources than a frame can name: the rest are sent whole
+    sent = [rec_line(lib, 3, 0x100 + i % (LOG_BATCH_SOURCES + 5), b"a") for i in range(2 * (LOG_BATCH_SOURCES + 5))]
+    for f in sent:
+        b.add(f, 0)
+    got = [l for _, ls in b.take(0, flush=True) for l in ls]
+    fails.check(got == [line_of(f) for f in sent], "lines past LOG_BATCH_SOURCES sources not carried back")
+
+    # Sources pointed at before they are named, or by the other kind
+    enc = encode([line_of(sent[0])])
+    fails.check(b.lines(batch_frame(lib, enc, 1)) is not None, "hand-made batch refused")
+    fails.check(b.lines(batch_frame(lib, bytes((enc[0] | 1,)) + enc[1:], 1)) is None, "unnamed source accepted")
+    fails.check(b.lines(batch_frame(lib, enc + bytes((0x31, 1, 0x41)), 2)) is None, "text pointing at a record accepted")
+    fails.check(b.lines(batch_frame(lib, enc + bytes((0xB1, 0)), 2)) is not None, "record pointing at a record refused")
+    fails.check(b.lines(batch_frame(lib, bytes((0xB0, 5)) + enc[2:7], 1)) is None, "record without its source accepted")
+
+    long_line = text_line(lib, 3, "T", "y" * 300)
+    fails.check(long_line[2] == MAX_PAYLOAD_LEN, "test line not at the frame limit")
+    b.add(long_line, 0)
+    got = b.take(0, flush=True)
+    fails.check(len(got) == 1 and got[0][1] == [(CMD_ESP_LOG_DATA, line_of(long_line)[1][:LOG_BATCH_LINE_MAX])],
+                "long line not cut to LOG_BATCH_LINE_MAX")
+    fails.check(len(got[0][0]) == LINK_FRAME_MAX, "cut line does not fill the frame")
+
+    # Corrupted batches are refused whole
+    good = bytearray(frames[0][0])
+    good[6] ^= 1
+    fails.check(b.lines(bytes(good)) is None, "batch with a bad CRC accepted")
+
+
+def check_timing(lib, fails):
+    print("timing")
+    b = Batch(lib, rate=0)
+    b.add(text_line(lib, 3, "T", "alone"), 1000)
+    fails.check(b.take(1000) == [] and b.take(1000 + LOG_BATCH_MS - 1) == [], "lone line sent early")
+    fails.check(len(b.take(1000 + LOG_BATCH_MS)) == 1, "lone line not sent after LOG_BATCH_MS")
+
+    # Bytes up to LOG_BATCH_FULL wait, the line reaching it sends all
+    line = text_line(lib, 3, "T", "z" * 40)
+    per = 2 + line[2]
+    n = 0
+    while (n + 1) * per < LOG_BATCH_FULL:
+        b.add(line, 2000)
+        n += 1
+        fails.check(b.take(2000) == [], "%d bytes sent before LOG_BATCH_FULL" % (n * per))
+    b.add(line, 2000)
+    got = b.take(2000)
+    fails.check(len(got) == 1 and len(got[0][1]) == n + 1, "LOG_BATCH_FULL bytes not sent at once")
+
+    b.add(line, 3000)
+    fails.check(len(b.take(3000, flush=True)) == 1, "flush did not send")
+    fails.check(b.take(3000, flush=True) == [], "empty flush sent a frame")
+
+    rnd = random.Random(5)
+    lines = [text_line(lib, 3, "T", "q" * rnd.randrange(0, 200)) for _ in range(300)]
+    frames = []
+    for f in lines:
+        b.add(f, 4000)
+        frames += b.take(4000)
+    frames += b.take(4000, flush=True)
+    carried = [l for _, ls in frames for l in ls]
+    fails.check(carried == [line_of(f) for f in lines], "lines lost or reordered across frames")
+
+    # A backlog leaves in frames as full as the next line allows
+    lines = [f for f in lines if b.add(f, 5000)]
+    frames = b.take(5000, flush=True)
+    carried = [l for _, ls in frames for l in ls]
+    fails.check(len(frames) > 2 and carried == [line_of(f) for f in lines], "backlog lost or reordered")
+    slack = [LINK_FRAME_MAX - len(fr) for fr, _ in frames]
+    nexts = [1 + len(ls2[0][1]) for (_, ls2) in frames[1:]]
+    fails.check(all(s < n for s, n in zip(slack, nexts)), "a frame left room for the next line")
+    fails.check(all(len(fr) <= LINK_FRAME_MAX for fr, _ in frames), "frame over LINK_FRAME_MAX")
+
+
+def check_limit(lib, fails):
+    print("limit")
+    for rate, burst in ((200, 400), (50, 10), (1000, 1)):
+        b = Batch(lib, rate, burst)
+        line = text_line(lib, 3, "T", "m")
+        accepted, refused, notes, count = 0, 0, 0, 0
+        for ms in range(0, 5000):
+            for _ in range(3):
+                if b.add(line, ms):
+                    accepted += 1
+                else:
+                    refused += 1
+            for _, ls in b.take(ms):
+                for l in ls:
+                    n = dropped_note(l)
+                    if n is not None:
+                        notes += n
+                        count += 1
+        for _, ls in b.take(5000 + NOTE_MS, flush=True):
+            notes += sum(dropped_note(l) or 0 for l in ls)
+            count += sum(dropped_note(l) is not None for l in ls)
+        allowed = burst + rate * 5000 // 1000
+        fails.check(allowed - 1 <= accepted <= allowed, "rate %d burst %d: %d accepted, %d allowed" % (
+            rate, burst, accepted, allowed))
+        fails.check(notes == refused == b.b.stats.dropped, "rate %d: %d refused, %d reported, %d counted" % (
+            rate, refused, notes, b.b.stats.dropped))
+        fails.check(count <= 5000 // NOTE_MS + 1, "rate %d: %d drop reports in 5 s" % (rate, count))
+        print("  %4d lines/s burst %3d: %5d of %5d through, drops in %d reports" % (
+            rate, burst, accepted, accepted + refused, count))
+
+    # Ring full while nothing takes (OTA, baud switch): dropped, counted, reported
+    b = Batch(lib, rate=0)
+    line = text_line(lib, 3, "T", "r" * 60)
+    kept = sum(b.add(line, 0) for _ in range(100))
+    fails.check(kept == LOG_BATCH_RING // (2 + line[2]), "ring kept %d lines" % kept)
+    got = b.take(NOTE_MS, flush=True)
+    lines = [l for _, ls in got for l in ls]
+    fails.check(lines[:kept] == [line_of(line)] * kept and dropped_note(lines[-1]) == 100 - kept,
+                "full ring: lines or drop report wrong")
+
+
+def burst_lines(lib, loop):
+    """BURST_LINES lines, half text and half records: random tags and FmtIds
+    with long text, or a handful of call sites in a loop, as a BLE
+    notification storm logs them."""
+    rnd = random.Random(11)
+    lines = []
+    for i in range(BURST_LINES):
+        if loop:
+            site = i % 6
+            if site < 2:
+                lines.append(text_line(lib, 3, ("BLE", "Stm32Serial")[site], "notify %d len %d" % (i, rnd.randrange(20, 200))))
+            else:
+                args = i.to_bytes(4, "little") + bytes(rnd.randrange(0, 9))
+                lines.append(rec_line(lib, 4, 0x51A00000 + site, args))
+        elif rnd.random() < 0.5:
+            lines.append(text_line(lib, rnd.choice((1, 2, 3)), "T%d" % (i % 9), "%d " % i + "w" * rnd.randrange(0, 120)))
+        else:
+            args = i.to_bytes(4, "little") + bytes(rnd.randrange(0, 40))
+            lines.append(rec_line(lib, 3, 0x1000 + i % 50, args))
+    return lines
+
+
+def check_burst(lib, fails):
+    print("burst")
+    for loop in (False, True):
+        lines = burst_lines(lib, loop)
+        for rate, burst in ((0, 1), (LOG_BATCH_RATE, LOG_BATCH_BURST)):
+            b = Batch(lib, rate, burst)
+            accepted, sent_at, got, reported, frames, wire, own, cobs, own_cobs = [], [], [], 0, 0, 0, 0, 0, 0
+            per_ms = BURST_LINES // 500
+            for ms in range(0, 3000):
+                # Stm32Serial::queueLog() takes after every line, update() every ms
+                out = []
+                for f in lines[ms * per_ms:(ms + 1) * per_ms]:
+                    if b.add(f, ms):
+                        accepted.append(line_of(f))
+                        sent_at.append(ms)
+                        own += len(f)
+                        own_cobs += cobs_len(len(f))
+                    out += b.take(ms)
+                for fr, ls in out + b.take(ms):
+                    fails.check(ls is not None and len(fr) <= LINK_FRAME_MAX, "bad batch frame")
+                    frames += 1
+                    wire += len(fr)
+                    cobs += cobs_len(len(fr))
+                    for l in ls:
+                        n = dropped_note(l)
+                        if n is None:
+                            got.append((l, ms))
+                        else:
+                            reported += n
+            what = ("loop " if loop else "mixed ") + ("unlimited" if rate == 0 else "%d/s" % rate)
+            fails.check([l for l, _ in got] == accepted, "%s: lines through differ from those accepted" % what)
+            late = max((t - s for (_, t), s in zip(got, sent_at)), default=0)
+            fails.check(late <= LOG_BATCH_MS, "%s: a line waited %d ms" % (what, late))
+            fails.check(len(accepted) + reported == BURST_LINES, "%s: %d through + %d reported != %d" % (
+                what, len(accepted), reported, BURST_LINES))
+            if rate:
+                fails.check(len(accepted) <= burst + rate * 3, "%s: %d through" % (what, len(accepted)))
+            else:
+                fails.check(len(accepted) == BURST_LINES, "%s: %d through" % (what, len(accepted)))
+            # Each line saves its own frame's 4 bytes and COBS's 2, less its
+            # 1-byte header; a line naming a known source saves that too
+            fails.check(frames * 3 < len(accepted) and cobs * 100 < own_cobs * (75 if loop else 95),
+                        "%s: %d frames, %d B for %d lines, %d B" % (what, frames, cobs, len(accepted), own_cobs))
+            print("  %-15s %5d through in %4d frames, %6d B / %6d B COBS (a frame each: %6d / %6d, %2d%% saved),"
+                  " %4d dropped, worst wait %d ms" % (what + ":", len(accepted), frames, wire, cobs, own, own_cobs,
+                                                     100 - cobs * 100 // own_cobs, reported, late))
+
+
+def main():
+    lib = build_lib()
+    fails = host_build.Failures()
+    check_lines(lib, fails)
+    check_timing(lib, fails)
+    check_limit(lib, fails)
+    check_burst(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import verify_log_record as rec
+import host_build  # noqa: E402  (tools/, on the path through verify_log_record)
+
+# Host checks for deferred ESP_LOGx (Logging.h with LOG_DEFERRED, the
+# arena's deferred records in lib/EcoFlowComm/log_arena.c and
+# log_rec_format() in log_record.c).
+#
+# Every ESP_LOGx call in the ESP32 sources is compiled on the host with
+# g++ -std=c++11, twice: through Logging.h as the firmware has it, under a
+# #line naming its real file and line, and formatted on the spot (vsnprintf,
+# then the line into the arena, as LogBuffer::push() and the framework's
+# ESP_LOGx do). Arguments are random values of each conversion's type.
+# LogBuffer and Stm32Serial are stubs around a real arena.
+#
+#   ids         the format ID each deferred call sends the STM32 is the one
+#               log_decode.py's scan of the sources gives it.
+#   format      each deferred record reads back from the arena as the text
+#               vsnprintf made of the same call.
+#   cost        host ns per call, formatting on the spot vs deferred, and
+#               per record read back (where deferred records are formatted).
+#   muted       with the tag's runtime level (esp_log_level_get) below the
+#               calls', no call takes arena space, and what one costs.
+#
+# Usage: python3 "Test Scripts/verify_log_defer.py"
+
+SRC_DIR = os.path.join(rec.ESP_DIR, "src")
+BENCH_ROUNDS = 2000
+
+STUB_ESP_LOG = """
+#pragma once
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+#define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+extern esp_log_level_t stub_tag_level;
+static inline esp_log_level_t esp_log_level_get(const char*) { return stub_tag_level; }
+"""
+
+STUB_REMOTE_LOGGER = """
+#pragma once
+static inline bool RemoteLogger_Wants(int, const char*) { return true; }
+static inline bool RemoteLogger_WantsStm(int, const char*) { return true; }
+"""
+
+STUB_SERIAL = """
+#pragma once
+#include <stdint.h>
+struct Stm32Serial {
+    static Stm32Serial& getInstance() { static Stm32Serial s; return s; }
+    void sendEspLogRecord(uint8_t, const char*, uint32_t, const uint8_t*, uint8_t) {}
+};
+"""
+
+STUB_LOG_BUFFER = """
+#pragma once
+#include <stdint.h>
+#include "esp_log.h"
+#include "log_arena.h"
+
+// LogBuffer::pushArgs() with logging enabled and no USB host: the record into
+// the arena; the format ID is kept where RemoteLogger would send it
+extern LogArena arena;
+extern uint32_t last_fmt_id;
+struct LogBuffer {
+    static LogBuffer& getInstance() { static LogBuffer b; return b; }
+    bool wantsRecords(esp_log_level_t level, const char* tag) const { return esp_log_level_get(tag) >= level; }
+    void pushArgs(esp_log_level_t level, const char* tag, uint32_t fmtId, const char* fmt,
+                  const uint8_t* args, int len) {
+        log_arena_write_args(&arena, 0, (uint8_t)level, tag, fmt, args, len);
+        last_fmt_id = fmtId;
+    }
+};
+"""
+
+HARNESS_HEAD = r"""
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Logging.h"
+
+LogArena arena;
+uint32_t last_fmt_id;
+esp_log_level_t stub_tag_level = ESP_LOG_VERBOSE;
+
+// Formatted on the calling task, as before
+static void LogNow(esp_log_level_t level, const char* tag, const char* format, ...) {
+    char msg[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg, sizeof(msg), format, args);
+    va_end(args);
+    log_arena_write(&arena, 0, (uint8_t)level, tag, msg);
+}
+
+static bool dumping = false;
+static uint32_t dump_from;
+
+static void hex(const char* s) {
+    if (!*s) printf("-");
+    for (; *s; s++) printf("%02x", (uint8_t)*s);
+}
+
+static void dump(int site) {
+    if (!dumping) return;
+    LogArenaRec r;
+    if (log_arena_read(&arena, &dump_from, &r, 1) != 1) {
+        printf("%d none\n", site);
+        return;
+    }
+    printf("%d %08x ", site, last_fmt_id);
+    hex(r.msg);
+    printf("\n");
+}
+"""
+
+HARNESS_TAIL = r"""
+static double now_ns() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Reads back everything written since `from`; the deferred records format here
+static double read_ns(uint32_t from) {
+    static LogArenaRec out[16];
+    double t0 = now_ns();
+    while (log_arena_read(&arena, &from, out, 16) > 0) {
+    }
+    return now_ns() - t0;
+}
+
+int main(int argc, char** argv) {
+    log_arena_init(&arena);
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        dumping = true;
+        run_now();
+        run_defer();
+        return 0;
+    }
+    int rounds = argc > 2 ? atoi(argv[2]) : 100;
+    if (strcmp(argv[1], "muted") == 0) {
+        // The tag's runtime level below the calls': nothing may be packed
+        stub_tag_level = ESP_LOG_WARN;
+        uint32_t s0 = arena.next_seq;
+        double best = 1e30;
+        for (int r = 0; r < rounds; r++) {
+            double t0 = now_ns();
+            run_defer();
+            double t = now_ns() - t0;
+            if (t < best) best = t;
+        }
+        printf("%u %.0f\n", arena.next_seq - s0, best);
+        return 0;
+    }
+    double best[4] = {1e30, 1e30, 1e30, 1e30};
+    for (int r = 0; r < rounds; r++) {
+        uint32_t s0 = arena.next_seq;
+        double t0 = now_ns();
+        run_now();
+        double t1 = now_ns();
+        double r_now = read_ns(s0);
+        uint32_t s1 = arena.next_seq;
+        double t2 = now_ns();
+        run_defer();
+        double t3 = now_ns();
+        double r_defer = read_ns(s1);
+        double t[4] = {t1 - t0, t3 - t2, r_now, r_defer};
+        for (int i = 0; i < 4; i++) if (t[i] < best[i]) best[i] = t[i];
+    }
+    printf("%.0f %.0f %.0f %.0f\n", best[0], best[1], best[2], best[3]);
+    return 0;
+}
+"""
+
+
+def load_sites():
+    """ESP_LOGx call sites of the ESP32 sources, and the decoder's table of them."""
+    table, sites = {}, []
+    for name in sorted(os.listdir(SRC_DIR)):
+        if not name.endswith(".cpp"):
+            continue
+        with open(os.path.join(SRC_DIR, name)) as f:
+            text = f.read()
+        lines = text.splitlines()
+        found = rec.log_decode.scan_file(name, text, {})
+        for s in sorted({id(v): v for v in found.values()}.values(), key=lambda s: s["line"]):
+            if "ESP_LOG" in lines[s["line"] - 1]:
+                sites.append(s)
+        table.update(found)
+    rnd = random.Random(3)
+    for s in sites:
+        s["args"] = rec.site_args(s["fmt"], rnd)
+    return table, sites
+
+
+def build(sites, tmp):
+    for name in ("Logging.h", "LogRecord.h"):
+        shutil.copy(os.path.join(SRC_DIR, name), tmp)
+    for name, text in (("esp_log.h", STUB_ESP_LOG), ("Stm32Serial.h", STUB_SERIAL),
+                       ("RemoteLogger.h", STUB_REMOTE_LOGGER), ("LogBuffer.h", STUB_LOG_BUFFER)):
+        with open(os.path.join(tmp, name), "w") as f:
+            f.write(text)
+
+    glob_i, glob_f, glob_s = [], [], []
+    now_calls, defer_calls = [], []
+    for k, site in enumerate(sites):
+        exprs = []
+        for kind, v in site["args"]:
+            if kind == "f":
+                exprs.append("(float)F[%d]" % len(glob_f))
+                glob_f.append(v)
+            elif kind == "s":
+                exprs.append("S[%d]" % len(glob_s))
+                glob_s.append(v)
+            elif kind == "u":
+                exprs.append("(uint32_t)I[%d]" % len(glob_i))
+                glob_i.append(v)
+            else:
+                exprs.append("(int)I[%d]" % len(glob_i))
+                glob_i.append(v)
+        args = "".join(", " + e for e in exprs)
+        lit = rec.c_literal(site["fmt"])
+        now_calls.append('    LogNow(ESP_LOG_INFO, "T", %s%s); dump(%d);' % (lit, args, k))
+        defer_calls.append('#line %d "%s"\n    ESP_LOGI("T", %s%s);\n#line %d "harness.cpp"\n    dump(%d);' % (
+            site["line"], site["file"], lit, args, 10000 + k, k))
+
+    src = [HARNESS_HEAD]
+    src.append("long long I[] = {%s};" % ", ".join(["0"] + ["%dLL" % v for v in glob_i]))
+    src.append("double F[] = {%s};" % ", ".join(["0"] + [repr(float(v)) for v in glob_f]))
+    src.append("const char* S[] = {%s};" % ", ".join(['""'] + [rec.c_literal(v) for v in glob_s]))
+    src.append("__attribute__((noinline)) static void run_now() {\n%s\n}" % "\n".join(now_calls))
+    src.append("__attribute__((noinline)) static void run_defer() {\n%s\n}" % "\n".join(defer_calls))
+    src.append(HARNESS_TAIL)
+    cpp = os.path.join(tmp, "harness.cpp")
+    with open(cpp, "w") as f:
+        f.write("\n".join(src))
+
+    exe = os.path.join(tmp, "harness")
+    objs = []
+    for c in ("log_record.c", "log_arena.c"):
+        obj = os.path.join(tmp, c + ".o")
+        subprocess.run(["gcc", "-c", "-O2", "-Wall", "-Wextra", "-Werror", "-I", rec.COMM_DIR,
+                        "-o", obj, os.path.join(rec.COMM_DIR, c)], check=True)
+        objs.append(obj)
+    subprocess.run(["g++", "-std=c++11", "-O2", "-Wall", "-Wextra", "-Werror", "-Wno-unused-function",
+                    "-Wno-format-truncation", "-DLOG_DEFERRED=1", "-I", tmp, "-I", rec.COMM_DIR,
+                    "-o", exe, cpp] + objs, check=True)
+    return exe
+
+
+def run_dump(exe, n):
+    out = subprocess.run([exe, "dump"], check=True, capture_output=True, text=True).stdout.split("\n")
+    rows = [line.split() for line in out if line.strip()]
+    text = lambda h: "" if h == "-" else bytes.fromhex(h).decode()
+    now = [text(r[2]) if len(r) == 3 else None for r in rows[:n]]
+    defer = [(int(r[1], 16), text(r[2])) if len(r) == 3 else None for r in rows[n:]]
+    return now, defer
+
+
+def check_ids(table, sites, defer, fails):
+    print("ids")
+    unknown = [s["line"] for s, d in zip(sites, defer) if d is None or table.get(d[0]) is not s]
+    fails.check(not unknown, "IDs the scan does not know, lines %s" % unknown[:10])
+    print("  %d call sites in %d files" % (len(sites), len({s["file"] for s in sites})))
+
+
+def check_format(sites, now, defer, fails):
+    print("format")
+    bad = 0
+    for s, t, d in zip(sites, now, defer):
+        if t is None or d is None or t != d[1]:
+            if bad < 5:
+                print("  %s:%d: %r != %r" % (s["file"], s["line"], d and d[1], t))
+            bad += 1
+    fails.check(bad == 0, "%d of %d deferred records read back differently" % (bad, len(sites)))
+
+
+def check_cost(exe, sites, fails):
+    print("cost")
+    n = len(sites)
+    out = subprocess.run([exe, "bench", str(BENCH_ROUNDS)], check=True, capture_output=True,
+                         text=True).stdout.split()
+    call_now, call_defer, read_now, read_defer = (float(v) / n for v in out)
+    print("  %d calls          %8s %8s" % (n, "on call", "deferred"))
+    print("  host ns/call      %8.0f %8.0f" % (call_now, call_defer))
+    print("  host ns/read      %8.0f %8.0f" % (read_now, read_defer))
+    fails.check(call_defer * 2 < call_now, "deferring not half the cost of formatting on the call")
+    return call_defer
+
+
+def check_muted(exe, sites, call_defer, fails):
+    print("muted")
+    n = len(sites)
+    written, ns = subprocess.run([exe, "muted", str(BENCH_ROUNDS)], check=True, capture_output=True,
+                                 text=True).stdout.split()
+    print("  INFO calls, tag at WARN: %s records, %.1f host ns/call (%.0f logged)" % (written, float(ns) / n, call_defer))
+    fails.check(int(written) == 0, "%s records packed below the tag's level" % written)
+
+
+def main():
+    fails = host_build.Failures()
+    table, sites = load_sites()
+    tmp = tempfile.mkdtemp(prefix="ecoflow_log_defer")
+    try:
+        exe = build(sites, tmp)
+        now, defer = run_dump(exe, len(sites))
+        fails.check(len(now) == len(defer) == len(sites), "harness printed %d/%d lines" % (len(now), len(defer)))
+        check_ids(table, sites, defer, fails)
+        check_format(sites, now, defer, fails)
+        call_defer = check_cost(exe, sites, fails)
+        check_muted(exe, sites, call_defer, fails)
+    finally:
+        shutil.rmtree(tmp, ignore_errors=True)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
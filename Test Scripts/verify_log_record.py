@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+# Host checks for the ESP32's binary log records (src/LogRecord.h, Logging.h,
+# lib/EcoFlowComm/log_record.c) against tools/log_decode.py.
+#
+# Every LOG_STM_x call in EcoflowDataParser.cpp is compiled on the host with
+# g++ -std=c++11, twice: through Logging.h as the firmware has it, under a
+# #line naming its real file and line so __FILE__ and __LINE__ are the ones
+# the ESP32 build sees, and through the text formatter Logging.h used before
+# (vsnprintf, then "func() msg", then a CMD_ESP_LOG_DATA frame). Arguments
+# are random values of each conversion's type. Stm32Serial is a stub that
+# keeps the frames; RemoteLogger forwards every line.
+#
+#   ids         the format ID each call site compiles to is the one the
+#               decoder's scan of the sources gives it, and no two sites
+#               share one; each record carries its tag's ID.
+#   decode      each record renders to the message the ESP32 used to format.
+#   size        bytes per log line on the UART and on the card, and the
+#               formatting CPU per line, text vs record, over one full dump
+#               of every device (what the ESP32 logs most). CPU is measured
+#               on the host, not on the ESP32.
+#
+# Usage: python3 "Test Scripts/verify_log_record.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+ESP_DIR = os.path.join(REPO, "EcoflowESP32")
+COMM_DIR = os.path.join(ESP_DIR, "lib", "EcoFlowComm")
+SITES_FILE = os.path.join(ESP_DIR, "src", "EcoflowDataParser.cpp")
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+import log_decode  # noqa: E402
+
+BENCH_ROUNDS = 200
+TEXT_TICK = 12345678  # Width of a tick after a few hours, for the text line size
+
+STUB_ESP_LOG = """
+#pragma once
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+"""
+
+STUB_REMOTE_LOGGER = """
+#pragma once
+static inline bool RemoteLogger_Wants(int, const char*) { return true; }
+static inline bool RemoteLogger_WantsStm(int, const char*) { return true; }
+"""
+
+STUB_SERIAL = """
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "ecoflow_protocol.h"
+#include "log_levels.h"
+
+// Keeps the last frame; the harness copies it out when dumping
+struct Stm32Serial {
+    uint8_t frame[MAX_PAYLOAD_LEN + 4];
+    int frame_len = 0;
+    static Stm32Serial& getInstance() { static Stm32Serial s; return s; }
+    void sendEspLog(uint8_t level, const char* tag, const char* msg) {
+        frame_len = pack_esp_log_message(frame, level, tag, msg);
+    }
+    void sendEspLogRecord(uint8_t level, const char* tag, uint32_t fmt_id, const uint8_t* args, uint8_t args_len) {
+        frame_len = pack_esp_log_rec_message(frame, level, fmt_id, log_levels_tag_id(tag), args, args_len);
+    }
+};
+"""
+
+HARNESS_HEAD = r"""
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Logging.h"
+
+// Logging.h before records
+static void LogToStm(esp_log_level_t level, const char* file, const char* func, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char loc_buf[256];
+    vsnprintf(loc_buf, sizeof(loc_buf), format, args);
+    va_end(args);
+    const char* filename = strrchr(file, '/');
+    if (filename) filename++; else filename = file;
+    char stm_msg[512];
+    snprintf(stm_msg, sizeof(stm_msg), "%s() %s", func, loc_buf);
+    Stm32Serial::getInstance().sendEspLog((uint8_t)level, filename, stm_msg);
+}
+
+static bool dumping = false;
+
+static void dump(int site) {
+    Stm32Serial& s = Stm32Serial::getInstance();
+    if (!dumping) return;
+    printf("%d ", site);
+    for (int i = 0; i < s.frame_len; i++) printf("%02x", s.frame[i]);
+    printf("\n");
+}
+
+static const char* TAG = "EcoflowDataParser";
+"""
+
+HARNESS_TAIL = r"""
+static double now_ns() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        dumping = true;
+        run_text();
+        run_rec();
+        return 0;
+    }
+    int rounds = argc > 2 ? atoi(argv[2]) : 100;
+    double best_text = 1e30, best_rec = 1e30;
+    for (int r = 0; r < rounds; r++) {
+        double t0 = now_ns();
+        run_text();
+        double t1 = now_ns();
+        run_rec();
+        double t2 = now_ns();
+        if (t1 - t0 < best_text) best_text = t1 - t0;
+        if (t2 - t1 < best_rec) best_rec = t2 - t1;
+    }
+    printf("%.0f %.0f\n", best_text, best_rec);
+    return 0;
+}
+"""
+
+
+def c_literal(s):
+    return '"' + s.replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n") + '"'
+
+
+def site_args(fmt, rnd):
+    """Random values, as C expressions read from mutable globals, for each conversion."""
+    out = []
+    for m in log_decode.CONV_RE.finditer(fmt):
+        kind = m.group(5)
+        if kind == "%":
+            continue
+        if kind in "eEfFgG":
+            out.append(("f", round(rnd.uniform(-5000, 5000), rnd.choice((0, 1, 2, 3)))))
+        elif kind == "s":
+            out.append(("s", rnd.choice(("DELTA 3", "", "Wave 2 kit"))))
+        elif kind == "u":
+            out.append(("u", rnd.choice((0, 7, 65535, 4000000000))))
+        else:
+            out.append(("i", rnd.choice((0, 1, -1, 42, -3000, 123456, -2147483647))))
+    return out
+
+
+def build(sites, tmp):
+    rnd = random.Random(7)
+    for name in ("Logging.h", "LogRecord.h"):
+        shutil.copy(os.path.join(ESP_DIR, "src", name), tmp)
+    with open(os.path.join(tmp, "esp_log.h"), "w") as f:
+        f.write(STUB_ESP_LOG)
+    with open(os.path.join(tmp, "Stm32Serial.h"), "w") as f:
+        f.write(STUB_SERIAL)
+    with open(os.path.join(tmp, "RemoteLogger.h"), "w") as f:
+        f.write(STUB_REMOTE_LOGGER)
+
+    glob_i, glob_f, glob_s = [], [], []
+    text_calls, rec_calls = [], []
+    for k, site in enumerate(sites):
+        exprs = []
+        for kind, v in site["args"]:
+            if kind == "f":
+                exprs.append("(float)F[%d]" % len(glob_f))
+                glob_f.append(v)
+            elif kind == "s":
+                exprs.append("S[%d]" % len(glob_s))
+                glob_s.append(v)
+            elif kind == "u":
+                exprs.append("(uint32_t)I[%d]" % len(glob_i))
+                glob_i.append(v)
+            else:
+                exprs.append("(int)I[%d]" % len(glob_i))
+                glob_i.append(v)
+        args = "".join(", " + e for e in exprs)
+        lit = c_literal(site["fmt"])
+        text_calls.append('    LogToStm(ESP_LOG_INFO, "%s", "%s", %s%s); dump(%d);' % (
+            site["file"], site["func"], lit, args, k))
+        rec_calls.append('#line %d "%s"\n    LOG_STM_I(TAG, %s%s);\n#line %d "harness.cpp"\n    dump(%d);' % (
+            site["line"], site["file"], lit, args, 10000 + k, k))
+
+    src = [HARNESS_HEAD]
+    src.append("long long I[] = {%s};" % ", ".join(["0"] + ["%dLL" % v for v in glob_i]))
+    src.append("double F[] = {%s};" % ", ".join(["0"] + [repr(float(v)) for v in glob_f]))
+    src.append("const char* S[] = {%s};" % ", ".join(['""'] + [c_literal(v) for v in glob_s]))
+    src.append("__attribute__((noinline)) static void run_text() {\n%s\n}" % "\n".join(text_calls))
+    src.append("__attribute__((noinline)) static void run_rec() {\n%s\n}" % "\n".join(rec_calls))
+    src.append(HARNESS_TAIL)
+    cpp = os.path.join(tmp, "harness.cpp")
+    with open(cpp, "w") as f:
+        f.write("\n".join(src))
+
+    exe = os.path.join(tmp, "harness")
+    objs = []
+    for c in ("ecoflow_protocol.c", "ota_crc.c", "log_record.c", "log_levels.c"):
+        obj = os.path.join(tmp, c + ".o")
+        subprocess.run(["gcc", "-c", "-O2", "-Wall", "-Wextra", "-Werror", "-I", COMM_DIR,
+                        "-o", obj, os.path.join(COMM_DIR, c)], check=True)
+        objs.append(obj)
+    subprocess.run(["g++", "-std=c++11", "-O2", "-Wall", "-Wextra", "-Werror", "-Wno-unused-function",
+                    "-Wno-format-truncation", "-I", tmp, "-I", COMM_DIR, "-o", exe, cpp] + objs, check=True)
+    return exe
+
+
+def load_sites():
+    with open(SITES_FILE) as f:
+        text = f.read()
+    table = log_decode.scan_file(os.path.basename(SITES_FILE), text, {})
+    rnd = random.Random(1)
+    sites = sorted({id(v): v for v in table.values()}.values(), key=lambda s: s["line"])
+    for s in sites:
+        s["args"] = site_args(s["fmt"], rnd)
+    return table, sites
+
+
+def run_dump(exe, n):
+    out = subprocess.run([exe, "dump"], check=True, capture_output=True, text=True).stdout.split("\n")
+    frames = [bytes.fromhex(line.split()[1]) for line in out if line.strip()]
+    return frames[:n], frames[n:]
+
+
+def text_message(frame):
+    # [Start][Cmd][Len][Level][TagLen][Tag][Msg][CRC]
+    tag_len = frame[4]
+    return frame[5:5 + tag_len].decode(), frame[5 + tag_len:-1].decode()
+
+
+def tag_id(tag):
+    """log_levels_tag_id(): FNV-1a of the tag, folded to 16 bits."""
+    h = 2166136261
+    for c in tag.encode():
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return (h ^ (h >> 16)) & 0xFFFF
+
+
+def check_ids(table, sites, rec, fails):
+    print("ids")
+    ids = [struct.unpack_from("<I", f, 4)[0] for f in rec]
+    fails.check(len(set(ids)) == len(ids), "format IDs collide")
+    unknown = [s["line"] for s, i in zip(sites, ids) if table.get(i) is not s]
+    fails.check(not unknown, "IDs the scan does not know, lines %s" % unknown[:10])
+    fails.check(all(f[1] == 0x7D for f in rec), "records not sent as CMD_ESP_LOG_REC")
+    want = tag_id("EcoflowDataParser")
+    fails.check(all(struct.unpack_from("<H", f, 8)[0] == want for f in rec), "records without their tag's ID")
+    print("  %d call sites" % len(sites))
+
+
+def check_decode(table, sites, text, rec, fails):
+    print("decode")
+    bad = 0
+    for s, t, r in zip(sites, text, rec):
+        tag, msg = text_message(t)
+        level, fid = r[3], struct.unpack_from("<I", r, 4)[0]
+        line = log_decode.decode_record(0, level, fid, r[10:-1], table)
+        want = "[0] [%s] %s" % (tag, msg)
+        if line != want:
+            if bad < 5:
+                print("  line %d: %r != %r" % (s["line"], line, want))
+            bad += 1
+    fails.check(bad == 0, "%d of %d records decode differently" % (bad, len(sites)))
+
+
+def check_size(exe, sites, text, rec, fails):
+    print("size")
+    n = len(sites)
+    uart_text = sum(len(f) for f in text)
+    uart_rec = sum(len(f) for f in rec)
+    card_text = card_rec = 0
+    for t, r in zip(text, rec):
+        tag, msg = text_message(t)
+        card_text += len(("[%d] [%s] %s\n" % (TEXT_TICK, tag, msg)).encode())
+        card_rec += 12 + len(r) - 9  # Header, then the args from the frame
+    out = subprocess.run([exe, "bench", str(BENCH_ROUNDS)], check=True, capture_output=True,
+                         text=True).stdout.split()
+    ns_text, ns_rec = float(out[0]) / n, float(out[1]) / n
+    print("  %d lines      %8s %8s" % (n, "text", "record"))
+    print("  UART bytes/line  %8.1f %8.1f" % (uart_text / n, uart_rec / n))
+    print("  card bytes/line  %8.1f %8.1f" % (card_text / n, card_rec / n))
+    print("  host ns/line     %8.0f %8.0f" % (ns_text, ns_rec))
+    fails.check(card_rec * 3 < card_text, "records not a third of the text on the card")
+    fails.check(uart_rec * 2 < uart_text, "records not half the text on the UART")
+    fails.check(ns_rec * 2 < ns_text, "packing not half the cost of formatting")
+
+
+def main():
+    fails = host_build.Failures()
+    table, sites = load_sites()
+    tmp = tempfile.mkdtemp(prefix="ecoflow_log_record")
+    try:
+        exe = build(sites, tmp)
+        text, rec = run_dump(exe, len(sites))
+        fails.check(len(text) == len(rec) == len(sites), "harness printed %d/%d frames" % (len(text), len(rec)))
+        check_ids(table, sites, rec, fails)
+        check_decode(table, sites, text, rec, fails)
+        check_size(exe, sites, text, rec, fails)
+    finally:
+        shutil.rmtree(tmp, ignore_errors=True)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
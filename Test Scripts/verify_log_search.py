@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import random
+import struct
+import sys
+
+# Host checks for the indexed log search (lib/EcoFlowComm/log_index.h,
+# LogManager_HandleSearch in src/log_manager.c).
+#
+# Uses the LogManager host build of verify_log_writer.py. Synthetic logs
+# are written through LogManager_Write and LogManager_WriteRecord as the
+# device writes them: text lines of a few tags over a common vocabulary,
+# some rare words, warnings throughout, errors in bursts, ESP32 records of
+# a handful of call sites. The first part is rotated to log_N.log; the rest
+# stays in current.log across a watchdog reset and a power cycle, so its
+# index has entries written after the reset and a torn record in it.
+#
+#   index       log_N.lix has an entry per 16 KB segment, all valid; the
+#               entries of current.lix from before the reset are kept, the
+#               one open at the reset is flagged partial.
+#   search      every query returns exactly the records a full decode of the
+#               file matches (Python matcher below), in file order, records
+#               too long for a frame cut to fit with Len fixed.
+#   sectors     sector reads per query against a full scan of the file; a
+#               selective query (rare word, time window, error burst, one
+#               call site) reads a small part of it; a query the index
+#               rules nothing out for (every record, a common word) stays
+#               within 2 % of a full scan.
+#   limit       Max stops a search with LOG_SEARCH_LIMIT after Max matches.
+#   errors      a missing file or a text log answers LOG_SEARCH_NO_FILE.
+#
+# Usage: python3 "Test Scripts/verify_log_search.py"
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import verify_log_writer as w  # noqa: E402
+import host_build  # noqa: E402  (tools/, on the path through verify_log_writer)
+import log_decode  # noqa: E402
+
+CMD_LOG_SEARCH_RESP = 0x7F
+LOG_SEARCH_OK = 0
+LOG_SEARCH_NO_FILE = 1
+LOG_SEARCH_LIMIT = 2
+LOG_IDX_SEGMENT = 16384
+LOG_IDX_ENTRY = struct.Struct("<III6HBBH256sI")  # First, TickMin/Max, Levels, Flags, -, Records, Words, CRC
+LOG_IDX_PARTIAL = 0x01
+LOG_IDX_WORD_MAX = 24
+SEARCH_MSG = struct.Struct("<BBIIHB4I32s64s")
+END_MSG = struct.Struct("<BBBIII")
+REC_CUT = 255 - 2 - 4  # Record bytes a page takes alone
+
+TAGS = ["BLE", "UART", "Power", "Fan", "LCD", "OTA"]
+SITES = [("DeviceManager.cpp", 120, "%s connected, rssi %d"),
+         ("DeviceManager.cpp", 188, "%s poll took %d ms"),
+         ("Stm32Serial.cpp", 310, "frame %d dropped: %s"),
+         ("WebServer.cpp", 77, "GET %s from %s")]
+ESP_LEVEL = 3
+
+
+def words(text):
+    """Words as log_index.c splits them, lower case and cut."""
+    out, cur = [], ""
+    for c in text + " ":
+        if c.isascii() and (c.isalnum() or c == "_"):
+            cur += c
+            continue
+        if cur and cur[0].isalpha():
+            out.append(cur[:LOG_IDX_WORD_MAX].lower())
+        cur = ""
+    return out
+
+
+def rec_words(fid, payload):
+    if fid == 0:
+        n = payload[0] if payload else 0
+        return words(payload[1:1 + n].decode("latin-1")) + words(payload[1 + n:].decode("latin-1"))
+    return [x for a in log_decode.unpack_args(payload) if isinstance(a, str) for x in words(a)]
+
+
+def file_records(data):
+    """(offset, record bytes) of every record a full decode finds."""
+    pos = len(log_decode.MAGIC)
+    out = []
+    hdr = log_decode.HEADER
+    while pos + hdr.size <= len(data):
+        if data[pos] != log_decode.SYNC:
+            pos += 1
+            continue
+        _, length, _, level, _ = hdr.unpack_from(data, pos)
+        nxt = pos + 3 + length
+        if length < log_decode.LEN_MIN or level > 7 or nxt > len(data) or (nxt < len(data) and data[nxt] != log_decode.SYNC):
+            pos += 1
+            continue
+        out.append((pos, data[pos:nxt]))
+        pos = nxt
+    return out
+
+
+def brute(data, levels=0, t_from=0, t_to=0xFFFFFFFF, text="", fmts=()):
+    want = words(text)[:4]
+    out = []
+    for off, rec in file_records(data):
+        _, _, tick, level, fid = log_decode.HEADER.unpack_from(rec)
+        if not t_from <= tick <= t_to:
+            continue
+        if levels and not levels & (1 << min(level, 5)):
+            continue
+        if fmts and fid not in fmts:
+            continue
+        if want and not set(want) <= set(rec_words(fid, rec[log_decode.HEADER.size:])):
+            continue
+        out.append((off, rec))
+    return out
+
+
+class Card(w.Board):
+    def __init__(self, lib, rng):
+        super().__init__(lib)
+        self.rng = rng
+        self.fids = [log_decode.fmt_id(f, line, fmt) for f, line, fmt in SITES]
+        self.fault_ticks = []
+
+    def esp(self, site, args):
+        buf = ctypes.create_string_buffer(250)
+        pos = 0
+        for a in args:
+            if isinstance(a, str):
+                pos = self.lib.log_arg_put_str(buf, pos, 250, a.encode())
+            else:
+                pos = self.lib.log_arg_put_int(buf, pos, 250, a)
+        self.lib.LogManager_WriteRecord(ESP_LEVEL, self.fids[site], 0, buf.raw[:pos], pos)
+
+    def traffic(self, lines, vocab, fault_every=0):
+        """`lines` lines over about 2 ms each; an error burst every `fault_every`."""
+        r = self.rng
+        for i in range(lines):
+            if fault_every and i % fault_every == fault_every // 2:
+                self.fault_ticks.append(self.lib.host_time())
+                for k in range(12):
+                    self.log(1, "Power", "overcurrent trip on port %d, brownout %d" % (k % 3, k))
+                    self.tick(1)
+            x = r.random()
+            if x < 0.1:
+                site = r.randrange(len(SITES))
+                if site == 0:
+                    self.esp(0, [r.choice(["DELTA3", "WAVE2", "DeltaPro3"]), -r.randrange(40, 90)])
+                elif site == 1:
+                    self.esp(1, [r.choice(["DELTA3", "WAVE2"]), r.randrange(5, 400)])
+                elif site == 2 and r.random() < 0.05:
+                    self.esp(2, [r.randrange(1 << 16), r.choice(["crc", "timeout", "overflow"])])
+                else:
+                    self.esp(3, ["/api/status", "192.168.1.%d" % r.randrange(2, 250)])
+            else:
+                level = 2 if x < 0.15 else 4 if x < 0.2 else 3
+                n = r.randrange(3, 9) if r.random() > 0.002 else 60  # A few lines too long for a frame
+                msg = " ".join(r.choice(vocab) for _ in range(n)) + " value=%d" % r.randrange(100000)
+                self.log(level, r.choice(TAGS), msg)
+            self.tick(r.randrange(0, 5))
+        self.tick(3 * w.LOG_FLUSH_MS)
+
+    def search(self, name, levels=0, t_from=0, t_to=0xFFFFFFFF, text="", fmts=(), max_matches=0, qid=9):
+        """(records, end fields, sector reads) of one search run to its end."""
+        msg = SEARCH_MSG.pack(qid, levels, t_from, t_to, max_matches, len(fmts),
+                              *(list(fmts) + [0] * (4 - len(fmts))), name.encode(), text.encode())
+        cap = 4 << 20
+        buf = (ctypes.c_uint8 * cap)()
+        self.lib.host_capture_frames(CMD_LOG_SEARCH_RESP, buf, cap)
+        self.lib.host_counters_reset()
+        self.lib.LogManager_HandleSearch(msg)
+        end = None
+        pos = 0
+        got = []
+        for _ in range(100000):
+            n = self.lib.host_captured()
+            while pos < n:
+                plen = buf[pos + 2]
+                frame = bytes(buf[pos:pos + 4 + plen])
+                pos += 4 + plen
+                qid_got, count = frame[3], frame[4]
+                assert qid_got == qid
+                if count == 0:
+                    end = END_MSG.unpack_from(frame, 3)
+                    continue
+                p = 5
+                for _ in range(count):
+                    off = struct.unpack_from("<I", frame, p)[0]
+                    rlen = 3 + struct.unpack_from("<H", frame, p + 5)[0]
+                    got.append((off, frame[p + 4:p + 4 + rlen]))
+                    p += 4 + rlen
+            if end:
+                break
+            self.lib.LogManager_Process()
+        reads = self.counters()["reads"]
+        self.lib.host_capture_frames(0, None, 0)
+        return got, end, reads
+
+
+def entries(data):
+    return [LOG_IDX_ENTRY.unpack_from(data, i) for i in range(0, len(data) - LOG_IDX_ENTRY.size + 1, LOG_IDX_ENTRY.size)]
+
+
+def valid(raw):
+    return w_crc(raw[:-4]) == struct.unpack_from("<I", raw, len(raw) - 4)[0]
+
+
+def w_crc(data):
+    # ota_crc32: CRC-32/BZIP2 (poly 0x04C11DB7, MSB first, init and xor 0xFFFFFFFF)
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc ^= b << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF if crc & 0x80000000 else (crc << 1) & 0xFFFFFFFF
+    return crc ^ 0xFFFFFFFF
+
+
+def cut(rec):
+    """A record as a page carries it."""
+    if len(rec) <= REC_CUT:
+        return rec
+    return rec[:1] + struct.pack("<H", REC_CUT - 3) + rec[3:REC_CUT]
+
+
+def check_index(card, fails, rotated, pre_reset_segs):
+    print("index")
+    raw = card.read(rotated.replace(".log", ".lix"))
+    size = len(card.read(rotated))
+    fails.check(raw is not None, "%s has no index" % rotated)
+    raw = raw or b""
+    n = len(raw) // LOG_IDX_ENTRY.size
+    segs = (size + LOG_IDX_SEGMENT - 1) // LOG_IDX_SEGMENT
+    fails.check(n == segs, "%s: %d entries for %d segments" % (rotated, n, segs))
+    bad = [i for i in range(n) if not valid(raw[i * LOG_IDX_ENTRY.size:(i + 1) * LOG_IDX_ENTRY.size])]
+    fails.check(not bad, "%s: entries %s fail their CRC" % (rotated, bad[:5]))
+    flagged = [i for i, e in enumerate(entries(raw)) if e[9] & LOG_IDX_PARTIAL]
+    fails.check(not flagged, "%s: entries %s flagged partial" % (rotated, flagged[:5]))
+
+    cur = entries(card.read("current.lix") or b"")
+    flags = [e[9] & LOG_IDX_PARTIAL for e in cur]
+    fails.check(len(cur) >= pre_reset_segs, "current.lix: %d entries, %d before the reset" % (len(cur), pre_reset_segs))
+    fails.check(not any(flags[:pre_reset_segs - 1]), "current.lix: entries before the reset flagged partial")
+    fails.check(any(flags[pre_reset_segs - 1:]), "current.lix: no partial entry after the reset")
+    print("  %s: %d entries for %d bytes; current.lix: %d entries, %d partial" % (
+        rotated, n, size, len(cur), sum(flags)))
+
+
+def check_search(card, fails, names):
+    print("search")
+    for name, fault in names:
+        check_file(card, fails, name, fault)
+
+
+def check_file(card, fails, name, fault):
+    queries = [("all records", {}),
+               ("rare word", {"text": "zeppelin"}),
+               ("two words", {"text": "overcurrent brownout"}),
+               ("error level", {"levels": 1 << 1}),
+               ("word + level", {"text": "port", "levels": 1 << 1}),
+               ("time window", {"t_from": fault - 200, "t_to": fault + 400}),
+               ("call site", {"fmts": (card.fids[2],)}),
+               ("esp32 string arg", {"text": "timeout", "fmts": (card.fids[2],)}),
+               ("common word", {"text": "value"}),
+               ("no match", {"text": "nonexistentword"})]
+    data = card.read(name)
+    full = (len(data) + 511) // 512
+    print("  %s: %d bytes, full scan %d sectors" % (name, len(data), full))
+    for what, q in queries:
+        want = brute(data, **q)
+        got, end, reads = card.search(name, **q)
+        ok = fails.check(end is not None and end[2] == LOG_SEARCH_OK, "%s, %s: ended %s" % (name, what, end))
+        if ok:
+            fails.check(end[3] == len(want), "%s, %s: %d matches reported, %d expected" % (name, what, end[3], len(want)))
+            fails.check(end[5] == len(data), "%s, %s: size %d, file %d" % (name, what, end[5], len(data)))
+        same = [o for o, _ in got] == [o for o, _ in want] and all(
+            g == cut(r) for (_, g), (_, r) in zip(got, want))
+        fails.check(same, "%s, %s: %d records returned, %d expected%s" % (
+            name, what, len(got), len(want), "" if len(got) != len(want) else ", contents differ"))
+        print("    %-18s %6d matches  %5d sector reads  %5.1f %% of full scan" % (
+            what, len(got), reads, 100.0 * reads / full))
+        selective = what in ("rare word", "two words", "word + level", "time window", "no match")
+        if selective:
+            fails.check(reads < full * 0.25, "%s, %s: %d sector reads of %d" % (name, what, reads, full))
+        elif what in ("all records", "common word"):
+            # The index rules nothing out: the scan goes on without it
+            fails.check(reads < full * 1.02, "%s, %s: %d sector reads of %d" % (name, what, reads, full))
+
+
+def check_limit(card, fails, name):
+    print("limit")
+    got, end, _ = card.search(name, text="value", max_matches=50)
+    fails.check(end is not None and end[2] == LOG_SEARCH_LIMIT and end[3] == 50 and len(got) == 50,
+                "max 50: %d records, end %s" % (len(got), end))
+    got, end, _ = card.search(name, text="overcurrent", max_matches=10000, qid=3)
+    fails.check(end is not None and end[0] == 3 and end[2] == LOG_SEARCH_OK, "id not echoed: %s" % (end,))
+
+
+def check_errors(card, fails):
+    print("errors")
+    for name in ("log_999.log", "nothing.log"):
+        got, end, _ = card.search(name, text="value")
+        fails.check(not got and end is not None and end[2] == LOG_SEARCH_NO_FILE, "%s: %s" % (name, end))
+    text = b"[10] [SYS] Log System Initialized\n"
+    card.lib.host_write_file(b"log_998.txt", text, len(text))
+    got, end, _ = card.search("log_998.txt")
+    fails.check(not got and end is not None and end[2] == LOG_SEARCH_NO_FILE, "text log: %s" % (end,))
+
+
+def main():
+    lib = w.build_lib()
+    lib.LogManager_HandleSearch.restype = None
+    lib.LogManager_HandleSearch.argtypes = [ctypes.c_char_p]
+    lib.host_capture_frames.restype = None
+    lib.host_capture_frames.argtypes = [ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint32]
+    lib.host_captured.restype = ctypes.c_uint32
+    fails = host_build.Failures()
+
+    rng = random.Random(46)
+    vocab = ["%s%s" % (rng.choice("bcdfghklmnprstvz"), "".join(rng.choice("aeiou") + rng.choice("lmnrst")
+                                                            for _ in range(rng.randrange(1, 4))))
+             for _ in range(300)]
+    rare = ["zeppelin"]
+
+    card = Card(lib, rng)
+    card.traffic(9000, vocab, fault_every=3000)
+    card.traffic(1, rare)
+    card.traffic(9000, vocab, fault_every=4500)
+    lib.LogManager_ForceRotate()
+    rotated = [n for n in ("log_%d.log" % i for i in range(4)) if card.exists(n)]
+    fails.check(len(rotated) == 1, "rotated logs: %s" % rotated)
+
+    card.traffic(6000, vocab, fault_every=3000)
+    card.traffic(1, rare)
+    card.traffic(3000, vocab)
+    pre_reset = len(card.read("current.lix") or b"") // LOG_IDX_ENTRY.size
+    card.log(3, "T", "before the reset")
+    card.reset(False)      # Watchdog: the ring is written at the next boot
+    card.traffic(6000, vocab, fault_every=3000)
+    card.log(3, "T", "before the power cycle")
+    lib.LogManager_Flush()
+    card.log(3, "T", "lost in the power cycle " * 4)
+    card.reset(True)       # Power: a torn record may be left behind
+    card.traffic(1, rare)
+    card.traffic(3000, vocab)
+
+    check_index(card, fails, rotated[0] if rotated else "log_0.log", pre_reset + 1)
+    check_search(card, fails, ((rotated[0] if rotated else "log_0.log", card.fault_ticks[1]),
+                               ("current.log", card.fault_ticks[-1])))
+    check_limit(card, fails, "current.log")
+    check_errors(card, fails)
+
+    print("PASS" if fails.count == 0 else "FAIL (%d)" % fails.count)
+    return 0 if fails.count == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
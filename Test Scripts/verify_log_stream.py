@@ -0,0 +1,408 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import random
+import sys
+
+# Host checks for the ESP32's log download ring (EcoFlowComm/log_stream.c).
+#
+# Builds the file with gcc and drives it through ctypes against a Python
+# model of the STM32's LogManager download: chunks of up to LOG_CHUNK_MAX
+# sent front to back up to the credited limit, a seek on CMD_LOG_RESEND_REQ,
+# an empty chunk at EOF and the drop after DL_IDLE_TIMEOUT without credit.
+#
+#   ring        data written across the wrap point comes out unchanged for
+#               arbitrary read sizes.
+#   credit      the credit never covers more than the ring has room for, so
+#               a sender that stays within it never overruns; a reader that
+#               stops stops the credit, and it resumes once half a window
+#               is read out.
+#   recovery    one resend request per gap, repeated only after the stall
+#               time; owed data that never comes (lost window tail, lost
+#               credit, lost end marker) brings a resend and a fresh credit.
+#   pause       a reader that holds the ring full for longer than the
+#               STM32's idle drop keeps the download open with keep-alive
+#               credits and gets the whole file once it drains.
+#   give up     a download the STM32 no longer serves fails after
+#               LOG_STREAM_STALLS_MAX stalls and ends once read out.
+#   transfer    whole downloads over a link that drops, and a reader that
+#               drains at random rates; content must match.
+#
+# Usage: python3 "Test Scripts/verify_log_stream.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+COMM_DIR = os.path.join(REPO, "EcoflowESP32", "lib", "EcoFlowComm")
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+
+LOG_STREAM_RING = 16384
+LOG_STREAM_CREDITS = 32
+LOG_STREAM_STALL_MS = 500
+LOG_STREAM_STALLS_MAX = 20
+LOG_STREAM_KEEPALIVE_MS = 2000
+LOG_STREAM_SEND_CREDIT = 0x01
+LOG_STREAM_SEND_RESEND = 0x02
+LOG_CHUNK_MAX = 240
+DL_IDLE_TIMEOUT = 10000
+
+
+class LogStream(ctypes.Structure):
+    _fields_ = [("buf", ctypes.c_uint8 * LOG_STREAM_RING), ("head", ctypes.c_uint32),
+                ("tail", ctypes.c_uint32), ("active", ctypes.c_bool), ("complete", ctypes.c_bool),
+                ("failed", ctypes.c_bool), ("granted", ctypes.c_uint32), ("resend_at", ctypes.c_uint32),
+                ("resend_ms", ctypes.c_uint32), ("last_rx_ms", ctypes.c_uint32),
+                ("keepalive_ms", ctypes.c_uint32), ("stall_run", ctypes.c_uint32), ("resends", ctypes.c_uint32), ("credits_sent", ctypes.c_uint32),
+                ("stalls", ctypes.c_uint32)]
+
+
+def build_lib():
+    u8p = ctypes.POINTER(ctypes.c_uint8)
+    sp = ctypes.POINTER(LogStream)
+    sigs = {
+        "log_stream_start": (ctypes.c_uint8, [sp, ctypes.c_uint32]),
+        "log_stream_abort": (None, [sp]),
+        "log_stream_on_chunk": (ctypes.c_uint8, [sp, ctypes.c_uint32, u8p, ctypes.c_uint16, ctypes.c_uint32]),
+        "log_stream_poll": (ctypes.c_uint8, [sp, ctypes.c_uint32]),
+        "log_stream_read": (ctypes.c_uint32, [sp, u8p, ctypes.c_uint32]),
+        "log_stream_buffered": (ctypes.c_uint32, [sp]),
+        "log_stream_offset": (ctypes.c_uint32, [sp]),
+        "log_stream_credits": (ctypes.c_uint8, [sp]),
+        "log_stream_done": (ctypes.c_bool, [sp]),
+    }
+    return host_build.build_lib([os.path.join(COMM_DIR, "log_stream.c")], sigs,
+                                ["-Wall", "-Wextra", "-Werror", "-I", COMM_DIR], "log_stream",
+                                [os.path.join(COMM_DIR, "log_stream.h")])
+
+
+def u8buf(data):
+    return (ctypes.c_uint8 * max(len(data), 1)).from_buffer_copy(bytes(data) or b"\0")
+
+
+class Esp:
+    """Stm32Serial: turns the returned flags into frames for the sender."""
+
+    def __init__(self, lib):
+        self.lib = lib
+        self.s = LogStream()
+        self.frames = []
+
+    def act(self, actions):
+        if actions & LOG_STREAM_SEND_RESEND:
+            self.frames.append(("resend", self.lib.log_stream_offset(self.s)))
+        if actions & LOG_STREAM_SEND_CREDIT:
+            offset = self.lib.log_stream_offset(self.s)
+            self.frames.append(("credit", offset, self.lib.log_stream_credits(self.s)))
+
+    def start(self, now):
+        self.act(self.lib.log_stream_start(self.s, now))
+
+    def chunk(self, offset, data, now):
+        self.act(self.lib.log_stream_on_chunk(self.s, offset, u8buf(data), len(data), now))
+
+    def poll(self, now):
+        self.act(self.lib.log_stream_poll(self.s, now))
+
+    def read(self, n):
+        out = (ctypes.c_uint8 * max(n, 1))()
+        got = self.lib.log_stream_read(self.s, out, n)
+        return bytes(out[:got])
+
+    def take(self):
+        frames, self.frames = self.frames, []
+        return frames
+
+
+class Stm:
+    """LogManager download: front to back within the credit, seek on resend,
+    dropped after DL_IDLE_TIMEOUT without credit."""
+
+    def __init__(self, content):
+        self.content = content
+        self.offset = 0
+        self.limit = 0
+        self.eof_sent = False
+        self.closed = False
+        self.dropped = False
+        self.last_credit = 0
+
+    def on_frame(self, frame, now=0):
+        if self.closed:
+            return  # Downloading is false: credits and resends are ignored
+        if frame[0] == "resend":
+            self.offset = frame[1]
+            self.eof_sent = False
+        else:
+            self.limit = max(self.limit, frame[1] + frame[2] * LOG_CHUNK_MAX)
+            self.last_credit = now
+            if self.eof_sent and frame[1] >= len(self.content):
+                self.closed = True
+
+    def burst(self, count=8, now=0):
+        if not self.closed and now - self.last_credit > DL_IDLE_TIMEOUT:
+            self.closed = self.dropped = True
+        out = []
+        for _ in range(count):
+            if self.closed or self.offset >= self.limit:
+                break
+            if self.offset >= len(self.content):
+                if not self.eof_sent:
+                    self.eof_sent = True
+                    out.append((len(self.content), b""))
+                break
+            n = min(LOG_CHUNK_MAX, self.limit - self.offset, len(self.content) - self.offset)
+            out.append((self.offset, self.content[self.offset:self.offset + n]))
+            self.offset += n
+        return out
+
+
+# --- ring ---
+
+def check_ring(lib, fails):
+    rng = random.Random(1)
+    content = bytes(rng.randrange(256) for _ in range(5 * LOG_STREAM_RING + 77))
+    esp = Esp(lib)
+    esp.start(0)
+    pos = 0
+    out = bytearray()
+    while pos < len(content):
+        room = LOG_STREAM_RING - lib.log_stream_buffered(esp.s)
+        n = min(rng.randrange(1, LOG_CHUNK_MAX + 1), len(content) - pos)
+        if n <= room:
+            esp.chunk(pos, content[pos:pos + n], 0)
+            pos += n
+        out += esp.read(rng.randrange(0, 3000))
+    esp.chunk(pos, b"", 0)
+    while not lib.log_stream_done(esp.s):
+        out += esp.read(rng.randrange(1, 3000))
+    fails.check(bytes(out) == content, "ring: content changed across the wrap")
+    print("  ring: %d bytes through %d wraps OK" % (len(content), len(content) // LOG_STREAM_RING))
+
+
+# --- credit ---
+
+def check_credit(lib, fails):
+    esp = Esp(lib)
+    esp.start(0)
+    frames = esp.take()
+    fails.check(frames == [("credit", 0, LOG_STREAM_CREDITS)], "start: no full window credit: %r" % frames)
+
+    # Reader stopped: the sender fills the ring to what was granted and no further
+    content = bytes(range(256)) * 1024
+    stm = Stm(content)
+    for f in frames:
+        stm.on_frame(f)
+    now = 0
+    for _ in range(400):
+        now += 5
+        for offset, data in stm.burst():
+            esp.chunk(offset, data, now)
+        esp.poll(now)
+        for f in esp.take():
+            stm.on_frame(f)
+        fails.check(stm.limit - esp.s.tail <= LOG_STREAM_RING, "credit past the ring's room")
+    buffered = lib.log_stream_buffered(esp.s)
+    half = LOG_STREAM_CREDITS // 2 * LOG_CHUNK_MAX
+    fails.check(buffered > LOG_STREAM_RING - half, "ring not filled to its room: %d" % buffered)
+    fails.check(stm.offset == stm.limit == esp.s.head, "sender not paused at the credit")
+    fails.check(esp.s.stalls == 0 and esp.s.resends == 0, "a paused reader counted as a link stall")
+    paused_at = esp.s.credits_sent
+
+    # Room for less than half a window earns no credit frame, the next byte does
+    esp.read(half - (LOG_STREAM_RING - buffered) - 1)
+    esp.poll(now)
+    fails.check(not esp.take(), "credit sent for less than half a window")
+    esp.read(1)
+    esp.poll(now)
+    frames = esp.take()
+    fails.check(len(frames) == 1 and frames[0][2] == LOG_STREAM_CREDITS // 2, "half window not credited: %r" % frames)
+    for f in frames:
+        stm.on_frame(f)
+
+    # Draining renews it and the transfer finishes
+    out = bytearray()
+    while not lib.log_stream_done(esp.s) and now < 60000:
+        now += 5
+        out += esp.read(4096)
+        esp.poll(now)
+        for f in esp.take():
+            stm.on_frame(f)
+        for offset, data in stm.burst():
+            esp.chunk(offset, data, now)
+        for f in esp.take():
+            stm.on_frame(f)
+        fails.check(stm.limit - esp.s.tail <= LOG_STREAM_RING, "credit past the ring's room")
+    fails.check(lib.log_stream_done(esp.s), "credit: download did not finish after draining")
+    fails.check(esp.s.credits_sent > paused_at, "credit not renewed after the reader drained")
+    fails.check(stm.closed, "end marker not confirmed")
+    print("  credit: paused at %d buffered, %d credits for %d bytes" % (buffered, esp.s.credits_sent, len(content)))
+
+
+# --- recovery ---
+
+def check_recovery(lib, fails):
+    esp = Esp(lib)
+    esp.start(0)
+    esp.take()
+    esp.chunk(0, b"a" * 240, 10)
+    esp.take()
+
+    # A gap asks once; later chunks of the same window do not ask again
+    esp.chunk(480, b"c" * 240, 20)
+    fails.check(esp.take() == [("resend", 240)], "gap: no resend request")
+    esp.chunk(720, b"d" * 240, 21)
+    fails.check(not esp.take(), "gap: second resend for the same gap")
+    esp.chunk(0, b"a" * 240, 22)
+    fails.check(not esp.take() and esp.s.head == 240, "overlap changed the stream")
+
+    # Still missing after the stall time: resend and credit again
+    esp.poll(20 + LOG_STREAM_STALL_MS + 1)
+    frames = esp.take()
+    fails.check(frames[:1] == [("resend", 240)] and frames[1:2] and frames[1][0] == "credit",
+                "stall: no resend and credit: %r" % frames)
+    esp.chunk(240, b"b" * 240, 600)
+    fails.check(esp.s.head == 480, "resent chunk not taken")
+
+    # Lost end marker: all credited data in, nothing owed is missing until
+    # the grant runs past the file, then the stall brings a resend
+    esp.poll(600 + LOG_STREAM_STALL_MS + 1)
+    frames = esp.take()
+    fails.check(("resend", 480) in frames, "lost end marker not recovered: %r" % frames)
+
+    # An end marker past the data is a gap, not the end
+    esp.chunk(960, b"", 2000)
+    fails.check(not esp.s.complete, "end marker past a gap taken")
+    esp.chunk(480, b"", 2001)
+    fails.check(esp.s.complete and esp.take()[-1][0] == "credit", "end marker not confirmed by a credit")
+    fails.check(not lib.log_stream_done(esp.s), "done before the reader emptied the ring")
+    fails.check(esp.read(1000) == b"a" * 240 + b"b" * 240, "recovered content wrong")
+    fails.check(lib.log_stream_done(esp.s), "not done after reading out")
+
+    # Aborted: nothing more taken or asked for
+    esp = Esp(lib)
+    esp.start(0)
+    lib.log_stream_abort(esp.s)
+    esp.take()
+    esp.chunk(0, b"x" * 10, 1)
+    esp.poll(5000)
+    fails.check(not esp.take() and esp.s.head == 0, "aborted stream still active")
+    print("  recovery: OK")
+
+
+# --- pause ---
+
+def run(esp, stm, now, read):
+    out = esp.read(read)
+    esp.poll(now)
+    for f in esp.take():
+        stm.on_frame(f, now)
+    for offset, data in stm.burst(now=now):
+        esp.chunk(offset, data, now)
+    for f in esp.take():
+        stm.on_frame(f, now)
+    return out
+
+
+def check_pause(lib, fails):
+    content = bytes(range(256)) * 512
+    esp = Esp(lib)
+    stm = Stm(content)
+    esp.start(0)
+    for f in esp.take():
+        stm.on_frame(f, 0)
+    now = 0
+    out = bytearray()
+
+    # Ring full, nothing read for one and a half idle timeouts
+    keepalives = 0
+    while now < DL_IDLE_TIMEOUT * 3 // 2:
+        now += 5
+        sent = esp.s.credits_sent
+        run(esp, stm, now, 0)
+        if esp.s.head == stm.limit and esp.s.credits_sent > sent:
+            keepalives += 1
+    fails.check(not stm.dropped, "pause: STM32 dropped the download of a paused reader")
+    fails.check(keepalives >= DL_IDLE_TIMEOUT * 3 // 2 // LOG_STREAM_KEEPALIVE_MS - 1,
+                "pause: %d keep-alive credits" % keepalives)
+    fails.check(esp.s.stalls == 0, "pause: a paused reader counted as a link stall")
+
+    # Draining picks the transfer up again
+    while not lib.log_stream_done(esp.s) and now < 120000:
+        now += 5
+        out += run(esp, stm, now, 4096)
+    fails.check(lib.log_stream_done(esp.s) and not esp.s.failed and bytes(out) == content,
+                "pause: download did not complete after the pause")
+    print("  pause: %d s paused, %d keep-alive credits, resumed OK" % (DL_IDLE_TIMEOUT * 3 // 2 // 1000, keepalives))
+
+    # STM32 gone mid-download: stalls run out, what arrived is read out, done
+    esp = Esp(lib)
+    stm = Stm(content)
+    esp.start(0)
+    for f in esp.take():
+        stm.on_frame(f, 0)
+    now = 0
+    out = bytearray()
+    while esp.s.head < 20000:
+        now += 5
+        out += run(esp, stm, now, 4096)
+    stm.closed = True
+    gone = now
+    while not lib.log_stream_done(esp.s) and now - gone < 60000:
+        now += 5
+        out += run(esp, stm, now, 1024)
+    took = now - gone
+    fails.check(lib.log_stream_done(esp.s) and esp.s.failed, "give up: dead download never ended")
+    fails.check(took <= (LOG_STREAM_STALLS_MAX + 1) * LOG_STREAM_STALL_MS + 100, "give up: took %d ms" % took)
+    fails.check(bytes(out) == content[:len(out)], "give up: content before the failure changed")
+    esp.poll(now + 5000)
+    fails.check(not esp.take(), "give up: frames after failing")
+    print("  give up: ended %d ms after the STM32 went silent, %d bytes delivered" % (took, len(out)))
+
+
+# --- transfer ---
+
+def check_transfer(lib, fails):
+    rng = random.Random(7)
+    for size, loss, rate in ((0, 0, 0), (1, 0, 0), (LOG_STREAM_RING, 0.0, 0), (100000, 0.02, 0),
+                             (100000, 0.05, 20), (300000, 0.01, 50), (64 * 1024 + 17, 0.1, 0)):
+        content = bytes(rng.randrange(256) for _ in range(size))
+        esp = Esp(lib)
+        stm = Stm(content)
+        esp.start(0)
+        out = bytearray()
+        now = 0
+        peak = 0
+        while not lib.log_stream_done(esp.s) and now < 600000:
+            now += 5
+            for f in esp.take():
+                if rng.random() >= loss:
+                    stm.on_frame(f)
+            for offset, data in stm.burst():
+                if rng.random() >= loss:
+                    esp.chunk(offset, data, now)
+            peak = max(peak, lib.log_stream_buffered(esp.s))
+            budget = rng.randrange(0, 2 * rate * 1024 * 5 // 1000 + 1) if rate else 4096
+            out += esp.read(budget)
+            esp.poll(now)
+        ok = fails.check(lib.log_stream_done(esp.s) and bytes(out) == content,
+                         "transfer %d loss %.2f: %s" % (size, loss, "mismatch" if lib.log_stream_done(esp.s) else "stuck"))
+        fails.check(peak <= LOG_STREAM_RING, "ring overrun")
+        print("  %7d bytes loss %.2f reader %s: %5.1fs  peak %5d  resends %3d  stalls %2d  %s" % (
+            size, loss, ("%d KB/s" % rate) if rate else "free", now / 1000, peak, esp.s.resends,
+            esp.s.stalls, "OK" if ok else "FAILED"))
+
+
+def main():
+    lib = build_lib()
+    fails = host_build.Failures()
+    check_ring(lib, fails)
+    check_credit(lib, fails)
+    check_recovery(lib, fails)
+    check_pause(lib, fails)
+    check_transfer(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,603 @@
+#!/usr/bin/env python3
+import ctypes
+import glob
+import os
+import random
+import re
+import struct
+import sys
+import tempfile
+import time
+
+# Host checks for the STM32's buffered SD log writer (src/log_manager.c).
+#
+# Builds log_manager.c with the real FatFs over a RAM disk that counts
+# sector reads and writes (tools/log_host). The log task does not run on
+# its own: each tick the test runs one pass of it when it was kicked or
+# its poll interval is up, as the task's semaphore wait would, and rests
+# LOG_COALESCE_MS after writing out an error or warning.
+#
+#   caller      LogManager_Write never touches the card, whatever the level.
+#   content     every line reaches current.log once, in order, at any mix
+#               of levels and rates.
+#   sectors     steady logging costs well under one sector write per line
+#               and data sectors are written once, not rewritten per line; a
+#               burst of warnings shares its writes instead of one f_sync each.
+#   latency     an info line is on the card within 2 x LOG_FLUSH_MS plus a
+#               poll; an error line within LOG_COALESCE_MS.
+#   overflow    a writer that cannot keep up drops whole lines and says how
+#               many.
+#   rotation    the file is rotated past MAX_LOG_SIZE without losing lines.
+#   reset       what was buffered at a watchdog or software reset is written
+#               at the next boot; a power cycle loses it.
+#   records     the file is binary (lib/EcoFlowComm/log_record.h): ESP32
+#               records decode with tools/log_decode.py to the line the ESP32
+#               used to format, and a text current.log from older firmware is
+#               kept as log_N.txt.
+#   index       rotation takes its log_N number from log.idx, not by probing
+#               names, and costs the same with 999 logs on the card; each new
+#               log is one contiguous cluster run, trimmed to its size when
+#               rotated, and its directory size is the logical end, a power
+#               cut included; the oldest logs go when the card runs short of
+#               space, ending a download still reading them.
+#   seek        a download of a fragmented multi-MB file, read at random
+#               offsets as resend requests do, returns the file's bytes, and
+#               with fast seek (FF_USE_FASTSEEK) does not walk the FAT chain:
+#               compared with a build that has it off.
+#
+# Usage: python3 "Test Scripts/verify_log_writer.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+STM_DIR = os.path.join(REPO, "EcoflowSTM32F4")
+TOOLS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools")
+HOST_DIR = os.path.join(TOOLS_DIR, "log_host")
+
+sys.path.insert(0, TOOLS_DIR)
+import host_build  # noqa: E402
+import log_decode  # noqa: E402
+
+LOG_RING_SIZE = 32768
+LOG_FLUSH_MS = 1000
+LOG_POLL_MS = 250
+LOG_COALESCE_MS = 100
+MAX_LOG_SIZE = 5 * 1024 * 1024
+LOG_PREALLOC = MAX_LOG_SIZE + LOG_RING_SIZE
+LOG_MIN_FREE = 4 * MAX_LOG_SIZE
+DISK_SECTORS = 64 * 2048  # 64 MB, enough clusters for FAT32
+
+LINE = re.compile(r"^\[\d+\] \[([\w.]+)\] (.*)$")
+
+
+def build_lib(fastseek=True):
+    fatfs = os.path.join(STM_DIR, "lib", "FatFs")
+    comm = os.path.join(STM_DIR, "lib", "EcoFlowComm")
+    suffix = ""
+    if not fastseek:
+        # FatFs as it was: a copy with FF_USE_FASTSEEK off, for comparison
+        copy = os.path.join(tempfile.gettempdir(), "ecoflow_fatfs_noseek")
+        os.makedirs(copy, exist_ok=True)
+        for name in os.listdir(fatfs):
+            with open(os.path.join(fatfs, name), "rb") as f:
+                data = f.read()
+            if name == "ffconf.h":
+                data = re.sub(rb"#define FF_USE_FASTSEEK\t1", b"#define FF_USE_FASTSEEK\t0", data)
+            path = os.path.join(copy, name)
+            if not os.path.exists(path) or open(path, "rb").read() != data:
+                with open(path, "wb") as f:
+                    f.write(data)
+        fatfs = copy
+        suffix = "_noseek"
+    srcs = [os.path.join(HOST_DIR, "log_host.c"),
+            os.path.join(fatfs, "ff.c"), os.path.join(fatfs, "ffunicode.c"), os.path.join(fatfs, "ffsystem.c"),
+            os.path.join(comm, "ecoflow_protocol.c"), os.path.join(comm, "ota_crc.c"),
+            os.path.join(comm, "log_record.c"), os.path.join(comm, "log_index.c"),
+            os.path.join(comm, "log_levels.c")]
+    deps = srcs + glob.glob(os.path.join(HOST_DIR, "*.h")) + [
+        os.path.join(STM_DIR, "src", "log_manager.c"), os.path.join(STM_DIR, "src", "log_manager.h"),
+        os.path.join(fatfs, "ffconf.h"), os.path.join(comm, "log_record.h"), os.path.join(comm, "log_index.h"),
+        os.path.join(comm, "log_levels.h")]
+    u32 = ctypes.c_uint32
+    sigs = {
+        "host_disk_init": (None, [u32]),
+        "host_counters_reset": (None, []),
+        "host_counters": (None, [ctypes.POINTER(u32)]),
+        "host_set_time": (None, [u32]),
+        "host_time": (u32, []),
+        "host_log_task_kicked": (ctypes.c_int, []),
+        "host_log_task_step": (ctypes.c_int, []),
+        "host_ring_buffered": (u32, []),
+        "host_ring_dropped": (u32, []),
+        "host_downloading": (ctypes.c_int, []),
+        "host_reset": (None, [ctypes.c_int]),
+        "host_read_file": (ctypes.c_long, [ctypes.c_char_p, ctypes.POINTER(ctypes.c_uint8), u32]),
+        "host_write_file": (ctypes.c_long, [ctypes.c_char_p, ctypes.c_char_p, u32]),
+        "host_stat": (ctypes.c_int, [ctypes.c_char_p]),
+        "host_unlink": (ctypes.c_int, [ctypes.c_char_p]),
+        "host_disk_peek": (None, [u32, ctypes.POINTER(ctypes.c_uint8)]),
+        "host_capture_download": (None, [ctypes.POINTER(ctypes.c_uint8), u32]),
+        "host_write_fragmented": (ctypes.c_int, [ctypes.c_char_p, u32, u32]),
+        "LogManager_HandleDownloadReq": (None, [ctypes.c_char_p]),
+        "LogManager_SeekDownload": (None, [u32]),
+        "LogManager_HandleCredit": (None, [u32, ctypes.c_uint8]),
+        "LogManager_HandleDeleteReq": (None, [ctypes.c_char_p]),
+        "LogManager_Init": (None, []),
+        "LogManager_Process": (None, []),
+        "LogManager_Flush": (None, []),
+        "LogManager_ForceRotate": (None, []),
+        "LogManager_Write": (None, [ctypes.c_uint8, ctypes.c_char_p, ctypes.c_char_p]),
+        "LogManager_WriteRecord": (None, [ctypes.c_uint8, u32, ctypes.c_uint16, ctypes.c_char_p, ctypes.c_uint8]),
+        "log_levels_tag_id": (ctypes.c_uint16, [ctypes.c_char_p]),
+        "LogManager_SetLevel": (ctypes.c_bool, [ctypes.c_char_p, ctypes.c_uint8]),
+        "LogManager_GetLevels": (ctypes.c_int, [ctypes.POINTER(ctypes.c_uint8)]),
+        "log_arg_put_int": (ctypes.c_int, [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int64]),
+        "log_arg_put_float": (ctypes.c_int, [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_float]),
+        "log_arg_put_str": (ctypes.c_int, [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_char_p]),
+    }
+    # -Wno-format: the firmware prints uint32_t with %lu
+    flags = ["-Wall", "-Wextra", "-Werror", "-Wno-format", "-Wno-unused-parameter", "-I", HOST_DIR,
+             "-I", os.path.join(STM_DIR, "src"), "-I", fatfs, "-I", comm]
+    return host_build.build_lib(srcs, sigs, flags, "log_host" + suffix, deps)
+
+
+class Board:
+    """A fresh card and a cold boot; ticks run the log task as FreeRTOS would."""
+
+    def __init__(self, lib):
+        self.lib = lib
+        self.last_poll = 0
+        self.resting = 0
+        lib.host_reset(1)
+        lib.host_disk_init(DISK_SECTORS)
+        lib.host_set_time(0)
+        self.boot()
+
+    def boot(self):
+        self.lib.LogManager_Init()
+        self.lib.LogManager_Process()  # Session header
+        self.last_poll = self.lib.host_time()
+
+    def reset(self, power):
+        self.lib.host_reset(1 if power else 0)
+        self.boot()
+
+    def log(self, level, tag, msg):
+        self.lib.LogManager_Write(level, tag.encode(), msg.encode())
+
+    def tick(self, ms=1):
+        for _ in range(ms):
+            now = self.lib.host_time() + 1
+            self.lib.host_set_time(now)
+            if now < self.resting:
+                continue
+            if self.lib.host_log_task_kicked() or now - self.last_poll >= LOG_POLL_MS:
+                self.last_poll = now
+                if self.lib.host_log_task_step():
+                    self.resting = now + LOG_COALESCE_MS
+
+    def counters(self):
+        out = (ctypes.c_uint32 * 4)()
+        self.lib.host_counters(out)
+        return {"writes": out[0], "calls": out[1], "reads": out[2], "rewrites": out[3]}
+
+    def read(self, name="current.log", max_size=8 * 1024 * 1024):
+        buf = (ctypes.c_uint8 * max_size)()
+        n = self.lib.host_read_file(name.encode(), buf, max_size)
+        return None if n < 0 else bytes(buf[:n])
+
+    def exists(self, name):
+        return self.lib.host_stat(name.encode()) == 0
+
+    def rotate(self):
+        """ForceRotate; returns (seconds, sector reads, sector writes)."""
+        self.lib.host_counters_reset()
+        t = time.perf_counter()
+        self.lib.LogManager_ForceRotate()
+        t = time.perf_counter() - t
+        c = self.counters()
+        return t, c["reads"], c["writes"]
+
+    def sector(self, n):
+        buf = (ctypes.c_uint8 * 512)()
+        self.lib.host_disk_peek(n, buf)
+        return bytes(buf)
+
+    def chain(self, short_name):
+        """(size, clusters) of a root directory file by its 8.3 name, read off the raw card."""
+        boot = 0
+        if self.sector(0)[82:87] != b"FAT32":
+            boot = struct.unpack_from("<I", self.sector(0), 446 + 8)[0]  # First MBR partition
+        bpb = self.sector(boot)
+        per_clst = bpb[13]
+        fat = boot + struct.unpack_from("<H", bpb, 14)[0]
+        data = fat + bpb[16] * struct.unpack_from("<I", bpb, 36)[0]
+        root = struct.unpack_from("<I", bpb, 44)[0]
+
+        def next_clst(c):
+            return struct.unpack_from("<I", self.sector(fat + c * 4 // 512), c * 4 % 512)[0] & 0x0FFFFFFF
+
+        def walk(c):
+            out = []
+            while 2 <= c < 0x0FFFFFF8 and len(out) < 1 << 20:
+                out.append(c)
+                c = next_clst(c)
+            return out
+
+        want = short_name.upper().encode()
+        for c in walk(root):
+            for k in range(per_clst):
+                sec = self.sector(data + (c - 2) * per_clst + k)
+                for off in range(0, 512, 32):
+                    e = sec[off:off + 32]
+                    if e[0] in (0, 0xE5) or e[11] == 0x0F or e[:11] != want:
+                        continue
+                    start = struct.unpack_from("<H", e, 20)[0] << 16 | struct.unpack_from("<H", e, 26)[0]
+                    return struct.unpack_from("<I", e, 28)[0], walk(start), per_clst * 512
+        return None
+
+    def lines(self, name="current.log", tag="T", table=None):
+        text = log_decode.decode(self.read(name) or b"", table or {})
+        out = []
+        for raw in text.split("\n"):
+            m = LINE.match(raw)
+            if m and m.group(1) == tag:
+                out.append(m.group(2))
+        return out
+
+
+def message(i, width):
+    return ("line %06d " % i).ljust(width, "x")
+
+
+def check_caller(lib, fails):
+    print("caller")
+    b = Board(lib)
+    b.tick(2 * LOG_FLUSH_MS)
+    lib.host_counters_reset()
+    for i in range(50):
+        b.log(i % 4, "T", message(i, 60))
+    c = b.counters()
+    fails.check(c["writes"] == 0 and c["reads"] == 0, "LogManager_Write touched the card: %s" % c)
+    b.tick(LOG_POLL_MS)
+    fails.check(b.lines() == [message(i, 60) for i in range(50)], "lines missing after the log task ran")
+
+
+def check_content(lib, fails):
+    print("content")
+    b = Board(lib)
+    expect = []
+    i = 0
+    # Bursts, trickles and pauses, at every level
+    for gap, count, width in ((1, 400, 80), (20, 100, 40), (0, 60, 200), (400, 10, 30), (3, 300, 120)):
+        for _ in range(count):
+            b.log(3 if i % 7 else 1 if i % 5 == 0 else 2, "T", message(i, width))
+            expect.append(message(i, width))
+            i += 1
+            b.tick(gap)
+    b.tick(3 * LOG_FLUSH_MS)
+    got = b.lines()
+    fails.check(got == expect, "content: %d lines on card, %d logged%s" % (
+        len(got), len(expect), "" if len(got) != len(expect) else ", order differs"))
+    fails.check(lib.host_ring_buffered() == 0, "ring not drained")
+    fails.check(lib.host_ring_dropped() == 0, "lines dropped")
+
+
+def check_sectors(lib, fails):
+    print("sectors")
+    for name, level, gap, count in (("info, 2 lines/ms", 3, 0.5, 20000), ("info, 1 line/10 ms", 3, 10, 3000),
+                                    ("warning, 1 line/10 ms", 1, 10, 1000)):
+        b = Board(lib)
+        b.tick(2 * LOG_FLUSH_MS)
+        lib.host_counters_reset()
+        due = 0.0
+        for i in range(count):
+            b.log(level, "T", message(i, 60))
+            due += gap
+            if due >= 1:
+                b.tick(int(due))
+                due -= int(due)
+        b.tick(3 * LOG_FLUSH_MS)
+        c = b.counters()
+        per_line = c["writes"] / count
+        print("  %-22s %5.3f sector writes/line  %4.2f rewrites/line  %5.3f reads/line" % (
+            name, per_line, c["rewrites"] / count, c["reads"] / count))
+        fails.check(len(b.lines()) == count, "%s: %d of %d lines" % (name, len(b.lines()), count))
+        if level == 3 and gap < 1:
+            # Whole sectors: each data sector once, about one per 7 lines, plus
+            # the FAT, directory entry and FSINFO sectors once per flush
+            fails.check(per_line < 0.2, "%s: %.3f sector writes per line" % (name, per_line))
+            fails.check(c["rewrites"] / count < 0.06, "%s: data sectors rewritten" % name)
+        elif level == 3:
+            # The time bound flushes a partial sector once per LOG_FLUSH_MS
+            fails.check(per_line < 0.5, "%s: %.3f sector writes per line" % (name, per_line))
+        else:
+            # One f_sync per LOG_COALESCE_MS, not per line
+            fails.check(per_line < 1, "%s: %.3f sector writes per line" % (name, per_line))
+
+
+def check_latency(lib, fails):
+    print("latency")
+    b = Board(lib)
+    b.tick(3 * LOG_FLUSH_MS)
+    b.log(3, "T", "quiet info")
+    waited = 0
+    while "quiet info" not in b.lines() and waited < 10000:
+        b.tick(10)
+        waited += 10
+    print("  info line on card after %d ms" % waited)
+    fails.check(waited <= 2 * LOG_FLUSH_MS + LOG_POLL_MS, "info line took %d ms" % waited)
+
+    b.tick(3 * LOG_FLUSH_MS)
+    b.log(0, "T", "error")
+    b.tick(1)
+    fails.check("error" in b.lines(), "error line not written on the next pass")
+    b.log(0, "T", "second error")
+    b.tick(LOG_COALESCE_MS - 1)
+    fails.check("second error" not in b.lines(), "log task did not rest after a write")
+    b.tick(1)
+    fails.check("second error" in b.lines(), "second error not written after LOG_COALESCE_MS")
+
+
+def check_overflow(lib, fails):
+    print("overflow")
+    b = Board(lib)
+    b.tick(2 * LOG_FLUSH_MS)
+    n = 2 * LOG_RING_SIZE // 100
+    for i in range(n):
+        b.log(3, "T", message(i, 90))  # The log task never gets to run
+    dropped = lib.host_ring_dropped()
+    fails.check(dropped > 0, "nothing dropped with the ring full")
+    b.tick(LOG_POLL_MS)
+    b.log(3, "T", "after")
+    b.tick(3 * LOG_FLUSH_MS)
+    got = b.lines()
+    kept = n - dropped
+    fails.check(got[:kept] == [message(i, 90) for i in range(kept)], "kept lines damaged")
+    fails.check(got[kept:] == ["after"], "line after the overflow missing")
+    notes = b.lines(tag="LOG")
+    fails.check(notes == ["%d lines dropped" % dropped], "drop note: %s" % notes)
+
+
+def check_rotation(lib, fails):
+    print("rotation")
+    b = Board(lib)
+    width = 480
+    count = MAX_LOG_SIZE // (width + 12) + 200
+    for i in range(count):
+        b.log(3, "T", message(i, width))
+        b.tick(2)  # 250 KB/s, more than the UART can bring in
+    b.tick(3 * LOG_FLUSH_MS)
+    old = b.lines("log_0.log")
+    new = b.lines()
+    fails.check(old is not None and len(old) > 0, "no log_0.log")
+    fails.check(old + new == [message(i, width) for i in range(count)], "lines lost across the rotation: %d + %d of %d" % (
+        len(old), len(new), count))
+    size = len(b.read("log_0.log") or b"")
+    fails.check(MAX_LOG_SIZE < size <= MAX_LOG_SIZE + LOG_RING_SIZE, "rotated at %d bytes" % size)
+    fails.check("--- Firmware Versions ---" in b.lines(tag="SYS"), "no session header in the new file")
+
+
+def check_reset(lib, fails):
+    print("reset")
+    for power in (False, True):
+        b = Board(lib)
+        b.tick(2 * LOG_FLUSH_MS)
+        for i in range(20):
+            b.log(3, "T", message(i, 50))
+        b.reset(power)
+        b.tick(3 * LOG_FLUSH_MS)
+        got = b.lines()
+        notes = [m for m in b.lines(tag="SYS") if "recovered" in m]
+        if power:
+            fails.check(got == [] and notes == [], "power cycle: ring survived")
+        else:
+            fails.check(got == [message(i, 50) for i in range(20)], "reset: %d of 20 lines recovered" % len(got))
+            fails.check(len(notes) == 1, "reset: no recovery note")
+
+
+def check_records(lib, fails):
+    print("records")
+    b = Board(lib)
+    sites = [("Parser.cpp", 12, "dump", "--- Dump ---", [], "--- Dump ---"),
+             ("Parser.cpp", 13, "dump", "soc: %.2f %%", [55.5], "soc: 55.50 %"),
+             ("Parser.cpp", 14, "dump", "in %d W, out %d W, flags %u", [-120, 300000, 7],
+              "in -120 W, out 300000 W, flags 7"),
+             ("Ble.cpp", 80, "connect", "%s at %d dBm", ["DELTA 3", -71], "DELTA 3 at -71 dBm"),
+             ("Ble.cpp", 81, "connect", "%d %d %d", [1, 2], "1 2 ?")]  # One argument short
+    table = {}
+    for file, line, func, fmt, args, _ in sites:
+        fid = log_decode.fmt_id(file, line, fmt)
+        table[fid] = {"file": file, "func": func, "line": line, "fmt": fmt}
+        buf = ctypes.create_string_buffer(250)
+        pos = 0
+        for a in args:
+            if isinstance(a, float):
+                pos = lib.log_arg_put_float(buf, pos, 250, a)
+            elif isinstance(a, str):
+                pos = lib.log_arg_put_str(buf, pos, 250, a.encode())
+            else:
+                pos = lib.log_arg_put_int(buf, pos, 250, a)
+        lib.LogManager_WriteRecord(3, fid, lib.log_levels_tag_id(b"EcoflowDataParser"), buf.raw[:pos], pos)
+    b.tick(2 * LOG_FLUSH_MS)
+    fails.check((b.read() or b"").startswith(log_decode.MAGIC), "current.log does not start with the magic")
+    for file in ("Parser.cpp", "Ble.cpp"):
+        got = b.lines(tag=file, table=table)
+        want = ["%s() %s" % (func, text) for f, _, func, _, _, text in sites if f == file]
+        fails.check(got == want, "%s records decode to %s" % (file, got))
+
+    # Firmware before records left a text current.log
+    b = Board(lib)
+    lib.host_reset(0)
+    old = b"[10] [SYS] Log System Initialized\n[20] [T] old line\n"
+    lib.host_write_file(b"current.log", old, len(old))
+    b.boot()
+    b.log(3, "T", "new line")
+    b.tick(2 * LOG_FLUSH_MS)
+    fails.check(b.read("log_0.txt") == old, "text log not kept as log_0.txt")
+    fails.check(b.lines() == ["new line"], "new current.log: %s" % b.lines())
+
+
+def check_levels(lib, fails):
+    print("levels")
+    b = Board(lib)
+    b.tick(2 * LOG_FLUSH_MS)
+    lib.host_counters_reset()
+    fails.check(lib.LogManager_SetLevel(b"T", 2), "SetLevel refused")
+    fails.check(lib.LogManager_SetLevel(b"R", 1), "SetLevel refused for a record tag")
+    fails.check(not lib.LogManager_SetLevel(b"T", 6), "level 6 accepted")
+    for i in range(40):
+        b.log(1 + i % 5, "T", message(i, 40))
+        lib.LogManager_WriteRecord(3, 0x1234, lib.log_levels_tag_id(b"R"), b"", 0)
+        lib.LogManager_WriteRecord(3, 0x5678, lib.log_levels_tag_id(b"Q"), b"", 0)
+    b.tick(2 * LOG_FLUSH_MS)
+    want = [message(i, 40) for i in range(40) if 1 + i % 5 <= 2]
+    fails.check(b.lines() == want, "gated: %d lines on card, %d wanted" % (len(b.lines()), len(want)))
+    fids = [f for _, _, f, _ in log_decode.records(b.read() or b"") if f]
+    fails.check(fids == [0x5678] * 40, "records gated by tag ID: %d of R, %d of Q on card" % (
+        fids.count(0x1234), fids.count(0x5678)))
+    fails.check(b.exists("loglevel.cfg"), "levels not saved")
+
+    # Kept over a reset; a damaged file is written again with the levels in use
+    table = (ctypes.c_uint8 * 256)()
+    before = bytes(table[:lib.LogManager_GetLevels(table)])
+    saved = b.read("loglevel.cfg")
+    b.reset(False)
+    fails.check(bytes(table[:lib.LogManager_GetLevels(table)]) == before, "levels lost on reset")
+    lib.host_write_file(b"loglevel.cfg", b"junk", 4)
+    b.reset(False)
+    fails.check(bytes(table[:lib.LogManager_GetLevels(table)]) == before, "damaged loglevel.cfg loaded")
+    fails.check(b.read("loglevel.cfg") == saved, "damaged loglevel.cfg not rewritten")
+    lib.LogManager_SetLevel(b"T", 0xFF)
+    lib.LogManager_SetLevel(b"R", 0xFF)
+
+
+def check_index(lib, fails):
+    print("index")
+    b = Board(lib)
+    size, clusters, clst_bytes = b.chain("CURRENT LOG")
+    contiguous = all(y == x + 1 for x, y in zip(clusters, clusters[1:]))
+    fails.check(len(clusters) * clst_bytes >= LOG_PREALLOC and contiguous,
+                "current.log not preallocated: %d clusters%s" % (len(clusters), "" if contiguous else ", fragmented"))
+
+    # The directory entry holds the logical end, the run goes on past it; a
+    # power cut reopens the log at that end, appending into the same run
+    b.log(3, "T", "first")
+    b.tick(3 * LOG_FLUSH_MS)
+    size, kept, _ = b.chain("CURRENT LOG")
+    fails.check(size == len(b.read()) and kept == clusters, "current.log: size %d for %d bytes written, %d clusters" % (
+        size, len(b.read()), len(kept)))
+    b.reset(True)
+    b.log(3, "T", "second")
+    b.tick(3 * LOG_FLUSH_MS)
+    size2, kept, _ = b.chain("CURRENT LOG")
+    fails.check(size2 == len(b.read()) and size2 > size and kept == clusters and b.lines() == ["first", "second"],
+                "after a power cut: size %d, %d clusters, lines %s" % (size2, len(kept), b.lines()))
+
+    # 999 logs from older firmware, no index yet
+    lib.host_reset(0)
+    for i in range(999):
+        lib.host_write_file(b"log_%d.txt" % i, b"old", 3)
+    lib.host_unlink(b"log.idx")
+    b.boot()
+    b.log(3, "T", "before")
+    t_new, reads_new, writes_new = b.rotate()
+    fails.check(b.exists("log_999.log"), "rotated log not named log_999.log")
+    size, clusters, clst_bytes = b.chain("LOG_999 LOG")
+    fails.check(len(clusters) == (size + clst_bytes - 1) // clst_bytes,
+                "rotated log keeps %d clusters for %d bytes" % (len(clusters), size))
+
+    # What probing with f_stat, as rotation used to, costs on the same card
+    lib.host_counters_reset()
+    t = time.perf_counter()
+    i = 0
+    while b.exists("log_%d.txt" % i):
+        i += 1
+    t_probe = time.perf_counter() - t
+    reads_probe = b.counters()["reads"]
+    print("  rotation, 999 logs   %7.2f ms %6d sector reads %4d writes" % (t_new * 1e3, reads_new, writes_new))
+    print("  probing names        %7.2f ms %6d sector reads" % (t_probe * 1e3, reads_probe))
+    fails.check(reads_new * 10 < reads_probe, "rotation reads %d sectors, probing %d" % (reads_new, reads_probe))
+
+    # The index outlives a reset: no directory scan, the next number follows
+    b.reset(False)
+    t, reads, _ = b.rotate()
+    fails.check(b.exists("log_1000.log"), "index lost across a reset")
+    fails.check(reads <= reads_new * 2, "rotation after reset read %d sectors" % reads)
+
+    # Short of space: the oldest logs go, the newest rotated one stays
+    b = Board(lib)
+    for _ in range(3):
+        b.rotate()
+    lib.host_reset(0)
+    fill = b"\0" * (DISK_SECTORS * 512 - LOG_MIN_FREE + 6 * 1024 * 1024)  # About 14 MB left
+    fails.check(lib.host_write_file(b"fill.bin", fill, len(fill)) == len(fill), "fill not written")
+    b.boot()
+    lib.LogManager_HandleDownloadReq(b"log_0.log")
+    fails.check(lib.host_downloading(), "download of log_0.log not started")
+    b.rotate()
+    gone = [n for n in range(3) if not b.exists("log_%d.log" % n)]
+    fails.check(gone == [0, 1, 2] and b.exists("log_3.log"), "pruned %s" % gone)
+    fails.check(not lib.host_downloading(), "download left open on a pruned log")
+
+    # A deleted log is not left open under a download either
+    lib.LogManager_HandleDownloadReq(b"log_3.log")
+    lib.LogManager_HandleDeleteReq(b"log_3.log")
+    fails.check(not lib.host_downloading() and not b.exists("log_3.log"), "download left open on a deleted log")
+
+
+def check_seek(lib, fails):
+    print("seek")
+    size, piece, seeks = 4 * 1024 * 1024, 64 * 1024, 300
+    results = {}
+    for fastseek, l in ((False, build_lib(False)), (True, lib)):
+        b = Board(l)
+        l.host_reset(0)
+        fails.check(l.host_write_fragmented(b"frag.log", size, piece) == 0, "fragmented file not written")
+        b.boot()
+        got = (ctypes.c_uint8 * size)()
+        l.host_capture_download(got, size)
+        l.LogManager_HandleDownloadReq(b"frag.log")
+        rnd = random.Random(5)
+        l.host_counters_reset()
+        t = time.perf_counter()
+        for _ in range(seeks):
+            # A resend: back to an offset, credit for one chunk, one UART loop pass
+            off = rnd.randrange(0, size)
+            l.LogManager_SeekDownload(off)
+            l.LogManager_HandleCredit(off, 1)
+            l.LogManager_Process()
+        t_seek = time.perf_counter() - t
+        reads = b.counters()["reads"]
+        # Then the whole file front to back, credit for all of it
+        l.LogManager_SeekDownload(0)
+        l.LogManager_HandleCredit(size - 1, 255)
+        for _ in range(size // (8 * 200)):
+            l.LogManager_Process()
+        l.host_capture_download(None, 0)
+        want = bytes(((i * 7 + (i >> 11)) & 0xFF) for i in range(size))
+        fails.check(bytes(got) == want, "download differs from the file (fast seek %s)" % fastseek)
+        results[fastseek] = (t_seek, reads)
+        print("  fast seek %-5s %7.2f ms %7d sector reads for %d seeks" % (fastseek, t_seek * 1e3, reads, seeks))
+    fails.check(results[True][1] * 3 < results[False][1], "fast seek saves little: %d vs %d reads" % (
+        results[True][1], results[False][1]))
+
+
+def main():
+    lib = build_lib()
+    fails = host_build.Failures()
+    check_caller(lib, fails)
+    check_content(lib, fails)
+    check_sectors(lib, fails)
+    check_latency(lib, fails)
+    check_overflow(lib, fails)
+    check_rotation(lib, fails)
+    check_reset(lib, fails)
+    check_records(lib, fails)
+    check_levels(lib, fails)
+    check_index(lib, fails)
+    check_seek(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
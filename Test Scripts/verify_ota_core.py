@@ -0,0 +1,1133 @@
+#!/usr/bin/env python3
+import ctypes
+import os
+import random
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+import ota_pack  # noqa: E402
+
+# Host checks for the HAL-free OTA logic in EcoflowSTM32F4/lib/OtaCore and
+# the OTA parts of the shared EcoFlowComm library.
+#
+# Builds the libraries with gcc and drives them through ctypes against
+# Python models of the hardware they run on.
+#
+#   flash_sched   erase/program ordering against a fake F469 bank that
+#                 rejects programming unerased, already written or
+#                 unaligned words, double erases and overlapping operations;
+#                 reports the flash time against erasing the whole bank up
+#                 front.
+#   ota_crc       the bootloader's running CRC, software fallback and CRC
+#                 unit model, against the ESP32's chained ota_crc32() and
+#                 a bitwise reference, for arbitrary chunk boundaries.
+#   ota_image     raw passthrough and EFZ1 containers from tools/ota_pack.py,
+#                 decoded through the bootloader's staging ring with random
+#                 chunk cuts and flash stalls; corrupt streams are rejected.
+#                 Reports compression ratio and decode speed (a built
+#                 factory_firmware.bin is included when one is found).
+#   ota_delta     EFD1 patches between synthetic old/new image pairs (edits,
+#                 insertions, relinked code, appended data), applied against
+#                 the old image as the active bank; a wrong base is refused by
+#                 its CRC or caught by the image CRC. Reports patch sizes.
+#   ota_resume    raw, EFZ1 and EFD1 transfers reset at random points (mid
+#                 erase, mid program, between chunks) and resumed from the
+#                 progress record in the backup registers, windowed and
+#                 stop-and-wait; the image must come out whole, a torn record
+#                 or a bank that changed must start over, and a word torn
+#                 past the checkpoint must fail the image CRC.
+#   ota_rx        the receiver the bootloader and the app's OTA task share,
+#                 frame by frame: windowed transfers with lost, reordered,
+#                 duplicated and corrupt chunks, stop-and-wait retries, early
+#                 or wrong END, a patch for another image, and resets answered
+#                 by QUERY/PROGRESS and a RESUME START.
+#
+# Usage: python3 "Test Scripts/verify_ota_core.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+LIB_DIR = os.path.join(REPO, "EcoflowSTM32F4", "lib", "OtaCore")
+COMM_DIR = os.path.join(REPO, "EcoflowSTM32F4", "lib", "EcoFlowComm")
+COMM_SOURCES = ["ota_crc.c"]
+
+# RM0386 typical timings, x32 parallelism
+SECTOR_KB = [16, 16, 16, 16, 64, 128, 128, 128, 128, 128, 128, 128]
+ERASE_S = {16: 0.25, 64: 0.5, 128: 1.0}
+WORD_PROGRAM_S = 16e-6
+UART_BYTES_PER_S = 921600 / 10 * 0.85   # framing and ack overhead
+STAGE_SIZE = 240 * 512                    # bootloader staging ring
+PROGRAM_STEP = 256
+FLASH_SCHED_BANK = 0x100000
+OTA_WINDOW_CHUNK = 240
+
+FLASH_OP_NONE, FLASH_OP_ERASE, FLASH_OP_PROGRAM, FLASH_OP_DONE = range(4)
+
+
+class FlashSched(ctypes.Structure):
+    _fields_ = [("image_size", ctypes.c_uint32), ("sectors", ctypes.c_uint8),
+                ("erased", ctypes.c_uint8), ("erasing", ctypes.c_bool),
+                ("programmed", ctypes.c_uint32)]
+
+
+class OtaImage(ctypes.Structure):
+    _fields_ = [("out", ctypes.POINTER(ctypes.c_uint8)), ("out_size", ctypes.c_uint32),
+                ("wire_size", ctypes.c_uint32), ("wire_pos", ctypes.c_uint32),
+                ("image_size", ctypes.c_uint32), ("image_crc", ctypes.c_uint32),
+                ("out_pos", ctypes.c_uint32), ("base", ctypes.POINTER(ctypes.c_uint8)),
+                ("base_avail", ctypes.c_uint32), ("base_size", ctypes.c_uint32),
+                ("base_crc", ctypes.c_uint32), ("base_off", ctypes.c_uint32),
+                ("format", ctypes.c_uint8), ("error", ctypes.c_bool),
+                ("hdr", ctypes.c_uint8 * 24), ("hdr_len", ctypes.c_uint8), ("hdr_out", ctypes.c_uint8),
+                ("state", ctypes.c_uint8), ("token", ctypes.c_uint8), ("offset", ctypes.c_uint16),
+                ("run", ctypes.c_uint32)]
+
+
+OTA_IMAGE_PENDING, OTA_IMAGE_RAW, OTA_IMAGE_LZ, OTA_IMAGE_DELTA = range(4)
+
+
+class OtaResume(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint32) for name in (
+                    "file_size", "file_crc", "wire_pos", "wire_crc", "out_pos", "flash_crc", "image_size",
+                    "image_crc", "base_size", "base_crc", "base_off", "run")] + \
+               [("offset", ctypes.c_uint16), ("state", ctypes.c_uint8), ("token", ctypes.c_uint8),
+                ("format", ctypes.c_uint8), ("window_log", ctypes.c_uint8)]
+
+
+OTA_RESUME_WORDS = 16
+
+
+class OtaCrcHw(ctypes.Structure):
+    _fields_ = [("reset", ctypes.CFUNCTYPE(None)),
+                ("feed", ctypes.CFUNCTYPE(ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint32))]
+
+
+class OtaCrcState(ctypes.Structure):
+    _fields_ = [("hw", ctypes.c_void_p), ("reg", ctypes.c_uint32), ("carry", ctypes.c_uint8 * 4),
+                ("carry_len", ctypes.c_uint8), ("length", ctypes.c_uint32)]
+
+
+RX_ERASE_START = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint8)
+RX_ERASE_POLL = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p)
+RX_PROGRAM = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.c_void_p, ctypes.c_uint32,
+                              ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint32)
+RX_REPLY = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint8)
+RX_IDLE = ctypes.CFUNCTYPE(None, ctypes.c_void_p)
+
+
+class OtaRxPort(ctypes.Structure):
+    _fields_ = [("erase_start", RX_ERASE_START), ("erase_poll", RX_ERASE_POLL), ("program", RX_PROGRAM),
+                ("reply", RX_REPLY), ("idle", RX_IDLE), ("log", ctypes.c_void_p),
+                ("stage", ctypes.POINTER(ctypes.c_uint8)), ("stage_size", ctypes.c_uint32),
+                ("bank", ctypes.POINTER(ctypes.c_uint8)), ("base", ctypes.POINTER(ctypes.c_uint8)),
+                ("base_size", ctypes.c_uint32), ("crc_hw", ctypes.c_void_p),
+                ("record", ctypes.POINTER(ctypes.c_uint32)), ("window_max", ctypes.c_uint8)]
+
+
+class OtaRx(ctypes.Structure):
+    _fields_ = [("port", ctypes.c_void_p), ("user", ctypes.c_void_p),
+                ("started", ctypes.c_bool), ("verified", ctypes.c_bool), ("failed", ctypes.c_bool),
+                ("end_pending", ctypes.c_bool), ("end_crc", ctypes.c_uint32),
+                ("window", ctypes.c_uint8), ("flags", ctypes.c_uint8), ("win_base", ctypes.c_uint16),
+                ("win_sack", ctypes.c_uint32), ("legacy_end", ctypes.c_uint32),
+                ("received", ctypes.c_uint32), ("chunks", ctypes.c_uint32),
+                ("wire", (ctypes.c_uint8 * 240) * 32), ("wire_len", ctypes.c_uint8 * 32),
+                ("dec_seq", ctypes.c_uint16), ("dec_off", ctypes.c_uint8),
+                ("image", OtaImage), ("wire_crc", ctypes.c_uint32), ("sched", FlashSched),
+                ("flash_crc", OtaCrcState), ("resume", OtaResume), ("resume_on", ctypes.c_bool),
+                ("resume_pending", ctypes.c_bool), ("resume_next", ctypes.c_uint32)]
+
+
+CMD_OTA_START, CMD_OTA_CHUNK, CMD_OTA_END = 0xA0, 0xA1, 0xA2
+CMD_OTA_APPLY, CMD_OTA_WCHUNK, CMD_OTA_WACK = 0xA3, 0xA4, 0xA5
+CMD_OTA_QUERY, CMD_OTA_PROGRESS = 0xA6, 0xA7
+CMD_OTA_ACK, CMD_OTA_NACK = 0x06, 0x15
+OTA_FLAG_CHUNK_CRC, OTA_FLAG_RESUME = 0x01, 0x02
+OTA_WINDOW_MAX = 16
+
+
+def build_lib():
+    sources = [os.path.join(LIB_DIR, f) for f in sorted(os.listdir(LIB_DIR)) if f.endswith(".c")]
+    sources += [os.path.join(COMM_DIR, f) for f in COMM_SOURCES]
+    deps = [os.path.join(LIB_DIR, f) for f in os.listdir(LIB_DIR)] + [os.path.join(COMM_DIR, f) for f in os.listdir(COMM_DIR)]
+    u8p = ctypes.POINTER(ctypes.c_uint8)
+    u32p = ctypes.POINTER(ctypes.c_uint32)
+    sigs = {
+        "flash_sched_init": (ctypes.c_bool, [ctypes.POINTER(FlashSched), ctypes.c_uint32]),
+        "flash_sched_resume": (ctypes.c_bool, [ctypes.POINTER(FlashSched), ctypes.c_uint32, ctypes.c_uint32]),
+        "flash_sched_next": (ctypes.c_int, [ctypes.POINTER(FlashSched), ctypes.c_uint32, ctypes.c_uint32, u8p, u32p]),
+        "flash_sched_erase_done": (None, [ctypes.POINTER(FlashSched)]),
+        "flash_sched_program_done": (None, [ctypes.POINTER(FlashSched), ctypes.c_uint32]),
+        "flash_sched_sector_start": (ctypes.c_uint32, [ctypes.c_uint8]),
+        "ota_crc32": (ctypes.c_uint32, [ctypes.c_uint32, u8p, ctypes.c_uint32]),
+        "ota_crc_begin": (None, [ctypes.c_void_p, ctypes.POINTER(OtaCrcHw)]),
+        "ota_crc_update": (None, [ctypes.c_void_p, u8p, ctypes.c_uint32]),
+        "ota_crc_value": (ctypes.c_uint32, [ctypes.c_void_p]),
+        "ota_image_begin": (None, [ctypes.POINTER(OtaImage), ctypes.c_uint32, u8p, ctypes.c_uint32]),
+        "ota_image_set_base": (None, [ctypes.POINTER(OtaImage), u8p, ctypes.c_uint32]),
+        "ota_image_feed": (ctypes.c_uint32, [ctypes.POINTER(OtaImage), u8p, ctypes.c_uint32, ctypes.c_uint32]),
+        "ota_image_sized": (ctypes.c_bool, [ctypes.POINTER(OtaImage)]),
+        "ota_image_done": (ctypes.c_bool, [ctypes.POINTER(OtaImage)]),
+        "ota_resume_point": (ctypes.c_bool, [ctypes.POINTER(OtaImage)]),
+        "ota_resume_capture": (None, [ctypes.POINTER(OtaResume), ctypes.POINTER(OtaImage)]),
+        "ota_resume_apply": (None, [ctypes.POINTER(OtaResume), ctypes.POINTER(OtaImage), u8p]),
+        "ota_resume_pack": (None, [ctypes.POINTER(OtaResume), u32p]),
+        "ota_resume_unpack": (ctypes.c_bool, [ctypes.POINTER(OtaResume), u32p]),
+        "ota_rx_init": (None, [ctypes.POINTER(OtaRx), ctypes.POINTER(OtaRxPort), ctypes.c_void_p]),
+        "ota_rx_frame": (ctypes.c_bool, [ctypes.POINTER(OtaRx), ctypes.c_uint8, u8p, ctypes.c_uint8]),
+        "ota_rx_frame_error": (None, [ctypes.POINTER(OtaRx)]),
+        "ota_rx_poll": (ctypes.c_bool, [ctypes.POINTER(OtaRx)]),
+    }
+    return host_build.build_lib(sources, sigs, ["-Wall", "-Werror", "-I", LIB_DIR, "-I", COMM_DIR], "ota_core", deps)
+
+
+# --- flash_sched ---
+
+class FakeBank:
+    """One F469 bank. Every operation is checked against the flash rules."""
+
+    def __init__(self, fails):
+        self.fails = fails
+        self.starts = [sum(SECTOR_KB[:i]) * 1024 for i in range(len(SECTOR_KB) + 1)]
+        self.erased = [False] * len(SECTOR_KB)
+        self.erase_count = [0] * len(SECTOR_KB)
+        self.written_to = 0      # Programs must be contiguous from 0
+        self.busy_until = 0.0
+        self.log = []
+
+    def sector_of(self, offset):
+        for i in range(len(SECTOR_KB)):
+            if offset < self.starts[i + 1]:
+                return i
+        return None
+
+    def erase(self, t, sector):
+        self.fails.check(t >= self.busy_until, "erase started while flash busy")
+        self.erase_count[sector] += 1
+        self.erased[sector] = True
+        self.busy_until = t + ERASE_S[SECTOR_KB[sector]]
+        self.log.append(("E", sector, t))
+        return self.busy_until
+
+    def program(self, t, offset, length):
+        self.fails.check(t >= self.busy_until, "program started while flash busy")
+        self.fails.check(offset == self.written_to, "program at %d, expected %d" % (offset, self.written_to))
+        self.fails.check(offset % 4 == 0, "program at unaligned offset %d" % offset)
+        for s in range(self.sector_of(offset), self.sector_of(offset + length - 1) + 1):
+            self.fails.check(self.erased[s], "program into unerased sector %d" % s)
+        self.written_to = offset + length
+        self.busy_until = t + (length + 3) // 4 * WORD_PROGRAM_S
+        self.log.append(("P", offset, length))
+        return self.busy_until
+
+
+def run_sched(lib, fails, size, stalls=()):
+    """Streams `size` bytes into the bootloader pipeline model.
+    stalls: (start_s, end_s) windows with no UART data. Returns seconds."""
+    s = FlashSched()
+    if not fails.check(lib.flash_sched_init(ctypes.byref(s), size), "init refused %d bytes" % size):
+        return 0.0
+    bank = FakeBank(fails)
+    t, dt = 0.0, 0.0005
+    received = 0.0
+    sector, length = ctypes.c_uint8(), ctypes.c_uint32()
+
+    while True:
+        if not any(a <= t < b for a, b in stalls):
+            room = s.programmed + STAGE_SIZE - received
+            received += min(UART_BYTES_PER_S * dt, room, size - received)
+
+        # Flash steps as fast as the controller allows within this tick
+        while bank.busy_until <= t + dt:
+            now = max(t, bank.busy_until)
+            if s.erasing:
+                lib.flash_sched_erase_done(ctypes.byref(s))
+                continue
+            pos = s.programmed % STAGE_SIZE
+            max_len = min(PROGRAM_STEP, STAGE_SIZE - pos)
+            op = lib.flash_sched_next(ctypes.byref(s), int(received), max_len,
+                                      ctypes.byref(sector), ctypes.byref(length))
+            if op == FLASH_OP_ERASE:
+                bank.erase(now, sector.value)
+            elif op == FLASH_OP_PROGRAM:
+                fails.check(0 < length.value <= max_len, "program length %d" % length.value)
+                fails.check(s.programmed + length.value <= int(received), "programmed unstaged data")
+                bank.program(now, s.programmed, length.value)
+                lib.flash_sched_program_done(ctypes.byref(s), length.value)
+            elif op == FLASH_OP_DONE:
+                done_at = max(now, bank.busy_until)
+                covered = bank.sector_of(size - 1) + 1
+                fails.check(bank.written_to == size, "image incomplete: %d/%d" % (bank.written_to, size))
+                fails.check(bank.erase_count[:covered] == [1] * covered,
+                            "sectors not erased exactly once: %s" % bank.erase_count)
+                fails.check(not any(bank.erase_count[covered:]), "erased beyond the image: %s" % bank.erase_count)
+                return done_at
+            else:
+                break
+        t += dt
+        if not fails.check(t < 120, "pipeline stuck at %d/%d bytes (size %d)" % (s.programmed, received, size)):
+            return t
+
+
+def check_flash_sched(lib, fails):
+    print("flash_sched")
+    fails.check(lib.flash_sched_sector_start(12) == 0x100000, "bank size")
+    fails.check(lib.flash_sched_sector_start(5) == 0x20000, "sector 5 start")
+    s = FlashSched()
+    fails.check(not lib.flash_sched_init(ctypes.byref(s), 0x100001), "oversized image accepted")
+
+    boundaries = [1, 3, 4, 240, 0x4000 - 1, 0x4000, 0x4000 + 1, 0x10000, 0x20000,
+                  0x20000 + 3, 0x40000, 0x100000 - 2, 0x100000]
+    rng = random.Random(1)
+    for size in boundaries + [rng.randrange(1, 0x100000) for _ in range(6)]:
+        run_sched(lib, fails, size)
+
+    # The UART pauses: the scheduler should erase ahead meanwhile
+    run_sched(lib, fails, 0x80000, stalls=[(0.5, 3.0)])
+
+    # Resumed: sectors holding programmed bytes stay, the rest is erased again
+    for programmed, erased in ((0, 0), (1, 1), (0x4000, 1), (0x4001, 2), (0x20000, 5), (0x30000, 6)):
+        fails.check(lib.flash_sched_resume(ctypes.byref(s), 0x40000, programmed) and
+                    s.erased == erased and s.programmed == programmed,
+                    "resume at %d: %d sectors erased" % (programmed, s.erased))
+    fails.check(not lib.flash_sched_resume(ctypes.byref(s), 0x4000, 0x4001), "resume past the image accepted")
+
+    print("  %-8s %12s %12s" % ("image", "lazy erase", "erase all"))
+    erase_all = sum(ERASE_S[kb] for kb in SECTOR_KB)
+    for size in (64 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024):
+        lazy = run_sched(lib, fails, size)
+        print("  %-8s %11.2fs %11.2fs" % ("%dK" % (size // 1024), lazy, erase_all + size / UART_BYTES_PER_S))
+
+
+# --- ota_crc ---
+
+def crc32_reference(data):
+    """CRC-32/BZIP2, bit by bit."""
+    reg = 0xFFFFFFFF
+    for b in data:
+        reg ^= b << 24
+        for _ in range(8):
+            reg = ((reg << 1) ^ 0x04C11DB7) if reg & 0x80000000 else (reg << 1)
+            reg &= 0xFFFFFFFF
+    return reg ^ 0xFFFFFFFF
+
+
+class CrcUnitModel:
+    """STM32F4 CRC unit (RM0386 sec. 4): 32-bit words, MSB first, reset to
+    0xFFFFFFFF, no final XOR. The bootloader hook byte-swaps each word."""
+
+    def __init__(self):
+        self.dr = 0xFFFFFFFF
+        self.words = 0
+        self.hw = OtaCrcHw(OtaCrcHw._fields_[0][1](self.reset), OtaCrcHw._fields_[1][1](self.feed))
+
+    def reset(self):
+        self.dr = 0xFFFFFFFF
+
+    def feed(self, data, words):
+        raw = ctypes.string_at(data, words * 4)
+        for i in range(words):
+            word = int.from_bytes(raw[i * 4:i * 4 + 4], "big")   # __REV of the LE load
+            self.dr ^= word
+            for _ in range(32):
+                self.dr = ((self.dr << 1) ^ 0x04C11DB7) if self.dr & 0x80000000 else (self.dr << 1)
+                self.dr &= 0xFFFFFFFF
+        self.words += words
+        return self.dr
+
+
+def u8buf(data):
+    return (ctypes.c_uint8 * max(len(data), 1)).from_buffer_copy(bytes(data) or b"\0")
+
+
+def at(buf, offset):
+    return ctypes.cast(ctypes.addressof(buf) + offset, ctypes.POINTER(ctypes.c_uint8))
+
+
+def random_splits(rng, n):
+    """Cut points for n bytes: empty, 1-3 byte and large pieces."""
+    cuts, pos = [], 0
+    while pos < n:
+        step = rng.choice([0, 1, 2, 3, 4, 5, 200, 240, rng.randrange(1, 700)])
+        pos = min(n, pos + step)
+        cuts.append(pos)
+    return cuts
+
+
+def check_ota_crc(lib, fails):
+    print("ota_crc")
+    fails.check(lib.ota_crc32(0, u8buf(b"123456789"), 9) == 0xFC891918, "CRC-32/BZIP2 check value")
+    fails.check(lib.ota_crc32(0, u8buf(b""), 0) == 0, "empty stream")
+
+    rng = random.Random(2)
+    state = ctypes.create_string_buffer(64)
+    unit = CrcUnitModel()
+    for trial in range(300):
+        n = rng.choice([0, 1, 3, 4, 5, 239, 240, 241, rng.randrange(0, 6000)])
+        data = bytes(rng.randrange(256) for _ in range(n))
+        ref = crc32_reference(data)
+
+        # ESP32 side: chained ota_crc32() over its 200 / 240 byte reads
+        for step in (200, 240):
+            crc = 0
+            for i in range(0, n, step):
+                piece = data[i:i + step]
+                crc = lib.ota_crc32(crc, u8buf(piece), len(piece))
+            fails.check(crc == ref, "ESP chained CRC, %d bytes in %d" % (n, step))
+
+        # Bootloader side: running CRC, software fallback and CRC unit
+        for hw in (None, unit):
+            lib.ota_crc_begin(state, ctypes.byref(hw.hw) if hw else None)
+            prev = 0
+            for cut in random_splits(rng, n):
+                lib.ota_crc_update(state, u8buf(data[prev:cut]), cut - prev)
+                prev = cut
+                # A mid-stream value must not disturb the rest of the stream
+                if rng.random() < 0.1:
+                    fails.check(lib.ota_crc_value(state) == crc32_reference(data[:cut]),
+                                "mid-stream value at %d/%d (%s)" % (cut, n, "unit" if hw else "software"))
+            fails.check(lib.ota_crc_value(state) == ref,
+                        "running CRC, %d bytes (%s)" % (n, "unit" if hw else "software"))
+    fails.check(unit.words > 0, "CRC unit model never used")
+
+
+# --- ota_image ---
+
+def firmware_like(rng, size):
+    """Stand-in for an F469 image: Thumb-ish code, string tables, sparse
+    glyph bitmaps and erased padding, in the proportions of the real build."""
+    ops = [rng.randrange(0x10000).to_bytes(2, "little") for _ in range(600)]
+    words = [w.encode() for w in ("ecoflow", "battery", "voltage", "error", "lv_obj", "status",
+                                  "ota", "log", "uart", "temp", "%d", "%s", "0x%08X", "\n")]
+    out = bytearray()
+    while len(out) < size:
+        kind = rng.random()
+        if kind < 0.6:
+            for _ in range(rng.randrange(16, 512)):
+                out += rng.choice(ops)
+                if rng.random() < 0.1:
+                    out += rng.randrange(1 << 32).to_bytes(4, "little")
+        elif kind < 0.75:
+            for _ in range(rng.randrange(4, 64)):
+                out += b" ".join(rng.choice(words) for _ in range(rng.randrange(1, 6))) + b"\0"
+        elif kind < 0.95:
+            for _ in range(rng.randrange(64, 1024)):
+                out.append(rng.choice((0, 0, 0, 0, 0xFF, 0x0F, 0xF0, rng.randrange(256))))
+        else:
+            out += b"\xff" * rng.randrange(256, 4096)
+    out[0:4] = (0x20050000).to_bytes(4, "little")     # initial SP, as the bootloader checks
+    return bytes(out[:size])
+
+
+def decode_image(lib, wire, ring_size, rng=None, cuts=None, base=None):
+    """Runs `wire` through the decoder as the bootloader does: pieces as
+    they arrive, output bounded by the programmed pointer, the flash draining
+    a random amount of the ring between calls. `base` stands in for the
+    active bank. Returns (image, OtaImage)."""
+    ring = (ctypes.c_uint8 * ring_size)()
+    im = OtaImage()
+    lib.ota_image_begin(ctypes.byref(im), len(wire), ring, ring_size)
+    if base is not None:
+        base_buf = u8buf(base)
+        lib.ota_image_set_base(ctypes.byref(im), base_buf, len(base))
+    src = u8buf(wire)
+    flash = bytearray()
+
+    def drain(everything):
+        staged = im.out_pos - len(flash)
+        take = staged if everything or rng is None else rng.randrange(staged + 1)
+        for _ in range(take):
+            flash.append(ring[len(flash) % ring_size])
+
+    prev = 0
+    for cut in (cuts if cuts is not None else [len(wire)]):
+        while prev < cut and not im.error:
+            used = lib.ota_image_feed(ctypes.byref(im), at(src, prev), cut - prev,
+                                      len(flash) + ring_size)
+            prev += used
+            if used == 0 and im.out_pos == len(flash):
+                break      # Refused input with nothing left to program: stuck
+            drain(used == 0)
+    # A back-reference may still be waiting for room
+    while not im.error:
+        drain(True)
+        before = im.out_pos
+        lib.ota_image_feed(ctypes.byref(im), src, 0, len(flash) + ring_size)
+        if im.out_pos == before:
+            break
+    return bytes(flash), im
+
+
+def check_ota_image(lib, fails):
+    print("ota_image")
+    rng = random.Random(3)
+
+    # Raw images pass through untouched, whatever the cuts and stalls
+    for n in (0, 1, 3, 4, 5, 240, 20000):
+        data = bytes(rng.randrange(256) for _ in range(n))
+        for trial in range(3):
+            out, im = decode_image(lib, data, 4096, rng, random_splits(rng, n))
+            fails.check(not im.error and lib.ota_image_done(ctypes.byref(im)), "raw %d: not done" % n)
+            fails.check(im.format == OTA_IMAGE_RAW and out == data, "raw %d: output differs" % n)
+
+    # Containers, against the bootloader's ring and a small one
+    images = [firmware_like(rng, n) for n in (1, 13, 300, 64 * 1024)]
+    images.append(b"\0" * 70000)                       # matches far longer than the ring room
+    images.append(bytes(rng.randrange(256) for _ in range(5000)))   # incompressible
+    for data in images:
+        for window_log, ring_size in ((16, STAGE_SIZE), (12, 4096), (8, 256)):
+            wire = ota_pack.pack(data, window_log)
+            for trial in range(2):
+                out, im = decode_image(lib, wire, ring_size, rng, random_splits(rng, len(wire)))
+                what = "EFZ1 %d bytes, window 2^%d, ring %d" % (len(data), window_log, ring_size)
+                fails.check(not im.error and lib.ota_image_done(ctypes.byref(im)), what + ": not done")
+                fails.check(im.format == OTA_IMAGE_LZ and out == data, what + ": output differs")
+                fails.check(im.image_crc == lib.ota_crc32(0, u8buf(data), len(data)), what + ": header CRC")
+
+    # Corrupt or unsupported streams stop the decoder instead of writing garbage
+    data = images[3]
+    wire = bytearray(ota_pack.pack(data, 16))
+    bad = {
+        "truncated": bytes(wire[:-7]),
+        "trailing bytes": bytes(wire) + b"\0",
+        "window larger than the ring": bytes(ota_pack.pack(data, 16)),
+        "zero image size": bytes(wire[:4]) + b"\0\0\0\0" + bytes(wire[8:]),
+        "offset before the image": bytes(wire[:16]) + bytes([0x10, 0x41, 0x05, 0x00]) + bytes(wire[20:]),
+    }
+    for what, stream in bad.items():
+        ring = 4096 if what == "window larger than the ring" else STAGE_SIZE
+        out, im = decode_image(lib, stream, ring, rng, random_splits(rng, len(stream)))
+        fails.check(im.error and not lib.ota_image_done(ctypes.byref(im)), "%s accepted" % what)
+
+    # Ratio and decode speed; one call per 240 byte chunk, like the windowed path
+    samples = [("firmware-like 256K", firmware_like(random.Random(4), 256 * 1024))]
+    factory = os.path.join(REPO, "EcoflowSTM32F4", "factory_firmware.bin")
+    if os.path.exists(factory):
+        with open(factory, "rb") as f:
+            samples.append(("factory_firmware.bin", f.read()))
+    print("  %-20s %9s %9s %7s %10s" % ("image", "raw", "EFZ1", "ratio", "decode"))
+    for name, data in samples:
+        wire = ota_pack.pack(data, 16)
+        ring = (ctypes.c_uint8 * STAGE_SIZE)()
+        im = OtaImage()
+        src = u8buf(wire)
+        best = None
+        for _ in range(3):
+            lib.ota_image_begin(ctypes.byref(im), len(wire), ring, STAGE_SIZE)
+            start = time.perf_counter()
+            for pos in range(0, len(wire), 240):
+                # The flash keeps up: all of the ring is free
+                lib.ota_image_feed(ctypes.byref(im), at(src, pos), min(240, len(wire) - pos),
+                                   im.out_pos + STAGE_SIZE)
+            while im.out_pos < im.image_size and not im.error:
+                lib.ota_image_feed(ctypes.byref(im), src, 0, im.out_pos + STAGE_SIZE)
+            elapsed = time.perf_counter() - start
+            best = elapsed if best is None else min(best, elapsed)
+        fails.check(lib.ota_image_done(ctypes.byref(im)), "%s: decode incomplete" % name)
+        print("  %-20s %9d %9d %6.1f%% %7.1fMB/s" % (name, len(data), len(wire),
+                                                     100.0 * len(wire) / len(data), len(data) / best / 1e6))
+        print("  %-20s link time at 921600: %.2fs -> %.2fs" % ("", len(data) / UART_BYTES_PER_S,
+                                                                len(wire) / UART_BYTES_PER_S))
+
+
+# --- ota_delta ---
+
+def relinked(rng, image, every):
+    """image with a 4-byte word changed every ~`every` bytes, like branch
+    targets and literal pools after code moved."""
+    out = bytearray(image)
+    pos = rng.randrange(every)
+    while pos + 4 <= len(out):
+        out[pos:pos + 4] = rng.randrange(1 << 32).to_bytes(4, "little")
+        pos += rng.randrange(every // 2, every * 3 // 2) & ~3
+    return bytes(out)
+
+
+def check_ota_delta(lib, fails):
+    print("ota_delta")
+    rng = random.Random(5)
+    old = firmware_like(rng, 192 * 1024)
+    mid = len(old) // 2
+
+    def insert(at, n):
+        return old[:at] + firmware_like(rng, n) + old[at:]
+
+    pairs = [
+        ("identical", old),
+        ("100 B edit", old[:mid] + bytes(100) + old[mid + 100:]),
+        ("2 KB inserted", insert(mid, 2048)),
+        ("2 KB removed", old[:mid] + old[mid + 2048:]),
+        ("moved + relinked", relinked(rng, insert(10000, 512), 400)),
+        ("10% relinked", relinked(rng, old, 40)),
+        ("16 KB appended", old + firmware_like(rng, 16 * 1024)),
+        ("unrelated", firmware_like(rng, 160 * 1024)),
+    ]
+    print("  %-18s %9s %9s %9s %8s" % ("change", "image", "EFZ1", "EFD1", "patch"))
+    for name, new in pairs:
+        patch = ota_pack.pack(new, 16, old)
+        efz = ota_pack.pack(new, 16)
+        for ring_size in (STAGE_SIZE, 4096):
+            window_patch = patch if ring_size == STAGE_SIZE else ota_pack.pack(new, 12, old)
+            out, im = decode_image(lib, window_patch, ring_size, rng, random_splits(rng, len(window_patch)), old)
+            what = "%s, ring %d" % (name, ring_size)
+            fails.check(not im.error and lib.ota_image_done(ctypes.byref(im)), what + ": not done")
+            fails.check(im.format == OTA_IMAGE_DELTA and out == new, what + ": output differs")
+        fails.check(im.base_size == len(old) and im.base_crc == lib.ota_crc32(0, u8buf(old), len(old)),
+                    name + ": base header")
+        print("  %-18s %9d %9d %9d %7.1f%%" % (name, len(new), len(efz), len(patch), 100.0 * len(patch) / len(new)))
+
+    new = pairs[2][1]
+    patch = ota_pack.pack(new, 16, old)
+    # No base, or a bank too small for it: refused at the header
+    out, im = decode_image(lib, patch, STAGE_SIZE)
+    fails.check(im.error and im.out_pos == 0, "patch decoded without a base")
+    out, im = decode_image(lib, patch, STAGE_SIZE, base=old[:-1])
+    fails.check(im.error and im.out_pos == 0, "patch accepted a short base")
+
+    # A bank holding something else: the bootloader's BaseCRC32 check refuses
+    # it, and an image built from it anyway fails the image CRC
+    other = bytearray(old)
+    other[mid + 4096] ^= 0x55
+    fails.check(lib.ota_crc32(0, u8buf(other), len(other)) != im.base_crc, "base CRC misses a changed base")
+    out, im = decode_image(lib, patch, STAGE_SIZE, base=bytes(other))
+    fails.check(lib.ota_crc32(0, u8buf(out), len(out)) != im.image_crc, "image CRC misses a wrong base")
+
+    # Base references past the base the patch names
+    bad = bytearray(ota_pack.DELTA_HEADER.pack(ota_pack.MAGIC_DELTA, 64, 0, 16, 32, 0))
+    bad += bytes([0x00, 0x00, 0x00]) + (30).to_bytes(4, "little") + bytes([0x00])
+    out, im = decode_image(lib, bytes(bad), STAGE_SIZE, base=old)
+    fails.check(im.error, "base match past BaseSize accepted")
+
+
+# --- ota_resume ---
+
+class ResumeBoot:
+    """Bootloader model for ota_resume: decoder, flash pipeline and progress
+    record as in Bootloader_OTA_Loop, on a bank that keeps its contents and a
+    backup-register record that survive a reset."""
+
+    def __init__(self, lib, fails, wire, base, ring_size, interval):
+        self.lib, self.fails = lib, fails
+        self.wire, self.base = wire, base
+        self.file_crc = ota_pack.crc32(wire)
+        self.ring_size, self.interval = ring_size, interval
+        self.bank = bytearray(b"\xff" * FLASH_SCHED_BANK)
+        self.bkp = [0] * OTA_RESUME_WORDS
+        self.base_buf = u8buf(base) if base else None
+
+    def start(self, want_resume):
+        """START: returns the file offset the transfer continues from."""
+        lib = self.lib
+        self.im = OtaImage()
+        self.ring = (ctypes.c_uint8 * self.ring_size)()
+        lib.ota_image_begin(ctypes.byref(self.im), len(self.wire), self.ring, self.ring_size)
+        if self.base_buf:
+            lib.ota_image_set_base(ctypes.byref(self.im), self.base_buf, len(self.base))
+        self.sched = FlashSched()
+        self.crc = ctypes.create_string_buffer(64)
+        lib.ota_crc_begin(self.crc, None)
+        self.wire_crc = 0
+        self.pending = None
+        self.next_point = self.interval
+        self.failed = False
+        self.erasing = None
+        if want_resume and self.restore():
+            return self.im.wire_pos
+        self.bkp[0] = 0
+        return 0
+
+    def restore(self):
+        lib = self.lib
+        r = OtaResume()
+        if not lib.ota_resume_unpack(ctypes.byref(r), (ctypes.c_uint32 * OTA_RESUME_WORDS)(*self.bkp)):
+            return False
+        if r.file_size != len(self.wire) or r.file_crc != self.file_crc:
+            return False
+        bank = u8buf(self.bank)
+        lib.ota_crc_update(self.crc, bank, r.out_pos)
+        if (lib.ota_crc_value(self.crc) != r.flash_crc or
+                not lib.flash_sched_resume(ctypes.byref(self.sched), r.image_size, r.out_pos)):
+            lib.ota_crc_begin(self.crc, None)
+            self.sched = FlashSched()
+            return False
+        lib.ota_resume_apply(ctypes.byref(r), ctypes.byref(self.im), bank)
+        self.wire_crc = r.wire_crc
+        self.next_point = r.out_pos + self.interval
+        return True
+
+    def feed(self, data):
+        """Image_Feed + Resume_Capture."""
+        lib, im = self.lib, self.im
+        sized = lib.ota_image_sized(ctypes.byref(im))
+        used = lib.ota_image_feed(ctypes.byref(im), u8buf(data), len(data), self.sched.programmed + self.ring_size)
+        self.wire_crc = lib.ota_crc32(self.wire_crc, u8buf(data[:used]), used)
+        if not sized and lib.ota_image_sized(ctypes.byref(im)):
+            self.failed = not lib.flash_sched_init(ctypes.byref(self.sched), im.image_size)
+        if im.error:
+            self.failed = True
+            self.bkp[0] = 0
+        if (self.pending is None and im.out_pos >= self.next_point and im.wire_pos % OTA_WINDOW_CHUNK == 0 and
+                lib.ota_resume_point(ctypes.byref(im))):
+            r = OtaResume()
+            lib.ota_resume_capture(ctypes.byref(r), ctypes.byref(im))
+            r.file_size, r.file_crc, r.wire_crc = len(self.wire), self.file_crc, self.wire_crc
+            self.pending = r
+        return used
+
+    def commit(self):
+        r = self.pending
+        r.flash_crc = self.lib.ota_crc_value(self.crc)
+        words = (ctypes.c_uint32 * OTA_RESUME_WORDS)()
+        self.lib.ota_resume_pack(ctypes.byref(r), words)
+        self.bkp = list(words)
+        self.pending = None
+        self.next_point = r.out_pos + self.interval
+
+    def flash_step(self):
+        """Flash_Pipeline_Step; an erase completes on the next call."""
+        lib, s = self.lib, self.sched
+        if s.erasing:
+            a, b = self.erasing
+            self.bank[a:b] = b"\xff" * (b - a)
+            lib.flash_sched_erase_done(ctypes.byref(s))
+            self.erasing = None
+            return FLASH_OP_ERASE
+        if self.failed:
+            return FLASH_OP_NONE
+        if self.pending is not None and s.programmed == self.pending.out_pos:
+            self.commit()
+        staged = self.im.out_pos
+        if self.pending is not None:
+            staged = min(staged, self.pending.out_pos)
+        pos = s.programmed % self.ring_size
+        max_len = min(PROGRAM_STEP, self.ring_size - pos)
+        sector, length = ctypes.c_uint8(), ctypes.c_uint32()
+        op = lib.flash_sched_next(ctypes.byref(s), staged, max_len, ctypes.byref(sector), ctypes.byref(length))
+        if op == FLASH_OP_ERASE:
+            self.erasing = (lib.flash_sched_sector_start(sector.value), lib.flash_sched_sector_start(sector.value + 1))
+        elif op == FLASH_OP_PROGRAM:
+            self.program(s.programmed, bytes(self.ring[pos:pos + length.value]))
+            lib.ota_crc_update(self.crc, u8buf(self.bank[s.programmed:s.programmed + length.value]), length.value)
+            lib.flash_sched_program_done(ctypes.byref(s), length.value)
+        return op
+
+    def program(self, addr, data):
+        """Program_Chunk: words that already hold their value are skipped;
+        programming can only clear bits."""
+        self.fails.check(addr % 4 == 0, "unaligned program at %d" % addr)
+        for i in range(0, len(data), 4):
+            word = data[i:i + 4].ljust(4, b"\xff")
+            old = self.bank[addr + i:addr + i + 4]
+            if old != word:
+                self.bank[addr + i:addr + i + 4] = bytes(a & b for a, b in zip(old, word))
+
+    def reset(self, rng, torn=False):
+        """Power cut: RAM is lost, an erase in progress leaves its sector
+        in an unknown state, the bank and the record stay. `torn`: the cut
+        lands in a program and leaves the next word half written."""
+        if self.erasing:
+            a, b = self.erasing
+            self.bank[a:b] = bytes(rng.randrange(256) for _ in range(b - a))
+        elif torn and self.sched.programmed + 4 <= self.sched.image_size:
+            a = self.sched.programmed
+            self.bank[a:a + 4] = bytes(b & rng.randrange(256) for b in self.bank[a:a + 4])
+
+    def end_ok(self):
+        im, lib = self.im, self.lib
+        expected = im.image_crc if im.format != OTA_IMAGE_RAW else self.file_crc
+        return (not self.failed and lib.ota_crc_value(self.crc) == expected and self.wire_crc == self.file_crc)
+
+
+def resume_transfer(lib, fails, rng, wire, image, base, ring_size, interval, resets, torn=False):
+    """Streams `wire`, resetting the bootloader after random numbers of steps;
+    each session continues where the record says. Returns (bytes sent,
+    END ok, resets, sessions resumed)."""
+    boot = ResumeBoot(lib, fails, wire, base, ring_size, interval)
+    sent = resumed = 0
+    for session in range(resets + 1):
+        pos = boot.start(want_resume=session > 0)
+        resumed += pos > 0
+        # The ESP32 picks windowed or stop-and-wait per session; either
+        # restarts at the offset the ACK gives
+        chunk = rng.choice([OTA_WINDOW_CHUNK, 200])
+        stop_after = rng.randrange(1, (len(wire) - pos) // chunk + 40) if session < resets else None
+        pending = b""
+        steps = idle = 0
+        while True:
+            if not pending and pos < len(wire) and not boot.failed:
+                pending = wire[pos:pos + chunk]
+                sent += len(pending)
+            if pending and not boot.failed:
+                used = boot.feed(pending)
+                pending = pending[used:]
+                pos += used
+            op = boot.flash_step()
+            steps += 1
+            if stop_after is not None and steps >= stop_after:
+                boot.reset(rng, torn)
+                break
+            if boot.failed or (op == FLASH_OP_DONE and lib.ota_image_done(ctypes.byref(boot.im))):
+                ok = boot.end_ok()
+                fails.check(not ok or boot.bank[:len(image)] == image, "END passed a bank that is not the image")
+                return sent, ok, session, resumed
+            idle = idle + 1 if op == FLASH_OP_NONE and not pending else 0
+            if not fails.check(idle < 10000, "transfer stuck at %d/%d" % (pos, len(wire))):
+                return sent, False, session, resumed
+    return sent, False, resets, resumed
+
+
+def stream(boot, wire, pos, stop):
+    """Windowed chunks from `pos` up to `stop`, then lets the flash drain."""
+    while pos < stop and not boot.failed:
+        chunk = wire[pos:min(stop, pos + OTA_WINDOW_CHUNK)]
+        while chunk and not boot.failed:
+            used = boot.feed(chunk)
+            chunk = chunk[used:]
+            pos += used
+            boot.flash_step()
+    while boot.flash_step() not in (FLASH_OP_NONE, FLASH_OP_DONE) or boot.sched.erasing:
+        pass
+    return pos
+
+
+def check_ota_resume(lib, fails):
+    print("ota_resume")
+    rng = random.Random(36)
+    old = firmware_like(rng, 96 * 1024)
+    new = old[:30000] + firmware_like(rng, 3000) + old[30000:]
+    image = firmware_like(rng, 128 * 1024 + 6)
+    # 16 KB checkpoints: a reset costs about the bytes since the last one
+    files = [
+        ("raw", image, image, None, STAGE_SIZE),
+        ("EFZ1", image, ota_pack.pack(image, 16), None, STAGE_SIZE),
+        ("EFZ1 16K ring", image, ota_pack.pack(image, 14), None, 16 * 1024),
+        ("EFD1", new, ota_pack.pack(new, 16, old), old, STAGE_SIZE),
+    ]
+    for name, img, wire, base, ring_size in files:
+        clean = resume_transfer(lib, fails, rng, wire, img, base, ring_size, 16 * 1024, 0)[0]
+        extra = cuts = resumes = 0
+        for trial in range(8):
+            sent, ok, resets, resumed = resume_transfer(lib, fails, rng, wire, img, base, ring_size, 16 * 1024,
+                                                        rng.randrange(1, 5))
+            fails.check(ok, "%s: END failed after %d resets" % (name, resets))
+            extra += sent - clean
+            cuts += resets
+            resumes += resumed
+        fails.check(len(wire) < 32 * 1024 or resumes > 0, "%s: never resumed" % name)
+        print("  %-14s %7d bytes, %2d resets, %2d resumed, %6.0f bytes resent per reset" %
+              (name, len(wire), cuts, resumes, extra / max(cuts, 1)))
+
+    # Half the file, the flash drained, a reset, the rest
+    wire = ota_pack.pack(image, 16)
+    boot = ResumeBoot(lib, fails, wire, None, STAGE_SIZE, 16 * 1024)
+    stream(boot, wire, boot.start(False), len(wire) // 2)
+    record = list(boot.bkp)
+    fails.check(record[0] != 0, "no checkpoint by half the file")
+    pos = boot.start(True)
+    fails.check(0 < pos <= len(wire) // 2 and pos % OTA_WINDOW_CHUNK == 0, "resumed at %d" % pos)
+    stream(boot, wire, pos, len(wire))
+    fails.check(boot.end_ok() and boot.bank[:len(image)] == image, "resumed image differs")
+
+    # Records that must not be resumed
+    def resumes(bkp, bank=None, file=wire):
+        b = ResumeBoot(lib, fails, file, None, STAGE_SIZE, 16 * 1024)
+        b.bkp = list(bkp)
+        if bank is not None:
+            b.bank = bank
+        return b.start(True) != 0
+    fails.check(resumes(record, boot.bank), "intact record refused")
+    for word in range(OTA_RESUME_WORDS):
+        torn = list(record)
+        torn[word] ^= 1 << rng.randrange(32)
+        fails.check(not resumes(torn, boot.bank), "record with word %d flipped accepted" % word)
+    fails.check(not resumes(record, boot.bank, ota_pack.pack(image, 15)), "record for another file accepted")
+    changed = bytearray(boot.bank)
+    changed[100] ^= 0x01
+    fails.check(not resumes(record, changed), "record accepted over a changed bank")
+
+    # A reset mid-program leaves a half-written word past the checkpoint in
+    # a sector the resume keeps; the transfer cannot fix it and END must say so
+    caught = 0
+    for trial in range(20):
+        boot = ResumeBoot(lib, fails, wire, None, STAGE_SIZE, 16 * 1024)
+        stop = rng.randrange(len(wire) // 4, len(wire) * 3 // 4) // OTA_WINDOW_CHUNK * OTA_WINDOW_CHUNK
+        stream(boot, wire, boot.start(False), stop)
+        boot.reset(rng, torn=True)
+        stream(boot, wire, boot.start(True), len(wire))
+        ok = boot.end_ok()
+        bad = boot.bank[:len(image)] != image
+        fails.check(ok != bad, "END %s a %s bank" % (("passed", "bad") if ok else ("failed", "good")))
+        caught += bad
+    print("  torn program word: %d/20 banks left wrong, END failed all of them" % caught)
+
+
+# --- ota_rx ---
+
+class RxBoard:
+    """ota_rx wired to a model of its port, as the bootloader and the app's
+    OTA task wire it: an erase takes a few polls, the bank and the progress
+    record survive a reset, and programming a word that holds another value
+    than the erased one is an error."""
+
+    def __init__(self, lib, fails, rng, base=None, bank=None, record=None):
+        self.lib, self.fails, self.rng, self.base_image = lib, fails, rng, base
+        if bank is None:
+            bank = (ctypes.c_uint8 * FLASH_SCHED_BANK)()
+            ctypes.memset(bank, 0xFF, FLASH_SCHED_BANK)
+        self.bank = bank
+        self.record = record if record is not None else (ctypes.c_uint32 * OTA_RESUME_WORDS)()
+        self.stage = (ctypes.c_uint8 * STAGE_SIZE)()
+        self.base = u8buf(base or b"")
+        self.erase = None          # [start, end, polls left]
+        self.replies = []
+        self.cbs = (RX_ERASE_START(self.erase_start), RX_ERASE_POLL(self.erase_poll),
+                    RX_PROGRAM(self.program), RX_REPLY(self.reply), RX_IDLE(lambda user: None))
+        self.port = OtaRxPort(*self.cbs, None, self.stage, STAGE_SIZE, self.bank, self.base,
+                              len(base or b""), None, self.record)
+        self.rx = OtaRx()
+        lib.ota_rx_init(ctypes.byref(self.rx), ctypes.byref(self.port), None)
+
+    def erase_start(self, user, sector):
+        self.fails.check(self.erase is None, "erase started during an erase")
+        self.erase = [self.lib.flash_sched_sector_start(sector), self.lib.flash_sched_sector_start(sector + 1),
+                      self.rng.randrange(1, 6)]
+
+    def erase_poll(self, user):
+        self.erase[2] -= 1
+        if self.erase[2] > 0:
+            return 1
+        a, b, _ = self.erase
+        ctypes.memset(ctypes.addressof(self.bank) + a, 0xFF, b - a)
+        self.erase = None
+        return 0
+
+    def program(self, user, offset, data, length):
+        self.fails.check(offset % 4 == 0 and self.erase is None, "program at %d during an erase or unaligned" % offset)
+        new = ctypes.string_at(data, length).ljust((length + 3) // 4 * 4, b"\xff")
+        for i in range(0, len(new), 4):
+            old = bytes(self.bank[offset + i:offset + i + 4])
+            if old == new[i:i + 4]:
+                continue
+            self.fails.check(old == b"\xff" * 4, "word at %d programmed over %s" % (offset + i, old.hex()))
+            self.bank[offset + i:offset + i + 4] = new[i:i + 4]
+        return True
+
+    def reply(self, user, cmd, payload, length):
+        self.replies.append((cmd, ctypes.string_at(payload, length) if length else b""))
+
+    def frame(self, cmd, payload=b""):
+        """One frame; returns the replies it produced."""
+        self.replies = []
+        self.fails.check(self.lib.ota_rx_frame(ctypes.byref(self.rx), cmd, u8buf(payload), len(payload)),
+                         "frame %02X not handled" % cmd)
+        return self.replies
+
+    def poll(self, n=1):
+        busy = False
+        for _ in range(n):
+            busy = self.lib.ota_rx_poll(ctypes.byref(self.rx))
+        return busy
+
+    def drain(self):
+        """Polls until the flash has caught up; returns the replies."""
+        self.replies = []
+        for _ in range(100000):
+            if not self.poll() and not self.rx.end_pending:
+                return self.replies
+        self.fails.check(False, "flash never caught up")
+        return self.replies
+
+    def reset(self):
+        """Power cut: RAM is lost, a sector being erased is left in an
+        unknown state, the bank and the record stay."""
+        if self.erase:
+            a, b, _ = self.erase
+            self.bank[a:b] = bytes(self.rng.randrange(256) for _ in range(b - a))
+        return RxBoard(self.lib, self.fails, self.rng, self.base_image, self.bank, self.record)
+
+
+def rx_start(board, wire, window, flags):
+    """START; returns the offset the ACK gives, None on a NACK."""
+    replies = board.frame(CMD_OTA_START, struct.pack("<IBBHI", len(wire), window, flags, 0, rx_crc(board.lib, wire)))
+    if not replies or replies[0][0] != CMD_OTA_ACK:
+        return None
+    ack = replies[0][1]
+    granted = min(window, board.port.window_max or OTA_WINDOW_MAX)
+    board.fails.check(window == 0 and flags == 0 or ack[:2] == bytes([granted, ack[1]]),
+                      "START ACK %s" % ack.hex())
+    return struct.unpack("<I", ack[2:6])[0] if len(ack) >= 6 else 0
+
+
+def rx_crc(lib, data):
+    return lib.ota_crc32(0, u8buf(data), len(data))
+
+
+def rx_chunk(lib, head, data, flags, bad_crc=False):
+    """CHUNK or WCHUNK payload; the chunk CRC covers the header too."""
+    payload = head + data
+    if not flags & OTA_FLAG_CHUNK_CRC:
+        return payload
+    return payload + struct.pack("<I", rx_crc(lib, payload) ^ (1 if bad_crc else 0))
+
+
+def rx_send_windowed(board, wire, pos, flags, rng, stop=None, loss=0.2):
+    """Selective repeat against the WACKs: chunks of the window lost, sent
+    out of order, duplicated or corrupt; the flash advances a random number
+    of steps between frames. Returns the file bytes acknowledged in order."""
+    total = (len(wire) + OTA_WINDOW_CHUNK - 1) // OTA_WINDOW_CHUNK
+    base, sack = pos // OTA_WINDOW_CHUNK, 0
+    stop = total if stop is None else stop
+    for _ in range(100000):
+        if base >= min(total, stop):
+            break
+        seqs = [q for q in range(base, min(total, base + OTA_WINDOW_MAX))
+                if q == base or not sack >> (q - base - 1) & 1]
+        if rng.random() < 0.5:
+            rng.shuffle(seqs)
+        for q in seqs:
+            if rng.random() < loss:
+                continue
+            data = wire[q * OTA_WINDOW_CHUNK:(q + 1) * OTA_WINDOW_CHUNK]
+            bad = rng.random() < 0.05
+            for _ in range(2 if rng.random() < 0.1 else 1):
+                for cmd, p in board.frame(CMD_OTA_WCHUNK, rx_chunk(board.lib, struct.pack("<H", q), data, flags, bad)):
+                    if not board.fails.check(cmd == CMD_OTA_WACK, "WCHUNK answered %02X" % cmd):
+                        return base * OTA_WINDOW_CHUNK
+                    nb, ns = struct.unpack("<HH", p)
+                    board.fails.check(nb >= base, "WACK went back from %d to %d" % (base, nb))
+                    base, sack = nb, ns
+            board.poll(rng.randrange(0, 4))
+    return min(base * OTA_WINDOW_CHUNK, len(wire))
+
+
+def rx_send_stop_and_wait(board, wire, pos, flags, rng, stop=None, chunk=200):
+    """CHUNK by CHUNK, each held until ACKed; retries of an ACKed chunk are
+    ACKed again, a chunk past the expected offset is NACKed."""
+    stop = len(wire) if stop is None else stop
+    while pos < min(len(wire), stop):
+        data = wire[pos:pos + chunk]
+        if rng.random() < 0.05:
+            replies = board.frame(CMD_OTA_CHUNK, rx_chunk(board.lib, struct.pack("<I", pos + chunk), data, flags))
+            board.fails.check(replies == [(CMD_OTA_NACK, b"")], "chunk past the expected offset not NACKed")
+        replies = board.frame(CMD_OTA_CHUNK, rx_chunk(board.lib, struct.pack("<I", pos), data, flags))
+        if not board.fails.check(replies == [(CMD_OTA_ACK, b"")], "CHUNK at %d answered %s" % (pos, replies)):
+            return pos
+        if pos and rng.random() < 0.05:
+            prev = max(0, pos - chunk)
+            replies = board.frame(CMD_OTA_CHUNK, rx_chunk(board.lib, struct.pack("<I", prev), wire[prev:pos], flags))
+            board.fails.check(replies == [(CMD_OTA_ACK, b"")], "retried CHUNK not ACKed")
+        pos += len(data)
+        board.poll(rng.randrange(0, 3))
+    return pos
+
+
+def rx_end(board, wire):
+    replies = board.frame(CMD_OTA_END, struct.pack("<I", rx_crc(board.lib, wire)))
+    return replies + board.drain()
+
+
+def check_ota_rx(lib, fails):
+    print("ota_rx")
+    rng = random.Random(37)
+    old = firmware_like(rng, 96 * 1024)
+    new = old[:50000] + firmware_like(rng, 2000) + old[50000:]
+    image = firmware_like(rng, 128 * 1024 + 6)
+    files = [("raw", image, image, None), ("EFZ1", image, ota_pack.pack(image, 16), None),
+             ("EFD1", new, ota_pack.pack(new, 16, old), old)]
+
+    # Whole transfers, windowed and stop-and-wait, with and without chunk CRCs
+    for name, img, wire, base in files:
+        for window, flags in ((OTA_WINDOW_MAX, OTA_FLAG_CHUNK_CRC), (OTA_WINDOW_MAX, 0), (0, OTA_FLAG_CHUNK_CRC)):
+            board = RxBoard(lib, fails, rng, base)
+            what = "%s %s%s" % (name, "window" if window else "stop-and-wait", ", chunk crc" if flags else "")
+            if not fails.check(rx_start(board, wire, window, flags) == 0, "%s: START refused" % what):
+                continue
+            send = rx_send_windowed if window else rx_send_stop_and_wait
+            sent = send(board, wire, 0, flags, rng)
+            fails.check(sent == len(wire), "%s: stuck at %d/%d" % (what, sent, len(wire)))
+            fails.check(rx_end(board, wire) == [(CMD_OTA_ACK, b"")], "%s: END not ACKed" % what)
+            fails.check(board.rx.verified and bytes(board.bank[:len(img)]) == img, "%s: bank differs" % what)
+            fails.check(board.record[0] == 0, "%s: progress record left after END" % what)
+        print("  %-5s %7d bytes: windowed and stop-and-wait OK" % (name, len(wire)))
+
+    # END that does not match, END before the whole file, a patch for
+    # another image
+    board = RxBoard(lib, fails, rng)
+    rx_start(board, image, OTA_WINDOW_MAX, 0)
+    fails.check(board.frame(CMD_OTA_END, struct.pack("<I", 0)) == [(CMD_OTA_NACK, b"")], "early END not NACKed")
+    rx_send_windowed(board, image, 0, 0, rng, loss=0)
+    replies = board.frame(CMD_OTA_END, struct.pack("<I", rx_crc(lib, image) ^ 1)) + board.drain()
+    fails.check(replies == [(CMD_OTA_NACK, b"")] and not board.rx.verified, "END with a wrong CRC accepted")
+    board = RxBoard(lib, fails, rng, old[:-1] + b"\0")
+    wire = files[2][2]
+    rx_start(board, wire, OTA_WINDOW_MAX, 0)
+    q = struct.pack("<H", 0) + wire[:OTA_WINDOW_CHUNK]
+    replies = board.frame(CMD_OTA_WCHUNK, q)
+    fails.check(board.rx.failed and board.frame(CMD_OTA_WCHUNK, struct.pack("<H", 1) + wire[240:480]) ==
+                [(CMD_OTA_NACK, b"")], "patch for another image not refused")
+
+    # A port that caps the window (the app, to what its UART ring holds)
+    # grants no more, whatever the sender asks for
+    board = RxBoard(lib, fails, rng)
+    board.port.window_max = 6
+    fails.check(rx_start(board, image, OTA_WINDOW_MAX, 0) == 0 and board.rx.window == 6,
+                "window_max 6: granted %d" % board.rx.window)
+
+    # Resets at random points; each restart asks what the receiver holds and
+    # continues from there, windowed or stop-and-wait
+    for name, img, wire, base in files:
+        cuts = resumed = 0
+        for trial in range(4):
+            board = RxBoard(lib, fails, rng, base)
+            sessions, pos = rng.randrange(2, 6), 0
+            for session in range(sessions):
+                progress = board.frame(CMD_OTA_QUERY)
+                fails.check(len(progress) == 1 and progress[0][0] == CMD_OTA_PROGRESS, "QUERY not answered")
+                size, crc, offset = struct.unpack("<III", progress[0][1])
+                held = size == len(wire) and crc == rx_crc(board.lib, wire) and offset > 0
+                window = rng.choice([OTA_WINDOW_MAX, 0])
+                flags = OTA_FLAG_CHUNK_CRC | (OTA_FLAG_RESUME if held else 0)
+                pos = rx_start(board, wire, window, flags)
+                if held:
+                    fails.check(pos == offset, "%s: resumed at %s, PROGRESS said %d" % (name, pos, offset))
+                    resumed += 1
+                last = session == sessions - 1
+                stop = None if last else rng.randrange(len(wire) // 2)
+                if window:
+                    rx_send_windowed(board, wire, pos, flags, rng,
+                                     None if last else stop // OTA_WINDOW_CHUNK + 1)
+                else:
+                    rx_send_stop_and_wait(board, wire, pos, flags, rng, stop)
+                if not last:
+                    board.poll(rng.randrange(0, 200))
+                    board = board.reset()
+                    cuts += 1
+            ok = rx_end(board, wire) == [(CMD_OTA_ACK, b"")]
+            fails.check(ok and bytes(board.bank[:len(img)]) == img, "%s: resumed transfer failed" % name)
+        fails.check(len(wire) < 32 * 1024 or resumed > 0, "%s: never resumed" % name)
+        print("  %-5s %2d resets, %2d resumed from the record" % (name, cuts, resumed))
+
+    # Nothing held: PROGRESS is all zero, a RESUME START starts over
+    board = RxBoard(lib, fails, rng)
+    fails.check(board.frame(CMD_OTA_QUERY) == [(CMD_OTA_PROGRESS, bytes(12))], "empty record not reported as zeros")
+    fails.check(rx_start(board, image, OTA_WINDOW_MAX, OTA_FLAG_RESUME) == 0, "RESUME without a record")
+    fails.check(not board.lib.ota_rx_frame(ctypes.byref(board.rx), CMD_OTA_APPLY, u8buf(b""), 0),
+                "APPLY taken by the receiver")
+
+
+def main():
+    lib = build_lib()
+    fails = host_build.Failures()
+    check_flash_sched(lib, fails)
+    check_ota_crc(lib, fails)
+    check_ota_image(lib, fails)
+    check_ota_delta(lib, fails)
+    check_ota_resume(lib, fails)
+    check_ota_rx(lib, fails)
+    print("FAILED: %d" % fails.count if fails.count else "PASS")
+    return 1 if fails.count else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
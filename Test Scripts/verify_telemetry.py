@@ -0,0 +1,569 @@
+#!/usr/bin/env python3
+import ctypes
+import glob
+import math
+import os
+import random
+import struct
+import sys
+
+# Host checks for the STM32's telemetry recorder (src/telemetry.c) and its
+# columnar blocks (lib/EcoFlowComm/telem_block.c).
+#
+# Builds telemetry.c next to the LogManager host build (tools/log_host): the
+# real FatFs over a RAM disk that counts sector reads, a clock the test
+# drives, and UART frames captured instead of sent. Every device type is fed
+# a week of synthetic DeviceStatus samples (solar following the sun, loads
+# switching, a slowly cycling battery, a device dropping out for hours).
+#
+#   blocks      every block is TELEM_BLOCK_SIZE bytes with a valid CRC, holds
+#               one device and one day, and decodes (by an independent
+#               decoder here) to exactly the samples taken, in order; one
+#               sample per TELEM_PERIOD_S at most, none while disconnected.
+#   index       entry n of each .idx is block n's header and column index,
+#               and its T0/T1/min/max are those of the block's samples.
+#   size        bytes on the card per sample (blocks and index), against the
+#               DeviceStatus it came from and a text log line of it.
+#   query       CMD_TELEM_QUERY answers match a brute-force min/max over the
+#               samples for ranges from minutes to the whole week, across
+#               midnight and into samples not on the card yet; a week-long
+#               query decodes only the blocks that straddle a bucket.
+#   errors      an unknown field gets an empty answer; a block written
+#               without its index entry is overwritten by the next one; a
+#               clock set back drops samples until it passes the last one.
+#   prune       short of space, whole days are deleted oldest first and the
+#               recent ones stay queryable.
+#   uart task   Telemetry_Record never touches the card: closed blocks reach
+#               it through Telemetry_Service, the log task's pass. A query is
+#               answered over Telemetry_Process steps of about
+#               TELEM_STEP_BYTES each. With the log task held off, a second
+#               closed block writes the first itself and nothing is lost.
+#
+# Usage: python3 "Test Scripts/verify_telemetry.py"
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+STM_DIR = os.path.join(REPO, "EcoflowSTM32F4")
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools", "log_host")
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import host_build  # noqa: E402
+
+BLOCK = 512
+HDR = 16
+COL = 10
+MAGIC = 0x4254
+DAY = 86400
+PERIOD = 10
+MIN_FREE = 64 * 1024 * 1024
+STEP_BYTES = 8192
+CMD_TELEM_DATA = 0x28
+DATA_OFF = 19            # DeviceStatus: id, connected, name[16], brightness, then the union
+STATUS_SIZE = 512        # Larger than any DeviceStatus
+EPOCH0 = 1782000000 - 1782000000 % DAY + 5 * 3600  # 05:00 UTC on a 2026 day
+DAYS = 7
+DISK_SECTORS = 160 * 2048
+
+DEVICES = {1: "Delta 3", 2: "Delta Pro 3", 3: "Wave 2", 4: "Alternator Charger"}
+
+
+class TelemField(ctypes.Structure):
+    _fields_ = [("name", ctypes.c_char_p), ("unit", ctypes.c_char_p), ("off", ctypes.c_uint16),
+                ("off2", ctypes.c_uint16), ("type", ctypes.c_uint8), ("scale", ctypes.c_uint16)]
+
+
+class TelemQueryMsg(ctypes.Structure):
+    _pack_ = 1
+    _fields_ = [("id", ctypes.c_uint8), ("dev", ctypes.c_uint8), ("field", ctypes.c_uint8),
+                ("from_", ctypes.c_uint32), ("to", ctypes.c_uint32), ("points", ctypes.c_uint16)]
+
+
+def build_lib():
+    fatfs = os.path.join(STM_DIR, "lib", "FatFs")
+    comm = os.path.join(STM_DIR, "lib", "EcoFlowComm")
+    srcs = [os.path.join(HOST_DIR, "log_host.c"), os.path.join(STM_DIR, "src", "telemetry.c"),
+            os.path.join(fatfs, "ff.c"), os.path.join(fatfs, "ffunicode.c"), os.path.join(fatfs, "ffsystem.c"),
+            os.path.join(comm, "ecoflow_protocol.c"), os.path.join(comm, "ota_crc.c"),
+            os.path.join(comm, "log_record.c"), os.path.join(comm, "log_index.c"), os.path.join(comm, "telem_block.c"),
+            os.path.join(comm, "log_levels.c")]
+    deps = srcs + glob.glob(os.path.join(HOST_DIR, "*.h")) + [
+        os.path.join(STM_DIR, "src", "log_manager.c"), os.path.join(STM_DIR, "src", "telemetry.h"),
+        os.path.join(fatfs, "ffconf.h"), os.path.join(comm, "telem_block.h"), os.path.join(comm, "ecoflow_protocol.h")]
+    u32 = ctypes.c_uint32
+    sigs = {
+        "host_disk_init": (None, [u32]),
+        "host_counters_reset": (None, []),
+        "host_counters": (None, [ctypes.POINTER(u32)]),
+        "host_set_time": (None, [u32]),
+        "host_reset": (None, [ctypes.c_int]),
+        "host_read_file": (ctypes.c_long, [ctypes.c_char_p, ctypes.POINTER(ctypes.c_uint8), u32]),
+        "host_write_file": (ctypes.c_long, [ctypes.c_char_p, ctypes.POINTER(ctypes.c_uint8), u32]),
+        "host_stat": (ctypes.c_int, [ctypes.c_char_p]),
+        "host_free": (u32, []),
+        "host_fill": (ctypes.c_int, [ctypes.c_char_p, u32]),
+        "host_capture_frames": (None, [ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint8), u32]),
+        "host_captured": (u32, []),
+        "LogManager_Init": (None, []),
+        "telem_fields": (ctypes.POINTER(TelemField), [ctypes.c_uint8, ctypes.POINTER(ctypes.c_int)]),
+        "Telemetry_SetTime": (None, [u32]),
+        "Telemetry_Record": (None, [ctypes.c_char_p]),
+        "Telemetry_HandleQuery": (None, [ctypes.POINTER(TelemQueryMsg)]),
+        "Telemetry_Process": (None, []),
+        "Telemetry_Service": (None, []),
+        "Telemetry_Flush": (None, []),
+    }
+    # -Wno-format: the firmware prints uint32_t with %lu
+    flags = ["-Wall", "-Wextra", "-Werror", "-Wno-format", "-Wno-unused-parameter", "-I", HOST_DIR,
+             "-I", os.path.join(STM_DIR, "src"), "-I", fatfs, "-I", comm]
+    return host_build.build_lib(srcs, sigs, flags, "telem_host", deps)
+
+
+# --- Reference decoder, written from telem_block.h ---
+
+def crc32_bzip2(data):
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc ^= b << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF if crc & 0x80000000 else (crc << 1) & 0xFFFFFFFF
+    return crc ^ 0xFFFFFFFF
+
+
+def varint(b, pos):
+    v = shift = 0
+    while True:
+        c = b[pos]
+        pos += 1
+        v |= (c & 0x7F) << shift
+        shift += 7
+        if not c & 0x80:
+            return v, pos
+
+
+def unzigzag(z):
+    return (z >> 1) ^ -(z & 1)
+
+
+def wrap32(v):
+    return (v + 2 ** 31) % 2 ** 32 - 2 ** 31
+
+
+def decode_block(blk):
+    """(dev, [(t, [vals])], header) or None if the block is not valid."""
+    if len(blk) != BLOCK or struct.unpack_from("<I", blk, BLOCK - 4)[0] != crc32_bzip2(blk[:BLOCK - 4]):
+        return None
+    magic, dev, cols, count, _, t0, t1 = struct.unpack_from("<HBBHHII", blk)
+    if magic != MAGIC:
+        return None
+    colhdr = [struct.unpack_from("<iiH", blk, HDR + COL * c) for c in range(cols)]
+    times = [t0]
+    pos = HDR + COL * cols
+    for _ in range(count - 1):
+        d, pos = varint(blk, pos)
+        times.append(times[-1] + d)
+    columns = []
+    for _, _, off in colhdr:
+        z, pos = varint(blk, off)
+        v = unzigzag(z)
+        vals = [v]
+        for _ in range(count - 1):
+            z, pos = varint(blk, pos)
+            v = wrap32(v + unzigzag(z))
+            vals.append(v)
+        columns.append(vals)
+    samples = [(times[i], [columns[c][i] for c in range(cols)]) for i in range(count)]
+    return dev, samples, {"t0": t0, "t1": t1, "cols": colhdr}
+
+
+# --- Synthetic devices ---
+
+def fields(lib, dev):
+    n = ctypes.c_int()
+    f = lib.telem_fields(dev, ctypes.byref(n))
+    return [f[i] for i in range(n.value)]
+
+
+class Device:
+    """One device's DeviceStatus over time; value(t) gives the stored integers."""
+
+    def __init__(self, lib, dev, rng):
+        self.dev = dev
+        self.fields = fields(lib, dev)
+        self.rng = rng
+        self.state = {}
+        self.buf = bytearray(STATUS_SIZE)
+        self.buf[0] = dev
+        self.buf[1] = 1
+
+    def target(self, f, t):
+        """Stored value of field `f` at time `t`, a plausible signal for its unit."""
+        name = f.name.decode()
+        key = name
+        hour = (t % DAY) / 3600.0
+        sun = max(0.0, math.sin((hour - 6) / 12 * math.pi))
+        r = self.rng
+        if f.unit == b"W":
+            if "solar" in name or name == "in":
+                v = int(sun * 380 * (0.8 + 0.2 * math.sin(t / 900))) + r.randint(-2, 2) * (sun > 0)
+            else:
+                # Loads switching on and off, with a little ripple
+                on = self.state.get(key, 0)
+                if r.random() < 0.01:
+                    on = r.choice([0, 0, 45, 120, 300, 1200])
+                    self.state[key] = on
+                v = on + (r.randint(-3, 3) if on else 0)
+            return v * f.scale
+        if f.unit == b"%":
+            # Slowly cycling battery, in tenths where scaled
+            base = 60 + 35 * math.sin(t / (DAY / (2 * math.pi)))
+            return int(base * f.scale)
+        if f.unit == b"C":
+            return int((24 + 4 * math.sin(t / 7200) + r.random() * 0.2) * f.scale)
+        if f.unit == b"V":
+            return int((12.6 + 0.4 * sun) * f.scale) + r.randint(-2, 2)
+        # Modes and settings: rare steps
+        if r.random() < 0.001:
+            self.state[key] = r.randint(0, 5)
+        return self.state.get(key, 1) * f.scale
+
+    def sample(self, t):
+        vals = []
+        for f in self.fields:
+            v = self.target(f, t)
+            vals.append(v)
+            if f.type == 0:  # TELEM_F32
+                if f.off2 != 0xFFFF:
+                    a = v // 2
+                    struct.pack_into("<f", self.buf, DATA_OFF + f.off, a / f.scale)
+                    struct.pack_into("<f", self.buf, DATA_OFF + f.off2, (v - a) / f.scale)
+                else:
+                    struct.pack_into("<f", self.buf, DATA_OFF + f.off, v / f.scale)
+            else:
+                struct.pack_into("<i", self.buf, DATA_OFF + f.off, v)
+        return vals
+
+
+def counters(lib):
+    out = (ctypes.c_uint32 * 4)()
+    lib.host_counters(out)
+    return list(out)
+
+
+def read_file(lib, name, cap=4 << 20):
+    buf = (ctypes.c_uint8 * cap)()
+    n = lib.host_read_file(name.encode(), buf, cap)
+    return None if n < 0 else bytes(buf[:n])
+
+
+class Recorder:
+    """Drives the recorder: clock, samples and what it should have taken."""
+
+    def __init__(self, lib, rng):
+        self.lib = lib
+        self.devices = {d: Device(lib, d, rng) for d in DEVICES}
+        self.expected = {d: [] for d in DEVICES}  # [(t, vals)] the recorder should take
+        self.last = {d: None for d in DEVICES}
+        self.epoch = None
+        self.tick0 = 0
+        self.service = True      # The log task runs between statuses
+        self.record_io = 0       # Sector reads and writes inside Telemetry_Record
+
+    def set_time(self, epoch, tick_ms):
+        self.lib.host_set_time(tick_ms)
+        self.lib.Telemetry_SetTime(epoch)
+        self.epoch = epoch
+        self.tick0 = tick_ms
+
+    def now(self, tick_ms):
+        return self.epoch + (tick_ms - self.tick0) // 1000
+
+    def feed(self, dev, tick_ms, connected=True):
+        d = self.devices[dev]
+        t = self.now(tick_ms)
+        self.lib.host_set_time(tick_ms)
+        vals = d.sample(t)
+        d.buf[1] = 1 if connected else 0
+        before = counters(self.lib)
+        self.lib.Telemetry_Record(bytes(d.buf))
+        after = counters(self.lib)
+        self.record_io += (after[0] - before[0]) + (after[2] - before[2])
+        if self.service:
+            self.lib.Telemetry_Service()
+        last = self.last[dev]
+        if connected and (last is None or (t >= last and t - last >= PERIOD)):
+            self.expected[dev].append((t, vals))
+            self.last[dev] = t
+
+
+def day_files(lib, dev, day):
+    blk = read_file(lib, "telem/%d_%d.blk" % (dev, day))
+    idx = read_file(lib, "telem/%d_%d.idx" % (dev, day))
+    return blk, idx
+
+
+def card_samples(lib, dev, days, f, what):
+    """All samples of a device on the card, checking each block and index entry."""
+    ncols = len(fields(lib, dev))
+    entry = HDR + COL * ncols
+    out = []
+    nbytes = 0
+    blocks = 0
+    for day in days:
+        blk, idx = day_files(lib, dev, day)
+        if blk is None:
+            continue
+        nbytes += len(blk) + len(idx)
+        if not f.check(len(blk) % BLOCK == 0 and len(idx) == len(blk) // BLOCK * entry,
+                       "%s: dev %d day %d: %d block bytes, %d index bytes" % (what, dev, day, len(blk), len(idx))):
+            continue
+        for n in range(len(blk) // BLOCK):
+            b = blk[n * BLOCK:(n + 1) * BLOCK]
+            dec = decode_block(b)
+            if not f.check(dec is not None and dec[0] == dev, "%s: dev %d day %d block %d invalid" % (what, dev, day, n)):
+                continue
+            _, samples, hdr = dec
+            blocks += 1
+            f.check(idx[n * entry:(n + 1) * entry] == b[:entry],
+                    "%s: dev %d day %d entry %d differs from the block header" % (what, dev, day, n))
+            f.check(all(t // DAY == day for t, _ in samples), "%s: dev %d block %d spans days" % (what, dev, n))
+            f.check(hdr["t0"] == samples[0][0] and hdr["t1"] == samples[-1][0],
+                    "%s: dev %d day %d block %d T0/T1 wrong" % (what, dev, day, n))
+            for c, (lo, hi, _) in enumerate(hdr["cols"]):
+                col = [v[c] for _, v in samples]
+                f.check(lo == min(col) and hi == max(col),
+                        "%s: dev %d block %d col %d min/max %d/%d, samples %d/%d" % (what, dev, n, c, lo, hi, min(col), max(col)))
+            out.extend(samples)
+    return out, nbytes, blocks
+
+
+def parse_frames(data, qid):
+    result = {}
+    total = None
+    pos = 0
+    while pos < len(data):
+        n = data[pos + 2]
+        payload = data[pos + 3:pos + 3 + n]
+        pos += 4 + n
+        rid, total, first, count = struct.unpack_from("<BHHB", payload)
+        assert rid == qid
+        for i in range(count):
+            result[first + i] = struct.unpack_from("<ii", payload, 6 + 8 * i)
+    return total, result
+
+
+def query(lib, dev, field, t_from, t_to, points, qid=7, steps=None):
+    """Runs a query to its end. `steps`, if given, collects the sector reads
+    of each Telemetry_Process call."""
+    cap = 8192
+    buf = (ctypes.c_uint8 * cap)()
+    lib.host_capture_frames(CMD_TELEM_DATA, buf, cap)
+    msg = TelemQueryMsg(qid, dev, field, t_from, t_to, points)
+    lib.host_counters_reset()
+    lib.Telemetry_HandleQuery(ctypes.byref(msg))
+    total, result = parse_frames(bytes(buf[:lib.host_captured()]), qid)
+    for _ in range(10000):
+        if total is not None and len(result) == total:
+            break
+        before = counters(lib)[2]
+        lib.Telemetry_Process()
+        if steps is not None:
+            steps.append(counters(lib)[2] - before)
+        total, result = parse_frames(bytes(buf[:lib.host_captured()]), qid)
+    reads = counters(lib)[2]
+    lib.host_capture_frames(0, None, 0)
+    return total, [result.get(i) for i in range(total or 0)], reads
+
+
+def brute(samples, field, t_from, t_to, points):
+    out = [(2 ** 31 - 1, -2 ** 31)] * points
+    for t, vals in samples:
+        if t_from <= t < t_to:
+            b = (t - t_from) * points // (t_to - t_from)
+            lo, hi = out[b]
+            out[b] = (min(lo, vals[field]), max(hi, vals[field]))
+    return out
+
+
+def check_week(lib, rec, f):
+    print("blocks/index/size: %d days of 4 devices, one status per device every 5 s" % DAYS)
+    days = range(EPOCH0 // DAY, EPOCH0 // DAY + DAYS + 1)
+    # The recorder's samples so far are all in full blocks or its RAM
+    for dev in DEVICES:
+        on_card, nbytes, blocks = card_samples(lib, dev, days, f, "week")
+        exp = rec.expected[dev]
+        f.check(on_card == exp[:len(on_card)], "week: dev %d card samples differ from those taken" % dev)
+        f.check(0 < len(exp) - len(on_card) < BLOCK, "week: dev %d: %d of %d samples not on the card"
+                % (dev, len(exp) - len(on_card), len(exp)))
+        f.check(all(b[0] - a[0] >= PERIOD for a, b in zip(exp, exp[1:])), "week: dev %d sampled too often" % dev)
+        ncols = len(rec.devices[dev].fields)
+        per = nbytes / len(on_card)
+        status = DATA_OFF + {1: 113, 2: 136, 3: 142, 4: 57}[dev]
+        text = sum(len("%s=%d " % (fl.name.decode(), v)) for fl, v in zip(rec.devices[dev].fields, exp[0][1])) + 24
+        print("  %-18s %d cols: %6d samples in %4d blocks, %.1f B/sample (%.2f B/value), "
+              "DeviceStatus %d B, text line ~%d B" % (DEVICES[dev], ncols, len(on_card), blocks, per,
+                                                       per / (ncols + 1), status, text))
+        f.check(per < 24, "size: dev %d at %.1f bytes per sample" % (dev, per))
+    return days
+
+
+def check_query(lib, rec, f):
+    print("query")
+    end = rec.expected[1][-1][0] + 1
+    start = rec.expected[1][0][0]
+    ranges = [
+        ("10 min", end - 600, end, 60),
+        ("1 h, RAM only", end - 3600, end, 120),
+        ("across midnight", (start // DAY + 2) * DAY - 5400, (start // DAY + 2) * DAY + 5400, 180),
+        ("1 day", end - DAY, end, 240),
+        ("week", start, end, 240),
+        ("week, 7 points", start, end, 7),
+        ("before the data", start - 3 * DAY, start - DAY, 50),
+    ]
+    for dev in DEVICES:
+        for field in range(len(rec.devices[dev].fields)):
+            for name, t_from, t_to, points in ranges:
+                if dev != 1 and field > 1 and name != "week":
+                    continue
+                total, got, reads = query(lib, dev, field, t_from, t_to, points)
+                exp = brute(rec.expected[dev], field, t_from, t_to, points)
+                f.check(total == points and got == exp, "query: dev %d field %d %s: %d buckets differ"
+                        % (dev, field, name, sum(1 for a, b in zip(got, exp) if a != b) if got else points))
+
+    # What the index saves on a long range: blocks decoded vs blocks in range
+    total, got, reads = query(lib, 1, 5, start, end, 240)
+    days = range(start // DAY, end // DAY + 1)
+    blocks = sum(len(day_files(lib, 1, d)[0] or b"") // BLOCK for d in days)
+    print("  week of Delta 3 solar in 240 points: %d sector reads, %d blocks on the card" % (reads, blocks))
+    f.check(reads < blocks * 0.75, "query: %d sector reads for %d blocks, the index is not used" % (reads, blocks))
+    total, got, reads = query(lib, 1, 5, end - 600, end, 30)
+    print("  last 10 minutes: %d sector reads" % reads)
+
+    total, got, _ = query(lib, 1, 200, start, end, 10)
+    f.check(total == 0, "errors: unknown field answered with %s buckets" % total)
+    total, got, _ = query(lib, 9, 0, start, end, 10)
+    f.check(total == 0, "errors: unknown device answered with %s buckets" % total)
+
+
+def check_torn(lib, rec, f, tick):
+    print("errors: block without index entry, clock set back")
+    dev = 3
+    # Flush, then a block that made it to the card without its entry
+    lib.Telemetry_Flush()
+    day = rec.expected[dev][-1][0] // DAY
+    blk, idx = day_files(lib, dev, day)
+    # A copy of the last block, valid on its own, that has no index entry
+    name = "telem/%d_%d.blk" % (dev, day)
+    data = blk + blk[-BLOCK:]
+    buf = (ctypes.c_uint8 * len(data)).from_buffer_copy(data)
+    f.check(lib.host_write_file(name.encode(), buf, len(data)) == len(data), "errors: could not stage a stray block")
+
+    # Clock back by an hour: nothing taken until it passes the last sample
+    last = rec.expected[dev][-1][0]
+    rec.set_time(last - 3600, tick)
+    for _ in range(360 * 2 + 400):
+        tick += 5000
+        for d in DEVICES:
+            rec.feed(d, tick)
+    lib.Telemetry_Flush()
+    days = range(EPOCH0 // DAY, day + 2)
+    on_card, _, _ = card_samples(lib, dev, days, f, "torn")
+    f.check(on_card == rec.expected[dev], "errors: dev %d samples after the stray block differ (%d vs %d)"
+            % (dev, len(on_card), len(rec.expected[dev])))
+    f.check(all(b[0] > a[0] for a, b in zip(on_card, on_card[1:])), "errors: samples out of order after the clock went back")
+    return tick
+
+
+def check_uart_task(lib, rec, f, tick):
+    print("uart task: no card access in Telemetry_Record, stepped queries")
+    f.check(rec.record_io == 0, "uart task: %d sector reads and writes inside Telemetry_Record" % rec.record_io)
+    end = rec.expected[1][-1][0] + 1
+    start = rec.expected[1][0][0]
+    steps = []
+    total, got, reads = query(lib, 1, 5, start, end, 240, steps=steps)
+    f.check(got == brute(rec.expected[1], 5, start, end, 240), "uart task: stepped week query differs")
+    # A step may end a block or day past its budget, and pays for opens and FAT reads
+    bound = (STEP_BYTES + BLOCK) // 512 + 8
+    print("  week query: %d steps, %d sector reads, at most %d per step" % (len(steps), reads, max(steps)))
+    f.check(len(steps) > 1 and max(steps) <= bound, "uart task: %d sector reads in one step" % max(steps))
+
+    # The log task held off for two blocks' time
+    dev = 2
+    days = range(EPOCH0 // DAY, rec.expected[dev][-1][0] // DAY + 2)
+    rec.service = False
+    rec.record_io = 0
+    for _ in range(3 * 60 * 6):
+        tick += 5000
+        for d in DEVICES:
+            rec.feed(d, tick)
+    print("  log task held off for 15 min: %d sector reads and writes in Telemetry_Record" % rec.record_io)
+    f.check(rec.record_io > 0, "uart task: no block was written with the log task held off")
+    rec.service = True
+    lib.Telemetry_Flush()
+    on_card, _, _ = card_samples(lib, dev, days, f, "held off")
+    f.check(on_card == rec.expected[dev], "uart task: dev %d lost samples with the log task held off (%d vs %d)"
+            % (dev, len(on_card), len(rec.expected[dev])))
+    return tick
+
+
+def check_prune(lib, rec, f, tick):
+    print("prune: card short of space")
+    lib.Telemetry_Flush()
+    lib.host_reset(1)
+    lib.host_disk_init(96 * 2048)
+    lib.LogManager_Init()
+    # Room above the limit for about two and a half days of all devices
+    day_bytes = 4 * (DAY // PERIOD) * 16 * 11 // 10
+    lib.host_fill(b"filler.bin", lib.host_free() - MIN_FREE - day_bytes * 5 // 2)
+    start = (rec.expected[1][-1][0] // DAY + 1) * DAY + 60
+    rec.set_time(start, tick)
+    for d in DEVICES:
+        rec.expected[d] = []
+    for _ in range(5 * DAY // 10):
+        tick += 10000
+        for d in DEVICES:
+            rec.feed(d, tick)
+    lib.Telemetry_Flush()
+    first = start // DAY
+    last = rec.expected[1][-1][0] // DAY
+    kept = [day for day in range(first, last + 1) if lib.host_stat(("telem/1_%d.blk" % day).encode()) == 0]
+    print("  days %d..%d recorded, kept: %s" % (0, last - first, [d - first for d in kept]))
+    f.check(kept and kept[-1] == last and kept[0] > first, "prune: kept days %s of %d..%d" % (kept, first, last))
+    f.check(kept == list(range(kept[0], last + 1)), "prune: days kept are not the newest ones: %s" % kept)
+    f.check(len(kept) >= 2, "prune: only %d days left" % len(kept))
+    t_to = rec.expected[1][-1][0] + 1
+    total, got, _ = query(lib, 1, 0, start, t_to, 100)
+    exp = brute([s for s in rec.expected[1] if s[0] // DAY in kept], 0, start, t_to, 100)
+    f.check(got == exp, "prune: query over deleted and kept days differs")
+
+
+def main():
+    lib = build_lib()
+    f = host_build.Failures()
+    rng = random.Random(45)
+    lib.host_disk_init(DISK_SECTORS)
+    lib.LogManager_Init()
+
+    rec = Recorder(lib, rng)
+    tick = 1000
+    rec.set_time(EPOCH0, tick)
+    # Statuses every 5 s, Wave 2 off for six hours on day 3
+    for step in range(DAYS * DAY // 5):
+        tick += 5000
+        t = rec.now(tick)
+        for dev in DEVICES:
+            rec.feed(dev, tick, connected=not (dev == 3 and 2 * DAY + 3600 <= t - EPOCH0 < 2 * DAY + 7 * 3600))
+
+    check_week(lib, rec, f)
+    check_query(lib, rec, f)
+    tick = check_torn(lib, rec, f, tick)
+    tick = check_uart_task(lib, rec, f, tick)
+    check_prune(lib, rec, f, tick)
+
+    if f.count:
+        print("FAILED: %d check(s)" % f.count)
+        return 1
+    print("PASS")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())